@@ -662,6 +662,14 @@ int main(int argc, char *argv[])
 
 	if (fr_radmin_start(config, radmin) < 0) EXIT_WITH_FAILURE;
 
+#ifdef HAVE_OPENSSL_CRYPTO_H
+	/*
+	 *	Only now that radmin is running can the TLS
+	 *	commands be registered.
+	 */
+	fr_tls_session_init();
+#endif
+
 	/*
 	 *  Disconnect from session
 	 */
@@ -802,6 +810,15 @@ int main(int argc, char *argv[])
 	 */
 	if (log_global_init(&default_log, config->daemonize) < 0) EXIT_WITH_FAILURE;
 
+	/*
+	 *	Start the threads which do CPU-heavy work (such as
+	 *	password hashing) on behalf of the workers.
+	 */
+	if (unlang_offload_init(config->num_offload_threads, config->offload_queue_size) < 0) {
+		PERROR("Failed starting offload threads");
+		EXIT_WITH_FAILURE;
+	}
+
 	/*
 	 *	Start the network / worker threads.
 	 */
@@ -813,10 +830,16 @@ int main(int argc, char *argv[])
 		schedule->max_workers = config->max_workers;
 		schedule->max_networks = config->max_networks;
 		schedule->stats_interval = config->stats_interval;
+		schedule->shard_listeners = config->shard_listeners;
+		schedule->shard_by_src_ipaddr = config->shard_by_src_ipaddr;
+		schedule->cpu_affinity = config->cpu_affinity;
+		schedule->timer_wheel_tick = config->timer_wheel_tick;
 
 		schedule->network.max_outstanding = config->max_requests;
 		schedule->worker.max_requests = config->max_requests;
 		schedule->worker.max_request_time = config->max_request_time;
+		schedule->worker.zero_copy = config->zero_copy;
+		schedule->worker.talloc_pool_size = config->talloc_pool_size;
 
 		/*
 		 *	Single server mode: use the global event list.
@@ -1051,6 +1074,12 @@ cleanup:
 	 */
 	(void) fr_schedule_destroy(&sc);
 
+	/*
+	 *	The workers have all exited, so nothing can be
+	 *	waiting for the offload threads.
+	 */
+	unlang_offload_free();
+
 	/*
 	 *  Frees request specific logging resources which is OK
 	 *  because all the requests will have been stopped.
@@ -267,7 +267,7 @@ static request_t *request_from_file(TALLOC_CTX *ctx, FILE *fp, RADCLIENT *client
 	request->reply->id = request->packet->id;
 	request->reply->code = 0; /* UNKNOWN code */
 	memcpy(request->reply->vector, request->packet->vector, sizeof(request->reply->vector));
-	fr_pair_list_init(&request->reply_pairs);
+	fr_pair_list_free(&request->reply_pairs);
 	request->reply->data = NULL;
 	request->reply->data_len = 0;
 
@@ -81,6 +81,20 @@ typedef int (*fr_app_open_t)(void *instance, fr_schedule_t *sc, CONF_SECTION *cs
  */
 typedef int (*fr_app_priority_get_t)(void const *instance, uint8_t const *buffer, size_t buflen);
 
+/** Verify the signatures of a burst of packets, before they're decoded
+ *
+ * Called by the worker with consecutive packets from the same listener,
+ * so that the work for all of them can be done in one pass.  Packets
+ * which pass should have cd->request.verified set.  Packets which fail
+ * should be left alone, and the decoder will check them again (and
+ * report why they failed).
+ *
+ * @param[in] instance	of the #fr_app_t.
+ * @param[in] cd	packets to verify.
+ * @param[in] num	number of packets.
+ */
+typedef void (*fr_app_verify_t)(void const *instance, fr_channel_data_t **cd, size_t num);
+
 /** Called by the network thread to pass an event list for the module to use for timer events
  */
 typedef void (*fr_app_event_list_set_t)(fr_listen_t *li, fr_event_list_t *el, void *nr);
@@ -119,6 +133,9 @@ typedef struct {
 							///< to all #fr_app_io_t can be performed by the #fr_app_t.
 
 	fr_app_priority_get_t		priority;	//!< Assign a priority to the packet.
+
+	fr_app_verify_t			verify;		//!< Check the signatures of a burst of packets.
+							///< May be NULL.
 } fr_app_t;
 
 /** Public structure describing an application (protocol) specialisation
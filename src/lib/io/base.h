@@ -43,6 +43,7 @@ typedef struct {
 	uint64_t	out;
 	uint64_t	dup;
 	uint64_t	dropped;
+	uint64_t	bytes_copied;	//!< packet data copied between the network and worker threads.
 } fr_io_stats_t;
 
 
@@ -44,11 +44,6 @@ RCSID("$Id$")
 #define MPRINT(...)
 #endif
 
-/*
- *	We disable this until we fix all of the signaling issues...
- */
-#define ENABLE_SKIPS (0)
-
 typedef enum {
 	TO_RESPONDER = 0,
 	TO_REQUESTOR = 1
@@ -62,10 +57,6 @@ static fr_table_num_sorted_t const channel_direction[] = {
 size_t channel_direction_len = NUM_ELEMENTS(channel_direction);
 #endif
 
-#if 0
-#define SIGNAL_INTERVAL (1000000)	//!< The minimum interval between responder signals.
-#endif
-
 /** Size of the atomic queues
  *
  * The queue reader MUST service the queue occasionally,
@@ -79,6 +70,14 @@ size_t channel_direction_len = NUM_ELEMENTS(channel_direction);
  */
 #define ATOMIC_QUEUE_SIZE (1024)
 
+/** Signal the other end after this many messages, even if it hasn't picked up our last signal
+ *
+ * This shouldn't be needed, as the other end drains the whole queue
+ * when it picks up a signal.  But it limits how far the queue can
+ * fill if the other end is slow to wake up.
+ */
+#define SIGNAL_WATERMARK (ATOMIC_QUEUE_SIZE / 4)
+
 typedef enum fr_channel_signal_t {
 	FR_CHANNEL_SIGNAL_ERROR			= FR_CHANNEL_ERROR,
 	FR_CHANNEL_SIGNAL_DATA_TO_RESPONDER	= FR_CHANNEL_DATA_READY_RESPONDER,
@@ -118,8 +117,8 @@ typedef struct {
 	fr_channel_recv_callback_t recv;	//!< callback for receiving messages
 	void			*recv_uctx;	//!< context for receiving messages
 
-	bool			must_signal;	//!< we need to signal the other end
-
+	atomic_bool		signal_pending;	//!< We've signalled the other end, and it hasn't yet
+						///< started reading the queue.
 
 	uint64_t		sequence;	//!< Sequence number for this channel.
 	uint64_t		ack;		//!< Sequence number of the other end.
@@ -238,11 +237,13 @@ fr_channel_t *fr_channel_create(TALLOC_CTX *ctx, fr_control_t *requestor, fr_con
 	ch->end[TO_RESPONDER].stats.last_write = now;
 	ch->end[TO_RESPONDER].stats.last_read_other = now;
 	ch->end[TO_RESPONDER].stats.last_sent_signal = now;
+	atomic_store(&ch->end[TO_RESPONDER].signal_pending, false);
 	atomic_store(&ch->end[TO_RESPONDER].active, true);
 
 	ch->end[TO_REQUESTOR].stats.last_write = now;
 	ch->end[TO_REQUESTOR].stats.last_read_other = now;
 	ch->end[TO_REQUESTOR].stats.last_sent_signal = now;
+	atomic_store(&ch->end[TO_REQUESTOR].signal_pending, false);
 	atomic_store(&ch->end[TO_REQUESTOR].active, true);
 
 	return ch;
@@ -275,7 +276,7 @@ static int fr_channel_data_ready(fr_channel_t *ch, fr_time_t when, fr_channel_en
 
 	end->stats.last_sent_signal = when;
 	end->stats.signals++;
-	end->must_signal = false;
+	end->sequence_at_last_signal = end->sequence;
 
 	cc.signal = which;
 	cc.ack = end->ack;
@@ -288,6 +289,63 @@ static int fr_channel_data_ready(fr_channel_t *ch, fr_time_t when, fr_channel_en
 	return fr_control_message_send(end->control, end->rb, FR_CONTROL_ID_CHANNEL, &cc, sizeof(cc));
 }
 
+/** Signal the other end after pushing a message, but only if it needs to be woken up
+ *
+ * The other end clears signal_pending before it drains the queue.  So
+ * if the flag is still set, the other end hasn't started reading yet,
+ * and it will see the message we just pushed without another signal.
+ * When the other end is busy, one signal covers every message which
+ * was queued before it got around to reading.
+ *
+ * @param[in] ch	the channel.
+ * @param[in] when	the data was ready.
+ * @param[in] end	of the channel that the message was written to.
+ * @param[in] which	signal to send.
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+static int fr_channel_data_ready_batched(fr_channel_t *ch, fr_time_t when, fr_channel_end_t *end,
+					 fr_channel_signal_t which)
+{
+	/*
+	 *	The push to the queue must be visible before we look
+	 *	at the flag.  The other end does the opposite.
+	 */
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (atomic_exchange(&end->signal_pending, true)) {
+		if ((end->sequence - end->sequence_at_last_signal) < SIGNAL_WATERMARK) {
+			end->stats.skipped++;
+			return 0;
+		}
+
+		end->stats.resignals++;
+	}
+
+	if (fr_channel_data_ready(ch, when, end, which) < 0) {
+		/*
+		 *	The other end won't get a signal, so the next
+		 *	message has to try again.
+		 */
+		atomic_store(&end->signal_pending, false);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Note that we're about to drain the queue for an end of the channel
+ *
+ * Any message pushed after this either gets read by the drain, or
+ * its sender sees the flag clear, and signals us again.
+ */
+static inline CC_HINT(always_inline) void fr_channel_data_draining(fr_channel_end_t *end)
+{
+	atomic_store(&end->signal_pending, false);
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
 #define IALPHA (8)
 #define RTT(_old, _new) fr_time_delta_wrap((fr_time_delta_unwrap(_new) + (fr_time_delta_unwrap(_old) * (IALPHA - 1))) / IALPHA)
 
@@ -357,34 +415,6 @@ int fr_channel_send_request(fr_channel_t *ch, fr_channel_data_t *cd)
 
 	MPRINT("REQUESTOR requests %"PRIu64", num_outstanding %"PRIu64"\n", requestor->stats.packets, requestor->stats.outstanding);
 
-#if ENABLE_SKIPS
-	/*
-	 *	We just sent the first packet.  There can't possibly be a reply, so don't bother looking.
-	 */
-	if (requestor->stats.outstanding == 1) {
-
-		/*
-		 *	There is at least one old packet which is
-		 *	outstanding, look for a reply.
-		 */
-	} else if (requestor->stats.outstanding > 1) {
-		bool has_reply;
-
-		has_reply = fr_channel_recv_reply(ch);
-
-		if (has_reply) while (fr_channel_recv_reply(ch));
-
-		/*
-		 *	There's no reply yet, so we still have packets outstanding.
-		 *	Or, there is a reply, and there are more packets outstanding.
-		 *	Skip the signal.
-		 */
-		if (!requestor->must_signal && (!has_reply || (has_reply && (requestor->stats.outstanding > 1)))) {
-			MPRINT("REQUESTOR SKIPS signal\n");
-			return 0;
-		}
-	}
-#endif
 
 	/*
 	 *	Tell the other end that there is new data ready.
@@ -393,8 +423,7 @@ int fr_channel_send_request(fr_channel_t *ch, fr_channel_data_t *cd)
 	 *	the packet in its inbound queue, so at some point, it
 	 *	will pick up the message.
 	 */
-	MPRINT("REQUESTOR SIGNALS\n");
-	(void) fr_channel_data_ready(ch, when, requestor, FR_CHANNEL_SIGNAL_DATA_TO_RESPONDER);
+	(void) fr_channel_data_ready_batched(ch, when, requestor, FR_CHANNEL_SIGNAL_DATA_TO_RESPONDER);
 	return 0;
 }
 
@@ -562,52 +591,10 @@ int fr_channel_send_reply(fr_channel_t *ch, fr_channel_data_t *cd)
 	 */
 	while (fr_channel_recv_request(ch));
 
-	/*
-	 *	No packets outstanding, we HAVE to signal the requestor
-	 *	thread.
-	 */
-	if (responder->stats.outstanding == 0) {
-		(void) fr_channel_data_ready(ch, when, responder, FR_CHANNEL_SIGNAL_DATA_DONE_RESPONDER);
-		return 0;
-	}
-
-	MPRINT("\twhen - last_read_other = %"PRIu64" - %"PRIu64" = %"PRIu64"\n", when, responder->stats.last_read_other, when - responder->stats.last_read_other);
-	MPRINT("\twhen - last signal = %"PRIu64" - %"PRIu64" = %"PRIu64"\n", when, responder->stats.last_sent_signal, when - responder->stats.last_sent_signal);
-	MPRINT("\tsequence - ack = %"PRIu64" - %"PRIu64" = %"PRIu64"\n", responder->sequence, responder->their_view_of_my_sequence, responder->sequence - responder->their_view_of_my_sequence);
-
-#ifdef __APPLE__
-	/*
-	 *	If we've sent them a signal since the last ACK, they
-	 *	will receive it, and process the packets.  So we don't
-	 *	need to signal them again.
-	 *
-	 *	But... this doesn't appear to work on the Linux
-	 *	libkqueue implementation.
-	 */
-	if (responder->sequence_at_last_signal > responder->their_view_of_my_sequence) return 0;
-#endif
-
-	/*
-	 *	If we've received a new packet in the last while, OR
-	 *	we've sent a signal in the last while, then we don't
-	 *	need to send a new signal.  But we DO send a signal if
-	 *	we haven't seen an ACK for a few packets.
-	 *
-	 *	FIXME: make these limits configurable, or include
-	 *	predictions about packet processing time?
-	 */
-	fr_assert(responder->their_view_of_my_sequence <= responder->sequence);
-#if 0
-	if (((responder->sequence - their_view_of_my_sequence) <= 1000) &&
-	    ((when - responder->stats.last_read_other < SIGNAL_INTERVAL) ||
-	     ((when - responder->stats.last_sent_signal) < SIGNAL_INTERVAL))) {
-		MPRINT("\tRESPONDER SKIPS signal\n");
-		return 0;
-	}
-#endif
-
 	MPRINT("\tRESPONDER SIGNALS num_outstanding %"PRIu64"\n", responder->stats.outstanding);
-	(void) fr_channel_data_ready(ch, when, responder, FR_CHANNEL_SIGNAL_DATA_TO_REQUESTOR);
+	(void) fr_channel_data_ready_batched(ch, when, responder,
+					     (responder->stats.outstanding == 0) ?
+					     FR_CHANNEL_SIGNAL_DATA_DONE_RESPONDER : FR_CHANNEL_SIGNAL_DATA_TO_REQUESTOR);
 	return 0;
 }
 
@@ -682,25 +669,17 @@ int fr_channel_responder_sleeping(fr_channel_t *ch)
  *	- FR_CHANNEL_OPEN when a channel has been opened and sent to us
  *	- FR_CHANNEL_CLOSE when a channel should be closed
  */
-fr_channel_event_t fr_channel_service_message(fr_time_t when, fr_channel_t **p_channel, void const *data, size_t data_size)
+fr_channel_event_t fr_channel_service_message(UNUSED fr_time_t when, fr_channel_t **p_channel,
+					      void const *data, size_t data_size)
 {
-	int rcode;
-#if ENABLE_SKIPS
-	uint64_t ack;
-#endif
 	fr_channel_control_t cc;
 	fr_channel_signal_t cs;
-	fr_channel_event_t ce = FR_CHANNEL_ERROR;
-	fr_channel_end_t *requestor;
 	fr_channel_t *ch;
 
 	fr_assert(data_size == sizeof(cc));
 	memcpy(&cc, data, data_size);
 
 	cs = cc.signal;
-#if ENABLE_SKIPS
-	ack = cc.ack;
-#endif
 	*p_channel = ch = cc.ch;
 
 	switch (cs) {
@@ -710,65 +689,43 @@ fr_channel_event_t fr_channel_service_message(fr_time_t when, fr_channel_t **p_c
 	 *	return them as-is.
 	 */
 	case FR_CHANNEL_SIGNAL_ERROR:
-	case FR_CHANNEL_SIGNAL_DATA_TO_RESPONDER:
-	case FR_CHANNEL_SIGNAL_DATA_TO_REQUESTOR:
 	case FR_CHANNEL_SIGNAL_OPEN:
 	case FR_CHANNEL_SIGNAL_CLOSE:
 		MPRINT("channel got %d\n", cs);
 		return (fr_channel_event_t) cs;
 
 	/*
-	 *	Only sent by the responder.  Both of these
-	 *	situations are largely the same, except for
-	 *	return codes.
+	 *	The caller MUST drain the queue after this, so that
+	 *	it sees every message which was sent without a
+	 *	signal.
+	 */
+	case FR_CHANNEL_SIGNAL_DATA_TO_RESPONDER:
+		MPRINT("channel got %d\n", cs);
+		fr_channel_data_draining(&ch->end[TO_RESPONDER]);
+		return (fr_channel_event_t) cs;
+
+	case FR_CHANNEL_SIGNAL_DATA_TO_REQUESTOR:
+		MPRINT("channel got %d\n", cs);
+		fr_channel_data_draining(&ch->end[TO_REQUESTOR]);
+		return (fr_channel_event_t) cs;
+
+	/*
+	 *	Only sent by the responder.  There's no need to
+	 *	signal the responder again.  If we've sent it more
+	 *	requests, then it either has a signal pending, or it
+	 *	will read them before it sleeps.
 	 */
 	case FR_CHANNEL_SIGNAL_DATA_DONE_RESPONDER:
 		MPRINT("channel got data_done_responder\n");
-		ce = FR_CHANNEL_DATA_READY_REQUESTOR;
-		ch->end[TO_RESPONDER].must_signal = true;
-		break;
+		fr_channel_data_draining(&ch->end[TO_REQUESTOR]);
+		return FR_CHANNEL_DATA_READY_REQUESTOR;
 
 	case FR_CHANNEL_SIGNAL_RESPONDER_SLEEPING:
 		MPRINT("channel got responder_sleeping\n");
-		ce = FR_CHANNEL_NOOP;
-		ch->end[TO_RESPONDER].must_signal = true;
-		break;
+		return FR_CHANNEL_NOOP;
 	}
 
-	/*
-	 *	Compare their ACK to the last sequence we
-	 *	sent.  If it's different, we signal the responder
-	 *	to wake up.
-	 */
-	requestor = &ch->end[TO_RESPONDER];
-#if ENABLE_SKIPS
-	if (!requestor->must_signal && (ack == requestor->sequence)) {
-		MPRINT("REQUESTOR SKIPS signal AFTER CE %d num_outstanding %"PRIu64"\n", cs, requestor->stats.outstanding);
-		MPRINT("REQUESTOR has ack %"PRIu64", my seq %"PRIu64" my_view %"PRIu64"\n", ack, requestor->sequence, requestor->their_view_of_my_sequence);
-		return ce;
-	}
-
-	/*
-	 *	The responder is sleeping or done.  There are more
-	 *	packets available, so we signal it to wake up again.
-	 */
-	fr_assert(ack <= requestor->sequence);
-#endif
-
-	/*
-	 *	We're signaling it again...
-	 */
-	requestor->stats.resignals++;
-
-	/*
-	 *	The responder hasn't seen our last few packets.  Signal
-	 *	that there is data ready.
-	 */
-	MPRINT("REQUESTOR SIGNALS AFTER CE %d\n", cs);
-	rcode = fr_channel_data_ready(ch, when, requestor, FR_CHANNEL_SIGNAL_DATA_TO_RESPONDER);
-	if (rcode < 0) return FR_CHANNEL_ERROR;
-
-	return ce;
+	return FR_CHANNEL_ERROR;
 }
 
 
@@ -965,6 +922,7 @@ void fr_channel_stats_log(fr_channel_t const *ch, fr_log_t const *log, char cons
 	fr_log(log, L_INFO, file, line, "requestor\n");
 	fr_log(log, L_INFO, file, line, "\tsignals sent = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.signals);
 	fr_log(log, L_INFO, file, line, "\tsignals re-sent = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.resignals);
+	fr_log(log, L_INFO, file, line, "\tsignals skipped = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.skipped);
 	fr_log(log, L_INFO, file, line, "\tkevents checked = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.kevents);
 	fr_log(log, L_INFO, file, line, "\toutstanding = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.outstanding);
 	fr_log(log, L_INFO, file, line, "\tpackets processed = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.packets);
@@ -975,6 +933,8 @@ void fr_channel_stats_log(fr_channel_t const *ch, fr_log_t const *log, char cons
 
 	fr_log(log, L_INFO, file, line, "responder\n");
 	fr_log(log, L_INFO, file, line, "\tsignals sent = %" PRIu64"\n", ch->end[TO_REQUESTOR].stats.signals);
+	fr_log(log, L_INFO, file, line, "\tsignals re-sent = %" PRIu64 "\n", ch->end[TO_REQUESTOR].stats.resignals);
+	fr_log(log, L_INFO, file, line, "\tsignals skipped = %" PRIu64 "\n", ch->end[TO_REQUESTOR].stats.skipped);
 	fr_log(log, L_INFO, file, line, "\tkevents checked = %" PRIu64 "\n", ch->end[TO_REQUESTOR].stats.kevents);
 	fr_log(log, L_INFO, file, line, "\tpackets processed = %" PRIu64 "\n", ch->end[TO_REQUESTOR].stats.packets);
 	fr_log(log, L_INFO, file, line, "\tmessage interval (RTT) = %" PRIu64 "\n", fr_time_delta_unwrap(ch->end[TO_REQUESTOR].stats.message_interval));
@@ -982,3 +942,18 @@ void fr_channel_stats_log(fr_channel_t const *ch, fr_log_t const *log, char cons
 	fr_log(log, L_INFO, file, line, "\tlast read other end = %" PRIu64 "\n", fr_time_unwrap(ch->end[TO_REQUESTOR].stats.last_read_other));
 	fr_log(log, L_INFO, file, line, "\tlast signal other = %" PRIu64 "\n", fr_time_unwrap(ch->end[TO_REQUESTOR].stats.last_sent_signal));
 }
+
+/** Get the statistics for each direction of a channel
+ *
+ * @note The statistics are updated by the threads at each end
+ *	of the channel without locking, so the values may be slightly stale.
+ *
+ * @param[in] ch		The channel.
+ * @param[out] requestor	statistics for requests sent to the responder.  May be NULL.
+ * @param[out] responder	statistics for replies sent to the requestor.  May be NULL.
+ */
+void fr_channel_stats_get(fr_channel_t const *ch, fr_channel_stats_t *requestor, fr_channel_stats_t *responder)
+{
+	if (requestor) *requestor = ch->end[TO_RESPONDER].stats;
+	if (responder) *responder = ch->end[TO_REQUESTOR].stats;
+}
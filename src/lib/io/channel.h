@@ -82,6 +82,8 @@ typedef struct {
 	uint64_t       		outstanding; 	//!< Number of outstanding requests with no reply.
 	uint64_t		signals;	//!< Number of kevent signals we've sent.
 	uint64_t		resignals;	//!< Number of signals resent.
+	uint64_t		skipped;	//!< Number of messages sent without a signal, because
+						///< the other end hadn't yet picked up the last one.
 
 	uint64_t		packets;	//!< Number of actual data packets.
 
@@ -129,6 +131,7 @@ typedef struct {
 		struct {
 			fr_time_t		recv_time;	//!< time original request was received (network -> worker)
 			bool			is_dup;		//!< dup, new, etc.
+			bool			verified;	//!< Signature was checked by the #fr_app_t verify callback.
 		} request;
 
 		struct {
@@ -191,6 +194,8 @@ void	*fr_channel_requestor_uctx_get(fr_channel_t *ch) CC_HINT(nonnull);
 
 void	fr_channel_stats_log(fr_channel_t const *ch, fr_log_t const *log, char const *file, int line);
 
+void	fr_channel_stats_get(fr_channel_t const *ch, fr_channel_stats_t *requestor, fr_channel_stats_t *responder) CC_HINT(nonnull(1));
+
 #ifdef __cplusplus
 }
 #endif
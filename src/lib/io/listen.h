@@ -41,6 +41,9 @@ struct fr_listen {
 
 	bool			connected;		//!< is this for a connected socket?
 	bool			track_duplicates;	//!< do we track duplicate packets?
+	bool			read_pending;		//!< the app_io has buffered data from a previous read,
+							///< so read() should be called again, even if the
+							///< socket isn't readable.
 	size_t			default_message_size;	//!< copied from app_io, but may be changed
 	size_t			num_messages;		//!< for the message ring buffer
 };
@@ -64,6 +67,12 @@ struct fr_async_s {
 	uint32_t		priority;	//!< higher == higher priority
 
 	uint32_t		sequence;	//!< higher == higher priority, too
+
+	fr_message_t		*msg;		//!< Channel message the packet was decoded from, if
+						//!< request->packet->data still points into it.
+
+	bool			verified;	//!< Packet signature has already been checked, so
+						//!< the decoder doesn't need to.
 };
 
 int fr_io_listen_free(fr_listen_t *li);
@@ -621,6 +621,7 @@ static fr_io_connection_t *fr_io_connection_alloc(fr_io_instance_t const *inst,
 		 *	Glue in the actual app_io
 		 */
 		li->connected = true;
+		li->read_pending = false;
 		li->app_io = thread->child->app_io;
 		li->thread_instance = connection;
 		li->app_io_instance = dl_inst->data;
@@ -661,6 +662,7 @@ static fr_io_connection_t *fr_io_connection_alloc(fr_io_instance_t const *inst,
 		fr_assert(li->app_io == &fr_master_app_io);
 
 		li->connected = true;
+		li->read_pending = false;
 		li->thread_instance = connection;
 		li->app_io_instance = li->thread_instance;
 		li->track_duplicates = thread->child->app_io->track_duplicates;
@@ -1282,6 +1284,13 @@ do_read:
 		 */
 		packet_len = inst->app_io->read(child, (void **) &local_address, &recv_time,
 					  buffer, buffer_len, leftover, priority, is_dup);
+
+		/*
+		 *	Tell the network side that the child has more
+		 *	data buffered.
+		 */
+		li->read_pending = child->read_pending;
+
 		if (packet_len <= 0) {
 			return packet_len;
 		}
@@ -2507,6 +2516,22 @@ reread:
 	return buffer_len;
 }
 
+/** Flush any writes which were batched by the child
+ *
+ */
+static int mod_flush(fr_listen_t *li)
+{
+	fr_io_instance_t const *inst;
+	fr_io_connection_t *connection;
+	fr_listen_t *child;
+
+	get_inst(li, &inst, NULL, &connection, &child);
+
+	if (!inst->app_io->flush) return 0;
+
+	return inst->app_io->flush(child);
+}
+
 /** Close the socket.
  *
  */
@@ -2878,25 +2903,27 @@ int fr_io_listen_free(fr_listen_t *li)
 	return 0;
 }
 
-int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *sc,
-			size_t default_message_size, size_t num_messages)
+/** Open one copy of a listener, and add it to the scheduler
+ *
+ * @param[in] ctx			to allocate the listener in.
+ * @param[in] inst			of the master IO handler.
+ * @param[in] sc			to add the listener to.
+ * @param[in] default_message_size	for the message ring buffer.
+ * @param[in] num_messages		for the message ring buffer.
+ * @param[in] shard			which copy of the listener this is.  Only
+ *					shard 0 is recorded as owning the address.
+ * @param[out] child_out		the listener for the underlying transport.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int master_io_listen_shard(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *sc,
+				  size_t default_message_size, size_t num_messages,
+				  unsigned int shard, fr_listen_t **child_out)
 {
 	fr_listen_t	*li, *child;
 	fr_io_thread_t	*thread;
 
-	/*
-	 *	No IO paths, so we don't initialize them.
-	 */
-	if (!inst->app_io) {
-		fr_assert(!inst->dynamic_clients);
-		return 0;
-	}
-
-	if (!inst->app_io->thread_inst_size) {
-		fr_strerror_const("IO modules MUST set 'thread_inst_size' when using the master IO handler.");
-		return -1;
-	}
-
 	/*
 	 *	Build the #fr_listen_t.  This describes the complete
 	 *	path data takes from the socket to the decoder and
@@ -3011,9 +3038,10 @@ int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *
 	li->name = child->name;
 
 	/*
-	 *	Record which socket we opened.
+	 *	Record which socket we opened.  Other shards
+	 *	deliberately share the address of the first one.
 	 */
-	if (child->app_io_addr) {
+	if (child->app_io_addr && (shard == 0)) {
 		fr_listen_t *other;
 
 		other = listen_find_any(thread->child);
@@ -3034,11 +3062,59 @@ int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *
 	 *	Add the socket to the scheduler, where it might end up
 	 *	in a different thread.
 	 */
-	if (!fr_schedule_listen_add(sc, li)) {
+	if (!fr_schedule_listen_add_shard(sc, li, shard)) {
 		talloc_free(li);
 		return -1;
 	}
 
+	*child_out = child;
+
+	return 0;
+}
+
+int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *sc,
+			size_t default_message_size, size_t num_messages)
+{
+	fr_listen_t	*child;
+	unsigned int	i, num_shards;
+	int		fd;
+	bool		steer;
+
+	/*
+	 *	No IO paths, so we don't initialize them.
+	 */
+	if (!inst->app_io) {
+		fr_assert(!inst->dynamic_clients);
+		return 0;
+	}
+
+	if (!inst->app_io->thread_inst_size) {
+		fr_strerror_const("IO modules MUST set 'thread_inst_size' when using the master IO handler.");
+		return -1;
+	}
+
+	if (master_io_listen_shard(ctx, inst, sc, default_message_size, num_messages, 0, &child) < 0) return -1;
+
+	/*
+	 *	Only UDP sockets can be sharded.  They're bound with
+	 *	SO_REUSEPORT, so each network thread can have its own
+	 *	socket, and the kernel spreads packets across them.
+	 */
+	num_shards = fr_schedule_listen_shards(sc, &steer);
+	if ((num_shards < 2) || !child->app_io_addr || (child->app_io_addr->proto != IPPROTO_UDP)) return 0;
+
+	fd = child->fd;
+
+	for (i = 1; i < num_shards; i++) {
+		if (master_io_listen_shard(ctx, inst, sc, default_message_size, num_messages, i, &child) < 0) {
+			return -1;
+		}
+	}
+
+	if (steer && (fr_socket_reuseport_steer(fd, num_shards) < 0)) {
+		PWARN("Packets for %s will be distributed by 4-tuple", child->name);
+	}
+
 	return 0;
 }
 
@@ -3056,6 +3132,7 @@ fr_app_io_t fr_master_app_io = {
 	.read			= mod_read,
 	.write			= mod_write,
 	.inject			= mod_inject,
+	.flush			= mod_flush,
 
 	.open			= mod_open,
 	.close			= mod_close,
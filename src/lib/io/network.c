@@ -64,6 +64,7 @@ typedef struct {
 	fr_time_delta_t		predicted;		//!< predicted processing time for one packet
 
 	bool			blocked;		//!< is this worker blocked?
+	int			numa_node;		//!< NUMA node the worker runs on, or -1 if unknown.
 
 	fr_channel_t		*channel;		//!< channel to the worker
 	fr_worker_t		*worker;		//!< worker pointer
@@ -93,6 +94,7 @@ typedef struct {
 
 	fr_channel_data_t	*pending;		//!< the currently pending partial packet
 	fr_heap_t		*waiting;		//!< packets waiting to be written
+	fr_dlist_t		flush_entry;		//!< in the list of sockets with batched writes.
 	fr_io_stats_t		stats;
 } fr_network_socket_t;
 
@@ -127,6 +129,7 @@ struct fr_network_s {
 	fr_event_list_t		*el;			//!< our event list
 
 	fr_heap_t		*replies;		//!< replies from the worker, ordered by priority / origin time
+	fr_dlist_head_t		flush;			//!< sockets which have batched writes to flush
 
 	fr_io_stats_t		stats;
 
@@ -144,6 +147,10 @@ struct fr_network_s {
 
 	fr_network_config_t	config;			//!< configuration
 	fr_network_worker_t	*workers[MAX_WORKERS]; 	//!< each worker
+
+	int			numa_node;		//!< NUMA node we run on, or -1 if unknown.
+	int			num_local_workers;	//!< number of workers on the same NUMA node as us.
+	fr_network_worker_t	*local_workers[MAX_WORKERS]; //!< workers on the same NUMA node as us.
 };
 
 static void fr_network_post_event(fr_event_list_t *el, fr_time_t now, void *uctx);
@@ -266,6 +273,38 @@ int fr_network_directory_add(fr_network_t *nr, fr_listen_t *li)
 	return fr_control_message_send(nr->control, rb, FR_CONTROL_ID_DIRECTORY, &li, sizeof(li));
 }
 
+/** Rebuild the list of workers which share our NUMA node
+ *
+ * @param[in] nr	the network
+ */
+static void fr_network_local_workers_update(fr_network_t *nr)
+{
+	int i;
+
+	nr->num_local_workers = 0;
+	if (nr->numa_node < 0) return;
+
+	for (i = 0; i < nr->num_workers; i++) {
+		if (nr->workers[i]->numa_node != nr->numa_node) continue;
+
+		nr->local_workers[nr->num_local_workers++] = nr->workers[i];
+	}
+}
+
+/** Set the NUMA node this network is running on
+ *
+ * When set, requests are preferentially sent to workers
+ * on the same node.  Must be called from the network thread.
+ *
+ * @param[in] nr	the network
+ * @param[in] node	NUMA node, or -1 if unknown.
+ */
+void fr_network_numa_node_set(fr_network_t *nr, int node)
+{
+	nr->numa_node = node;
+	fr_network_local_workers_update(nr);
+}
+
 /** Add a worker to a network
  *
  * @param nr the network
@@ -345,6 +384,7 @@ void fr_network_listen_write(fr_network_t *nr, fr_listen_t *li, uint8_t const *p
 	 */
 	lm = fr_message_localize(nr, &cd.m, sizeof(cd));
 	if (!lm) return;
+	nr->stats.bytes_copied += lm->data_size;
 
 	if (fr_heap_insert(nr->replies, lm) < 0) {
 		fr_message_done(lm);
@@ -533,11 +573,14 @@ static void fr_network_channel_callback(void *ctx, void const *data, size_t data
 				/*
 				 *	Close the hole...
 				 */
-				memcpy(&nr->workers[i], &nr->workers[i + 1], ((nr->num_workers - i) - 1));
+				memmove(&nr->workers[i], &nr->workers[i + 1],
+					((nr->num_workers - i) - 1) * sizeof(nr->workers[0]));
+				nr->workers[nr->num_workers - 1] = NULL;
 				break;
 			}
 		}
 		nr->num_workers--;
+		fr_network_local_workers_update(nr);
 	}
 		break;
 	}
@@ -566,17 +609,29 @@ retry:
 		}
 
 	} else if (nr->num_blocked == 0) {
-		uint32_t one, two;
+		fr_network_worker_t	**workers = nr->workers;
+		int			num_workers = nr->num_workers;
+		uint32_t		one, two;
+
+		/*
+		 *	If there are enough workers on our NUMA node
+		 *	to make a choice, only pick from those.  The
+		 *	packet data then doesn't cross the interconnect.
+		 */
+		if (nr->num_local_workers >= 2) {
+			workers = nr->local_workers;
+			num_workers = nr->num_local_workers;
+		}
 
-		one = fr_rand() % nr->num_workers;
+		one = fr_rand() % num_workers;
 		do {
-			two = fr_rand() % nr->num_workers;
+			two = fr_rand() % num_workers;
 		} while (two == one);
 
-		if (fr_time_delta_lt(nr->workers[one]->cpu_time, nr->workers[two]->cpu_time)) {
-			worker = nr->workers[one];
+		if (fr_time_delta_lt(workers[one]->cpu_time, workers[two]->cpu_time)) {
+			worker = workers[one];
 		} else {
-			worker = nr->workers[two];
+			worker = workers[two];
 		}
 	} else {
 		int i;
@@ -726,8 +781,13 @@ next_message:
 	/*
 	 *	Poll this socket, but not too often.  We have to go
 	 *	service other sockets, too.
+	 *
+	 *	Except if the app_io has buffered datagrams from a
+	 *	batched read.  The socket may not become readable
+	 *	again, so we have to drain them now.  The number of
+	 *	buffered datagrams is limited by the app_io.
 	 */
-	if (num_messages > 16) {
+	if ((num_messages > 16) && !s->listen->read_pending) {
 		s->cd = cd;
 		return;
 	}
@@ -748,6 +808,16 @@ next_message:
 	data_size = s->listen->app_io->read(s->listen, &cd->packet_ctx, &cd->request.recv_time,
 					    cd->m.data, cd->m.rb_size, &s->leftover, &cd->priority, &cd->request.is_dup);
 	if (data_size == 0) {
+		/*
+		 *	The packet was discarded, but there are
+		 *	more buffered datagrams.  Re-use the same
+		 *	message for the next one.
+		 */
+		if (s->listen->read_pending) {
+			num_messages++;
+			goto next_message;
+		}
+
 		/*
 		 *	Cache the message for later.  This is
 		 *	important for stream sockets, which can do
@@ -850,6 +920,23 @@ next_message:
 		num_messages++;
 		goto next_message;
 	}
+
+	/*
+	 *	The app_io read a burst of datagrams, e.g. with
+	 *	recvmmsg().  Send them all to the workers now.
+	 */
+	if (s->listen->read_pending) {
+		cd = (fr_channel_data_t *) fr_message_reserve(s->ms, s->listen->default_message_size);
+		if (!cd) {
+			ERROR("Failed allocating message size %zd! - Closing socket",
+			      s->listen->default_message_size);
+			fr_network_socket_dead(nr, s);
+			return;
+		}
+
+		num_messages++;
+		goto next_message;
+	}
 }
 
 
@@ -925,6 +1012,16 @@ static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 
 	(void) talloc_get_type_abort(nr, fr_network_t);
 
+	/*
+	 *	Write any packets the app_io left queued
+	 *	because the socket would have blocked.
+	 */
+	if (s->blocked && li->app_io->flush && (li->app_io->flush(li) < 0)) {
+		if (errno == EWOULDBLOCK) return;
+
+		PERROR("Failed flushing writes to socket %s", li->name);
+	}
+
 	/*
 	 *	Start with the currently pending message, and then
 	 *	work through the priority heap.
@@ -971,6 +1068,8 @@ static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 						ERROR("Failed saving pending packet");
 						goto dead;
 					}
+					nr->stats.bytes_copied += lm->data_size;
+					s->stats.bytes_copied += lm->data_size;
 
 					cd = (fr_channel_data_t *) lm;
 				}
@@ -1023,6 +1122,15 @@ static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 		nr->stats.out++;
 		s->stats.out++;
 
+		/*
+		 *	The app_io may have queued the packet instead
+		 *	of writing it.  Remember to flush it before
+		 *	going back to the event loop.
+		 */
+		if (li->app_io->flush && !fr_dlist_entry_in_list(&s->flush_entry)) {
+			fr_dlist_insert_tail(&nr->flush, s);
+		}
+
 		/*
 		 *	Grab the net entry.
 		 */
@@ -1049,6 +1157,8 @@ static int _network_socket_free(fr_network_socket_t *s)
 	fr_rb_delete(nr->sockets, s);
 	fr_rb_delete(nr->sockets_by_num, s);
 
+	if (fr_dlist_entry_in_list(&s->flush_entry)) fr_dlist_remove(&nr->flush, s);
+
 	fr_event_fd_delete(nr->el, s->listen->fd, s->filter);
 
 	if (s->listen->app_io->close) {
@@ -1255,6 +1365,7 @@ static void fr_network_worker_started_callback(void *ctx, void const *data, size
 	MEM(w = talloc_zero(nr, fr_network_worker_t));
 
 	w->worker = worker;
+	w->numa_node = fr_worker_numa_node(worker);
 	w->channel = fr_worker_channel_create(worker, w, nr->control);
 	fr_fatal_assert_msg(w->channel, "Failed creating new channel");
 
@@ -1271,6 +1382,7 @@ static void fr_network_worker_started_callback(void *ctx, void const *data, size
 		if (nr->workers[i]) continue;
 
 		nr->workers[i] = w;
+		fr_network_local_workers_update(nr);
 		return;
 	}
 
@@ -1332,6 +1444,41 @@ static int fr_network_pre_event(UNUSED fr_time_t now, UNUSED fr_time_delta_t wak
 	return 0;
 }
 
+/** Flush batched writes for all sockets which have them
+ *
+ * @param[in] nr	the network
+ */
+static void fr_network_flush(fr_network_t *nr)
+{
+	fr_network_socket_t *s;
+
+	while ((s = fr_dlist_pop_head(&nr->flush)) != NULL) {
+		if (s->dead) continue;
+
+		if (s->listen->app_io->flush(s->listen) < 0) {
+			if (errno != EWOULDBLOCK) {
+				PERROR("Failed flushing writes to socket %s", s->listen->name);
+				continue;
+			}
+
+			/*
+			 *	The rest of the batch is still queued.
+			 *	fr_network_write() flushes it when the
+			 *	socket becomes writable.
+			 */
+			if (s->blocked) continue;
+
+			if (fr_event_filter_update(nr->el, s->listen->fd, FR_EVENT_FILTER_IO, resume_write) < 0) {
+				PERROR("Failed adding write callback to event loop");
+				fr_network_socket_dead(nr, s);
+				continue;
+			}
+
+			s->blocked = true;
+		}
+	}
+}
+
 /** Handle replies after all FD and timer events have been serviced
  *
  * @param el	the event loop
@@ -1396,17 +1543,24 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED fr_time_t n
 		}
 
 		/*
-		 *	No pending message, let's try writing it.
+		 *	Socket isn't blocked, let's try writing it.
 		 *
-		 *	If there is a pending message, then we're
-		 *	waiting for IO write to become ready.
+		 *	If there is a pending message, or batched
+		 *	writes which couldn't be flushed, then we're
+		 *	waiting for IO write to become ready, and the
+		 *	message is written from the heap then.
 		 */
-		if (!s->pending) {
-			fr_assert(!s->blocked);
-			(void) fr_heap_insert(s->waiting, cd);
-			fr_network_write(nr->el, s->listen->fd, 0, s);
-		}
+		(void) fr_heap_insert(s->waiting, cd);
+		if (!s->blocked) fr_network_write(nr->el, s->listen->fd, 0, s);
 	}
+
+	/*
+	 *	Write any packets which were batched by the app_io.
+	 *	This is done once per loop iteration, so that replies
+	 *	are delayed by at most the time it takes to service
+	 *	one round of events.
+	 */
+	fr_network_flush(nr);
 }
 
 /** Stop a network thread in an orderly way
@@ -1612,6 +1766,7 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const
 	nr->num_workers = 0;
 	nr->signal_pipe[0] = -1;
 	nr->signal_pipe[1] = -1;
+	nr->numa_node = -1;
 	if (config) nr->config = *config;
 
 	nr->aq_control = fr_atomic_queue_alloc(nr, 1024);
@@ -1688,6 +1843,8 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const
 		goto fail2;
 	}
 
+	fr_dlist_init(&nr->flush, fr_network_socket_t, flush_entry);
+
 	if (fr_event_pre_insert(nr->el, fr_network_pre_event, nr) < 0) {
 		fr_strerror_const("Failed adding pre-check to event list");
 		goto fail2;
@@ -1745,14 +1902,38 @@ void fr_network_stats_log(fr_network_t const *nr, fr_log_t const *log)
 
 static int cmd_stats_self(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
 {
-	fr_network_t const *nr = ctx;
+	fr_network_t const	*nr = ctx;
+	fr_channel_stats_t	requests, replies;
+	uint64_t		num_requests = 0, request_signals = 0;
+	uint64_t		num_replies = 0, reply_signals = 0;
+	int			i;
 
 	fprintf(fp, "count.in\t%" PRIu64 "\n", nr->stats.in);
 	fprintf(fp, "count.out\t%" PRIu64 "\n", nr->stats.out);
 	fprintf(fp, "count.dup\t%" PRIu64 "\n", nr->stats.dup);
 	fprintf(fp, "count.dropped\t%" PRIu64 "\n", nr->stats.dropped);
+	fprintf(fp, "count.bytes_copied\t%" PRIu64 "\n", nr->stats.bytes_copied);
 	fprintf(fp, "count.sockets\t%u\n", fr_rb_num_elements(nr->sockets));
 
+	/*
+	 *	Messages moved through the channels to the workers,
+	 *	vs how many times we had to wake up the other end.
+	 */
+	for (i = 0; i < nr->max_workers; i++) {
+		if (!nr->workers[i]) continue;
+
+		fr_channel_stats_get(nr->workers[i]->channel, &requests, &replies);
+		num_requests += requests.packets;
+		request_signals += requests.signals;
+		num_replies += replies.packets;
+		reply_signals += replies.signals;
+	}
+
+	fprintf(fp, "channel.requests\t%" PRIu64 "\n", num_requests);
+	fprintf(fp, "channel.request_signals\t%" PRIu64 "\n", request_signals);
+	fprintf(fp, "channel.replies\t%" PRIu64 "\n", num_replies);
+	fprintf(fp, "channel.reply_signals\t%" PRIu64 "\n", reply_signals);
+
 	return 0;
 }
 
@@ -1791,6 +1972,7 @@ static int cmd_stats_socket(FILE *fp, FILE *fp_err, void *ctx, fr_cmd_info_t con
 	fprintf(fp, "count.out\t%" PRIu64 "\n", s->stats.out);
 	fprintf(fp, "count.dup\t%" PRIu64 "\n", s->stats.dup);
 	fprintf(fp, "count.dropped\t%" PRIu64 "\n", s->stats.dropped);
+	fprintf(fp, "count.bytes_copied\t%" PRIu64 "\n", s->stats.bytes_copied);
 
 	return 0;
 }
@@ -36,6 +36,11 @@ RCSID("$Id$")
 
 #include <pthread.h>
 
+#ifdef __linux__
+#  include <sched.h>
+#  include <sys/syscall.h>
+#endif
+
 /*
  *	Other OS's have sem_init, OS X doesn't.
  */
@@ -159,6 +164,72 @@ int fr_schedule_worker_id(void)
 	return worker_id;
 }
 
+#if defined(__linux__) && defined(CPU_SET) && defined(SYS_getcpu)
+/** Pin the calling thread to a CPU
+ *
+ * CPUs are picked from the set the process is allowed to run on, so
+ * restrictions from taskset, cgroups, containers etc. are respected.
+ *
+ * @param[in] sc	the scheduler.
+ * @param[in] name	of the thread, for logging.
+ * @param[in] slot	index of the thread.  Network threads use the first
+ *			slots, and worker threads the slots after that.
+ * @return
+ *	- the NUMA node of the CPU the thread was pinned to.
+ *	- -1 if the thread couldn't be pinned, or the node is unknown.
+ */
+static int fr_schedule_thread_pin(fr_schedule_t *sc, char const *name, unsigned int slot)
+{
+	cpu_set_t	allowed, set;
+	int		num_cpus, i, ret;
+	unsigned int	cpu, node;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+		WARN("%s - Failed getting CPU affinity: %s", name, fr_syserror(errno));
+		return -1;
+	}
+
+	num_cpus = CPU_COUNT(&allowed);
+	if (num_cpus <= 0) return -1;
+
+	slot %= (unsigned int) num_cpus;
+	for (i = 0; i < CPU_SETSIZE; i++) {
+		if (!CPU_ISSET(i, &allowed)) continue;
+		if (slot == 0) break;
+		slot--;
+	}
+
+	CPU_ZERO(&set);
+	CPU_SET(i, &set);
+
+	ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (ret != 0) {
+		WARN("%s - Failed pinning thread to CPU %i: %s", name, i, fr_syserror(ret));
+		return -1;
+	}
+
+	/*
+	 *	We're now running on the CPU we asked for,
+	 *	so this tells us which node it's on.
+	 */
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) < 0) {
+		DEBUG2("%s - Pinned to CPU %i, NUMA node unknown", name, i);
+		return -1;
+	}
+
+	DEBUG2("%s - Pinned to CPU %u, NUMA node %u", name, cpu, node);
+
+	return (int) node;
+}
+#else
+static int fr_schedule_thread_pin(fr_schedule_t *sc, char const *name, UNUSED unsigned int slot)
+{
+	WARN("%s - CPU affinity is not supported on this platform", name);
+
+	return -1;
+}
+#endif
+
 /** Entry point for worker threads
  *
  * @param[in] arg	the fr_schedule_worker_t
@@ -172,6 +243,7 @@ static void *fr_schedule_worker_thread(void *arg)
 	fr_schedule_child_status_t	status = FR_CHILD_FAIL;
 	fr_schedule_network_t		*sn;
 	char				worker_name[32];
+	int				numa_node = -1;
 
 	worker_id = sw->id;		/* Store the current worker ID */
 
@@ -185,18 +257,33 @@ static void *fr_schedule_worker_thread(void *arg)
 
 	INFO("%s - Starting", worker_name);
 
+	/*
+	 *	Pin before allocating anything else, so that
+	 *	our memory is local to the CPU we run on.
+	 */
+	if (sc->config->cpu_affinity) {
+		numa_node = fr_schedule_thread_pin(sc, worker_name, sc->config->max_networks + sw->id);
+	}
+
 	sw->el = fr_event_list_alloc(ctx, NULL, NULL);
 	if (!sw->el) {
 		PERROR("%s - Failed creating event list", worker_name);
 		goto fail;
 	}
 
+	if (fr_time_delta_ispos(sc->config->timer_wheel_tick) &&
+	    (fr_event_list_set_timer_wheel(sw->el, sc->config->timer_wheel_tick) < 0)) {
+		PERROR("%s - Failed creating timer wheel", worker_name);
+		goto fail;
+	}
+
 
 	sw->worker = fr_worker_create(ctx, sw->el, worker_name, sc->log, sc->lvl, &sc->config->worker);
 	if (!sw->worker) {
 		PERROR("%s - Failed creating worker", worker_name);
 		goto fail;
 	}
+	fr_worker_numa_node_set(sw->worker, numa_node);
 
 	/*
 	 *	@todo make this a registry
@@ -293,6 +380,7 @@ static void *fr_schedule_network_thread(void *arg)
 	fr_schedule_child_status_t	status = FR_CHILD_FAIL;
 	fr_event_list_t			*el;
 	char				network_name[32];
+	int				numa_node = -1;
 
 	snprintf(network_name, sizeof(network_name), "Network %d", sn->id);
 
@@ -304,17 +392,26 @@ static void *fr_schedule_network_thread(void *arg)
 		goto fail;
 	}
 
+	if (sc->config->cpu_affinity) numa_node = fr_schedule_thread_pin(sc, network_name, sn->id);
+
 	el = fr_event_list_alloc(ctx, NULL, NULL);
 	if (!el) {
 		PERROR("%s - Failed creating event list", network_name);
 		goto fail;
 	}
 
+	if (fr_time_delta_ispos(sc->config->timer_wheel_tick) &&
+	    (fr_event_list_set_timer_wheel(el, sc->config->timer_wheel_tick) < 0)) {
+		PERROR("%s - Failed creating timer wheel", network_name);
+		goto fail;
+	}
+
 	sn->nr = fr_network_create(ctx, el, network_name, sc->log, sc->lvl, &sc->config->network);
 	if (!sn->nr) {
 		PERROR("%s - Failed creating network", network_name);
 		goto fail;
 	}
+	fr_network_numa_node_set(sn->nr, numa_node);
 
 	sn->status = FR_CHILD_RUNNING;
 
@@ -843,6 +940,68 @@ fr_network_t *fr_schedule_listen_add(fr_schedule_t *sc, fr_listen_t *li)
 	return nr;
 }
 
+/** Return how many copies of a listener should be opened
+ *
+ * When sharding is enabled, each network thread gets its own socket
+ * for every UDP listener, and the kernel distributes packets across
+ * them with SO_REUSEPORT.  That avoids funnelling all packets through
+ * a single network thread.
+ *
+ * @param[in] sc	the scheduler.
+ * @param[out] steer	whether packets should be steered to shards by
+ *			source IP address.  May be NULL.
+ * @return the number of shards, 1 if sharding is disabled.
+ */
+unsigned int fr_schedule_listen_shards(fr_schedule_t const *sc, bool *steer)
+{
+	if (steer) *steer = false;
+
+	if (sc->el || !sc->config->shard_listeners) return 1;
+
+	if (steer) *steer = sc->config->shard_by_src_ipaddr;
+
+	return fr_dlist_num_elements(&sc->networks);
+}
+
+/** Add one shard of a listener to a scheduler
+ *
+ * Each shard is owned by a different network thread.
+ *
+ * @param[in] sc	the scheduler
+ * @param[in] li	the ctx and callbacks for the transport.
+ * @param[in] shard	number, from 0 to #fr_schedule_listen_shards - 1.
+ * @return
+ *	- NULL on error
+ *	- the fr_network_t that the socket was added to.
+ */
+fr_network_t *fr_schedule_listen_add_shard(fr_schedule_t *sc, fr_listen_t *li, unsigned int shard)
+{
+	fr_network_t *nr;
+
+	(void) talloc_get_type_abort(sc, fr_schedule_t);
+
+	if (sc->el) {
+		nr = sc->single_network;
+	} else {
+		fr_schedule_network_t *sn;
+
+		shard %= fr_dlist_num_elements(&sc->networks);
+
+		for (sn = fr_dlist_head(&sc->networks);
+		     sn != NULL;
+		     sn = fr_dlist_next(&sc->networks, sn)) {
+			if (sn->id == shard) break;
+		}
+		if (!sn) sn = fr_dlist_head(&sc->networks);
+
+		nr = sn->nr;
+	}
+
+	if (fr_network_listen_add(nr, li) < 0) return NULL;
+
+	return nr;
+}
+
 /** Add a directory NOTE_EXTEND to a scheduler.
  *
  * @param[in] sc the scheduler
@@ -68,6 +68,13 @@ typedef struct {
 	fr_network_config_t network;		//!< configuration for each network;
 
 	fr_time_delta_t	stats_interval;		//!< print channel statistics
+
+	bool		shard_listeners;	//!< open one SO_REUSEPORT socket per network thread
+						///< for each UDP listener.
+	bool		shard_by_src_ipaddr;	//!< steer packets to shards by source IP address.
+	bool		cpu_affinity;		//!< pin network and worker threads to CPUs.
+	fr_time_delta_t	timer_wheel_tick;	//!< resolution of the timer wheel for network and
+						///< worker event lists.  0 disables the wheel.
 } fr_schedule_config_t;
 
 int			fr_schedule_worker_id(void);
@@ -81,6 +88,8 @@ fr_schedule_t		*fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_
 int			fr_schedule_destroy(fr_schedule_t **sc);
 
 fr_network_t		*fr_schedule_listen_add(fr_schedule_t *sc, fr_listen_t *li) CC_HINT(nonnull);
+fr_network_t		*fr_schedule_listen_add_shard(fr_schedule_t *sc, fr_listen_t *li, unsigned int shard) CC_HINT(nonnull);
+unsigned int		fr_schedule_listen_shards(fr_schedule_t const *sc, bool *steer) CC_HINT(nonnull(1));
 fr_network_t		*fr_schedule_directory_add(fr_schedule_t *sc, fr_listen_t *li) CC_HINT(nonnull);
 #ifdef __cplusplus
 }
@@ -74,6 +74,18 @@ static void worker_verify(fr_worker_t *worker);
 #define CACHE_LINE_SIZE	64
 static alignas(CACHE_LINE_SIZE) atomic_uint64_t request_number = 0;
 
+/*
+ *	Most requests we gather from a channel before bootstrapping
+ *	them, so that the fr_app_t can verify them together.
+ */
+#define WORKER_RECV_BATCH	(16)
+
+/*
+ *	Measure the attribute memory of one in this many
+ *	finished requests.
+ */
+#define WORKER_MEMORY_SAMPLE	(64)
+
 /**
  *  A worker which takes packets from a master, and processes them.
  */
@@ -84,6 +96,7 @@ struct fr_worker_s {
 	unlang_interpret_t 	*intp;		//!< Worker's local interpreter.
 
 	pthread_t		thread_id;	//!< my thread ID
+	int			numa_node;	//!< NUMA node we're running on, or -1 if unknown.
 
 	fr_log_t const		*log;		//!< log destination
 	fr_log_lvl_t		lvl;		//!< log level
@@ -107,6 +120,12 @@ struct fr_worker_s {
 	uint64_t    		num_naks;	//!< number of messages which were nak'd
 	uint64_t    		num_active;	//!< number of active requests
 
+	uint64_t		pairs_allocated; //!< by this thread, as of the last request which finished.
+	uint64_t		attr_requests;	//!< finished requests, for sampling their attribute memory.
+	uint64_t		attr_sampled;	//!< finished requests whose attribute memory was measured.
+	uint64_t		attr_bytes;	//!< total memory used by the attributes of sampled requests.
+	uint64_t		attr_pool_overflow; //!< sampled requests whose attributes didn't fit in the request pool.
+
 	fr_time_delta_t		predicted;	//!< How long we predict a request will take to execute.
 	fr_time_tracking_t	tracking;	//!< how much time the worker has spent doing things.
 
@@ -118,6 +137,11 @@ struct fr_worker_s {
 	fr_event_timer_t const	*ev_cleanup;	//!< timer for max_request_time
 
 	fr_channel_t		**channel;	//!< list of channels
+
+	bool			recv_batch;	//!< Gather requests in recv_pending instead of
+						//!< bootstrapping them immediately.
+	fr_channel_data_t	*recv_pending[WORKER_RECV_BATCH];	//!< Requests waiting to be bootstrapped.
+	size_t			num_recv_pending;	//!< Number of entries in recv_pending.
 };
 
 static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now);
@@ -125,6 +149,44 @@ static void worker_send_reply(fr_worker_t *worker, request_t *request, size_t si
 static void worker_max_request_time(UNUSED fr_event_list_t *el, UNUSED fr_time_t when, void *uctx);
 static void worker_max_request_timer(fr_worker_t *worker);
 
+/** Verify and bootstrap the requests gathered while draining a channel
+ *
+ * Runs of requests from the same listener are passed to the
+ * fr_app_t verify callback together, which lets it do the work for
+ * all of them in one pass.
+ *
+ * @param[in] worker	the worker
+ */
+static void worker_recv_flush(fr_worker_t *worker)
+{
+	fr_channel_data_t	*pending[WORKER_RECV_BATCH];
+	size_t			i, start, num = worker->num_recv_pending;
+
+	if (!num) return;
+
+	/*
+	 *	Bootstrapping may NAK a request, which
+	 *	can receive more requests from the channel.
+	 *	Those have to be bootstrapped immediately.
+	 */
+	memcpy(pending, worker->recv_pending, num * sizeof(pending[0]));
+	worker->num_recv_pending = 0;
+	worker->recv_batch = false;
+
+	for (start = 0, i = 1; i <= num; i++) {
+		fr_listen_t const *listen = pending[start]->listen;
+
+		if ((i < num) && (pending[i]->listen == listen)) continue;
+
+		if (listen->app->verify && ((i - start) > 1)) {
+			listen->app->verify(listen->app_instance, &pending[start], i - start);
+		}
+		start = i;
+	}
+
+	for (i = 0; i < num; i++) worker_request_bootstrap(worker, pending[i], fr_time());
+}
+
 /** Callback which handles a message being received on the worker side.
  *
  * @param[in] ctx the worker
@@ -138,7 +200,18 @@ static void worker_recv_request(void *ctx, fr_channel_t *ch, fr_channel_data_t *
 	worker->stats.in++;
 	DEBUG3("Received request %" PRIu64 "", worker->stats.in);
 	cd->channel.ch = ch;
-	worker_request_bootstrap(worker, cd, fr_time());
+	cd->request.verified = false;
+
+	if (!worker->recv_batch) {
+		worker_request_bootstrap(worker, cd, fr_time());
+		return;
+	}
+
+	worker->recv_pending[worker->num_recv_pending++] = cd;
+	if (worker->num_recv_pending == WORKER_RECV_BATCH) {
+		worker_recv_flush(worker);
+		worker->recv_batch = true;
+	}
 }
 
 static void worker_exit(fr_worker_t *worker)
@@ -199,10 +272,13 @@ static void worker_channel_callback(void *ctx, void const *data, size_t data_siz
 	case FR_CHANNEL_DATA_READY_RESPONDER:
 		fr_assert(ch != NULL);
 
+		worker->recv_batch = true;
 		if (!fr_channel_recv_request(ch)) {
 			worker->was_sleeping = was_sleeping;
 
 		} else while (fr_channel_recv_request(ch));
+		worker_recv_flush(worker);
+		worker->recv_batch = false;
 		break;
 
 	case FR_CHANNEL_OPEN:
@@ -654,6 +730,39 @@ void worker_request_init(fr_worker_t *worker, request_t *request, fr_time_t now)
 	request->async->el = worker->el;
 }
 
+/** Release the channel message a request was decoded from
+ *
+ */
+static int _worker_async_free(fr_async_t *async)
+{
+	if (async->msg) fr_message_done(async->msg);
+
+	return 0;
+}
+
+/** Copy the packet data out of the channel message
+ *
+ *  Requests which are decoded in place hold on to the channel
+ *  message, which stops the network thread from re-using that part
+ *  of its ring buffers.  That's fine for requests which are processed
+ *  quickly, but requests which yield may be around for a long time.
+ *  So we give the message back, and keep a copy of the packet.
+ */
+static void worker_request_localize(fr_worker_t *worker, request_t *request)
+{
+	fr_message_t *m = request->async->msg;
+
+	if (!m) return;
+
+	if (request->packet->data == m->data) {
+		MEM(request->packet->data = talloc_memdup(request->packet, m->data, request->packet->data_len));
+		worker->stats.bytes_copied += request->packet->data_len;
+	}
+
+	request->async->msg = NULL;
+	fr_message_done(m);
+}
+
 static inline CC_HINT(always_inline)
 void worker_request_name_number(request_t *request)
 {
@@ -700,8 +809,18 @@ static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd,
 
 	request->async->listen = cd->listen;
 	request->async->packet_ctx = cd->packet_ctx;
+	request->async->verified = cd->request.verified;
 	listen = request->async->listen;
 
+	/*
+	 *	Tell the decoder that it can point at the message
+	 *	data, instead of copying it.
+	 */
+	if (worker->config.zero_copy) {
+		request->async->msg = &cd->m;
+		talloc_set_destructor(request->async, _worker_async_free);
+	}
+
 	/*
 	 *	Now that the "request" structure has been initialized, go decode the packet.
 	 *
@@ -714,6 +833,7 @@ static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd,
 	}
 
 	if (ret < 0) {
+		request->async->msg = NULL;
 		talloc_free(ctx);
 nak:
 		worker_nak(worker, cd, now);
@@ -725,15 +845,23 @@ nak:
 	 */
 	if (unlang_call_push(request, cd->listen->server_cs, UNLANG_TOP_FRAME) < 0) {
 		RERROR("Protocol failed to set 'process' function");
+		request->async->msg = NULL;
 		worker_nak(worker, cd, now);
 		return;
 	}
 
+	is_dup = cd->request.is_dup;
+
 	/*
-	 *	We're done with this message.
+	 *	If the decoder pointed the packet at the message
+	 *	data, then the message is released when the request
+	 *	is freed.  Otherwise we're done with this message.
 	 */
-	is_dup = cd->request.is_dup;
-	fr_message_done(&cd->m);
+	if (!request->async->msg || (request->packet->data != cd->m.data)) {
+		request->async->msg = NULL;
+		worker->stats.bytes_copied += request->packet->data_len;
+		fr_message_done(&cd->m);
+	}
 
 	/*
 	 *	Look for conflicting / duplicate packets, but only if
@@ -932,6 +1060,28 @@ static void _worker_request_internal_init(request_t *request, void *uctx)
 }
 
 
+/** Record how much memory the attributes of a finished request used
+ *
+ * talloc_total_size() walks every attribute, so only one in
+ * #WORKER_MEMORY_SAMPLE requests is measured.
+ */
+static inline CC_HINT(always_inline)
+void worker_request_memory_stats(fr_worker_t *worker, request_t *request)
+{
+	size_t size;
+
+	worker->pairs_allocated = fr_pair_alloc_count();
+
+	if (!request->pair_root) return;
+
+	if ((worker->attr_requests++ % WORKER_MEMORY_SAMPLE) != 0) return;
+
+	worker->attr_sampled++;
+	size = talloc_total_size(request->pair_root);
+	worker->attr_bytes += size;
+	if (size > worker->config.talloc_pool_size) worker->attr_pool_overflow++;
+}
+
 /** External request is now complete
  *
  */
@@ -977,6 +1127,7 @@ static void _worker_request_done_external(request_t *request, UNUSED rlm_rcode_t
 	 *	The request is done.  Track that.
 	 */
 	worker_request_time_tracking_end(worker, request, now);
+	worker_request_memory_stats(worker, request);
 
 	/*
 	 *	These conditions are true when the server is
@@ -1118,10 +1269,19 @@ static void _worker_request_runnable(request_t *request, void *uctx)
 /** Interpreter yielded request
  *
  */
-static void _worker_request_yield(request_t *request, UNUSED void *uctx)
+static void _worker_request_yield(request_t *request, void *uctx)
 {
+	fr_worker_t	*worker = talloc_get_type_abort(uctx, fr_worker_t);
+
 	RDEBUG3("Request yielded");
 	fr_time_tracking_yield(&request->async->tracking, fr_time());
+
+	/*
+	 *	We don't know when the request will be resumed, so
+	 *	don't block the network side from cleaning up the
+	 *	message.
+	 */
+	worker_request_localize(worker, request);
 }
 
 /** Interpreter is starting to work on request again
@@ -1212,6 +1372,7 @@ nomem:
 	}
 
 	worker->name = talloc_strdup(worker, name); /* thread locality */
+	worker->numa_node = -1;
 
 	unlang_thread_instantiate(worker);
 
@@ -1236,6 +1397,13 @@ nomem:
 	CHECK_CONFIG(ring_buffer_size, (1 << 17), (1 << 20));
 	CHECK_CONFIG_TIME_DELTA(max_request_time, fr_time_delta_from_sec(30), fr_time_delta_from_sec(60));
 
+	/*
+	 *	Requests are allocated by the thread which runs
+	 *	them, and kept on a per-thread free list.  Give
+	 *	them enough room for their attributes.
+	 */
+	request_pool_attr_size_set(worker->config.talloc_pool_size);
+
 	worker->channel = talloc_zero_array(worker, fr_channel_t *, worker->config.max_channels);
 	if (!worker->channel) {
 		talloc_free(worker);
@@ -1491,6 +1659,29 @@ static void worker_verify(fr_worker_t *worker)
 }
 #endif
 
+/** Record which NUMA node a worker is running on
+ *
+ * Must be called before the worker is added to any network,
+ * as networks read this when the worker is added.
+ *
+ * @param[in] worker	to set the node for.
+ * @param[in] node	NUMA node, or -1 if unknown.
+ */
+void fr_worker_numa_node_set(fr_worker_t *worker, int node)
+{
+	worker->numa_node = node;
+}
+
+/** Return the NUMA node a worker is running on
+ *
+ * @param[in] worker	to get the node for.
+ * @return the NUMA node, or -1 if unknown.
+ */
+int fr_worker_numa_node(fr_worker_t const *worker)
+{
+	return worker->numa_node;
+}
+
 int fr_worker_stats(fr_worker_t const *worker, int num, uint64_t *stats)
 {
 	if (num < 0) return -1;
@@ -1502,10 +1693,12 @@ int fr_worker_stats(fr_worker_t const *worker, int num, uint64_t *stats)
 	if (num >= 4) stats[3] = worker->stats.dropped;
 	if (num >= 5) stats[4] = worker->num_naks;
 	if (num >= 6) stats[5] = worker->num_active;
+	if (num >= 7) stats[6] = worker->pairs_allocated;
+	if (num >= 8) stats[7] = worker->attr_pool_overflow;
 
-	if (num <= 6) return num;
+	if (num <= 8) return num;
 
-	return 6;
+	return 8;
 }
 
 static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_info_t const *info)
@@ -1518,9 +1711,21 @@ static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_inf
 		fprintf(fp, "count.out\t\t\t%" PRIu64 "\n", worker->stats.out);
 		fprintf(fp, "count.dup\t\t\t%" PRIu64 "\n", worker->stats.dup);
 		fprintf(fp, "count.dropped\t\t\t%" PRIu64 "\n", worker->stats.dropped);
+		fprintf(fp, "count.bytes_copied\t\t%" PRIu64 "\n", worker->stats.bytes_copied);
+		fprintf(fp, "count.bytes_copied_per_request\t%.1f\n",
+			worker->stats.in ? (double) worker->stats.bytes_copied / worker->stats.in : 0.0);
 		fprintf(fp, "count.naks\t\t\t%" PRIu64 "\n", worker->num_naks);
 		fprintf(fp, "count.active\t\t\t%" PRIu64 "\n", worker->num_active);
 		fprintf(fp, "count.runnable\t\t\t%u\n", fr_heap_num_elements(worker->runnable));
+		fprintf(fp, "count.pairs\t\t\t%" PRIu64 "\n", worker->pairs_allocated);
+		fprintf(fp, "count.pool_overflow\t\t%" PRIu64 "\n", worker->attr_pool_overflow);
+	}
+
+	if ((info->argc == 0) || (strcmp(info->argv[0], "memory") == 0)) {
+		fprintf(fp, "memory.pool_size\t\t%zu\n", worker->config.talloc_pool_size);
+		fprintf(fp, "memory.sampled\t\t\t%" PRIu64 "\n", worker->attr_sampled);
+		fprintf(fp, "memory.attrs_per_request\t%.1f\n",
+			worker->attr_sampled ? (double) worker->attr_bytes / worker->attr_sampled : 0.0);
 	}
 
 	if ((info->argc == 0) || (strcmp(info->argv[0], "cpu") == 0)) {
@@ -1556,7 +1761,7 @@ fr_cmd_table_t cmd_worker_table[] = {
 		.parent = "stats worker",
 		.add_name = true,
 		.name = "self",
-		.syntax = "[(count|cpu)]",
+		.syntax = "[(count|cpu|memory)]",
 		.func = cmd_stats_worker,
 		.help = "Show statistics for a specific worker thread.",
 		.read_only = true
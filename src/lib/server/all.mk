@@ -1,4 +1,5 @@
 SUBMAKEFILES := \
 	libfreeradius-server.mk \
 	pair_server_tests.mk \
+	state_test.mk \
 	trunk_tests.mk
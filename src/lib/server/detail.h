@@ -0,0 +1,161 @@
+#pragma once
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/server/detail.h
+ * @brief Binary detail record format, shared by rlm_detail and proto_detail.
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+RCSIDH(server_detail_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/util/dbuff.h>
+#include <freeradius-devel/util/strerror.h>
+#include <freeradius-devel/util/time.h>
+
+/*
+ *	A binary detail file is a sequence of records.  Each record
+ *	is a fixed header, followed by the attributes in the internal
+ *	encoding (see src/protocols/internal/encode.c).
+ *
+ *	 0                   1                   2                   3
+ *	 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	|     Magic     |    Version    |     Flags     |   Reserved    |
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	|               Record length (including header)                |
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	|                          Packet code                          |
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	|                           Protocol                            |
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	|                                                               |
+ *	+           Timestamp (nanoseconds since the epoch)             +
+ *	|                                                               |
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	|  Attributes...
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *
+ *	All fields are in network byte order.  The magic byte is never
+ *	printable, so a reader can tell a binary record from the date
+ *	header of a text entry by looking at the first byte of the file.
+ *
+ *	The flags byte is rewritten in place by the reader when it has
+ *	finished with the record, in the same way "Timestamp" is
+ *	overwritten with "Done" in text files.
+ */
+#define FR_DETAIL_BINARY_MAGIC		0xfd
+#define FR_DETAIL_BINARY_VERSION	1
+#define FR_DETAIL_BINARY_HDR_LEN	24
+#define FR_DETAIL_BINARY_FLAGS_OFFSET	2
+
+#define FR_DETAIL_BINARY_FLAG_DONE	0x01		//!< Record has been processed.
+
+typedef struct {
+	uint8_t			flags;			//!< FR_DETAIL_BINARY_FLAG_* values.
+	uint32_t		length;			//!< Of the complete record, including this header.
+	uint32_t		code;			//!< Packet code.
+	uint32_t		protocol;		//!< Number of the dictionary the attributes are from.
+	fr_unix_time_t		timestamp;		//!< When the original packet was received.
+} fr_detail_binary_hdr_t;
+
+/** Write a binary detail record header
+ *
+ * @param[out] dbuff	to write the header to.
+ * @param[in] hdr	to encode.
+ * @return
+ *	- FR_DETAIL_BINARY_HDR_LEN on success.
+ *	- <0 the number of bytes we would have needed.
+ */
+static inline ssize_t fr_detail_binary_hdr_encode(fr_dbuff_t *dbuff, fr_detail_binary_hdr_t const *hdr)
+{
+	fr_dbuff_t	work_dbuff = FR_DBUFF(dbuff);
+
+	FR_DBUFF_IN_BYTES_RETURN(&work_dbuff, FR_DETAIL_BINARY_MAGIC, FR_DETAIL_BINARY_VERSION, hdr->flags, 0x00);
+	FR_DBUFF_IN_RETURN(&work_dbuff, hdr->length);
+	FR_DBUFF_IN_RETURN(&work_dbuff, hdr->code);
+	FR_DBUFF_IN_RETURN(&work_dbuff, hdr->protocol);
+	FR_DBUFF_IN_RETURN(&work_dbuff, fr_unix_time_unwrap(hdr->timestamp));
+
+	return fr_dbuff_set(dbuff, &work_dbuff);
+}
+
+/** Read and validate a binary detail record header
+ *
+ * @param[out] hdr	the decoded header.
+ * @param[in] data	start of the record.
+ * @param[in] data_len	number of bytes available at data.  May be
+ *			larger than the record.
+ * @return
+ *	- FR_DETAIL_BINARY_HDR_LEN on success.
+ *	- -1 if the header is malformed, or the record is truncated.
+ */
+static inline ssize_t fr_detail_binary_hdr_decode(fr_detail_binary_hdr_t *hdr, uint8_t const *data, size_t data_len)
+{
+	fr_dbuff_t	dbuff = FR_DBUFF_TMP(data, data_len);
+	uint8_t		magic, version, reserved;
+	uint64_t	timestamp;
+
+	if (data_len < FR_DETAIL_BINARY_HDR_LEN) {
+		fr_strerror_printf("Binary detail record header truncated, need %u bytes, have %zu",
+				   FR_DETAIL_BINARY_HDR_LEN, data_len);
+		return -1;
+	}
+
+	FR_DBUFF_OUT_RETURN(&magic, &dbuff);
+	FR_DBUFF_OUT_RETURN(&version, &dbuff);
+	FR_DBUFF_OUT_RETURN(&hdr->flags, &dbuff);
+	FR_DBUFF_OUT_RETURN(&reserved, &dbuff);
+	FR_DBUFF_OUT_RETURN(&hdr->length, &dbuff);
+	FR_DBUFF_OUT_RETURN(&hdr->code, &dbuff);
+	FR_DBUFF_OUT_RETURN(&hdr->protocol, &dbuff);
+	FR_DBUFF_OUT_RETURN(&timestamp, &dbuff);
+	hdr->timestamp = fr_unix_time_wrap(timestamp);
+
+	if (magic != FR_DETAIL_BINARY_MAGIC) {
+		fr_strerror_printf("Invalid binary detail record magic 0x%02x", magic);
+		return -1;
+	}
+
+	if (version != FR_DETAIL_BINARY_VERSION) {
+		fr_strerror_printf("Unsupported binary detail record version %u", version);
+		return -1;
+	}
+
+	if (hdr->length < FR_DETAIL_BINARY_HDR_LEN) {
+		fr_strerror_printf("Binary detail record length %u is shorter than its header", hdr->length);
+		return -1;
+	}
+
+	if (hdr->length > data_len) {
+		fr_strerror_printf("Binary detail record truncated, need %u bytes, have %zu",
+				   hdr->length, data_len);
+		return -1;
+	}
+
+	return FR_DETAIL_BINARY_HDR_LEN;
+}
+
+#ifdef __cplusplus
+}
+#endif
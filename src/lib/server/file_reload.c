@@ -0,0 +1,296 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/*
+ * $Id$
+ *
+ * @file file_reload.c
+ * @brief Watch data files for changes, and reload them in the background.
+ *
+ * Modules which build large lookup structures from files (users,
+ * CSV, etc.) can use this to pick up changes without a HUP.  A
+ * dedicated thread periodically stat()s the files.  When any of them
+ * change, the module's callback builds a new copy of its data, and
+ * publishes it (usually with fr_rcu_publish()).  Workers carry on
+ * using the old data until the new data is ready.
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/io/schedule.h>
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/command.h>
+#include <freeradius-devel/server/file_reload.h>
+
+#include <freeradius-devel/util/debug.h>
+
+#include <pthread.h>
+#include <sys/stat.h>
+
+typedef struct {
+	bool			exists;
+	dev_t			dev;
+	ino_t			ino;
+	off_t			size;
+	time_t			mtime;
+	time_t			ctime;
+} file_reload_stat_t;
+
+struct file_reload_s {
+	char const		*name;			//!< Of the module, for logging and radmin.
+	char const		**filenames;		//!< Files to watch.  NULL entries are ignored.
+	file_reload_stat_t	*stats;			//!< What the files looked like when we last loaded them.
+	size_t			num_files;
+
+	fr_time_delta_t		interval;		//!< How often we check the files.
+	file_reload_func_t	func;			//!< Re-reads the files.
+	void			*uctx;			//!< Passed to func.
+
+	pthread_t		thread;
+	pthread_mutex_t		mutex;			//!< Protects everything below.
+	pthread_cond_t		cond;			//!< Signalled to stop the thread.
+	bool			running;
+	bool			stop;
+
+	uint64_t		reloads;		//!< Number of successful reloads.
+	uint64_t		failed;			//!< Number of failed reloads.
+	int64_t			entries;		//!< Loaded by the last successful reload.
+	fr_unix_time_t		last;			//!< When the last successful reload finished.
+	fr_time_delta_t		duration;		//!< How long the last successful reload took.
+};
+
+static void file_reload_stat(file_reload_t const *reload, file_reload_stat_t *out)
+{
+	size_t i;
+
+	for (i = 0; i < reload->num_files; i++) {
+		struct stat buf;
+
+		memset(&out[i], 0, sizeof(out[i]));
+
+		if (!reload->filenames[i] || (stat(reload->filenames[i], &buf) < 0)) continue;
+
+		out[i].exists = true;
+		out[i].dev = buf.st_dev;
+		out[i].ino = buf.st_ino;
+		out[i].size = buf.st_size;
+		out[i].mtime = buf.st_mtime;
+		out[i].ctime = buf.st_ctime;
+	}
+}
+
+static bool file_reload_changed(file_reload_t const *reload, file_reload_stat_t const *now)
+{
+	size_t i;
+
+	for (i = 0; i < reload->num_files; i++) {
+		file_reload_stat_t const *old = &reload->stats[i];
+
+		if ((now[i].exists != old->exists) ||
+		    (now[i].dev != old->dev) ||
+		    (now[i].ino != old->ino) ||
+		    (now[i].size != old->size) ||
+		    (now[i].mtime != old->mtime) ||
+		    (now[i].ctime != old->ctime)) return true;
+	}
+
+	return false;
+}
+
+/** Check the files, and reload them if any have changed
+ *
+ */
+static void file_reload_check(file_reload_t *reload)
+{
+	file_reload_stat_t	now[reload->num_files];
+	fr_time_t		start;
+	int64_t			entries;
+
+	file_reload_stat(reload, now);
+	if (!file_reload_changed(reload, now)) return;
+
+	INFO("%s - Files have changed, reloading", reload->name);
+
+	start = fr_time();
+	entries = reload->func(reload->uctx);
+	if (entries < 0) {
+		/*
+		 *	Leave the old stat data alone, so that we try
+		 *	again on the next check.  The file may have been
+		 *	part way through being written.
+		 */
+		PERROR("%s - Failed reloading files, continuing with the old data", reload->name);
+
+		pthread_mutex_lock(&reload->mutex);
+		reload->failed++;
+		pthread_mutex_unlock(&reload->mutex);
+		return;
+	}
+
+	memcpy(reload->stats, now, sizeof(now));
+
+	pthread_mutex_lock(&reload->mutex);
+	reload->reloads++;
+	reload->entries = entries;
+	reload->duration = fr_time_sub(fr_time(), start);
+	reload->last = fr_time_to_unix_time(fr_time());
+	pthread_mutex_unlock(&reload->mutex);
+
+	INFO("%s - Reloaded %" PRId64 " entries in %pVs", reload->name, entries,
+	     fr_box_time_delta(reload->duration));
+}
+
+static void *file_reload_thread(void *arg)
+{
+	file_reload_t	*reload = arg;
+
+	pthread_mutex_lock(&reload->mutex);
+	while (!reload->stop) {
+		struct timespec	when;
+		fr_time_delta_t	delay;
+
+		clock_gettime(CLOCK_REALTIME, &when);
+		delay = fr_time_delta_add(fr_time_delta_from_timespec(&when), reload->interval);
+		when = fr_time_delta_to_timespec(delay);
+
+		pthread_cond_timedwait(&reload->cond, &reload->mutex, &when);
+		if (reload->stop) break;
+
+		pthread_mutex_unlock(&reload->mutex);
+		file_reload_check(reload);
+		pthread_mutex_lock(&reload->mutex);
+	}
+	pthread_mutex_unlock(&reload->mutex);
+
+	return NULL;
+}
+
+static int _file_reload_free(file_reload_t *reload)
+{
+	if (reload->running) {
+		pthread_mutex_lock(&reload->mutex);
+		reload->stop = true;
+		pthread_cond_signal(&reload->cond);
+		pthread_mutex_unlock(&reload->mutex);
+
+		pthread_join(reload->thread, NULL);
+	}
+
+	pthread_cond_destroy(&reload->cond);
+	pthread_mutex_destroy(&reload->mutex);
+
+	return 0;
+}
+
+static int cmd_show_reload(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	file_reload_t	*reload = talloc_get_type_abort(ctx, file_reload_t);
+	size_t		i;
+
+	pthread_mutex_lock(&reload->mutex);
+	for (i = 0; i < reload->num_files; i++) {
+		if (reload->filenames[i]) fprintf(fp, "file\t%s\n", reload->filenames[i]);
+	}
+	fprintf(fp, "entries\t%" PRId64 "\n", reload->entries);
+	fprintf(fp, "count.reloads\t%" PRIu64 "\n", reload->reloads);
+	fprintf(fp, "count.failed\t%" PRIu64 "\n", reload->failed);
+	if (reload->reloads) {
+		fr_fprintf(fp, "last\t%pV\n", fr_box_date(reload->last));
+		fr_fprintf(fp, "duration\t%pVs\n", fr_box_time_delta(reload->duration));
+	}
+	pthread_mutex_unlock(&reload->mutex);
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_table[] = {
+	{
+		.parent = "show module",
+		.add_name = true,
+		.name = "reload",
+		.func = cmd_show_reload,
+		.help = "Show when the module last reloaded its data files, and how long it took.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
+/** Start watching files for changes
+ *
+ * The files are assumed to have been loaded already.  The thread is
+ * stopped when the returned structure is freed.
+ *
+ * Files should be replaced atomically (i.e. written to a temporary
+ * file, and renamed), otherwise a partially written file may be
+ * loaded.
+ *
+ * @param[in] ctx		to allocate the structure in.
+ * @param[in] name		of the module instance.
+ * @param[in] filenames		talloc array of files to watch.  NULL entries are
+ *				ignored.  The strings must remain valid until
+ *				the structure is freed.
+ * @param[in] interval		how often to check the files.
+ * @param[in] func		called to reload the files.
+ * @param[in] uctx		passed to func.
+ * @return
+ *	- The new structure.
+ *	- NULL on error.
+ */
+file_reload_t *file_reload_alloc(TALLOC_CTX *ctx, char const *name, char const **filenames,
+				 fr_time_delta_t interval, file_reload_func_t func, void *uctx)
+{
+	file_reload_t	*reload;
+
+	MEM(reload = talloc_zero(ctx, file_reload_t));
+	reload->name = name;
+	reload->num_files = talloc_array_length(filenames);
+	MEM(reload->filenames = talloc_memdup(reload, filenames, reload->num_files * sizeof(filenames[0])));
+	MEM(reload->stats = talloc_zero_array(reload, file_reload_stat_t, reload->num_files));
+	reload->interval = interval;
+	reload->func = func;
+	reload->uctx = uctx;
+
+	pthread_mutex_init(&reload->mutex, NULL);
+	pthread_cond_init(&reload->cond, NULL);
+	talloc_set_destructor(reload, _file_reload_free);
+
+	file_reload_stat(reload, reload->stats);
+
+	if (fr_schedule_pthread_create(&reload->thread, file_reload_thread, reload) < 0) {
+		fr_strerror_const_push("Failed creating reload thread");
+		talloc_free(reload);
+		return NULL;
+	}
+	reload->running = true;
+
+	if (fr_command_register_hook(NULL, name, reload, cmd_table) < 0) {
+		PWARN("%s - Failed registering radmin commands", name);
+	}
+
+	return reload;
+}
+
+/** Record how many entries were loaded at startup
+ *
+ */
+void file_reload_entries_set(file_reload_t *reload, int64_t entries)
+{
+	pthread_mutex_lock(&reload->mutex);
+	reload->entries = entries;
+	pthread_mutex_unlock(&reload->mutex);
+}
@@ -0,0 +1,55 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/server/file_reload.h
+ * @brief Watch data files for changes, and reload them in the background.
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+RCSIDH(file_reload_h, "$Id$")
+
+#include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct file_reload_s file_reload_t;
+
+/** Re-read the data files, and publish the result
+ *
+ * Called from the reload thread, never from a worker.
+ *
+ * @param[in] uctx	passed to file_reload_alloc().
+ * @return
+ *	- >= 0 the number of entries loaded.
+ *	- < 0 on error.  The old data should be left in place.
+ */
+typedef int64_t (*file_reload_func_t)(void *uctx);
+
+file_reload_t	*file_reload_alloc(TALLOC_CTX *ctx, char const *name, char const **filenames,
+				   fr_time_delta_t interval, file_reload_func_t func, void *uctx);
+
+void		file_reload_entries_set(file_reload_t *reload, int64_t entries);
+
+#ifdef __cplusplus
+}
+#endif
@@ -16,6 +16,7 @@ SOURCES	:= \
 	exec.c \
 	exec_legacy.c \
 	exfile.c \
+	file_reload.c \
 	log.c \
 	main_config.c \
 	main_loop.c \
@@ -40,6 +41,7 @@ SOURCES	:= \
 	tmpl_tokenize.c \
 	trigger.c \
 	trunk.c \
+	trunk_shared.c \
 	users_file.c \
 	util.c \
 	virtual_servers.c
@@ -72,5 +74,5 @@ $(call DEFINE_LOG_ID_SECTION,map,	5,map.c map_proc.c map_async.c)
 $(call DEFINE_LOG_ID_SECTION,snmp,	6,snmp.c)
 $(call DEFINE_LOG_ID_SECTION,templates,	7,tmpl_eval.c tmpl_tokenize.c)
 $(call DEFINE_LOG_ID_SECTION,triggers,	8,trigger.c)
-$(call DEFINE_LOG_ID_SECTION,trunk,	9,trunk.c)
+$(call DEFINE_LOG_ID_SECTION,trunk,	9,trunk.c trunk_shared.c)
 $(call DEFINE_LOG_ID_SECTION,virtual_servers,10,virtual_servers.c)
@@ -168,6 +168,15 @@ static const CONF_PARSER thread_config[] = {
 
 	{ FR_CONF_OFFSET("stats_interval", FR_TYPE_TIME_DELTA | FR_TYPE_HIDDEN, main_config_t, stats_interval), },
 
+	{ FR_CONF_OFFSET("shard_listeners", FR_TYPE_BOOL, main_config_t, shard_listeners), .dflt = "no" },
+	{ FR_CONF_OFFSET("shard_by_src_ipaddr", FR_TYPE_BOOL, main_config_t, shard_by_src_ipaddr), .dflt = "no" },
+	{ FR_CONF_OFFSET("cpu_affinity", FR_TYPE_BOOL, main_config_t, cpu_affinity), .dflt = "no" },
+	{ FR_CONF_OFFSET("timer_wheel_tick", FR_TYPE_TIME_DELTA, main_config_t, timer_wheel_tick), .dflt = "0" },
+	{ FR_CONF_OFFSET("zero_copy", FR_TYPE_BOOL, main_config_t, zero_copy), .dflt = "no" },
+
+	{ FR_CONF_OFFSET("num_offload_threads", FR_TYPE_UINT32, main_config_t, num_offload_threads), .dflt = "0" },
+	{ FR_CONF_OFFSET("offload_queue_size", FR_TYPE_UINT32, main_config_t, offload_queue_size), .dflt = "1024" },
+
 #ifdef HAVE_OPENSSL_CRYPTO_H
 	{ FR_CONF_OFFSET("openssl_async_pool_init", FR_TYPE_SIZE, main_config_t, openssl_async_pool_init), .dflt = "64" },
 	{ FR_CONF_OFFSET("openssl_async_pool_max", FR_TYPE_SIZE, main_config_t, openssl_async_pool_max), .dflt = "1024" },
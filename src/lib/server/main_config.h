@@ -149,6 +149,14 @@ struct main_config_s {
 	uint32_t	max_networks;			//!< for the scheduler
 	uint32_t	max_workers;			//!< for the scheduler
 	fr_time_delta_t	stats_interval;			//!< for the scheduler
+	bool		shard_listeners;		//!< for the scheduler
+	bool		shard_by_src_ipaddr;		//!< for the scheduler
+	bool		cpu_affinity;			//!< for the scheduler
+	fr_time_delta_t	timer_wheel_tick;		//!< for the scheduler
+	bool		zero_copy;			//!< for the workers
+
+	uint32_t	num_offload_threads;		//!< for CPU-heavy work, such as password hashing
+	uint32_t	offload_queue_size;		//!< jobs waiting for an offload thread
 
 };
 
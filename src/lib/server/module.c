@@ -1600,7 +1600,18 @@ module_instance_t *module_bootstrap(module_instance_t const *parent, CONF_SECTIO
 	 *	Compile the default "actions" subsection, which includes retries.
 	 */
 	actions = cf_section_find(cs, "actions", NULL);
-	if (actions && unlang_compile_actions(&mi->actions, actions, (mi->module->type & RLM_TYPE_RETRY) != 0)) {
+	if (actions && !unlang_compile_actions(&mi->actions, actions, (mi->module->type & RLM_TYPE_RETRY) != 0)) {
+		talloc_free(mi);
+		return NULL;
+	}
+
+	/*
+	 *	The weight is set where the module is used,
+	 *	in a keyed load-balance section.
+	 */
+	if (mi->actions.weight) {
+		cf_log_err(actions, "'weight' is only allowed in the children of a keyed "
+			   "'load-balance' or 'redundant-load-balance' section");
 		talloc_free(mi);
 		return NULL;
 	}
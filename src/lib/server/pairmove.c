@@ -141,12 +141,11 @@ void radius_pairmove(request_t *request, fr_pair_list_t *to, fr_pair_list_t *fro
 			 *	the one in the "from" list.
 			 */
 			if (from_vp->op == T_OP_SET) {
-				fr_pair_t *vp;
 				RDEBUG4("::: OVERWRITING %s FROM %d TO %d",
 				       to_vp->da->name, i, j);
 				fr_pair_remove(from, from_vp);
-				vp = fr_dlist_replace(&to->order.head, to_vp, from_vp);
-				talloc_free(vp);
+				fr_pair_replace(to, to_vp, from_vp);
+				talloc_free(to_vp);
 				from_vp = NULL;
 				edited[j] = true;
 				break;
@@ -222,12 +221,11 @@ void radius_pairmove(request_t *request, fr_pair_list_t *to, fr_pair_list_t *fro
 					 */
 				case T_OP_LE:
 					if (rcode > 0) {
-						fr_pair_t *vp;
 						RDEBUG4("::: REPLACING %s FROM %d TO %d",
 						       from_vp->da->name, i, j);
 						fr_pair_remove(from, from_vp);
-						vp = fr_dlist_replace(&to->order.head, to_vp, from_vp);
-						talloc_free(vp);
+						fr_pair_replace(to, to_vp, from_vp);
+						talloc_free(to_vp);
 						from_vp = NULL;
 						edited[j] = true;
 					}
@@ -235,12 +233,11 @@ void radius_pairmove(request_t *request, fr_pair_list_t *to, fr_pair_list_t *fro
 
 				case T_OP_GE:
 					if (rcode < 0) {
-						fr_pair_t *vp;
 						RDEBUG4("::: REPLACING %s FROM %d TO %d",
 						       from_vp->da->name, i, j);
 						fr_pair_remove(from, from_vp);
-						vp = fr_dlist_replace(&to->order.head, to_vp, from_vp);
-						talloc_free(vp);
+						fr_pair_replace(to, to_vp, from_vp);
+						talloc_free(to_vp);
 						from_vp = NULL;
 						edited[j] = true;
 					}
@@ -59,6 +59,11 @@ fr_dict_attr_autoload_t request_dict_attr[] = {
  */
 static _Thread_local fr_dlist_head_t *request_free_list; /* macro */
 
+/** Extra pool memory for the attributes of requests allocated by this thread
+ *
+ */
+static _Thread_local size_t request_pool_attr_size;
+
 #ifndef NDEBUG
 static int _state_ctx_free(fr_pair_t *state)
 {
@@ -253,6 +258,15 @@ static inline CC_HINT(always_inline) int request_init(char const *file, int line
 			talloc_set_destructor(request->pair_list.state, _state_ctx_free);
 #endif
 		}
+
+		/*
+		 *	Policies do most of their lookups in
+		 *	these lists, which can be long, e.g.
+		 *	for accounting.
+		 */
+		if ((fr_pair_list_index_enable(request->request_ctx, &request->request_pairs) < 0) ||
+		    (fr_pair_list_index_enable(request->reply_ctx, &request->reply_pairs) < 0) ||
+		    (fr_pair_list_index_enable(request->control_ctx, &request->control_pairs) < 0)) return -1;
 	}
 
 	/*
@@ -399,10 +413,12 @@ static inline CC_HINT(always_inline) request_t *request_alloc_pool(TALLOC_CTX *c
 					   1 + 					/* Stack pool */
 					   UNLANG_STACK_MAX + 			/* Stack Frames */
 					   2 + 					/* packets */
+					   (request_pool_attr_size / sizeof(fr_pair_t)) + /* attributes */
 					   10,					/* extra */
 					   (UNLANG_FRAME_PRE_ALLOC * UNLANG_STACK_MAX) +	/* Stack memory */
 					   (sizeof(fr_pair_t) * 5) +		/* pair lists and root*/
 					   (sizeof(fr_radius_packet_t) * 2) +	/* packets */
+					   request_pool_attr_size +		/* attributes and their values */
 					   128					/* extra */
 					   ));
 	fr_assert(ctx != request);
@@ -410,6 +426,24 @@ static inline CC_HINT(always_inline) request_t *request_alloc_pool(TALLOC_CTX *c
 	return request;
 }
 
+/** Reserve memory in each request for its attributes
+ *
+ * Requests are talloc pools, so attributes decoded into the request's
+ * lists, and their values, are carved out of the pool instead of each
+ * one being a separate malloc().  The pool is reset in one go when
+ * the request is returned to the free list.  Attributes which don't
+ * fit in the pool are allocated as normal.
+ *
+ * Only affects requests which are allocated by the calling thread,
+ * after this function is called.
+ *
+ * @param[in] size	in bytes, to reserve for attributes.
+ */
+void request_pool_attr_size_set(size_t size)
+{
+	request_pool_attr_size = size;
+}
+
 /** Create a new request_t data structure
  *
  * @param[in] file	where the request was allocated.
@@ -58,6 +58,18 @@ RCSID("$Id$")
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/rand.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+/** Number of shards to use for thread safe state trees
+ *
+ * Must be a power of two.
+ */
+#define STATE_TREE_SHARDS	64
+
 /** Holds a state value, and associated fr_pair_ts and data
  *
  */
@@ -142,19 +154,33 @@ typedef struct {
 	request_t		*thawed;			//!< The request that thawed this entry.
 } state_child_entry_t;
 
-struct fr_state_tree_s {
-	uint64_t		id;				//!< Next ID to assign.
+/** One shard of a state tree
+ *
+ * Entries are distributed between shards using a hash of their state value,
+ * so that workers operating on different sessions rarely contend for the
+ * same mutex.  Each shard expires its own entries.
+ */
+typedef struct {
+	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
+	fr_rb_tree_t		*tree;				//!< rbtree used to lookup state value.
+	fr_dlist_head_t		to_expire;			//!< Linked list of entries to free.
 	uint64_t		timed_out;			//!< Number of states that were cleaned up due to
 								//!< timeout.
+} fr_state_shard_t;
+
+struct fr_state_tree_s {
+	atomic_uint_fast64_t	id;				//!< Next ID to assign.
 	uint32_t		max_sessions;			//!< Maximum number of sessions we track.
-	uint32_t		used_sessions;			//!< How many sessions are currently in progress.
-	fr_rb_tree_t		*tree;				//!< rbtree used to lookup state value.
-	fr_dlist_head_t		to_expire;			//!< Linked list of entries to free.
+	atomic_uint_fast32_t	used_sessions;			//!< How many sessions are currently in progress.
+
+	fr_state_shard_t	*shard;				//!< Array of shards, indexed by state hash.
+	uint32_t		num_shards;			//!< How many shards were initialised.
+								///< Always a power of two once the tree is
+								///< fully initialised.
 
 	fr_time_delta_t		timeout;			//!< How long to wait before cleaning up state entires.
 
-	bool			thread_safe;			//!< Whether we lock the tree whilst modifying it.
-	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
+	bool			thread_safe;			//!< Whether we lock the shards whilst modifying them.
 
 	uint8_t			server_id;			//!< ID to use for load balancing.
 	uint32_t		context_id;			//!< ID binding state values to a context such
@@ -166,7 +192,7 @@ struct fr_state_tree_s {
 #define PTHREAD_MUTEX_LOCK if (state->thread_safe) pthread_mutex_lock
 #define PTHREAD_MUTEX_UNLOCK if (state->thread_safe) pthread_mutex_unlock
 
-static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry);
+static void state_entry_unlink(fr_state_shard_t *shard, fr_state_entry_t *entry);
 
 /** Compare two fr_state_entry_t based on their state value i.e. the value of the attribute
  *
@@ -185,31 +211,37 @@ static int8_t state_entry_cmp(void const *one, void const *two)
  */
 static int _state_tree_free(fr_state_tree_t *state)
 {
-	fr_state_entry_t *entry;
-
-	if (state->thread_safe) pthread_mutex_destroy(&state->mutex);
+	fr_state_entry_t	*entry;
+	uint32_t		i;
 
 	DEBUG4("Freeing state tree %p", state);
 
-	while ((entry = fr_dlist_head(&state->to_expire))) {
-		DEBUG4("Freeing state entry %p (%"PRIu64")", entry, entry->id);
-		state_entry_unlink(state, entry);
-		talloc_free(entry);
-	}
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shard[i];
 
-	/*
-	 *	Free the rbtree
-	 */
-	talloc_free(state->tree);
+		if (state->thread_safe) pthread_mutex_destroy(&shard->mutex);
+
+		while ((entry = fr_dlist_head(&shard->to_expire))) {
+			DEBUG4("Freeing state entry %p (%"PRIu64")", entry, entry->id);
+			state_entry_unlink(shard, entry);
+			talloc_free(entry);
+		}
+
+		/*
+		 *	Free the rbtree
+		 */
+		talloc_free(shard->tree);
+	}
 
 	return 0;
 }
 
-/** Initialise a new state tree
+/** Allocate a state tree with a specific number of shards
  *
  * @param[in] ctx		to link the lifecycle of the state tree to.
  * @param[in] da		Attribute used to store and retrieve state from.
- * @param[in] thread_safe		Whether we should mutex protect the state tree.
+ * @param[in] thread_safe	Whether we should mutex protect the shards.
+ * @param[in] num_shards	to split the tree into.  Must be a power of two.
  * @param[in] max_sessions	we track state for.
  * @param[in] timeout		How long to wait before cleaning up entries.
  * @param[in] server_id		ID byte to use in load-balancing operations.
@@ -219,17 +251,21 @@ static int _state_tree_free(fr_state_tree_t *state)
  *	- A new state tree.
  *	- NULL on failure.
  */
-fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, bool thread_safe,
-				    uint32_t max_sessions, fr_time_delta_t timeout,
-				    uint8_t server_id, uint32_t context_id)
+static fr_state_tree_t *state_tree_alloc(TALLOC_CTX *ctx, fr_dict_attr_t const *da, bool thread_safe,
+					 uint32_t num_shards, uint32_t max_sessions, fr_time_delta_t timeout,
+					 uint8_t server_id, uint32_t context_id)
 {
 	fr_state_tree_t *state;
+	uint32_t	i;
+
+	fr_assert(num_shards && ((num_shards & (num_shards - 1)) == 0));
 
 	state = talloc_zero(NULL, fr_state_tree_t);
 	if (!state) return 0;
 
 	state->max_sessions = max_sessions;
 	state->timeout = timeout;
+	state->thread_safe = thread_safe;
 
 	/*
 	 *	Create a break in the contexts.
@@ -240,55 +276,237 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, b
 	 */
 	talloc_link_ctx(ctx, state);
 
-	if (thread_safe && (pthread_mutex_init(&state->mutex, NULL) != 0)) {
+	state->shard = talloc_zero_array(state, fr_state_shard_t, num_shards);
+	if (!state->shard) {
 		talloc_free(state);
 		return NULL;
 	}
+	talloc_set_destructor(state, _state_tree_free);
 
-	fr_dlist_talloc_init(&state->to_expire, fr_state_entry_t, free_entry);
+	for (i = 0; i < num_shards; i++) {
+		fr_state_shard_t *shard = &state->shard[i];
 
-	/*
-	 *	We need to do controlled freeing of the
-	 *	rbtree, so that all the state entries
-	 *	are freed before it's destroyed.  Hence
-	 *	it being parented from the NULL ctx.
-	 */
-	state->tree = fr_rb_inline_talloc_alloc(NULL, fr_state_entry_t, node, state_entry_cmp, NULL);
-	if (!state->tree) {
-		talloc_free(state);
-		return NULL;
+		if (thread_safe && (pthread_mutex_init(&shard->mutex, NULL) != 0)) {
+			talloc_free(state);
+			return NULL;
+		}
+
+		fr_dlist_talloc_init(&shard->to_expire, fr_state_entry_t, free_entry);
+
+		/*
+		 *	We need to do controlled freeing of the
+		 *	rbtree, so that all the state entries
+		 *	are freed before it's destroyed.  Hence
+		 *	it being parented from the NULL ctx.
+		 */
+		shard->tree = fr_rb_inline_talloc_alloc(NULL, fr_state_entry_t, node, state_entry_cmp, NULL);
+		if (!shard->tree) {
+			if (thread_safe) pthread_mutex_destroy(&shard->mutex);
+			talloc_free(state);
+			return NULL;
+		}
+
+		state->num_shards++;	/* Only count fully initialised shards */
 	}
-	talloc_set_destructor(state, _state_tree_free);
 
 	state->da = da;		/* Remember which attribute we use to load/store state */
 	state->server_id = server_id;
 	state->context_id = context_id;
-	state->thread_safe = thread_safe;
 
 	return state;
 }
 
+/** Initialise a new state tree
+ *
+ * @param[in] ctx		to link the lifecycle of the state tree to.
+ * @param[in] da		Attribute used to store and retrieve state from.
+ * @param[in] thread_safe		Whether we should mutex protect the state tree.
+ * @param[in] max_sessions	we track state for.
+ * @param[in] timeout		How long to wait before cleaning up entries.
+ * @param[in] server_id		ID byte to use in load-balancing operations.
+ * @param[in] context_id	Specifies a unique ctx id to prevent states being
+ *				used in contexts for which they weren't intended.
+ * @return
+ *	- A new state tree.
+ *	- NULL on failure.
+ */
+fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, bool thread_safe,
+				    uint32_t max_sessions, fr_time_delta_t timeout,
+				    uint8_t server_id, uint32_t context_id)
+{
+	/*
+	 *	Trees shared between workers are split into
+	 *	shards so that lookups and insertions for
+	 *	different sessions don't serialise on a single
+	 *	mutex.
+	 */
+	return state_tree_alloc(ctx, da, thread_safe, thread_safe ? STATE_TREE_SHARDS : 1,
+				max_sessions, timeout, server_id, context_id);
+}
+
 /** Unlink an entry and remove if from the tree
  *
  */
 static inline CC_HINT(always_inline)
-void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry)
+void state_entry_unlink(fr_state_shard_t *shard, fr_state_entry_t *entry)
 {
 	/*
 	 *	Check the memory is still valid
 	 */
 	(void) talloc_get_type_abort(entry, fr_state_entry_t);
 
-	fr_dlist_remove(&state->to_expire, entry);
-	fr_rb_delete(state->tree, entry);
+	fr_dlist_remove(&shard->to_expire, entry);
+	fr_rb_delete(shard->tree, entry);
 
 	DEBUG4("State ID %" PRIu64 " unlinked", entry->id);
 }
 
-/** Frees any data associated with a state
+/** Return the shard a state value belongs in
  *
+ * @note Must be called with the final state value, i.e. after the context_id has been applied.
  */
-static int _state_entry_free(fr_state_entry_t *entry)
+static inline CC_HINT(always_inline)
+fr_state_shard_t *state_shard(fr_state_tree_t *state, uint8_t const *value)
+{
+	if (state->num_shards == 1) return &state->shard[0];
+
+	return &state->shard[fr_hash(value, sizeof(((fr_state_entry_t *)NULL)->state)) & (state->num_shards - 1)];
+}
+
+/** Unlink any entries in a shard which have passed their cleanup time
+ *
+ * @note Called with the shard mutex held.
+ *
+ * @param[in] shard	to expire entries in.
+ * @param[in] now	The current time.
+ * @param[out] to_free	List to add the unlinked entries to.  They should
+ *			be freed after the mutex has been released.
+ * @return The number of entries unlinked.
+ */
+static uint64_t state_shard_expire(fr_state_shard_t *shard, fr_time_t now, fr_dlist_head_t *to_free)
+{
+	fr_state_entry_t	*entry, *next;
+	uint64_t		timed_out = 0;
+
+	for (entry = fr_dlist_head(&shard->to_expire);
+	     entry != NULL;
+	     entry = next) {
+		(void)talloc_get_type_abort(entry, fr_state_entry_t);	/* Allow examination */
+		next = fr_dlist_next(&shard->to_expire, entry);		/* Advance *before* potential unlinking */
+
+		/*
+		 *	The list is ordered by cleanup time,
+		 *	so the first entry which is still
+		 *	live means we're done.
+		 */
+		if (!fr_time_lt(entry->cleanup, now)) break;
+
+		state_entry_unlink(shard, entry);
+		fr_dlist_insert_tail(to_free, entry);
+		timed_out++;
+	}
+
+	shard->timed_out += timed_out;
+
+	return timed_out;
+}
+
+/** Unlink expired entries from every shard in the tree
+ *
+ * Only used when we're at the session limit, as expired entries in
+ * other shards may be holding sessions we could otherwise reuse.
+ */
+static uint64_t state_tree_expire(fr_state_tree_t *state, fr_time_t now, fr_dlist_head_t *to_free)
+{
+	uint32_t	i;
+	uint64_t	timed_out = 0;
+
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shard[i];
+
+		PTHREAD_MUTEX_LOCK(&shard->mutex);
+		timed_out += state_shard_expire(shard, now, to_free);
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+	}
+
+	return timed_out;
+}
+
+/** Free a list of unlinked entries
+ *
+ * We do it outside of the critical region as freeing may involve
+ * significantly more work than just freeing the data.
+ *
+ * If there's request data that was persisted it will now be freed
+ * also, and it may have complex destructors associated with it.
+ */
+static void state_entry_list_free(fr_dlist_head_t *to_free)
+{
+	fr_state_entry_t *entry;
+
+	while ((entry = fr_dlist_head(to_free)) != NULL) {
+		fr_dlist_remove(to_free, entry);
+		talloc_free(entry);
+	}
+}
+
+/** Insert an entry into the shard its state value maps to
+ *
+ * Any expired entries in the same shard are unlinked whilst we hold
+ * the mutex, and added to to_free.
+ *
+ * @param[in] state	tree to insert the entry into.
+ * @param[in] entry	to insert.  Its state value must be final.
+ * @param[in] now	The current time.
+ * @param[out] to_free	List to add expired entries to.
+ * @param[out] timed_out	Incremented by the number of expired entries.
+ * @return
+ *	- 0 on success.
+ *	- -1 if an entry with the same state value already exists.
+ */
+static int state_entry_insert(fr_state_tree_t *state, fr_state_entry_t *entry, fr_time_t now,
+			      fr_dlist_head_t *to_free, uint64_t *timed_out)
+{
+	fr_state_shard_t	*shard = state_shard(state, entry->state);
+	int			ret = 0;
+
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+	*timed_out += state_shard_expire(shard, now, to_free);
+
+	if (!fr_rb_insert(shard->tree, entry)) {
+		ret = -1;
+	} else {
+		/*
+		 *	Link it to the end of the list, which is implicitely
+		 *	ordered by cleanup time.
+		 */
+		fr_dlist_insert_tail(&shard->to_expire, entry);
+	}
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+
+	return ret;
+}
+
+/** Reserve a session, failing if we're at max_sessions
+ *
+ */
+static inline CC_HINT(always_inline)
+bool state_session_reserve(fr_state_tree_t *state)
+{
+	uint_fast32_t used = atomic_load_explicit(&state->used_sessions, memory_order_relaxed);
+
+	do {
+		if (used >= state->max_sessions) return false;
+	} while (!atomic_compare_exchange_weak_explicit(&state->used_sessions, &used, used + 1,
+							memory_order_relaxed, memory_order_relaxed));
+
+	return true;
+}
+
+/** Frees any data associated with a state, without releasing its session
+ *
+ */
+static void state_entry_data_free(fr_state_entry_t *entry)
 {
 #ifdef WITH_VERIFY_PTR
 	fr_dcursor_t cursor;
@@ -317,31 +535,43 @@ static int _state_entry_free(fr_state_entry_t *entry)
 	 *	Should also free any state attributes
 	 */
 	if (entry->ctx) TALLOC_FREE(entry->ctx);
+}
+
+/** Frees any data associated with a state, and releases its session
+ *
+ */
+static int _state_entry_free(fr_state_entry_t *entry)
+{
+	state_entry_data_free(entry);
 
 	DEBUG4("State ID %" PRIu64 " freed", entry->id);
 
-	entry->state_tree->used_sessions--;
+	atomic_fetch_sub_explicit(&entry->state_tree->used_sessions, 1, memory_order_relaxed);
 
 	return 0;
 }
 
-/** Create a new state entry
+/** Create a new state entry and insert it into the tree
+ *
+ * The entry takes ownership of the request's session_state_ctx and
+ * the persistable request data in data, before it becomes visible
+ * to other threads.
  *
- * @note Called with the mutex held.
+ * @note Called with no shard mutexes held.
  */
 static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *request,
-					    fr_pair_list_t *reply_list, fr_state_entry_t *old)
+					    fr_pair_list_t *reply_list, fr_state_entry_t *old,
+					    fr_dlist_head_t *data)
 {
 	size_t			i;
 	uint32_t		x;
 	fr_time_t		now = fr_time();
 	fr_pair_t		*vp;
-	fr_state_entry_t	*entry, *next;
+	fr_state_entry_t	*entry;
 
 	uint8_t			old_state[sizeof(old->state)];
 	int			old_tries = 0;
 	uint64_t		timed_out = 0;
-	bool			too_many = false;
 	fr_dlist_head_t		to_free;
 
 	/*
@@ -353,85 +583,41 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 
 	fr_dlist_init(&to_free, fr_state_entry_t, free_entry);
 
-	/*
-	 *	Clean up expired entries
-	 */
-	for (entry = fr_dlist_head(&state->to_expire);
-	     entry != NULL;
-	     entry = next) {
- 		(void)talloc_get_type_abort(entry, fr_state_entry_t);	/* Allow examination */
-		next = fr_dlist_next(&state->to_expire, entry);		/* Advance *before* potential unlinking */
-
-		if (entry == old) continue;
-
-		/*
-		 *	Too old, we can delete it.
-		 */
-		if (fr_time_lt(entry->cleanup, now)) {
-			state_entry_unlink(state, entry);
-			fr_dlist_insert_tail(&to_free, entry);
-			timed_out++;
-			continue;
-		}
-
-		break;
-	}
-
-	state->timed_out += timed_out;
-
-	if (!old) {
-		too_many = (state->used_sessions == (uint32_t) state->max_sessions);
-		if (!too_many) state->used_sessions++;	/* preemptively increment whilst we hold the mutex */
-	} else {
-		old_tries = old->tries;
-		memcpy(old_state, old->state, sizeof(old_state));
-	}
-
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
-
-	if (timed_out > 0) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
-
-	/*
-	 *	Now free the unlinked entries.
-	 *
-	 *	We do it here as freeing may involve significantly more
-	 *	work than just freeing the data.
-	 *
-	 *	If there's request data that was persisted it will now
-	 *	be freed also, and it may have complex destructors associated
-	 *	with it.
-	 */
-	while ((entry = fr_dlist_head(&to_free)) != NULL) {
-		fr_dlist_remove(&to_free, entry);
-		talloc_free(entry);
-	}
-
-	/*
-	 *	Have to do this post-cleanup, else we end up returning with
-	 *	a list full of entries to free with none of them being
-	 *	freed which is bad...
-	 */
-	if (too_many) {
-		RERROR("Failed inserting state entry - At maximum ongoing session limit (%u)",
-		       state->max_sessions);
-		PTHREAD_MUTEX_LOCK(&state->mutex);	/* Caller expects this to be locked */
-		return NULL;
-	}
-
 	/*
 	 *	Allocation doesn't need to occur inside the critical region
 	 *	and would add significantly to contention.
 	 */
 	if (!old) {
+		if (!state_session_reserve(state)) {
+			/*
+			 *	Expired entries are normally only cleaned up
+			 *	when inserting into the same shard.  Sweep
+			 *	all the shards before giving up.
+			 */
+			timed_out = state_tree_expire(state, now, &to_free);
+			state_entry_list_free(&to_free);
+			if (timed_out > 0) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
+
+			if (!state_session_reserve(state)) {
+				RERROR("Failed inserting state entry - At maximum ongoing session limit (%u)",
+				       state->max_sessions);
+				return NULL;
+			}
+			timed_out = 0;
+		}
+
 		MEM(entry = talloc_zero(NULL, fr_state_entry_t));
 		talloc_set_destructor(entry, _state_entry_free);
 		/* tree->used_sessions incremented above */
 	/*
 	 *	Reuse the old state entry cleaning up any memory associated
-	 *	with it.
+	 *	with it.  It keeps the session it already holds.
 	 */
 	} else {
-		_state_entry_free(old);
+		old_tries = old->tries;
+		memcpy(old_state, old->state, sizeof(old_state));
+
+		state_entry_data_free(old);
 		talloc_free_children(old);
 		memset(old, 0, sizeof(*old));
 		entry = old;
@@ -441,7 +627,7 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 
 	request_data_list_init(&entry->data);
 
-	entry->id = state->id++;
+	entry->id = atomic_fetch_add_explicit(&state->id, 1, memory_order_relaxed);
 
 	/*
 	 *	Limit the lifetime of this entry based on how long the
@@ -529,8 +715,6 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 	       entry->id, fr_box_octets(entry->state, sizeof(entry->state)),
 	       fr_box_time_delta(fr_time_sub(entry->cleanup, now)));
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-
 	/*
 	 *	XOR the server hash with four bytes of random data.
 	 *	We XOR is again before resolving, to ensure state lookups
@@ -539,28 +723,43 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 	 */
 	*((uint32_t *)(&entry->state_comp.context_id)) ^= state->context_id;
 
-	if (!fr_rb_insert(state->tree, entry)) {
+	/*
+	 *	Take ownership of the session-state before the entry
+	 *	is visible to other threads.
+	 */
+	fr_assert(request->session_state_ctx);
+
+	entry->seq_start = request->seq_start;
+	entry->ctx = request->session_state_ctx;
+	fr_dlist_move(&entry->data, data);
+
+	if (state_entry_insert(state, entry, now, &to_free, &timed_out) < 0) {
 		RERROR("Failed inserting state entry - Insertion into state tree failed");
 		fr_pair_delete_by_da(reply_list, state->da);
+
+		/*
+		 *	Give the session-state back to the request
+		 */
+		fr_dlist_move(data, &entry->data);
+		entry->ctx = NULL;
 		talloc_free(entry);
-		return NULL;
+		entry = NULL;
 	}
 
-	/*
-	 *	Link it to the end of the list, which is implicitely
-	 *	ordered by cleanup time.
-	 */
-	fr_dlist_insert_tail(&state->to_expire, entry);
+	if (timed_out > 0) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
+	state_entry_list_free(&to_free);
 
 	return entry;
 }
 
 /** Find the entry based on the State attribute and remove it from the state tree
  *
+ * @note Called with no shard mutexes held.
  */
 static fr_state_entry_t *state_entry_find_and_unlink(fr_state_tree_t *state, fr_value_box_t const *vb)
 {
-	fr_state_entry_t *entry, my_entry;
+	fr_state_entry_t	*entry, my_entry;
+	fr_state_shard_t	*shard;
 
 	/*
 	 *	Assume our own State first.
@@ -589,11 +788,15 @@ static fr_state_entry_t *state_entry_find_and_unlink(fr_state_tree_t *state, fr_
 	 */
 	my_entry.state_comp.context_id ^= state->context_id;
 
-	entry = fr_rb_remove(state->tree, &my_entry);
+	shard = state_shard(state, my_entry.state);
+
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+	entry = fr_rb_remove(shard->tree, &my_entry);
 	if (entry) {
 		(void) talloc_get_type_abort(entry, fr_state_entry_t);
-		fr_dlist_remove(&state->to_expire, entry);
+		fr_dlist_remove(&shard->to_expire, entry);
 	}
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 
 	return entry;
 }
@@ -609,13 +812,8 @@ void fr_state_discard(fr_state_tree_t *state, request_t *request)
 	vp = fr_pair_find_by_da_idx(&request->request_pairs, state->da, 0);
 	if (!vp) return;
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
 	entry = state_entry_find_and_unlink(state, &vp->data);
-	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
-		return;
-	}
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	if (!entry) return;
 
 	/*
 	 *	If fr_state_to_request was never called, this ensures
@@ -673,19 +871,15 @@ int fr_state_to_request(fr_state_tree_t *state, request_t *request)
 		return 1;
 	}
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
 	entry = state_entry_find_and_unlink(state, &vp->data);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
 		RDEBUG2("No state entry matching &request.%pP found", vp);
 		return 2;
 	}
-   	PTHREAD_MUTEX_UNLOCK(&state->mutex);
 
 	/* Probably impossible in the current code */
 	if (unlikely(entry->thawed != NULL)) {
 		RERROR("State entry has already been thawed by a request %"PRIu64, entry->thawed->number);
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
 		return -2;
 	}
 	if (request->session_state_ctx) old_ctx = request->session_state_ctx;	/* Store for later freeing */
@@ -754,27 +948,16 @@ int fr_request_to_state(fr_state_tree_t *state, request_t *request)
 		log_request_pair_list(L_DBG_LVL_2, request, NULL, &request->session_state_pairs, "&session-state.");
 	}
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-
 	/*
 	 *	Reuses old if possible
 	 */
-	entry = state_entry_create(state, request, &request->reply_pairs, old);
+	entry = state_entry_create(state, request, &request->reply_pairs, old, &data);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
 		RERROR("Creating state entry failed");
 		request_data_restore(request, &data);	/* Put it back again */
 		return -1;
 	}
 
-	fr_assert(entry->ctx == NULL);
-	fr_assert(request->session_state_ctx);
-
-	entry->seq_start = request->seq_start;
-	entry->ctx = request->session_state_ctx;
-	fr_dlist_move(&entry->data, &data);
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
-
 	MEM(request->session_state_ctx = fr_pair_afrom_da(NULL, request_attr_state));	/* fixme - should use a pool */
 
 	RDEBUG3("%s - saved", state->da->name);
@@ -926,7 +1109,7 @@ void fr_state_discard_child(request_t *parent, void const *unique_ptr, int uniqu
  */
 uint64_t fr_state_entries_created(fr_state_tree_t *state)
 {
-	return state->id;
+	return atomic_load_explicit(&state->id, memory_order_relaxed);
 }
 
 /** Return number of entries that timed out
@@ -934,7 +1117,18 @@ uint64_t fr_state_entries_created(fr_state_tree_t *state)
  */
 uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
 {
-	return state->timed_out;
+	uint64_t	timed_out = 0;
+	uint32_t	i;
+
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shard[i];
+
+		PTHREAD_MUTEX_LOCK(&shard->mutex);
+		timed_out += shard->timed_out;
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+	}
+
+	return timed_out;
 }
 
 /** Return number of entries we're currently tracking
@@ -942,5 +1136,16 @@ uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
  */
 uint64_t fr_state_entries_tracked(fr_state_tree_t *state)
 {
-	return fr_rb_num_elements(state->tree);
+	uint64_t	tracked = 0;
+	uint32_t	i;
+
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shard[i];
+
+		PTHREAD_MUTEX_LOCK(&shard->mutex);
+		tracked += fr_rb_num_elements(shard->tree);
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+	}
+
+	return tracked;
 }
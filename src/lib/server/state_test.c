@@ -1,28 +1,259 @@
 #include <freeradius-devel/util/acutest.h>
 
-fr_time_t	test_time;
+#include <pthread.h>
 
-/** Allow us to arbitrarily manipulate time
+#include "state.c"
+
+#define STATE_TEST_LIVE		256		//!< Sessions each benchmark thread keeps in progress.
+#define STATE_TEST_ROUNDS	200000		//!< Rounds each benchmark thread performs.
+
+/** Allocate a bare state entry with a random state value
+ *
+ */
+static fr_state_entry_t *test_entry_alloc(fr_state_tree_t *state, fr_time_t cleanup)
+{
+	fr_state_entry_t	*entry;
+	size_t			i;
+	uint32_t		x;
+
+	if (!state_session_reserve(state)) return NULL;
+
+	MEM(entry = talloc_zero(NULL, fr_state_entry_t));
+	talloc_set_destructor(entry, _state_entry_free);
+
+	entry->state_tree = state;
+	request_data_list_init(&entry->data);
+	entry->id = atomic_fetch_add_explicit(&state->id, 1, memory_order_relaxed);
+	entry->cleanup = cleanup;
+
+	for (i = 0; i < sizeof(entry->state) / sizeof(x); i++) {
+		x = fr_rand();
+		memcpy(entry->state + (i * 4), &x, sizeof(x));
+	}
+
+	return entry;
+}
+
+static int test_entry_insert(fr_state_tree_t *state, fr_state_entry_t *entry, uint64_t *timed_out)
+{
+	fr_dlist_head_t	to_free;
+	int		ret;
+
+	fr_dlist_init(&to_free, fr_state_entry_t, free_entry);
+	ret = state_entry_insert(state, entry, fr_time(), &to_free, timed_out);
+	state_entry_list_free(&to_free);
+
+	return ret;
+}
+
+static fr_state_entry_t *test_entry_find_and_unlink(fr_state_tree_t *state, fr_state_entry_t *entry)
+{
+	return state_entry_find_and_unlink(state, fr_box_octets(entry->state, sizeof(entry->state)));
+}
+
+static void state_test_insert_find(void)
+{
+	fr_state_tree_t		*state;
+	fr_state_entry_t	*entries[1000];
+	fr_time_t		cleanup;
+	uint64_t		timed_out = 0;
+	size_t			i;
+
+	state = state_tree_alloc(NULL, NULL, true, STATE_TREE_SHARDS, 10000, fr_time_delta_from_sec(30), 0, 0);
+	TEST_CHECK(state != NULL);
+
+	cleanup = fr_time_add(fr_time(), fr_time_delta_from_sec(30));
+	for (i = 0; i < NUM_ELEMENTS(entries); i++) {
+		entries[i] = test_entry_alloc(state, cleanup);
+		TEST_CHECK(test_entry_insert(state, entries[i], &timed_out) == 0);
+	}
+	TEST_CHECK(fr_state_entries_tracked(state) == NUM_ELEMENTS(entries));
+	TEST_CHECK(timed_out == 0);
+
+	/*
+	 *	Entries should be spread across the shards
+	 */
+	for (i = 0; i < state->num_shards; i++) {
+		TEST_CHECK(fr_rb_num_elements(state->shard[i].tree) > 0);
+		TEST_MSG("shard %zu is empty", i);
+	}
+
+	TEST_CHECK(test_entry_insert(state, entries[0], &timed_out) < 0);
+
+	for (i = 0; i < NUM_ELEMENTS(entries); i++) {
+		TEST_CHECK(test_entry_find_and_unlink(state, entries[i]) == entries[i]);
+		TEST_MSG("failed finding entry %zu", i);
+		TEST_CHECK(test_entry_find_and_unlink(state, entries[i]) == NULL);
+		talloc_free(entries[i]);
+	}
+	TEST_CHECK(fr_state_entries_tracked(state) == 0);
+	TEST_CHECK(atomic_load(&state->used_sessions) == 0);
+
+	talloc_free(state);
+}
+
+static void state_test_expire(void)
+{
+	fr_state_tree_t		*state;
+	fr_state_entry_t	*entries[100];
+	fr_state_shard_t	*shard;
+	fr_dlist_head_t		to_free;
+	fr_time_t		now = fr_time();
+	uint64_t		timed_out = 0, expected;
+	size_t			i;
+
+	state = state_tree_alloc(NULL, NULL, true, STATE_TREE_SHARDS, NUM_ELEMENTS(entries),
+				 fr_time_delta_from_sec(30), 0, 0);
+	TEST_CHECK(state != NULL);
+
+	for (i = 0; i < NUM_ELEMENTS(entries); i++) {
+		entries[i] = test_entry_alloc(state, fr_time_add(now, fr_time_delta_from_sec(30)));
+		TEST_CHECK(entries[i] != NULL);
+		TEST_CHECK(test_entry_insert(state, entries[i], &timed_out) == 0);
+	}
+	TEST_CHECK(timed_out == 0);
+	TEST_CHECK(test_entry_alloc(state, now) == NULL);
+	TEST_MSG("max_sessions was not enforced");
+
+	/*
+	 *	Pretend all the entries have expired
+	 */
+	for (i = 0; i < NUM_ELEMENTS(entries); i++) entries[i]->cleanup = fr_time_sub(now, fr_time_delta_from_sec(1));
+
+	fr_dlist_init(&to_free, fr_state_entry_t, free_entry);
+
+	/*
+	 *	Expiring a shard only touches entries in that shard
+	 */
+	shard = state_shard(state, entries[0]->state);
+	expected = fr_rb_num_elements(shard->tree);
+	timed_out = state_shard_expire(shard, now, &to_free);
+	state_entry_list_free(&to_free);
+	TEST_CHECK(timed_out == expected);
+	TEST_CHECK(fr_state_entries_tracked(state) == (NUM_ELEMENTS(entries) - expected));
+
+	/*
+	 *	Sweeping all the shards frees up all the sessions
+	 */
+	timed_out += state_tree_expire(state, now, &to_free);
+	state_entry_list_free(&to_free);
+
+	TEST_CHECK(timed_out == NUM_ELEMENTS(entries));
+	TEST_CHECK(fr_state_entries_timeout(state) == NUM_ELEMENTS(entries));
+	TEST_CHECK(fr_state_entries_tracked(state) == 0);
+	TEST_CHECK(atomic_load(&state->used_sessions) == 0);
+
+	talloc_free(state);
+}
+
+typedef struct {
+	fr_state_tree_t		*state;
+	pthread_t		thread;
+	uint64_t		failed;
+} state_test_thread_t;
+
+/** Simulate multi-round sessions
  *
+ * Each round finds and unlinks the oldest session this thread has in
+ * progress, then inserts the state for its next round.
  */
-#define fr_time()	test_time
+static void *state_test_worker(void *uctx)
+{
+	state_test_thread_t	*t = uctx;
+	fr_state_entry_t	*live[STATE_TEST_LIVE], *entry;
+	fr_time_t		cleanup = fr_time_add(fr_time(), fr_time_delta_from_sec(3600));
+	uint64_t		timed_out = 0;
+	size_t			i;
+
+	for (i = 0; i < NUM_ELEMENTS(live); i++) {
+		live[i] = test_entry_alloc(t->state, cleanup);
+		if (!live[i] || (test_entry_insert(t->state, live[i], &timed_out) < 0)) t->failed++;
+	}
+
+	for (i = 0; i < STATE_TEST_ROUNDS; i++) {
+		entry = live[i % NUM_ELEMENTS(live)];
+
+		if (test_entry_find_and_unlink(t->state, entry) != entry) t->failed++;
+		talloc_free(entry);
 
-#include <state_test.c>
+		entry = live[i % NUM_ELEMENTS(live)] = test_entry_alloc(t->state, cleanup);
+		if (!entry || (test_entry_insert(t->state, entry, &timed_out) < 0)) t->failed++;
+	}
 
-/** Test functions that read from dbuffs.
+	for (i = 0; i < NUM_ELEMENTS(live); i++) {
+		if (test_entry_find_and_unlink(t->state, live[i]) != live[i]) t->failed++;
+		talloc_free(live[i]);
+	}
+
+	return NULL;
+}
+
+static uint64_t state_contention(uint32_t num_shards, unsigned int num_threads)
+{
+	fr_state_tree_t		*state;
+	state_test_thread_t	*threads;
+	fr_time_t		start, end;
+	uint64_t		failed = 0;
+	unsigned int		i;
+
+	state = state_tree_alloc(NULL, NULL, true, num_shards,
+				 num_threads * STATE_TEST_LIVE, fr_time_delta_from_sec(3600), 0, 0);
+	TEST_CHECK(state != NULL);
+
+	MEM(threads = talloc_zero_array(NULL, state_test_thread_t, num_threads));
+
+	start = fr_time();
+	for (i = 0; i < num_threads; i++) {
+		threads[i].state = state;
+		TEST_CHECK(pthread_create(&threads[i].thread, NULL, state_test_worker, &threads[i]) == 0);
+	}
+	for (i = 0; i < num_threads; i++) {
+		pthread_join(threads[i].thread, NULL);
+		failed += threads[i].failed;
+	}
+	end = fr_time();
+
+	TEST_CHECK(failed == 0);
+	TEST_MSG("%"PRIu64" operations failed", failed);
+	TEST_CHECK(fr_state_entries_tracked(state) == 0);
+
+	talloc_free(threads);
+	talloc_free(state);
+
+	return fr_time_delta_unwrap(fr_time_sub(end, start)) / 1000;
+}
+
+/** Compare a single locked tree with a sharded one as the number of threads increases
  *
  */
-static void state_entry_create(void)
+static void state_contention_bench(void)
 {
+	static unsigned int const	num_threads[] = { 1, 4, 16, 32 };
+	size_t				i;
+
+	for (i = 0; i < NUM_ELEMENTS(num_threads); i++) {
+		uint64_t single, sharded;
 
+		single = state_contention(1, num_threads[i]);
+		sharded = state_contention(STATE_TREE_SHARDS, num_threads[i]);
+
+		TEST_MSG_ALWAYS("\nthreads: %u (%u rounds each)\n", num_threads[i], STATE_TEST_ROUNDS);
+		TEST_MSG_ALWAYS("1 shard: %"PRIu64" μs\n", single);
+		TEST_MSG_ALWAYS("%u shards: %"PRIu64" μs\n", STATE_TREE_SHARDS, sharded);
+	}
 }
 
 TEST_LIST = {
 	/*
 	 *	Basic tests
 	 */
-	{ "state_entry_create",				state_entry_create },
-	{ "state_entry_too_many" }
+	{ "state_test_insert_find",			state_test_insert_find },
+	{ "state_test_expire",				state_test_expire },
+
+	/*
+	 *	Benchmarks
+	 */
+	{ "state_contention_bench",			state_contention_bench },
 
 	{ NULL }
 };
@@ -0,0 +1,868 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file trunk_shared.c
+ * @brief Trunks owned by dedicated I/O threads, and shared by all workers.
+ *
+ * Normally each worker has its own #fr_trunk_t, so a server with many
+ * workers opens (workers * max) connections to every backend, most of
+ * which sit idle.  A shared trunk instead starts a small number of I/O
+ * threads, each of which owns a trunk and runs its own event loop.
+ *
+ * Workers hand requests to an I/O thread through a #fr_atomic_queue_t,
+ * and the I/O thread enqueues them on its trunk.  When the trunk is
+ * done with a request, it's pushed back onto a queue owned by the worker
+ * which submitted it.  Either side only writes to the other's wakeup
+ * pipe if the other side hasn't already been signalled.
+ *
+ * The API client's I/O callbacks (connection_alloc, request_mux,
+ * request_demux, request_cancel etc.) run in the I/O threads, with a
+ * NULL request.  They must only use the preq.  The request_complete,
+ * request_fail and request_free callbacks run in the worker which
+ * submitted the request, and may use the request and rctx as normal.
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/io/atomic_queue.h>
+#include <freeradius-devel/io/schedule.h>
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/command.h>
+#include <freeradius-devel/server/trunk_shared.h>
+
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+typedef struct fr_trunk_shared_io_s fr_trunk_shared_io_t;
+
+typedef enum {
+	TRUNK_SHARED_RESULT_NONE = 0,			//!< Cancelled before it got anywhere.
+	TRUNK_SHARED_RESULT_COMPLETE,			//!< Call request_complete.
+	TRUNK_SHARED_RESULT_FAIL			//!< Call request_fail.
+} fr_trunk_shared_result_t;
+
+/** Where the I/O threads give requests back to a worker
+ *
+ * This is separate from the worker's #fr_trunk_shared_thread_t, as it
+ * has to outlive the worker if the worker exits with requests in flight.
+ * It's freed by whoever drops the last reference.
+ */
+typedef struct {
+	fr_atomic_queue_t		*done;		//!< Requests the I/O threads have given back.
+	int				pipe[2];	//!< I/O threads write to pipe[1] to wake up the worker.
+	atomic_bool			signalled;	//!< Someone has written to the pipe since it was last read.
+	atomic_bool			detached;	//!< The worker has gone.  Requests are freed by the
+							///< I/O thread which gives them back.
+	atomic_uint_fast32_t		refs;		//!< One for the worker, and one for each request
+							///< an I/O thread may still give back.
+} trunk_shared_return_t;
+
+/** A request in flight between a worker and an I/O thread
+ *
+ * Allocated in the NULL ctx by the worker, and freed by it once the I/O
+ * thread has given it back.  If the worker has exited, the I/O thread
+ * frees it instead.
+ */
+struct fr_trunk_shared_request_s {
+	trunk_shared_return_t		*ret;		//!< Where to give the request back to.
+	fr_trunk_shared_io_t		*io;		//!< I/O thread which is running the request.
+	fr_dlist_t			entry;		//!< In the worker's list of outstanding requests.
+
+	request_t			*request;	//!< Only used by the worker.
+	void				*rctx;		//!< Only used by the worker.
+	void				*preq;		//!< Parented by us whilst in flight.
+
+	fr_trunk_request_t		*treq;		//!< Only used by the I/O thread.
+	fr_trunk_shared_result_t	result;		//!< Written by the I/O thread.
+	fr_trunk_request_state_t	fail_state;	//!< State the request failed in.
+
+	atomic_bool			cancelled;	//!< The worker no longer cares about the result.
+	atomic_uint_fast32_t		refs;		//!< Held by the I/O thread, and by cancel messages.
+							///< When it reaches zero, the request goes back to
+							///< the worker.
+
+	fr_time_t			queued;		//!< When the worker pushed the request.
+	fr_time_t			started;	//!< When the I/O thread popped the request.
+};
+
+/** An I/O thread, and the trunk it owns
+ *
+ */
+struct fr_trunk_shared_io_s {
+	fr_trunk_shared_t		*shared;	//!< We belong to.
+	uint32_t			id;		//!< For logging, and radmin.
+
+	TALLOC_CTX			*ctx;		//!< Everything the thread uses is allocated in here.
+	fr_event_list_t			*el;		//!< The I/O thread's event loop.
+	fr_trunk_t			*trunk;		//!< Connections owned by this thread.
+
+	pthread_t			pthread_id;
+	bool				running;	//!< Whether the thread was started.
+	atomic_bool			stop;		//!< Tell the thread to exit.
+
+	fr_atomic_queue_t		*requests;	//!< New requests from the workers.
+	fr_atomic_queue_t		*cancels;	//!< Cancellations from the workers.
+	int				pipe[2];	//!< Workers write to pipe[1] to wake us up.
+	atomic_bool			signalled;	//!< Someone has written to the pipe since we last read it.
+	atomic_uint_fast32_t		outstanding;	//!< Requests pushed to us, and not yet given back.
+
+	pthread_mutex_t			mutex;		//!< Protects the stats below.
+	uint64_t			started;	//!< Requests we've popped.
+	uint64_t			completed;
+	uint64_t			failed;
+	uint64_t			cancelled;
+	fr_time_elapsed_t		wait;		//!< How long requests sat in our queue.
+	fr_time_elapsed_t		service;	//!< How long requests spent in our trunk.
+};
+
+struct fr_trunk_shared_s {
+	char const			*name;		//!< For logging, and radmin.
+	fr_trunk_io_funcs_t		funcs;		//!< The API client's callbacks.
+	void				*uctx;		//!< Passed to the callbacks.
+	uint32_t			max_outstanding;	//!< Requests each worker may have in flight.
+
+	fr_trunk_shared_io_t		**io;		//!< One per I/O thread.
+	uint32_t			num_io;
+
+	atomic_uint_fast64_t		rejected;	//!< Requests refused because a queue was full.
+};
+
+/** Per-worker state
+ *
+ */
+struct fr_trunk_shared_thread_s {
+	fr_trunk_shared_t		*shared;	//!< We submit requests to.
+	fr_event_list_t			*el;		//!< The pipe is registered with.
+
+	trunk_shared_return_t		*ret;		//!< Where the I/O threads give requests back.
+
+	uint32_t			outstanding;	//!< Requests we've pushed, and not yet had back.
+	fr_dlist_head_t			requests;	//!< Requests we've pushed, and not yet had back.
+	uint32_t			next;		//!< I/O thread to try first.
+};
+
+/** Wake up the other end, unless it's already been woken
+ *
+ */
+static inline void trunk_shared_wake(int fd, atomic_bool *signalled)
+{
+	uint8_t	c = 0;
+
+	if (atomic_exchange(signalled, true)) return;
+
+	/*
+	 *	A full pipe means the reader is already
+	 *	going to wake up.
+	 */
+	if ((write(fd, &c, sizeof(c)) < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+		ERROR("shared trunk - Failed writing to wakeup pipe: %s", fr_syserror(errno));
+	}
+}
+
+/** Empty a wakeup pipe, and allow it to be written to again
+ *
+ * Must be called before the queue the pipe is for is drained.
+ */
+static inline void trunk_shared_woken(int fd, atomic_bool *signalled)
+{
+	uint8_t	buff[64];
+
+	while (read(fd, buff, sizeof(buff)) == sizeof(buff));
+
+	atomic_store(signalled, false);
+}
+
+static int trunk_shared_pipe(int fds[2])
+{
+	if (pipe(fds) < 0) {
+		fr_strerror_printf("Failed creating wakeup pipe: %s", fr_syserror(errno));
+		fds[0] = fds[1] = -1;
+		return -1;
+	}
+
+	if ((fr_nonblock(fds[0]) < 0) || (fr_nonblock(fds[1]) < 0)) {
+		fr_strerror_printf_push("Failed setting wakeup pipe to non-blocking");
+		close(fds[0]);
+		close(fds[1]);
+		fds[0] = fds[1] = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Drop a reference to a worker's return path, freeing it if it was the last
+ *
+ * Any requests still in the queue were given back after the worker
+ * exited, so nothing is waiting for them.
+ */
+static void trunk_shared_return_release(trunk_shared_return_t *ret)
+{
+	fr_trunk_shared_request_t *sreq;
+
+	if (atomic_fetch_sub(&ret->refs, 1) != 1) return;
+
+	if (ret->done) while (fr_atomic_queue_pop(ret->done, (void **)&sreq)) talloc_free(sreq);
+
+	if (ret->pipe[0] >= 0) close(ret->pipe[0]);
+	if (ret->pipe[1] >= 0) close(ret->pipe[1]);
+	talloc_free(ret);
+}
+
+/** Drop a reference to a request
+ *
+ * When the last reference goes, the request is pushed back to the worker
+ * which submitted it, or freed if the worker has exited.  May be called
+ * from either thread.
+ */
+static void trunk_shared_request_release(fr_trunk_shared_request_t *sreq)
+{
+	trunk_shared_return_t *ret = sreq->ret;
+
+	if (atomic_fetch_sub(&sreq->refs, 1) != 1) return;
+
+	/*
+	 *	Nothing is waiting for the result.
+	 *
+	 *	Otherwise, the queue is as large as the number of
+	 *	requests the worker may have outstanding, so the
+	 *	push can't fail.
+	 */
+	if (atomic_load(&ret->detached)) {
+		talloc_free(sreq);
+	} else if (fr_cond_assert_msg(fr_atomic_queue_push(ret->done, sreq),
+				      "shared trunk - Worker's completion queue is full")) {
+		trunk_shared_wake(ret->pipe[1], &ret->signalled);
+	}
+
+	/*
+	 *	The worker may have exited, in which case
+	 *	this frees the return path.
+	 */
+	trunk_shared_return_release(ret);
+}
+
+/** The I/O thread has finished with a request
+ *
+ */
+static void trunk_shared_io_done(fr_trunk_shared_io_t *io, fr_trunk_shared_request_t *sreq)
+{
+	pthread_mutex_lock(&io->mutex);
+	if (atomic_load(&sreq->cancelled)) {
+		io->cancelled++;
+	} else if (sreq->result == TRUNK_SHARED_RESULT_COMPLETE) {
+		io->completed++;
+	} else {
+		io->failed++;
+	}
+	fr_time_elapsed_update(&io->service, sreq->started, fr_time());
+	pthread_mutex_unlock(&io->mutex);
+
+	atomic_fetch_sub(&io->outstanding, 1);
+	trunk_shared_request_release(sreq);
+}
+
+/** Record the result, which is passed back to the worker
+ *
+ */
+static void _trunk_shared_request_complete(UNUSED request_t *request, UNUSED void *preq, void *rctx, UNUSED void *uctx)
+{
+	fr_trunk_shared_request_t *sreq = talloc_get_type_abort(rctx, fr_trunk_shared_request_t);
+
+	sreq->result = TRUNK_SHARED_RESULT_COMPLETE;
+}
+
+static void _trunk_shared_request_fail(UNUSED request_t *request, UNUSED void *preq, void *rctx,
+				       fr_trunk_request_state_t state, UNUSED void *uctx)
+{
+	fr_trunk_shared_request_t *sreq = talloc_get_type_abort(rctx, fr_trunk_shared_request_t);
+
+	sreq->result = TRUNK_SHARED_RESULT_FAIL;
+	sreq->fail_state = state;
+}
+
+/** The trunk no longer has the request, give it back to the worker
+ *
+ * This is always the last callback the trunk makes for a request.  It
+ * isn't passed the rctx, but the preq is parented by the shared request.
+ */
+static void _trunk_shared_request_free(UNUSED request_t *request, void *preq, UNUSED void *uctx)
+{
+	fr_trunk_shared_request_t *sreq = talloc_get_type_abort(talloc_parent(preq), fr_trunk_shared_request_t);
+
+	sreq->treq = NULL;
+	trunk_shared_io_done(sreq->io, sreq);
+}
+
+/** Enqueue a request from a worker on our trunk
+ *
+ */
+static void trunk_shared_io_request(fr_trunk_shared_io_t *io, fr_trunk_shared_request_t *sreq)
+{
+	fr_trunk_shared_t	*shared = io->shared;
+
+	sreq->started = fr_time();
+
+	pthread_mutex_lock(&io->mutex);
+	io->started++;
+	fr_time_elapsed_update(&io->wait, sreq->queued, sreq->started);
+	pthread_mutex_unlock(&io->mutex);
+
+	if (atomic_load(&sreq->cancelled)) {
+		trunk_shared_io_done(io, sreq);
+		return;
+	}
+
+	/*
+	 *	The request may complete before this returns,
+	 *	in which case sreq has already been given back.
+	 */
+	switch (fr_trunk_request_enqueue(&sreq->treq, io->trunk, NULL, sreq->preq, sreq)) {
+	case FR_TRUNK_ENQUEUE_OK:
+	case FR_TRUNK_ENQUEUE_IN_BACKLOG:
+		return;
+
+	default:
+		DEBUG2("%s - I/O thread %u failed enqueueing request", shared->name, io->id);
+		sreq->result = TRUNK_SHARED_RESULT_FAIL;
+		sreq->fail_state = FR_TRUNK_REQUEST_STATE_UNASSIGNED;
+		trunk_shared_io_done(io, sreq);
+		return;
+	}
+}
+
+/** Cancel a request on our trunk
+ *
+ */
+static void trunk_shared_io_cancel(UNUSED fr_trunk_shared_io_t *io, fr_trunk_shared_request_t *sreq)
+{
+	if (sreq->treq) fr_trunk_request_signal_cancel(sreq->treq);
+
+	trunk_shared_request_release(sreq);		/* The cancel message's reference */
+}
+
+static void _trunk_shared_io_wakeup(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	fr_trunk_shared_io_t		*io = talloc_get_type_abort(uctx, fr_trunk_shared_io_t);
+	fr_trunk_shared_request_t	*sreq;
+
+	trunk_shared_woken(fd, &io->signalled);
+
+	if (atomic_load(&io->stop)) {
+		fr_event_loop_exit(io->el, 1);
+		return;
+	}
+
+	while (fr_atomic_queue_pop(io->requests, (void **)&sreq)) trunk_shared_io_request(io, sreq);
+	while (fr_atomic_queue_pop(io->cancels, (void **)&sreq)) trunk_shared_io_cancel(io, sreq);
+}
+
+static void _trunk_shared_io_error(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, int fd_errno, void *uctx)
+{
+	fr_trunk_shared_io_t *io = talloc_get_type_abort(uctx, fr_trunk_shared_io_t);
+
+	ERROR("%s - I/O thread %u wakeup pipe (%i) failed: %s", io->shared->name, io->id, fd, fr_syserror(fd_errno));
+}
+
+static void *trunk_shared_io_main(void *arg)
+{
+	fr_trunk_shared_io_t *io = talloc_get_type_abort(arg, fr_trunk_shared_io_t);
+
+	/*
+	 *	Connections are opened here, so that their
+	 *	callbacks are only ever run by this thread.
+	 */
+	if (fr_trunk_start(io->trunk) < 0) {
+		PERROR("%s - I/O thread %u failed starting trunk", io->shared->name, io->id);
+	}
+
+	fr_event_loop(io->el);
+
+	return NULL;
+}
+
+static int _trunk_shared_io_free(fr_trunk_shared_io_t *io)
+{
+	fr_trunk_shared_request_t *sreq;
+
+	if (io->running) {
+		atomic_store(&io->stop, true);
+		trunk_shared_wake(io->pipe[1], &io->signalled);
+		pthread_join(io->pthread_id, NULL);
+	}
+
+	/*
+	 *	The workers have all gone, but may have left
+	 *	cancelled requests with us.  Any the trunk has
+	 *	are failed when it's freed, and any it never
+	 *	saw are given back here.
+	 */
+	if (io->cancels) while (fr_atomic_queue_pop(io->cancels, (void **)&sreq)) trunk_shared_io_cancel(io, sreq);
+	TALLOC_FREE(io->trunk);
+	if (io->requests) while (fr_atomic_queue_pop(io->requests, (void **)&sreq)) trunk_shared_io_done(io, sreq);
+
+	fr_assert(atomic_load(&io->outstanding) == 0);
+
+	talloc_free(io->ctx);
+	if (io->pipe[0] >= 0) close(io->pipe[0]);
+	if (io->pipe[1] >= 0) close(io->pipe[1]);
+	pthread_mutex_destroy(&io->mutex);
+
+	return 0;
+}
+
+static int cmd_show_shared_trunk(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	fr_trunk_shared_t	*shared = talloc_get_type_abort(ctx, fr_trunk_shared_t);
+	uint32_t		i;
+
+	fprintf(fp, "threads\t\t\t%u\n", shared->num_io);
+	fprintf(fp, "count.rejected\t\t%" PRIu64 "\n", (uint64_t)atomic_load(&shared->rejected));
+
+	for (i = 0; i < shared->num_io; i++) {
+		fr_trunk_shared_io_t	*io = shared->io[i];
+		char			prefix[64];
+
+		pthread_mutex_lock(&io->mutex);
+		fprintf(fp, "thread.%u.outstanding\t%u\n", i, (unsigned int)atomic_load(&io->outstanding));
+		fprintf(fp, "thread.%u.count.started\t%" PRIu64 "\n", i, io->started);
+		fprintf(fp, "thread.%u.count.completed\t%" PRIu64 "\n", i, io->completed);
+		fprintf(fp, "thread.%u.count.failed\t%" PRIu64 "\n", i, io->failed);
+		fprintf(fp, "thread.%u.count.cancelled\t%" PRIu64 "\n", i, io->cancelled);
+		snprintf(prefix, sizeof(prefix), "thread.%u.time.queued", i);
+		fr_time_elapsed_fprint(fp, &io->wait, prefix, 4);
+		snprintf(prefix, sizeof(prefix), "thread.%u.time.service", i);
+		fr_time_elapsed_fprint(fp, &io->service, prefix, 4);
+		pthread_mutex_unlock(&io->mutex);
+	}
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_table[] = {
+	{
+		.parent = "show module",
+		.add_name = true,
+		.name = "shared-trunk",
+		.func = cmd_show_shared_trunk,
+		.help = "Show how long requests waited for, and spent in, the shared trunk's I/O threads.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
+/** Start the I/O threads for a shared trunk
+ *
+ * The I/O threads are stopped when the returned structure is freed.
+ * This must be after all the workers have freed their
+ * #fr_trunk_shared_thread_t.
+ *
+ * @param[in] ctx		to allocate the shared trunk in.
+ * @param[in] name		of the module instance, for logging and radmin.
+ * @param[in] num_threads	I/O threads to start.  Each has its own trunk,
+ *				configured by conf.
+ * @param[in] max_outstanding	requests each worker may have in flight.
+ *				Any more are refused with #FR_TRUNK_ENQUEUE_NO_CAPACITY.
+ * @param[in] funcs		as for fr_trunk_alloc().  request_complete,
+ *				request_fail and request_free are called in
+ *				the worker, everything else in the I/O thread.
+ * @param[in] conf		as for fr_trunk_alloc().
+ * @param[in] uctx		passed to all the callbacks.
+ * @return
+ *	- The new shared trunk.
+ *	- NULL on error.
+ */
+fr_trunk_shared_t *fr_trunk_shared_alloc(TALLOC_CTX *ctx, char const *name,
+					 uint32_t num_threads, uint32_t max_outstanding,
+					 fr_trunk_io_funcs_t const *funcs, fr_trunk_conf_t const *conf,
+					 void const *uctx)
+{
+	fr_trunk_shared_t	*shared;
+	fr_trunk_io_funcs_t	io_funcs;
+	uint32_t		i;
+
+	if (!fr_cond_assert(num_threads > 0) || !fr_cond_assert(max_outstanding > 0)) return NULL;
+
+	MEM(shared = talloc_zero(ctx, fr_trunk_shared_t));
+	shared->name = name;
+	shared->funcs = *funcs;
+	memcpy(&shared->uctx, &uctx, sizeof(shared->uctx));
+	shared->max_outstanding = max_outstanding;
+	atomic_init(&shared->rejected, 0);
+	MEM(shared->io = talloc_zero_array(shared, fr_trunk_shared_io_t *, num_threads));
+
+	/*
+	 *	The trunks in the I/O threads tell us when
+	 *	they're done with a request, and we tell the
+	 *	worker.
+	 */
+	io_funcs = *funcs;
+	io_funcs.request_complete = _trunk_shared_request_complete;
+	io_funcs.request_fail = _trunk_shared_request_fail;
+	io_funcs.request_free = _trunk_shared_request_free;
+
+	for (i = 0; i < num_threads; i++) {
+		fr_trunk_shared_io_t	*io;
+
+		MEM(io = talloc_zero(shared, fr_trunk_shared_io_t));
+		io->shared = shared;
+		io->id = i;
+		io->pipe[0] = io->pipe[1] = -1;
+		atomic_init(&io->stop, false);
+		atomic_init(&io->signalled, false);
+		atomic_init(&io->outstanding, 0);
+		pthread_mutex_init(&io->mutex, NULL);
+		talloc_set_destructor(io, _trunk_shared_io_free);
+		shared->io[i] = io;
+		shared->num_io++;
+
+		/*
+		 *	Shared by all the workers.  When they fill up,
+		 *	new requests are refused, so they only need to
+		 *	be large enough to absorb bursts.
+		 */
+		MEM(io->ctx = talloc_init("shared trunk I/O thread %u", i));
+		io->requests = fr_atomic_queue_alloc(io->ctx, max_outstanding * 4);
+		io->cancels = fr_atomic_queue_alloc(io->ctx, max_outstanding * 4);
+		if (!io->requests || !io->cancels) {
+			fr_strerror_const("Failed allocating I/O thread queues");
+		error:
+			talloc_free(shared);
+			return NULL;
+		}
+
+		if (trunk_shared_pipe(io->pipe) < 0) goto error;
+
+		io->el = fr_event_list_alloc(io->ctx, NULL, NULL);
+		if (!io->el) goto error;
+
+		if (fr_event_fd_insert(io->el, io->el, io->pipe[0],
+				       _trunk_shared_io_wakeup, NULL, _trunk_shared_io_error, io) < 0) goto error;
+
+		io->trunk = fr_trunk_alloc(io->ctx, io->el, &io_funcs, conf, name, uctx, true);
+		if (!io->trunk) goto error;
+
+		if (fr_schedule_pthread_create(&io->pthread_id, trunk_shared_io_main, io) < 0) {
+			fr_strerror_const_push("Failed creating I/O thread");
+			goto error;
+		}
+		io->running = true;
+	}
+
+	if (fr_command_register_hook(NULL, name, shared, cmd_table) < 0) {
+		PWARN("%s - Failed registering radmin commands", name);
+	}
+
+	DEBUG("%s - Started %u shared trunk I/O thread(s)", name, num_threads);
+
+	return shared;
+}
+
+/** Hand back a request which the I/O thread has finished with
+ *
+ * @param[in] thread	which submitted the request.
+ * @param[in] sreq	to hand back.
+ * @param[in] discard	the worker is exiting, don't call complete or fail.
+ */
+static void trunk_shared_thread_done(fr_trunk_shared_thread_t *thread, fr_trunk_shared_request_t *sreq, bool discard)
+{
+	fr_trunk_shared_t	*shared = thread->shared;
+	fr_trunk_io_funcs_t	*funcs = &shared->funcs;
+	request_t		*request = sreq->request;
+
+	thread->outstanding--;
+	fr_dlist_remove(&thread->requests, sreq);
+
+	/*
+	 *	The request may have been freed, so we
+	 *	can't touch it, or the rctx.
+	 */
+	if (discard || atomic_load(&sreq->cancelled)) {
+		if (funcs->request_free) funcs->request_free(NULL, sreq->preq, shared->uctx);
+		talloc_free(sreq);
+		return;
+	}
+
+	switch (sreq->result) {
+	case TRUNK_SHARED_RESULT_COMPLETE:
+		if (funcs->request_complete) funcs->request_complete(request, sreq->preq, sreq->rctx, shared->uctx);
+		break;
+
+	case TRUNK_SHARED_RESULT_FAIL:
+	case TRUNK_SHARED_RESULT_NONE:
+		if (funcs->request_fail) funcs->request_fail(request, sreq->preq, sreq->rctx,
+							     sreq->fail_state, shared->uctx);
+		break;
+	}
+
+	if (funcs->request_free) funcs->request_free(request, sreq->preq, shared->uctx);
+	talloc_free(sreq);
+}
+
+static void trunk_shared_thread_drain(fr_trunk_shared_thread_t *thread, bool discard)
+{
+	fr_trunk_shared_request_t *sreq;
+
+	trunk_shared_woken(thread->ret->pipe[0], &thread->ret->signalled);
+
+	while (fr_atomic_queue_pop(thread->ret->done, (void **)&sreq)) trunk_shared_thread_done(thread, sreq, discard);
+}
+
+static void _trunk_shared_thread_wakeup(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	trunk_shared_thread_drain(talloc_get_type_abort(uctx, fr_trunk_shared_thread_t), false);
+}
+
+static void _trunk_shared_thread_error(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, int fd_errno, void *uctx)
+{
+	fr_trunk_shared_thread_t *thread = talloc_get_type_abort(uctx, fr_trunk_shared_thread_t);
+
+	ERROR("%s - Worker wakeup pipe (%i) failed: %s", thread->shared->name, fd, fr_syserror(fd_errno));
+}
+
+static int _trunk_shared_thread_free(fr_trunk_shared_thread_t *thread)
+{
+	trunk_shared_return_t		*ret = thread->ret;
+	fr_trunk_shared_request_t	*sreq = NULL;
+
+	if (!ret) return 0;
+
+	if (ret->pipe[0] >= 0) (void) fr_event_fd_delete(thread->el, ret->pipe[0], FR_EVENT_FILTER_IO);
+
+	/*
+	 *	Don't wait for requests still in the I/O threads,
+	 *	as the backend may be slow, or dead.  Cancel them,
+	 *	and the I/O threads free them when they're done.
+	 */
+	while ((sreq = fr_dlist_next(&thread->requests, sreq))) fr_trunk_shared_request_signal_cancel(sreq);
+
+	if (ret->done) trunk_shared_thread_drain(thread, true);
+
+	if (thread->outstanding > 0) {
+		DEBUG2("%s - Leaving %u cancelled request(s) for the I/O threads to free",
+		       thread->shared->name, thread->outstanding);
+	}
+
+	atomic_store(&ret->detached, true);
+	trunk_shared_return_release(ret);
+
+	return 0;
+}
+
+/** Allocate a worker's handle for submitting requests to a shared trunk
+ *
+ * When the handle is freed, any requests still in flight are cancelled,
+ * and freed by the I/O threads when they're done with them.  The
+ * request_free callback isn't called for those, their preqs are freed
+ * along with the shared requests.
+ *
+ * @param[in] ctx	to allocate the handle in.  Usually the module's thread
+ *			instance data.
+ * @param[in] shared	to submit requests to.
+ * @param[in] el	the worker's event list.  Completed requests are
+ *			handed back from it.
+ * @return
+ *	- The new handle.
+ *	- NULL on error.
+ */
+fr_trunk_shared_thread_t *fr_trunk_shared_thread_alloc(TALLOC_CTX *ctx, fr_trunk_shared_t *shared,
+						       fr_event_list_t *el)
+{
+	fr_trunk_shared_thread_t *thread;
+
+	MEM(thread = talloc_zero(ctx, fr_trunk_shared_thread_t));
+	thread->shared = shared;
+	thread->el = el;
+	fr_dlist_talloc_init(&thread->requests, fr_trunk_shared_request_t, entry);
+
+	/*
+	 *	Not parented by the thread, as it may
+	 *	have to outlive it.
+	 */
+	MEM(thread->ret = talloc_zero(NULL, trunk_shared_return_t));
+	thread->ret->pipe[0] = thread->ret->pipe[1] = -1;
+	atomic_init(&thread->ret->signalled, false);
+	atomic_init(&thread->ret->detached, false);
+	atomic_init(&thread->ret->refs, 1);
+	talloc_set_destructor(thread, _trunk_shared_thread_free);
+
+	thread->ret->done = fr_atomic_queue_alloc(thread->ret, shared->max_outstanding);
+	if (!thread->ret->done) {
+		fr_strerror_const("Failed allocating completion queue");
+	error:
+		talloc_free(thread);
+		return NULL;
+	}
+
+	if (trunk_shared_pipe(thread->ret->pipe) < 0) goto error;
+
+	if (fr_event_fd_insert(thread, el, thread->ret->pipe[0],
+			       _trunk_shared_thread_wakeup, NULL, _trunk_shared_thread_error, thread) < 0) goto error;
+
+	return thread;
+}
+
+/** Pick the I/O thread with the fewest outstanding requests
+ *
+ */
+static fr_trunk_shared_io_t *trunk_shared_io_pick(fr_trunk_shared_thread_t *thread)
+{
+	fr_trunk_shared_t	*shared = thread->shared;
+	fr_trunk_shared_io_t	*found = NULL;
+	uint_fast32_t		found_outstanding = 0;
+	uint32_t		i;
+
+	for (i = 0; i < shared->num_io; i++) {
+		fr_trunk_shared_io_t	*io = shared->io[(thread->next + i) % shared->num_io];
+		uint_fast32_t		outstanding = atomic_load_explicit(&io->outstanding, memory_order_relaxed);
+
+		if (!found || (outstanding < found_outstanding)) {
+			found = io;
+			found_outstanding = outstanding;
+		}
+	}
+
+	/*
+	 *	Spread ties across the I/O threads
+	 */
+	thread->next = (thread->next + 1) % shared->num_io;
+
+	return found;
+}
+
+/** Submit a request to a shared trunk
+ *
+ * The preq must be a talloc chunk.  It's parented by the shared request
+ * whilst the request is in flight, and must be freed by the request_free
+ * callback (or it's freed when the shared request is).
+ *
+ * Unlike fr_trunk_request_enqueue(), errors from the trunk itself (no
+ * connections, destination unavailable) are reported by calling
+ * request_fail, as the trunk is run asynchronously.  request_fail is
+ * passed #FR_TRUNK_REQUEST_STATE_UNASSIGNED if the request was never
+ * enqueued on the trunk.
+ *
+ * @param[out] sreq_out	The shared request.  Only valid until request_complete
+ *			or request_fail is called.
+ * @param[in] thread	The worker's handle.
+ * @param[in] request	to pass to request_complete, request_fail and request_free.
+ * @param[in] preq	Protocol request, passed to all the callbacks.
+ * @param[in] rctx	to pass to request_complete and request_fail.
+ * @return
+ *	- FR_TRUNK_ENQUEUE_OK if the request was handed to an I/O thread.
+ *	- FR_TRUNK_ENQUEUE_NO_CAPACITY if the worker has too many requests in
+ *	  flight, or the I/O thread's queue is full.  The preq is not modified.
+ */
+fr_trunk_enqueue_t fr_trunk_shared_request_enqueue(fr_trunk_shared_request_t **sreq_out,
+						   fr_trunk_shared_thread_t *thread, request_t *request,
+						   void *preq, void *rctx)
+{
+	fr_trunk_shared_t		*shared = thread->shared;
+	fr_trunk_shared_request_t	*sreq;
+	fr_trunk_shared_io_t		*io;
+	TALLOC_CTX			*preq_parent;
+
+	if (thread->outstanding >= shared->max_outstanding) {
+	no_capacity:
+		atomic_fetch_add_explicit(&shared->rejected, 1, memory_order_relaxed);
+		return FR_TRUNK_ENQUEUE_NO_CAPACITY;
+	}
+
+	io = trunk_shared_io_pick(thread);
+
+	MEM(sreq = talloc_zero(NULL, fr_trunk_shared_request_t));
+	sreq->ret = thread->ret;
+	sreq->io = io;
+	sreq->request = request;
+	sreq->rctx = rctx;
+	preq_parent = talloc_parent(preq);
+	sreq->preq = talloc_steal(sreq, preq);
+	atomic_init(&sreq->cancelled, false);
+	atomic_init(&sreq->refs, 1);
+	sreq->queued = fr_time();
+
+	/*
+	 *	The I/O thread may give the request back as
+	 *	soon as it's pushed.
+	 */
+	atomic_fetch_add(&thread->ret->refs, 1);
+	atomic_fetch_add(&io->outstanding, 1);
+
+	if (!fr_atomic_queue_push(io->requests, sreq)) {
+		atomic_fetch_sub(&io->outstanding, 1);
+		atomic_fetch_sub(&thread->ret->refs, 1);
+		talloc_steal(preq_parent, preq);
+		talloc_free(sreq);
+		goto no_capacity;
+	}
+
+	thread->outstanding++;
+	fr_dlist_insert_tail(&thread->requests, sreq);
+
+	trunk_shared_wake(io->pipe[1], &io->signalled);
+
+	*sreq_out = sreq;
+
+	return FR_TRUNK_ENQUEUE_OK;
+}
+
+/** Stop waiting for a request
+ *
+ * Neither request_complete nor request_fail will be called for the
+ * request, so the request and rctx may be freed as soon as this returns.
+ * request_free is still called, with a NULL request, once the I/O thread
+ * is done with the request, unless the worker's handle has been freed
+ * by then.
+ *
+ * @param[in] sreq	to cancel.  Must be called from the worker which
+ *			submitted it.
+ */
+void fr_trunk_shared_request_signal_cancel(fr_trunk_shared_request_t *sreq)
+{
+	fr_trunk_shared_io_t	*io = sreq->io;
+	uint_fast32_t		refs;
+
+	if (atomic_exchange(&sreq->cancelled, true)) return;
+
+	/*
+	 *	Take a reference for the cancel message, unless the
+	 *	I/O thread has already given the request back.
+	 */
+	refs = atomic_load(&sreq->refs);
+	do {
+		if (refs == 0) return;
+	} while (!atomic_compare_exchange_weak(&sreq->refs, &refs, refs + 1));
+
+	/*
+	 *	If we can't tell the I/O thread, the request runs
+	 *	to completion, and the result is discarded.
+	 */
+	if (!fr_atomic_queue_push(io->cancels, sreq)) {
+		trunk_shared_request_release(sreq);
+		return;
+	}
+
+	trunk_shared_wake(io->pipe[1], &io->signalled);
+}
@@ -0,0 +1,54 @@
+#pragma once
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/server/trunk_shared.h
+ * @brief Trunks owned by dedicated I/O threads, and shared by all workers.
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+RCSIDH(trunk_shared_h, "$Id$")
+
+#include <freeradius-devel/server/trunk.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct fr_trunk_shared_s fr_trunk_shared_t;
+typedef struct fr_trunk_shared_thread_s fr_trunk_shared_thread_t;
+typedef struct fr_trunk_shared_request_s fr_trunk_shared_request_t;
+
+fr_trunk_shared_t	*fr_trunk_shared_alloc(TALLOC_CTX *ctx, char const *name,
+					       uint32_t num_threads, uint32_t max_outstanding,
+					       fr_trunk_io_funcs_t const *funcs, fr_trunk_conf_t const *conf,
+					       void const *uctx);
+
+fr_trunk_shared_thread_t *fr_trunk_shared_thread_alloc(TALLOC_CTX *ctx, fr_trunk_shared_t *shared,
+						       fr_event_list_t *el);
+
+fr_trunk_enqueue_t	fr_trunk_shared_request_enqueue(fr_trunk_shared_request_t **sreq_out,
+							fr_trunk_shared_thread_t *thread, request_t *request,
+							void *preq, void *rctx) CC_HINT(nonnull(1,2,4));
+
+void			fr_trunk_shared_request_signal_cancel(fr_trunk_shared_request_t *sreq) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
@@ -2,9 +2,12 @@
 #include <freeradius-devel/util/syserror.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <stdatomic.h>
 
 #include "trunk.c"
 
+#include <freeradius-devel/server/trunk_shared.h>
+
 //#include <gperftools/profiler.h>
 typedef struct {
 	fr_trunk_request_t	*treq;			//!< Trunk request.
@@ -1853,6 +1856,166 @@ static void test_enqueue_and_io_speed(void)
 }
 #endif
 
+typedef struct {
+	uint64_t		completed;		//!< Seen by the complete callback, in the worker.
+	uint64_t		failed;			//!< Seen by the failed callback, in the worker.
+	uint64_t		freed;			//!< Seen by the free callback, in the worker.
+} test_shared_stats_t;
+
+/** Same as test_mux, but records the treq in the preq, as the worker doesn't know it
+ *
+ */
+static void test_shared_mux(UNUSED fr_event_list_t *el, fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
+{
+	fr_trunk_request_t	*treq;
+	int			fd = *(talloc_get_type_abort(conn->h, int));
+	ssize_t			slen;
+
+	while (fr_trunk_connection_pop_request(&treq, tconn) == 0) {
+		test_proto_request_t	*preq = talloc_get_type_abort(treq->pub.preq, test_proto_request_t);
+
+		preq->treq = treq;
+
+		slen = write(fd, &preq, sizeof(preq));
+		if (slen <= 0) return;
+		if (slen < (ssize_t)sizeof(preq)) abort();
+
+		fr_trunk_request_signal_sent(treq);
+	}
+}
+
+static void test_shared_request_complete(UNUSED request_t *request, void *preq, UNUSED void *rctx, void *uctx)
+{
+	test_shared_stats_t	*stats = uctx;
+	test_proto_request_t	*our_preq = talloc_get_type_abort(preq, test_proto_request_t);
+
+	our_preq->completed = true;
+	stats->completed++;
+}
+
+static void test_shared_request_fail(UNUSED request_t *request, void *preq, UNUSED void *rctx,
+				     UNUSED fr_trunk_request_state_t state, void *uctx)
+{
+	test_shared_stats_t	*stats = uctx;
+	test_proto_request_t	*our_preq = talloc_get_type_abort(preq, test_proto_request_t);
+
+	our_preq->failed = true;
+	stats->failed++;
+}
+
+static void test_shared_request_free(UNUSED request_t *request, void *preq, void *uctx)
+{
+	test_shared_stats_t *stats = uctx;
+
+	talloc_free(preq);
+	stats->freed++;
+}
+
+static atomic_bool test_shared_preq_freed;
+
+static int _test_shared_preq_free(UNUSED test_proto_request_t *preq)
+{
+	atomic_store(&test_shared_preq_freed, true);
+	return 0;
+}
+
+static void test_shared_enqueue(void)
+{
+	TALLOC_CTX			*ctx = talloc_init_const("test");
+	fr_event_list_t			*el;
+	fr_trunk_conf_t			conf = {
+						.start = 1,
+						.min = 1,
+						.manage_interval = fr_time_delta_from_nsec(NSEC * 0.5)
+					};
+	fr_trunk_io_funcs_t		io_funcs = {
+						.connection_alloc = test_setup_socket_pair_connection_alloc,
+						.connection_notify = _conn_notify,
+						.request_mux = test_shared_mux,
+						.request_demux = test_demux,
+						.request_complete = test_shared_request_complete,
+						.request_fail = test_shared_request_fail,
+						.request_free = test_shared_request_free
+					};
+	test_shared_stats_t		stats = { 0 };
+	fr_trunk_shared_t		*shared;
+	fr_trunk_shared_thread_t	*thread;
+	fr_trunk_shared_request_t	*sreq;
+	test_proto_request_t		*preq;
+	size_t				i, requests = 128;
+
+	DEBUG_LVL_SET;
+
+	el = fr_event_list_alloc(ctx, NULL, NULL);
+
+	/*
+	 *	One I/O thread, as the loopback handler isn't thread safe.
+	 */
+	shared = fr_trunk_shared_alloc(ctx, "test_shared", 1, requests, &io_funcs, &conf, &stats);
+	TEST_CHECK(shared != NULL);
+	if (!shared) goto done;
+
+	thread = fr_trunk_shared_thread_alloc(ctx, shared, el);
+	TEST_CHECK(thread != NULL);
+	if (!thread) goto done;
+
+	TEST_CASE("Enqueue up to max_outstanding");
+	for (i = 0; i < requests; i++) {
+		preq = talloc_zero(NULL, test_proto_request_t);
+		TEST_CHECK(fr_trunk_shared_request_enqueue(&sreq, thread, NULL, preq, NULL) == FR_TRUNK_ENQUEUE_OK);
+	}
+
+	TEST_CASE("Enqueue over max_outstanding is refused");
+	preq = talloc_zero(NULL, test_proto_request_t);
+	TEST_CHECK(fr_trunk_shared_request_enqueue(&sreq, thread, NULL, preq, NULL) == FR_TRUNK_ENQUEUE_NO_CAPACITY);
+	TEST_CHECK(talloc_parent(preq) == NULL);
+	talloc_free(preq);
+
+	TEST_CASE("Requests are completed in the worker");
+	for (i = 0; (stats.freed < requests) && (i < 5000); i++) {
+		struct timespec ts = { .tv_sec = 0, .tv_nsec = 1000000 };
+
+		if (fr_event_corral(el, fr_time(), false) > 0) {
+			fr_event_service(el);
+			continue;
+		}
+		nanosleep(&ts, NULL);
+	}
+
+	TEST_CHECK(stats.completed == requests);
+	TEST_MSG("Expected %zu completed, got %" PRIu64, requests, stats.completed);
+	TEST_CHECK(stats.failed == 0);
+	TEST_CHECK(stats.freed == requests);
+
+	TEST_CASE("Capacity is available again");
+	preq = talloc_zero(NULL, test_proto_request_t);
+	atomic_init(&test_shared_preq_freed, false);
+	talloc_set_destructor(preq, _test_shared_preq_free);
+	TEST_CHECK(fr_trunk_shared_request_enqueue(&sreq, thread, NULL, preq, NULL) == FR_TRUNK_ENQUEUE_OK);
+
+	TEST_CASE("Freeing the worker's handle doesn't wait for requests in flight");
+	talloc_free(thread);
+
+	/*
+	 *	The request may already have been given back,
+	 *	in which case it was freed with the handle.
+	 */
+	TEST_CHECK(stats.completed == requests);
+	TEST_CHECK((stats.freed == requests) || (stats.freed == requests + 1));
+
+	/*
+	 *	Once the I/O thread has been stopped, the
+	 *	request has been freed, one way or another.
+	 */
+	talloc_free(shared);
+	TEST_CHECK(atomic_load(&test_shared_preq_freed));
+	shared = NULL;
+
+done:
+	talloc_free(shared);
+	talloc_free(ctx);
+}
+
 /*
  *	Connection spawning
  */
@@ -1893,6 +2056,11 @@ TEST_LIST = {
 	{ "Spawn - Connection levels alternating edges",test_connection_levels_alternating_edges },
 #endif
 
+	/*
+	 *	Shared trunks
+	 */
+	{ "Shared - Enqueue and complete in the worker",	test_shared_enqueue },
+
 	/*
 	 *	Performance tests
 	 */
@@ -14,6 +14,7 @@ SOURCES	:= \
 	engine.c \
 	log.c \
 	pairs.c \
+	pkey.c \
 	session.c \
 	utils.c \
 	verify.c \
@@ -397,6 +397,8 @@ void fr_openssl_free(void)
 	fr_tls_engine_free_all();
 #endif
 
+	fr_tls_pkey_free();
+
 	OPENSSL_cleanup();
 
 	fr_dict_autofree(tls_dict);
@@ -404,6 +406,8 @@ void fr_openssl_free(void)
 	fr_tls_log_free();
 
 	fr_tls_bio_free();
+
+	fr_tls_session_free();
 }
 
 /** Add all the default ciphers and message digests to our context.
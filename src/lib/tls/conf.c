@@ -129,6 +129,7 @@ static CONF_PARSER tls_chain_config[] = {
 			 },
 			 .dflt = "hard" },
 	{ FR_CONF_OFFSET("include_root_ca", FR_TYPE_BOOL, fr_tls_chain_conf_t, include_root_ca), .dflt = "no" },
+	{ FR_CONF_OFFSET("offload_private_key", FR_TYPE_BOOL, fr_tls_chain_conf_t, offload_private_key), .dflt = "no" },
 	CONF_PARSER_TERMINATOR
 };
 
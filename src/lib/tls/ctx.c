@@ -349,6 +349,13 @@ static int tls_ctx_load_cert_chain(SSL_CTX *ctx, fr_tls_chain_conf_t *chain, boo
 		return -1;
 	}
 
+	/*
+	 *	Wrap the private key so that signing and
+	 *	decryption can pause the handshake, and run
+	 *	in an offload thread.
+	 */
+	if (chain->offload_private_key && (fr_tls_pkey_offload(ctx) < 0)) return -1;
+
 	/*
 	 *	Loop over the certificates checking validity periods.
 	 *	SSL_CTX_build_cert_chain does this too, but we can
@@ -0,0 +1,950 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file tls/pkey.c
+ * @brief Run private key operations in offload threads
+ *
+ * Full handshakes spend most of their CPU time signing, or decrypting, with
+ * the server's private key.  Each handshake round already runs in an OpenSSL
+ * ASYNC_JOB (see SSL_MODE_ASYNC in ctx.c), so if the key operation pauses the
+ * job, the worker can process other requests whilst an offload thread does
+ * the work.
+ *
+ * OpenSSL >= 3.0 doesn't let applications replace key operations directly,
+ * so we register a small built-in provider.  Its keys wrap a key loaded by
+ * the default provider.  Its sign and decrypt operations copy their inputs
+ * into a #fr_tls_pkey_op_t, and pause the job.
+ * tls_session_async_handshake_cont() then passes the op to an offload
+ * thread, and yields until it's done.
+ *
+ * Operations which happen outside of a handshake round, or which can't be
+ * offloaded, run immediately, exactly as they would with an unwrapped key.
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
+
+#ifdef WITH_TLS
+#define LOG_PREFIX "tls"
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/util/debug.h>
+
+#include "base.h"
+#include "log.h"
+#include "pkey.h"
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/async.h>
+#include <openssl/core_dispatch.h>
+#include <openssl/core_names.h>
+#include <openssl/provider.h>
+
+#define TLS_PKEY_PROVIDER	"freeradius"
+#define TLS_PKEY_PROPERTIES	"provider=" TLS_PKEY_PROVIDER
+
+/** Used for all operations on the wrapped key, so we never call ourselves
+ *
+ */
+#define TLS_PKEY_INNER_PROPQ	"provider!=" TLS_PKEY_PROVIDER
+
+/** Passes the key to wrap to our import function
+ *
+ */
+#define TLS_PKEY_PARAM_INNER	"freeradius-inner-key"
+
+typedef enum {
+	TLS_PKEY_OP_DIGEST_SIGN = 0,			//!< Finish a digest and sign it.
+	TLS_PKEY_OP_SIGN,				//!< Sign a digest.
+	TLS_PKEY_OP_DECRYPT				//!< Decrypt, e.g. an RSA premaster secret.
+} tls_pkey_op_type_t;
+
+/** A private key operation, with copies of everything it needs
+ *
+ * Ops are allocated in the NULL ctx, as they may be owned by an
+ * offload thread whilst the request is cancelled.
+ */
+struct fr_tls_pkey_op_s {
+	tls_pkey_op_type_t	type;
+	EVP_MD_CTX		*md_ctx;		//!< Copy of the digest state, for #TLS_PKEY_OP_DIGEST_SIGN.
+	EVP_PKEY_CTX		*pkey_ctx;		//!< Copy of the operation state, for the others.
+
+	uint8_t			*in;			//!< Data to sign, or decrypt.
+	size_t			inlen;
+
+	uint8_t			*out;			//!< Where the result is written.
+	size_t			outlen;			//!< Size of out, then the length of the result.
+
+	int			ret;			//!< What OpenSSL returned.
+	bool			done;			//!< Whether the op has run.
+};
+
+/** A key from our provider, wrapping one from the default provider
+ *
+ */
+typedef struct {
+	char const		*type;			//!< "RSA" or "EC".
+	EVP_PKEY		*inner;			//!< The key which does the work.
+	bool			has_private;		//!< Whether inner has a private key.
+} tls_pkey_key_t;
+
+/** Signature or asymmetric cipher context
+ *
+ */
+typedef struct {
+	tls_pkey_key_t		*key;
+	EVP_MD_CTX		*md_ctx;		//!< For digest sign operations.  Owns pkey_ctx.
+	EVP_PKEY_CTX		*pkey_ctx;		//!< The operation on the inner key.
+} tls_pkey_ctx_t;
+
+/** The TLS session whose handshake is being advanced by SSL_read()
+ *
+ * Key operations don't get passed the SSL *, but they're always
+ * called on the same thread, and from inside SSL_read().
+ */
+static _Thread_local fr_tls_session_t *pkey_session;
+
+static int _tls_pkey_op_free(fr_tls_pkey_op_t *op)
+{
+	EVP_MD_CTX_free(op->md_ctx);
+	EVP_PKEY_CTX_free(op->pkey_ctx);
+
+	return 0;
+}
+
+static fr_tls_pkey_op_t *tls_pkey_op_alloc(tls_pkey_op_type_t type, size_t outlen)
+{
+	fr_tls_pkey_op_t *op;
+
+	MEM(op = talloc_zero(NULL, fr_tls_pkey_op_t));
+	talloc_set_destructor(op, _tls_pkey_op_free);
+	op->type = type;
+	MEM(op->out = talloc_array(op, uint8_t, outlen));
+	op->outlen = outlen;
+
+	return op;
+}
+
+/** Run a key operation
+ *
+ * This may be called in an offload thread, so it only touches the op.
+ */
+static void tls_pkey_op_run(void *uctx)
+{
+	fr_tls_pkey_op_t *op = talloc_get_type_abort(uctx, fr_tls_pkey_op_t);
+
+	switch (op->type) {
+	case TLS_PKEY_OP_DIGEST_SIGN:
+		op->ret = EVP_DigestSignFinal(op->md_ctx, op->out, &op->outlen);
+		break;
+
+	case TLS_PKEY_OP_SIGN:
+		op->ret = EVP_PKEY_sign(op->pkey_ctx, op->out, &op->outlen, op->in, op->inlen);
+		break;
+
+	case TLS_PKEY_OP_DECRYPT:
+		op->ret = EVP_PKEY_decrypt(op->pkey_ctx, op->out, &op->outlen, op->in, op->inlen);
+		break;
+	}
+	op->done = true;
+
+	/*
+	 *	Errors from offload threads would otherwise
+	 *	accumulate in that thread's error queue.
+	 */
+	ERR_clear_error();
+}
+
+/** Run a key operation, pausing the handshake whilst it's offloaded
+ *
+ * @param[in] op	to run.  Freed before this function returns.
+ * @param[out] out	where to write the result.
+ * @param[out] outlen	length of the result.
+ * @return
+ *	- 1 on success.
+ *	- 0 on failure.
+ */
+static int tls_pkey_op(fr_tls_pkey_op_t *op, uint8_t *out, size_t *outlen)
+{
+	fr_tls_session_t	*tls_session = pkey_session;
+	int			ret;
+
+	/*
+	 *	Not inside a handshake round, or we can't pause.
+	 */
+	if (!tls_session || !ASYNC_get_current_job() || tls_session->pkey.op || tls_session->pkey.offload) {
+		tls_pkey_op_run(op);
+		goto done;
+	}
+
+	tls_session->pkey.op = op;
+
+	ASYNC_pause_job();	/* Jumps back to SSL_read() in session.c */
+
+	/*
+	 *	We're resumed by the next call to SSL_read(),
+	 *	either once the op has completed, or because
+	 *	the request was cancelled.
+	 */
+	if (tls_session->pkey.offload) {
+		fr_tls_pkey_op_t *result = unlang_offload_result(tls_session->pkey.offload);
+
+		TALLOC_FREE(tls_session->pkey.offload);	/* Cancels the op if it hasn't completed */
+		if (!result) return 0;
+		fr_assert(result == op);
+
+	} else if (tls_session->pkey.op == op) {
+		tls_session->pkey.op = NULL;		/* Ran in the worker, or not at all */
+
+	} else {
+		return 0;				/* Cancelled, and freed by the offload thread */
+	}
+
+	if (!op->done) {
+		talloc_free(op);
+		return 0;
+	}
+
+done:
+	ret = op->ret > 0;
+	if (ret) {
+		memcpy(out, op->out, op->outlen);
+		*outlen = op->outlen;
+	}
+	talloc_free(op);
+
+	return ret;
+}
+
+/*
+ *	Key management
+ *
+ *	Keys can't be exported with their private components,
+ *	which makes OpenSSL use our signature and asymmetric
+ *	cipher implementations with them.
+ */
+static void *tls_pkey_keymgmt_new(char const *type)
+{
+	tls_pkey_key_t *key;
+
+	key = OPENSSL_zalloc(sizeof(*key));
+	if (!key) return NULL;
+	key->type = type;
+
+	return key;
+}
+
+static void *tls_pkey_keymgmt_new_rsa(UNUSED void *provctx)
+{
+	return tls_pkey_keymgmt_new("RSA");
+}
+
+static void *tls_pkey_keymgmt_new_ec(UNUSED void *provctx)
+{
+	return tls_pkey_keymgmt_new("EC");
+}
+
+static void tls_pkey_keymgmt_free(void *keydata)
+{
+	tls_pkey_key_t *key = keydata;
+
+	if (!key) return;
+
+	EVP_PKEY_free(key->inner);
+	OPENSSL_free(key);
+}
+
+static int tls_pkey_keymgmt_has(void const *keydata, int selection)
+{
+	tls_pkey_key_t const *key = keydata;
+
+	if (!key) return 0;
+	if ((selection & OSSL_KEYMGMT_SELECT_ALL) == 0) return 1;
+	if (!key->inner) return 0;
+	if ((selection & OSSL_KEYMGMT_SELECT_PRIVATE_KEY) && !key->has_private) return 0;
+
+	return 1;
+}
+
+static int tls_pkey_keymgmt_match(void const *keydata1, void const *keydata2, UNUSED int selection)
+{
+	tls_pkey_key_t const *a = keydata1, *b = keydata2;
+
+	if (!a->inner || !b->inner) return 0;
+
+	return EVP_PKEY_eq(a->inner, b->inner) == 1;
+}
+
+/** Wrap a key, or create an inner key from public components
+ *
+ * The latter is needed so that OpenSSL can compare the public key in
+ * the certificate with our key.
+ */
+static int tls_pkey_keymgmt_import(void *keydata, int selection, OSSL_PARAM const params[])
+{
+	tls_pkey_key_t		*key = keydata;
+	OSSL_PARAM const	*p;
+	EVP_PKEY_CTX		*ctx;
+	EVP_PKEY		*inner = NULL;
+
+	if (key->inner) return 0;
+
+	p = OSSL_PARAM_locate_const(params, TLS_PKEY_PARAM_INNER);
+	if (p) {
+		void const	*ptr;
+		size_t		len;
+
+		if (!OSSL_PARAM_get_octet_ptr(p, &ptr, &len) || !ptr) return 0;
+
+		memcpy(&inner, &ptr, sizeof(inner));
+		if (!EVP_PKEY_up_ref(inner)) return 0;
+
+		key->inner = inner;
+		key->has_private = true;
+		return 1;
+	}
+
+	ctx = EVP_PKEY_CTX_new_from_name(NULL, key->type, TLS_PKEY_INNER_PROPQ);
+	if (!ctx) return 0;
+
+	if ((EVP_PKEY_fromdata_init(ctx) <= 0) ||
+	    (EVP_PKEY_fromdata(ctx, &inner, selection, UNCONST(OSSL_PARAM *, params)) <= 0)) {
+		EVP_PKEY_CTX_free(ctx);
+		return 0;
+	}
+	EVP_PKEY_CTX_free(ctx);
+
+	key->inner = inner;
+	key->has_private = (selection & OSSL_KEYMGMT_SELECT_PRIVATE_KEY) != 0;
+
+	return 1;
+}
+
+static OSSL_PARAM const *tls_pkey_keymgmt_types(char const *type, int selection)
+{
+	EVP_PKEY_CTX		*ctx;
+	OSSL_PARAM const	*types = NULL;
+
+	ctx = EVP_PKEY_CTX_new_from_name(NULL, type, TLS_PKEY_INNER_PROPQ);
+	if (!ctx) return NULL;
+
+	if (EVP_PKEY_fromdata_init(ctx) > 0) types = EVP_PKEY_fromdata_settable(ctx, selection);
+	EVP_PKEY_CTX_free(ctx);
+
+	return types;
+}
+
+static OSSL_PARAM const *tls_pkey_keymgmt_import_types_rsa(int selection)
+{
+	return tls_pkey_keymgmt_types("RSA", selection);
+}
+
+static OSSL_PARAM const *tls_pkey_keymgmt_import_types_ec(int selection)
+{
+	return tls_pkey_keymgmt_types("EC", selection);
+}
+
+static OSSL_PARAM const *tls_pkey_keymgmt_export_types_rsa(int selection)
+{
+	if (selection & OSSL_KEYMGMT_SELECT_PRIVATE_KEY) return NULL;
+
+	return tls_pkey_keymgmt_types("RSA", selection);
+}
+
+static OSSL_PARAM const *tls_pkey_keymgmt_export_types_ec(int selection)
+{
+	if (selection & OSSL_KEYMGMT_SELECT_PRIVATE_KEY) return NULL;
+
+	return tls_pkey_keymgmt_types("EC", selection);
+}
+
+static int tls_pkey_keymgmt_export(void *keydata, int selection, OSSL_CALLBACK *cb, void *cbarg)
+{
+	tls_pkey_key_t *key = keydata;
+
+	if (!key->inner || (selection & OSSL_KEYMGMT_SELECT_PRIVATE_KEY)) return 0;
+
+	return EVP_PKEY_export(key->inner, selection, cb, cbarg);
+}
+
+static int tls_pkey_keymgmt_get_params(void *keydata, OSSL_PARAM params[])
+{
+	tls_pkey_key_t *key = keydata;
+
+	if (!key->inner) return 0;
+
+	return EVP_PKEY_get_params(key->inner, params);
+}
+
+static OSSL_PARAM const *tls_pkey_keymgmt_gettable_params(char const *type)
+{
+	EVP_KEYMGMT		*keymgmt;
+	OSSL_PARAM const	*params;
+
+	keymgmt = EVP_KEYMGMT_fetch(NULL, type, TLS_PKEY_INNER_PROPQ);
+	if (!keymgmt) return NULL;
+
+	params = EVP_KEYMGMT_gettable_params(keymgmt);
+	EVP_KEYMGMT_free(keymgmt);
+
+	return params;
+}
+
+static OSSL_PARAM const *tls_pkey_keymgmt_gettable_params_rsa(UNUSED void *provctx)
+{
+	return tls_pkey_keymgmt_gettable_params("RSA");
+}
+
+static OSSL_PARAM const *tls_pkey_keymgmt_gettable_params_ec(UNUSED void *provctx)
+{
+	return tls_pkey_keymgmt_gettable_params("EC");
+}
+
+static char const *tls_pkey_keymgmt_operation_name_rsa(UNUSED int operation_id)
+{
+	return "RSA";
+}
+
+static char const *tls_pkey_keymgmt_operation_name_ec(int operation_id)
+{
+	return (operation_id == OSSL_OP_SIGNATURE) ? "ECDSA" : NULL;
+}
+
+#define TLS_PKEY_KEYMGMT(_type) \
+static OSSL_DISPATCH const tls_pkey_keymgmt_##_type[] = { \
+	{ OSSL_FUNC_KEYMGMT_NEW, (void (*)(void))tls_pkey_keymgmt_new_##_type }, \
+	{ OSSL_FUNC_KEYMGMT_FREE, (void (*)(void))tls_pkey_keymgmt_free }, \
+	{ OSSL_FUNC_KEYMGMT_HAS, (void (*)(void))tls_pkey_keymgmt_has }, \
+	{ OSSL_FUNC_KEYMGMT_MATCH, (void (*)(void))tls_pkey_keymgmt_match }, \
+	{ OSSL_FUNC_KEYMGMT_IMPORT, (void (*)(void))tls_pkey_keymgmt_import }, \
+	{ OSSL_FUNC_KEYMGMT_IMPORT_TYPES, (void (*)(void))tls_pkey_keymgmt_import_types_##_type }, \
+	{ OSSL_FUNC_KEYMGMT_EXPORT, (void (*)(void))tls_pkey_keymgmt_export }, \
+	{ OSSL_FUNC_KEYMGMT_EXPORT_TYPES, (void (*)(void))tls_pkey_keymgmt_export_types_##_type }, \
+	{ OSSL_FUNC_KEYMGMT_GET_PARAMS, (void (*)(void))tls_pkey_keymgmt_get_params }, \
+	{ OSSL_FUNC_KEYMGMT_GETTABLE_PARAMS, (void (*)(void))tls_pkey_keymgmt_gettable_params_##_type }, \
+	{ OSSL_FUNC_KEYMGMT_QUERY_OPERATION_NAME, (void (*)(void))tls_pkey_keymgmt_operation_name_##_type }, \
+	{ 0, NULL } \
+}
+
+TLS_PKEY_KEYMGMT(rsa);
+TLS_PKEY_KEYMGMT(ec);
+
+/*
+ *	Signatures and asymmetric ciphers
+ *
+ *	Everything is passed through to an operation on the
+ *	inner key, except for the final step, which is copied
+ *	into an op.
+ */
+static void *tls_pkey_ctx_new(UNUSED void *provctx, UNUSED char const *propq)
+{
+	return OPENSSL_zalloc(sizeof(tls_pkey_ctx_t));
+}
+
+static void tls_pkey_ctx_reset(tls_pkey_ctx_t *ctx)
+{
+	if (ctx->md_ctx) {
+		EVP_MD_CTX_free(ctx->md_ctx);
+		ctx->md_ctx = NULL;
+	} else {
+		EVP_PKEY_CTX_free(ctx->pkey_ctx);
+	}
+	ctx->pkey_ctx = NULL;
+}
+
+static void tls_pkey_ctx_free(void *vctx)
+{
+	tls_pkey_ctx_t *ctx = vctx;
+
+	tls_pkey_ctx_reset(ctx);
+	OPENSSL_free(ctx);
+}
+
+static void *tls_pkey_ctx_dup(void *vctx)
+{
+	tls_pkey_ctx_t *ctx = vctx, *dup;
+
+	dup = OPENSSL_zalloc(sizeof(*dup));
+	if (!dup) return NULL;
+	dup->key = ctx->key;
+
+	if (ctx->md_ctx) {
+		dup->md_ctx = EVP_MD_CTX_new();
+		if (!dup->md_ctx || !EVP_MD_CTX_copy_ex(dup->md_ctx, ctx->md_ctx)) goto error;
+		dup->pkey_ctx = EVP_MD_CTX_get_pkey_ctx(dup->md_ctx);
+	} else if (ctx->pkey_ctx) {
+		dup->pkey_ctx = EVP_PKEY_CTX_dup(ctx->pkey_ctx);
+		if (!dup->pkey_ctx) goto error;
+	}
+
+	return dup;
+
+error:
+	tls_pkey_ctx_free(dup);
+	return NULL;
+}
+
+static int tls_pkey_ctx_get_params(void *vctx, OSSL_PARAM params[])
+{
+	tls_pkey_ctx_t *ctx = vctx;
+
+	if (!ctx->pkey_ctx) return 0;
+
+	return EVP_PKEY_CTX_get_params(ctx->pkey_ctx, params);
+}
+
+static OSSL_PARAM const *tls_pkey_ctx_gettable_params(void *vctx, UNUSED void *provctx)
+{
+	tls_pkey_ctx_t *ctx = vctx;
+
+	if (!ctx || !ctx->pkey_ctx) return NULL;
+
+	return EVP_PKEY_CTX_gettable_params(ctx->pkey_ctx);
+}
+
+static int tls_pkey_ctx_set_params(void *vctx, OSSL_PARAM const params[])
+{
+	tls_pkey_ctx_t *ctx = vctx;
+
+	if (!ctx->pkey_ctx) return 0;
+
+	return EVP_PKEY_CTX_set_params(ctx->pkey_ctx, params);
+}
+
+static OSSL_PARAM const *tls_pkey_ctx_settable_params(void *vctx, UNUSED void *provctx)
+{
+	tls_pkey_ctx_t *ctx = vctx;
+
+	if (!ctx || !ctx->pkey_ctx) return NULL;
+
+	return EVP_PKEY_CTX_settable_params(ctx->pkey_ctx);
+}
+
+static int tls_pkey_sign_init(void *vctx, void *keydata, OSSL_PARAM const params[])
+{
+	tls_pkey_ctx_t *ctx = vctx;
+	tls_pkey_key_t *key = keydata;
+
+	tls_pkey_ctx_reset(ctx);
+	ctx->key = key;
+
+	ctx->pkey_ctx = EVP_PKEY_CTX_new_from_pkey(NULL, key->inner, TLS_PKEY_INNER_PROPQ);
+	if (!ctx->pkey_ctx) return 0;
+
+	return EVP_PKEY_sign_init_ex(ctx->pkey_ctx, params) > 0;
+}
+
+static int tls_pkey_sign(void *vctx, unsigned char *sig, size_t *siglen, size_t sigsize,
+			 unsigned char const *tbs, size_t tbslen)
+{
+	tls_pkey_ctx_t		*ctx = vctx;
+	fr_tls_pkey_op_t	*op;
+
+	if (!sig) {
+		*siglen = EVP_PKEY_get_size(ctx->key->inner);
+		return 1;
+	}
+
+	op = tls_pkey_op_alloc(TLS_PKEY_OP_SIGN, sigsize);
+	op->pkey_ctx = EVP_PKEY_CTX_dup(ctx->pkey_ctx);
+	if (!op->pkey_ctx) {
+		talloc_free(op);
+		return 0;
+	}
+	MEM(op->in = talloc_memdup(op, tbs, tbslen));
+	op->inlen = tbslen;
+
+	return tls_pkey_op(op, sig, siglen);
+}
+
+static int tls_pkey_digest_sign_init(void *vctx, char const *mdname, void *keydata, OSSL_PARAM const params[])
+{
+	tls_pkey_ctx_t *ctx = vctx;
+	tls_pkey_key_t *key = keydata;
+
+	tls_pkey_ctx_reset(ctx);
+	ctx->key = key;
+
+	ctx->md_ctx = EVP_MD_CTX_new();
+	if (!ctx->md_ctx) return 0;
+
+	return EVP_DigestSignInit_ex(ctx->md_ctx, &ctx->pkey_ctx, mdname,
+				     NULL, TLS_PKEY_INNER_PROPQ, key->inner, params) > 0;
+}
+
+static int tls_pkey_digest_sign_update(void *vctx, unsigned char const *data, size_t datalen)
+{
+	tls_pkey_ctx_t *ctx = vctx;
+
+	return EVP_DigestSignUpdate(ctx->md_ctx, data, datalen) > 0;
+}
+
+static int tls_pkey_digest_sign_final(void *vctx, unsigned char *sig, size_t *siglen, size_t sigsize)
+{
+	tls_pkey_ctx_t		*ctx = vctx;
+	fr_tls_pkey_op_t	*op;
+
+	if (!sig) {
+		*siglen = EVP_PKEY_get_size(ctx->key->inner);
+		return 1;
+	}
+
+	op = tls_pkey_op_alloc(TLS_PKEY_OP_DIGEST_SIGN, sigsize);
+	op->md_ctx = EVP_MD_CTX_new();
+	if (!op->md_ctx || !EVP_MD_CTX_copy_ex(op->md_ctx, ctx->md_ctx)) {
+		talloc_free(op);
+		return 0;
+	}
+
+	return tls_pkey_op(op, sig, siglen);
+}
+
+static int tls_pkey_decrypt_init(void *vctx, void *keydata, OSSL_PARAM const params[])
+{
+	tls_pkey_ctx_t *ctx = vctx;
+	tls_pkey_key_t *key = keydata;
+
+	tls_pkey_ctx_reset(ctx);
+	ctx->key = key;
+
+	ctx->pkey_ctx = EVP_PKEY_CTX_new_from_pkey(NULL, key->inner, TLS_PKEY_INNER_PROPQ);
+	if (!ctx->pkey_ctx) return 0;
+
+	return EVP_PKEY_decrypt_init_ex(ctx->pkey_ctx, params) > 0;
+}
+
+static int tls_pkey_decrypt(void *vctx, unsigned char *out, size_t *outlen, size_t outsize,
+			    unsigned char const *in, size_t inlen)
+{
+	tls_pkey_ctx_t		*ctx = vctx;
+	fr_tls_pkey_op_t	*op;
+
+	if (!out) {
+		*outlen = EVP_PKEY_get_size(ctx->key->inner);
+		return 1;
+	}
+
+	op = tls_pkey_op_alloc(TLS_PKEY_OP_DECRYPT, outsize);
+	op->pkey_ctx = EVP_PKEY_CTX_dup(ctx->pkey_ctx);
+	if (!op->pkey_ctx) {
+		talloc_free(op);
+		return 0;
+	}
+	MEM(op->in = talloc_memdup(op, in, inlen));
+	op->inlen = inlen;
+
+	return tls_pkey_op(op, out, outlen);
+}
+
+static OSSL_DISPATCH const tls_pkey_signature[] = {
+	{ OSSL_FUNC_SIGNATURE_NEWCTX, (void (*)(void))tls_pkey_ctx_new },
+	{ OSSL_FUNC_SIGNATURE_FREECTX, (void (*)(void))tls_pkey_ctx_free },
+	{ OSSL_FUNC_SIGNATURE_DUPCTX, (void (*)(void))tls_pkey_ctx_dup },
+	{ OSSL_FUNC_SIGNATURE_SIGN_INIT, (void (*)(void))tls_pkey_sign_init },
+	{ OSSL_FUNC_SIGNATURE_SIGN, (void (*)(void))tls_pkey_sign },
+	{ OSSL_FUNC_SIGNATURE_DIGEST_SIGN_INIT, (void (*)(void))tls_pkey_digest_sign_init },
+	{ OSSL_FUNC_SIGNATURE_DIGEST_SIGN_UPDATE, (void (*)(void))tls_pkey_digest_sign_update },
+	{ OSSL_FUNC_SIGNATURE_DIGEST_SIGN_FINAL, (void (*)(void))tls_pkey_digest_sign_final },
+	{ OSSL_FUNC_SIGNATURE_GET_CTX_PARAMS, (void (*)(void))tls_pkey_ctx_get_params },
+	{ OSSL_FUNC_SIGNATURE_GETTABLE_CTX_PARAMS, (void (*)(void))tls_pkey_ctx_gettable_params },
+	{ OSSL_FUNC_SIGNATURE_SET_CTX_PARAMS, (void (*)(void))tls_pkey_ctx_set_params },
+	{ OSSL_FUNC_SIGNATURE_SETTABLE_CTX_PARAMS, (void (*)(void))tls_pkey_ctx_settable_params },
+	{ 0, NULL }
+};
+
+static OSSL_DISPATCH const tls_pkey_asym_cipher[] = {
+	{ OSSL_FUNC_ASYM_CIPHER_NEWCTX, (void (*)(void))tls_pkey_ctx_new },
+	{ OSSL_FUNC_ASYM_CIPHER_FREECTX, (void (*)(void))tls_pkey_ctx_free },
+	{ OSSL_FUNC_ASYM_CIPHER_DUPCTX, (void (*)(void))tls_pkey_ctx_dup },
+	{ OSSL_FUNC_ASYM_CIPHER_DECRYPT_INIT, (void (*)(void))tls_pkey_decrypt_init },
+	{ OSSL_FUNC_ASYM_CIPHER_DECRYPT, (void (*)(void))tls_pkey_decrypt },
+	{ OSSL_FUNC_ASYM_CIPHER_GET_CTX_PARAMS, (void (*)(void))tls_pkey_ctx_get_params },
+	{ OSSL_FUNC_ASYM_CIPHER_GETTABLE_CTX_PARAMS, (void (*)(void))tls_pkey_ctx_gettable_params },
+	{ OSSL_FUNC_ASYM_CIPHER_SET_CTX_PARAMS, (void (*)(void))tls_pkey_ctx_set_params },
+	{ OSSL_FUNC_ASYM_CIPHER_SETTABLE_CTX_PARAMS, (void (*)(void))tls_pkey_ctx_settable_params },
+	{ 0, NULL }
+};
+
+/*
+ *	The names must match the default provider's, as libssl
+ *	picks certificate slots and signature algorithms by key
+ *	type.  Because we're loaded after the default provider,
+ *	fetches which don't involve one of our keys still get
+ *	the default provider's implementations.
+ */
+static OSSL_ALGORITHM const tls_pkey_keymgmt_algs[] = {
+	{ "RSA:rsaEncryption", TLS_PKEY_PROPERTIES, tls_pkey_keymgmt_rsa, NULL },
+	{ "EC:id-ecPublicKey", TLS_PKEY_PROPERTIES, tls_pkey_keymgmt_ec, NULL },
+	{ NULL, NULL, NULL, NULL }
+};
+
+static OSSL_ALGORITHM const tls_pkey_signature_algs[] = {
+	{ "RSA:rsaEncryption", TLS_PKEY_PROPERTIES, tls_pkey_signature, NULL },
+	{ "ECDSA", TLS_PKEY_PROPERTIES, tls_pkey_signature, NULL },
+	{ NULL, NULL, NULL, NULL }
+};
+
+static OSSL_ALGORITHM const tls_pkey_asym_cipher_algs[] = {
+	{ "RSA:rsaEncryption", TLS_PKEY_PROPERTIES, tls_pkey_asym_cipher, NULL },
+	{ NULL, NULL, NULL, NULL }
+};
+
+static OSSL_ALGORITHM const *tls_pkey_provider_query(UNUSED void *provctx, int operation_id, int *no_cache)
+{
+	*no_cache = 0;
+
+	switch (operation_id) {
+	case OSSL_OP_KEYMGMT:
+		return tls_pkey_keymgmt_algs;
+
+	case OSSL_OP_SIGNATURE:
+		return tls_pkey_signature_algs;
+
+	case OSSL_OP_ASYM_CIPHER:
+		return tls_pkey_asym_cipher_algs;
+
+	default:
+		return NULL;
+	}
+}
+
+static OSSL_DISPATCH const tls_pkey_provider[] = {
+	{ OSSL_FUNC_PROVIDER_QUERY_OPERATION, (void (*)(void))tls_pkey_provider_query },
+	{ 0, NULL }
+};
+
+static int tls_pkey_provider_init(OSSL_CORE_HANDLE const *handle, UNUSED OSSL_DISPATCH const *in,
+				  OSSL_DISPATCH const **out, void **provctx)
+{
+	*out = tls_pkey_provider;
+	memcpy(provctx, &handle, sizeof(*provctx));
+
+	return 1;
+}
+
+static pthread_mutex_t	tls_pkey_provider_mutex = PTHREAD_MUTEX_INITIALIZER;
+static OSSL_PROVIDER	*tls_pkey_provider_loaded;
+
+/** Register and load our provider, if it hasn't been already
+ *
+ * This is only done when a certificate chain enables offloading, so
+ * that other processes linking against libfreeradius-tls don't have
+ * an extra provider in the default library context.
+ *
+ * May be called from multiple threads, as each worker allocates
+ * its own SSL_CTX.
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int tls_pkey_provider_load(void)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&tls_pkey_provider_mutex);
+	if (tls_pkey_provider_loaded) goto done;
+
+	if (!OSSL_PROVIDER_add_builtin(NULL, TLS_PKEY_PROVIDER, tls_pkey_provider_init)) {
+		fr_tls_log_error(NULL, "Failed registering private key offload provider");
+		ret = -1;
+		goto done;
+	}
+
+	/*
+	 *	The default provider was loaded by
+	 *	fr_openssl_init(), so it's still used
+	 *	for everything except the keys we wrap.
+	 */
+	tls_pkey_provider_loaded = OSSL_PROVIDER_load(NULL, TLS_PKEY_PROVIDER);
+	if (!tls_pkey_provider_loaded) {
+		fr_tls_log_error(NULL, "Failed loading private key offload provider");
+		ret = -1;
+	}
+
+done:
+	pthread_mutex_unlock(&tls_pkey_provider_mutex);
+
+	return ret;
+}
+
+/** Unload our provider, if it was loaded
+ *
+ * Must be called before OPENSSL_cleanup().
+ */
+void fr_tls_pkey_free(void)
+{
+	pthread_mutex_lock(&tls_pkey_provider_mutex);
+	if (tls_pkey_provider_loaded) {
+		OSSL_PROVIDER_unload(tls_pkey_provider_loaded);
+		tls_pkey_provider_loaded = NULL;
+	}
+	pthread_mutex_unlock(&tls_pkey_provider_mutex);
+}
+
+/** Replace the current private key of a ctx with one whose operations can be offloaded
+ *
+ * @param[in] ctx	whose most recently loaded private key we wrap.
+ * @return
+ *	- 0 on success, or if the key type isn't supported.
+ *	- -1 on failure.
+ */
+int fr_tls_pkey_offload(SSL_CTX *ctx)
+{
+	EVP_PKEY	*inner = SSL_CTX_get0_privatekey(ctx);
+	EVP_PKEY	*pkey = NULL;
+	EVP_PKEY_CTX	*pkey_ctx;
+	char const	*type;
+	OSSL_PARAM	params[2];
+
+	if (!inner) return 0;
+
+	if (EVP_PKEY_is_a(inner, "RSA")) {
+		type = "RSA";
+	} else if (EVP_PKEY_is_a(inner, "EC")) {
+		type = "EC";
+	} else {
+		WARN("Operations with %s private keys can't be offloaded", EVP_PKEY_get0_type_name(inner));
+		return 0;
+	}
+
+	if (tls_pkey_provider_load() < 0) return -1;
+
+	params[0] = OSSL_PARAM_construct_octet_ptr(TLS_PKEY_PARAM_INNER, (void **)&inner, 0);
+	params[1] = OSSL_PARAM_construct_end();
+
+	pkey_ctx = EVP_PKEY_CTX_new_from_name(NULL, type, TLS_PKEY_PROPERTIES);
+	if (!pkey_ctx) {
+	error:
+		fr_tls_log_error(NULL, "Failed wrapping private key for offloading");
+		return -1;
+	}
+
+	if ((EVP_PKEY_fromdata_init(pkey_ctx) <= 0) ||
+	    (EVP_PKEY_fromdata(pkey_ctx, &pkey, EVP_PKEY_KEYPAIR, params) <= 0)) {
+		EVP_PKEY_CTX_free(pkey_ctx);
+		goto error;
+	}
+	EVP_PKEY_CTX_free(pkey_ctx);
+
+	/*
+	 *	Replaces the key for the certificate
+	 *	it was loaded with.
+	 */
+	if (!SSL_CTX_use_PrivateKey(ctx, pkey)) {
+		EVP_PKEY_free(pkey);
+		goto error;
+	}
+	EVP_PKEY_free(pkey);
+
+	return 0;
+}
+
+/** Mark the session whose handshake is about to be advanced
+ *
+ * Should be called immediately before SSL_read(), so that key
+ * operations know where to record the op.
+ */
+void fr_tls_pkey_session_bind(fr_tls_session_t *tls_session)
+{
+	pkey_session = tls_session;
+}
+
+/** Clear the session set by #fr_tls_pkey_session_bind
+ *
+ */
+void fr_tls_pkey_session_unbind(void)
+{
+	pkey_session = NULL;
+}
+
+/** Offload a private key operation which has paused the handshake
+ *
+ * @param[in] request		The current request.
+ * @param[in] tls_session	The current TLS session.
+ * @return
+ *	- UNLANG_ACTION_CALCULATE_RESULT	- No pending op, or we ran it in the worker.
+ *	- UNLANG_ACTION_YIELD			- The op was offloaded.  The request is
+ *						  marked runnable when it's done.
+ */
+unlang_action_t fr_tls_pkey_pending_offload(request_t *request, fr_tls_session_t *tls_session)
+{
+	fr_tls_pkey_op_t *op = tls_session->pkey.op;
+
+	if (!op || op->done) return UNLANG_ACTION_CALCULATE_RESULT;
+
+	tls_session->pkey.offload = unlang_offload_submit(tls_session, request, tls_pkey_op_run, op);
+	if (!tls_session->pkey.offload) {
+		RDEBUG3("Running private key operation in the worker");
+		tls_pkey_op_run(op);
+		return UNLANG_ACTION_CALCULATE_RESULT;
+	}
+	tls_session->pkey.op = NULL;
+
+	RDEBUG3("Waiting for private key operation to complete");
+
+	return UNLANG_ACTION_YIELD;
+}
+
+/** Stop waiting for an offloaded private key operation
+ *
+ * The paused key operation fails when the handshake is next resumed.
+ */
+void fr_tls_pkey_cancel(fr_tls_session_t *tls_session)
+{
+	if (!tls_session->pkey.offload) return;
+
+	/*
+	 *	Completed ops are ours again, so the key
+	 *	operation can free them.
+	 */
+	tls_session->pkey.op = unlang_offload_result(tls_session->pkey.offload);
+	TALLOC_FREE(tls_session->pkey.offload);
+}
+#else
+void fr_tls_pkey_free(void)
+{
+}
+
+int fr_tls_pkey_offload(UNUSED SSL_CTX *ctx)
+{
+	WARN("Offloading private key operations requires OpenSSL >= 3.0");
+
+	return 0;
+}
+
+void fr_tls_pkey_session_bind(UNUSED fr_tls_session_t *tls_session)
+{
+}
+
+void fr_tls_pkey_session_unbind(void)
+{
+}
+
+unlang_action_t fr_tls_pkey_pending_offload(UNUSED request_t *request, UNUSED fr_tls_session_t *tls_session)
+{
+	return UNLANG_ACTION_CALCULATE_RESULT;
+}
+
+void fr_tls_pkey_cancel(UNUSED fr_tls_session_t *tls_session)
+{
+}
+#endif
+#endif /* WITH_TLS */
@@ -0,0 +1,74 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifdef WITH_TLS
+/**
+ * $Id$
+ *
+ * @file lib/tls/pkey.h
+ * @brief Run private key operations in offload threads.
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+RCSIDH(pkey_h, "$Id$")
+
+#include <freeradius-devel/unlang/offload.h>
+
+#include <openssl/ssl.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct fr_tls_pkey_op_s fr_tls_pkey_op_t;
+
+/** Private key operation state
+ *
+ * This tracks a private key operation which OpenSSL has paused
+ * the handshake for, so that we can run it in an offload thread.
+ */
+typedef struct {
+	fr_tls_pkey_op_t	*op;			//!< Waiting to be offloaded, or completed.
+							///< NULL whilst an offload thread owns it.
+	unlang_offload_t	*offload;		//!< Handle for the op whilst it's offloaded.
+} fr_tls_pkey_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#include "session.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void		fr_tls_pkey_free(void);
+
+int		fr_tls_pkey_offload(SSL_CTX *ctx);
+
+void		fr_tls_pkey_session_bind(fr_tls_session_t *tls_session);
+
+void		fr_tls_pkey_session_unbind(void);
+
+unlang_action_t	fr_tls_pkey_pending_offload(request_t *request, fr_tls_session_t *tls_session);
+
+void		fr_tls_pkey_cancel(fr_tls_session_t *tls_session);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* WITH_TLS */
@@ -27,6 +27,7 @@
 #ifdef WITH_TLS
 #define LOG_PREFIX "tls"
 
+#include <freeradius-devel/server/command.h>
 #include <freeradius-devel/server/pair.h>
 
 #include <freeradius-devel/util/debug.h>
@@ -36,6 +37,7 @@
 
 #include <freeradius-devel/protocol/freeradius/freeradius.internal.h>
 
+#include <freeradius-devel/unlang/call.h>
 #include <freeradius-devel/unlang/interpret.h>
 
 #include <openssl/x509v3.h>
@@ -44,6 +46,7 @@
 #include <sys/stat.h>
 #include <ctype.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 #include "attrs.h"
 #include "base.h"
@@ -1126,6 +1129,125 @@ static void fr_tls_session_alert_send(request_t *request, fr_tls_session_t *sess
 	session_msg_log(request, session, session->dirty_out.data, session->dirty_out.used);
 }
 
+/** How long handshakes took to complete, for one virtual server
+ *
+ */
+typedef struct {
+	fr_rb_node_t		node;			//!< Entry in the handshake_stats tree.
+	char const		*server;		//!< Virtual server the handshakes were run by.
+	uint64_t		full;			//!< Number of full handshakes.
+	uint64_t		resumed;		//!< Number of resumed handshakes.
+	fr_time_elapsed_t	full_elapsed;		//!< Time from the first round to completion.
+	fr_time_elapsed_t	resumed_elapsed;	//!< Time from the first round to completion.
+} tls_session_handshake_stats_t;
+
+static pthread_mutex_t	handshake_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static fr_rb_tree_t	*handshake_stats;	//!< Protected by handshake_stats_mutex.
+
+static int8_t tls_session_handshake_stats_cmp(void const *one, void const *two)
+{
+	tls_session_handshake_stats_t const *a = one, *b = two;
+	int ret;
+
+	ret = strcmp(a->server, b->server);
+	return CMP(ret, 0);
+}
+
+/** Record how long a handshake took
+ *
+ * Handshakes are attributed to the virtual server which ran
+ * their first round, as resumption can depend on the server.
+ */
+static void tls_session_handshake_stats_update(request_t *request, fr_tls_session_t *tls_session)
+{
+	tls_session_handshake_stats_t	*stats, find;
+	CONF_SECTION			*server_cs;
+	fr_time_t			now = fr_time();
+
+	if (!fr_time_ispos(tls_session->handshake_start)) return;
+
+	server_cs = unlang_call_current(request);
+	find.server = server_cs ? cf_section_name2(server_cs) : NULL;
+	if (!find.server) find.server = "<none>";
+
+	pthread_mutex_lock(&handshake_stats_mutex);
+	if (!handshake_stats) {
+		MEM(handshake_stats = fr_rb_inline_talloc_alloc(NULL, tls_session_handshake_stats_t, node,
+								tls_session_handshake_stats_cmp, NULL));
+	}
+
+	stats = fr_rb_find(handshake_stats, &find);
+	if (!stats) {
+		MEM(stats = talloc_zero(handshake_stats, tls_session_handshake_stats_t));
+		MEM(stats->server = talloc_strdup(stats, find.server));
+		fr_rb_insert(handshake_stats, stats);
+	}
+
+	if (SSL_session_reused(tls_session->ssl)) {
+		stats->resumed++;
+		fr_time_elapsed_update(&stats->resumed_elapsed, tls_session->handshake_start, now);
+	} else {
+		stats->full++;
+		fr_time_elapsed_update(&stats->full_elapsed, tls_session->handshake_start, now);
+	}
+	pthread_mutex_unlock(&handshake_stats_mutex);
+
+	RDEBUG3("Handshake completed in %pVs", fr_box_time_delta(fr_time_sub(now, tls_session->handshake_start)));
+
+	tls_session->handshake_start = fr_time_wrap(0);
+}
+
+static int cmd_stats_tls(FILE *fp, UNUSED FILE *fp_err, UNUSED void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	pthread_mutex_lock(&handshake_stats_mutex);
+	if (handshake_stats) {
+		fr_rb_inorder_foreach(handshake_stats, tls_session_handshake_stats_t, stats) {
+			fprintf(fp, "server %s\n", stats->server);
+			fprintf(fp, "\tcount.full\t\t%" PRIu64 "\n", stats->full);
+			fprintf(fp, "\tcount.resumed\t\t%" PRIu64 "\n", stats->resumed);
+			fr_time_elapsed_fprint(fp, &stats->full_elapsed, "\ttime.full", 3);
+			fr_time_elapsed_fprint(fp, &stats->resumed_elapsed, "\ttime.resumed", 3);
+		}}
+	}
+	pthread_mutex_unlock(&handshake_stats_mutex);
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_table[] = {
+	{
+		.parent = "stats",
+		.name = "tls",
+		.func = cmd_stats_tls,
+		.help = "Show how long TLS handshakes took to complete, for each virtual server.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
+/** Register the TLS session radmin commands
+ *
+ * Must be called after radmin has started, otherwise the commands
+ * are registered with the no-op stub, and never show up.
+ */
+void fr_tls_session_init(void)
+{
+	if (fr_command_register_hook(NULL, NULL, NULL, cmd_table) < 0) {
+		PWARN("Failed registering TLS radmin commands");
+	}
+}
+
+/** Free the handshake statistics
+ *
+ */
+void fr_tls_session_free(void)
+{
+	pthread_mutex_lock(&handshake_stats_mutex);
+	TALLOC_FREE(handshake_stats);
+	pthread_mutex_unlock(&handshake_stats_mutex);
+}
+
 /** Finish off a handshake round, possibly adding attributes to the request
  *
  */
@@ -1233,6 +1355,8 @@ static unlang_action_t tls_session_async_handshake_done_round(UNUSED rlm_rcode_t
 			MEM(pair_update_request(&vp, attr_session_resumed) >= 0);
 			vp->vp_bool = true;
 		}
+
+		tls_session_handshake_stats_update(request, tls_session);
 	}
 
 	/*
@@ -1291,6 +1415,13 @@ static void tls_session_async_handshake_signal(UNUSED request_t *request, fr_sta
 
 	if (action != FR_SIGNAL_CANCEL) return;
 
+	/*
+	 *	Stop waiting for any offloaded private key
+	 *	operation.  It fails when the loop below
+	 *	resumes the handshake.
+	 */
+	fr_tls_pkey_cancel(tls_session);
+
 	/*
 	 *	If SSL_get_error returns SSL_ERROR_WANT_ASYNC
 	 *	it means we're yielded in the middle of a
@@ -1353,9 +1484,14 @@ static unlang_action_t tls_session_async_handshake_cont(rlm_rcode_t *p_result, i
 	 *
 	 *	If acting as a server SSL_set_accept_state must have
 	 *	been called before this function.
+	 *
+	 *	The session is bound so that private key operations
+	 *	can pause the handshake whilst they're offloaded.
 	 */
+	fr_tls_pkey_session_bind(tls_session);
 	tls_session->last_ret = SSL_read(tls_session->ssl, tls_session->clean_out.data + tls_session->clean_out.used,
 					 sizeof(tls_session->clean_out.data) - tls_session->clean_out.used);
+	fr_tls_pkey_session_unbind();
 	if (tls_session->last_ret > 0) {
 		tls_session->clean_out.used += tls_session->last_ret;
 
@@ -1413,7 +1549,7 @@ DIAG_ON(used-but-marked-unused)
 	 *	asynchronously.
 	 */
 	switch (err = SSL_get_error(tls_session->ssl, tls_session->last_ret)) {
-	case SSL_ERROR_WANT_ASYNC:	/* Certification validation or cache loads */
+	case SSL_ERROR_WANT_ASYNC:	/* Certification validation, cache loads, or private key operations */
 	{
 		unlang_action_t ua;
 
@@ -1445,6 +1581,14 @@ DIAG_ON(used-but-marked-unused)
 			break;
 		}
 
+		/*
+		 *	Next offload any pending private key
+		 *	operations.  We're called again once
+		 *	they've completed.
+		 */
+		ua = fr_tls_pkey_pending_offload(request, tls_session);
+		if (ua == UNLANG_ACTION_YIELD) return ua;
+
 		/*
 		 *	Next service any pending certificate
 		 *	validation actions.
@@ -1504,6 +1648,8 @@ static unlang_action_t tls_session_async_handshake(rlm_rcode_t *p_result, int *p
 
 	fr_tls_session_request_bind(tls_session->ssl, request);
 
+	if (!fr_time_ispos(tls_session->handshake_start)) tls_session->handshake_start = fr_time();
+
 	/*
 	 *	This is a logic error.  fr_tls_session_async_handshake
 	 *	must not be called if the handshake is
@@ -1573,6 +1719,13 @@ unlang_action_t fr_tls_session_async_handshake_push(request_t *request, fr_tls_s
  */
 static int _fr_tls_session_free(fr_tls_session_t *session)
 {
+	/*
+	 *	Free any private key operation the
+	 *	handshake was abandoned in the middle of.
+	 */
+	fr_tls_pkey_cancel(session);
+	TALLOC_FREE(session->pkey.op);
+
 	if (session->ssl) {
 		SSL_set_quiet_shutdown(session->ssl, 1);
 		SSL_shutdown(session->ssl);
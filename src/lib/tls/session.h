@@ -33,6 +33,7 @@ typedef struct fr_tls_session_s fr_tls_session_t;
 #include "cache.h"
 #include "conf.h"
 #include "index.h"
+#include "pkey.h"
 #include "verify.h"
 
 #ifdef __cplusplus
@@ -129,6 +130,10 @@ struct fr_tls_session_s {
 
 	fr_tls_verify_t		validate;			//!< Current session certificate validation state.
 
+	fr_tls_pkey_t		pkey;				//!< Current private key operation state.
+
+	fr_time_t		handshake_start;		//!< When the first round of the current handshake started.
+
 	bool			invalid;			//!< Whether heartbleed attack was detected.
 
 	bool			client_cert_ok;			//!< whether or not the client certificate was validated
@@ -297,6 +302,10 @@ int 		fr_tls_session_alert(request_t *request, fr_tls_session_t *tls_session, ui
 
 unlang_action_t	fr_tls_session_async_handshake_push(request_t *request, fr_tls_session_t *tls_session);
 
+void		fr_tls_session_init(void);
+
+void		fr_tls_session_free(void);
+
 fr_tls_session_t *fr_tls_session_alloc_client(TALLOC_CTX *ctx, SSL_CTX *ssl_ctx);
 
 fr_tls_session_t *fr_tls_session_alloc_server(TALLOC_CTX *ctx, SSL_CTX *ssl_ctx, request_t *request, bool client_cert);
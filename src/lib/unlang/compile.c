@@ -26,6 +26,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/modpriv.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/protocol/freeradius/freeradius.internal.h>
 
 #include "call_priv.h"
@@ -1990,6 +1991,25 @@ bool unlang_compile_actions(unlang_actions_t *actions, CONF_SECTION *action_cs,
 			continue;
 		}
 
+		/*
+		 *	Allow 'weight = <n>' for keyed load-balance sections.
+		 */
+		if (strcmp(name, "weight") == 0) {
+			char const	*value = cf_pair_value(cp);
+			char		*end;
+			unsigned long	weight;
+
+			weight = value ? strtoul(value, &end, 10) : 0;
+			if (!value || *end || !weight || (weight > 65535)) {
+				cf_log_err(csi, "Invalid weight '%s' - must be an integer from 1 to 65535",
+					   value ? value : "");
+				return false;
+			}
+
+			actions->weight = weight;
+			continue;
+		}
+
 		if (!compile_action_pair(actions, cp)) {
 			return false;
 		}
@@ -2080,6 +2100,36 @@ static unlang_t *compile_empty(unlang_t *parent, unlang_compile_t *unlang_ctx, C
 
 static unlang_t *compile_item(unlang_t *parent, unlang_compile_t *unlang_ctx, CONF_ITEM *ci);
 
+/** Whether the children of a section can have a "weight"
+ *
+ * Only keyed "load-balance" and "redundant-load-balance" sections use
+ * it.  Inside of the "modules" section the name is a module name, not
+ * a key.
+ */
+static bool compile_weight_allowed(unlang_t *parent)
+{
+	unlang_group_t	*g;
+	char const	*name1;
+
+	if (!parent) return false;
+
+	switch (parent->type) {
+	case UNLANG_TYPE_LOAD_BALANCE:
+	case UNLANG_TYPE_REDUNDANT_LOAD_BALANCE:
+		break;
+
+	default:
+		return false;
+	}
+
+	g = unlang_generic_to_group(parent);
+	if (!cf_section_name2(g->cs)) return false;
+
+	name1 = cf_section_name1(cf_item_to_section(cf_parent(g->cs)));
+
+	return (!name1 || (strcmp(name1, "modules") != 0));
+}
+
 /*
  *	compile 'actions { ... }' inside of another group.
  */
@@ -2125,7 +2175,19 @@ static bool compile_action_subsection(unlang_t *c, CONF_SECTION *cs, CONF_SECTIO
 		return false;
 	}
 
-	return unlang_compile_actions(&c->actions, subcs, false);
+	if (!unlang_compile_actions(&c->actions, subcs, false)) return false;
+
+	/*
+	 *	Children are checked when they're added to their
+	 *	parent.  Top level sections don't have one.
+	 */
+	if (c->actions.weight && !c->parent) {
+		cf_log_err(subcs, "'weight' is only allowed in the children of a keyed "
+			   "'load-balance' or 'redundant-load-balance' section");
+		return false;
+	}
+
+	return true;
 }
 
 
@@ -2281,6 +2343,17 @@ static unlang_t *compile_children(unlang_group_t *g, unlang_compile_t *unlang_ct
 	add_child:
 		if (single == UNLANG_IGNORE) continue;
 
+		/*
+		 *	The weight may have come from a reference's
+		 *	actions, or from an "actions" subsection.
+		 */
+		if (single->actions.weight && !compile_weight_allowed(c)) {
+			cf_log_err(ci, "'weight' is only allowed in the children of a keyed "
+				   "'load-balance' or 'redundant-load-balance' section");
+			talloc_free(c);
+			return NULL;
+		}
+
 		/*
 		 *	Do optimizations for "if" and "elsif"
 		 *	conditions.
@@ -3304,6 +3377,42 @@ static unlang_t *compile_load_balance_subsection(unlang_t *parent, unlang_compil
 		}
 	}
 
+	/*
+	 *	Keys which aren't integers are consistently hashed
+	 *	over the children.  The children are identified by
+	 *	name, so that adding or removing one doesn't change
+	 *	which of the others gets a key.
+	 */
+	if (name2) {
+		unlang_t	*child, *prev;
+		int		i, dup;
+		bool		weighted = false;
+
+		gext = unlang_group_to_load_balance(g);
+
+		MEM(gext->child_hash = talloc_array(gext, uint32_t, g->num_children));
+		MEM(gext->weight = talloc_array(gext, uint32_t, g->num_children));
+
+		for (child = g->children, i = 0; child != NULL; child = child->next, i++) {
+			gext->child_hash[i] = fr_hash_string(child->name);
+
+			/*
+			 *	Children with the same name, e.g. "group",
+			 *	are told apart by how many came before.
+			 */
+			dup = 0;
+			for (prev = g->children; prev != child; prev = prev->next) {
+				if (strcmp(prev->name, child->name) == 0) dup++;
+			}
+			if (dup) gext->child_hash[i] = fr_hash_update(&dup, sizeof(dup), gext->child_hash[i]);
+
+			gext->weight[i] = child->actions.weight ? child->actions.weight : 1;
+			if (gext->weight[i] != 1) weighted = true;
+		}
+
+		if (!weighted) TALLOC_FREE(gext->weight);
+	}
+
 	return c;
 }
 
@@ -4101,6 +4210,12 @@ static unlang_t *compile_item(unlang_t *parent, unlang_compile_t *unlang_ctx, CO
 			if (c == UNLANG_IGNORE) return UNLANG_IGNORE;
 
 			c->number = unlang_number++;
+
+			/*
+			 *	Only instructions with per-thread
+			 *	data need to be found again later.
+			 */
+			if (unlang_ops[c->type].thread_instantiate) fr_rb_insert(unlang_instruction_tree, c);
 			return c;
 		}
 
@@ -4369,7 +4484,11 @@ static int8_t instruction_cmp(void const *one, void const *two)
 
 void unlang_compile_init()
 {
-	unlang_instruction_tree = fr_rb_talloc_alloc(NULL, unlang_t, instruction_cmp, NULL);
+	/*
+	 *	The instructions are all of different talloc types,
+	 *	so we can't type-check them.
+	 */
+	unlang_instruction_tree = fr_rb_alloc(NULL, instruction_cmp, NULL);
 }
 
 void unlang_compile_free()
@@ -4423,6 +4542,23 @@ int unlang_thread_instantiate(TALLOC_CTX *ctx)
 	return 0;
 }
 
+/** Get the thread-specific data for an instruction
+ *
+ * @param[in] instruction	to find the data for.
+ * @return
+ *	- The data allocated by the op's thread_instantiate() callback.
+ *	- NULL if the current thread hasn't been instantiated, or the
+ *	  instruction doesn't have any thread-specific data.
+ */
+void *unlang_thread_instance(unlang_t const *instruction)
+{
+	if (!instruction->number || !unlang_thread_array) return NULL;
+
+	fr_assert(instruction->number <= unlang_number);
+
+	return unlang_thread_array[instruction->number].thread_inst;
+}
+
 #ifdef WITH_PERF
 void unlang_frame_perf_init(unlang_t const *instruction)
 {
@@ -36,6 +36,7 @@ extern "C" {
 typedef struct {
 	int			actions[RLM_MODULE_NUMCODES];
 	fr_retry_config_t	retry;
+	uint32_t		weight;				//!< relative weight in a keyed load-balance section.
 } unlang_actions_t;
 
 void		unlang_compile_init(void);
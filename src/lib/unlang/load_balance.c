@@ -22,14 +22,209 @@
  *
  * @copyright 2006-2019 The FreeRADIUS server project
  */
+#include <freeradius-devel/server/command.h>
 #include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/rand.h>
 
+#include <pthread.h>
+
 #include "load_balance_priv.h"
 #include "module_priv.h"
 
 #define unlang_redundant_load_balance unlang_load_balance
 
+/*
+ *	New latency samples are weighted 1/8 in the moving average.
+ */
+#define LOAD_BALANCE_EWMA_SHIFT		(3)
+
+/*
+ *	A child which fails is scored as if it had taken at least this
+ *	long.  Otherwise a child which fails quickly would look fast,
+ *	and would be picked more often.
+ */
+#define LOAD_BALANCE_FAIL_PENALTY	fr_time_delta_from_sec(1)
+
+/*
+ *	A child's latency is halved for every this long it goes without
+ *	being measured.  A child which was slow, or which failed, would
+ *	otherwise never be picked again, and so would never get the
+ *	chance to show that it has recovered.
+ */
+#define LOAD_BALANCE_DECAY		fr_time_delta_from_sec(1)
+
+/*
+ *	All of the per-thread load-balance data, sorted by instruction,
+ *	so that radmin can sum the statistics across threads.  The lock
+ *	only protects the list, and is only taken when threads start and
+ *	stop.
+ */
+static pthread_mutex_t		load_balance_threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+static fr_dlist_head_t		load_balance_threads;
+
+/** Return a child's latency, decayed by how long ago it was measured
+ *
+ */
+static inline int64_t load_balance_latency(unlang_load_balance_child_t const *lc, fr_time_t now)
+{
+	int64_t latency = fr_time_delta_unwrap(lc->latency);
+	int64_t halvings;
+
+	if (latency <= 0) return 0;
+
+	halvings = fr_time_delta_unwrap(fr_time_sub(now, lc->measured)) / fr_time_delta_unwrap(LOAD_BALANCE_DECAY);
+	if (halvings <= 0) return latency;
+	if (halvings >= 63) return 0;
+
+	return latency >> halvings;
+}
+
+/** Score a child, lower is better
+ *
+ * This is the expected time for a new request to finish, if it
+ * queues behind the ones which are already running.  Children which
+ * haven't been run yet score zero, so that they are tried.
+ */
+static inline uint64_t load_balance_score(unlang_load_balance_child_t const *lc, fr_time_t now)
+{
+	return (uint64_t) load_balance_latency(lc, now) * (lc->in_flight + 1);
+}
+
+/** Pick a child using the "power of two choices"
+ *
+ * Two different children are chosen at random from the ones which
+ * haven't been tried yet, and the one with the lower score wins.
+ *
+ * With only two children left, both are always chosen, so the one
+ * with the higher score is never picked until its latency has decayed
+ * below the other's.  The decay is what makes slow or failed children
+ * get picked, and measured, again.
+ *
+ * @param[in] redundant		frame state, with the thread data.
+ * @return
+ *	- The child to run.
+ *	- NULL if all of the children have been tried.
+ */
+static unlang_load_balance_child_t *load_balance_pick(unlang_frame_state_redundant_t *redundant)
+{
+	unlang_load_balance_thread_t	*t = redundant->t;
+	unlang_load_balance_child_t	*one = NULL, *two = NULL;
+	int				i, num = 0;
+	uint32_t			a, b;
+	fr_time_t			now;
+
+	for (i = 0; i < t->num_children; i++) {
+		if (!redundant->tried || !redundant->tried[i]) num++;
+	}
+
+	if (!num) return NULL;
+
+	a = fr_rand() % num;
+	if (num == 1) {
+		b = a;
+	} else {
+		b = fr_rand() % (num - 1);
+		if (b >= a) b++;
+	}
+
+	num = 0;
+	for (i = 0; i < t->num_children; i++) {
+		if (redundant->tried && redundant->tried[i]) continue;
+
+		if ((uint32_t) num == a) one = &t->children[i];
+		if ((uint32_t) num == b) two = &t->children[i];
+		num++;
+	}
+
+	fr_assert(one && two);
+
+	now = fr_time();
+
+	return (load_balance_score(two, now) < load_balance_score(one, now)) ? two : one;
+}
+
+/** Find the statistics for a child
+ *
+ */
+static unlang_load_balance_child_t *load_balance_child_find(unlang_load_balance_thread_t *t, unlang_t const *child)
+{
+	int i;
+
+	for (i = 0; i < t->num_children; i++) {
+		if (t->children[i].child == child) return &t->children[i];
+	}
+
+	return NULL;
+}
+
+/** Record that a child is about to run
+ *
+ */
+static void load_balance_child_start(unlang_frame_state_redundant_t *redundant, unlang_t const *child)
+{
+	unlang_load_balance_child_t *lc;
+
+	if (!redundant->t) return;
+
+	lc = load_balance_child_find(redundant->t, child);
+	if (!lc) return;
+
+	lc->in_flight++;
+	lc->selected++;
+
+	redundant->running = lc;
+	redundant->started = fr_time();
+
+	if (redundant->tried) redundant->tried[lc - redundant->t->children] = true;
+}
+
+/** Record that a child has finished, and update its latency
+ *
+ */
+static void load_balance_child_done(unlang_frame_state_redundant_t *redundant, rlm_rcode_t rcode)
+{
+	unlang_load_balance_child_t	*lc = redundant->running;
+	fr_time_delta_t			sample;
+	fr_time_t			now;
+	int64_t				ewma;
+
+	if (!lc) return;
+
+	now = fr_time();
+	sample = fr_time_sub(now, redundant->started);
+	if (rcode == RLM_MODULE_FAIL) {
+		lc->failed++;
+		if (fr_time_delta_lt(sample, LOAD_BALANCE_FAIL_PENALTY)) sample = LOAD_BALANCE_FAIL_PENALTY;
+	}
+
+	/*
+	 *	Start from the decayed latency, so that one fast
+	 *	sample after a long gap counts for more than 1/8th.
+	 */
+	ewma = load_balance_latency(lc, now);
+	if (!ewma) {
+		lc->latency = sample;
+	} else {
+		ewma += (fr_time_delta_unwrap(sample) - ewma) >> LOAD_BALANCE_EWMA_SHIFT;
+		lc->latency = fr_time_delta_wrap(ewma);
+	}
+	lc->measured = now;
+
+	fr_assert(lc->in_flight > 0);
+	lc->in_flight--;
+	redundant->running = NULL;
+}
+
+/** Don't leave a child marked as in flight if the request is cancelled
+ *
+ */
+static int _load_balance_state_free(unlang_frame_state_redundant_t *redundant)
+{
+	if (redundant->running) redundant->running->in_flight--;
+
+	return 0;
+}
+
 static unlang_action_t unlang_load_balance_next(rlm_rcode_t *p_result, request_t *request,
 						unlang_stack_frame_t *frame)
 {
@@ -49,6 +244,8 @@ static unlang_action_t unlang_load_balance_next(rlm_rcode_t *p_result, request_t
 		redundant->child = redundant->found;
 
 	} else {
+		load_balance_child_done(redundant, *p_result);
+
 		/*
 		 *	child is NULL on the first pass.  But if it's
 		 *	back to the found one, then we're done.
@@ -85,25 +282,48 @@ static unlang_action_t unlang_load_balance_next(rlm_rcode_t *p_result, request_t
 		*p_result = RLM_MODULE_FAIL;
 		return UNLANG_ACTION_STOP_PROCESSING;
 	}
+	load_balance_child_start(redundant, redundant->child);
 
 	/*
-	 *	Now that we've pushed this child, make the next call
-	 *	use the next child, wrapping around to the beginning.
+	 *	Now that we've pushed this child, decide which one to
+	 *	use if it fails.
 	 *
-	 *	@todo - track the one we chose, and if it fails, do
-	 *	the load-balancing again, except this time skipping
-	 *	the failed module.  AND, keep track of multiple failed
-	 *	modules in the unlang_frame_state_redundant_t
-	 *	structure.
+	 *	If we're tracking latency, do the load-balancing
+	 *	again, skipping the children we've already tried.
+	 *	Once they've all been tried, go back to "found",
+	 *	which tells the next call that we're done.
 	 */
-	redundant->child = redundant->child->next;
-	if (!redundant->child) redundant->child = g->children;
+	if (redundant->tried) {
+		unlang_load_balance_child_t *lc;
+
+		lc = load_balance_pick(redundant);
+		redundant->child = lc ? lc->child : redundant->found;
+
+	/*
+	 *	Otherwise use the next child, wrapping around to the
+	 *	beginning.
+	 */
+	} else {
+		redundant->child = redundant->child->next;
+		if (!redundant->child) redundant->child = g->children;
+	}
 
 	repeatable_set(frame);
 
 	return UNLANG_ACTION_PUSHED_CHILD;
 }
 
+static unlang_action_t unlang_load_balance_done(rlm_rcode_t *p_result, UNUSED request_t *request,
+						unlang_stack_frame_t *frame)
+{
+	unlang_frame_state_redundant_t	*redundant = talloc_get_type_abort(frame->state, unlang_frame_state_redundant_t);
+
+	load_balance_child_done(redundant, *p_result);
+
+	/* DON'T change p_result, as it is taken from the child */
+	return UNLANG_ACTION_CALCULATE_RESULT;
+}
+
 static unlang_action_t unlang_load_balance(rlm_rcode_t *p_result, request_t *request, unlang_stack_frame_t *frame)
 {
 	unlang_frame_state_redundant_t	*redundant;
@@ -124,6 +344,12 @@ static unlang_action_t unlang_load_balance(rlm_rcode_t *p_result, request_t *req
 	redundant = talloc_get_type_abort(frame->state,
 					  unlang_frame_state_redundant_t);
 
+	/*
+	 *	Only the worker threads have thread-specific data.
+	 */
+	redundant->t = unlang_thread_instance(frame->instruction);
+	if (redundant->t) talloc_set_destructor(redundant, _load_balance_state_free);
+
 	if (gext && gext->vpt) {
 		uint32_t hash, start;
 		ssize_t slen;
@@ -177,39 +403,52 @@ static unlang_action_t unlang_load_balance(rlm_rcode_t *p_result, request_t *req
 
 			hash = fr_hash(p, slen);
 
-			start = hash % g->num_children;;
+			/*
+			 *	Rendezvous hashing, so that adding or
+			 *	removing a child only moves the keys
+			 *	which it gets, or got.
+			 */
+			start = (uint32_t) fr_hash_rendezvous(hash, gext->child_hash, gext->weight, g->num_children);
 		}
 
 		RDEBUG3("load-balance starting at child %d", (int) start);
 
 		count = 0;
-		for (redundant->child = redundant->found = g->children;
-		     redundant->child != NULL;
-		     redundant->child = redundant->child->next) {
+		for (redundant->found = g->children;
+		     redundant->found->next && (count < start);
+		     redundant->found = redundant->found->next) {
 			count++;
-			if (count == start) {
-				redundant->found = redundant->child;
-				break;
-			}
 		}
 
+	} else if (redundant->t) {
+		unlang_load_balance_child_t *lc;
+
+		/*
+		 *	Pick the child which we expect to be fastest.
+		 *
+		 *	For "redundant-load-balance", keep track of
+		 *	which children we've tried, so that we skip
+		 *	them if we have to pick again.
+		 */
+		if (frame->instruction->type == UNLANG_TYPE_REDUNDANT_LOAD_BALANCE) {
+			MEM(redundant->tried = talloc_zero_array(redundant, bool, redundant->t->num_children));
+		}
+
+		lc = load_balance_pick(redundant);
+		fr_assert(lc != NULL);
+		redundant->found = lc->child;
+
+		RDEBUG3("load-balance chose %s (latency %pVs, in flight %u)", lc->child->debug_name,
+			fr_box_time_delta(lc->latency), lc->in_flight);
+
 	} else {
 	randomly_choose:
 		count = 0;
 
 		/*
-		 *	Choose a child at random.
-		 *
-		 *	@todo - leverage the "power of 2", as per
-		 *      lib/io/network.c.  This is good enough for
-		 *      most purposes.  However, in order to do this,
-		 *      we need to track active callers across
-		 *      *either* multiple modules in one thread, *or*
-		 *      across multiple threads.
-		 *
-		 *	We don't have thread-specific instance data
-		 *	for this load-balance section.  So for now,
-		 *	just pick a random child.
+		 *	Choose a child at random.  This is only done
+		 *	when we don't have thread-specific data, i.e.
+		 *	outside of the workers.
 		 */
 		for (redundant->child = redundant->found = g->children;
 		     redundant->child != NULL;
@@ -231,6 +470,15 @@ static unlang_action_t unlang_load_balance(rlm_rcode_t *p_result, request_t *req
 			*p_result = RLM_MODULE_FAIL;
 			return UNLANG_ACTION_STOP_PROCESSING;
 		}
+
+		/*
+		 *	Come back when the child is done, so that we
+		 *	can record how long it took.
+		 */
+		if (redundant->t) {
+			load_balance_child_start(redundant, redundant->found);
+			frame_repeat(frame, unlang_load_balance_done);
+		}
 		return UNLANG_ACTION_PUSHED_CHILD;
 	}
 
@@ -245,6 +493,113 @@ static unlang_action_t unlang_load_balance(rlm_rcode_t *p_result, request_t *req
 	return unlang_load_balance_next(p_result, request, frame);
 }
 
+static int _load_balance_thread_free(unlang_load_balance_thread_t *t)
+{
+	pthread_mutex_lock(&load_balance_threads_mutex);
+	fr_dlist_remove(&load_balance_threads, t);
+	pthread_mutex_unlock(&load_balance_threads_mutex);
+
+	return 0;
+}
+
+/** Create the per-thread statistics for a load-balance section
+ *
+ */
+static int unlang_load_balance_thread_instantiate(unlang_t const *instruction, void *thread_inst)
+{
+	unlang_group_t			*g = unlang_generic_to_group(instruction);
+	unlang_load_balance_thread_t	*t = thread_inst, *prev;
+	unlang_t			*child;
+	int				i;
+
+	t->instruction = instruction;
+	t->num_children = g->num_children;
+	MEM(t->children = talloc_zero_array(t, unlang_load_balance_child_t, t->num_children));
+
+	for (child = g->children, i = 0; child != NULL; child = child->next, i++) {
+		fr_assert(i < t->num_children);
+		t->children[i].child = child;
+	}
+
+	/*
+	 *	Keep the list sorted, so that each section's
+	 *	threads are next to each other.
+	 */
+	pthread_mutex_lock(&load_balance_threads_mutex);
+	for (prev = fr_dlist_tail(&load_balance_threads);
+	     prev && (prev->instruction->number > instruction->number);
+	     prev = fr_dlist_prev(&load_balance_threads, prev));
+	fr_dlist_insert_after(&load_balance_threads, prev, t);
+	pthread_mutex_unlock(&load_balance_threads_mutex);
+
+	talloc_set_destructor(t, _load_balance_thread_free);
+
+	return 0;
+}
+
+static int cmd_stats_load_balance(FILE *fp, UNUSED FILE *fp_err, UNUSED void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	unlang_load_balance_thread_t *t, *first;
+
+	pthread_mutex_lock(&load_balance_threads_mutex);
+	for (first = fr_dlist_head(&load_balance_threads);
+	     first != NULL;
+	     first = t) {
+		unlang_group_t	*g = unlang_generic_to_group(first->instruction);
+		int		i;
+
+		fprintf(fp, "%s\t%s[%d]\n", first->instruction->debug_name,
+			g->cs ? cf_filename(g->cs) : "", g->cs ? cf_lineno(g->cs) : 0);
+
+		/*
+		 *	Sum the statistics over all of the threads
+		 *	which are running this section.
+		 */
+		for (i = 0; i < first->num_children; i++) {
+			uint64_t	selected = 0, failed = 0, in_flight = 0;
+			int64_t		latency = 0;
+			int		sampled = 0;
+
+			for (t = first;
+			     t && (t->instruction == first->instruction);
+			     t = fr_dlist_next(&load_balance_threads, t)) {
+				unlang_load_balance_child_t const *lc = &t->children[i];
+
+				selected += lc->selected;
+				failed += lc->failed;
+				in_flight += lc->in_flight;
+				if (fr_time_delta_ispos(lc->latency)) {
+					latency += fr_time_delta_unwrap(lc->latency);
+					sampled++;
+				}
+			}
+
+			fprintf(fp, "\t%s\tselected=%" PRIu64 " failed=%" PRIu64 " in_flight=%" PRIu64 " latency=%.6f\n",
+				first->children[i].child->debug_name, selected, failed, in_flight,
+				sampled ? ((double) latency / sampled) / (double) NSEC : 0.0);
+		}
+
+		for (t = first;
+		     t && (t->instruction == first->instruction);
+		     t = fr_dlist_next(&load_balance_threads, t));
+	}
+	pthread_mutex_unlock(&load_balance_threads_mutex);
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_table[] = {
+	{
+		.parent = "stats",
+		.name = "load-balance",
+		.func = cmd_stats_load_balance,
+		.help = "Show how often each child of the load-balance sections was chosen, and how long it took.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
 void unlang_load_balance_init(void)
 {
 	unlang_register(UNLANG_TYPE_LOAD_BALANCE,
@@ -254,6 +609,9 @@ void unlang_load_balance_init(void)
 				.debug_braces = true,
 			        .frame_state_size = sizeof(unlang_frame_state_redundant_t),
 				.frame_state_type = "unlang_frame_state_redundant_t",
+				.thread_instantiate = unlang_load_balance_thread_instantiate,
+				.thread_inst_size = sizeof(unlang_load_balance_thread_t),
+				.thread_inst_type = "unlang_load_balance_thread_t",
 			   });
 
 	unlang_register(UNLANG_TYPE_REDUNDANT_LOAD_BALANCE,
@@ -263,5 +621,14 @@ void unlang_load_balance_init(void)
 				.debug_braces = true,
 			        .frame_state_size = sizeof(unlang_frame_state_redundant_t),
 				.frame_state_type = "unlang_frame_state_redundant_t",
+				.thread_instantiate = unlang_load_balance_thread_instantiate,
+				.thread_inst_size = sizeof(unlang_load_balance_thread_t),
+				.thread_inst_type = "unlang_load_balance_thread_t",
 			   });
+
+	fr_dlist_talloc_init(&load_balance_threads, unlang_load_balance_thread_t, entry);
+
+	if (fr_command_register_hook(NULL, NULL, NULL, cmd_table) < 0) {
+		PWARN("Failed registering load-balance radmin commands");
+	}
 }
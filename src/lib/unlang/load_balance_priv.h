@@ -32,14 +32,46 @@ extern "C" {
 typedef struct {
 	unlang_group_t	group;
 	tmpl_t		*vpt;
+	uint32_t	*child_hash;		//!< hash of each child's name, for rendezvous hashing.
+	uint32_t	*weight;		//!< of each child, or NULL if they're all the same.
 } unlang_load_balance_t;
 
+/** Per-thread statistics for one child of a load-balance section
+ *
+ * These are only ever touched by the thread which owns them, so
+ * they don't need locks.  radmin reads them without locks, in
+ * the same way as it reads the worker statistics.
+ */
+typedef struct {
+	unlang_t		*child;				//!< which this entry is for.
+	fr_time_delta_t		latency;			//!< EWMA of how long the child takes to run.
+	fr_time_t		measured;			//!< when latency was last updated.
+	uint32_t		in_flight;			//!< requests currently running the child.
+	uint64_t		selected;			//!< how many times the child was chosen.
+	uint64_t		failed;				//!< how many times the child returned "fail".
+} unlang_load_balance_child_t;
+
+/** Per-thread data for a load-balance section
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;				//!< in the list of all load-balance threads.
+	unlang_t const		*instruction;			//!< which this data is for.
+	int			num_children;
+	unlang_load_balance_child_t *children;			//!< array, in the same order as the children.
+} unlang_load_balance_thread_t;
+
 /** State of a redundant operation
  *
  */
 typedef struct {
 	unlang_t 		*child;
 	unlang_t		*found;
+
+	unlang_load_balance_thread_t *t;			//!< thread-specific data, if any.
+	unlang_load_balance_child_t *running;			//!< statistics of the child we're running.
+	fr_time_t		started;			//!< when the child was pushed.
+	bool			*tried;				//!< children which have already been run.
 } unlang_frame_state_redundant_t;
 
 /** Cast a group structure to the load_balance keyword extension
@@ -0,0 +1,179 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for choosing load-balance children by latency
+ *
+ * @file src/lib/unlang/load_balance_tests.c
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+static void test_init(void);
+#define TEST_INIT  test_init()
+
+#include <freeradius-devel/util/acutest.h>
+
+#include "load_balance.c"
+
+static void test_init(void)
+{
+	fr_time_start();
+}
+
+/** Two children, "fast" has just been measured, "slow" was penalised for failing
+ *
+ */
+typedef struct {
+	unlang_t			child[2];
+	unlang_load_balance_child_t	lc[2];
+	unlang_load_balance_thread_t	t;
+	unlang_frame_state_redundant_t	redundant;
+} load_balance_test_t;
+
+static void load_balance_test_init(load_balance_test_t *test, fr_time_t now)
+{
+	memset(test, 0, sizeof(*test));
+
+	test->lc[0] = (unlang_load_balance_child_t) {
+		.child = &test->child[0],
+		.latency = fr_time_delta_from_msec(1),
+		.measured = now
+	};
+	test->lc[1] = (unlang_load_balance_child_t) {
+		.child = &test->child[1],
+		.latency = LOAD_BALANCE_FAIL_PENALTY,
+		.measured = now,
+		.failed = 1
+	};
+
+	test->t.num_children = 2;
+	test->t.children = test->lc;
+	test->redundant.t = &test->t;
+}
+
+/** Count how many times each child is picked
+ *
+ */
+static void load_balance_test_pick(load_balance_test_t *test, unsigned int picked[2], unsigned int rounds)
+{
+	unsigned int i;
+
+	picked[0] = picked[1] = 0;
+
+	for (i = 0; i < rounds; i++) {
+		unlang_load_balance_child_t *lc = load_balance_pick(&test->redundant);
+
+		TEST_ASSERT(lc != NULL);
+		picked[lc - test->lc]++;
+	}
+}
+
+/** While both measurements are fresh, the faster child always wins
+ *
+ */
+static void test_pick_fresh(void)
+{
+	load_balance_test_t	test;
+	unsigned int		picked[2];
+
+	load_balance_test_init(&test, fr_time());
+	load_balance_test_pick(&test, picked, 100);
+
+	TEST_CHECK(picked[0] == 100);
+	TEST_MSG("Expected the fast child to be picked 100 times, got %u", picked[0]);
+}
+
+/** Once the penalty has decayed, the penalised child is picked again
+ *
+ */
+static void test_pick_penalty_decays(void)
+{
+	load_balance_test_t	test;
+	unsigned int		picked[2];
+	fr_time_t		now = fr_time();
+
+	load_balance_test_init(&test, now);
+
+	/*
+	 *	Pretend nothing has run either child for a while.
+	 *	1s >> 12 is less than 1ms >> 2.
+	 */
+	test.lc[0].measured = fr_time_sub(now, fr_time_delta_from_sec(2));
+	test.lc[1].measured = fr_time_sub(now, fr_time_delta_from_sec(12));
+
+	load_balance_test_pick(&test, picked, 100);
+
+	TEST_CHECK(picked[1] == 100);
+	TEST_MSG("Expected the penalised child to be picked 100 times, got %u", picked[1]);
+}
+
+/** A fast result after the penalty has decayed replaces the old latency
+ *
+ */
+static void test_penalised_child_recovers(void)
+{
+	load_balance_test_t	test;
+	unsigned int		picked[2];
+	fr_time_t		now = fr_time();
+
+	load_balance_test_init(&test, now);
+	test.lc[1].measured = fr_time_sub(now, fr_time_delta_from_sec(70));
+
+	/*
+	 *	Run the penalised child, which succeeds quickly.
+	 */
+	test.lc[1].in_flight = 1;
+	test.redundant.running = &test.lc[1];
+	test.redundant.started = fr_time_sub(now, fr_time_delta_from_usec(100));
+	load_balance_child_done(&test.redundant, RLM_MODULE_OK);
+
+	TEST_CHECK(test.lc[1].in_flight == 0);
+	TEST_CHECK(fr_time_delta_lt(test.lc[1].latency, fr_time_delta_from_msec(1)));
+	TEST_MSG("Expected latency < 1ms, got %" PRId64 "ns", fr_time_delta_unwrap(test.lc[1].latency));
+
+	load_balance_test_pick(&test, picked, 100);
+
+	TEST_CHECK(picked[1] == 100);
+	TEST_MSG("Expected the recovered child to be picked 100 times, got %u", picked[1]);
+}
+
+/** A child which fails is penalised, however quickly it failed
+ *
+ */
+static void test_fail_penalty(void)
+{
+	load_balance_test_t	test;
+	fr_time_t		now = fr_time();
+
+	load_balance_test_init(&test, now);
+
+	test.lc[0].in_flight = 1;
+	test.redundant.running = &test.lc[0];
+	test.redundant.started = now;
+	load_balance_child_done(&test.redundant, RLM_MODULE_FAIL);
+
+	TEST_CHECK(test.lc[0].failed == 1);
+	TEST_CHECK(fr_time_delta_gt(test.lc[0].latency, fr_time_delta_from_msec(100)));
+	TEST_MSG("Expected latency > 100ms, got %" PRId64 "ns", fr_time_delta_unwrap(test.lc[0].latency));
+}
+
+TEST_LIST = {
+	{ "pick_fresh",			test_pick_fresh },
+	{ "pick_penalty_decays",	test_pick_penalty_decays },
+	{ "penalised_child_recovers",	test_penalised_child_recovers },
+	{ "fail_penalty",		test_fail_penalty },
+
+	{ NULL }
+};
@@ -0,0 +1,590 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file unlang/offload.c
+ * @brief Run CPU-heavy work in a pool of threads, while the request yields.
+ *
+ * Some work, such as hashing passwords with many iterations of PBKDF2,
+ * takes long enough that doing it in the worker delays every other
+ * request the worker has.  Modules can instead hand the work to a
+ * small pool of offload threads, and yield.
+ *
+ * When a job is finished, the offload thread writes a pointer to it
+ * down a pipe owned by the worker which submitted it.  The worker reads
+ * the pipe from its event loop, and marks the request as runnable.
+ *
+ * If the pool isn't configured, or its queue is full, the work is done
+ * in the worker, exactly as if it had been called directly.
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/io/schedule.h>
+#include <freeradius-devel/server/command.h>
+#include <freeradius-devel/unlang/interpret.h>
+#include <freeradius-devel/unlang/offload.h>
+
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+typedef struct unlang_offload_thread_s unlang_offload_thread_t;
+
+/** A piece of work, owned by nobody but itself whilst it's in flight
+ *
+ * The job is allocated in the NULL ctx, so that it can outlive the
+ * request if the request is cancelled whilst an offload thread is
+ * still working on it.
+ */
+typedef struct {
+	unlang_offload_func_t	func;			//!< To call in the offload thread.
+	void			*rctx;			//!< Stolen from the module whilst the job is in flight.
+	TALLOC_CTX		*rctx_parent;		//!< To give rctx back to when the job is done.
+
+	unlang_offload_thread_t	*thread;		//!< Worker which submitted the job.
+	request_t		*request;		//!< Waiting for the job.
+	unlang_offload_t	*offload;		//!< Yield state in the request.
+	bool			cancelled;		//!< The request no longer cares about the result.
+
+	fr_time_t		queued;			//!< When the job was submitted.
+	fr_dlist_t		entry;			//!< Entry in the pool's queue.
+} unlang_offload_job_t;
+
+/** Yield state, allocated in the request, or in the caller's ctx
+ *
+ */
+struct unlang_offload_s {
+	unlang_offload_job_t	*job;			//!< NULL once the job has completed.
+	unlang_module_resume_t	resume;			//!< Module's resume function.
+	void			*rctx;			//!< Caller's rctx, given back when the job completes.
+};
+
+/** Per-worker state
+ *
+ * Allocated in the worker's event list, so it's cleaned up along with it.
+ */
+struct unlang_offload_thread_s {
+	fr_event_list_t		*el;			//!< The pipe is registered with.
+	int			pipe[2];		//!< Completed jobs are written to pipe[1].
+	atomic_uint_fast32_t	outstanding;		//!< Jobs which haven't been written back yet.
+};
+
+typedef struct {
+	pthread_mutex_t		mutex;			//!< Protects everything below.
+	pthread_cond_t		cond;			//!< Signalled when jobs are added, or on exit.
+	fr_dlist_head_t		queue;			//!< Jobs waiting for an offload thread.
+	uint32_t		max_queued;		//!< Above this, work is done in the worker.
+	bool			stop;			//!< Tell the offload threads to exit.
+
+	pthread_t		*threads;
+	uint32_t		num_threads;		//!< Number which were started.
+
+	uint32_t		active;			//!< Jobs being run right now.
+	uint64_t		offloaded;		//!< Jobs given to the offload threads.
+	uint64_t		ran_inline;		//!< Jobs run in the worker, because the queue was full.
+	uint64_t		cancelled;		//!< Jobs whose request went away.
+	fr_time_elapsed_t	wait;			//!< How long jobs sat in the queue.
+	fr_time_elapsed_t	run;			//!< How long jobs took to run.
+} unlang_offload_pool_t;
+
+static unlang_offload_pool_t *offload_pool;
+
+static _Thread_local unlang_offload_thread_t *offload_thread;
+
+/** Hand a completed job back to its request
+ *
+ * @param[in] job	which has completed.
+ * @param[in] discard	don't resume the request, the worker is exiting.
+ */
+static void offload_job_done(unlang_offload_job_t *job, bool discard)
+{
+	unlang_offload_t	*offload;
+	request_t		*request = job->request;
+
+	/*
+	 *	If we're discarding jobs, the worker has already
+	 *	freed its requests, so don't touch them.
+	 */
+	if (job->cancelled || discard) {
+		talloc_free(job);
+		return;
+	}
+
+	offload = job->offload;
+	offload->job = NULL;
+	offload->rctx = talloc_steal(job->rctx_parent, job->rctx);
+	talloc_free(job);
+
+	unlang_interpret_mark_runnable(request);
+}
+
+/** Read completed jobs from the pipe
+ *
+ */
+static void offload_thread_drain(unlang_offload_thread_t *thread, bool discard)
+{
+	unlang_offload_job_t	*jobs[64];
+	ssize_t			len;
+	size_t			i;
+
+	for (;;) {
+		len = read(thread->pipe[0], jobs, sizeof(jobs));
+		if (len < 0) {
+			if (errno == EINTR) continue;
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+				ERROR("offload - Failed reading from completion pipe: %s", fr_syserror(errno));
+			}
+			return;
+		}
+
+		/*
+		 *	Each job pointer is written atomically, so we
+		 *	never see part of one.
+		 */
+		for (i = 0; i < ((size_t)len / sizeof(jobs[0])); i++) offload_job_done(jobs[i], discard);
+
+		if ((size_t)len < sizeof(jobs)) return;
+	}
+}
+
+static void _offload_pipe_read(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	offload_thread_drain(talloc_get_type_abort(uctx, unlang_offload_thread_t), false);
+}
+
+static void _offload_pipe_error(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, int fd_errno, UNUSED void *uctx)
+{
+	ERROR("offload - Completion pipe (%i) failed: %s", fd, fr_syserror(fd_errno));
+}
+
+static int _offload_thread_free(unlang_offload_thread_t *thread)
+{
+	struct timespec ts = { .tv_sec = 0, .tv_nsec = 1000000 };
+
+	/*
+	 *	Offload threads may still be working on jobs for
+	 *	this worker.  Wait for them, emptying the pipe as
+	 *	we go so that they don't block writing to it.
+	 */
+	for (;;) {
+		offload_thread_drain(thread, true);
+		if (atomic_load(&thread->outstanding) == 0) break;
+		nanosleep(&ts, NULL);
+	}
+	offload_thread_drain(thread, true);
+
+	(void) fr_event_fd_delete(thread->el, thread->pipe[0], FR_EVENT_FILTER_IO);
+	close(thread->pipe[0]);
+	close(thread->pipe[1]);
+
+	if (offload_thread == thread) offload_thread = NULL;
+
+	return 0;
+}
+
+/** Find or create the completion pipe for this worker
+ *
+ * @return
+ *	- The per-worker state.
+ *	- NULL if jobs from this request can't be offloaded.
+ */
+static unlang_offload_thread_t *offload_thread_get(request_t *request)
+{
+	unlang_offload_thread_t	*thread;
+	fr_event_list_t		*el;
+
+	if (!offload_pool) return NULL;
+
+	el = unlang_interpret_event_list(request);
+	if (!el) return NULL;
+
+	if (offload_thread) {
+		/*
+		 *	Requests run by a temporary interpreter,
+		 *	such as the synchronous one, don't get to
+		 *	use the pool.
+		 */
+		if (offload_thread->el != el) return NULL;
+
+		return offload_thread;
+	}
+
+	MEM(thread = talloc_zero(el, unlang_offload_thread_t));
+	thread->el = el;
+	thread->pipe[0] = thread->pipe[1] = -1;
+	atomic_init(&thread->outstanding, 0);
+
+	if (pipe(thread->pipe) < 0) {
+		RERROR("Failed creating offload completion pipe: %s", fr_syserror(errno));
+	error:
+		if (thread->pipe[0] >= 0) close(thread->pipe[0]);
+		if (thread->pipe[1] >= 0) close(thread->pipe[1]);
+		talloc_free(thread);
+		return NULL;
+	}
+
+	if (fr_nonblock(thread->pipe[0]) < 0) {
+		RPERROR("Failed setting offload completion pipe to non-blocking");
+		goto error;
+	}
+
+	if (fr_event_fd_insert(el, el, thread->pipe[0],
+			       _offload_pipe_read, NULL, _offload_pipe_error, thread) < 0) {
+		RPERROR("Failed listening on offload completion pipe");
+		goto error;
+	}
+
+	talloc_set_destructor(thread, _offload_thread_free);
+	offload_thread = thread;
+
+	return thread;
+}
+
+static void *offload_thread_main(void *arg)
+{
+	unlang_offload_pool_t	*pool = arg;
+	unlang_offload_job_t	*job;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		unlang_offload_thread_t	*thread;
+		fr_time_t		started, finished;
+		ssize_t			len;
+
+		while (!(job = fr_dlist_head(&pool->queue)) && !pool->stop) pthread_cond_wait(&pool->cond, &pool->mutex);
+		if (!job) break;
+
+		fr_dlist_remove(&pool->queue, job);
+		pool->active++;
+		started = fr_time();
+		fr_time_elapsed_update(&pool->wait, job->queued, started);
+		pthread_mutex_unlock(&pool->mutex);
+
+		job->func(job->rctx);
+		finished = fr_time();
+
+		/*
+		 *	Once the pointer is written, the worker may
+		 *	free the job at any time.  Once outstanding is
+		 *	decremented, it may free its own state.
+		 */
+		thread = job->thread;
+		do {
+			len = write(thread->pipe[1], &job, sizeof(job));
+		} while ((len < 0) && (errno == EINTR));
+		if (len < 0) ERROR("offload - Failed writing to completion pipe: %s", fr_syserror(errno));
+		atomic_fetch_sub(&thread->outstanding, 1);
+
+		pthread_mutex_lock(&pool->mutex);
+		pool->active--;
+		fr_time_elapsed_update(&pool->run, started, finished);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+/** Give the module back its rctx, and call its resume function
+ *
+ */
+static unlang_action_t offload_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	unlang_offload_t	*offload = talloc_get_type_abort(mctx->rctx, unlang_offload_t);
+	unlang_module_resume_t	resume = offload->resume;
+	void			*rctx = offload->rctx;
+
+	fr_assert(!offload->job);
+	talloc_free(offload);
+
+	return resume(p_result, MODULE_CTX(mctx->inst, mctx->thread, rctx), request);
+}
+
+/** Stop waiting for a job
+ *
+ * Jobs which haven't started are removed from the queue.  Jobs which
+ * have started are left to finish, and are freed when they're written
+ * back to the worker.
+ */
+static void offload_cancel(unlang_offload_t *offload)
+{
+	unlang_offload_job_t	*job = offload->job;
+
+	if (!job) return;
+
+	offload->job = NULL;
+
+	pthread_mutex_lock(&offload_pool->mutex);
+	offload_pool->cancelled++;
+	if (fr_dlist_entry_in_list(&job->entry)) {
+		fr_dlist_remove(&offload_pool->queue, job);
+		pthread_mutex_unlock(&offload_pool->mutex);
+
+		atomic_fetch_sub(&job->thread->outstanding, 1);
+		talloc_free(job);
+		return;
+	}
+	job->cancelled = true;
+	pthread_mutex_unlock(&offload_pool->mutex);
+}
+
+static void offload_signal(module_ctx_t const *mctx, UNUSED request_t *request, fr_state_signal_t action)
+{
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	offload_cancel(talloc_get_type_abort(mctx->rctx, unlang_offload_t));
+}
+
+/** Make sure the job doesn't point at a request which has been freed
+ *
+ */
+static int _offload_free(unlang_offload_t *offload)
+{
+	offload_cancel(offload);
+
+	return 0;
+}
+
+/** Run CPU-heavy work in an offload thread, and mark the request runnable when it's done
+ *
+ * This is for callers which manage their own yield, such as function
+ * frames.  The caller should yield after this returns a handle, and
+ * call #unlang_offload_result when it's resumed.
+ *
+ * Whilst the job is in flight, rctx is stolen into the job.  Freeing
+ * the handle before the job completes cancels the job, and rctx is then
+ * freed along with it.
+ *
+ * @param[in] ctx		to allocate the handle in.
+ * @param[in] request		to mark runnable when the job completes.
+ * @param[in] func		to call in the offload thread.
+ * @param[in] rctx		passed to func.  Must be a talloc chunk.
+ * @return
+ *	- A handle for the job.
+ *	- NULL if the work can't be offloaded.  The caller should call
+ *	  func itself.
+ */
+unlang_offload_t *unlang_offload_submit(TALLOC_CTX *ctx, request_t *request,
+					unlang_offload_func_t func, void *rctx)
+{
+	unlang_offload_thread_t	*thread;
+	unlang_offload_job_t	*job;
+	unlang_offload_t	*offload;
+
+	thread = offload_thread_get(request);
+	if (!thread) return NULL;
+
+	MEM(offload = talloc_zero(ctx, unlang_offload_t));
+	MEM(job = talloc_zero(NULL, unlang_offload_job_t));
+
+	pthread_mutex_lock(&offload_pool->mutex);
+	if (fr_dlist_num_elements(&offload_pool->queue) >= offload_pool->max_queued) {
+		offload_pool->ran_inline++;
+		pthread_mutex_unlock(&offload_pool->mutex);
+
+		RDEBUG3("Offload queue is full, running job in the worker");
+		talloc_free(job);
+		talloc_free(offload);
+		return NULL;
+	}
+
+	job->func = func;
+	job->rctx_parent = talloc_parent(rctx);
+	job->rctx = talloc_steal(job, rctx);
+	job->thread = thread;
+	job->request = request;
+	job->offload = offload;
+	job->queued = fr_time();
+
+	offload->job = job;
+	talloc_set_destructor(offload, _offload_free);
+
+	atomic_fetch_add(&thread->outstanding, 1);
+	fr_dlist_insert_tail(&offload_pool->queue, job);
+	offload_pool->offloaded++;
+	pthread_cond_signal(&offload_pool->cond);
+	pthread_mutex_unlock(&offload_pool->mutex);
+
+	RDEBUG3("Offloaded job, waiting for it to complete");
+
+	return offload;
+}
+
+/** Return the rctx of a completed job
+ *
+ * @param[in] offload	handle returned by #unlang_offload_submit.
+ * @return
+ *	- The rctx passed to #unlang_offload_submit, back in its original ctx.
+ *	- NULL if the job hasn't completed.
+ */
+void *unlang_offload_result(unlang_offload_t const *offload)
+{
+	if (offload->job) return NULL;
+
+	return offload->rctx;
+}
+
+/** Run CPU-heavy work in an offload thread, and resume the module when it's done
+ *
+ * Whilst the job is in flight, rctx is stolen into the job, so that it
+ * isn't freed from under the offload thread if the request is cancelled.
+ * It's given back to its original parent before resume is called.
+ *
+ * If the work can't be offloaded (no offload threads are configured,
+ * or the queue is full), func is called immediately in the worker, and
+ * this function returns whatever resume does.
+ *
+ * @param[out] p_result		passed to resume if the work is done immediately.
+ * @param[in] mctx		of the module calling us.
+ * @param[in] request		the current request.
+ * @param[in] func		to call in the offload thread.
+ * @param[in] resume		called in the worker when func has returned.
+ * @param[in] rctx		passed to func, and to resume (as mctx->rctx).
+ *				Must be a talloc chunk.
+ * @return
+ *	- UNLANG_ACTION_YIELD if the work was offloaded.
+ *	- Whatever resume returns, if the work was done immediately.
+ */
+unlang_action_t unlang_module_yield_to_offload(rlm_rcode_t *p_result, module_ctx_t const *mctx,
+					       request_t *request, unlang_offload_func_t func,
+					       unlang_module_resume_t resume, void *rctx)
+{
+	unlang_offload_t	*offload;
+
+	offload = unlang_offload_submit(request, request, func, rctx);
+	if (offload) {
+		offload->resume = resume;
+		return unlang_module_yield(request, offload_resume, offload_signal, offload);
+	}
+
+	func(rctx);
+
+	return resume(p_result, MODULE_CTX(mctx->inst, mctx->thread, rctx), request);
+}
+
+static int cmd_stats_offload(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	unlang_offload_pool_t *pool = ctx;
+
+	pthread_mutex_lock(&pool->mutex);
+	fprintf(fp, "threads\t\t\t%u\n", pool->num_threads);
+	fprintf(fp, "count.queued\t\t%u\n", fr_dlist_num_elements(&pool->queue));
+	fprintf(fp, "count.active\t\t%u\n", pool->active);
+	fprintf(fp, "count.offloaded\t\t%" PRIu64 "\n", pool->offloaded);
+	fprintf(fp, "count.inline\t\t%" PRIu64 "\n", pool->ran_inline);
+	fprintf(fp, "count.cancelled\t\t%" PRIu64 "\n", pool->cancelled);
+	fr_time_elapsed_fprint(fp, &pool->wait, "time.queued", 3);
+	fr_time_elapsed_fprint(fp, &pool->run, "time.run", 3);
+	pthread_mutex_unlock(&pool->mutex);
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_table[] = {
+	{
+		.parent = "stats",
+		.name = "offload",
+		.func = cmd_stats_offload,
+		.help = "Show how long offloaded jobs spent queued, and running.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
+/** Start the offload threads
+ *
+ * @param[in] num_threads	to start.  If 0, all work is done in the workers.
+ * @param[in] max_queued	jobs waiting for an offload thread.  Any more
+ *				are run in the worker which submitted them.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+int unlang_offload_init(uint32_t num_threads, uint32_t max_queued)
+{
+	unlang_offload_pool_t	*pool;
+	uint32_t		i;
+
+	if (!num_threads || offload_pool) return 0;
+
+	MEM(pool = talloc_zero(NULL, unlang_offload_pool_t));
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	fr_dlist_talloc_init(&pool->queue, unlang_offload_job_t, entry);
+	pool->max_queued = max_queued;
+	MEM(pool->threads = talloc_zero_array(pool, pthread_t, num_threads));
+
+	offload_pool = pool;
+
+	for (i = 0; i < num_threads; i++) {
+		if (fr_schedule_pthread_create(&pool->threads[i], offload_thread_main, pool) < 0) {
+			fr_strerror_const_push("Failed creating offload thread");
+			unlang_offload_free();
+			return -1;
+		}
+		pool->num_threads++;
+	}
+
+	if (fr_command_register_hook(NULL, NULL, pool, cmd_table) < 0) {
+		PWARN("Failed registering offload radmin commands");
+	}
+
+	DEBUG("Started %u offload thread(s)", num_threads);
+
+	return 0;
+}
+
+/** Stop the offload threads
+ *
+ * Must be called after the workers have exited.
+ */
+void unlang_offload_free(void)
+{
+	unlang_offload_pool_t	*pool = offload_pool;
+	uint32_t		i;
+
+	if (!pool) return;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->num_threads; i++) pthread_join(pool->threads[i], NULL);
+
+	fr_assert(fr_dlist_num_elements(&pool->queue) == 0);
+
+	offload_pool = NULL;
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+	talloc_free(pool);
+}
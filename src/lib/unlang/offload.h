@@ -0,0 +1,61 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/**
+ * $Id$
+ *
+ * @file unlang/offload.h
+ * @brief Run CPU-heavy work in a pool of threads, while the request yields.
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/server/module_ctx.h>
+#include <freeradius-devel/server/request.h>
+#include <freeradius-devel/unlang/module.h>
+
+/** Do CPU-heavy work outside of the worker
+ *
+ * This runs in an offload thread.  It must not access the request,
+ * log via the request, or allocate memory from any talloc context
+ * other than rctx.
+ *
+ * @param[in] rctx	passed to unlang_module_yield_to_offload().
+ */
+typedef void (*unlang_offload_func_t)(void *rctx);
+
+typedef struct unlang_offload_s unlang_offload_t;
+
+int		unlang_offload_init(uint32_t num_threads, uint32_t max_queued);
+
+void		unlang_offload_free(void);
+
+unlang_offload_t *unlang_offload_submit(TALLOC_CTX *ctx, request_t *request,
+					unlang_offload_func_t func, void *rctx);
+
+void		*unlang_offload_result(unlang_offload_t const *offload);
+
+unlang_action_t	unlang_module_yield_to_offload(rlm_rcode_t *p_result, module_ctx_t const *mctx,
+					       request_t *request, unlang_offload_func_t func,
+					       unlang_module_resume_t resume, void *rctx);
+
+#ifdef __cplusplus
+}
+#endif
@@ -238,6 +238,8 @@ typedef struct {
 #endif
 } unlang_thread_t;
 
+void		*unlang_thread_instance(unlang_t const *instruction);
+
 #ifdef WITH_PERF
 void		unlang_frame_perf_init(unlang_t const *instruction);
 
@@ -3,17 +3,22 @@ SUBMAKEFILES := \
 	cursor_tests.mk \
 	dbuff_tests.mk \
 	dcursor_tests.mk \
+	dict_cache_tests.mk \
 	dlist_tests.mk \
 	edit_tests.mk \
+	event_tests.mk \
+	hash_tests.mk \
 	heap_tests.mk \
 	hmac_tests.mk \
 	libfreeradius-util.mk \
 	lst_tests.mk \
+	md5_tests.mk \
 	minmax_heap_tests.mk \
 	pair_legacy_tests.mk \
 	pair_list_perf_test.mk \
 	pair_tests.mk \
 	rb_tests.mk \
+	rcu_tests.mk \
 	sbuff_tests.mk \
 	strerror_tests.mk
 
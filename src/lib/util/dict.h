@@ -622,12 +622,16 @@ int			fr_dict_global_ctx_free(fr_dict_gctx_t const *gctx);
 
 int			fr_dict_global_ctx_dir_set(char const *dict_dir);
 
+int			fr_dict_global_ctx_cache_dir_set(char const *cache_dir);
+
 void			fr_dict_global_ctx_read_only(void);
 
 void			fr_dict_global_ctx_debug(void);
 
 char const		*fr_dict_global_ctx_dir(void);
 
+char const		*fr_dict_global_ctx_cache_dir(void);
+
 typedef struct fr_hash_iter_s fr_dict_global_ctx_iter_t;
 
 fr_dict_t		*fr_dict_global_ctx_iter_init(fr_dict_global_ctx_iter_t *iter) CC_HINT(nonnull);
@@ -0,0 +1,591 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Precompiled dictionary images
+ *
+ * An image is written the first time a dictionary is loaded from text, and
+ * contains every line which was passed to the parser, already split into
+ * arguments.  Comments and blank lines are dropped, and the contents of
+ * $INCLUDEd files are inlined after the $INCLUDE line.
+ *
+ * On subsequent loads the image is mapped read-only, and the parser is fed
+ * directly from the mapping.  Every file which contributed to the image is
+ * recorded with its size, times, inode and mode.  If any of those differ,
+ * or an optional $INCLUDE which was missing now exists, the image is
+ * considered stale and the text dictionaries are read instead.
+ *
+ * All integers are stored in network byte order, and the image contains no
+ * pointers, so it can be mapped at any address.
+ *
+ * @file src/lib/util/dict_cache.c
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/dbuff.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/rand.h>
+#include <freeradius-devel/util/strerror.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include "dict_cache_priv.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define DICT_CACHE_MAGIC	"FRDC"
+#define DICT_CACHE_VERSION	1
+
+/** Types of record in the line stream
+ *
+ */
+typedef enum {
+	DICT_CACHE_RECORD_FILE = 1,				//!< Start of a dictionary file.
+	DICT_CACHE_RECORD_LINE,					//!< A line, split into arguments.
+	DICT_CACHE_RECORD_END					//!< End of the current dictionary file.
+} dict_cache_record_t;
+
+struct dict_cache_writer_s {
+	fr_dbuff_t		sources;			//!< Files the image depends on.
+	fr_dbuff_uctx_talloc_t	sources_tctx;
+	uint32_t		num_sources;			//!< How many entries there are in sources.
+
+	fr_dbuff_t		records;			//!< Stream of files and lines.
+	fr_dbuff_uctx_talloc_t	records_tctx;
+
+	bool			failed;				//!< Something went wrong recording the image.
+								///< It won't be written.
+};
+
+struct dict_cache_s {
+	uint8_t const		*start;				//!< Start of the mapping.
+	size_t			len;				//!< Length of the mapping.
+
+	fr_dbuff_t		records;			//!< Our position in the line stream.
+};
+
+/** Return the path of the image for a given root dictionary file
+ *
+ * @param[in] ctx		to allocate the path in.
+ * @param[in] cache_dir		where images are stored.
+ * @param[in] root		path of the top level dictionary file.
+ * @return
+ *	- The image path.
+ *	- NULL on error.
+ */
+char *dict_cache_path(TALLOC_CTX *ctx, char const *cache_dir, char const *root)
+{
+	return talloc_asprintf(ctx, "%s%cdictionary-%08x.cache", cache_dir, FR_DIR_SEP, fr_hash_string(root));
+}
+
+static void dict_cache_in_str(dict_cache_writer_t *writer, fr_dbuff_t *dbuff, char const *str)
+{
+	size_t len = strlen(str);
+
+	if ((len > UINT16_MAX) ||
+	    (fr_dbuff_in(dbuff, (uint16_t)len) < 0) ||
+	    (fr_dbuff_in_memcpy(dbuff, (uint8_t const *)str, len + 1) < 0)) writer->failed = true;
+}
+
+/** Allocate a new image writer
+ *
+ * @param[in] ctx	to allocate the writer in.
+ * @return
+ *	- A new writer.
+ *	- NULL on error.
+ */
+dict_cache_writer_t *dict_cache_writer_alloc(TALLOC_CTX *ctx)
+{
+	dict_cache_writer_t *writer;
+
+	writer = talloc_zero(ctx, dict_cache_writer_t);
+	if (unlikely(!writer)) return NULL;
+
+	if (!fr_dbuff_init_talloc(writer, &writer->sources, &writer->sources_tctx, 1024, SIZE_MAX) ||
+	    !fr_dbuff_init_talloc(writer, &writer->records, &writer->records_tctx, 65536, SIZE_MAX)) {
+		talloc_free(writer);
+		return NULL;
+	}
+
+	return writer;
+}
+
+/** Record the start of a dictionary file
+ *
+ * @param[in] writer	to record the file in.
+ * @param[in] filename	the full path of the file.
+ * @param[in] statbuf	the result of stat() on filename.  Used to
+ *			determine whether the image is stale.
+ */
+void dict_cache_writer_file(dict_cache_writer_t *writer, char const *filename, struct stat const *statbuf)
+{
+	fr_dbuff_t	*dbuff = &writer->sources;
+
+	dict_cache_in_str(writer, dbuff, filename);
+	if ((fr_dbuff_in(dbuff, (uint8_t)true) < 0) ||
+	    (fr_dbuff_in(dbuff, (uint64_t)statbuf->st_size) < 0) ||
+	    (fr_dbuff_in(dbuff, (int64_t)statbuf->st_mtime) < 0) ||
+	    (fr_dbuff_in(dbuff, (int64_t)statbuf->st_ctime) < 0) ||
+	    (fr_dbuff_in(dbuff, (uint64_t)statbuf->st_ino) < 0) ||
+	    (fr_dbuff_in(dbuff, (uint64_t)statbuf->st_dev) < 0) ||
+	    (fr_dbuff_in(dbuff, (uint32_t)statbuf->st_mode) < 0)) writer->failed = true;
+	writer->num_sources++;
+
+	if (fr_dbuff_in(&writer->records, (uint8_t)DICT_CACHE_RECORD_FILE) < 0) writer->failed = true;
+	dict_cache_in_str(writer, &writer->records, filename);
+}
+
+/** Record an optional file which did not exist
+ *
+ * If the file is created later, the image is stale.
+ *
+ * @param[in] writer	to record the file in.
+ * @param[in] filename	the full path of the file.
+ */
+void dict_cache_writer_missing(dict_cache_writer_t *writer, char const *filename)
+{
+	dict_cache_in_str(writer, &writer->sources, filename);
+	if (fr_dbuff_in(&writer->sources, (uint8_t)false) < 0) writer->failed = true;
+	writer->num_sources++;
+}
+
+/** Record a line which has been split into arguments
+ *
+ * @param[in] writer	to record the line in.
+ * @param[in] line	number of the line in the current file.
+ * @param[in] argv	arguments.  Must not have been modified by the parser.
+ * @param[in] argc	number of arguments.
+ */
+void dict_cache_writer_line(dict_cache_writer_t *writer, int line, char **argv, int argc)
+{
+	fr_dbuff_t	*dbuff = &writer->records;
+	size_t		len = 0;
+	int		i;
+
+	for (i = 0; i < argc; i++) len += strlen(argv[i]) + 1;
+
+	if ((argc > UINT8_MAX) || (len > UINT16_MAX) ||
+	    (fr_dbuff_in(dbuff, (uint8_t)DICT_CACHE_RECORD_LINE) < 0) ||
+	    (fr_dbuff_in(dbuff, (uint32_t)line) < 0) ||
+	    (fr_dbuff_in(dbuff, (uint8_t)argc) < 0) ||
+	    (fr_dbuff_in(dbuff, (uint16_t)len) < 0)) {
+		writer->failed = true;
+		return;
+	}
+
+	for (i = 0; i < argc; i++) {
+		if (fr_dbuff_in_memcpy(dbuff, (uint8_t const *)argv[i], strlen(argv[i]) + 1) < 0) {
+			writer->failed = true;
+			return;
+		}
+	}
+}
+
+/** Record the end of the current dictionary file
+ *
+ * @param[in] writer	to record the end of file in.
+ */
+void dict_cache_writer_end(dict_cache_writer_t *writer)
+{
+	if (fr_dbuff_in(&writer->records, (uint8_t)DICT_CACHE_RECORD_END) < 0) writer->failed = true;
+}
+
+/** Write the image to disk
+ *
+ * The image is written to a temporary file, and renamed into place, so
+ * concurrent readers will either see the old image, or the new one.
+ *
+ * @param[in] writer	containing the recorded image.
+ * @param[in] path	to write the image to.
+ * @param[in] dict_dir	the default dictionary directory, used to expand ${dictdir}.
+ * @param[in] root	the path of the top level dictionary file.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int dict_cache_writer_commit(dict_cache_writer_t *writer, char const *path,
+			     char const *dict_dir, char const *root)
+{
+	fr_dbuff_t		hdr;
+	fr_dbuff_uctx_talloc_t	hdr_tctx;
+	char			*tmp;
+	int			fd;
+	struct iovec		iov[3];
+	ssize_t			slen;
+
+	if (writer->failed) {
+		fr_strerror_printf("Failed recording dictionary image %s", path);
+		return -1;
+	}
+
+	if (!fr_dbuff_init_talloc(writer, &hdr, &hdr_tctx, 256, SIZE_MAX)) {
+	oom:
+		fr_strerror_const("Out of memory");
+		return -1;
+	}
+
+	if (fr_dbuff_in_memcpy(&hdr, (uint8_t const *)DICT_CACHE_MAGIC, sizeof(DICT_CACHE_MAGIC) - 1) < 0) goto oom;
+	if (fr_dbuff_in(&hdr, (uint32_t)DICT_CACHE_VERSION) < 0) goto oom;
+	dict_cache_in_str(writer, &hdr, dict_dir);
+	dict_cache_in_str(writer, &hdr, root);
+	if (fr_dbuff_in(&hdr, writer->num_sources) < 0) goto oom;
+	if (writer->failed) goto oom;
+
+	tmp = talloc_asprintf(writer, "%s.%u", path, (unsigned int)getpid());
+	if (!tmp) goto oom;
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		fr_strerror_printf("Failed creating dictionary image %s: %s", tmp, fr_syserror(errno));
+		talloc_free(tmp);
+		return -1;
+	}
+
+	iov[0] = (struct iovec){ .iov_base = fr_dbuff_start(&hdr), .iov_len = fr_dbuff_used(&hdr) };
+	iov[1] = (struct iovec){ .iov_base = fr_dbuff_start(&writer->sources), .iov_len = fr_dbuff_used(&writer->sources) };
+	iov[2] = (struct iovec){ .iov_base = fr_dbuff_start(&writer->records), .iov_len = fr_dbuff_used(&writer->records) };
+
+	slen = writev(fd, iov, NUM_ELEMENTS(iov));
+	if ((slen < 0) || ((size_t)slen != (iov[0].iov_len + iov[1].iov_len + iov[2].iov_len))) {
+		fr_strerror_printf("Failed writing dictionary image %s: %s", tmp,
+				   slen < 0 ? fr_syserror(errno) : "Short write");
+	error:
+		close(fd);
+		unlink(tmp);
+		talloc_free(tmp);
+		return -1;
+	}
+
+	if (rename(tmp, path) < 0) {
+		fr_strerror_printf("Failed renaming dictionary image %s to %s: %s", tmp, path, fr_syserror(errno));
+		goto error;
+	}
+
+	close(fd);
+	talloc_free(tmp);
+
+	return 0;
+}
+
+/** Return a string from the image, without copying it
+ *
+ */
+static int dict_cache_out_str(char const **out, fr_dbuff_t *dbuff)
+{
+	uint16_t	len;
+	uint8_t const	*p;
+
+	FR_DBUFF_OUT_RETURN(&len, dbuff);
+
+	if (fr_dbuff_remaining(dbuff) < ((size_t)len + 1)) return -1;
+
+	p = fr_dbuff_current(dbuff);
+	if ((p[len] != '\0') || memchr(p, '\0', len)) return -1;
+
+	*out = (char const *)p;
+
+	return fr_dbuff_advance(dbuff, (size_t)len + 1);
+}
+
+/** Check whether one of the source files has changed since the image was written
+ *
+ * @return
+ *	- 0 the file has not changed.
+ *	- -1 the file has changed, or the entry is malformed.
+ */
+static int dict_cache_source_check(fr_dbuff_t *dbuff)
+{
+	char const	*filename;
+	uint8_t		present;
+	uint64_t	size, ino, dev;
+	int64_t		mtime, ctime;
+	uint32_t	mode;
+	struct stat	statbuf;
+
+	if (dict_cache_out_str(&filename, dbuff) < 0) return -1;
+	FR_DBUFF_OUT_RETURN(&present, dbuff);
+
+	if (!present) {
+		if ((stat(filename, &statbuf) < 0) && (errno == ENOENT)) return 0;
+		return -1;
+	}
+
+	FR_DBUFF_OUT_RETURN(&size, dbuff);
+	FR_DBUFF_OUT_RETURN(&mtime, dbuff);
+	FR_DBUFF_OUT_RETURN(&ctime, dbuff);
+	FR_DBUFF_OUT_RETURN(&ino, dbuff);
+	FR_DBUFF_OUT_RETURN(&dev, dbuff);
+	FR_DBUFF_OUT_RETURN(&mode, dbuff);
+
+	if (stat(filename, &statbuf) < 0) return -1;
+
+	/*
+	 *	The text parser seeds the random pool with the
+	 *	same data.
+	 */
+	fr_rand_seed(&statbuf, sizeof(statbuf));
+
+	if (((uint64_t)statbuf.st_size != size) ||
+	    ((int64_t)statbuf.st_mtime != mtime) ||
+	    ((int64_t)statbuf.st_ctime != ctime) ||
+	    ((uint64_t)statbuf.st_ino != ino) ||
+	    ((uint64_t)statbuf.st_dev != dev) ||
+	    ((uint32_t)statbuf.st_mode != mode)) return -1;
+
+	return 0;
+}
+
+/** Walk the line stream, checking every record is well formed
+ *
+ * Once this passes, the replay functions don't need to do
+ * any bounds checking of their own.
+ */
+static int dict_cache_records_check(fr_dbuff_t *in)
+{
+	fr_dbuff_t	dbuff = FR_DBUFF(in);
+	int		depth = 0;
+
+	if (fr_dbuff_remaining(&dbuff) == 0) return -1;
+
+	while (fr_dbuff_remaining(&dbuff) > 0) {
+		uint8_t		type;
+
+		FR_DBUFF_OUT_RETURN(&type, &dbuff);
+
+		switch (type) {
+		case DICT_CACHE_RECORD_FILE:
+		{
+			char const *filename;
+
+			if (dict_cache_out_str(&filename, &dbuff) < 0) return -1;
+			depth++;
+		}
+			break;
+
+		case DICT_CACHE_RECORD_LINE:
+		{
+			uint32_t	line;
+			uint8_t		argc;
+			uint16_t	len;
+			uint8_t const	*p, *end;
+
+			if (depth == 0) return -1;
+
+			FR_DBUFF_OUT_RETURN(&line, &dbuff);
+			FR_DBUFF_OUT_RETURN(&argc, &dbuff);
+			FR_DBUFF_OUT_RETURN(&len, &dbuff);
+
+			if ((argc == 0) || (len == 0) || (fr_dbuff_remaining(&dbuff) < len)) return -1;
+
+			/*
+			 *	Each argument is '\0' terminated, and
+			 *	there must be exactly argc of them.
+			 */
+			p = fr_dbuff_current(&dbuff);
+			end = p + len;
+			if (end[-1] != '\0') return -1;
+			while (p < end) {
+				p = memchr(p, '\0', end - p);
+				p++;
+				argc--;
+			}
+			if (argc != 0) return -1;
+
+			if (fr_dbuff_advance(&dbuff, (size_t)len) < 0) return -1;
+		}
+			break;
+
+		case DICT_CACHE_RECORD_END:
+			if (depth == 0) return -1;
+			depth--;
+
+			/*
+			 *	The top level file must be the
+			 *	last thing in the image.
+			 */
+			if ((depth == 0) && (fr_dbuff_remaining(&dbuff) > 0)) return -1;
+			break;
+
+		default:
+			return -1;
+		}
+	}
+
+	return (depth == 0) ? 0 : -1;
+}
+
+static int _dict_cache_free(dict_cache_t *cache)
+{
+	munmap(UNCONST(uint8_t *, cache->start), cache->len);
+
+	return 0;
+}
+
+/** Map a dictionary image, and check it's still valid
+ *
+ * @param[in] ctx	to allocate the cache handle in.
+ * @param[in] path	of the image.
+ * @param[in] dict_dir	the current default dictionary directory.
+ * @param[in] root	the path of the top level dictionary file.
+ * @return
+ *	- A cache handle positioned at the start of the line stream.
+ *	- NULL if the image doesn't exist, is malformed, or is stale.
+ */
+dict_cache_t *dict_cache_open(TALLOC_CTX *ctx, char const *path, char const *dict_dir, char const *root)
+{
+	int		fd;
+	struct stat	statbuf;
+	void		*start;
+	dict_cache_t	*cache;
+	fr_dbuff_t	dbuff;
+	uint8_t		magic[sizeof(DICT_CACHE_MAGIC) - 1];
+	uint32_t	version, num_sources, i;
+	char const	*str;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) return NULL;
+
+	/*
+	 *	Apply the same checks as we do for the text
+	 *	dictionaries.  Anyone who can write the image
+	 *	can control the server configuration.
+	 */
+	if ((fstat(fd, &statbuf) < 0) || !S_ISREG(statbuf.st_mode) || (statbuf.st_size == 0)
+#ifdef S_IWOTH
+	    || ((statbuf.st_mode & S_IWOTH) != 0)
+#endif
+	    ) {
+		close(fd);
+		return NULL;
+	}
+
+	start = mmap(NULL, (size_t)statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (start == MAP_FAILED) return NULL;
+
+	cache = talloc_zero(ctx, dict_cache_t);
+	if (!cache) {
+		munmap(start, (size_t)statbuf.st_size);
+		return NULL;
+	}
+	cache->start = start;
+	cache->len = (size_t)statbuf.st_size;
+	talloc_set_destructor(cache, _dict_cache_free);
+
+	fr_dbuff_init(&dbuff, cache->start, cache->len);
+
+	if ((fr_dbuff_out_memcpy(magic, &dbuff, sizeof(magic)) < 0) ||
+	    (memcmp(magic, DICT_CACHE_MAGIC, sizeof(magic)) != 0)) {
+	stale:
+		talloc_free(cache);
+		return NULL;
+	}
+
+	if ((fr_dbuff_out(&version, &dbuff) < 0) || (version != DICT_CACHE_VERSION)) goto stale;
+
+	if ((dict_cache_out_str(&str, &dbuff) < 0) || (strcmp(str, dict_dir) != 0)) goto stale;
+	if ((dict_cache_out_str(&str, &dbuff) < 0) || (strcmp(str, root) != 0)) goto stale;
+
+	if (fr_dbuff_out(&num_sources, &dbuff) < 0) goto stale;
+	for (i = 0; i < num_sources; i++) if (dict_cache_source_check(&dbuff) < 0) goto stale;
+
+	if (dict_cache_records_check(&dbuff) < 0) goto stale;
+
+	fr_dbuff_init(&cache->records, fr_dbuff_current(&dbuff), fr_dbuff_remaining(&dbuff));
+
+	return cache;
+}
+
+/** Enter the next file in the image
+ *
+ * Optional $INCLUDEs which did not exist when the image was written
+ * have no entry in the line stream.
+ *
+ * @param[in] cache	to read from.
+ * @param[out] filename	of the file, valid for the lifetime of the cache.
+ * @return
+ *	- true if the next record was the start of a file.
+ *	- false if there is no file at this position in the stream.
+ */
+bool dict_cache_file_next(dict_cache_t *cache, char const **filename)
+{
+	uint8_t const *p = fr_dbuff_current(&cache->records);
+
+	if (!fr_dbuff_remaining(&cache->records) || (*p != DICT_CACHE_RECORD_FILE)) return false;
+
+	fr_dbuff_advance(&cache->records, 1);
+	if (!fr_cond_assert(dict_cache_out_str(filename, &cache->records) >= 0)) return false;
+
+	return true;
+}
+
+/** Return the next line in the current file
+ *
+ * The arguments are copied into buf, as the parser modifies them in place.
+ *
+ * @param[in] cache	to read from.
+ * @param[in] buf	to copy the arguments into.
+ * @param[in] buflen	length of buf.
+ * @param[out] argv	pointers to the arguments in buf.
+ * @param[in] max_argc	maximum number of arguments.
+ * @param[out] line	number of the line in the original file.
+ * @return
+ *	- >0 the number of arguments.
+ *	- 0 at the end of the current file.
+ *	- -1 if the line was too long for buf.
+ */
+int dict_cache_line_next(dict_cache_t *cache, char *buf, size_t buflen, char **argv, int max_argc, int *line)
+{
+	uint8_t		type;
+	uint32_t	num;
+	uint8_t		argc;
+	uint16_t	len;
+	char		*p;
+	int		i;
+
+	/*
+	 *	dict_cache_records_check() has already validated
+	 *	the stream, and nested files are consumed by
+	 *	dict_cache_file_next().
+	 */
+	(void) fr_dbuff_out(&type, &cache->records);
+	if (type == DICT_CACHE_RECORD_END) return 0;
+	fr_assert(type == DICT_CACHE_RECORD_LINE);
+
+	(void) fr_dbuff_out(&num, &cache->records);
+	(void) fr_dbuff_out(&argc, &cache->records);
+	(void) fr_dbuff_out(&len, &cache->records);
+
+	if ((len > buflen) || (argc > max_argc)) {
+		fr_strerror_const("Dictionary image line too long");
+		return -1;
+	}
+
+	memcpy(buf, fr_dbuff_current(&cache->records), len);
+	fr_dbuff_advance(&cache->records, (size_t)len);
+
+	for (i = 0, p = buf; i < argc; i++) {
+		argv[i] = p;
+		p += strlen(p) + 1;
+	}
+	*line = (int)num;
+
+	return argc;
+}
@@ -0,0 +1,65 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Precompiled dictionary images
+ *
+ * @file src/lib/util/dict_cache_priv.h
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+RCSIDH(dict_cache_priv_h, "$Id$")
+
+#include <freeradius-devel/util/talloc.h>
+
+#include <sys/stat.h>
+
+typedef struct dict_cache_writer_s dict_cache_writer_t;
+typedef struct dict_cache_s dict_cache_t;
+
+char			*dict_cache_path(TALLOC_CTX *ctx, char const *cache_dir, char const *root);
+
+/** @name Recording an image whilst the text dictionaries are parsed
+ *
+ * @{
+ */
+dict_cache_writer_t	*dict_cache_writer_alloc(TALLOC_CTX *ctx);
+
+void			dict_cache_writer_file(dict_cache_writer_t *writer,
+					       char const *filename, struct stat const *statbuf);
+
+void			dict_cache_writer_missing(dict_cache_writer_t *writer, char const *filename);
+
+void			dict_cache_writer_line(dict_cache_writer_t *writer, int line, char **argv, int argc);
+
+void			dict_cache_writer_end(dict_cache_writer_t *writer);
+
+int			dict_cache_writer_commit(dict_cache_writer_t *writer, char const *path,
+						 char const *dict_dir, char const *root);
+/** @} */
+
+/** @name Replaying a previously recorded image
+ *
+ * @{
+ */
+dict_cache_t		*dict_cache_open(TALLOC_CTX *ctx, char const *path,
+					 char const *dict_dir, char const *root);
+
+bool			dict_cache_file_next(dict_cache_t *cache, char const **filename);
+
+int			dict_cache_line_next(dict_cache_t *cache, char *buf, size_t buflen,
+					     char **argv, int max_argc, int *line);
+/** @} */
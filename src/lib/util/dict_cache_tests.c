@@ -0,0 +1,324 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests and startup benchmark for precompiled dictionary images
+ *
+ * @file src/lib/util/dict_cache_tests.c
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include <freeradius-devel/util/conf.h>
+#include <freeradius-devel/util/dict.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/time.h>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BENCHMARK_LOADS		20
+
+typedef struct {
+	fr_dict_gctx_t const	*gctx;
+	fr_dict_t		*internal;
+	fr_dict_t		*proto;
+} dict_cache_test_t;
+
+/** Remove every file in a directory, then the directory
+ *
+ */
+static void test_dir_free(char const *dir)
+{
+	DIR		*dp;
+	struct dirent	*de;
+	char		path[PATH_MAX];
+
+	dp = opendir(dir);
+	if (!dp) return;
+
+	while ((de = readdir(dp)) != NULL) {
+		if (de->d_name[0] == '.') continue;
+
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		if (unlink(path) < 0) test_dir_free(path);	/* Must be a directory */
+	}
+	closedir(dp);
+
+	rmdir(dir);
+}
+
+static void test_file_write(char const *dir, char const *name, char const *contents, char const *mode)
+{
+	char	path[PATH_MAX];
+	FILE	*fp;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+	fp = fopen(path, mode);
+	TEST_ASSERT(fp != NULL);
+	fputs(contents, fp);
+	fclose(fp);
+}
+
+static size_t test_dir_count(char const *dir)
+{
+	DIR		*dp;
+	struct dirent	*de;
+	size_t		count = 0;
+
+	dp = opendir(dir);
+	if (!dp) return 0;
+
+	while ((de = readdir(dp)) != NULL) if (de->d_name[0] != '.') count++;
+	closedir(dp);
+
+	return count;
+}
+
+static int _dict_hash(fr_dict_attr_t const *da, void *uctx)
+{
+	uint32_t *hash = uctx;
+
+	*hash = fr_hash_update(da->name, strlen(da->name), *hash);
+	*hash = fr_hash_update(&da->attr, sizeof(da->attr), *hash);
+	*hash = fr_hash_update(&da->type, sizeof(da->type), *hash);
+	*hash = fr_hash_update(&da->depth, sizeof(da->depth), *hash);
+
+	return 0;
+}
+
+/** Hash the names, numbers and types of every attribute in a dictionary
+ *
+ */
+static uint32_t test_dict_hash(fr_dict_t const *dict)
+{
+	uint32_t hash = 0;
+
+	TEST_CHECK(fr_dict_walk(fr_dict_root(dict), _dict_hash, &hash) == 0);
+
+	return hash;
+}
+
+static int test_dict_load(dict_cache_test_t *t, char const *dict_dir, char const *cache_dir, char const *proto)
+{
+	memset(t, 0, sizeof(*t));
+
+	t->gctx = fr_dict_global_ctx_init(NULL, dict_dir);
+	if (!t->gctx) return -1;
+
+	if (fr_dict_global_ctx_cache_dir_set(cache_dir) < 0) return -1;
+
+	if (fr_dict_internal_afrom_file(&t->internal, FR_DICTIONARY_INTERNAL_DIR, __FILE__) < 0) return -1;
+	if (fr_dict_protocol_afrom_file(&t->proto, proto, NULL, __FILE__) < 0) return -1;
+
+	return 0;
+}
+
+static void test_dict_free(dict_cache_test_t *t)
+{
+	if (t->proto) fr_dict_free(&t->proto, __FILE__);
+	if (t->internal) fr_dict_free(&t->internal, __FILE__);
+	if (t->gctx) TEST_CHECK(fr_dict_global_ctx_free(t->gctx) == 0);
+}
+
+/** Create a dictionary tree with an internal dictionary, and a small protocol
+ *
+ */
+static void test_dict_tree_alloc(char *dict_dir, size_t len)
+{
+	char path[PATH_MAX];
+
+	strlcpy(dict_dir, "/tmp/dict_cache_tests.XXXXXX", len);
+	TEST_ASSERT(mkdtemp(dict_dir) != NULL);
+
+	snprintf(path, sizeof(path), "%s/%s", dict_dir, FR_DICTIONARY_INTERNAL_DIR);
+	TEST_ASSERT(mkdir(path, 0755) == 0);
+	test_file_write(path, "dictionary",
+			"ATTRIBUTE	Cache-Test-Internal	1	string\n", "w");
+
+	snprintf(path, sizeof(path), "%s/cachetest", dict_dir);
+	TEST_ASSERT(mkdir(path, 0755) == 0);
+	test_file_write(path, "dictionary",
+			"# Comments are not recorded\n"
+			"PROTOCOL	cachetest	254\n"
+			"BEGIN-PROTOCOL	cachetest\n"
+			"ATTRIBUTE	Test-String	1	string\n"
+			"ATTRIBUTE	Test-Integer	2	uint32\n"
+			"VALUE	Test-Integer	One	1\n"
+			"$INCLUDE dictionary.extra\n"
+			"$INCLUDE- dictionary.optional\n"
+			"END-PROTOCOL	cachetest\n", "w");
+	test_file_write(path, "dictionary.extra",
+			"ATTRIBUTE	Test-TLV	3	tlv\n"
+			"BEGIN-TLV	Test-TLV\n"
+			"ATTRIBUTE	Test-Child	1	ipaddr\n"
+			"END-TLV	Test-TLV\n", "w");
+}
+
+static void test_dict_cache_replay(void)
+{
+	char			dict_dir[64], cache_dir[128];
+	dict_cache_test_t	t;
+	uint32_t		text_hash, replay_hash;
+
+	test_dict_tree_alloc(dict_dir, sizeof(dict_dir));
+	snprintf(cache_dir, sizeof(cache_dir), "%s/cache", dict_dir);
+	TEST_ASSERT(mkdir(cache_dir, 0755) == 0);
+
+	TEST_CASE("First load parses the text files, and writes an image");
+	TEST_CHECK(test_dict_load(&t, dict_dir, cache_dir, "cachetest") == 0);
+	TEST_MSG("Load failed: %s", fr_strerror());
+	text_hash = test_dict_hash(t.proto);
+	TEST_CHECK(fr_dict_attr_by_oid(NULL, fr_dict_root(t.proto), "Test-TLV.Test-Child") != NULL);
+	test_dict_free(&t);
+
+	TEST_CHECK(test_dir_count(cache_dir) == 2);	/* internal and cachetest */
+	TEST_MSG("Expected 2 images, got %zu", test_dir_count(cache_dir));
+
+	TEST_CASE("Second load replays the image, and produces the same dictionary");
+	TEST_CHECK(test_dict_load(&t, dict_dir, cache_dir, "cachetest") == 0);
+	TEST_MSG("Load failed: %s", fr_strerror());
+	replay_hash = test_dict_hash(t.proto);
+	TEST_CHECK(replay_hash == text_hash);
+	TEST_MSG("Expected hash %08x, got %08x", text_hash, replay_hash);
+	TEST_CHECK(fr_dict_enum_by_name(fr_dict_attr_by_name(NULL, fr_dict_root(t.proto), "Test-Integer"),
+					"One", -1) != NULL);
+	test_dict_free(&t);
+
+	test_dir_free(dict_dir);
+}
+
+static void test_dict_cache_stale(void)
+{
+	char			dict_dir[64], cache_dir[128], path[PATH_MAX];
+	dict_cache_test_t	t;
+
+	test_dict_tree_alloc(dict_dir, sizeof(dict_dir));
+	snprintf(cache_dir, sizeof(cache_dir), "%s/cache", dict_dir);
+	TEST_ASSERT(mkdir(cache_dir, 0755) == 0);
+	snprintf(path, sizeof(path), "%s/cachetest", dict_dir);
+
+	TEST_CHECK(test_dict_load(&t, dict_dir, cache_dir, "cachetest") == 0);
+	TEST_MSG("Load failed: %s", fr_strerror());
+	test_dict_free(&t);
+
+	TEST_CASE("Modifying an $INCLUDEd file invalidates the image");
+	test_file_write(path, "dictionary.extra", "ATTRIBUTE	Test-Added	4	octets\n", "a");
+
+	TEST_CHECK(test_dict_load(&t, dict_dir, cache_dir, "cachetest") == 0);
+	TEST_MSG("Load failed: %s", fr_strerror());
+	TEST_CHECK(fr_dict_attr_by_name(NULL, fr_dict_root(t.proto), "Test-Added") != NULL);
+	test_dict_free(&t);
+
+	TEST_CASE("Creating a missing optional $INCLUDE invalidates the image");
+	test_file_write(path, "dictionary.optional", "ATTRIBUTE	Test-Optional	5	uint8\n", "w");
+
+	TEST_CHECK(test_dict_load(&t, dict_dir, cache_dir, "cachetest") == 0);
+	TEST_MSG("Load failed: %s", fr_strerror());
+	TEST_CHECK(fr_dict_attr_by_name(NULL, fr_dict_root(t.proto), "Test-Optional") != NULL);
+	TEST_CHECK(fr_dict_attr_by_name(NULL, fr_dict_root(t.proto), "Test-Added") != NULL);
+	test_dict_free(&t);
+
+	TEST_CASE("Corrupt images are ignored");
+	test_dir_free(cache_dir);
+	TEST_ASSERT(mkdir(cache_dir, 0755) == 0);
+	TEST_CHECK(test_dict_load(&t, dict_dir, cache_dir, "cachetest") == 0);
+	test_dict_free(&t);
+	{
+		DIR		*dp;
+		struct dirent	*de;
+		char		image[PATH_MAX];
+
+		dp = opendir(cache_dir);
+		TEST_ASSERT(dp != NULL);
+		while ((de = readdir(dp)) != NULL) {
+			if (de->d_name[0] == '.') continue;
+			snprintf(image, sizeof(image), "%s/%s", cache_dir, de->d_name);
+			TEST_CHECK(truncate(image, 16) == 0);
+		}
+		closedir(dp);
+	}
+	TEST_CHECK(test_dict_load(&t, dict_dir, cache_dir, "cachetest") == 0);
+	TEST_MSG("Load failed: %s", fr_strerror());
+	TEST_CHECK(fr_dict_attr_by_name(NULL, fr_dict_root(t.proto), "Test-Optional") != NULL);
+	test_dict_free(&t);
+
+	test_dir_free(dict_dir);
+}
+
+/** Time repeated loads of the internal and RADIUS dictionaries
+ *
+ */
+static fr_time_delta_t test_dict_load_time(char const *cache_dir)
+{
+	dict_cache_test_t	t;
+	fr_time_t		start;
+	fr_time_delta_t		total = fr_time_delta_wrap(0);
+	int			i;
+
+	for (i = 0; i < BENCHMARK_LOADS; i++) {
+		start = fr_time();
+		if (!TEST_CHECK(test_dict_load(&t, "share/dictionary", cache_dir, "radius") == 0)) {
+			TEST_MSG("Load failed: %s", fr_strerror());
+			test_dict_free(&t);
+			break;
+		}
+		total = fr_time_delta_add(total, fr_time_sub(fr_time(), start));
+		test_dict_free(&t);
+	}
+
+	return fr_time_delta_div(total, fr_time_delta_wrap(BENCHMARK_LOADS));
+}
+
+static void test_dict_cache_benchmark(void)
+{
+	char		cache_dir[128];
+	fr_time_delta_t	text, replay;
+	dict_cache_test_t t;
+
+	strlcpy(cache_dir, "/tmp/dict_cache_tests.XXXXXX", sizeof(cache_dir));
+	TEST_ASSERT(mkdtemp(cache_dir) != NULL);
+
+	text = test_dict_load_time(NULL);
+
+	/*
+	 *	Write the images
+	 */
+	TEST_CHECK(test_dict_load(&t, "share/dictionary", cache_dir, "radius") == 0);
+	test_dict_free(&t);
+
+	replay = test_dict_load_time(cache_dir);
+
+	printf("\nStartup time (internal + radius), average of %u loads\n", BENCHMARK_LOADS);
+	printf("  text     %" PRId64 " us\n", fr_time_delta_to_usec(text));
+	printf("  image    %" PRId64 " us\n", fr_time_delta_to_usec(replay));
+
+	/* shared runners are terrible for performance tests */
+	if (!getenv("NO_PERFORMANCE_TESTS")) TEST_CHECK(fr_time_delta_lt(replay, text));
+
+	test_dir_free(cache_dir);
+}
+
+TEST_LIST = {
+	{ "dict_cache_replay",		test_dict_cache_replay },
+	{ "dict_cache_stale",		test_dict_cache_stale },
+	{ "dict_cache_benchmark",	test_dict_cache_benchmark },
+
+	{ NULL }
+};
@@ -115,6 +115,9 @@ struct fr_dict_gctx_s {
 	char			*dict_dir_default;	//!< The default location for loading dictionaries if one
 							///< wasn't provided.
 
+	char			*dict_cache_dir;	//!< Where precompiled dictionary images are stored.
+							///< If NULL, images are not used.
+
 	dl_loader_t		*dict_loader;		//!< for protocol validation
 
 	fr_hash_table_t		*protocol_by_name;	//!< Hash containing names of all the
@@ -24,6 +24,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/radius/defs.h>
 #include <freeradius-devel/util/conf.h>
+#include <freeradius-devel/util/dict_cache_priv.h>
 #include <freeradius-devel/util/dict_fixup_priv.h>
 #include <freeradius-devel/util/file.h>
 #include <freeradius-devel/util/rand.h>
@@ -60,6 +61,9 @@ typedef struct {
 	fr_dict_attr_t const   	*relative_attr;		//!< for ".82" instead of "1.2.3.82".
 							///< only for parents of type "tlv"
 	dict_fixup_ctx_t	fixup;
+
+	dict_cache_t		*replay;		//!< Precompiled image we're reading lines from.
+	dict_cache_writer_t	*record;		//!< Image we're recording lines into.
 } dict_tokenize_ctx_t;
 
 #define CURRENT_FRAME(_dctx)	(&(_dctx)->stack[(_dctx)->stack_depth])
@@ -1754,6 +1758,53 @@ static int dict_finalise(dict_tokenize_ctx_t *ctx)
 	return 0;
 }
 
+/** Return the next line containing definitions, split into arguments
+ *
+ * Lines come either from the text file, or from the precompiled image
+ * we're replaying.  When reading text, the line is recorded before the
+ * parser gets a chance to modify the arguments.
+ *
+ * @return
+ *	- >0 the number of arguments.
+ *	- 0 at the end of the file.
+ *	- -1 on error.
+ */
+static int dict_line_next(dict_tokenize_ctx_t *ctx, FILE *fp, char *buf, size_t buflen, char **argv, int *line)
+{
+	char	*p;
+	int	argc;
+
+	if (ctx->replay) return dict_cache_line_next(ctx->replay, buf, buflen, argv, MAX_ARGV, line);
+
+	while (fgets(buf, buflen, fp) != NULL) {
+		(*line)++;
+
+		switch (buf[0]) {
+		case '#':
+		case '\0':
+		case '\n':
+		case '\r':
+			continue;
+		}
+
+		/*
+		 *  Comment characters should NOT be appearing anywhere but
+		 *  as start of a comment;
+		 */
+		p = strchr(buf, '#');
+		if (p) *p = '\0';
+
+		argc = fr_dict_str_to_argv(buf, argv, MAX_ARGV);
+		if (argc == 0) continue;
+
+		if (ctx->record) dict_cache_writer_line(ctx->record, *line, argv, argc);
+
+		return argc;
+	}
+
+	return 0;
+}
+
 /** Parse a dictionary file
  *
  * @param[in] ctx	Contains the current state of the dictionary parser.
@@ -1761,6 +1812,7 @@ static int dict_finalise(dict_tokenize_ctx_t *ctx)
  *			we're in. Block context changes in $INCLUDEs should
  *			not affect the context of the including file.
  * @param[in] dir_name	Directory containing the dictionary we're loading.
+ *			Unused when replaying a precompiled image.
  * @param[in] filename	we're parsing.
  * @param[in] src_file	The including file.
  * @param[in] src_line	Line on which the $INCLUDE or $INCLUDE- statement was found.
@@ -1791,6 +1843,28 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 
 	if (!fr_cond_assert(!ctx->dict->root || ctx->stack[ctx->stack_depth].da)) return -1;
 
+	/*
+	 *	The image contains the resolved path of each file,
+	 *	and all the checks below were done when it was
+	 *	written.  Optional $INCLUDEs which didn't exist
+	 *	have no entry.
+	 */
+	if (ctx->replay) {
+		char const *cached;
+
+		if (!dict_cache_file_next(ctx->replay, &cached)) {
+			fr_strerror_printf_push("Error reading dictionary: %s[%d]: Couldn't open dictionary '%s'",
+						fr_cwd_strip(src_file), src_line, filename);
+			return -2;
+		}
+
+		fp = NULL;
+		dir[0] = '\0';
+		strlcpy(fn, cached, sizeof(fn));
+		ctx->stack[ctx->stack_depth].filename = fn;
+		goto parse;
+	}
+
 	if ((strlen(dir_name) + 3 + strlen(filename)) > sizeof(dir)) {
 		fr_strerror_printf_push("%s: Filename name too long", "Error reading dictionary");
 		return -1;
@@ -1840,6 +1914,8 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 	ctx->stack[ctx->stack_depth].filename = fn;
 
 	if ((fp = fopen(fn, "r")) == NULL) {
+		if (ctx->record) dict_cache_writer_missing(ctx->record, fn);
+
 		if (!src_file) {
 			fr_strerror_printf_push("Couldn't open dictionary %s: %s", fr_syserror(errno), fn);
 		} else {
@@ -1882,35 +1958,20 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 	 */
 	fr_rand_seed(&statbuf, sizeof(statbuf));
 
-	memset(&base_flags, 0, sizeof(base_flags));
-
-	while (fgets(buf, sizeof(buf), fp) != NULL) {
-		ctx->stack[ctx->stack_depth].line = ++line;
+	if (ctx->record) dict_cache_writer_file(ctx->record, fn, &statbuf);
 
-		switch (buf[0]) {
-		case '#':
-		case '\0':
-		case '\n':
-		case '\r':
-			continue;
-		}
-
-		/*
-		 *  Comment characters should NOT be appearing anywhere but
-		 *  as start of a comment;
-		 */
-		p = strchr(buf, '#');
-		if (p) *p = '\0';
+parse:
+	memset(&base_flags, 0, sizeof(base_flags));
 
-		argc = fr_dict_str_to_argv(buf, argv, MAX_ARGV);
-		if (argc == 0) continue;
+	while ((argc = dict_line_next(ctx, fp, buf, sizeof(buf), argv, &line)) > 0) {
+		ctx->stack[ctx->stack_depth].line = line;
 
 		if (argc == 1) {
 			fr_strerror_const("Invalid entry");
 
 		error:
 			fr_strerror_printf_push("Failed parsing dictionary at %s[%d]", fr_cwd_strip(fn), line);
-			fclose(fp);
+			if (fp) fclose(fp);
 			return -1;
 		}
 
@@ -2051,7 +2112,9 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 			 *	people don't have to remember where
 			 *	the root dictionaries are located.
 			 */
-			if (strncmp(argv[1], "${dictdir}/", 11) != 0) {
+			if (ctx->replay) {
+				ret = _dict_from_file(ctx, NULL, argv[1], fn, line);
+			} else if (strncmp(argv[1], "${dictdir}/", 11) != 0) {
 				ret = _dict_from_file(ctx, dir, argv[1], fn, line);
 			} else {
 				ret = _dict_from_file(ctx, fr_dict_global_ctx_dir(), argv[1] + 11, fn, line);
@@ -2064,14 +2127,14 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 
 			if (ret < 0) {
 				fr_strerror_printf_push("from $INCLUDE at %s[%d]", fr_cwd_strip(fn), line);
-				fclose(fp);
+				if (fp) fclose(fp);
 				return -1;
 			}
 
 			if (ctx->stack_depth < stack_depth) {
 				fr_strerror_printf_push("unexpected END-??? in $INCLUDE at %s[%d]",
 							fr_cwd_strip(fn), line);
-				fclose(fp);
+				if (fp) fclose(fp);
 				return -1;
 			}
 
@@ -2083,7 +2146,7 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 
 				fr_strerror_printf_push("BEGIN-??? without END-... in file $INCLUDEd from %s[%d]",
 							fr_cwd_strip(fn), line);
-				fclose(fp);
+				if (fp) fclose(fp);
 				return -1;
 			}
 
@@ -2224,7 +2287,7 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 			 *	here.
 			 */
 			if (dict_finalise(ctx) < 0) {
-				fclose(fp);
+				if (fp) fclose(fp);
 				return -1;
 			}
 
@@ -2487,7 +2550,12 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 	 *	be missing things.
 	 */
 
+	if (!fp) return argc;	/* 0 at the end of the file, -1 on error */
+
 	fclose(fp);
+
+	if (ctx->record) dict_cache_writer_end(ctx->record);
+
 	return 0;
 }
 
@@ -2495,8 +2563,9 @@ static int dict_from_file(fr_dict_t *dict,
 			  char const *dir_name, char const *filename,
 			  char const *src_file, int src_line)
 {
-	int ret;
+	int		ret;
 	dict_tokenize_ctx_t ctx;
+	char		*root = NULL, *cache_path = NULL;
 
 	memset(&ctx, 0, sizeof(ctx));
 	ctx.dict = dict;
@@ -2505,9 +2574,24 @@ static int dict_from_file(fr_dict_t *dict,
 	ctx.stack[0].da = dict->root;
 	ctx.stack[0].nest = FR_TYPE_MAX;
 
+	/*
+	 *	Replay the precompiled image if there's a current
+	 *	one, otherwise record a new image as we parse the
+	 *	text files.
+	 */
+	if (dict_gctx->dict_cache_dir) {
+		root = talloc_asprintf(NULL, "%s%c%s", dir_name, FR_DIR_SEP, filename);
+		cache_path = dict_cache_path(root, dict_gctx->dict_cache_dir, root);
+		if (cache_path) {
+			ctx.replay = dict_cache_open(root, cache_path, fr_dict_global_ctx_dir(), root);
+			if (!ctx.replay) ctx.record = dict_cache_writer_alloc(root);
+		}
+	}
+
 	ret = _dict_from_file(&ctx, dir_name, filename, src_file, src_line);
 	if (ret < 0) {
 		talloc_free(ctx.fixup.pool);
+		talloc_free(root);
 		return ret;
 	}
 
@@ -2518,7 +2602,18 @@ static int dict_from_file(fr_dict_t *dict,
 	 *	Fixups should have been applied already to any protocol
 	 *	dictionaries.
 	 */
-	return dict_finalise(&ctx);
+	ret = dict_finalise(&ctx);
+
+	/*
+	 *	Failing to write the image isn't fatal, we'll
+	 *	just parse the text files again next time.
+	 */
+	if ((ret == 0) && ctx.record &&
+	    (dict_cache_writer_commit(ctx.record, cache_path, fr_dict_global_ctx_dir(), root) < 0)) fr_strerror_clear();
+
+	talloc_free(root);
+
+	return ret;
 }
 
 /** (Re-)Initialize the special internal dictionary
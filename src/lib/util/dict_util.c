@@ -3495,7 +3495,8 @@ static int _dict_global_free(fr_dict_gctx_t *gctx)
  */
 fr_dict_gctx_t const *fr_dict_global_ctx_init(TALLOC_CTX *ctx, char const *dict_dir)
 {
-	fr_dict_gctx_t *new_ctx;
+	fr_dict_gctx_t	*new_ctx;
+	char		*env;
 
 	if (!dict_dir) {
 		fr_strerror_const("No dictionary location provided");
@@ -3525,6 +3526,12 @@ fr_dict_gctx_t const *fr_dict_global_ctx_init(TALLOC_CTX *ctx, char const *dict_
 	new_ctx->dict_dir_default = talloc_strdup(new_ctx, dict_dir);
 	if (!new_ctx->dict_dir_default) goto error;
 
+	env = getenv("FR_DICT_CACHE_DIR");
+	if (env && *env) {
+		new_ctx->dict_cache_dir = talloc_strdup(new_ctx, env);
+		if (!new_ctx->dict_cache_dir) goto error;
+	}
+
 	new_ctx->dict_loader = dl_loader_init(new_ctx, NULL, false, false);
 	if (!new_ctx->dict_loader) goto error;
 
@@ -3586,6 +3593,39 @@ char const *fr_dict_global_ctx_dir(void)
 	return dict_gctx->dict_dir_default;
 }
 
+/** Set where precompiled dictionary images are stored
+ *
+ * When set, the first load of a dictionary from text writes an image
+ * of the parsed dictionary files to this directory.  Later loads replay
+ * the image instead of reading the text files, unless any of the files
+ * have changed.
+ *
+ * The default is taken from the FR_DICT_CACHE_DIR environment variable.
+ *
+ * @param[in] cache_dir	Directory to store images in.  NULL disables images.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_dict_global_ctx_cache_dir_set(char const *cache_dir)
+{
+	if (!dict_gctx) return -1;
+
+	talloc_free(dict_gctx->dict_cache_dir);			/* Free previous value */
+	dict_gctx->dict_cache_dir = NULL;
+	if (!cache_dir) return 0;
+
+	dict_gctx->dict_cache_dir = talloc_strdup(dict_gctx, cache_dir);
+	if (!dict_gctx->dict_cache_dir) return -1;
+
+	return 0;
+}
+
+char const *fr_dict_global_ctx_cache_dir(void)
+{
+	return dict_gctx->dict_cache_dir;
+}
+
 /** Mark all dictionaries and the global dictionary ctx as read only
  *
  * Any attempts to add new attributes will now fail.
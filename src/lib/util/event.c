@@ -43,6 +43,30 @@ RCSID("$Id$")
 #include <sys/wait.h>
 #include <pthread.h>
 
+/*
+ *	On Linux kevent() is provided by libkqueue, which is itself
+ *	implemented on top of epoll, and adds a layer of bookkeeping
+ *	to every filter change and every event delivered.
+ *
+ *	Socket read/write readiness is by far the most common event
+ *	we process, so for those we talk to epoll directly.  The kqueue
+ *	is still used for everything else (user events, PIDs, vnodes,
+ *	I/O on regular files).
+ *
+ *	Older versions of libkqueue return a pollable fd from kqueue(),
+ *	which we register in the epoll set, so that we only ever block
+ *	in epoll_wait().  Newer versions return an identifier which
+ *	can't be polled.  In that case we register the epoll fd with
+ *	the kqueue instead, and block in kevent().
+ *
+ *	Configure with --without-epoll (which defines WITHOUT_EVENT_EPOLL)
+ *	to route everything through kevent().
+ */
+#if defined(__linux__) && !defined(WITHOUT_EVENT_EPOLL)
+#  define WITH_EVENT_EPOLL 1
+#  include <sys/epoll.h>
+#endif
+
 #ifdef NDEBUG
 /*
  *	Turn off documentation warnings as file/line
@@ -108,6 +132,10 @@ struct fr_event_timer {
 	fr_lst_index_t		lst_id;	     	  	//!< Where to store opaque lst data.
 	fr_dlist_t		entry;			//!< List of deferred timer events.
 
+	fr_dlist_t		wheel_entry;		//!< Entry in a timer wheel slot.
+	uint8_t			wheel_level;		//!< Wheel level the event is in.
+	uint8_t			wheel_slot;		//!< Slot within that level.
+
 	fr_event_list_t		*el;			//!< Event list containing this timer.
 
 #ifndef NDEBUG
@@ -309,6 +337,11 @@ struct fr_event_fd {
 	bool			is_registered;		//!< Whether this fr_event_fd_t's FD has been registered with
 							///< kevent.  Mostly for debugging.
 
+#ifdef WITH_EVENT_EPOLL
+	bool			use_epoll;		//!< Filters are managed with epoll_ctl() instead of kevent().
+	uint32_t		epoll_events;		//!< Events currently registered with epoll.
+#endif
+
 	void			*uctx;			//!< Context pointer to pass to each file descriptor callback.
 	TALLOC_CTX		*linked_ctx;		//!< talloc ctx this event was bound to.
 
@@ -382,11 +415,33 @@ typedef struct {
 } fr_event_user_t;
 
 
+#define EVENT_WHEEL_LEVELS	4				//!< Number of levels in the timer wheel.
+#define EVENT_WHEEL_BITS	6				//!< log2 of the number of slots per level.
+#define EVENT_WHEEL_SLOTS	(1 << EVENT_WHEEL_BITS)		//!< Slots per level.
+
+/** Hierarchical timer wheel
+ *
+ * Each slot at level n covers 64^n ticks.  Timers are placed at the lowest level
+ * which can hold them, and are moved down a level (cascaded) when the start of their
+ * slot is reached.  Once a timer is due in the current tick it's moved into the lst,
+ * which orders it precisely against all other timers which are about to fire.
+ */
+typedef struct {
+	fr_time_delta_t		tick;			//!< Resolution of the wheel.
+	uint64_t		now;			//!< The tick the wheel has been advanced to.
+	uint64_t		num;			//!< Number of timers in the wheel.
+	uint64_t		pending[EVENT_WHEEL_LEVELS];	//!< Bitmap of non-empty slots for each level.
+	fr_dlist_head_t		slot[EVENT_WHEEL_LEVELS][EVENT_WHEEL_SLOTS];	//!< Timers in each slot.
+} fr_event_wheel_t;
+
 /** Stores all information relating to an event list
  *
  */
 struct fr_event_list {
 	fr_lst_t		*times;			//!< of timer events to be executed.
+	fr_event_wheel_t	*wheel;			//!< Optional timer wheel for timers which
+							///< aren't due yet.  Only timers in the
+							///< lst are ever run.
 	fr_rb_tree_t		*fds;			//!< Tree used to track FDs with filters in kqueue.
 
 	int			will_exit;		//!< Will exit on next call to fr_event_corral.
@@ -402,6 +457,14 @@ struct fr_event_list {
 
 	int			kq;			//!< instance associated with this event list.
 
+#ifdef WITH_EVENT_EPOLL
+	int			epfd;			//!< epoll instance used for socket I/O events.
+	bool			kq_pollable;		//!< el->kq is registered with epfd.  If false,
+							///< epfd is registered with el->kq instead.
+	struct epoll_event	ep_events[FR_EV_BATCH_FDS / 2];	//!< Scratch space for epoll_wait().
+							///< Each one may expand to two kevents.
+#endif
+
 	fr_dlist_head_t		pre_callbacks;		//!< callbacks when we may be idle...
 	fr_dlist_head_t		user_callbacks;		//!< EVFILT_USER callbacks
 	fr_dlist_head_t		post_callbacks;		//!< post-processing callbacks
@@ -585,7 +648,7 @@ uint64_t fr_event_list_num_timers(fr_event_list_t *el)
 {
 	if (unlikely(!el)) return -1;
 
-	return fr_lst_num_elements(el->times);
+	return fr_lst_num_elements(el->times) + (el->wheel ? el->wheel->num : 0);
 }
 
 /** Return the kq associated with an event list.
@@ -768,6 +831,58 @@ static ssize_t fr_event_build_evset(
 	return out - out_kev;
 }
 
+/** Push filter changes for a file descriptor to the kernel
+ *
+ * For most events this is just a call to kevent() with the evset produced
+ * by #fr_event_build_evset.  When the fd is managed by epoll, the evset is
+ * ignored, and the epoll registration is reconciled with the set of active
+ * functions instead.
+ *
+ * @param[in] el	the fd is registered with.
+ * @param[in] ef	whose filters changed.  ef->active must already reflect
+ *			the new state.
+ * @param[in] evset	produced by #fr_event_build_evset.
+ * @param[in] count	number of entries in evset.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure, with errno set.
+ */
+static int fr_event_fd_filters_apply(fr_event_list_t *el,
+#ifndef WITH_EVENT_EPOLL
+				      UNUSED
+#endif
+				      fr_event_fd_t *ef, struct kevent evset[], int count)
+{
+#ifdef WITH_EVENT_EPOLL
+	if (ef->use_epoll) {
+		struct epoll_event	ev = { .data.ptr = ef };
+		int			op;
+
+		if (ef->active.io.read && (ef->active.io.read != fr_event_fd_noop)) ev.events |= EPOLLIN | EPOLLRDHUP;
+		if (ef->active.io.write && (ef->active.io.write != fr_event_fd_noop)) ev.events |= EPOLLOUT;
+
+		if (ev.events == ef->epoll_events) return 0;
+
+		if (!ef->epoll_events) {
+			op = EPOLL_CTL_ADD;
+		} else if (!ev.events) {
+			op = EPOLL_CTL_DEL;
+		} else {
+			op = EPOLL_CTL_MOD;
+		}
+
+		if (epoll_ctl(el->epfd, op, ef->fd, &ev) < 0) return -1;
+
+		ef->epoll_events = ev.events;
+		return 0;
+	}
+#endif
+
+	if (!count) return 0;
+
+	return (kevent(el->kq, evset, count, NULL, 0, NULL) < 0) ? -1 : 0;
+}
+
 /** Discover the type of a file descriptor
  *
  * This function writes the result of the discovery to the ef->type,
@@ -857,13 +972,13 @@ static int _event_fd_delete(fr_event_fd_t *ef)
 		 */
 		count = fr_event_build_evset(el, evset, sizeof(evset)/sizeof(*evset),
 					     &ef->active, ef, &funcs, &ef->active);
-		if (count > 0) {
+		if (count >= 0) {
 			int ret;
 
 			/*
 			 *	If this fails, assert on debug builds.
 			 */
-			ret = kevent(el->kq, evset, count, NULL, 0, NULL);
+			ret = fr_event_fd_filters_apply(el, ef, evset, count);
 			if (!fr_cond_assert_msg(ret >= 0,
 						"FD %i was closed without being removed from the KQ: %s",
 						ef->fd, fr_syserror(errno))) {
@@ -1025,7 +1140,7 @@ int _fr_event_filter_update(NDEBUG_LOCATION_ARGS
 		return -1;
 	}
 
-	if (count && unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0)) {
+	if (unlikely(fr_event_fd_filters_apply(el, ef, evset, count) < 0)) {
 		fr_strerror_printf("Failed updating filters for FD %i: %s", ef->fd, fr_syserror(errno));
 		goto error;
 	}
@@ -1129,10 +1244,18 @@ int _fr_event_filter_insert(NDEBUG_LOCATION_ARGS
 		ef->map = &filter_maps[filter];
 		if (ef->map->idx_type == FR_EVENT_FUNC_IDX_NONE) goto not_supported;
 
+#ifdef WITH_EVENT_EPOLL
+		/*
+		 *	epoll refuses regular files, so those
+		 *	stay with kevent().
+		 */
+		ef->use_epoll = (filter == FR_EVENT_FILTER_IO) && (ef->type != FR_EVENT_FD_FILE);
+#endif
+
 		count = fr_event_build_evset(el, evset, sizeof(evset)/sizeof(*evset),
 					     &ef->active, ef, funcs, &ef->active);
 		if (count < 0) goto free;
-		if (count && (unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0))) {
+		if (unlikely(fr_event_fd_filters_apply(el, ef, evset, count) < 0)) {
 			fr_strerror_printf("Failed inserting filters for FD %i: %s", fd, fr_syserror(errno));
 			goto free;
 		}
@@ -1164,7 +1287,7 @@ int _fr_event_filter_insert(NDEBUG_LOCATION_ARGS
 			memcpy(&ef->active, &active, sizeof(ef->active));
 			return -1;
 		}
-		if (count && (unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0))) {
+		if (unlikely(fr_event_fd_filters_apply(el, ef, evset, count) < 0)) {
 			fr_strerror_printf("Failed modifying filters for FD %i: %s", fd, fr_syserror(errno));
 			goto error;
 		}
@@ -1356,6 +1479,199 @@ int fr_event_fd_unarmour(fr_event_list_t *el, int fd, fr_event_filter_t filter,
 }
 #endif
 
+/** Convert a time to a timer wheel tick
+ *
+ */
+static inline CC_HINT(always_inline) uint64_t event_wheel_tick(fr_event_wheel_t const *wheel, fr_time_t when)
+{
+	int64_t t = fr_time_unwrap(when);
+
+	if (t <= 0) return 0;
+
+	return (uint64_t)t / (uint64_t)fr_time_delta_unwrap(wheel->tick);
+}
+
+/** Insert a timer into the wheel, or into the lst if it's due soon
+ *
+ * Timers due in the current tick go straight into the lst, as do timers
+ * too far in the future for the top level of the wheel.
+ *
+ * @param[in] el	to insert the timer into.
+ * @param[in] ev	to insert.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int event_timer_insert(fr_event_list_t *el, fr_event_timer_t *ev)
+{
+	fr_event_wheel_t	*wheel = el->wheel;
+	uint64_t		expires, delta;
+	unsigned int		level, slot;
+
+	if (!wheel) return fr_lst_insert(el->times, ev);
+
+	expires = event_wheel_tick(wheel, ev->when);
+	if (expires <= wheel->now) return fr_lst_insert(el->times, ev);
+
+	delta = expires - wheel->now;
+	for (level = 0; level < EVENT_WHEEL_LEVELS; level++) {
+		if (delta < ((uint64_t)1 << (EVENT_WHEEL_BITS * (level + 1)))) break;
+	}
+	if (level == EVENT_WHEEL_LEVELS) return fr_lst_insert(el->times, ev);
+
+	slot = (expires >> (EVENT_WHEEL_BITS * level)) & (EVENT_WHEEL_SLOTS - 1);
+
+	ev->wheel_level = level;
+	ev->wheel_slot = slot;
+	fr_dlist_insert_tail(&wheel->slot[level][slot], ev);
+	wheel->pending[level] |= ((uint64_t)1 << slot);
+	wheel->num++;
+
+	return 0;
+}
+
+/** Remove a timer from the wheel or the lst
+ *
+ * @param[in] el	to remove the timer from.
+ * @param[in] ev	to remove.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the event wasn't found.
+ */
+static int event_timer_extract(fr_event_list_t *el, fr_event_timer_t *ev)
+{
+	fr_event_wheel_t	*wheel = el->wheel;
+	fr_dlist_head_t		*head;
+
+	if (!fr_dlist_entry_in_list(&ev->wheel_entry)) return fr_lst_extract(el->times, ev);
+
+	head = &wheel->slot[ev->wheel_level][ev->wheel_slot];
+	(void) fr_dlist_remove(head, ev);
+	if (fr_dlist_empty(head)) wheel->pending[ev->wheel_level] &= ~((uint64_t)1 << ev->wheel_slot);
+	wheel->num--;
+
+	return 0;
+}
+
+/** Return the next tick at which a slot in the wheel needs processing
+ *
+ * @param[in] wheel	to check.
+ * @return
+ *	- The tick.
+ *	- UINT64_MAX if the wheel is empty.
+ */
+static uint64_t event_wheel_next(fr_event_wheel_t const *wheel)
+{
+	uint64_t	next = UINT64_MAX;
+	unsigned int	level;
+
+	for (level = 0; level < EVENT_WHEEL_LEVELS; level++) {
+		uint64_t	pending = wheel->pending[level];
+		unsigned int	shift = EVENT_WHEEL_BITS * level;
+		uint64_t	block, tick;
+		unsigned int	idx;
+
+		if (!pending) continue;
+
+		/*
+		 *	Slots are processed at the start of their
+		 *	block, and the current block has already
+		 *	started, so look from the next one.
+		 *	Rotate so that its slot is bit 0.
+		 */
+		block = (wheel->now >> shift) + 1;
+		idx = block & (EVENT_WHEEL_SLOTS - 1);
+		if (idx) pending = (pending >> idx) | (pending << (EVENT_WHEEL_SLOTS - idx));
+
+		tick = (block + __builtin_ctzll(pending)) << shift;
+		if (tick < next) next = tick;
+	}
+
+	return next;
+}
+
+/** Move any timers which are due before the end of the tick containing "now" into the lst
+ *
+ * @param[in] el	to advance the wheel for.
+ * @param[in] now	time to advance to.
+ */
+static void event_wheel_advance(fr_event_list_t *el, fr_time_t now)
+{
+	fr_event_wheel_t	*wheel = el->wheel;
+	uint64_t		target = event_wheel_tick(wheel, now);
+	uint64_t		next;
+
+	while (wheel->num && ((next = event_wheel_next(wheel)) <= target)) {
+		unsigned int level;
+
+		wheel->now = next;
+
+		/*
+		 *	Cascade from the top down.  Timers from higher
+		 *	levels are re-inserted relative to the new
+		 *	"now", so they go into a lower level, or into
+		 *	the lst if they're due in this tick.
+		 */
+		for (level = EVENT_WHEEL_LEVELS; level-- > 0; ) {
+			unsigned int		shift = EVENT_WHEEL_BITS * level;
+			unsigned int		slot;
+			fr_dlist_head_t		*head;
+			fr_event_timer_t	*ev;
+
+			if (next & (((uint64_t)1 << shift) - 1)) continue;	/* Not the start of a block at this level */
+
+			slot = (next >> shift) & (EVENT_WHEEL_SLOTS - 1);
+			if (!(wheel->pending[level] & ((uint64_t)1 << slot))) continue;
+
+			wheel->pending[level] &= ~((uint64_t)1 << slot);
+			head = &wheel->slot[level][slot];
+
+			while ((ev = fr_dlist_pop_head(head))) {
+				wheel->num--;
+				if (unlikely(event_timer_insert(el, ev) < 0)) {
+					talloc_free(ev);
+					fr_assert_msg(0, "failed inserting lst event: %s", fr_strerror());	/* Die in debug builds */
+				}
+			}
+		}
+	}
+
+	if (target > wheel->now) wheel->now = target;
+}
+
+/** Return when the next timer event may be due
+ *
+ * For timers in the wheel this is the start of the tick they're due in,
+ * at which point they'll be moved into the lst.
+ *
+ * @param[in] el	to check.
+ * @param[out] when	the next timer event may be due.
+ * @return
+ *	- true if there are timer events.
+ *	- false if there are no timer events.
+ */
+static bool event_timer_next(fr_event_list_t *el, fr_time_t *when)
+{
+	fr_event_timer_t	*ev;
+	bool			found = false;
+
+	ev = fr_lst_peek(el->times);
+	if (ev) {
+		*when = ev->when;
+		found = true;
+	}
+
+	if (el->wheel && el->wheel->num) {
+		fr_time_t wheel_when;
+
+		wheel_when = fr_time_wrap(event_wheel_next(el->wheel) * fr_time_delta_unwrap(el->wheel->tick));
+		if (!found || fr_time_lt(wheel_when, *when)) *when = wheel_when;
+		found = true;
+	}
+
+	return found;
+}
+
 /** Remove an event from the event loop
  *
  * @param[in] ev	to free.
@@ -1371,7 +1687,7 @@ static int _event_timer_free(fr_event_timer_t *ev)
 	if (fr_dlist_entry_in_list(&ev->entry)) {
 		(void) fr_dlist_remove(&el->ev_to_add, ev);
 	} else {
-		int		ret = fr_lst_extract(el->times, ev);
+		int		ret = event_timer_extract(el, ev);
 		char const	*err_file = "not-available";
 		int		err_line = 0;
 
@@ -1490,7 +1806,7 @@ int _fr_event_timer_at(NDEBUG_LOCATION_ARGS
 			char const	*err_file = "not-available";
 			int		err_line = 0;
 
-			ret = fr_lst_extract(el->times, ev);
+			ret = event_timer_extract(el, ev);
 
 #ifndef NDEBUG
 			err_file = ev->file;
@@ -1525,7 +1841,7 @@ int _fr_event_timer_at(NDEBUG_LOCATION_ARGS
 		 *	multiple times.
 		 */
 		if (!fr_dlist_entry_in_list(&ev->entry)) fr_dlist_insert_head(&el->ev_to_add, ev);
-	} else if (unlikely(fr_lst_insert(el->times, ev) < 0)) {
+	} else if (unlikely(event_timer_insert(el, ev) < 0)) {
 		fr_strerror_const_push("Failed inserting event");
 		talloc_set_destructor(ev, NULL);
 		*ev_p = NULL;
@@ -2114,14 +2430,15 @@ int fr_event_timer_run(fr_event_list_t *el, fr_time_t *when)
 
 	if (unlikely(!el)) return 0;
 
-	if (fr_lst_num_elements(el->times) == 0) {
-		*when = fr_time_wrap(0);
-		return 0;
-	}
+	/*
+	 *	Pull in any timers from the wheel which
+	 *	are due in the current tick.
+	 */
+	if (el->wheel && el->wheel->num) event_wheel_advance(el, *when);
 
 	ev = fr_lst_peek(el->times);
 	if (!ev) {
-		*when = fr_time_wrap(0);
+		if (!event_timer_next(el, when)) *when = fr_time_wrap(0);
 		return 0;
 	}
 
@@ -2129,7 +2446,7 @@ int fr_event_timer_run(fr_event_list_t *el, fr_time_t *when)
 	 *	See if it's time to do this one.
 	 */
 	if (fr_time_gt(ev->when, *when)) {
-		*when = ev->when;
+		(void)event_timer_next(el, when);
 		return 0;
 	}
 
@@ -2148,6 +2465,110 @@ int fr_event_timer_run(fr_event_list_t *el, fr_time_t *when)
 	return 1;
 }
 
+#ifdef WITH_EVENT_EPOLL
+/** Wait for I/O events using epoll, translating them into kevents
+ *
+ * Events are written to el->events in the same format kevent() would have
+ * produced them, so #fr_event_service doesn't need to know which mechanism
+ * delivered them.  Any events the kqueue has pending are always appended,
+ * as the kqueue may not be able to wake us up.
+ *
+ * @param[in] el	to wait on.
+ * @param[in] ts_wake	how long to wait for, or NULL to wait forever.
+ * @return
+ *	- >= 0 the number of events written to el->events.
+ *	- -1 on error, with errno set.
+ */
+static int fr_event_epoll_wait(fr_event_list_t *el, struct timespec const *ts_wake)
+{
+	int		timeout, num, i, count = 0;
+
+	/*
+	 *	The kqueue can't be polled, so block in kevent(),
+	 *	which returns when the epoll fd is readable too.
+	 *	Then collect the socket events without waiting.
+	 */
+	if (!el->kq_pollable) {
+		num = kevent(el->kq, NULL, 0, el->events, FR_EV_BATCH_FDS / 2, ts_wake);
+		if (num < 0) return -1;
+
+		for (i = 0; i < num; i++) {
+			if ((el->events[i].filter == EVFILT_READ) && ((int)el->events[i].ident == el->epfd)) continue;
+
+			if (count != i) el->events[count] = el->events[i];
+			count++;
+		}
+
+		timeout = 0;
+
+	/*
+	 *	Round up so we never wake before the
+	 *	next timer is due, and then spin.
+	 */
+	} else if (!ts_wake) {
+		timeout = -1;
+	} else {
+		int64_t ms = (ts_wake->tv_sec * 1000) + ((ts_wake->tv_nsec + 999999) / 1000000);
+
+		timeout = (ms > INT_MAX) ? INT_MAX : (int)ms;
+	}
+
+	num = epoll_wait(el->epfd, el->ep_events, (FR_EV_BATCH_FDS - count) / 2, timeout);
+	if (num < 0) {
+		if (count && (errno == EINTR)) return count;
+		return -1;
+	}
+
+	for (i = 0; i < num; i++) {
+		struct epoll_event	*ep = &el->ep_events[i];
+		fr_event_fd_t		*ef;
+		uint16_t		flags = 0;
+		int			fd_errno = 0;
+
+		if (!ep->data.ptr) continue;	/* The kqueue, read below */
+
+		ef = ep->data.ptr;
+
+		/*
+		 *	kevent reports the pending socket
+		 *	error in fflags alongside EV_EOF.
+		 */
+		if (ep->events & EPOLLERR) {
+			socklen_t len = sizeof(fd_errno);
+
+			(void) getsockopt(ef->fd, SOL_SOCKET, SO_ERROR, &fd_errno, &len);
+			flags |= EV_EOF;
+		}
+		if (ep->events & (EPOLLHUP | EPOLLRDHUP)) flags |= EV_EOF;
+
+		if ((ep->events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && (ef->epoll_events & EPOLLIN)) {
+			EV_SET(&el->events[count++], ef->fd, EVFILT_READ, flags, fd_errno, 0, ef);
+		}
+
+		if ((ep->events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) && (ef->epoll_events & EPOLLOUT)) {
+			EV_SET(&el->events[count++], ef->fd, EVFILT_WRITE, flags, fd_errno, 0, ef);
+		}
+	}
+
+	/*
+	 *	User, PID and vnode events.  We can't rely on
+	 *	epoll telling us the kqueue is readable, as
+	 *	libkqueue may deliver some filters without
+	 *	the kqueue fd becoming readable.
+	 */
+	if (el->kq_pollable && (count < FR_EV_BATCH_FDS)) {
+		num = kevent(el->kq, NULL, 0, el->events + count, FR_EV_BATCH_FDS - count, &(struct timespec){ 0 });
+		if (num < 0) {
+			if (count && (errno == EINTR)) return count;
+			return -1;
+		}
+		count += num;
+	}
+
+	return count;
+}
+#endif
+
 /** Gather outstanding timer and file descriptor events
  *
  * @param[in] el	to process events for.
@@ -2164,7 +2585,7 @@ int fr_event_corral(fr_event_list_t *el, fr_time_t now, bool wait)
 	fr_event_pre_t		*pre;
 	int			num_fd_events;
 	bool			timer_event_ready = false;
-	fr_event_timer_t	*ev;
+	fr_time_t		next;
 
 	el->num_fd_events = 0;
 
@@ -2188,13 +2609,12 @@ int fr_event_corral(fr_event_list_t *el, fr_time_t now, bool wait)
 	 *	events are in the past.  Or, we wait for a future
 	 *	timer event.
 	 */
-	ev = fr_lst_peek(el->times);
-	if (ev) {
-		if (fr_time_lteq(ev->when, el->now)) {
+	if (event_timer_next(el, &next)) {
+		if (fr_time_lteq(next, el->now)) {
 			timer_event_ready = true;
 
 		} else if (wait) {
-			when = fr_time_sub(ev->when, el->now);
+			when = fr_time_sub(next, el->now);
 
 		} /* else we're not waiting, leave "when == 0" */
 
@@ -2242,7 +2662,11 @@ int fr_event_corral(fr_event_list_t *el, fr_time_t now, bool wait)
 	 *	that occurred since this function was last called
 	 *	or wait for the next timer event.
 	 */
+#ifdef WITH_EVENT_EPOLL
+	num_fd_events = fr_event_epoll_wait(el, ts_wake);
+#else
 	num_fd_events = kevent(el->kq, NULL, 0, el->events, FR_EV_BATCH_FDS, ts_wake);
+#endif
 
 	/*
 	 *	Interrupt is different from timeout / FD events.
@@ -2465,7 +2889,7 @@ void fr_event_service(fr_event_list_t *el)
 	 *	Run all of the timer events.  Note that these can add
 	 *	new timers!
 	 */
-	if (fr_lst_num_elements(el->times) > 0) {
+	if (fr_event_list_num_timers(el) > 0) {
 		el->in_handler = true;
 
 		do {
@@ -2491,7 +2915,7 @@ void fr_event_service(fr_event_list_t *el)
 	 */
 	while ((ev = fr_dlist_head(&el->ev_to_add)) != NULL) {
 		(void)fr_dlist_remove(&el->ev_to_add, ev);
-		if (unlikely(fr_lst_insert(el->times, ev) < 0)) {
+		if (unlikely(event_timer_insert(el, ev) < 0)) {
 			talloc_free(ev);
 			fr_assert_msg(0, "failed inserting lst event: %s", fr_strerror());	/* Die in debug builds */
 		}
@@ -2571,11 +2995,24 @@ static int _event_list_free(fr_event_list_t *el)
 
 	while ((ev = fr_lst_peek(el->times)) != NULL) fr_event_timer_delete(&ev);
 
+	if (el->wheel) {
+		unsigned int level, slot;
+
+		for (level = 0; level < EVENT_WHEEL_LEVELS; level++) {
+			for (slot = 0; slot < EVENT_WHEEL_SLOTS; slot++) {
+				while ((ev = fr_dlist_head(&el->wheel->slot[level][slot])) != NULL) fr_event_timer_delete(&ev);
+			}
+		}
+	}
+
 	fr_event_list_reap_signal(el, fr_time_delta_wrap(0), SIGKILL);
 
 	talloc_free_children(el);
 
 	if (el->kq >= 0) close(el->kq);
+#ifdef WITH_EVENT_EPOLL
+	if (el->epfd >= 0) close(el->epfd);
+#endif
 
 	return 0;
 }
@@ -2624,6 +3061,9 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 	}
 	el->time = fr_time;
 	el->kq = -1;	/* So destructor can be used before kqueue() provides us with fd */
+#ifdef WITH_EVENT_EPOLL
+	el->epfd = -1;
+#endif
 	talloc_set_destructor(el, _event_list_free);
 
 	el->times = fr_lst_talloc_alloc(el, fr_event_timer_cmp, fr_event_timer_t, lst_id, 0);
@@ -2646,6 +3086,34 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 		goto error;
 	}
 
+#ifdef WITH_EVENT_EPOLL
+	el->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (el->epfd < 0) {
+		fr_strerror_printf("Failed allocating epoll instance: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	/*
+	 *	If the kq is pollable, we get woken up for
+	 *	kevent() filters too.  A NULL data pointer
+	 *	identifies it.
+	 *
+	 *	Otherwise block in kevent(), and have it
+	 *	wake us up for socket events.
+	 */
+	if (epoll_ctl(el->epfd, EPOLL_CTL_ADD, el->kq, &(struct epoll_event){ .events = EPOLLIN }) == 0) {
+		el->kq_pollable = true;
+	} else {
+		struct kevent evset;
+
+		EV_SET(&evset, el->epfd, EVFILT_READ, EV_ADD, 0, 0, NULL);
+		if (kevent(el->kq, &evset, 1, NULL, 0, NULL) < 0) {
+			fr_strerror_printf("Failed adding epoll instance to kqueue: %s", fr_syserror(errno));
+			goto error;
+		}
+	}
+#endif
+
 	fr_dlist_talloc_init(&el->pre_callbacks, fr_event_pre_t, entry);
 	fr_dlist_talloc_init(&el->post_callbacks, fr_event_post_t, entry);
 	fr_dlist_talloc_init(&el->user_callbacks, fr_event_user_t, entry);
@@ -2678,6 +3146,78 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 void fr_event_list_set_time_func(fr_event_list_t *el, fr_event_time_source_t func)
 {
 	el->time = func;
+
+	/*
+	 *	The wheel's idea of the current tick came
+	 *	from the old time source, so rebuild it.
+	 */
+	if (el->wheel) {
+		fr_time_delta_t tick = el->wheel->tick;
+
+		(void) fr_event_list_set_timer_wheel(el, fr_time_delta_wrap(0));
+		(void) fr_event_list_set_timer_wheel(el, tick);
+	}
+}
+
+/** Use a hierarchical timer wheel for timers which aren't due yet
+ *
+ * Inserting and deleting timers in the wheel is O(1), instead of O(log n)
+ * for the lst.  This helps when there are many timers which are usually
+ * deleted or re-armed before they fire, such as request timeouts.
+ *
+ * Timers are moved from the wheel into the lst during the tick they're due,
+ * so they still fire in order, and at the time they were scheduled for.
+ *
+ * @param[in] el	to set the timer wheel for.
+ * @param[in] tick	Resolution of the wheel.  The wheel covers 64^4 ticks,
+ *			timers further out than that go into the lst.
+ *			0 disables the wheel, moving any timers it holds
+ *			into the lst.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_event_list_set_timer_wheel(fr_event_list_t *el, fr_time_delta_t tick)
+{
+	fr_event_wheel_t	*wheel;
+	unsigned int		level, slot;
+
+	if (el->wheel) {
+		fr_event_timer_t *ev;
+
+		wheel = el->wheel;
+		el->wheel = NULL;
+
+		for (level = 0; level < EVENT_WHEEL_LEVELS; level++) {
+			for (slot = 0; slot < EVENT_WHEEL_SLOTS; slot++) {
+				while ((ev = fr_dlist_pop_head(&wheel->slot[level][slot])) != NULL) {
+					if (unlikely(fr_lst_insert(el->times, ev) < 0)) {
+						talloc_free(ev);
+						fr_assert_msg(0, "failed inserting lst event: %s", fr_strerror());
+					}
+				}
+			}
+		}
+		talloc_free(wheel);
+	}
+
+	if (!fr_time_delta_ispos(tick)) return 0;
+
+	wheel = talloc_zero(el, fr_event_wheel_t);
+	if (unlikely(!wheel)) {
+		fr_strerror_const("Out of memory");
+		return -1;
+	}
+	wheel->tick = tick;
+	for (level = 0; level < EVENT_WHEEL_LEVELS; level++) {
+		for (slot = 0; slot < EVENT_WHEEL_SLOTS; slot++) {
+			fr_dlist_talloc_init(&wheel->slot[level][slot], fr_event_timer_t, wheel_entry);
+		}
+	}
+	el->wheel = wheel;
+	wheel->now = event_wheel_tick(wheel, el->time());
+
+	return 0;
 }
 
 /** Return whether the event loop has any active events
@@ -2685,7 +3225,7 @@ void fr_event_list_set_time_func(fr_event_list_t *el, fr_event_time_source_t fun
  */
 bool fr_event_list_empty(fr_event_list_t *el)
 {
-	return !fr_lst_num_elements(el->times) && !fr_rb_num_elements(el->fds);
+	return !fr_event_list_num_timers(el) && !fr_rb_num_elements(el->fds);
 }
 
 #ifdef WITH_EVENT_DEBUG
@@ -2725,6 +3265,39 @@ static int8_t event_timer_location_cmp(void const *one, void const *two)
 }
 
 
+/** Add a timer event to the report counters
+ *
+ */
+static int event_report_timer(fr_rb_tree_t *locations[], size_t array[], fr_event_timer_t const *ev, fr_time_t now)
+{
+	fr_time_delta_t diff = fr_time_sub(ev->when, now);
+	size_t		i;
+
+	for (i = 0; i < NUM_ELEMENTS(decades); i++) {
+		if (fr_time_delta_lteq(diff, decades[i]) || (i == NUM_ELEMENTS(decades) - 1)) {
+			fr_event_counter_t find = { .file = ev->file, .line = ev->line };
+			fr_event_counter_t *counter;
+
+			counter = fr_rb_find(locations[i], &find);
+			if (!counter) {
+				counter = talloc(locations[i], fr_event_counter_t);
+				if (!counter) return -1;
+				counter->file = ev->file;
+				counter->line = ev->line;
+				counter->count = 1;
+				fr_rb_insert(locations[i], counter);
+			} else {
+				counter->count++;
+			}
+
+			array[i]++;
+			break;
+		}
+	}
+
+	return 0;
+}
+
 /** Print out information about the number of events in the event loop
  *
  */
@@ -2759,27 +3332,19 @@ void fr_event_report(fr_event_list_t *el, fr_time_t now, void *uctx)
 	for (ev = fr_lst_iter_init(el->times, &iter);
 	     ev != NULL;
 	     ev = fr_lst_iter_next(el->times, &iter)) {
-		fr_time_delta_t diff = fr_time_sub(ev->when, now);
-
-		for (i = 0; i < NUM_ELEMENTS(decades); i++) {
-			if ((diff <= decades[i]) || (i == NUM_ELEMENTS(decades) - 1)) {
-				fr_event_counter_t find = { .file = ev->file, .line = ev->line };
-				fr_event_counter_t *counter;
-
-				counter = fr_rb_find(locations[i], &find);
-				if (!counter) {
-					counter = talloc(locations[i], fr_event_counter_t);
-					if (!counter) goto oom;
-					counter->file = ev->file;
-					counter->line = ev->line;
-					counter->count = 1;
-					fr_rb_insert(locations[i], counter);
-				} else {
-					counter->count++;
-				}
+		if (event_report_timer(locations, array, ev, now) < 0) goto oom;
+	}
 
-				array[i]++;
-				break;
+	if (el->wheel) {
+		unsigned int level, slot;
+
+		for (level = 0; level < EVENT_WHEEL_LEVELS; level++) {
+			for (slot = 0; slot < EVENT_WHEEL_SLOTS; slot++) {
+				fr_dlist_head_t *head = &el->wheel->slot[level][slot];
+
+				for (ev = fr_dlist_head(head); ev; ev = fr_dlist_next(head, ev)) {
+					if (event_report_timer(locations, array, ev, now) < 0) goto oom;
+				}
 			}
 		}
 	}
@@ -2838,11 +3403,29 @@ void fr_event_timer_dump(fr_event_list_t *el)
 			    ev->file, ev->line, ev, fr_time_unwrap(ev->when),
 			    fr_time_gt(now, ev->when) ? '<' : '>', ev->callback);
 	}
+
+	if (el->wheel) {
+		unsigned int level, slot;
+
+		for (level = 0; level < EVENT_WHEEL_LEVELS; level++) {
+			for (slot = 0; slot < EVENT_WHEEL_SLOTS; slot++) {
+				fr_dlist_head_t *head = &el->wheel->slot[level][slot];
+
+				for (ev = fr_dlist_head(head); ev; ev = fr_dlist_next(head, ev)) {
+					(void)talloc_get_type_abort(ev, fr_event_timer_t);
+					EVENT_DEBUG("%s[%u]: %p time=%" PRId64 " (wheel %u/%u), callback=%p",
+						    ev->file, ev->line, ev, fr_time_unwrap(ev->when),
+						    level, slot, ev->callback);
+				}
+			}
+		}
+	}
 }
 #endif
 #endif
 
 #ifdef TESTING
+#include <freeradius-devel/util/rand.h>
 
 /*
  *  cc -g -I .. -c rb.c -o rbtree.o && cc -g -I .. -c isaac.c -o isaac.o && cc -DTESTING -I .. -c event.c  -o event_mine.o && cc event_mine.o rbtree.o isaac.o -o event
@@ -2857,17 +3440,28 @@ void fr_event_timer_dump(fr_event_list_t *el)
  *  OR
  *
  *   valgrind --tool=memcheck --leak-check=full --show-reachable=yes ./event
+ *
+ *  OR
+ *
+ *   ./event -b
+ *
+ *  to measure the per-event cost of corralling and servicing I/O events.
+ *
+ *  OR
+ *
+ *   ./event -t
+ *
+ *  to measure the cost of arming, re-arming and running timers, with and
+ *  without the timer wheel.
  */
 
-static void print_time(void *ctx)
+static void print_time(UNUSED fr_event_list_t *el, fr_time_t now, UNUSED void *uctx)
 {
-	fr_time_t when;
 	int64_t usec;
 
-	when = *(fr_time_t *) ctx;
-	usec = fr_time_to_usec(when);
+	usec = fr_time_to_usec(now);
 
-	printf("%d.%06d\n", usec / USEC, usec % USEC);
+	printf("%" PRId64 ".%06" PRId64 "\n", usec / USEC, usec % USEC);
 	fflush(stdout);
 }
 
@@ -2887,16 +3481,175 @@ static uint32_t event_rand(void)
 }
 
 
+/*
+ *	Dispatch benchmark.
+ *
+ *	Registers a number of socketpairs with the event list, makes
+ *	all of them readable, and measures how long it takes to corral
+ *	and service the resulting events.  Build with and without
+ *	--without-epoll to compare the epoll and kevent paths.
+ */
+#define BENCH_PAIRS	128
+#define BENCH_ROUNDS	10000
+
+static void bench_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	uint64_t	*serviced = uctx;
+	uint8_t		buff[16];
+
+	if (read(fd, buff, sizeof(buff)) > 0) (*serviced)++;
+}
+
+static int dispatch_bench(void)
+{
+	fr_event_list_t	*el;
+	int		pairs[BENCH_PAIRS][2];
+	uint64_t	serviced = 0, expected = (uint64_t)BENCH_PAIRS * BENCH_ROUNDS;
+	fr_time_t	start;
+	fr_time_delta_t	elapsed;
+	int		i, round;
+
+	el = fr_event_list_alloc(NULL, NULL, NULL);
+	if (!el) return -1;
+
+	for (i = 0; i < BENCH_PAIRS; i++) {
+		if (socketpair(AF_UNIX, SOCK_DGRAM, 0, pairs[i]) < 0) {
+			fprintf(stderr, "socketpair failed: %s\n", fr_syserror(errno));
+			return -1;
+		}
+		if (fr_event_fd_insert(el, el, pairs[i][0], bench_read, NULL, NULL, &serviced) < 0) {
+			fr_perror("event");
+			return -1;
+		}
+	}
+
+	start = el->time();
+	for (round = 0; round < BENCH_ROUNDS; round++) {
+		for (i = 0; i < BENCH_PAIRS; i++) if (write(pairs[i][1], "x", 1) != 1) return -1;
+
+		while (serviced < ((uint64_t)(round + 1) * BENCH_PAIRS)) {
+			if (fr_event_corral(el, el->time(), false) < 0) return -1;
+			fr_event_service(el);
+		}
+	}
+	elapsed = fr_time_sub(el->time(), start);
+
+	printf("%s: %" PRIu64 " events in %" PRId64 " us, %" PRId64 " ns/event\n",
+#ifdef WITH_EVENT_EPOLL
+	       "epoll",
+#else
+	       "kevent",
+#endif
+	       expected, fr_time_delta_to_usec(elapsed), fr_time_delta_unwrap(elapsed) / (int64_t)expected);
+
+	talloc_free(el);
+	for (i = 0; i < BENCH_PAIRS; i++) {
+		close(pairs[i][0]);
+		close(pairs[i][1]);
+	}
+
+	return 0;
+}
+
+/*
+ *	Timer churn benchmark.
+ *
+ *	Arms a large number of timers due in 1-30 seconds, then re-arms
+ *	random ones, as happens with request timeouts and idle checks.
+ *	Finally the (fake) clock is run forward in 1ms steps until all
+ *	of the timers have fired.
+ */
+#define CHURN_TIMERS	200000
+#define CHURN_REARMS	2000000
+
+#undef fr_time		/* The event list clock is fake, so we need the real one to time things */
+
+static fr_time_t churn_now;
+
+static fr_time_t churn_time(void)
+{
+	return churn_now;
+}
+
+static void churn_fire(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	uint64_t	*fired = uctx;
+
+	(*fired)++;
+}
+
+static int churn_bench(fr_time_delta_t tick)
+{
+	fr_event_list_t		*el;
+	fr_event_timer_t const	**ev;
+	uint64_t		fired = 0;
+	fr_time_t		start, when;
+	fr_time_delta_t		insert, rearm, run;
+	int			i;
+
+	el = fr_event_list_alloc(NULL, NULL, NULL);
+	if (!el) return -1;
+
+	churn_now = fr_time_wrap(NSEC);
+	fr_event_list_set_time_func(el, churn_time);
+	if (fr_event_list_set_timer_wheel(el, tick) < 0) {
+		fr_perror("event");
+		return -1;
+	}
+
+	ev = talloc_zero_array(el, fr_event_timer_t const *, CHURN_TIMERS);
+	if (!ev) return -1;
+
+	start = fr_time();
+	for (i = 0; i < CHURN_TIMERS; i++) {
+		if (fr_event_timer_in(el, el, &ev[i], fr_time_delta_from_msec(1000 + (event_rand() % 29000)),
+				      churn_fire, &fired) < 0) return -1;
+	}
+	insert = fr_time_sub(fr_time(), start);
+
+	start = fr_time();
+	for (i = 0; i < CHURN_REARMS; i++) {
+		if (fr_event_timer_in(el, el, &ev[event_rand() % CHURN_TIMERS],
+				      fr_time_delta_from_msec(1000 + (event_rand() % 29000)),
+				      churn_fire, &fired) < 0) return -1;
+	}
+	rearm = fr_time_sub(fr_time(), start);
+
+	start = fr_time();
+	while (fr_event_list_num_timers(el) > 0) {
+		churn_now = fr_time_add(churn_now, fr_time_delta_from_msec(1));
+		do {
+			when = churn_now;
+		} while (fr_event_timer_run(el, &when) == 1);
+	}
+	run = fr_time_sub(fr_time(), start);
+
+	if (fired != CHURN_TIMERS) {
+		fprintf(stderr, "Expected %u timers to fire, got %" PRIu64 "\n", CHURN_TIMERS, fired);
+		return -1;
+	}
+
+	printf("%s: arm %" PRId64 " ns/timer, re-arm %" PRId64 " ns/timer, run %" PRId64 " ns/timer\n",
+	       fr_time_delta_ispos(tick) ? "wheel" : "lst",
+	       fr_time_delta_unwrap(insert) / CHURN_TIMERS,
+	       fr_time_delta_unwrap(rearm) / CHURN_REARMS,
+	       fr_time_delta_unwrap(run) / CHURN_TIMERS);
+
+	talloc_free(el);
+
+	return 0;
+}
+
 #define MAX 100
 int main(int argc, char **argv)
 {
-	int i, rcode;
+	int i;
 	fr_time_t array[MAX];
+	fr_event_timer_t const *ev[MAX];
 	fr_time_t now, when;
 	fr_event_list_t *el;
 
-	el = fr_event_list_alloc(NULL, NULL);
-	if (!el) fr_exit_now(1);
+	if ((argc > 1) && (strcmp(argv[1], "-b") == 0)) return (dispatch_bench() < 0) ? 1 : 0;
 
 	memset(&rand_pool, 0, sizeof(rand_pool));
 	rand_pool.randrsl[1] = time(NULL);
@@ -2904,19 +3657,28 @@ int main(int argc, char **argv)
 	fr_rand_init(&rand_pool, 1);
 	rand_pool.randcnt = 0;
 
+	if ((argc > 1) && (strcmp(argv[1], "-t") == 0)) {
+		if (churn_bench(fr_time_delta_wrap(0)) < 0) return 1;
+		if (churn_bench(fr_time_delta_from_msec(1)) < 0) return 1;
+		return 0;
+	}
+
+	el = fr_event_list_alloc(NULL, NULL, NULL);
+	if (!el) fr_exit_now(1);
+
 	array[0] = el->time();
 	for (i = 1; i < MAX; i++) {
-		array[i] = array[i - 1];
-		array[i] += event_rand() & 0xffff;
+		array[i] = fr_time_add(array[i - 1], fr_time_delta_wrap(event_rand() & 0xffff));
 
-		fr_event_timer_at(NULL, el, array[i], print_time, array[i]);
+		ev[i] = NULL;
+		fr_event_timer_at(NULL, el, &ev[i], array[i], print_time, NULL);
 	}
 
 	while (fr_event_list_num_timers(el)) {
 		now = el->time();
 		when = now;
 		if (!fr_event_timer_run(el, &when)) {
-			int delay = (when - now) / 1000;	/* nanoseconds to microseconds */
+			int delay = fr_time_delta_to_usec(fr_time_sub(when, now));
 
 			printf("\tsleep %d microseconds\n", delay);
 			fflush(stdout);
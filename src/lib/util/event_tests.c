@@ -0,0 +1,238 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for event lists
+ *
+ * On Linux socket events are delivered by epoll, and everything else by
+ * the kqueue.  These check that both kinds of event wake up a blocked
+ * event loop.
+ *
+ * @file src/lib/util/event_tests.c
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+static void test_init(void);
+#define TEST_INIT  test_init()
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/time.h>
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+typedef struct {
+	bool		user;		//!< User event fired.
+	bool		exited;		//!< Child exited.
+	bool		readable;	//!< Socket became readable.
+	bool		timeout;	//!< Nothing happened in time.
+} event_test_ctx_t;
+
+static void test_init(void)
+{
+	fr_time_start();
+}
+
+/** Run the event loop until one of our events, or the timeout, fires
+ *
+ */
+static void event_test_run(fr_event_list_t *el, event_test_ctx_t *ctx, bool const *done)
+{
+	while (!*done && !ctx->timeout) {
+		int num;
+
+		num = fr_event_corral(el, fr_time(), true);
+		TEST_CHECK(num >= 0);
+		if (num < 0) break;
+
+		fr_event_service(el);
+	}
+}
+
+static void _event_test_timeout(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	event_test_ctx_t *ctx = uctx;
+
+	ctx->timeout = true;
+}
+
+static void _event_test_user(UNUSED int kq, UNUSED struct kevent const *kev, void *uctx)
+{
+	event_test_ctx_t *ctx = uctx;
+
+	ctx->user = true;
+}
+
+typedef struct {
+	int		kq;
+	uintptr_t	ident;
+} event_test_trigger_t;
+
+static void *event_test_trigger(void *arg)
+{
+	event_test_trigger_t	*trigger = arg;
+	struct kevent		kev;
+
+	/*
+	 *	Give the event loop time to block.
+	 */
+	usleep(100 * 1000);
+
+	EV_SET(&kev, trigger->ident, EVFILT_USER, 0, NOTE_TRIGGER, 0, NULL);
+	(void) kevent(trigger->kq, &kev, 1, NULL, 0, NULL);
+
+	return NULL;
+}
+
+/** A user event triggered by another thread wakes up the event loop
+ *
+ */
+static void test_user_event(void)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("test");
+	fr_event_list_t		*el;
+	fr_event_timer_t const	*ev = NULL;
+	event_test_ctx_t	test = { 0 };
+	event_test_trigger_t	trigger;
+	struct kevent		kev;
+	pthread_t		thread;
+
+	el = fr_event_list_alloc(ctx, NULL, NULL);
+	TEST_CHECK(el != NULL);
+
+	trigger.kq = fr_event_list_kq(el);
+	trigger.ident = fr_event_user_insert(el, _event_test_user, &test);
+	TEST_CHECK(trigger.ident != 0);
+
+	EV_SET(&kev, trigger.ident, EVFILT_USER, EV_ADD | EV_CLEAR, NOTE_FFNOP, 0, NULL);
+	TEST_CHECK(kevent(trigger.kq, &kev, 1, NULL, 0, NULL) == 0);
+
+	TEST_CHECK(fr_event_timer_in(ctx, el, &ev, fr_time_delta_from_sec(5), _event_test_timeout, &test) == 0);
+
+	TEST_CHECK(pthread_create(&thread, NULL, event_test_trigger, &trigger) == 0);
+	event_test_run(el, &test, &test.user);
+	pthread_join(thread, NULL);
+
+	TEST_CHECK(test.user);
+	TEST_MSG("User event didn't fire");
+	TEST_CHECK(!test.timeout);
+
+	talloc_free(ctx);
+}
+
+static void _event_test_exited(UNUSED fr_event_list_t *el, UNUSED pid_t pid, UNUSED int status, void *uctx)
+{
+	event_test_ctx_t *ctx = uctx;
+
+	ctx->exited = true;
+}
+
+/** A child exiting wakes up the event loop
+ *
+ */
+static void test_proc_exit(void)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("test");
+	fr_event_list_t		*el;
+	fr_event_timer_t const	*ev = NULL;
+	event_test_ctx_t	test = { 0 };
+	pid_t			pid;
+
+	el = fr_event_list_alloc(ctx, NULL, NULL);
+	TEST_CHECK(el != NULL);
+
+	pid = fork();
+	TEST_ASSERT(pid >= 0);
+	if (pid == 0) {
+		usleep(100 * 1000);
+		_exit(3);
+	}
+
+	TEST_CHECK(fr_event_pid_wait(ctx, el, NULL, pid, _event_test_exited, &test) == 0);
+	TEST_CHECK(fr_event_timer_in(ctx, el, &ev, fr_time_delta_from_sec(5), _event_test_timeout, &test) == 0);
+
+	event_test_run(el, &test, &test.exited);
+
+	TEST_CHECK(test.exited);
+	TEST_MSG("PID event didn't fire");
+	TEST_CHECK(!test.timeout);
+
+	(void) waitpid(pid, NULL, WNOHANG);
+
+	talloc_free(ctx);
+}
+
+static void _event_test_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	event_test_ctx_t	*ctx = uctx;
+	char			buffer[16];
+
+	if (read(fd, buffer, sizeof(buffer)) > 0) ctx->readable = true;
+}
+
+static void *event_test_write(void *arg)
+{
+	int fd = *(int *)arg;
+
+	usleep(100 * 1000);
+	(void) write(fd, "x", 1);
+
+	return NULL;
+}
+
+/** A socket becoming readable wakes up the event loop
+ *
+ */
+static void test_socket_read(void)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("test");
+	fr_event_list_t		*el;
+	fr_event_timer_t const	*ev = NULL;
+	event_test_ctx_t	test = { 0 };
+	pthread_t		thread;
+	int			fds[2];
+
+	el = fr_event_list_alloc(ctx, NULL, NULL);
+	TEST_CHECK(el != NULL);
+
+	TEST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+	TEST_CHECK(fr_event_fd_insert(ctx, el, fds[0], _event_test_read, NULL, NULL, &test) == 0);
+	TEST_CHECK(fr_event_timer_in(ctx, el, &ev, fr_time_delta_from_sec(5), _event_test_timeout, &test) == 0);
+
+	TEST_CHECK(pthread_create(&thread, NULL, event_test_write, &fds[1]) == 0);
+	event_test_run(el, &test, &test.readable);
+	pthread_join(thread, NULL);
+
+	TEST_CHECK(test.readable);
+	TEST_MSG("Read event didn't fire");
+	TEST_CHECK(!test.timeout);
+
+	talloc_free(ctx);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+TEST_LIST = {
+	{ "user_event",		test_user_event },
+	{ "proc_exit",		test_proc_exit },
+	{ "socket_read",	test_socket_read },
+
+	{ NULL }
+};
@@ -0,0 +1,6 @@
+TARGET      := event_tests
+SOURCES     := event_tests.c
+
+TGT_LDLIBS  := $(LIBS) $(GPERFTOOLS_LIBS)
+TGT_LDFLAGS := $(LDFLAGS) $(GPERFTOOLS_LDFLAGS)
+TGT_PREREQS := libfreeradius-util.a
@@ -16,15 +16,21 @@
 
 /** Resizable hash tables
  *
- * The weird "reverse" function is based on an idea from
- * "Split-Ordered Lists - Lock-free Resizable Hash Tables", with
- * modifications so that they're not lock-free. :(
+ * Open addressing, with the slots split into groups of 16.  Each slot
+ * has a one byte "control" entry, which is either EMPTY, DELETED, or
+ * holds 7 bits of the (mixed) hash of the element in that slot.
  *
- * However, the split-order idea allows a fast & easy splitting of the
- * hash bucket chain when the hash table is resized.  Without it, we'd
- * have to check & update the pointers for every node in the buck chain,
- * rather than being able to move 1/2 of the entries in the chain with
- * one update.
+ * Lookups hash the key to a group, then compare the 7 bit tag against
+ * all 16 control bytes of the group at once (with SSE2 where available).
+ * Only slots with a matching tag have their full key and data compared,
+ * so in the common case a lookup touches one cache line of control bytes
+ * and one of keys.  If the group contains an EMPTY slot the search stops,
+ * otherwise we move onto the next group with triangular probing, which
+ * visits every group when the number of groups is a power of two.
+ *
+ * Keys, data pointers and control bytes are stored in separate arrays
+ * (in one allocation), so there's no per-element allocation, and the
+ * table is never modified by lookups.
  *
  * @file src/lib/util/hash.c
  *
@@ -34,24 +40,39 @@ RCSID("$Id$")
 
 #include <freeradius-devel/util/hash.h>
 
+#include <math.h>
+
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
 /*
- *	A reasonable number of buckets to start off with.
- *	Should be a power of two.
+ *	A reasonable number of slots to start off with.
+ *	Must be a power of two, and a multiple of FR_HASH_GROUP_SIZE.
  */
-#define FR_HASH_NUM_BUCKETS (64)
+#define FR_HASH_NUM_SLOTS	(32)
 
-struct fr_hash_entry_s {
-	fr_hash_entry_t 	*next;
-	uint32_t		reversed;
-	uint32_t		key;
-	void 			*data;
-};
+/*
+ *	Number of slots whose control bytes are checked together.
+ */
+#define FR_HASH_GROUP_SIZE	(16)
+
+#define HASH_CTRL_EMPTY		((uint8_t)0x80)		//!< Slot has never been used.
+#define HASH_CTRL_DELETED	((uint8_t)0xfe)		//!< Slot held an element which was removed.
+#define HASH_CTRL_IS_FULL(_c)	(((_c) & 0x80) == 0)	//!< Slot holds an element.
+
+#define HASH_SLOT_NONE		UINT32_MAX
+
+/*
+ *	Tables are grown when they're 7/8 full, counting DELETED slots.
+ */
+#define HASH_MAX_LOAD(_slots)	((_slots) - ((_slots) >> 3))
 
 struct fr_hash_table_s {
 	uint32_t		num_elements;	//!< Number of elements in the hash table.
-	uint32_t		num_buckets;	//!< Number of buckets (how long the array is) - power of 2 */
-	uint32_t		next_grow;
-	uint32_t		mask;
+	uint32_t		num_slots;	//!< Number of slots - power of 2, and at least one group.
+	uint32_t		group_mask;	//!< Number of groups - 1.
+	uint32_t		growth_left;	//!< How many EMPTY slots we can fill before growing.
 
 	fr_free_t		free;		//!< Data free function.
 	fr_hash_t		hash;		//!< Hashing function.
@@ -59,215 +80,118 @@ struct fr_hash_table_s {
 
 	char const		*type;		//!< Talloc type to check elements against.
 
-	fr_hash_entry_t		null;
-	fr_hash_entry_t		**buckets;	//!< Array of hash buckets.
+	uint8_t			*slots;		//!< Single allocation holding data, keys and ctrl.
+	void			**data;		//!< User data for each slot.
+	uint32_t		*keys;		//!< Unmixed key for each slot.
+	uint8_t			*ctrl;		//!< Control bytes for each slot.
 };
 
-#ifdef TESTING
-static int grow = 0;
-#endif
-
 /*
- * perl -e 'foreach $i (0..255) {$r = 0; foreach $j (0 .. 7 ) { if (($i & ( 1<< $j)) != 0) { $r |= (1 << (7 - $j));}} print $r, ", ";if (($i & 7) == 7) {print "\n";}}'
- */
-static const uint8_t reversed_byte[256] = {
-	0,  128, 64, 192, 32, 160, 96,  224,
-	16, 144, 80, 208, 48, 176, 112, 240,
-	8,  136, 72, 200, 40, 168, 104, 232,
-	24, 152, 88, 216, 56, 184, 120, 248,
-	4,  132, 68, 196, 36, 164, 100, 228,
-	20, 148, 84, 212, 52, 180, 116, 244,
-	12, 140, 76, 204, 44, 172, 108, 236,
-	28, 156, 92, 220, 60, 188, 124, 252,
-	2,  130, 66, 194, 34, 162, 98,  226,
-	18, 146, 82, 210, 50, 178, 114, 242,
-	10, 138, 74, 202, 42, 170, 106, 234,
-	26, 154, 90, 218, 58, 186, 122, 250,
-	6,  134, 70, 198, 38, 166, 102, 230,
-	22, 150, 86, 214, 54, 182, 118, 246,
-	14, 142, 78, 206, 46, 174, 110, 238,
-	30, 158, 94, 222, 62, 190, 126, 254,
-	1,  129, 65, 193, 33, 161, 97,  225,
-	17, 145, 81, 209, 49, 177, 113, 241,
-	9,  137, 73, 201, 41, 169, 105, 233,
-	25, 153, 89, 217, 57, 185, 121, 249,
-	5,  133, 69, 197, 37, 165, 101, 229,
-	21, 149, 85, 213, 53, 181, 117, 245,
-	13, 141, 77, 205, 45, 173, 109, 237,
-	29, 157, 93, 221, 61, 189, 125, 253,
-	3,  131, 67, 195, 35, 163, 99,  227,
-	19, 147, 83, 211, 51, 179, 115, 243,
-	11, 139, 75, 203, 43, 171, 107, 235,
-	27, 155, 91, 219, 59, 187, 123, 251,
-	7,  135, 71, 199, 39, 167, 103, 231,
-	23, 151, 87, 215, 55, 183, 119, 247,
-	15, 143, 79, 207, 47, 175, 111, 239,
-	31, 159, 95, 223, 63, 191, 127, 255
-};
-
+ *	Mix the bits of the key, so that the users hash functions
+ *	don't need to provide good distribution in both the high
+ *	bits (tag) and low bits (group).
+ *
+ *	This is the murmur3 32bit finaliser.
+ */
+static inline CC_HINT(always_inline) uint32_t hash_mix(uint32_t key)
+{
+	key ^= key >> 16;
+	key *= 0x85ebca6b;
+	key ^= key >> 13;
+	key *= 0xc2b2ae35;
+	key ^= key >> 16;
 
-/*
- * perl -e 'foreach $i (0..255) {$r = 0;foreach $j (0 .. 7) { $r = $i & (1 << (7 - $j)); last if ($r)} print $i & ~($r), ", ";if (($i & 7) == 7) {print "\n";}}'
- */
-static uint8_t parent_byte[256] = {
-	0, 0, 0, 1, 0, 1, 2, 3,
-	0, 1, 2, 3, 4, 5, 6, 7,
-	0, 1, 2, 3, 4, 5, 6, 7,
-	8, 9, 10, 11, 12, 13, 14, 15,
-	0, 1, 2, 3, 4, 5, 6, 7,
-	8, 9, 10, 11, 12, 13, 14, 15,
-	16, 17, 18, 19, 20, 21, 22, 23,
-	24, 25, 26, 27, 28, 29, 30, 31,
-	0, 1, 2, 3, 4, 5, 6, 7,
-	8, 9, 10, 11, 12, 13, 14, 15,
-	16, 17, 18, 19, 20, 21, 22, 23,
-	24, 25, 26, 27, 28, 29, 30, 31,
-	32, 33, 34, 35, 36, 37, 38, 39,
-	40, 41, 42, 43, 44, 45, 46, 47,
-	48, 49, 50, 51, 52, 53, 54, 55,
-	56, 57, 58, 59, 60, 61, 62, 63,
-	0, 1, 2, 3, 4, 5, 6, 7,
-	8, 9, 10, 11, 12, 13, 14, 15,
-	16, 17, 18, 19, 20, 21, 22, 23,
-	24, 25, 26, 27, 28, 29, 30, 31,
-	32, 33, 34, 35, 36, 37, 38, 39,
-	40, 41, 42, 43, 44, 45, 46, 47,
-	48, 49, 50, 51, 52, 53, 54, 55,
-	56, 57, 58, 59, 60, 61, 62, 63,
-	64, 65, 66, 67, 68, 69, 70, 71,
-	72, 73, 74, 75, 76, 77, 78, 79,
-	80, 81, 82, 83, 84, 85, 86, 87,
-	88, 89, 90, 91, 92, 93, 94, 95,
-	96, 97, 98, 99, 100, 101, 102, 103,
-	104, 105, 106, 107, 108, 109, 110, 111,
-	112, 113, 114, 115, 116, 117, 118, 119,
-	120, 121, 122, 123, 124, 125, 126, 127
-};
+	return key;
+}
 
+#define HASH_H1(_mixed)		((_mixed) & 0x01ffffff)	//!< Bits used to pick the first group.
+#define HASH_H2(_mixed)		((uint8_t)((_mixed) >> 25))	//!< 7 bit tag stored in the ctrl byte.
 
+#ifdef __SSE2__
 /*
- *	Reverse a key.
+ *	Return a bitmask of the slots in the group whose
+ *	control byte matches.
  */
-static uint32_t reverse(uint32_t key)
+static inline CC_HINT(always_inline) uint32_t group_match(uint8_t const *ctrl, uint8_t c)
 {
-	/*
-	 *	Cast to uint32_t is required because the
-	 *	default type of of the expression is an
-	 *	int and ubsan correctly complains that
-	 *	the result of 0xff << 24 won't fit in a
-	 *	signed 32bit integer.
-	 */
-	return (((uint32_t)reversed_byte[key & 0xff] << 24) |
-		((uint32_t)reversed_byte[(key >> 8) & 0xff] << 16) |
-		((uint32_t)reversed_byte[(key >> 16) & 0xff] << 8) |
-		((uint32_t)reversed_byte[(key >> 24) & 0xff]));
+	__m128i group = _mm_loadu_si128((__m128i const *)ctrl);
+
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)c)));
 }
 
 /*
- *	Take the parent by discarding the highest bit that is set.
+ *	EMPTY and DELETED have the high bit set, FULL slots don't,
+ *	so the sign bits are exactly the available slots.
  */
-static uint32_t parent_of(uint32_t key)
+static inline CC_HINT(always_inline) uint32_t group_match_available(uint8_t const *ctrl)
 {
-	if (key > 0x00ffffff)
-		return (key & 0x00ffffff) | (parent_byte[key >> 24] << 24);
-
-	if (key > 0x0000ffff)
-		return (key & 0x0000ffff) | (parent_byte[key >> 16] << 16);
+	return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((__m128i const *)ctrl));
+}
+#else
+static inline CC_HINT(always_inline) uint32_t group_match(uint8_t const *ctrl, uint8_t c)
+{
+	uint32_t	match = 0;
+	int		i;
 
-	if (key > 0x000000ff)
-		return (key & 0x000000ff) | (parent_byte[key >> 8] << 8);
+	for (i = 0; i < FR_HASH_GROUP_SIZE; i++) if (ctrl[i] == c) match |= (1 << i);
 
-	return parent_byte[key];
+	return match;
 }
 
-
-static fr_hash_entry_t *list_find(fr_hash_table_t *ht,
-				  fr_hash_entry_t *head, uint32_t reversed, void const *data)
+static inline CC_HINT(always_inline) uint32_t group_match_available(uint8_t const *ctrl)
 {
-	fr_hash_entry_t *cur;
+	uint32_t	match = 0;
+	int		i;
 
-	for (cur = head; cur != &ht->null; cur = cur->next) {
-		if (cur->reversed == reversed) {
-			if (ht->cmp) {
-				int cmp = ht->cmp(data, cur->data);
-				if (cmp > 0) break;
-				if (cmp < 0) continue;
-			}
-			return cur;
-		}
-		if (cur->reversed > reversed) break;
-	}
+	for (i = 0; i < FR_HASH_GROUP_SIZE; i++) if (!HASH_CTRL_IS_FULL(ctrl[i])) match |= (1 << i);
 
-	return NULL;
+	return match;
 }
-
+#endif
 
 /*
- *	Inserts a new entry into the list, in order.
+ *	Triangular probing, i.e. offsets of 0, 1, 3, 6, 10...
+ *	groups from the start.
  */
-static bool list_insert(fr_hash_table_t *ht,
-		        fr_hash_entry_t **head, fr_hash_entry_t *node)
-{
-	fr_hash_entry_t **last, *cur;
+#define HASH_GROUP_NEXT(_ht, _group, _probe)	(((_group) + (_probe)) & (_ht)->group_mask)
 
-	last = head;
+static int _fr_hash_table_free(fr_hash_table_t *ht)
+{
+	uint32_t i;
 
-	for (cur = *head; cur != &ht->null; cur = cur->next) {
-		if (cur->reversed > node->reversed) break;
-		last = &(cur->next);
+	if (ht->free) {
+		for (i = 0; i < ht->num_slots; i++) {
+			if (!HASH_CTRL_IS_FULL(ht->ctrl[i])) continue;
 
-		if (cur->reversed == node->reversed) {
-			if (ht->cmp) {
-				int8_t cmp = ht->cmp(node->data, cur->data);
-				if (cmp > 0) break;
-				if (cmp < 0) continue;
-			}
-			return false;
+			ht->free(ht->data[i]);
 		}
 	}
 
-	node->next = *last;
-	*last = node;
-
-	return true;
+	return 0;
 }
 
-
 /*
- *	Delete an entry from the list.
+ *	Allocate a new (empty) set of slots for the table.
+ *
+ *	Data pointers go first so that everything is naturally aligned.
  */
-static void list_delete(fr_hash_table_t *ht,
-			fr_hash_entry_t **head, fr_hash_entry_t *node)
+static int hash_table_slots_alloc(fr_hash_table_t *ht, uint32_t num_slots)
 {
-	fr_hash_entry_t **last, *cur;
+	uint8_t *slots;
 
-	last = head;
+	slots = talloc_array(ht, uint8_t, (size_t)num_slots * (sizeof(void *) + sizeof(uint32_t) + 1));
+	if (unlikely(!slots)) return -1;
 
-	for (cur = *head; cur != &ht->null; cur = cur->next) {
-		if (cur == node) break;
-		last = &(cur->next);
-	}
-
-	*last = node->next;
-}
+	ht->slots = slots;
+	ht->data = (void **)slots;
+	ht->keys = (uint32_t *)(slots + (num_slots * sizeof(void *)));
+	ht->ctrl = slots + (num_slots * (sizeof(void *) + sizeof(uint32_t)));
+	memset(ht->ctrl, HASH_CTRL_EMPTY, num_slots);
 
-static int _fr_hash_table_free(fr_hash_table_t *ht)
-{
-	uint32_t i;
-	fr_hash_entry_t *node, *next;
-
-	if (ht->free) {
-		for (i = 0; i < ht->num_buckets; i++) {
-			if (ht->buckets[i]) for (node = ht->buckets[i];
-						 node != &ht->null;
-						 node = next) {
-				next = node->next;
-				if (!node->data) continue; /* dummy entry */
-
-				ht->free(node->data);
-			}
-		}
-	}
+	ht->num_slots = num_slots;
+	ht->group_mask = (num_slots / FR_HASH_GROUP_SIZE) - 1;
+	ht->growth_left = HASH_MAX_LOAD(num_slots);
+	ht->num_elements = 0;
 
 	return 0;
 }
@@ -275,7 +199,8 @@ static int _fr_hash_table_free(fr_hash_table_t *ht)
 /*
  *	Create the table.
  *
- *	Memory usage in bytes is (20/3) * number of entries.
+ *	Memory usage in bytes is 13 per slot on 64bit systems,
+ *	which works out to between 15 and 30 bytes per entry.
  */
 fr_hash_table_t *_fr_hash_table_alloc(TALLOC_CTX *ctx,
 				      char const *type,
@@ -287,133 +212,138 @@ fr_hash_table_t *_fr_hash_table_alloc(TALLOC_CTX *ctx,
 
 	ht = talloc(ctx, fr_hash_table_t);
 	if (!ht) return NULL;
-	talloc_set_destructor(ht, _fr_hash_table_free);
 
 	*ht = (fr_hash_table_t){
 		.type = type,
 		.free = free_func,
 		.hash = hash_func,
-		.cmp = cmp_func,
-		.num_buckets = FR_HASH_NUM_BUCKETS,
-		.mask = FR_HASH_NUM_BUCKETS - 1,
-
-		/*
-		 *	Have a default load factor of 2.5.  In practice this
-		 *	means that the average load will hit 3 before the
-		 *	table grows.
-		 */
-		.next_grow = (FR_HASH_NUM_BUCKETS << 1) + (FR_HASH_NUM_BUCKETS >> 1),
-		.buckets = talloc_zero_array(ht, fr_hash_entry_t *, FR_HASH_NUM_BUCKETS)
+		.cmp = cmp_func
 	};
-	if (unlikely(!ht->buckets)) {
+	if (unlikely(hash_table_slots_alloc(ht, FR_HASH_NUM_SLOTS) < 0)) {
 		talloc_free(ht);
 		return NULL;
 	}
-
-	ht->null.reversed = ~0;
-	ht->null.key = ~0;
-	ht->null.next = &ht->null;
-	ht->buckets[0] = &ht->null;
+	talloc_set_destructor(ht, _fr_hash_table_free);
 
 	return ht;
 }
 
-
 /*
- *	If the current bucket is uninitialized, initialize it
- *	by recursively copying information from the parent.
- *
- *	We may have a situation where entry E is a parent to 2 other
- *	entries E' and E".  If we split E into E and E', then the
- *	nodes meant for E" end up in E or E', either of which is
- *	wrong.  To solve that problem, we walk down the whole chain,
- *	inserting the elements into the correct place.
+ *	Find the first EMPTY or DELETED slot in the probe sequence
+ *	for a key.  There's always one, as the table is never full.
  */
-static void fr_hash_table_fixup(fr_hash_table_t *ht, uint32_t entry)
+static inline CC_HINT(always_inline) uint32_t hash_table_find_available(fr_hash_table_t const *ht, uint32_t mixed)
 {
-	uint32_t parent_entry;
-	fr_hash_entry_t **last, *cur;
-	uint32_t this;
+	uint32_t group = HASH_H1(mixed) & ht->group_mask;
+	uint32_t probe;
 
-	parent_entry = parent_of(entry);
+	for (probe = 1; ; probe++) {
+		uint32_t match = group_match_available(ht->ctrl + (group * FR_HASH_GROUP_SIZE));
 
-	/* parent_entry == entry if and only if entry == 0 */
+		if (match) return (group * FR_HASH_GROUP_SIZE) + __builtin_ctz(match);
 
-	if (!ht->buckets[parent_entry]) {
-		fr_hash_table_fixup(ht, parent_entry);
+		group = HASH_GROUP_NEXT(ht, group, probe);
 	}
-
-	/*
-	 *	Keep walking down cur, trying to find entries that
-	 *	don't belong here any more.  There may be multiple
-	 *	ones, so we can't have a naive algorithm...
-	 */
-	last = &ht->buckets[parent_entry];
-	this = parent_entry;
-
-	for (cur = *last; cur != &ht->null; cur = cur->next) {
-		uint32_t real_entry;
-
-		real_entry = cur->key & ht->mask;
-		if (real_entry != this) { /* ht->buckets[real_entry] == NULL */
-			*last = &ht->null;
-			ht->buckets[real_entry] = cur;
-			this = real_entry;
-		}
-
-		last = &(cur->next);
-	}
-
-	/*
-	 *	We may NOT have initialized this bucket, so do it now.
-	 */
-	if (!ht->buckets[entry]) ht->buckets[entry] = &ht->null;
 }
 
 /*
- *	This should be a power of two.  Changing it to 4 doesn't seem
- *	to make any difference.
+ *	Place an element in the table without checking for duplicates
+ *	or whether the table needs to grow.
  */
-#define GROW_FACTOR (2)
+static inline CC_HINT(always_inline) void hash_table_slot_fill(fr_hash_table_t *ht, uint32_t key, void *data)
+{
+	uint32_t mixed = hash_mix(key);
+	uint32_t slot = hash_table_find_available(ht, mixed);
+
+	if (ht->ctrl[slot] == HASH_CTRL_EMPTY) ht->growth_left--;
+
+	ht->ctrl[slot] = HASH_H2(mixed);
+	ht->keys[slot] = key;
+	ht->data[slot] = data;
+	ht->num_elements++;
+}
 
 /*
- *	Grow the hash table.
+ *	Re-insert all elements into a new set of slots.
  */
-static void fr_hash_table_grow(fr_hash_table_t *ht)
+static int hash_table_resize(fr_hash_table_t *ht, uint32_t num_slots)
 {
-	fr_hash_entry_t **buckets;
-	size_t existing = talloc_get_size(ht->buckets);
+	uint8_t		*old_slots = ht->slots;
+	void		**old_data = ht->data;
+	uint32_t	*old_keys = ht->keys;
+	uint8_t		*old_ctrl = ht->ctrl;
+	uint32_t	old_num_slots = ht->num_slots;
+	uint32_t	i;
 
-	buckets = talloc_realloc(ht, ht->buckets, fr_hash_entry_t *, GROW_FACTOR * ht->num_buckets);
-	if (!buckets) return;
+	if (hash_table_slots_alloc(ht, num_slots) < 0) return -1;
 
-	memset(((uint8_t *)buckets) + existing, 0, talloc_get_size(buckets) - existing);
+	for (i = 0; i < old_num_slots; i++) {
+		if (!HASH_CTRL_IS_FULL(old_ctrl[i])) continue;
+
+		hash_table_slot_fill(ht, old_keys[i], old_data[i]);
+	}
+
+	talloc_free(old_slots);
 
-	ht->buckets = buckets;
-	ht->num_buckets *= GROW_FACTOR;
-	ht->next_grow *= GROW_FACTOR;
-	ht->mask = ht->num_buckets - 1;
 #ifdef TESTING
-	grow = 1;
-	fprintf(stderr, "GROW TO %d\n", ht->num_buckets);
+	fprintf(stderr, "RESIZE TO %u\n", ht->num_slots);
 #endif
+
+	return 0;
+}
+
+/*
+ *	Called when we've run out of EMPTY slots.
+ *
+ *	If a large fraction of the used slots are DELETED, then
+ *	rehashing at the same size is enough to get them back.
+ *	Otherwise double the size of the table.
+ */
+static int hash_table_grow(fr_hash_table_t *ht)
+{
+	if (ht->num_elements <= (HASH_MAX_LOAD(ht->num_slots) / 2)) return hash_table_resize(ht, ht->num_slots);
+
+	if (unlikely(ht->num_slots >= (UINT32_MAX / 2))) {
+		fr_strerror_const("Hash table is too large to grow");
+		return -1;
+	}
+
+	return hash_table_resize(ht, ht->num_slots * 2);
 }
 
 /*
- *	Internal find a node routine.
+ *	Internal find a slot routine.
  */
-static inline CC_HINT(always_inline) fr_hash_entry_t *hash_table_find(fr_hash_table_t *ht,
-									 uint32_t key, void const *data)
+static inline CC_HINT(always_inline) uint32_t hash_table_find(fr_hash_table_t const *ht,
+							       uint32_t key, void const *data)
 {
-	uint32_t entry;
-	uint32_t reversed;
+	uint32_t mixed = hash_mix(key);
+	uint8_t h2 = HASH_H2(mixed);
+	uint32_t group = HASH_H1(mixed) & ht->group_mask;
+	uint32_t probe;
+
+	for (probe = 1; probe <= (ht->group_mask + 1); probe++) {
+		uint8_t const	*ctrl = ht->ctrl + (group * FR_HASH_GROUP_SIZE);
+		uint32_t	match = group_match(ctrl, h2);
 
-	entry = key & ht->mask;
-	reversed = reverse(key);
+		while (match) {
+			uint32_t slot = (group * FR_HASH_GROUP_SIZE) + __builtin_ctz(match);
 
-	if (!ht->buckets[entry]) fr_hash_table_fixup(ht, entry);
+			if ((ht->keys[slot] == key) && (!ht->cmp || (ht->cmp(data, ht->data[slot]) == 0))) return slot;
 
-	return list_find(ht, ht->buckets[entry], reversed, data);
+			match &= match - 1;
+		}
+
+		/*
+		 *	An EMPTY slot means the element would have
+		 *	been inserted here if it existed.
+		 */
+		if (group_match(ctrl, HASH_CTRL_EMPTY)) break;
+
+		group = HASH_GROUP_NEXT(ht, group, probe);
+	}
+
+	return HASH_SLOT_NONE;
 }
 
 /** Find data in a hash table
@@ -427,12 +357,12 @@ static inline CC_HINT(always_inline) fr_hash_entry_t *hash_table_find(fr_hash_ta
  */
 void *fr_hash_table_find(fr_hash_table_t *ht, void const *data)
 {
-	fr_hash_entry_t *node;
+	uint32_t slot;
 
-	node = hash_table_find(ht, ht->hash(data), data);
-	if (!node) return NULL;
+	slot = hash_table_find(ht, ht->hash(data), data);
+	if (slot == HASH_SLOT_NONE) return NULL;
 
-	return UNCONST(void *, node->data);
+	return ht->data[slot];
 }
 
 /** Hash table lookup with pre-computed key
@@ -446,12 +376,12 @@ void *fr_hash_table_find(fr_hash_table_t *ht, void const *data)
  */
 void *fr_hash_table_find_by_key(fr_hash_table_t *ht, uint32_t key, void const *data)
 {
-	fr_hash_entry_t *node;
+	uint32_t slot;
 
-	node = hash_table_find(ht, key, data);
-	if (!node) return NULL;
+	slot = hash_table_find(ht, key, data);
+	if (slot == HASH_SLOT_NONE) return NULL;
 
-	return UNCONST(void *, node->data);
+	return ht->data[slot];
 }
 
 /** Insert data into a hash table
@@ -466,44 +396,19 @@ void *fr_hash_table_find_by_key(fr_hash_table_t *ht, uint32_t key, void const *d
 bool fr_hash_table_insert(fr_hash_table_t *ht, void const *data)
 {
 	uint32_t		key;
-	uint32_t		entry;
-	uint32_t		reversed;
-	fr_hash_entry_t		*node;
 
 #ifndef TALLOC_GET_TYPE_ABORT_NOOP
 	if (ht->type) (void)_talloc_get_type_abort(data, ht->type, __location__);
 #endif
 
 	key = ht->hash(data);
-	entry = key & ht->mask;
-	reversed = reverse(key);
-
-	if (!ht->buckets[entry]) fr_hash_table_fixup(ht, entry);
-
-	/*
-	 *	If we try to do our own memory allocation here, the
-	 *	speedup is only ~15% or so, which isn't worth it.
-	 */
-	node = talloc_zero(ht, fr_hash_entry_t);
-	if (unlikely(!node)) return false;
-
-	node->next = &ht->null;
-	node->reversed = reversed;
-	node->key = key;
-	node->data = UNCONST(void *, data);
 
 	/* already in the table, can't insert it */
-	if (!list_insert(ht, &ht->buckets[entry], node)) {
-		talloc_free(node);
-		return false;
-	}
+	if (hash_table_find(ht, key, data) != HASH_SLOT_NONE) return false;
 
-	/*
-	 *	Check the load factor, and grow the table if
-	 *	necessary.
-	 */
-	ht->num_elements++;
-	if (ht->num_elements >= ht->next_grow) fr_hash_table_grow(ht);
+	if ((ht->growth_left == 0) && (hash_table_grow(ht) < 0)) return false;
+
+	hash_table_slot_fill(ht, key, UNCONST(void *, data));
 
 	return true;
 }
@@ -524,21 +429,21 @@ bool fr_hash_table_insert(fr_hash_table_t *ht, void const *data)
  */
 int fr_hash_table_replace(void **old, fr_hash_table_t *ht, void const *data)
 {
-	fr_hash_entry_t *node;
+	uint32_t slot;
 
-	node = hash_table_find(ht, ht->hash(data), data);
-	if (!node) {
+	slot = hash_table_find(ht, ht->hash(data), data);
+	if (slot == HASH_SLOT_NONE) {
 		if (old) *old = NULL;
 		return fr_hash_table_insert(ht, data) ? 1 : -1;
 	}
 
 	if (old) {
-		*old = node->data;
+		*old = ht->data[slot];
 	} else if (ht->free) {
-		ht->free(node->data);
+		ht->free(ht->data[slot]);
 	}
 
-	node->data = UNCONST(void *, data);
+	ht->data[slot] = UNCONST(void *, data);
 
 	return 0;
 }
@@ -554,27 +459,29 @@ int fr_hash_table_replace(void **old, fr_hash_table_t *ht, void const *data)
  */
 void *fr_hash_table_remove(fr_hash_table_t *ht, void const *data)
 {
-	uint32_t		key;
-	uint32_t		entry;
-	uint32_t		reversed;
+	uint32_t		slot;
 	void			*old;
-	fr_hash_entry_t		*node;
-
-	key = ht->hash(data);
-	entry = key & ht->mask;
-	reversed = reverse(key);
 
-	if (!ht->buckets[entry]) fr_hash_table_fixup(ht, entry);
+	slot = hash_table_find(ht, ht->hash(data), data);
+	if (slot == HASH_SLOT_NONE) return NULL;
 
-	node = list_find(ht, ht->buckets[entry], reversed, data);
-	if (!node) return NULL;
+	old = ht->data[slot];
 
-	list_delete(ht, &ht->buckets[entry], node);
+	/*
+	 *	If the group still has an EMPTY slot, no probe
+	 *	sequence can have continued past it, so this slot
+	 *	can go straight back to EMPTY.  Otherwise leave
+	 *	a tombstone so later lookups keep probing.
+	 */
+	if (group_match(ht->ctrl + (slot & ~(FR_HASH_GROUP_SIZE - 1)), HASH_CTRL_EMPTY)) {
+		ht->ctrl[slot] = HASH_CTRL_EMPTY;
+		ht->growth_left++;
+	} else {
+		ht->ctrl[slot] = HASH_CTRL_DELETED;
+	}
+	ht->data[slot] = NULL;
 	ht->num_elements--;
 
-	old = node->data;
-	talloc_free(node);
-
 	return old;
 }
 
@@ -619,42 +526,15 @@ uint32_t fr_hash_table_num_elements(fr_hash_table_t *ht)
  */
 void *fr_hash_table_iter_next(fr_hash_table_t *ht, fr_hash_iter_t *iter)
 {
-	fr_hash_entry_t *node;
-	uint32_t	i;
-
-	/*
-	 *	Return the next element in the bucket
-	 */
-	if (iter->node != &ht->null) {
-		node = iter->node;
-		iter->node = node->next;
-
-		return node->data;
-	}
-
-	if (iter->bucket == 0) return NULL;
+	uint32_t i;
 
-	/*
-	 *	We might have to go through multiple empty
-	 *	buckets to find one that contains something
-	 *	we should return
-	 */
-	i = iter->bucket - 1;
-	for (;;) {
-		if (!ht->buckets[i]) fr_hash_table_fixup(ht, i);
-
-		node = ht->buckets[i];
-		if (node == &ht->null) {
-			if (i == 0) break;
-			i--;
-			continue;	/* This bucket was empty too... */
-		}
+	for (i = iter->slot; i < ht->num_slots; i++) {
+		if (!HASH_CTRL_IS_FULL(ht->ctrl[i])) continue;
 
-		iter->node = node->next;		/* Store the next one to examine */
-		iter->bucket = i;
-		return node->data;
+		iter->slot = i + 1;
+		return ht->data[i];
 	}
-	iter->bucket = i;
+	iter->slot = i;
 
 	return NULL;
 }
@@ -671,8 +551,7 @@ void *fr_hash_table_iter_next(fr_hash_table_t *ht, fr_hash_iter_t *iter)
  */
 void *fr_hash_table_iter_init(fr_hash_table_t *ht, fr_hash_iter_t *iter)
 {
-	iter->bucket = ht->num_buckets;
-	iter->node = &ht->null;
+	iter->slot = 0;
 
 	return fr_hash_table_iter_next(ht, iter);
 }
@@ -703,18 +582,15 @@ int fr_hash_table_flatten(TALLOC_CTX *ctx, void **out[], fr_hash_table_t *ht)
 	return 0;
 }
 
-/** Ensure all buckets are filled
+/** Prepare a table to be read by multiple threads
  *
- * This must be called if the table will be read by multiple threads without
- * synchronisation.  Synchronisation is still required for updates.
+ * Lookups never modify the table, so there's nothing to do.  Synchronisation
+ * is still required for updates.
  *
  * @param[in] ht	to fill.
  */
-void fr_hash_table_fill(fr_hash_table_t *ht)
+void fr_hash_table_fill(UNUSED fr_hash_table_t *ht)
 {
-	int i;
-
-	for (i = ht->num_buckets - 1; i >= 0; i--) if (!ht->buckets[i]) fr_hash_table_fixup(ht, i);
 }
 
 #ifdef TESTING
@@ -723,75 +599,51 @@ void fr_hash_table_fill(fr_hash_table_t *ht)
  */
 int fr_hash_table_info(fr_hash_table_t *ht)
 {
-	int i, a, collisions, uninitialized;
-	int array[256];
+	uint32_t	i, deleted = 0, total = 0, longest = 0;
+	uint32_t	array[16];
 
 	if (!ht) return 0;
 
-	uninitialized = collisions = 0;
 	memset(array, 0, sizeof(array));
 
-	for (i = 0; i < ht->num_buckets; i++) {
-		uint32_t key;
-		int load;
-		fr_hash_entry_t *node, *next;
+	for (i = 0; i < ht->num_slots; i++) {
+		uint32_t group, probes;
+
+		if (ht->ctrl[i] == HASH_CTRL_DELETED) deleted++;
+		if (!HASH_CTRL_IS_FULL(ht->ctrl[i])) continue;
 
 		/*
-		 *	If we haven't inserted or looked up an entry
-		 *	in a bucket, it's uninitialized.
+		 *	Count how many groups we have to look at
+		 *	to find this element.
 		 */
-		if (!ht->buckets[i]) {
-			uninitialized++;
-			continue;
-		}
-
-		load = 0;
-		key = ~0;
-		for (node = ht->buckets[i]; node != &ht->null; node = next) {
-			if (node->reversed == key) {
-				collisions++;
-			} else {
-				key = node->reversed;
-			}
-			next = node->next;
-			load++;
+		group = HASH_H1(hash_mix(ht->keys[i])) & ht->group_mask;
+		for (probes = 1; group != (i / FR_HASH_GROUP_SIZE); probes++) {
+			group = HASH_GROUP_NEXT(ht, group, probes);
 		}
 
-		if (load > 255) load = 255;
-		array[load]++;
+		total += probes;
+		if (probes > longest) longest = probes;
+		array[(probes < 15) ? probes : 15]++;
 	}
 
-	printf("HASH TABLE %p\tbuckets: %d\t(%d uninitialized)\n", ht,
-		ht->num_buckets, uninitialized);
-	printf("\tnum entries %d\thash collisions %d\n",
-		ht->num_elements, collisions);
+	printf("HASH TABLE %p\tslots: %u\t(%u deleted)\n", ht, ht->num_slots, deleted);
+	printf("\tnum entries %u\tload %f\n", ht->num_elements, (float) ht->num_elements / (float) ht->num_slots);
 
-	a = 0;
-	for (i = 1; i < 256; i++) {
+	for (i = 1; i < 16; i++) {
 		if (!array[i]) continue;
-		printf("%d\t%d\n", i, array[i]);
-
-		/*
-		 *	Since the entries are ordered, the lookup cost
-		 *	for any one element in a chain is (on average)
-		 *	the cost of walking half of the chain.
-		 */
-		if (i > 1) {
-			a += array[i] * i;
-		}
+		printf("%u\t%u\n", i, array[i]);
 	}
-	a /= 2;
-	a += array[1];
 
-	printf("\texpected lookup cost = %d/%d or %f\n\n",
-	       ht->num_elements, a,
-	       (float) ht->num_elements / (float) a);
+	printf("\texpected lookup cost = %f groups (longest %u)\n\n",
+	       ht->num_elements ? (float) total / (float) ht->num_elements : 0.0, longest);
 
 	return 0;
 }
 #endif
 
 
+
+
 #define FNV_MAGIC_INIT (0x811c9dc5)
 #define FNV_MAGIC_PRIME (0x01000193)
 
@@ -883,6 +735,89 @@ uint32_t fr_hash_case_string(char const *p)
 	return hash;
 }
 
+/** Mix a key and a node into a 64-bit score
+ *
+ * This is the splitmix64 finaliser.  FNV alone doesn't mix the high
+ * bits well enough for the scores to be independent.
+ */
+static inline uint64_t hash_rendezvous_mix(uint32_t key, uint32_t node)
+{
+	uint64_t x = (((uint64_t) key) << 32) | node;
+
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+
+	return x;
+}
+
+/** Pick a node for a key using weighted rendezvous hashing
+ *
+ * Each node is scored by mixing the key with the node's own hash, and
+ * the node with the highest score wins.  When a node is added or removed,
+ * the only keys which move are the ones that node wins, or won.  That's
+ * about 1/N of the keys, instead of nearly all of them with "hash % N".
+ *
+ * With weights, the score is weight / -ln(u), where u is the mixed
+ * hash mapped to (0,1).  Each node then gets a share of the keys in
+ * proportion to its weight.
+ *
+ * @param[in] key	hash of the key, e.g. from fr_hash().
+ * @param[in] nodes	hashes of the node names.  These must not depend on
+ *			the position of the node in the list.
+ * @param[in] weights	of the nodes.  May be NULL, in which case all of
+ *			the nodes have the same weight.  A weight of 0 is
+ *			treated as 1.
+ * @param[in] num	how many nodes there are.
+ * @return
+ *	- The index of the chosen node.
+ *	- -1 if there are no nodes.
+ */
+int fr_hash_rendezvous(uint32_t key, uint32_t const *nodes, uint32_t const *weights, int num)
+{
+	int	i, best = -1;
+	double	best_score = 0;
+
+	/*
+	 *	All of the weights are the same, so we don't need
+	 *	the logarithm.
+	 */
+	if (!weights) {
+		uint64_t best_mix = 0;
+
+		for (i = 0; i < num; i++) {
+			uint64_t mix = hash_rendezvous_mix(key, nodes[i]);
+
+			if ((best < 0) || (mix > best_mix)) {
+				best = i;
+				best_mix = mix;
+			}
+		}
+
+		return best;
+	}
+
+	for (i = 0; i < num; i++) {
+		double u, score;
+
+		/*
+		 *	53 bits is all a double can hold.  Adding 0.5
+		 *	means u is never 0 or 1.
+		 */
+		u = ((double) (hash_rendezvous_mix(key, nodes[i]) >> 11) + 0.5) / 9007199254740992.0;
+		score = (double) (weights[i] ? weights[i] : 1) / -log(u);
+
+		if ((best < 0) || (score > best_score)) {
+			best = i;
+			best_score = score;
+		}
+	}
+
+	return best;
+}
+
 /** Check hash table is sane
  *
  */
@@ -890,11 +825,22 @@ void fr_hash_table_verify(fr_hash_table_t *ht)
 {
 	fr_hash_iter_t	iter;
 	void		*ptr;
+	uint32_t	i, used = 0, num = 0;
 
 	(void)talloc_get_type_abort(ht, fr_hash_table_t);
-	(void)talloc_get_type_abort(ht->buckets, fr_hash_entry_t *);
+	(void)talloc_get_type_abort(ht->slots, uint8_t);
+
+	fr_assert(talloc_array_length(ht->slots) == (ht->num_slots * (sizeof(void *) + sizeof(uint32_t) + 1)));
+	fr_assert(((ht->group_mask + 1) * FR_HASH_GROUP_SIZE) == ht->num_slots);
 
-	fr_assert(talloc_array_length(ht->buckets) == ht->num_buckets);
+	for (i = 0; i < ht->num_slots; i++) {
+		if (ht->ctrl[i] == HASH_CTRL_EMPTY) continue;
+
+		used++;
+		if (HASH_CTRL_IS_FULL(ht->ctrl[i])) num++;
+	}
+	fr_assert(num == ht->num_elements);
+	fr_assert((used + ht->growth_left) == HASH_MAX_LOAD(ht->num_slots));
 
 	/*
 	 *	Check talloc headers on all data
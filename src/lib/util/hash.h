@@ -32,15 +32,13 @@ extern "C" {
 #include <stddef.h>
 #include <stdint.h>
 
-typedef struct fr_hash_entry_s fr_hash_entry_t;
 typedef	uint32_t (*fr_hash_t)(void const *);
 
 /** Stores the state of the current iteration operation
  *
  */
 typedef struct fr_hash_iter_s {
-	uint32_t		bucket;
-	fr_hash_entry_t		*node;
+	uint32_t		slot;		//!< Next slot to examine.
 } fr_hash_iter_t;
 
 /*
@@ -52,6 +50,8 @@ uint32_t fr_hash_update(void const *data, size_t size, uint32_t hash);
 uint32_t fr_hash_string(char const *p);
 uint32_t fr_hash_case_string(char const *p);
 
+int fr_hash_rendezvous(uint32_t key, uint32_t const *nodes, uint32_t const *weights, int num);
+
 typedef struct fr_hash_table_s fr_hash_table_t;
 typedef int (*fr_hash_table_walk_t)(void *data, void *uctx);
 
@@ -0,0 +1,481 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for hash tables, and rendezvous hashing
+ *
+ * Only the public API is used, so the benchmarks can be built against
+ * other implementations of fr_hash_table_t for comparison.
+ *
+ * @file src/lib/util/hash_tests.c
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/rand.h>
+#include <freeradius-devel/util/time.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/rb.h>
+
+typedef struct {
+	uint32_t	num;
+	bool		visited;	/* Only used by iterator test */
+	fr_rb_node_t	node;		/* Only used by the benchmark */
+} hash_thing;
+
+static uint32_t hash_thing_hash(void const *data)
+{
+	hash_thing const *a = data;
+
+	return fr_hash(&a->num, sizeof(a->num));
+}
+
+/*
+ *	Every element has the same key, so every
+ *	lookup has to fall back to the cmp function.
+ */
+static uint32_t hash_thing_hash_collide(UNUSED void const *data)
+{
+	return 42;
+}
+
+static int8_t hash_thing_cmp(void const *one, void const *two)
+{
+	hash_thing const *a = one, *b = two;
+
+	return CMP(a->num, b->num);
+}
+
+static hash_thing *populate_values(unsigned int len)
+{
+	hash_thing	*values;
+	unsigned int	i;
+	fr_fast_rand_t	rand_ctx;
+
+	values = talloc_zero_array(NULL, hash_thing, len);
+
+	rand_ctx.a = fr_rand();
+	rand_ctx.b = fr_rand();
+
+	/*
+	 *	Random, but unique, values
+	 */
+	for (i = 0; i < len; i++) values[i].num = (fr_fast_rand(&rand_ctx) & 0xffff0000) | i;
+
+	return values;
+}
+
+static void hash_test_basic(void)
+{
+	fr_hash_table_t	*ht;
+	hash_thing	*values, other;
+	unsigned int	i;
+	unsigned int	count = 10000;
+
+	values = populate_values(count);
+	ht = fr_hash_table_alloc(NULL, hash_thing_hash, hash_thing_cmp, NULL);
+	TEST_CHECK(ht != NULL);
+
+	for (i = 0; i < count; i++) {
+		TEST_CHECK(fr_hash_table_insert(ht, &values[i]));
+		TEST_MSG("failed inserting %u", i);
+	}
+	TEST_CHECK(fr_hash_table_num_elements(ht) == count);
+	fr_hash_table_verify(ht);
+
+	for (i = 0; i < count; i++) {
+		other.num = values[i].num;
+
+		TEST_CHECK(fr_hash_table_find(ht, &other) == &values[i]);
+		TEST_MSG("failed finding %u", i);
+
+		TEST_CHECK(fr_hash_table_find_by_key(ht, hash_thing_hash(&other), &other) == &values[i]);
+		TEST_MSG("failed finding %u by key", i);
+
+		TEST_CHECK(!fr_hash_table_insert(ht, &other));
+		TEST_MSG("duplicate %u was inserted", i);
+	}
+	TEST_CHECK(fr_hash_table_num_elements(ht) == count);
+
+	for (i = 0; i < count; i += 2) {
+		TEST_CHECK(fr_hash_table_remove(ht, &values[i]) == &values[i]);
+		TEST_MSG("failed removing %u", i);
+	}
+	TEST_CHECK(fr_hash_table_num_elements(ht) == count / 2);
+	fr_hash_table_verify(ht);
+
+	for (i = 0; i < count; i++) {
+		TEST_CHECK((fr_hash_table_find(ht, &values[i]) != NULL) == (i & 0x01));
+		TEST_MSG("wrong result for %u after removing even entries", i);
+	}
+
+	talloc_free(ht);
+	talloc_free(values);
+}
+
+static void hash_test_collisions(void)
+{
+	fr_hash_table_t	*ht;
+	hash_thing	*values;
+	unsigned int	i;
+	unsigned int	count = 200;
+
+	values = populate_values(count);
+	ht = fr_hash_table_alloc(NULL, hash_thing_hash_collide, hash_thing_cmp, NULL);
+	TEST_CHECK(ht != NULL);
+
+	for (i = 0; i < count; i++) TEST_CHECK(fr_hash_table_insert(ht, &values[i]));
+	fr_hash_table_verify(ht);
+
+	for (i = 0; i < count; i++) {
+		TEST_CHECK(fr_hash_table_find(ht, &values[i]) == &values[i]);
+		TEST_MSG("failed finding %u", i);
+	}
+
+	for (i = 0; i < count; i += 3) TEST_CHECK(fr_hash_table_delete(ht, &values[i]));
+	fr_hash_table_verify(ht);
+
+	for (i = 0; i < count; i++) {
+		TEST_CHECK((fr_hash_table_find(ht, &values[i]) != NULL) == ((i % 3) != 0));
+		TEST_MSG("wrong result for %u after removing every third entry", i);
+	}
+
+	talloc_free(ht);
+	talloc_free(values);
+}
+
+static void hash_test_replace(void)
+{
+	fr_hash_table_t	*ht;
+	hash_thing	a = { .num = 1 }, b = { .num = 1 };
+	void		*old;
+
+	ht = fr_hash_table_alloc(NULL, hash_thing_hash, hash_thing_cmp, NULL);
+	TEST_CHECK(ht != NULL);
+
+	TEST_CHECK(fr_hash_table_replace(&old, ht, &a) == 1);
+	TEST_CHECK(old == NULL);
+	TEST_CHECK(fr_hash_table_replace(&old, ht, &b) == 0);
+	TEST_CHECK(old == &a);
+	TEST_CHECK(fr_hash_table_find(ht, &a) == &b);
+	TEST_CHECK(fr_hash_table_num_elements(ht) == 1);
+
+	talloc_free(ht);
+}
+
+static void hash_test_iter(void)
+{
+	fr_hash_table_t	*ht;
+	fr_hash_iter_t	iter;
+	hash_thing	*values, *p;
+	void		**flat;
+	unsigned int	i, seen = 0;
+	unsigned int	count = 1000;
+
+	values = populate_values(count);
+	ht = fr_hash_table_alloc(NULL, hash_thing_hash, hash_thing_cmp, NULL);
+	TEST_CHECK(ht != NULL);
+
+	for (i = 0; i < count; i++) fr_hash_table_insert(ht, &values[i]);
+
+	for (p = fr_hash_table_iter_init(ht, &iter);
+	     p;
+	     p = fr_hash_table_iter_next(ht, &iter)) {
+		TEST_CHECK(!p->visited);
+		TEST_MSG("%u visited twice", p->num);
+		p->visited = true;
+		seen++;
+	}
+	TEST_CHECK(seen == count);
+
+	TEST_CHECK(fr_hash_table_flatten(NULL, &flat, ht) == 0);
+	TEST_CHECK(talloc_array_length(flat) == count);
+	talloc_free(flat);
+
+	talloc_free(ht);
+	talloc_free(values);
+}
+
+/*
+ *	Lots of inserts and deletes with a small live set.
+ *	The table shouldn't grow without bound.
+ */
+static void hash_test_churn(void)
+{
+	fr_hash_table_t	*ht;
+	hash_thing	*values;
+	unsigned int	i;
+	unsigned int	count = 100000, live = 100;
+	size_t		size;
+
+	values = populate_values(count);
+	ht = fr_hash_table_alloc(NULL, hash_thing_hash, hash_thing_cmp, NULL);
+	TEST_CHECK(ht != NULL);
+
+	for (i = 0; i < live; i++) TEST_CHECK(fr_hash_table_insert(ht, &values[i]));
+	size = talloc_total_size(ht);
+
+	for (i = live; i < count; i++) {
+		TEST_CHECK(fr_hash_table_remove(ht, &values[i - live]) == &values[i - live]);
+		TEST_CHECK(fr_hash_table_insert(ht, &values[i]));
+		TEST_CHECK(fr_hash_table_find(ht, &values[i - (live / 2)]) == &values[i - (live / 2)]);
+	}
+	TEST_CHECK(fr_hash_table_num_elements(ht) == live);
+	fr_hash_table_verify(ht);
+
+	TEST_CHECK(talloc_total_size(ht) <= (size * 2));
+	TEST_MSG("table grew from %zu to %zu bytes with constant number of elements", size, talloc_total_size(ht));
+
+	talloc_free(ht);
+	talloc_free(values);
+}
+
+#define RENDEZVOUS_KEYS (100000)
+
+static void rendezvous_assign(int *out, uint32_t const *keys, uint32_t const *nodes, uint32_t const *weights, int num)
+{
+	int i;
+
+	for (i = 0; i < RENDEZVOUS_KEYS; i++) out[i] = fr_hash_rendezvous(keys[i], nodes, weights, num);
+}
+
+/*
+ *	Adding or removing a node should only move the keys
+ *	which that node wins, or won.  That's about 1/N of them.
+ */
+static void hash_test_rendezvous(void)
+{
+	uint32_t	*keys;
+	uint32_t	nodes[11], fewer[10];
+	int		*before, *after;
+	int		i, j, moved, modulo_moved, count[11];
+	char		name[32];
+
+	keys = talloc_array(NULL, uint32_t, RENDEZVOUS_KEYS);
+	before = talloc_array(NULL, int, RENDEZVOUS_KEYS);
+	after = talloc_array(NULL, int, RENDEZVOUS_KEYS);
+
+	for (i = 0; i < RENDEZVOUS_KEYS; i++) {
+		snprintf(name, sizeof(name), "user%d@example.org", i);
+		keys[i] = fr_hash_string(name);
+	}
+
+	for (i = 0; i < 11; i++) {
+		snprintf(name, sizeof(name), "sql%d", i);
+		nodes[i] = fr_hash_string(name);
+	}
+
+	TEST_CHECK(fr_hash_rendezvous(keys[0], nodes, NULL, 0) == -1);
+
+	/*
+	 *	Ten nodes, each should get about 1/10 of the keys.
+	 */
+	rendezvous_assign(before, keys, nodes, NULL, 10);
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < RENDEZVOUS_KEYS; i++) count[before[i]]++;
+	for (i = 0; i < 10; i++) {
+		TEST_CHECK((count[i] > (RENDEZVOUS_KEYS / 10) * 9 / 10) && (count[i] < (RENDEZVOUS_KEYS / 10) * 11 / 10));
+		TEST_MSG("node %d has %d keys", i, count[i]);
+	}
+
+	/*
+	 *	Add an eleventh node.  Every key which moves must move
+	 *	to the new node.
+	 */
+	rendezvous_assign(after, keys, nodes, NULL, 11);
+	moved = modulo_moved = 0;
+	for (i = 0; i < RENDEZVOUS_KEYS; i++) {
+		if ((keys[i] % 10) != (keys[i] % 11)) modulo_moved++;
+		if (before[i] == after[i]) continue;
+
+		moved++;
+		TEST_CHECK(after[i] == 10);
+		TEST_MSG("key %d moved from %d to %d", i, before[i], after[i]);
+	}
+	TEST_CHECK((moved > RENDEZVOUS_KEYS / 15) && (moved < RENDEZVOUS_KEYS / 8));
+	TEST_MSG_ALWAYS("\nadding 1 to 10 nodes moved %.1f%% of keys, \"hash %% N\" moves %.1f%%\n",
+			(100.0 * moved) / RENDEZVOUS_KEYS, (100.0 * modulo_moved) / RENDEZVOUS_KEYS);
+
+	/*
+	 *	Remove the fourth node.  Only its keys should move, and
+	 *	the order of the other nodes doesn't matter.
+	 */
+	for (i = 0, j = 0; i < 10; i++) {
+		if (i == 3) continue;
+		fewer[j++] = nodes[i];
+	}
+	rendezvous_assign(after, keys, fewer, NULL, 9);
+	moved = 0;
+	for (i = 0; i < RENDEZVOUS_KEYS; i++) {
+		if (before[i] == 3) {
+			moved++;
+			continue;
+		}
+
+		TEST_CHECK(fewer[after[i]] == nodes[before[i]]);
+		TEST_MSG("key %d moved from %d, but its node wasn't removed", i, before[i]);
+	}
+	TEST_CHECK(moved == count[3]);
+	TEST_MSG_ALWAYS("removing 1 of 10 nodes moved %.1f%% of keys\n", (100.0 * moved) / RENDEZVOUS_KEYS);
+
+	talloc_free(keys);
+	talloc_free(before);
+	talloc_free(after);
+}
+
+/*
+ *	A node with twice the weight should get twice the keys.
+ */
+static void hash_test_rendezvous_weights(void)
+{
+	uint32_t	nodes[4], weights[4] = { 2, 1, 1, 0 };
+	int		i, count[4] = { 0 };
+	char		name[32];
+
+	for (i = 0; i < 4; i++) {
+		snprintf(name, sizeof(name), "ldap%d", i);
+		nodes[i] = fr_hash_string(name);
+	}
+
+	for (i = 0; i < RENDEZVOUS_KEYS; i++) {
+		snprintf(name, sizeof(name), "user%d@example.org", i);
+		count[fr_hash_rendezvous(fr_hash_string(name), nodes, weights, 4)]++;
+	}
+
+	/*
+	 *	Weights are 2:1:1:1, so 40% and 20% each.
+	 */
+	TEST_CHECK((count[0] > RENDEZVOUS_KEYS * 37 / 100) && (count[0] < RENDEZVOUS_KEYS * 43 / 100));
+	TEST_MSG("node 0 has %d keys", count[0]);
+	for (i = 1; i < 4; i++) {
+		TEST_CHECK((count[i] > RENDEZVOUS_KEYS * 18 / 100) && (count[i] < RENDEZVOUS_KEYS * 22 / 100));
+		TEST_MSG("node %d has %d keys", i, count[i]);
+	}
+}
+
+static void hash_cmp(unsigned int count)
+{
+	fr_hash_table_t	*ht;
+	fr_rb_tree_t	*tree;
+	hash_thing	*values;
+	unsigned int	i;
+
+	values = populate_values(count);
+
+	/*
+	 *	Check times for hash table insert, find, delete
+	 */
+	{
+		fr_time_t	start_insert, end_insert, start_find, end_find, start_delete, end_delete;
+		size_t		size;
+
+		ht = fr_hash_table_alloc(NULL, hash_thing_hash, hash_thing_cmp, NULL);
+		TEST_CHECK(ht != NULL);
+
+		start_insert = fr_time();
+		for (i = 0; i < count; i++) fr_hash_table_insert(ht, &values[i]);
+		end_insert = fr_time();
+
+		size = talloc_total_size(ht);
+
+		start_find = fr_time();
+		for (i = 0; i < count; i++) TEST_CHECK(fr_hash_table_find(ht, &values[i]) != NULL);
+		end_find = fr_time();
+
+		start_delete = fr_time();
+		for (i = 0; i < count; i++) TEST_CHECK(fr_hash_table_delete(ht, &values[i]));
+		end_delete = fr_time();
+
+		TEST_MSG_ALWAYS("\nhash size: %u\n", count);
+		TEST_MSG_ALWAYS("insert: %"PRIu64" μs\n", fr_time_delta_unwrap(fr_time_sub(end_insert, start_insert)) / 1000);
+		TEST_MSG_ALWAYS("find: %"PRIu64" μs\n", fr_time_delta_unwrap(fr_time_sub(end_find, start_find)) / 1000);
+		TEST_MSG_ALWAYS("delete: %"PRIu64" μs\n", fr_time_delta_unwrap(fr_time_sub(end_delete, start_delete)) / 1000);
+		TEST_MSG_ALWAYS("memory: %.1f bytes/entry\n", (double)size / count);
+
+		talloc_free(ht);
+	}
+
+	/*
+	 *	Check times for rbtree insert, find, delete
+	 */
+	{
+		fr_time_t	start_insert, end_insert, start_find, end_find, start_delete, end_delete;
+		size_t		size;
+
+		tree = fr_rb_inline_alloc(NULL, hash_thing, node, hash_thing_cmp, NULL);
+		TEST_CHECK(tree != NULL);
+
+		start_insert = fr_time();
+		for (i = 0; i < count; i++) fr_rb_insert(tree, &values[i]);
+		end_insert = fr_time();
+
+		size = talloc_total_size(tree) + (count * sizeof(fr_rb_node_t));
+
+		start_find = fr_time();
+		for (i = 0; i < count; i++) TEST_CHECK(fr_rb_find(tree, &values[i]) != NULL);
+		end_find = fr_time();
+
+		start_delete = fr_time();
+		for (i = 0; i < count; i++) TEST_CHECK(fr_rb_delete(tree, &values[i]));
+		end_delete = fr_time();
+
+		TEST_MSG_ALWAYS("\nrbtree size: %u\n", count);
+		TEST_MSG_ALWAYS("insert: %"PRIu64" μs\n", fr_time_delta_unwrap(fr_time_sub(end_insert, start_insert)) / 1000);
+		TEST_MSG_ALWAYS("find: %"PRIu64" μs\n", fr_time_delta_unwrap(fr_time_sub(end_find, start_find)) / 1000);
+		TEST_MSG_ALWAYS("delete: %"PRIu64" μs\n", fr_time_delta_unwrap(fr_time_sub(end_delete, start_delete)) / 1000);
+		TEST_MSG_ALWAYS("memory: %.1f bytes/entry\n", (double)size / count);
+
+		talloc_free(tree);
+	}
+
+	talloc_free(values);
+}
+
+static void hash_cmp_100(void)
+{
+	hash_cmp(100);
+}
+
+static void hash_cmp_10000(void)
+{
+	hash_cmp(10000);
+}
+
+static void hash_cmp_1000000(void)
+{
+	hash_cmp(1000000);
+}
+
+TEST_LIST = {
+	/*
+	 *	Basic tests
+	 */
+	{ "hash_test_basic",		hash_test_basic },
+	{ "hash_test_collisions",	hash_test_collisions },
+	{ "hash_test_replace",		hash_test_replace },
+	{ "hash_test_iter",		hash_test_iter },
+	{ "hash_test_churn",		hash_test_churn },
+	{ "hash_test_rendezvous",	hash_test_rendezvous },
+	{ "hash_test_rendezvous_weights", hash_test_rendezvous_weights },
+
+	/*
+	 *	Benchmarks
+	 */
+	{ "hash_cmp_100",		hash_cmp_100 },
+	{ "hash_cmp_10000",		hash_cmp_10000 },
+	{ "hash_cmp_1000000",		hash_cmp_1000000 },
+	{ NULL }
+};
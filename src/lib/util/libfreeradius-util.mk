@@ -16,6 +16,7 @@ SOURCES		:= \
 		   dbuff.c \
 		   dcursor.c \
 		   debug.c \
+		   dict_cache.c \
 		   dict_ext.c \
 		   dict_fixup.c \
 		   dict_print.c \
@@ -63,6 +64,7 @@ SOURCES		:= \
 		   proto.c \
 		   rand.c \
 		   rb.c \
+		   rcu.c \
 		   regex.c \
 		   retry.c \
 		   sbuff.c \
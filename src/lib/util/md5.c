@@ -248,6 +248,81 @@ static const uint8_t PADDING[MD5_BLOCK_LENGTH] = {
 /* This is the central step in the MD5 algorithm. */
 #define MD5STEP(f, w, x, y, z, data, s) (w += f(x, y, z) + data, w = w << s | w >> (32 - s),  w += x)
 
+/** The 64 MD5 steps, shared by the scalar and the multi-buffer transforms
+ *
+ * The working variables and input words can be uint32_t, or vectors of
+ * uint32_t, in which case each lane is a separate message.
+ */
+#define MD5_ROUNDS(_a, _b, _c, _d, _in) do { \
+	MD5STEP(MD5_F1, _a, _b, _c, _d, _in[ 0] + 0xd76aa478,  7); \
+	MD5STEP(MD5_F1, _d, _a, _b, _c, _in[ 1] + 0xe8c7b756, 12); \
+	MD5STEP(MD5_F1, _c, _d, _a, _b, _in[ 2] + 0x242070db, 17); \
+	MD5STEP(MD5_F1, _b, _c, _d, _a, _in[ 3] + 0xc1bdceee, 22); \
+	MD5STEP(MD5_F1, _a, _b, _c, _d, _in[ 4] + 0xf57c0faf,  7); \
+	MD5STEP(MD5_F1, _d, _a, _b, _c, _in[ 5] + 0x4787c62a, 12); \
+	MD5STEP(MD5_F1, _c, _d, _a, _b, _in[ 6] + 0xa8304613, 17); \
+	MD5STEP(MD5_F1, _b, _c, _d, _a, _in[ 7] + 0xfd469501, 22); \
+	MD5STEP(MD5_F1, _a, _b, _c, _d, _in[ 8] + 0x698098d8,  7); \
+	MD5STEP(MD5_F1, _d, _a, _b, _c, _in[ 9] + 0x8b44f7af, 12); \
+	MD5STEP(MD5_F1, _c, _d, _a, _b, _in[10] + 0xffff5bb1, 17); \
+	MD5STEP(MD5_F1, _b, _c, _d, _a, _in[11] + 0x895cd7be, 22); \
+	MD5STEP(MD5_F1, _a, _b, _c, _d, _in[12] + 0x6b901122,  7); \
+	MD5STEP(MD5_F1, _d, _a, _b, _c, _in[13] + 0xfd987193, 12); \
+	MD5STEP(MD5_F1, _c, _d, _a, _b, _in[14] + 0xa679438e, 17); \
+	MD5STEP(MD5_F1, _b, _c, _d, _a, _in[15] + 0x49b40821, 22); \
+	\
+	MD5STEP(MD5_F2, _a, _b, _c, _d, _in[ 1] + 0xf61e2562,  5); \
+	MD5STEP(MD5_F2, _d, _a, _b, _c, _in[ 6] + 0xc040b340,  9); \
+	MD5STEP(MD5_F2, _c, _d, _a, _b, _in[11] + 0x265e5a51, 14); \
+	MD5STEP(MD5_F2, _b, _c, _d, _a, _in[ 0] + 0xe9b6c7aa, 20); \
+	MD5STEP(MD5_F2, _a, _b, _c, _d, _in[ 5] + 0xd62f105d,  5); \
+	MD5STEP(MD5_F2, _d, _a, _b, _c, _in[10] + 0x02441453,  9); \
+	MD5STEP(MD5_F2, _c, _d, _a, _b, _in[15] + 0xd8a1e681, 14); \
+	MD5STEP(MD5_F2, _b, _c, _d, _a, _in[ 4] + 0xe7d3fbc8, 20); \
+	MD5STEP(MD5_F2, _a, _b, _c, _d, _in[ 9] + 0x21e1cde6,  5); \
+	MD5STEP(MD5_F2, _d, _a, _b, _c, _in[14] + 0xc33707d6,  9); \
+	MD5STEP(MD5_F2, _c, _d, _a, _b, _in[ 3] + 0xf4d50d87, 14); \
+	MD5STEP(MD5_F2, _b, _c, _d, _a, _in[ 8] + 0x455a14ed, 20); \
+	MD5STEP(MD5_F2, _a, _b, _c, _d, _in[13] + 0xa9e3e905,  5); \
+	MD5STEP(MD5_F2, _d, _a, _b, _c, _in[ 2] + 0xfcefa3f8,  9); \
+	MD5STEP(MD5_F2, _c, _d, _a, _b, _in[ 7] + 0x676f02d9, 14); \
+	MD5STEP(MD5_F2, _b, _c, _d, _a, _in[12] + 0x8d2a4c8a, 20); \
+	\
+	MD5STEP(MD5_F3, _a, _b, _c, _d, _in[ 5] + 0xfffa3942,  4); \
+	MD5STEP(MD5_F3, _d, _a, _b, _c, _in[ 8] + 0x8771f681, 11); \
+	MD5STEP(MD5_F3, _c, _d, _a, _b, _in[11] + 0x6d9d6122, 16); \
+	MD5STEP(MD5_F3, _b, _c, _d, _a, _in[14] + 0xfde5380c, 23); \
+	MD5STEP(MD5_F3, _a, _b, _c, _d, _in[ 1] + 0xa4beea44,  4); \
+	MD5STEP(MD5_F3, _d, _a, _b, _c, _in[ 4] + 0x4bdecfa9, 11); \
+	MD5STEP(MD5_F3, _c, _d, _a, _b, _in[ 7] + 0xf6bb4b60, 16); \
+	MD5STEP(MD5_F3, _b, _c, _d, _a, _in[10] + 0xbebfbc70, 23); \
+	MD5STEP(MD5_F3, _a, _b, _c, _d, _in[13] + 0x289b7ec6,  4); \
+	MD5STEP(MD5_F3, _d, _a, _b, _c, _in[ 0] + 0xeaa127fa, 11); \
+	MD5STEP(MD5_F3, _c, _d, _a, _b, _in[ 3] + 0xd4ef3085, 16); \
+	MD5STEP(MD5_F3, _b, _c, _d, _a, _in[ 6] + 0x04881d05, 23); \
+	MD5STEP(MD5_F3, _a, _b, _c, _d, _in[ 9] + 0xd9d4d039,  4); \
+	MD5STEP(MD5_F3, _d, _a, _b, _c, _in[12] + 0xe6db99e5, 11); \
+	MD5STEP(MD5_F3, _c, _d, _a, _b, _in[15] + 0x1fa27cf8, 16); \
+	MD5STEP(MD5_F3, _b, _c, _d, _a, _in[ 2] + 0xc4ac5665, 23); \
+	\
+	MD5STEP(MD5_F4, _a, _b, _c, _d, _in[ 0] + 0xf4292244,  6); \
+	MD5STEP(MD5_F4, _d, _a, _b, _c, _in[ 7] + 0x432aff97, 10); \
+	MD5STEP(MD5_F4, _c, _d, _a, _b, _in[14] + 0xab9423a7, 15); \
+	MD5STEP(MD5_F4, _b, _c, _d, _a, _in[ 5] + 0xfc93a039, 21); \
+	MD5STEP(MD5_F4, _a, _b, _c, _d, _in[12] + 0x655b59c3,  6); \
+	MD5STEP(MD5_F4, _d, _a, _b, _c, _in[ 3] + 0x8f0ccc92, 10); \
+	MD5STEP(MD5_F4, _c, _d, _a, _b, _in[10] + 0xffeff47d, 15); \
+	MD5STEP(MD5_F4, _b, _c, _d, _a, _in[ 1] + 0x85845dd1, 21); \
+	MD5STEP(MD5_F4, _a, _b, _c, _d, _in[ 8] + 0x6fa87e4f,  6); \
+	MD5STEP(MD5_F4, _d, _a, _b, _c, _in[15] + 0xfe2ce6e0, 10); \
+	MD5STEP(MD5_F4, _c, _d, _a, _b, _in[ 6] + 0xa3014314, 15); \
+	MD5STEP(MD5_F4, _b, _c, _d, _a, _in[13] + 0x4e0811a1, 21); \
+	MD5STEP(MD5_F4, _a, _b, _c, _d, _in[ 4] + 0xf7537e82,  6); \
+	MD5STEP(MD5_F4, _d, _a, _b, _c, _in[11] + 0xbd3af235, 10); \
+	MD5STEP(MD5_F4, _c, _d, _a, _b, _in[ 2] + 0x2ad7d2bb, 15); \
+	MD5STEP(MD5_F4, _b, _c, _d, _a, _in[ 9] + 0xeb86d391, 21); \
+} while (0)
+
 /** The core of the MD5 algorithm
  *
  * This alters an existing MD5 hash to reflect the addition of 16
@@ -276,73 +351,7 @@ static void fr_md5_local_transform(uint32_t state[static 4], uint8_t const block
 	c = state[2];
 	d = state[3];
 
-	MD5STEP(MD5_F1, a, b, c, d, in[ 0] + 0xd76aa478,  7);
-	MD5STEP(MD5_F1, d, a, b, c, in[ 1] + 0xe8c7b756, 12);
-	MD5STEP(MD5_F1, c, d, a, b, in[ 2] + 0x242070db, 17);
-	MD5STEP(MD5_F1, b, c, d, a, in[ 3] + 0xc1bdceee, 22);
-	MD5STEP(MD5_F1, a, b, c, d, in[ 4] + 0xf57c0faf,  7);
-	MD5STEP(MD5_F1, d, a, b, c, in[ 5] + 0x4787c62a, 12);
-	MD5STEP(MD5_F1, c, d, a, b, in[ 6] + 0xa8304613, 17);
-	MD5STEP(MD5_F1, b, c, d, a, in[ 7] + 0xfd469501, 22);
-	MD5STEP(MD5_F1, a, b, c, d, in[ 8] + 0x698098d8,  7);
-	MD5STEP(MD5_F1, d, a, b, c, in[ 9] + 0x8b44f7af, 12);
-	MD5STEP(MD5_F1, c, d, a, b, in[10] + 0xffff5bb1, 17);
-	MD5STEP(MD5_F1, b, c, d, a, in[11] + 0x895cd7be, 22);
-	MD5STEP(MD5_F1, a, b, c, d, in[12] + 0x6b901122,  7);
-	MD5STEP(MD5_F1, d, a, b, c, in[13] + 0xfd987193, 12);
-	MD5STEP(MD5_F1, c, d, a, b, in[14] + 0xa679438e, 17);
-	MD5STEP(MD5_F1, b, c, d, a, in[15] + 0x49b40821, 22);
-
-	MD5STEP(MD5_F2, a, b, c, d, in[ 1] + 0xf61e2562,  5);
-	MD5STEP(MD5_F2, d, a, b, c, in[ 6] + 0xc040b340,  9);
-	MD5STEP(MD5_F2, c, d, a, b, in[11] + 0x265e5a51, 14);
-	MD5STEP(MD5_F2, b, c, d, a, in[ 0] + 0xe9b6c7aa, 20);
-	MD5STEP(MD5_F2, a, b, c, d, in[ 5] + 0xd62f105d,  5);
-	MD5STEP(MD5_F2, d, a, b, c, in[10] + 0x02441453,  9);
-	MD5STEP(MD5_F2, c, d, a, b, in[15] + 0xd8a1e681, 14);
-	MD5STEP(MD5_F2, b, c, d, a, in[ 4] + 0xe7d3fbc8, 20);
-	MD5STEP(MD5_F2, a, b, c, d, in[ 9] + 0x21e1cde6,  5);
-	MD5STEP(MD5_F2, d, a, b, c, in[14] + 0xc33707d6,  9);
-	MD5STEP(MD5_F2, c, d, a, b, in[ 3] + 0xf4d50d87, 14);
-	MD5STEP(MD5_F2, b, c, d, a, in[ 8] + 0x455a14ed, 20);
-	MD5STEP(MD5_F2, a, b, c, d, in[13] + 0xa9e3e905,  5);
-	MD5STEP(MD5_F2, d, a, b, c, in[ 2] + 0xfcefa3f8,  9);
-	MD5STEP(MD5_F2, c, d, a, b, in[ 7] + 0x676f02d9, 14);
-	MD5STEP(MD5_F2, b, c, d, a, in[12] + 0x8d2a4c8a, 20);
-
-	MD5STEP(MD5_F3, a, b, c, d, in[ 5] + 0xfffa3942,  4);
-	MD5STEP(MD5_F3, d, a, b, c, in[ 8] + 0x8771f681, 11);
-	MD5STEP(MD5_F3, c, d, a, b, in[11] + 0x6d9d6122, 16);
-	MD5STEP(MD5_F3, b, c, d, a, in[14] + 0xfde5380c, 23);
-	MD5STEP(MD5_F3, a, b, c, d, in[ 1] + 0xa4beea44,  4);
-	MD5STEP(MD5_F3, d, a, b, c, in[ 4] + 0x4bdecfa9, 11);
-	MD5STEP(MD5_F3, c, d, a, b, in[ 7] + 0xf6bb4b60, 16);
-	MD5STEP(MD5_F3, b, c, d, a, in[10] + 0xbebfbc70, 23);
-	MD5STEP(MD5_F3, a, b, c, d, in[13] + 0x289b7ec6,  4);
-	MD5STEP(MD5_F3, d, a, b, c, in[ 0] + 0xeaa127fa, 11);
-	MD5STEP(MD5_F3, c, d, a, b, in[ 3] + 0xd4ef3085, 16);
-	MD5STEP(MD5_F3, b, c, d, a, in[ 6] + 0x04881d05, 23);
-	MD5STEP(MD5_F3, a, b, c, d, in[ 9] + 0xd9d4d039,  4);
-	MD5STEP(MD5_F3, d, a, b, c, in[12] + 0xe6db99e5, 11);
-	MD5STEP(MD5_F3, c, d, a, b, in[15] + 0x1fa27cf8, 16);
-	MD5STEP(MD5_F3, b, c, d, a, in[2 ] + 0xc4ac5665, 23);
-
-	MD5STEP(MD5_F4, a, b, c, d, in[ 0] + 0xf4292244,  6);
-	MD5STEP(MD5_F4, d, a, b, c, in[7 ] + 0x432aff97, 10);
-	MD5STEP(MD5_F4, c, d, a, b, in[14] + 0xab9423a7, 15);
-	MD5STEP(MD5_F4, b, c, d, a, in[5 ] + 0xfc93a039, 21);
-	MD5STEP(MD5_F4, a, b, c, d, in[12] + 0x655b59c3,  6);
-	MD5STEP(MD5_F4, d, a, b, c, in[3 ] + 0x8f0ccc92, 10);
-	MD5STEP(MD5_F4, c, d, a, b, in[10] + 0xffeff47d, 15);
-	MD5STEP(MD5_F4, b, c, d, a, in[1 ] + 0x85845dd1, 21);
-	MD5STEP(MD5_F4, a, b, c, d, in[8 ] + 0x6fa87e4f,  6);
-	MD5STEP(MD5_F4, d, a, b, c, in[15] + 0xfe2ce6e0, 10);
-	MD5STEP(MD5_F4, c, d, a, b, in[6 ] + 0xa3014314, 15);
-	MD5STEP(MD5_F4, b, c, d, a, in[13] + 0x4e0811a1, 21);
-	MD5STEP(MD5_F4, a, b, c, d, in[4 ] + 0xf7537e82,  6);
-	MD5STEP(MD5_F4, d, a, b, c, in[11] + 0xbd3af235, 10);
-	MD5STEP(MD5_F4, c, d, a, b, in[2 ] + 0x2ad7d2bb, 15);
-	MD5STEP(MD5_F4, b, c, d, a, in[9 ] + 0xeb86d391, 21);
+	MD5_ROUNDS(a, b, c, d, in);
 
 	state[0] += a;
 	state[1] += b;
@@ -532,8 +541,8 @@ static void fr_md5_local_final(uint8_t out[static MD5_DIGEST_LENGTH], fr_md5_ctx
 	    ((ctx_local->count[0] >> 3) & (MD5_BLOCK_LENGTH - 1));
 	if (padlen < 1 + 8)
 		padlen += MD5_BLOCK_LENGTH;
-	fr_md5_update(ctx_local, PADDING, padlen - 8); /* padlen - 8 <= 64 */
-	fr_md5_update(ctx_local, count, 8);
+	fr_md5_local_update(ctx_local, PADDING, padlen - 8); /* padlen - 8 <= 64 */
+	fr_md5_local_update(ctx_local, count, 8);
 
 	if (out != NULL) {
 		for (i = 0; i < 4; i++)
@@ -567,3 +576,198 @@ void fr_md5_calc(uint8_t out[static MD5_DIGEST_LENGTH], uint8_t const *in, size_
 	fr_md5_final(out, ctx);
 	fr_md5_ctx_free(&ctx);
 }
+
+/*
+ *	Multi-buffer MD5.
+ *
+ *	A single MD5 can't be made faster with SIMD, as every step depends
+ *	on the previous one.  What we can do is hash several independent
+ *	messages at once, with each message in its own lane of a vector.
+ *	The vector types below are compiled to SSE2, AVX2 or AVX-512
+ *	instructions, depending on what the CPU supports, and to plain
+ *	scalar code if there's nothing better.
+ */
+typedef struct {
+	fr_md5_multi_t const	*msg;
+	size_t			len;		//!< Of the whole message.
+	size_t			blocks;		//!< Number of blocks, including the padding.
+} fr_md5_multi_lane_t;
+
+static inline CC_HINT(always_inline) uint32_t md5_get_32bit_le(uint8_t const *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline CC_HINT(always_inline) void md5_multi_lane_init(fr_md5_multi_lane_t *lane, fr_md5_multi_t const *msg)
+{
+	lane->msg = msg;
+	lane->len = msg->inlen + msg->in2len;
+	lane->blocks = ((lane->len + 8) / MD5_BLOCK_LENGTH) + 1;
+}
+
+/** Return a block of a message, including the MD5 padding and length
+ *
+ * Blocks which are entirely within the first part of the message are
+ * returned in place.  Everything else is assembled in buff.
+ */
+static uint8_t const *md5_multi_block(fr_md5_multi_lane_t const *lane, size_t block,
+				      uint8_t buff[static MD5_BLOCK_LENGTH])
+{
+	fr_md5_multi_t const	*msg = lane->msg;
+	size_t			start = block * MD5_BLOCK_LENGTH;
+	size_t			used = 0;
+
+	if ((start + MD5_BLOCK_LENGTH) <= msg->inlen) return msg->in + start;
+
+	memset(buff, 0, MD5_BLOCK_LENGTH);
+
+	if (start < msg->inlen) {
+		used = msg->inlen - start;
+		memcpy(buff, msg->in + start, used);
+	}
+
+	if ((start + used) < lane->len) {
+		size_t offset = start + used - msg->inlen;
+		size_t len = msg->in2len - offset;
+
+		if (len > (MD5_BLOCK_LENGTH - used)) len = MD5_BLOCK_LENGTH - used;
+		memcpy(buff + used, msg->in2 + offset, len);
+	}
+
+	if ((lane->len >= start) && (lane->len < (start + MD5_BLOCK_LENGTH))) buff[lane->len - start] = 0x80;
+
+	if (block == (lane->blocks - 1)) {
+		uint32_t count[2] = { (uint32_t)(lane->len << 3), (uint32_t)((uint64_t)lane->len >> 29) };
+
+		PUT_64BIT_LE(buff + MD5_BLOCK_LENGTH - 8, count);
+	}
+
+	return buff;
+}
+
+/** Define a function which hashes up to _lanes messages in parallel
+ *
+ * Lanes which have run out of blocks keep going, but their results are
+ * masked out of the state.  Messages of similar lengths (which is the
+ * normal case for RADIUS packets) waste very little work.
+ */
+#define MD5_MULTI_FUNC(_lanes, _attr) \
+typedef uint32_t fr_md5_vec##_lanes##_t __attribute__((vector_size((_lanes) * sizeof(uint32_t)))); \
+static _attr void md5_multi_##_lanes(fr_md5_multi_t const *msgs, size_t num) \
+{ \
+	fr_md5_vec##_lanes##_t	state[4], mask, a, b, c, d, in[MD5_BLOCK_LENGTH / 4]; \
+	fr_md5_multi_lane_t	lane[_lanes]; \
+	uint8_t			buff[MD5_BLOCK_LENGTH]; \
+	size_t			i, j, block, blocks = 0; \
+	\
+	fr_assert(num <= (_lanes)); \
+	\
+	for (i = 0; i < num; i++) { \
+		md5_multi_lane_init(&lane[i], &msgs[i]); \
+		if (lane[i].blocks > blocks) blocks = lane[i].blocks; \
+	} \
+	\
+	for (i = 0; i < (_lanes); i++) { \
+		state[0][i] = 0x67452301; \
+		state[1][i] = 0xefcdab89; \
+		state[2][i] = 0x98badcfe; \
+		state[3][i] = 0x10325476; \
+	} \
+	\
+	for (block = 0; block < blocks; block++) { \
+		for (i = 0; i < (_lanes); i++) { \
+			uint8_t const *p; \
+			\
+			if ((i >= num) || (block >= lane[i].blocks)) { \
+				mask[i] = 0; \
+				for (j = 0; j < (MD5_BLOCK_LENGTH / 4); j++) in[j][i] = 0; \
+				continue; \
+			} \
+			\
+			mask[i] = 0xffffffff; \
+			p = md5_multi_block(&lane[i], block, buff); \
+			for (j = 0; j < (MD5_BLOCK_LENGTH / 4); j++) in[j][i] = md5_get_32bit_le(p + (j * 4)); \
+		} \
+		\
+		a = state[0]; \
+		b = state[1]; \
+		c = state[2]; \
+		d = state[3]; \
+		\
+		MD5_ROUNDS(a, b, c, d, in); \
+		\
+		state[0] += a & mask; \
+		state[1] += b & mask; \
+		state[2] += c & mask; \
+		state[3] += d & mask; \
+	} \
+	\
+	for (i = 0; i < num; i++) { \
+		for (j = 0; j < 4; j++) PUT_32BIT_LE(msgs[i].out + (j * 4), state[j][i]); \
+	} \
+}
+
+/*
+ *	On x86_64 the wider versions are compiled for AVX2 and AVX-512,
+ *	and only used if the CPU supports them.  Elsewhere the compiler
+ *	splits them into whatever vector registers the target has.
+ */
+#if defined(__x86_64__) && defined(__GNUC__)
+#  define MD5_MULTI_X86 1
+MD5_MULTI_FUNC(4, )
+MD5_MULTI_FUNC(8, __attribute__((target("avx2"))))
+MD5_MULTI_FUNC(16, __attribute__((target("avx512f"))))
+#else
+MD5_MULTI_FUNC(4, )
+MD5_MULTI_FUNC(8, )
+MD5_MULTI_FUNC(16, )
+#endif
+
+/** Hash several messages in parallel
+ *
+ * Produces the same digests as calling fr_md5_calc() on each message,
+ * but is substantially faster when there's more than one message.
+ * It always uses the local MD5 implementation, as OpenSSL has no
+ * multi-buffer API.
+ *
+ * @param[in] msgs	to hash.  Each digest is written to msgs[i].out.
+ * @param[in] num	number of messages.
+ */
+void fr_md5_calc_multi(fr_md5_multi_t const *msgs, size_t num)
+{
+	size_t	max_lanes = 16;
+
+#ifdef MD5_MULTI_X86
+	if (!__builtin_cpu_supports("avx512f")) max_lanes = __builtin_cpu_supports("avx2") ? 8 : 4;
+#endif
+
+	while (num > 0) {
+		size_t todo = (num < max_lanes) ? num : max_lanes;
+
+		/*
+		 *	One message on its own gains nothing from
+		 *	the vector code.
+		 */
+		if (todo == 1) {
+			fr_md5_ctx_t *ctx;
+
+			ctx = fr_md5_ctx_alloc(true);
+			fr_md5_update(ctx, msgs->in, msgs->inlen);
+			if (msgs->in2len) fr_md5_update(ctx, msgs->in2, msgs->in2len);
+			fr_md5_final(msgs->out, ctx);
+			fr_md5_ctx_free(&ctx);
+
+		} else if (todo <= 4) {
+			md5_multi_4(msgs, todo);
+
+		} else if (todo <= 8) {
+			md5_multi_8(msgs, todo);
+
+		} else {
+			md5_multi_16(msgs, todo);
+		}
+
+		msgs += todo;
+		num -= todo;
+	}
+}
@@ -84,6 +84,23 @@ extern		fr_md5_final_t		fr_md5_final;
  */
 void		fr_md5_calc(uint8_t out[static MD5_DIGEST_LENGTH], uint8_t const *in, size_t inlen);
 
+/** One of the messages hashed by fr_md5_calc_multi()
+ *
+ * The message is in followed by in2, which saves callers from copying
+ * e.g. a packet and a shared secret into one buffer.
+ */
+typedef struct {
+	uint8_t const	*in;		//!< Start of the message.
+	size_t		inlen;		//!< Length of in.
+	uint8_t const	*in2;		//!< Rest of the message, may be NULL.
+	size_t		in2len;		//!< Length of in2.
+	uint8_t		*out;		//!< Where to write the MD5_DIGEST_LENGTH byte digest.
+} fr_md5_multi_t;
+
+#define FR_MD5_MULTI_MAX_LANES	(16)	//!< Most messages which are hashed in parallel.
+
+void		fr_md5_calc_multi(fr_md5_multi_t const *msgs, size_t num);
+
 /* hmac.c */
 int		fr_hmac_md5(uint8_t digest[static MD5_DIGEST_LENGTH], uint8_t const *in, size_t inlen,
 			    uint8_t const *key, size_t key_len);
@@ -0,0 +1,311 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for the MD5 functions
+ *
+ * md5.c is included directly, so that the local implementation can be
+ * benchmarked against OpenSSL, and each width of the multi-buffer code
+ * can be tested on its own.
+ *
+ * @file src/lib/util/md5_tests.c
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/rand.h>
+#include <freeradius-devel/util/time.h>
+
+#include "md5.c"
+
+/*
+ *	Test vectors from RFC 1321
+ */
+static struct {
+	char const	*in;
+	char const	*digest;
+} md5_vectors[] = {
+	{ "", "d41d8cd98f00b204e9800998ecf8427e" },
+	{ "a", "0cc175b9c0f1b6cb831f57fb8a2c6ae9" },
+	{ "abc", "900150983cd24fb0d6963f7d28e17f72" },
+	{ "message digest", "f96b697d7cb7938d525a2f31aaf161d0" },
+	{ "abcdefghijklmnopqrstuvwxyz", "c3fcd3d76192e4007dfb496cca67e13b" },
+	{ "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789", "d174ab98d277d9f5a5611c2c9f419d9f" },
+	{ "12345678901234567890123456789012345678901234567890123456789012345678901234567890",
+	  "57edf4a22be3c955ac49da2e2107b67a" }
+};
+
+#define NUM_VECTORS	(NUM_ELEMENTS(md5_vectors))
+
+/*
+ *	Typical size of a RADIUS packet, and a typical shared secret.
+ */
+#define BENCH_PACKET_LEN	(100)
+#define BENCH_SECRET		"testing123"
+#define BENCH_NUM		(1 << 20)
+
+static void md5_hex(char out[static (MD5_DIGEST_LENGTH * 2) + 1], uint8_t const digest[static MD5_DIGEST_LENGTH])
+{
+	size_t i;
+
+	for (i = 0; i < MD5_DIGEST_LENGTH; i++) snprintf(out + (i * 2), 3, "%02x", digest[i]);
+}
+
+/** Calculate an MD5 digest with the local implementation, even if OpenSSL is available
+ *
+ */
+static void md5_local_calc(fr_md5_ctx_local_t *ctx, uint8_t out[static MD5_DIGEST_LENGTH],
+			   uint8_t const *in, size_t inlen, uint8_t const *in2, size_t in2len)
+{
+	fr_md5_local_ctx_reset(ctx);
+	fr_md5_local_update(ctx, in, inlen);
+	if (in2len) fr_md5_local_update(ctx, in2, in2len);
+	fr_md5_local_final(out, ctx);
+}
+
+static void test_md5_vectors(void)
+{
+	fr_md5_multi_t	msgs[NUM_VECTORS];
+	uint8_t		digests[NUM_VECTORS][MD5_DIGEST_LENGTH];
+	char		hex[(MD5_DIGEST_LENGTH * 2) + 1];
+	size_t		i;
+
+	for (i = 0; i < NUM_VECTORS; i++) {
+		msgs[i] = (fr_md5_multi_t) {
+			.in = (uint8_t const *)md5_vectors[i].in,
+			.inlen = strlen(md5_vectors[i].in),
+			.out = digests[i]
+		};
+	}
+
+	fr_md5_calc_multi(msgs, NUM_VECTORS);
+
+	for (i = 0; i < NUM_VECTORS; i++) {
+		md5_hex(hex, digests[i]);
+		TEST_CHECK(strcmp(hex, md5_vectors[i].digest) == 0);
+		TEST_MSG("\"%s\" expected %s, got %s", md5_vectors[i].in, md5_vectors[i].digest, hex);
+	}
+}
+
+/*
+ *	Random messages, split randomly between in and in2, in batches
+ *	of every size up to and beyond the widest vector.
+ */
+static void test_md5_multi_random(void)
+{
+	fr_md5_multi_t		msgs[40];
+	uint8_t			digests[40][MD5_DIGEST_LENGTH];
+	uint8_t			data[40][300];
+	fr_md5_ctx_local_t	*ctx;
+	fr_fast_rand_t		rand_ctx;
+	size_t			num, i, j;
+
+	ctx = talloc(NULL, fr_md5_ctx_local_t);
+	rand_ctx.a = fr_rand();
+	rand_ctx.b = fr_rand();
+
+	for (num = 1; num <= NUM_ELEMENTS(msgs); num++) {
+		for (i = 0; i < num; i++) {
+			size_t len = fr_fast_rand(&rand_ctx) % sizeof(data[i]);
+			size_t split = len ? fr_fast_rand(&rand_ctx) % (len + 1) : 0;
+
+			for (j = 0; j < len; j++) data[i][j] = fr_fast_rand(&rand_ctx);
+
+			msgs[i] = (fr_md5_multi_t) {
+				.in = data[i],
+				.inlen = split,
+				.in2 = (split < len) ? data[i] + split : NULL,
+				.in2len = len - split,
+				.out = digests[i]
+			};
+		}
+
+		fr_md5_calc_multi(msgs, num);
+
+		for (i = 0; i < num; i++) {
+			uint8_t expected[MD5_DIGEST_LENGTH];
+
+			md5_local_calc(ctx, expected, msgs[i].in, msgs[i].inlen, msgs[i].in2, msgs[i].in2len);
+			TEST_CHECK(memcmp(expected, digests[i], MD5_DIGEST_LENGTH) == 0);
+			TEST_MSG("batch of %zu, message %zu (%zu + %zu bytes) differs", num, i,
+				 msgs[i].inlen, msgs[i].in2len);
+		}
+	}
+
+	talloc_free(ctx);
+}
+
+/*
+ *	Messages which end at, and either side of, the block boundaries
+ *	where the padding spills into another block.
+ */
+static void test_md5_multi_boundaries(void)
+{
+	static size_t const	lens[] = { 0, 1, 55, 56, 57, 63, 64, 65, 119, 120, 121, 127, 128, 129 };
+	fr_md5_multi_t		msgs[NUM_ELEMENTS(lens)];
+	uint8_t			digests[NUM_ELEMENTS(lens)][MD5_DIGEST_LENGTH];
+	uint8_t			data[129];
+	fr_md5_ctx_local_t	*ctx;
+	size_t			i;
+
+	ctx = talloc(NULL, fr_md5_ctx_local_t);
+	for (i = 0; i < sizeof(data); i++) data[i] = i;
+
+	for (i = 0; i < NUM_ELEMENTS(lens); i++) {
+		msgs[i] = (fr_md5_multi_t) { .in = data, .inlen = lens[i], .out = digests[i] };
+	}
+
+	fr_md5_calc_multi(msgs, NUM_ELEMENTS(lens));
+
+	for (i = 0; i < NUM_ELEMENTS(lens); i++) {
+		uint8_t expected[MD5_DIGEST_LENGTH];
+
+		md5_local_calc(ctx, expected, data, lens[i], NULL, 0);
+		TEST_CHECK(memcmp(expected, digests[i], MD5_DIGEST_LENGTH) == 0);
+		TEST_MSG("%zu byte message differs", lens[i]);
+	}
+
+	talloc_free(ctx);
+}
+
+typedef struct {
+	uint8_t		packets[FR_MD5_MULTI_MAX_LANES][BENCH_PACKET_LEN];
+	uint8_t		digests[FR_MD5_MULTI_MAX_LANES][MD5_DIGEST_LENGTH];
+	fr_md5_multi_t	msgs[FR_MD5_MULTI_MAX_LANES];
+} md5_bench_t;
+
+static md5_bench_t *md5_bench_alloc(void)
+{
+	md5_bench_t	*bench;
+	size_t		i, j;
+
+	bench = talloc_zero(NULL, md5_bench_t);
+	for (i = 0; i < FR_MD5_MULTI_MAX_LANES; i++) {
+		for (j = 0; j < BENCH_PACKET_LEN; j++) bench->packets[i][j] = fr_rand();
+
+		bench->msgs[i] = (fr_md5_multi_t) {
+			.in = bench->packets[i],
+			.inlen = BENCH_PACKET_LEN,
+			.in2 = (uint8_t const *)BENCH_SECRET,
+			.in2len = sizeof(BENCH_SECRET) - 1,
+			.out = bench->digests[i]
+		};
+	}
+
+	return bench;
+}
+
+static void md5_bench_print(char const *name, fr_time_t start, fr_time_t end)
+{
+	uint64_t ns = fr_time_delta_unwrap(fr_time_sub(end, start));
+
+	TEST_MSG_ALWAYS("%-10s %6.1f ns/packet, %7.1f MB/s\n", name, (double)ns / BENCH_NUM,
+			((double)BENCH_NUM * (BENCH_PACKET_LEN + sizeof(BENCH_SECRET) - 1) * 1000) / ns);
+}
+
+/*
+ *	Authenticator style digests, MD5(packet + secret), one at a time
+ *	with the local and OpenSSL implementations, and in batches.
+ */
+static void md5_bench(void)
+{
+	md5_bench_t		*bench = md5_bench_alloc();
+	fr_md5_ctx_local_t	*ctx_local;
+	fr_md5_ctx_t		*ctx;
+	fr_time_t		start, end;
+	size_t			i;
+
+	TEST_MSG_ALWAYS("\n%u x %u byte packets\n", BENCH_NUM, BENCH_PACKET_LEN);
+
+	ctx_local = talloc(NULL, fr_md5_ctx_local_t);
+	start = fr_time();
+	for (i = 0; i < BENCH_NUM; i++) {
+		fr_md5_multi_t const *msg = &bench->msgs[i % FR_MD5_MULTI_MAX_LANES];
+
+		md5_local_calc(ctx_local, msg->out, msg->in, msg->inlen, msg->in2, msg->in2len);
+	}
+	end = fr_time();
+	md5_bench_print("local", start, end);
+	talloc_free(ctx_local);
+
+	/*
+	 *	Whatever fr_md5_ctx_alloc() picks, which is OpenSSL
+	 *	if it's available, and not in FIPS mode.
+	 */
+	start = fr_time();
+	for (i = 0; i < BENCH_NUM; i++) {
+		fr_md5_multi_t const *msg = &bench->msgs[i % FR_MD5_MULTI_MAX_LANES];
+
+		ctx = fr_md5_ctx_alloc(true);
+		fr_md5_update(ctx, msg->in, msg->inlen);
+		fr_md5_update(ctx, msg->in2, msg->in2len);
+		fr_md5_final(msg->out, ctx);
+		fr_md5_ctx_free(&ctx);
+	}
+	end = fr_time();
+#ifdef HAVE_OPENSSL_EVP_H
+	md5_bench_print(have_openssl_md5 == 1 ? "openssl" : "default", start, end);
+#else
+	md5_bench_print("default", start, end);
+#endif
+
+	start = fr_time();
+	for (i = 0; i < BENCH_NUM; i += 4) md5_multi_4(bench->msgs, 4);
+	end = fr_time();
+	md5_bench_print("multi x4", start, end);
+
+#ifdef MD5_MULTI_X86
+	if (__builtin_cpu_supports("avx2"))
+#endif
+	{
+		start = fr_time();
+		for (i = 0; i < BENCH_NUM; i += 8) md5_multi_8(bench->msgs, 8);
+		end = fr_time();
+		md5_bench_print("multi x8", start, end);
+	}
+
+#ifdef MD5_MULTI_X86
+	if (__builtin_cpu_supports("avx512f"))
+#endif
+	{
+		start = fr_time();
+		for (i = 0; i < BENCH_NUM; i += 16) md5_multi_16(bench->msgs, 16);
+		end = fr_time();
+		md5_bench_print("multi x16", start, end);
+	}
+
+	start = fr_time();
+	for (i = 0; i < BENCH_NUM; i += FR_MD5_MULTI_MAX_LANES) fr_md5_calc_multi(bench->msgs, FR_MD5_MULTI_MAX_LANES);
+	end = fr_time();
+	md5_bench_print("multi", start, end);
+
+	talloc_free(bench);
+}
+
+TEST_LIST = {
+	/*
+	 *	Basic tests
+	 */
+	{ "md5_vectors",		test_md5_vectors },
+	{ "md5_multi_random",		test_md5_multi_random },
+	{ "md5_multi_boundaries",	test_md5_multi_boundaries },
+
+	/*
+	 *	Benchmarks
+	 */
+	{ "md5_bench",			md5_bench },
+	{ NULL }
+};
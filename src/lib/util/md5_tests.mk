@@ -0,0 +1,7 @@
+TARGET		:= md5_tests
+
+SOURCES		:= md5_tests.c
+
+TGT_LDLIBS	:= $(LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS)
+TGT_PREREQS	:= libfreeradius-util.a
@@ -34,7 +34,47 @@ RCSID("$Id$")
 
 FR_DLIST_FUNCS(pair, fr_pair_t, order_entry)
 
+/** Lists shorter than this are searched linearly, even if indexing is enabled
+ *
+ */
+#define PAIR_LIST_INDEX_MIN	16
+
+/** Number of pairs allocated by this thread
+ *
+ */
+static _Thread_local uint64_t pair_alloc_count;
+
+/** An entry in a pair list index
+ *
+ */
+typedef struct {
+	fr_dict_attr_t const	*da;		//!< Attribute this slot is for.  NULL if the slot is free.
+	fr_pair_t		*first;		//!< First pair in the list with this da.
+	unsigned int		count;		//!< How many pairs in the list have this da.
+} fr_pair_list_index_slot_t;
+
+/** Lookup index for a pair list
+ *
+ * Maps each #fr_dict_attr_t in the list to the first pair using it, so that
+ * lookups by da don't need to walk the list.  The index is built on demand by
+ * the lookup functions, kept up to date on append and remove, and discarded
+ * by anything else which changes the order of the list.
+ *
+ * Slots are never freed once assigned a da, so linear probing doesn't need
+ * tombstones.
+ */
+struct fr_pair_list_index_s {
+	bool				valid;		//!< Whether the slots reflect the current list.
+	uint32_t			mask;		//!< Number of slots - 1.
+	uint32_t			used;		//!< Number of slots with a da assigned.
+	fr_pair_list_index_slot_t	*slots;		//!< Open addressed table of slots.
+};
+
 /** Initialise a pair list header
+ *
+ * @note Only for lists which haven't been initialised yet.  Any index the list
+ *	had is forgotten, not freed.  Use #fr_pair_list_free to empty a list
+ *	which is already in use, which keeps its index.
  *
  * @param[in,out] list to initialise
  */
@@ -47,6 +87,189 @@ void fr_pair_list_init(fr_pair_list_t *list)
 	 *	all of them.
 	 */
 	fr_dlist_pair_talloc_init(&list->order);
+	list->index = NULL;
+}
+
+/** Enable indexed lookups for a pair list
+ *
+ * Once enabled, #fr_pair_find_by_da, #fr_pair_find_by_da_idx, #fr_pair_count_by_da
+ * and #fr_pair_delete_by_da no longer need to walk the whole of a long list.
+ * The index is built the first time it's needed, and rebuilt after any operation
+ * which reorders the list.
+ *
+ * @note Lookups on an indexed list may modify the index, so indexed lists must not
+ *	be searched concurrently from multiple threads.
+ *
+ * @note The da of a pair in an indexed list must only be changed with
+ *	#fr_pair_reinit_from_da, passing the list.
+ *
+ * @param[in] ctx	to allocate the index in.  Must not be freed before the list.
+ * @param[in] list	to index.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_pair_list_index_enable(TALLOC_CTX *ctx, fr_pair_list_t *list)
+{
+	if (list->index) return 0;
+
+	list->index = talloc_zero(ctx, fr_pair_list_index_t);
+	if (unlikely(!list->index)) {
+		fr_strerror_const("Out of memory");
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Find the slot for a da, or the free slot it would occupy
+ *
+ */
+static inline CC_HINT(always_inline) fr_pair_list_index_slot_t *pair_list_index_slot(fr_pair_list_index_t const *index,
+										      fr_dict_attr_t const *da)
+{
+	uint32_t i;
+
+	i = (uint32_t)((((uint64_t)(uintptr_t)da) * 0x9e3779b97f4a7c15ULL) >> 32) & index->mask;
+	while (index->slots[i].da && (index->slots[i].da != da)) i = (i + 1) & index->mask;
+
+	return &index->slots[i];
+}
+
+/** Add a pair to the end of an index
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 if the index is too full.
+ */
+static inline CC_HINT(always_inline) int pair_list_index_add(fr_pair_list_index_t *index, fr_pair_t *vp)
+{
+	fr_pair_list_index_slot_t *slot;
+
+	slot = pair_list_index_slot(index, vp->da);
+	if (!slot->da) {
+		/*
+		 *	Keep the load factor below 3/4
+		 */
+		if (((index->used + 1) * 4) > ((index->mask + 1) * 3)) return -1;
+
+		slot->da = vp->da;
+		index->used++;
+	}
+	if (!slot->first) slot->first = vp;
+	slot->count++;
+
+	return 0;
+}
+
+/** (Re)build a pair list's index
+ *
+ */
+static int pair_list_index_build(fr_pair_list_t *list)
+{
+	fr_pair_list_index_t	*index = list->index;
+	fr_pair_t		*vp = NULL;
+	uint32_t		num_slots = 32;
+	size_t			len = fr_dlist_pair_num_elements(&list->order);
+
+	while (num_slots < (len * 2)) num_slots <<= 1;
+
+	if (!index->slots || (num_slots > (index->mask + 1))) {
+		talloc_free(index->slots);
+		index->slots = talloc_zero_array(index, fr_pair_list_index_slot_t, num_slots);
+		if (unlikely(!index->slots)) {
+			index->mask = 0;
+			return -1;
+		}
+		index->mask = num_slots - 1;
+	} else {
+		memset(index->slots, 0, sizeof(index->slots[0]) * (index->mask + 1));
+	}
+	index->used = 0;
+
+	while ((vp = fr_dlist_pair_next(&list->order, vp))) {
+		if (unlikely(pair_list_index_add(index, vp) < 0)) return -1;	/* Can't happen */
+	}
+	index->valid = true;
+
+	return 0;
+}
+
+/** Return the index slot for a da, building the index if required
+ *
+ * @return
+ *	- The slot for the da.  If the da isn't in the list this will be
+ *	  a free slot, with count 0.  It must not be modified.
+ *	- NULL if the list isn't indexed, or is too short to index.
+ */
+static inline CC_HINT(always_inline) fr_pair_list_index_slot_t *pair_list_index_find(fr_pair_list_t const *list,
+										      fr_dict_attr_t const *da)
+{
+	fr_pair_list_index_t		*index = list->index;
+	fr_pair_list_index_slot_t	*slot;
+
+	if (likely(!index)) return NULL;
+
+	if (!index->valid) {
+		if (fr_dlist_pair_num_elements(&list->order) < PAIR_LIST_INDEX_MIN) return NULL;
+		if (pair_list_index_build(UNCONST(fr_pair_list_t *, list)) < 0) return NULL;
+	}
+
+	slot = pair_list_index_slot(index, da);
+
+	/*
+	 *	Something changed the da of a pair without
+	 *	telling us.  Fall back to searching the list.
+	 */
+	if (unlikely(slot->first && (slot->first->da != da))) {
+		index->valid = false;
+		return NULL;
+	}
+
+	return slot;
+}
+
+/** Discard a pair list's index after the list has been reordered
+ *
+ */
+static inline CC_HINT(always_inline) void pair_list_index_invalidate(fr_pair_list_t const *list)
+{
+	if (list->index) list->index->valid = false;
+}
+
+/** Update a pair list's index after a pair has been appended
+ *
+ */
+static inline CC_HINT(always_inline) void pair_list_index_append(fr_pair_list_t *list, fr_pair_t *vp)
+{
+	if (!list->index || !list->index->valid) return;
+
+	if (pair_list_index_add(list->index, vp) < 0) list->index->valid = false;
+}
+
+/** Update a pair list's index before a pair is removed
+ *
+ */
+static inline CC_HINT(always_inline) void pair_list_index_remove(fr_pair_list_t *list, fr_pair_t *vp)
+{
+	fr_pair_list_index_slot_t *slot;
+
+	if (!list->index || !list->index->valid) return;
+
+	slot = pair_list_index_slot(list->index, vp->da);
+	if (unlikely(!slot->da || !slot->count)) {
+		list->index->valid = false;
+		return;
+	}
+
+	if (--slot->count == 0) {
+		slot->first = NULL;
+		return;
+	}
+
+	if (slot->first != vp) return;
+
+	while ((slot->first = fr_dlist_pair_next(&list->order, slot->first))) if (slot->first->da == vp->da) break;
 }
 
 /** Free a fr_pair_t
@@ -138,12 +361,21 @@ fr_pair_t *fr_pair_alloc_null(TALLOC_CTX *ctx)
 		return NULL;
 	}
 	talloc_set_destructor(vp, _fr_pair_free);
+	pair_alloc_count++;
 
 	pair_init_null(vp);
 
 	return vp;
 }
 
+/** Return the number of pairs allocated by the calling thread
+ *
+ */
+uint64_t fr_pair_alloc_count(void)
+{
+	return pair_alloc_count;
+}
+
 /** A special allocation function which disables child autofree
  *
  * This is intended to allocate root attributes for requests.
@@ -169,6 +401,7 @@ fr_pair_t *fr_pair_root_afrom_da(TALLOC_CTX *ctx, fr_dict_attr_t const *da)
 		fr_strerror_const("Out of memory");
 		return NULL;
 	}
+	pair_alloc_count++;
 
 	if (unlikely(da->flags.is_unknown)) {
 		fr_strerror_const("Root attribute cannot be unknown");
@@ -303,6 +536,7 @@ fr_pair_t *fr_pair_afrom_da_with_pool(TALLOC_CTX *ctx, fr_dict_attr_t const *da,
 		return NULL;
 	}
 	talloc_set_destructor(vp, _fr_pair_free);
+	pair_alloc_count++;
 
 	pair_init_null(vp);
 	pair_init_from_da(vp, da);
@@ -508,6 +742,7 @@ int fr_pair_steal_prepend(TALLOC_CTX *list_ctx, fr_pair_list_t *list, fr_pair_t
  */
 void fr_pair_list_free(fr_pair_list_t *list)
 {
+	pair_list_index_invalidate(list);
 	fr_dlist_pair_talloc_free(&list->order);
 }
 
@@ -606,11 +841,15 @@ void *fr_pair_iter_next_by_ancestor(fr_dlist_head_t *list, void *to_eval, void *
  */
 unsigned int fr_pair_count_by_da(fr_pair_list_t const *list, fr_dict_attr_t const *da)
 {
-	fr_pair_t	*vp = NULL;
-	unsigned int	count = 0;
+	fr_pair_t			*vp = NULL;
+	unsigned int			count = 0;
+	fr_pair_list_index_slot_t	*slot;
 
 	if (fr_dlist_pair_empty(&list->order)) return 0;
 
+	slot = pair_list_index_find(list, da);
+	if (slot) return slot->count;
+
 	while ((vp = fr_dlist_pair_next(&list->order, vp))) if (da == vp->da) count++;
 
 	return count;
@@ -635,6 +874,12 @@ fr_pair_t *fr_pair_find_by_da(fr_pair_list_t const *list, fr_pair_t const *prev,
 
 	PAIR_LIST_VERIFY(list);
 
+	if (!prev) {
+		fr_pair_list_index_slot_t *slot = pair_list_index_find(list, da);
+
+		if (slot) return slot->first;
+	}
+
 	while ((vp = fr_dlist_pair_next(&list->order, vp))) if (da == vp->da) return vp;
 
 	return NULL;
@@ -653,12 +898,25 @@ fr_pair_t *fr_pair_find_by_da(fr_pair_list_t const *list, fr_pair_t const *prev,
  */
 fr_pair_t *fr_pair_find_by_da_idx(fr_pair_list_t const *list, fr_dict_attr_t const *da, unsigned int idx)
 {
-	fr_pair_t *vp = NULL;
+	fr_pair_t			*vp = NULL;
+	fr_pair_list_index_slot_t	*slot;
 
 	if (fr_dlist_pair_empty(&list->order)) return NULL;
 
 	PAIR_LIST_VERIFY(list);
 
+	/*
+	 *	Skip straight to the first instance
+	 */
+	slot = pair_list_index_find(list, da);
+	if (slot) {
+		if (idx >= slot->count) return NULL;
+		if (idx == 0) return slot->first;
+
+		vp = slot->first;
+		idx--;
+	}
+
 	while ((vp = fr_pair_list_next(list, vp))) {
 		if (da != vp->da) continue;
 
@@ -803,8 +1061,10 @@ fr_pair_list_t *fr_pair_children(fr_pair_t *vp)
  * @return
  *	- 0 on success.
  */
-static int _pair_list_dcursor_insert(UNUSED fr_dlist_head_t *list, UNUSED void *to_insert, UNUSED void *uctx)
+static int _pair_list_dcursor_insert(UNUSED fr_dlist_head_t *list, UNUSED void *to_insert, void *uctx)
 {
+	pair_list_index_invalidate(uctx);
+
 	return 0;
 }
 
@@ -816,8 +1076,14 @@ static int _pair_list_dcursor_insert(UNUSED fr_dlist_head_t *list, UNUSED void *
  * @return
  *	- 0 on success.
  */
-static int _pair_list_dcursor_remove(UNUSED fr_dlist_head_t *list, UNUSED void *to_remove, UNUSED void *uctx)
+static int _pair_list_dcursor_remove(UNUSED fr_dlist_head_t *list, UNUSED void *to_remove, void *uctx)
 {
+	/*
+	 *	Cursors can descend into child lists, so
+	 *	to_remove may not be in this list.
+	 */
+	pair_list_index_invalidate(uctx);
+
 	return 0;
 }
 
@@ -979,6 +1245,7 @@ int fr_pair_prepend(fr_pair_list_t *list, fr_pair_t *to_add)
 	}
 
 	fr_dlist_pair_insert_head(&list->order, to_add);
+	pair_list_index_invalidate(list);
 
 	return 0;
 }
@@ -1003,6 +1270,7 @@ int fr_pair_append(fr_pair_list_t *list, fr_pair_t *to_add)
 	}
 
 	fr_dlist_pair_insert_tail(&list->order, to_add);
+	pair_list_index_append(list, to_add);
 
 	return 0;
 }
@@ -1031,6 +1299,7 @@ int fr_pair_insert_after(fr_pair_list_t *list, fr_pair_t *pos, fr_pair_t *to_add
 	}
 
 	fr_dlist_pair_insert_after(&list->order, pos, to_add);
+	pair_list_index_invalidate(list);
 
 	return 0;
 }
@@ -1059,6 +1328,7 @@ int fr_pair_insert_before(fr_pair_list_t *list, fr_pair_t *pos, fr_pair_t *to_ad
 	}
 
 	fr_dlist_pair_insert_before(&list->order, pos, to_add);
+	pair_list_index_invalidate(list);
 
 	return 0;
 }
@@ -1188,10 +1458,16 @@ int fr_pair_update_by_da(TALLOC_CTX *ctx, fr_pair_t **out, fr_pair_list_t *list,
  */
 int fr_pair_delete_by_da(fr_pair_list_t *list, fr_dict_attr_t const *da)
 {
-	fr_pair_t	*vp, *next;
-	int		cnt = 0;
+	fr_pair_t			*vp, *next;
+	int				cnt = 0;
+	fr_pair_list_index_slot_t	*slot;
 
-	for (vp = fr_pair_list_head(list); vp; vp = next) {
+	vp = fr_pair_list_head(list);
+
+	slot = pair_list_index_find(list, da);
+	if (slot) vp = slot->first;
+
+	for (; vp; vp = next) {
 		next = fr_pair_list_next(list, vp);
 		if (da == vp->da) {
 			cnt++;
@@ -1232,6 +1508,8 @@ fr_pair_t *fr_pair_remove(fr_pair_list_t *list, fr_pair_t *vp)
 {
 	fr_pair_t *prev;
 
+	pair_list_index_remove(list, vp);
+
 	prev = fr_dlist_pair_prev(&list->order, vp);
 	fr_dlist_pair_remove(&list->order, vp);
 
@@ -1248,6 +1526,8 @@ fr_pair_t *fr_pair_delete(fr_pair_list_t *list, fr_pair_t *vp)
 {
 	fr_pair_t *prev;
 
+	pair_list_index_remove(list, vp);
+
 	prev = fr_dlist_pair_prev(&list->order, vp);
 	fr_dlist_pair_remove(&list->order, vp);
 	talloc_free(vp);
@@ -1486,6 +1766,7 @@ int fr_pair_list_cmp(fr_pair_list_t const *a, fr_pair_list_t const *b)
  */
 void fr_pair_list_sort(fr_pair_list_t *list, fr_cmp_t cmp)
 {
+	pair_list_index_invalidate(list);
 	fr_dlist_pair_sort(&list->order, cmp);
 }
 
@@ -2744,6 +3025,8 @@ void fr_pair_list_tainted(fr_pair_list_t *list)
  */
 void fr_pair_list_append(fr_pair_list_t *dst, fr_pair_list_t *src)
 {
+	pair_list_index_invalidate(dst);
+	pair_list_index_invalidate(src);
 	fr_dlist_pair_move(&dst->order, &src->order);
 }
 
@@ -2754,6 +3037,8 @@ void fr_pair_list_append(fr_pair_list_t *dst, fr_pair_list_t *src)
  */
 void fr_pair_list_prepend(fr_pair_list_t *dst, fr_pair_list_t *src)
 {
+	pair_list_index_invalidate(dst);
+	pair_list_index_invalidate(src);
 	fr_dlist_pair_move_head(&dst->order, &src->order);
 }
 
@@ -46,10 +46,14 @@ extern "C" {
 
 typedef struct value_pair_s fr_pair_t;
 
+typedef struct fr_pair_list_index_s fr_pair_list_index_t;
+
 FR_DLIST_TYPES(pair)
 
 typedef struct {
         FR_DLIST_HEAD_TYPE(pair)		order;			//!< Maintains the relative order of pairs in a list.
+	fr_pair_list_index_t		*index;			//!< Optional index for lookups by da.
+								///< See #fr_pair_list_index_enable.
 } fr_pair_list_t;
 
 /** Stores an attribute, a value and various bits of other data
@@ -196,8 +200,12 @@ void fr_pair_list_init(fr_pair_list_t *head) CC_HINT(nonnull);
 /* Allocation and management */
 fr_pair_t	*fr_pair_alloc_null(TALLOC_CTX *ctx) CC_HINT(warn_unused_result);
 
+uint64_t	fr_pair_alloc_count(void);
+
 fr_pair_list_t	*fr_pair_list_alloc(TALLOC_CTX *ctx) CC_HINT(warn_unused_result);
 
+int		fr_pair_list_index_enable(TALLOC_CTX *ctx, fr_pair_list_t *list) CC_HINT(nonnull(2));
+
 fr_pair_t	*fr_pair_root_afrom_da(TALLOC_CTX *ctx, fr_dict_attr_t const *da) CC_HINT(warn_unused_result) CC_HINT(nonnull(2));
 
 /** @hidecallergraph */
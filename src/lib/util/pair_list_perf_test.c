@@ -380,6 +380,128 @@ static void do_test_fr_pair_find_by_da_idx(unsigned int len, unsigned int perc,
 	TEST_MSG_ALWAYS("per_sec=%0.0lf", (reps * len)/(fr_time_delta_unwrap(used) / (double)NSEC));
 }
 
+static void do_test_fr_pair_find_by_da_idx_indexed(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[])
+{
+	fr_pair_list_t		test_vps;
+	unsigned int		i, j;
+	fr_pair_t		*new_vp;
+	fr_time_t		start, end;
+	fr_time_delta_t		used = fr_time_delta_wrap(0);
+	fr_dict_attr_t const	*da;
+	size_t			input_count = talloc_array_length(source_vps);
+
+	fr_pair_list_init(&test_vps);
+	TEST_CHECK(fr_pair_list_index_enable(autofree, &test_vps) == 0);
+	if (input_count > len) input_count = len;
+
+	/*
+	 *  Initialise the test list
+	 */
+	for (i = 0; i < len; i++) {
+		int idx = rand() % input_count;
+		new_vp = fr_pair_copy(autofree, source_vps[idx]);
+		fr_pair_append(&test_vps, new_vp);
+	}
+
+	/*
+	 * Find first instance of specific DA, the first lookup builds the index
+	 */
+	for (i = 0; i < reps; i++) {
+		for (j = 0; j < len; j++) {
+			int idx = rand() % input_count;
+			da = source_vps[idx]->da;
+			start = fr_time();
+			(void) fr_pair_find_by_da_idx(&test_vps, da, 0);
+			end = fr_time();
+			used = fr_time_delta_add(used, fr_time_sub(end, start));
+		}
+	}
+	fr_pair_list_free(&test_vps);
+	TEST_MSG_ALWAYS("repetitions=%d", reps);
+	TEST_MSG_ALWAYS("perc_rep=%d", perc);
+	TEST_MSG_ALWAYS("list_length=%d", len);
+	TEST_MSG_ALWAYS("used=%"PRId64, fr_time_delta_unwrap(used));
+	TEST_MSG_ALWAYS("per_sec=%0.0lf", (reps * len)/(fr_time_delta_unwrap(used) / (double)NSEC));
+}
+
+/** Simulate a policy run against a received packet
+ *
+ * Each repetition copies the packet into a fresh list, then does a mix of
+ * lookups, counts and edits, as unlang conditions and updates would.
+ */
+static void lookup_mix(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[], bool indexed)
+{
+	fr_pair_list_t		test_vps;
+	unsigned int		i, j;
+	fr_pair_t		*new_vp;
+	fr_time_t		start, end;
+	fr_time_delta_t		used = fr_time_delta_wrap(0);
+	fr_dict_attr_t const	*da;
+	size_t			input_count = talloc_array_length(source_vps);
+	unsigned int		found = 0;
+
+	fr_pair_list_init(&test_vps);
+	if (indexed) TEST_CHECK(fr_pair_list_index_enable(autofree, &test_vps) == 0);
+	if (input_count > len) input_count = len;
+
+	for (i = 0; i < reps; i++) {
+		for (j = 0; j < len; j++) {
+			int idx = rand() % input_count;
+			new_vp = fr_pair_copy(autofree, source_vps[idx]);
+			fr_pair_append(&test_vps, new_vp);
+		}
+
+		start = fr_time();
+		for (j = 0; j < len; j++) {
+			da = source_vps[rand() % input_count]->da;
+
+			if (fr_pair_find_by_da(&test_vps, NULL, da)) found++;
+			if (fr_pair_count_by_da(&test_vps, da) > 1) found++;
+
+			/*
+			 *  Every so often, edit the list
+			 */
+			switch (j % 16) {
+			case 0:
+				(void) fr_pair_find_by_da_idx(&test_vps, da, 1);
+				break;
+
+			case 5:
+				fr_pair_delete_by_da(&test_vps, da);
+				break;
+
+			case 10:
+				(void) fr_pair_append_by_da(autofree, NULL, &test_vps, da);
+				break;
+
+			default:
+				break;
+			}
+		}
+		end = fr_time();
+		used = fr_time_delta_add(used, fr_time_sub(end, start));
+
+		fr_pair_list_free(&test_vps);
+	}
+	TEST_MSG_ALWAYS("repetitions=%d", reps);
+	TEST_MSG_ALWAYS("perc_rep=%d", perc);
+	TEST_MSG_ALWAYS("list_length=%d", len);
+	TEST_MSG_ALWAYS("indexed=%s", indexed ? "yes" : "no");
+	TEST_MSG_ALWAYS("found=%u", found);
+	TEST_MSG_ALWAYS("used=%"PRId64, fr_time_delta_unwrap(used));
+	TEST_MSG_ALWAYS("per_sec=%0.0lf", (reps * len)/(fr_time_delta_unwrap(used) / (double)NSEC));
+}
+
+static void do_test_lookup_mix(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[])
+{
+	lookup_mix(len, perc, reps, source_vps, false);
+}
+
+static void do_test_lookup_mix_indexed(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[])
+{
+	lookup_mix(len, perc, reps, source_vps, true);
+}
+
 static void do_test_find_nth(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[])
 {
 	fr_pair_list_t	  	test_vps;
@@ -479,7 +601,10 @@ static void test_ ## _func ## _ ## _count ## _ ## _perc(void)\
 
 all_test_funcs(fr_pair_append)
 all_test_funcs(fr_pair_find_by_da_idx)
+all_test_funcs(fr_pair_find_by_da_idx_indexed)
 all_test_funcs(find_nth)
+all_test_funcs(lookup_mix)
+all_test_funcs(lookup_mix_indexed)
 all_test_funcs(fr_pair_list_free)
 
 #define repetition_tests(_func, _perc) \
@@ -499,7 +624,10 @@ all_test_funcs(fr_pair_list_free)
 TEST_LIST = {
 	all_repetition_tests(fr_pair_append)
 	all_repetition_tests(fr_pair_find_by_da_idx)
+	all_repetition_tests(fr_pair_find_by_da_idx_indexed)
 	all_repetition_tests(find_nth)
+	all_repetition_tests(lookup_mix)
+	all_repetition_tests(lookup_mix_indexed)
 	all_repetition_tests(fr_pair_list_free)
 
 	{ NULL }
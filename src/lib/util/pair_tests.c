@@ -536,6 +536,103 @@ static void test_fr_pair_list_sort(void)
 	fr_pair_list_free(&local_pairs);
 }
 
+/** Check the results of indexed lookups against a walk of the list
+ *
+ */
+static bool pair_list_index_matches(fr_pair_list_t *list, fr_dict_attr_t const **das, size_t num_das)
+{
+	size_t i;
+
+	for (i = 0; i < num_das; i++) {
+		fr_pair_t	*vp = NULL, *first = NULL, *third = NULL;
+		unsigned int	count = 0;
+
+		while ((vp = fr_pair_list_next(list, vp))) {
+			if (vp->da != das[i]) continue;
+
+			if (!first) first = vp;
+			if (count == 2) third = vp;
+			count++;
+		}
+
+		if (fr_pair_find_by_da(list, NULL, das[i]) != first) return false;
+		if (fr_pair_count_by_da(list, das[i]) != count) return false;
+		if (fr_pair_find_by_da_idx(list, das[i], 2) != third) return false;
+	}
+
+	return true;
+}
+
+static void test_fr_pair_list_index(void)
+{
+	fr_dict_attr_t const	*das[] = {
+					fr_dict_attr_test_string, fr_dict_attr_test_octets,
+					fr_dict_attr_test_ipv4_addr, fr_dict_attr_test_uint8,
+					fr_dict_attr_test_uint16, fr_dict_attr_test_uint32,
+					fr_dict_attr_test_uint64, fr_dict_attr_test_date
+				};
+	fr_pair_list_t		local_pairs;
+	fr_pair_t		*vp;
+	fr_dcursor_t		cursor;
+	TALLOC_CTX		*ctx = talloc_null_ctx();
+	TALLOC_CTX		*index_ctx = talloc_init_const("index");
+	fr_pair_list_index_t	*index;
+	size_t			i;
+
+	TEST_CASE("Create an indexed list of 40 attributes");
+	fr_pair_list_init(&local_pairs);
+	TEST_CHECK(fr_pair_list_index_enable(index_ctx, &local_pairs) == 0);
+	index = local_pairs.index;
+
+	for (i = 0; i < 40; i++) TEST_CHECK(fr_pair_append_by_da(ctx, NULL, &local_pairs, das[i % NUM_ELEMENTS(das)]) == 0);
+	TEST_CHECK(pair_list_index_matches(&local_pairs, das, NUM_ELEMENTS(das)));
+
+	TEST_CASE("Append after the index has been built");
+	TEST_CHECK(fr_pair_append_by_da(ctx, NULL, &local_pairs, fr_dict_attr_test_int8) == 0);
+	TEST_CHECK(fr_pair_append_by_da(ctx, NULL, &local_pairs, fr_dict_attr_test_string) == 0);
+	TEST_CHECK(fr_pair_find_by_da(&local_pairs, NULL, fr_dict_attr_test_int8) == fr_pair_list_prev(&local_pairs, fr_pair_list_tail(&local_pairs)));
+	TEST_CHECK(pair_list_index_matches(&local_pairs, das, NUM_ELEMENTS(das)));
+
+	TEST_CASE("Remove the first instance of an attribute");
+	vp = fr_pair_find_by_da(&local_pairs, NULL, fr_dict_attr_test_octets);
+	TEST_CHECK(vp != NULL);
+	fr_pair_delete(&local_pairs, vp);
+	TEST_CHECK(pair_list_index_matches(&local_pairs, das, NUM_ELEMENTS(das)));
+
+	TEST_CASE("Prepend, which reorders the list");
+	TEST_CHECK(fr_pair_prepend_by_da(ctx, NULL, &local_pairs, fr_dict_attr_test_uint32) == 0);
+	TEST_CHECK(fr_pair_find_by_da(&local_pairs, NULL, fr_dict_attr_test_uint32) == fr_pair_list_head(&local_pairs));
+	TEST_CHECK(pair_list_index_matches(&local_pairs, das, NUM_ELEMENTS(das)));
+
+	TEST_CASE("Delete all instances of an attribute");
+	TEST_CHECK(fr_pair_delete_by_da(&local_pairs, fr_dict_attr_test_uint8) == 5);
+	TEST_CHECK(fr_pair_find_by_da(&local_pairs, NULL, fr_dict_attr_test_uint8) == NULL);
+	TEST_CHECK(pair_list_index_matches(&local_pairs, das, NUM_ELEMENTS(das)));
+
+	TEST_CASE("Remove attributes with a cursor");
+	for (vp = fr_pair_dcursor_by_da_init(&cursor, &local_pairs, fr_dict_attr_test_date);
+	     vp;
+	     vp = fr_dcursor_current(&cursor)) talloc_free(fr_dcursor_remove(&cursor));
+	TEST_CHECK(fr_pair_find_by_da(&local_pairs, NULL, fr_dict_attr_test_date) == NULL);
+	TEST_CHECK(pair_list_index_matches(&local_pairs, das, NUM_ELEMENTS(das)));
+
+	TEST_CASE("Sort the list");
+	fr_pair_list_sort(&local_pairs, fr_pair_cmp_by_da);
+	TEST_CHECK(pair_list_index_matches(&local_pairs, das, NUM_ELEMENTS(das)));
+
+	TEST_CASE("Empty the list, and reuse it");
+	fr_pair_list_free(&local_pairs);
+	TEST_CHECK(fr_pair_find_by_da(&local_pairs, NULL, fr_dict_attr_test_string) == NULL);
+	TEST_CHECK(fr_pair_count_by_da(&local_pairs, fr_dict_attr_test_string) == 0);
+	TEST_CHECK(local_pairs.index == index);
+
+	for (i = 0; i < 20; i++) TEST_CHECK(fr_pair_append_by_da(ctx, NULL, &local_pairs, das[i % NUM_ELEMENTS(das)]) == 0);
+	TEST_CHECK(pair_list_index_matches(&local_pairs, das, NUM_ELEMENTS(das)));
+
+	fr_pair_list_free(&local_pairs);
+	talloc_free(index_ctx);
+}
+
 static void test_fr_pair_value_copy(void)
 {
 	fr_pair_t *vp1, vp2;
@@ -1152,6 +1249,7 @@ TEST_LIST = {
 	{ "fr_pair_list_copy_by_da",              test_fr_pair_list_copy_by_da },
 	{ "fr_pair_list_copy_by_ancestor",        test_fr_pair_list_copy_by_ancestor },
 	{ "fr_pair_list_sort",                    test_fr_pair_list_sort },
+	{ "fr_pair_list_index",                   test_fr_pair_list_index },
 
 	/* Copy */
 	{ "fr_pair_value_copy",                   test_fr_pair_value_copy },
@@ -0,0 +1,230 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Publish read-mostly data to many threads, and replace it without locking the readers
+ *
+ * Each thread which reads the data registers a reader.  A read-side
+ * critical section records the current epoch in the reader, and clears
+ * it again when done.  A publisher swaps in the new data, moves the
+ * epoch on, and then waits until no reader is still in a critical
+ * section which started in an earlier epoch.  Only then is the old
+ * data freed.
+ *
+ * Readers never block, and never write to memory shared with other
+ * readers.  Publishing is slow, and should be done from a thread which
+ * isn't processing requests.
+ *
+ * @file src/lib/util/rcu.c
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/rcu.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/debug.h>
+
+#include <pthread.h>
+#include <time.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+struct fr_rcu_s {
+	_Atomic(void *)		data;			//!< Currently published data.
+	atomic_uint_fast64_t	epoch;			//!< Incremented every time data is replaced.
+
+	pthread_mutex_t		mutex;			//!< Protects the list of readers, and serialises
+							///< publishers.
+	fr_dlist_head_t		readers;		//!< Every thread which may read the data.
+};
+
+struct fr_rcu_reader_s {
+	fr_rcu_t		*rcu;			//!< We're reading from.
+	atomic_uint_fast64_t	epoch;			//!< Epoch the current critical section started in,
+							///< or 0 if we're not in one.
+	fr_dlist_t		entry;			//!< Entry in the list of readers.
+};
+
+static int _rcu_free(fr_rcu_t *rcu)
+{
+	fr_assert_msg(fr_dlist_num_elements(&rcu->readers) == 0, "RCU freed whilst it still has readers");
+
+	talloc_free(atomic_load_explicit(&rcu->data, memory_order_relaxed));
+	pthread_mutex_destroy(&rcu->mutex);
+
+	return 0;
+}
+
+/** Allocate a new RCU-protected pointer
+ *
+ * @param[in] ctx	to allocate the RCU structure in.
+ * @param[in] data	initial data to publish, may be NULL.  The data is
+ *			freed when it's replaced, or when the RCU structure
+ *			is freed.  It should not be parented by a talloc
+ *			context which other threads allocate from.
+ * @return
+ *	- A new RCU structure.
+ *	- NULL on error.
+ */
+fr_rcu_t *fr_rcu_alloc(TALLOC_CTX *ctx, void *data)
+{
+	fr_rcu_t *rcu;
+
+	rcu = talloc_zero(ctx, fr_rcu_t);
+	if (!rcu) return NULL;
+
+	if (pthread_mutex_init(&rcu->mutex, NULL) != 0) {
+		fr_strerror_const("Failed initialising mutex");
+		talloc_free(rcu);
+		return NULL;
+	}
+
+	atomic_init(&rcu->data, data);
+	atomic_init(&rcu->epoch, 1);
+	fr_dlist_init(&rcu->readers, fr_rcu_reader_t, entry);
+	talloc_set_destructor(rcu, _rcu_free);
+
+	return rcu;
+}
+
+static int _rcu_reader_free(fr_rcu_reader_t *reader)
+{
+	fr_rcu_t *rcu = reader->rcu;
+
+	fr_assert(atomic_load_explicit(&reader->epoch, memory_order_relaxed) == 0);
+
+	pthread_mutex_lock(&rcu->mutex);
+	fr_dlist_remove(&rcu->readers, reader);
+	pthread_mutex_unlock(&rcu->mutex);
+
+	return 0;
+}
+
+/** Register a thread as a reader
+ *
+ * Each thread which calls fr_rcu_read_lock() needs its own reader.
+ *
+ * @param[in] ctx	to allocate the reader in.  Usually thread
+ *			instance data.  The reader must be freed before
+ *			the RCU structure.
+ * @param[in] rcu	to read from.
+ * @return
+ *	- A new reader.
+ *	- NULL on error.
+ */
+fr_rcu_reader_t *fr_rcu_reader_alloc(TALLOC_CTX *ctx, fr_rcu_t *rcu)
+{
+	fr_rcu_reader_t *reader;
+
+	reader = talloc_zero(ctx, fr_rcu_reader_t);
+	if (!reader) return NULL;
+
+	reader->rcu = rcu;
+	atomic_init(&reader->epoch, 0);
+
+	pthread_mutex_lock(&rcu->mutex);
+	fr_dlist_insert_tail(&rcu->readers, reader);
+	pthread_mutex_unlock(&rcu->mutex);
+
+	talloc_set_destructor(reader, _rcu_reader_free);
+
+	return reader;
+}
+
+/** Start a read-side critical section
+ *
+ * The returned data remains valid until fr_rcu_read_unlock() is called.
+ * Critical sections must not be nested, and should be short, as they
+ * hold up publishers.
+ *
+ * @param[in] reader	belonging to the calling thread.
+ * @return the currently published data.
+ */
+void *fr_rcu_read_lock(fr_rcu_reader_t *reader)
+{
+	fr_rcu_t *rcu = reader->rcu;
+
+	fr_assert(atomic_load_explicit(&reader->epoch, memory_order_relaxed) == 0);
+
+	/*
+	 *	Both of these are sequentially consistent.  If the
+	 *	publisher doesn't see our epoch, then we're guaranteed
+	 *	to see the data it published.
+	 */
+	atomic_store(&reader->epoch, atomic_load(&rcu->epoch));
+
+	return atomic_load(&rcu->data);
+}
+
+/** End a read-side critical section
+ *
+ * @param[in] reader	belonging to the calling thread.
+ */
+void fr_rcu_read_unlock(fr_rcu_reader_t *reader)
+{
+	atomic_store_explicit(&reader->epoch, 0, memory_order_release);
+}
+
+/** Replace the published data, and free the old data once no readers are using it
+ *
+ * This function blocks until every reader which could have seen the
+ * old data has left its critical section.
+ *
+ * @param[in] rcu	to publish to.
+ * @param[in] data	to publish.  Ownership passes to the RCU structure.
+ */
+void fr_rcu_publish(fr_rcu_t *rcu, void *data)
+{
+	void			*old;
+	uint_fast64_t		epoch;
+	struct timespec		ts = { .tv_sec = 0, .tv_nsec = 1000000 };
+
+	pthread_mutex_lock(&rcu->mutex);
+
+	old = atomic_exchange(&rcu->data, data);
+	epoch = atomic_fetch_add(&rcu->epoch, 1) + 1;
+
+	for (;;) {
+		fr_rcu_reader_t	*reader = NULL;
+		bool		busy = false;
+
+		while ((reader = fr_dlist_next(&rcu->readers, reader))) {
+			uint_fast64_t seen = atomic_load(&reader->epoch);
+
+			if (seen && (seen < epoch)) {
+				busy = true;
+				break;
+			}
+		}
+
+		if (!busy) break;
+
+		/*
+		 *	Let readers come and go whilst we wait.
+		 */
+		pthread_mutex_unlock(&rcu->mutex);
+		nanosleep(&ts, NULL);
+		pthread_mutex_lock(&rcu->mutex);
+	}
+
+	pthread_mutex_unlock(&rcu->mutex);
+
+	talloc_free(old);
+}
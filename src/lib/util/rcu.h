@@ -0,0 +1,49 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Publish read-mostly data to many threads, and replace it without locking the readers
+ *
+ * @file src/lib/util/rcu.h
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+RCSIDH(rcu_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/missing.h>
+#include <freeradius-devel/util/talloc.h>
+
+typedef struct fr_rcu_s fr_rcu_t;
+typedef struct fr_rcu_reader_s fr_rcu_reader_t;
+
+fr_rcu_t		*fr_rcu_alloc(TALLOC_CTX *ctx, void *data);
+
+fr_rcu_reader_t		*fr_rcu_reader_alloc(TALLOC_CTX *ctx, fr_rcu_t *rcu);
+
+void			*fr_rcu_read_lock(fr_rcu_reader_t *reader);
+
+void			fr_rcu_read_unlock(fr_rcu_reader_t *reader);
+
+void			fr_rcu_publish(fr_rcu_t *rcu, void *data);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,169 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for RCU-protected data
+ *
+ * @file src/lib/util/rcu_tests.c
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/rcu.h>
+
+#include <pthread.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+#define NUM_READERS		4
+#define NUM_GENERATIONS		2000
+
+typedef struct {
+	uint64_t		id;
+} rcu_gen_t;
+
+static atomic_uint_fast64_t	freed_max;	//!< Highest generation which has been freed.
+static atomic_uint_fast64_t	freed_count;
+static atomic_bool		stop;
+static atomic_uint_fast64_t	errors;
+
+static int _rcu_gen_free(rcu_gen_t *gen)
+{
+	atomic_store(&freed_max, gen->id);
+	atomic_fetch_add(&freed_count, 1);
+
+	return 0;
+}
+
+static rcu_gen_t *rcu_gen_alloc(uint64_t id)
+{
+	rcu_gen_t *gen;
+
+	gen = talloc_zero(NULL, rcu_gen_t);
+	gen->id = id;
+	talloc_set_destructor(gen, _rcu_gen_free);
+
+	return gen;
+}
+
+static void rcu_test_basic(void)
+{
+	fr_rcu_t	*rcu;
+	fr_rcu_reader_t	*reader;
+	rcu_gen_t	*gen;
+
+	atomic_store(&freed_count, 0);
+
+	rcu = fr_rcu_alloc(NULL, rcu_gen_alloc(1));
+	TEST_CHECK(rcu != NULL);
+
+	reader = fr_rcu_reader_alloc(NULL, rcu);
+	TEST_CHECK(reader != NULL);
+
+	gen = fr_rcu_read_lock(reader);
+	TEST_CHECK(gen && (gen->id == 1));
+	fr_rcu_read_unlock(reader);
+
+	fr_rcu_publish(rcu, rcu_gen_alloc(2));
+	TEST_CHECK(atomic_load(&freed_count) == 1);
+	TEST_MSG("old data was not freed");
+
+	gen = fr_rcu_read_lock(reader);
+	TEST_CHECK(gen && (gen->id == 2));
+	fr_rcu_read_unlock(reader);
+
+	talloc_free(reader);
+	talloc_free(rcu);
+	TEST_CHECK(atomic_load(&freed_count) == 2);
+	TEST_MSG("current data was not freed with the RCU structure");
+}
+
+static void *rcu_reader_thread(void *arg)
+{
+	fr_rcu_t	*rcu = arg;
+	fr_rcu_reader_t	*reader;
+
+	reader = fr_rcu_reader_alloc(NULL, rcu);
+
+	while (!atomic_load(&stop)) {
+		rcu_gen_t	*gen;
+		uint64_t	id;
+		int		i;
+
+		gen = fr_rcu_read_lock(reader);
+		id = gen->id;
+
+		/*
+		 *	Hold the data for a while, and check nobody
+		 *	freed it underneath us.
+		 */
+		for (i = 0; i < 100; i++) {
+			if ((atomic_load(&freed_max) >= id) || (gen->id != id)) {
+				atomic_fetch_add(&errors, 1);
+				break;
+			}
+		}
+
+		fr_rcu_read_unlock(reader);
+	}
+
+	talloc_free(reader);
+
+	return NULL;
+}
+
+static void rcu_test_concurrent(void)
+{
+	fr_rcu_t	*rcu;
+	pthread_t	threads[NUM_READERS];
+	uint64_t	i;
+
+	atomic_store(&freed_max, 0);
+	atomic_store(&freed_count, 0);
+	atomic_store(&errors, 0);
+	atomic_store(&stop, false);
+
+	rcu = fr_rcu_alloc(NULL, rcu_gen_alloc(1));
+	TEST_CHECK(rcu != NULL);
+
+	for (i = 0; i < NUM_READERS; i++) {
+		TEST_CHECK(pthread_create(&threads[i], NULL, rcu_reader_thread, rcu) == 0);
+	}
+
+	for (i = 2; i <= NUM_GENERATIONS; i++) fr_rcu_publish(rcu, rcu_gen_alloc(i));
+
+	atomic_store(&stop, true);
+	for (i = 0; i < NUM_READERS; i++) pthread_join(threads[i], NULL);
+
+	TEST_CHECK(atomic_load(&errors) == 0);
+	TEST_MSG("readers saw their data freed %" PRIu64 " times", (uint64_t) atomic_load(&errors));
+
+	TEST_CHECK(atomic_load(&freed_count) == NUM_GENERATIONS - 1);
+	TEST_MSG("expected %u generations freed, got %" PRIu64,
+		 NUM_GENERATIONS - 1, (uint64_t) atomic_load(&freed_count));
+
+	talloc_free(rcu);
+}
+
+TEST_LIST = {
+	{ "rcu_test_basic",		rcu_test_basic },
+	{ "rcu_test_concurrent",	rcu_test_concurrent },
+	{ NULL }
+};
@@ -40,6 +40,10 @@
 
 #include <ifaddrs.h>
 
+#ifdef __linux__
+#  include <linux/filter.h>
+#endif
+
 /** Resolve a named service to a port
  *
  * @param[in] proto	The protocol. Either IPPROTO_TCP or IPPROTO_UDP.
@@ -1042,3 +1046,76 @@ done:
 #endif
 	return 0;
 }
+
+/** Steer packets in a SO_REUSEPORT group by source IP address
+ *
+ * By default the kernel distributes packets across the sockets in a
+ * reuseport group using a hash of the 4-tuple.  This attaches a classic
+ * BPF program to the group which hashes only the source IP address, so
+ * that all packets from a given client are delivered to the same socket
+ * no matter which source port they come from.
+ *
+ * The program is shared by the whole group, so it only needs to be
+ * attached to one of the sockets.  The value it returns is the index of
+ * the socket in the group, which is the order the sockets were bound in.
+ *
+ * @param[in] sockfd	any socket in the reuseport group.
+ * @param[in] num	number of sockets in the group.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure, or if the platform doesn't support steering.
+ */
+#if defined(SO_ATTACH_REUSEPORT_CBPF) && defined(SKF_NET_OFF)
+int fr_socket_reuseport_steer(int sockfd, unsigned int num)
+{
+	struct sock_filter code[] = {
+		/* A = IP version */
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF + 0),
+		BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 4),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 6, 2, 0),
+
+		/* IPv4: A = saddr */
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12),
+		BPF_JUMP(BPF_JMP | BPF_JA, 10, 0, 0),
+
+		/* IPv6: A = saddr[0] ^ saddr[1] ^ saddr[2] ^ saddr[3] */
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 8),
+		BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12),
+		BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+		BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 16),
+		BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+		BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 20),
+		BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+
+		/* return ((A * golden ratio) >> 16) % num */
+		BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 0x9e3779b1),
+		BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+		BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, num),
+		BPF_STMT(BPF_RET | BPF_A, 0)
+	};
+	struct sock_fprog prog = {
+		.len = NUM_ELEMENTS(code),
+		.filter = code
+	};
+
+	if (num < 2) return 0;
+
+	if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+		fr_strerror_printf("Failed attaching reuseport filter: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+#else
+int fr_socket_reuseport_steer(UNUSED int sockfd, unsigned int num)
+{
+	if (num < 2) return 0;
+
+	fr_strerror_const("Steering reuseport groups is not supported on this platform");
+	return -1;
+}
+#endif
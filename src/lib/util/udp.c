@@ -213,3 +213,407 @@ done:
 
 	return slen;
 }
+
+/** Size of the control buffer for each message, enough for PKTINFO and SO_TIMESTAMP
+ *
+ */
+#define UDP_MMSG_CBUF_SIZE	256
+
+struct fr_udp_mmsg_s {
+	unsigned int		num;			//!< Maximum number of datagrams to read or write at once.
+	unsigned int		count;			//!< Number of datagrams returned by the last recvmmsg(),
+							///< or queued for the next sendmmsg().
+	unsigned int		next;			//!< Next datagram to return to the caller,
+							///< or the first one which hasn't been written.
+
+	int			sockfd;			//!< Socket the queued datagrams will be written to.
+
+	size_t			max_packet_size;	//!< Size of each receive buffer.
+
+	fr_time_t		when;			//!< When the batch was read, if there's no SO_TIMESTAMP.
+
+	struct sockaddr_storage	local;			//!< Address the socket is bound to.
+	socklen_t		local_len;		//!< Length of the local address, 0 until
+							///< the first read.
+
+	struct mmsghdr		*msgvec;		//!< Headers passed to recvmmsg().
+	struct iovec		*iov;			//!< One per message, pointing into buffer.
+	struct sockaddr_storage	*addr;			//!< Source address of each received message,
+							///< or destination address of each sent one.
+	uint8_t			*cbuf;			//!< Control data for each message.
+	uint8_t			*buffer;		//!< Packet data for each message.
+};
+
+/** Allocate a structure for batched reads from, or writes to a UDP socket
+ *
+ * A structure should be used for either reading or writing, not both,
+ * and only with one socket.
+ *
+ * @param[in] ctx		to allocate the structure in.
+ * @param[in] num		maximum number of datagrams to read or write in one system call.
+ * @param[in] max_packet_size	the largest datagram we expect to receive.
+ * @return
+ *	- a new batch structure.
+ *	- NULL on error.
+ */
+fr_udp_mmsg_t *udp_mmsg_alloc(TALLOC_CTX *ctx, unsigned int num, size_t max_packet_size)
+{
+	fr_udp_mmsg_t	*mm;
+
+	if (!num || !max_packet_size) {
+		fr_strerror_const("Invalid arguments");
+		return NULL;
+	}
+
+	mm = talloc_zero(ctx, fr_udp_mmsg_t);
+	if (!mm) {
+	oom:
+		fr_strerror_const("Out of memory");
+		talloc_free(mm);
+		return NULL;
+	}
+
+	mm->num = num;
+	mm->max_packet_size = max_packet_size;
+
+	mm->msgvec = talloc_zero_array(mm, struct mmsghdr, num);
+	if (!mm->msgvec) goto oom;
+
+	mm->iov = talloc_zero_array(mm, struct iovec, num);
+	if (!mm->iov) goto oom;
+
+	mm->addr = talloc_zero_array(mm, struct sockaddr_storage, num);
+	if (!mm->addr) goto oom;
+
+	mm->cbuf = talloc_zero_array(mm, uint8_t, num * UDP_MMSG_CBUF_SIZE);
+	if (!mm->cbuf) goto oom;
+
+	mm->buffer = talloc_array(mm, uint8_t, num * max_packet_size);
+	if (!mm->buffer) goto oom;
+
+	return mm;
+}
+
+/** Whether there are datagrams left over from a previous batched read
+ *
+ * The socket may not be readable even though we still have data
+ * buffered, so callers MUST keep calling udp_recv_mmsg() until this
+ * function returns false.
+ *
+ * @param[in] mm	the batch structure.  May be NULL.
+ * @return
+ *	- true if there is more data to return.
+ *	- false if the next read will call recvmmsg().
+ */
+bool udp_mmsg_pending(fr_udp_mmsg_t const *mm)
+{
+	if (!mm) return false;
+
+	return (mm->next < mm->count);
+}
+
+/** Read multiple datagrams in one system call
+ *
+ * @param[in] mm		the batch structure.
+ * @param[in] sockfd		we're reading from.
+ * @param[in] flags		UDP_FLAGS_CONNECTED if the socket is connected.
+ * @return
+ *	- > 0 the number of datagrams read.
+ *	- 0 if there was no data.
+ *	- < 0 on error.
+ */
+static int udp_mmsg_fill(fr_udp_mmsg_t *mm, int sockfd, int flags)
+{
+	unsigned int	i;
+	int		num;
+
+	mm->next = mm->count = 0;
+
+	/*
+	 *	recvmmsg() doesn't tell us the destination port,
+	 *	so we have to get it from the socket.  A batch
+	 *	structure is only used with one socket, so we
+	 *	only need to ask once.
+	 */
+	if (!(flags & UDP_FLAGS_CONNECTED) && !mm->local_len) {
+		socklen_t local_len = sizeof(mm->local);
+
+		if (getsockname(sockfd, (struct sockaddr *)&mm->local, &local_len) < 0) {
+			fr_strerror_printf("Failed getting socket name: %s", fr_syserror(errno));
+			return -1;
+		}
+		mm->local_len = local_len;
+	}
+
+	/*
+	 *	The kernel overwrites the lengths, so we have to
+	 *	reset them before each read.
+	 */
+	for (i = 0; i < mm->num; i++) {
+		struct msghdr *msgh = &mm->msgvec[i].msg_hdr;
+
+		mm->iov[i].iov_base = mm->buffer + (i * mm->max_packet_size);
+		mm->iov[i].iov_len = mm->max_packet_size;
+
+		*msgh = (struct msghdr) {
+			.msg_iov = &mm->iov[i],
+			.msg_iovlen = 1,
+		};
+		mm->msgvec[i].msg_len = 0;
+
+		if (flags & UDP_FLAGS_CONNECTED) continue;
+
+		msgh->msg_name = &mm->addr[i];
+		msgh->msg_namelen = sizeof(mm->addr[i]);
+		msgh->msg_control = mm->cbuf + (i * UDP_MMSG_CBUF_SIZE);
+		msgh->msg_controllen = UDP_MMSG_CBUF_SIZE;
+	}
+
+	num = recvmmsg(sockfd, mm->msgvec, mm->num, MSG_DONTWAIT, NULL);
+	if (num < 0) {
+		if ((errno == EWOULDBLOCK) || (errno == EAGAIN) || (errno == EINTR)) return 0;
+
+		fr_strerror_printf("Failed reading socket: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	mm->count = num;
+	mm->when = fr_time();
+
+	return num;
+}
+
+/** Read a UDP packet, using recvmmsg() to read many packets at once
+ *
+ * The first call reads as many datagrams as are available (up to the
+ * size of the batch), and returns the first one.  Subsequent calls
+ * return the remaining datagrams without any system calls.
+ *
+ * Callers must use udp_mmsg_pending() to check if there are more
+ * datagrams to return, as the socket may no longer be readable.
+ *
+ * @param[in] mm		the batch structure, from udp_mmsg_alloc().
+ * @param[in] sockfd		we're reading from.
+ * @param[in] flags		for things
+ * @param[out] socket_out	Information about the src/dst address of the packet
+ *				and the interface it was received on.
+ * @param[out] data		pointer where data will be written
+ * @param[in] data_len		length of data to read
+ * @param[out] when		the packet was received.
+ * @return
+ *	- > 0 on success (number of bytes read).
+ *	- 0 if there was no data.
+ *	- < 0 on failure.
+ */
+ssize_t udp_recv_mmsg(fr_udp_mmsg_t *mm, int sockfd, int flags,
+		      fr_socket_t *socket_out, void *data, size_t data_len, fr_time_t *when)
+{
+	struct mmsghdr		*msg;
+	struct sockaddr_storage	dst;
+	socklen_t		sizeof_dst;
+	size_t			len;
+
+	/*
+	 *	Peeking makes no sense for batched reads.
+	 */
+	if ((flags & UDP_FLAGS_PEEK) != 0) return udp_recv(sockfd, flags, socket_out, data, data_len, when);
+
+	if (mm->next >= mm->count) {
+		int num;
+
+		num = udp_mmsg_fill(mm, sockfd, flags);
+		if (num <= 0) {
+			*socket_out = (fr_socket_t){
+				.fd = sockfd,
+				.proto = IPPROTO_UDP
+			};
+			if (when) *when = fr_time_wrap(0);
+			return num;
+		}
+	}
+
+	msg = &mm->msgvec[mm->next++];
+
+	*socket_out = (fr_socket_t){
+		.fd = sockfd,
+		.proto = IPPROTO_UDP
+	};
+
+	/*
+	 *	The OS will discard any data in the packet after "len"
+	 *	bytes, so we do the same.
+	 */
+	len = msg->msg_len;
+	if (len > data_len) len = data_len;
+	memcpy(data, msg->msg_hdr.msg_iov->iov_base, len);
+
+	if (when) *when = fr_time_wrap(0);
+
+	/*
+	 *	Connected sockets already know src/dst IP/port
+	 */
+	if ((flags & UDP_FLAGS_CONNECTED) == 0) {
+		memcpy(&dst, &mm->local, sizeof(dst));
+		sizeof_dst = mm->local_len;
+
+		recvfromto_cmsg(&msg->msg_hdr, &socket_out->inet.ifindex,
+				(struct sockaddr *)&dst, &sizeof_dst, when);
+
+		if (fr_ipaddr_from_sockaddr(&socket_out->inet.src_ipaddr, &socket_out->inet.src_port,
+					    msg->msg_hdr.msg_name, msg->msg_hdr.msg_namelen) < 0) {
+			fr_strerror_const_push("Failed converting src sockaddr to ipaddr");
+			return -1;
+		}
+		if (fr_ipaddr_from_sockaddr(&socket_out->inet.dst_ipaddr, &socket_out->inet.dst_port,
+					    &dst, sizeof_dst) < 0) {
+			fr_strerror_const_push("Failed converting dst sockaddr to ipaddr");
+			return -1;
+		}
+	}
+
+	/*
+	 *	We didn't get it from the kernel, so use the time
+	 *	the batch was read.
+	 */
+	if (when && fr_time_eq(*when, fr_time_wrap(0))) *when = mm->when;
+
+	return len;
+}
+
+/** Write all queued datagrams with one sendmmsg() call
+ *
+ * If the socket would block, the datagrams which haven't been written
+ * stay queued, and the caller should call this function again once the
+ * socket is writable.  Any other error discards the datagram it
+ * occurred for, as with udp_send().
+ *
+ * @param[in] mm	the batch structure.
+ * @return
+ *	- >= 0 the number of datagrams written.
+ *	- < 0 if the socket would block (errno is EWOULDBLOCK), or no
+ *	  datagrams could be written.
+ */
+int udp_mmsg_flush(fr_udp_mmsg_t *mm)
+{
+	unsigned int	sent = 0, failed = 0;
+	int		ret;
+
+	while (mm->next < mm->count) {
+		ret = sendmmsg(mm->sockfd, mm->msgvec + mm->next, mm->count - mm->next, 0);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+
+			/*
+			 *	Leave the rest queued until the
+			 *	socket is writable again.
+			 */
+			if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) {
+				fr_strerror_const("udp_mmsg_flush would block");
+				errno = EWOULDBLOCK;
+				return -1;
+			}
+
+			/*
+			 *	The first message couldn't be sent.
+			 *	Discard it, and send the rest.
+			 */
+			fr_strerror_printf("udp_mmsg_flush failed: %s", fr_syserror(errno));
+			failed++;
+			mm->next++;
+			continue;
+		}
+
+		sent += ret;
+		mm->next += ret;
+	}
+
+	mm->count = 0;
+	mm->next = 0;
+
+	if (failed && !sent) return -1;
+
+	return sent;
+}
+
+/** Queue a UDP packet to be sent with sendmmsg()
+ *
+ * The data is copied, so the caller can re-use the buffer as soon as
+ * this function returns.  Queued packets are sent when the batch is
+ * full, or when udp_mmsg_flush() is called.  The caller MUST call
+ * udp_mmsg_flush() before going back to the event loop.
+ *
+ * If the batch is full, and the socket would block, the packet isn't
+ * queued, and errno is set to EWOULDBLOCK.
+ *
+ * @param[in] mm		the batch structure, from udp_mmsg_alloc().
+ * @param[in] socket		we're writing to.
+ * @param[in] flags		UDP_FLAGS_CONNECTED if the socket is connected.
+ * @param[in] data		to data to send
+ * @param[in] data_len		length of data to send
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int udp_send_mmsg(fr_udp_mmsg_t *mm, fr_socket_t const *socket, int flags, void *data, size_t data_len)
+{
+	struct msghdr		*msgh;
+	struct sockaddr_storage	src;
+	socklen_t		sizeof_src;
+	socklen_t		sizeof_dst;
+	unsigned int		i;
+
+	if (unlikely(socket->proto != IPPROTO_UDP)) {
+		fr_strerror_printf("Invalid proto type %u", socket->proto);
+		return -1;
+	}
+
+	/*
+	 *	Too large to queue, or for a different socket.  Send
+	 *	whatever we have, and then send this packet directly.
+	 */
+	if ((data_len > mm->max_packet_size) || (mm->count && (mm->sockfd != socket->fd))) {
+		if (mm->count && (udp_mmsg_flush(mm) < 0) && mm->count) return -1;	/* Would block */
+
+		if (data_len > mm->max_packet_size) return udp_send(socket, flags, data, data_len);
+	}
+
+	/*
+	 *	Datagrams discarded because of errors other than
+	 *	EWOULDBLOCK don't stop us queueing this one.
+	 */
+	if ((mm->count >= mm->num) && (udp_mmsg_flush(mm) < 0) && mm->count) return -1;	/* Would block */
+
+	i = mm->count;
+	msgh = &mm->msgvec[i].msg_hdr;
+
+	*msgh = (struct msghdr) {
+		.msg_iov = &mm->iov[i],
+		.msg_iovlen = 1,
+	};
+	mm->msgvec[i].msg_len = 0;
+
+	mm->iov[i].iov_base = mm->buffer + (i * mm->max_packet_size);
+	mm->iov[i].iov_len = data_len;
+	memcpy(mm->iov[i].iov_base, data, data_len);
+
+	if ((flags & UDP_FLAGS_CONNECTED) == 0) {
+		if (fr_ipaddr_to_sockaddr(&mm->addr[i], &sizeof_dst,
+					  &socket->inet.dst_ipaddr, socket->inet.dst_port) < 0) return -1;
+		if (fr_ipaddr_to_sockaddr(&src, &sizeof_src,
+					  &socket->inet.src_ipaddr, socket->inet.src_port) < 0) return -1;
+
+		msgh->msg_name = &mm->addr[i];
+		msgh->msg_namelen = sizeof_dst;
+
+		if (sendfromto_cmsg(socket->fd, msgh, mm->cbuf + (i * UDP_MMSG_CBUF_SIZE),
+				    socket->inet.ifindex, (struct sockaddr *)&src, sizeof_src) < 0) {
+			fr_strerror_printf("udp_send_mmsg failed: %s", fr_syserror(errno));
+			return -1;
+		}
+	}
+
+	mm->sockfd = socket->fd;
+	mm->count++;
+
+	return 0;
+}
@@ -31,6 +31,7 @@ extern "C" {
 #include <freeradius-devel/missing.h>
 #include <freeradius-devel/util/inet.h>
 #include <freeradius-devel/util/socket.h>
+#include <freeradius-devel/util/talloc.h>
 #include <freeradius-devel/util/time.h>
 #include <freeradius-devel/util/udpfromto.h>
 
@@ -47,6 +48,22 @@ ssize_t udp_recv_peek(int sockfd, void *data, size_t data_len, int flags, fr_ipa
 ssize_t udp_recv(int sockfd, int flags,
 		 fr_socket_t *socket_out, void *data, size_t data_len, fr_time_t *when);
 
+/** Datagrams read from, or written to a socket in one recvmmsg() / sendmmsg() call
+ *
+ */
+typedef struct fr_udp_mmsg_s fr_udp_mmsg_t;
+
+fr_udp_mmsg_t *udp_mmsg_alloc(TALLOC_CTX *ctx, unsigned int num, size_t max_packet_size);
+
+bool udp_mmsg_pending(fr_udp_mmsg_t const *mm);
+
+ssize_t udp_recv_mmsg(fr_udp_mmsg_t *mm, int sockfd, int flags,
+		      fr_socket_t *socket_out, void *data, size_t data_len, fr_time_t *when);
+
+int udp_send_mmsg(fr_udp_mmsg_t *mm, fr_socket_t const *socket, int flags, void *data, size_t data_len);
+
+int udp_mmsg_flush(fr_udp_mmsg_t *mm);
+
 #ifdef __cplusplus
 }
 #endif
@@ -39,12 +39,19 @@ extern "C" {
 
 int	udpfromto_init(int s);
 
+void	recvfromto_cmsg(struct msghdr *msgh, int *ifindex,
+			struct sockaddr *to, socklen_t *to_len,
+			fr_time_t *when);
+
 int	recvfromto(int s, void *buf, size_t len, int flags,
 		   int *ifindex,
 	       	   struct sockaddr *from, socklen_t *fromlen,
 		   struct sockaddr *to, socklen_t *tolen,
 		   fr_time_t *when);
 
+int	sendfromto_cmsg(int fd, struct msghdr *msgh, void *cbuf,
+			int ifindex, struct sockaddr *from, socklen_t from_len);
+
 int	sendfromto(int s, void *buf, size_t len, int flags,
 		   int ifindex,
 		   struct sockaddr *from, socklen_t fromlen,
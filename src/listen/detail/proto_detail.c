@@ -25,7 +25,9 @@
 #include <freeradius-devel/io/application.h>
 #include <freeradius-devel/io/listen.h>
 #include <freeradius-devel/io/schedule.h>
+#include <freeradius-devel/internal/internal.h>
 #include <freeradius-devel/radius/radius.h>
+#include <freeradius-devel/server/detail.h>
 #include <freeradius-devel/util/pair_legacy.h>
 
 #include "proto_detail.h"
@@ -181,6 +183,95 @@ static int transport_parse(TALLOC_CTX *ctx, void *out, UNUSED void *parent,
 	return dl_module_instance(ctx, out, transport_cs, parent_inst, name, DL_MODULE_TYPE_SUBMODULE);
 }
 
+/** Set the original src/dst ip/port, and the protocol from a decoded attribute
+ *
+ */
+static int detail_packet_header_set(request_t *request, fr_pair_t const *vp)
+{
+	if ((vp->da == attr_packet_src_ip_address) ||
+	    (vp->da == attr_packet_src_ipv6_address)) {
+		request->packet->socket.inet.src_ipaddr = vp->vp_ip;
+	} else if ((vp->da == attr_packet_dst_ip_address) ||
+		   (vp->da == attr_packet_dst_ipv6_address)) {
+		request->packet->socket.inet.dst_ipaddr = vp->vp_ip;
+	} else if (vp->da == attr_packet_src_port) {
+		request->packet->socket.inet.src_port = vp->vp_uint16;
+	} else if (vp->da == attr_packet_dst_port) {
+		request->packet->socket.inet.dst_port = vp->vp_uint16;
+	} else if (vp->da == attr_protocol) {
+		request->dict = fr_dict_by_protocol_num(vp->vp_uint32);
+		if (!request->dict) {
+			REDEBUG("Invalid protocol: %pP", vp);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/** Decode a binary detail record, as written by rlm_detail with "format = binary"
+ *
+ * The attributes are in the internal encoding, so there's no text
+ * to parse.
+ */
+static int mod_decode_binary(request_t *request, uint8_t const *data, size_t data_len)
+{
+	fr_detail_binary_hdr_t	hdr;
+	fr_pair_list_t		tmp_list;
+	fr_pair_t		*vp;
+	uint8_t const		*p, *end;
+	ssize_t			slen;
+
+	if (fr_detail_binary_hdr_decode(&hdr, data, data_len) < 0) {
+		RPEDEBUG("Malformed binary detail record");
+		return -1;
+	}
+
+	/*
+	 *	As with text entries, the packet code comes from the
+	 *	listener's "type", and not from the record.
+	 */
+	request->dict = fr_dict_by_protocol_num(hdr.protocol);
+	if (!request->dict) {
+		REDEBUG("Invalid protocol %u in binary detail record", hdr.protocol);
+		return -1;
+	}
+
+	fr_pair_list_init(&tmp_list);
+
+	p = data + FR_DETAIL_BINARY_HDR_LEN;
+	end = data + hdr.length;
+	while (p < end) {
+		slen = fr_internal_decode_pair(request->request_ctx, &tmp_list, fr_dict_root(request->dict),
+					       p, end - p, NULL);
+		if (slen <= 0) {
+			RPEDEBUG("Failed decoding attribute at offset %zu of binary detail record", (size_t) (p - data));
+		error:
+			fr_pair_list_free(&tmp_list);
+			return -1;
+		}
+		p += slen;
+	}
+
+	for (vp = fr_pair_list_head(&tmp_list);
+	     vp;
+	     vp = fr_pair_list_next(&tmp_list, vp)) {
+		if (detail_packet_header_set(request, vp) < 0) goto error;
+	}
+
+	/*
+	 *	The original time at which we received the packet.
+	 *	We need this to properly calculate Acct-Delay-Time.
+	 */
+	MEM(vp = fr_pair_afrom_da(request->request_ctx, attr_packet_original_timestamp));
+	vp->vp_date = hdr.timestamp;
+	fr_pair_append(&tmp_list, vp);
+
+	fr_pair_list_append(&request->request_pairs, &tmp_list);
+
+	return 0;
+}
+
 /** Decode the packet, and set the request->process function
  *
  */
@@ -210,6 +301,12 @@ static int mod_decode(void const *instance, request_t *request, uint8_t *const d
 	request->reply->socket.inet.src_ipaddr = request->packet->socket.inet.src_ipaddr;
 	request->reply->socket.inet.dst_ipaddr = request->packet->socket.inet.src_ipaddr;
 
+	if ((data_len > 0) && (data[0] == FR_DETAIL_BINARY_MAGIC)) {
+		if (mod_decode_binary(request, data, data_len) < 0) return -1;
+
+		return inst->app_io->decode(inst->app_io_instance, request, data, data_len);
+	}
+
 	end = data + data_len;
 
 	MPRINT("HEADER %s", data);
@@ -303,25 +400,7 @@ static int mod_decode(void const *instance, request_t *request, uint8_t *const d
 		/*
 		 *	Set the original src/dst ip/port
 		 */
-		if (vp) {
-			if ((vp->da == attr_packet_src_ip_address) ||
-			    (vp->da == attr_packet_src_ipv6_address)) {
-				request->packet->socket.inet.src_ipaddr = vp->vp_ip;
-			} else if ((vp->da == attr_packet_dst_ip_address) ||
-				   (vp->da == attr_packet_dst_ipv6_address)) {
-				request->packet->socket.inet.dst_ipaddr = vp->vp_ip;
-			} else if (vp->da == attr_packet_src_port) {
-				request->packet->socket.inet.src_port = vp->vp_uint16;
-			} else if (vp->da == attr_packet_dst_port) {
-				request->packet->socket.inet.dst_port = vp->vp_uint16;
-			} else if (vp->da == attr_protocol) {
-				request->dict = fr_dict_by_protocol_num(vp->vp_uint32);
-				if (!request->dict) {
-					REDEBUG("Invalid protocol: %pP", vp);
-					goto error;
-				}
-			}
-		}
+		if (vp && (detail_packet_header_set(request, vp) < 0)) goto error;
 
 	next:
 		lineno++;
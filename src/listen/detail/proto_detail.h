@@ -29,6 +29,12 @@ RCSIDH(detail_h, "$Id$")
 #include <freeradius-devel/util/retry.h>
 #include <freeradius-devel/util/dlist.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -68,6 +74,22 @@ typedef struct {
 									//!< the I/O path.
 } proto_detail_t;
 
+/** Replay statistics, shared by all of the readers of a "work" instance
+ *
+ *  Updated by the network threads, and read by radmin.
+ */
+typedef struct {
+	atomic_int_fast64_t		start;			//!< fr_time_t of the first file being opened.
+	atomic_uint_fast64_t		read;			//!< records sent for processing, not including
+								///< retransmissions.
+	atomic_uint_fast64_t		retransmitted;		//!< number of retransmissions.
+	atomic_uint_fast64_t		done;			//!< records which were processed successfully.
+	atomic_uint_fast64_t		failed;			//!< records we gave up on.
+	atomic_uint_fast64_t		skipped;		//!< records skipped because they were already done.
+	atomic_int_fast64_t		outstanding;		//!< records currently being processed.
+	atomic_int_fast64_t		backlog;		//!< bytes of work files which haven't been read yet.
+} proto_detail_work_stats_t;
+
 typedef struct proto_detail_work_s proto_detail_work_t;
 
 /*
@@ -90,11 +112,16 @@ struct proto_detail_work_s {
 	bool				retransmit;		//!< are we retransmitting on error?
 	bool				immediate;		//!< start reading the detail files immediately
 
+	bool				checkpoint;		//!< track progress in a bitmap checkpoint file.
+	fr_time_delta_t			checkpoint_interval;	//!< how often the checkpoint file is updated.
+
 	int				mode;			//!< O_RDWR or O_RDONLY
 
 	fr_rb_node_t			filename_node;		//!< for dedup
 
 	RADCLIENT			*client;		//!< so the rest of the server doesn't complain
+
+	proto_detail_work_stats_t	*stats;			//!< replay statistics.
 };
 
 typedef struct proto_detail_work_thread_s proto_detail_work_thread_t;
@@ -133,6 +160,23 @@ struct proto_detail_work_thread_s {
 	off_t				header_offset;		//!< offset of the current header we're reading
 	off_t				read_offset;		//!< where we're reading from in filename_work
 
+	bool				binary;			//!< file contains binary records, not text.
+	uint8_t const			*map;			//!< binary file, mapped into memory.
+	size_t				map_len;		//!< how much of the file is mapped.
+
+	uint64_t			num_records;		//!< records found so far, including ones we skipped.
+	off_t				consumed;		//!< how much of the file has been counted as read
+								///< in the backlog statistics.
+	off_t				total_size;		//!< size of the file when it was opened.
+
+	char const			*filename_checkpoint;	//!< bitmap of completed records.
+	int				checkpoint_fd;		//!< for filename_checkpoint.
+	uint8_t				*done_map;		//!< bit N is set when record N has been processed.
+	size_t				done_map_len;		//!< size of done_map in bytes.
+	size_t				dirty_start;		//!< first byte of done_map not yet written.
+	size_t				dirty_end;		//!< last byte of done_map not yet written, plus one.
+	fr_event_timer_t const		*checkpoint_ev;		//!< for writing the checkpoint.
+
 	fr_event_timer_t const		*ev;			//!< for detail file timers.
 
 	pthread_mutex_t			worker_mutex;		//!< for the workers
@@ -23,14 +23,17 @@
  * @copyright 2017 Alan DeKok (aland@deployingradius.com)
  */
 #include <netdb.h>
+#include <freeradius-devel/server/detail.h>
 #include <freeradius-devel/server/protocol.h>
 #include <freeradius-devel/server/pair.h>
 #include <freeradius-devel/io/application.h>
 #include <freeradius-devel/io/listen.h>
 #include <freeradius-devel/util/syserror.h>
+#include <freeradius-devel/server/command.h>
 #include "proto_detail.h"
 
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #ifndef NDEBUG
@@ -54,6 +57,7 @@ typedef struct {
 	off_t				done_offset;		//!< where we're tracking the status
 
 	int				id;			//!< for retransmission counters
+	uint64_t			record;			//!< number of the record in the file, for checkpoints
 
 	uint8_t				*packet;		//!< for retransmissions
 	size_t				packet_len;		//!< for retransmissions
@@ -87,6 +91,10 @@ static const CONF_PARSER file_listen_config[] = {
 
 	{ FR_CONF_OFFSET("retransmit", FR_TYPE_BOOL, proto_detail_work_t, retransmit ), .dflt = "yes" },
 
+	{ FR_CONF_OFFSET("checkpoint", FR_TYPE_BOOL, proto_detail_work_t, checkpoint ) },
+
+	{ FR_CONF_OFFSET("checkpoint_interval", FR_TYPE_TIME_DELTA, proto_detail_work_t, checkpoint_interval ), .dflt = "1.0" },
+
 	{ FR_CONF_POINTER("limit", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) limit_config },
 	CONF_PARSER_TERMINATOR
 };
@@ -108,6 +116,175 @@ fr_dict_attr_autoload_t proto_detail_work_dict_attr[] = {
 	{ NULL }
 };
 
+/*
+ *	The checkpoint file is a small header, followed by a bitmap
+ *	with one bit per record in the work file.  Bits are only ever
+ *	set, so changed bytes are written in place.  A partial write,
+ *	or a crash before the next write, just means that a few records
+ *	are processed again.
+ *
+ *	 0                   1                   2                   3
+ *	 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	|                      Magic ("FRDK")                           |
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	|                          Version                              |
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	|                                                               |
+ *	+                    Inode of the work file                     +
+ *	|                                                               |
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *	|  Bitmap...
+ *	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ */
+#define CHECKPOINT_MAGIC	"FRDK"
+#define CHECKPOINT_VERSION	1
+#define CHECKPOINT_HDR_LEN	16
+
+/** Open the checkpoint for a work file, loading the bitmap if it's for the same file
+ *
+ */
+static int work_checkpoint_open(proto_detail_work_t const *inst, proto_detail_work_thread_t *thread)
+{
+	uint8_t		hdr[CHECKPOINT_HDR_LEN];
+	struct stat	buf;
+	ssize_t		slen;
+
+	if (fstat(thread->fd, &buf) < 0) {
+		cf_log_err(inst->cs, "Failed examining %s: %s", thread->filename_work, fr_syserror(errno));
+		return -1;
+	}
+
+	thread->filename_checkpoint = talloc_typed_asprintf(thread, "%s.checkpoint", thread->filename_work);
+	thread->checkpoint_fd = open(thread->filename_checkpoint, O_RDWR | O_CREAT, 0600);
+	if (thread->checkpoint_fd < 0) {
+		cf_log_err(inst->cs, "Failed opening %s: %s", thread->filename_checkpoint, fr_syserror(errno));
+		return -1;
+	}
+
+	slen = pread(thread->checkpoint_fd, hdr, sizeof(hdr), 0);
+	if ((slen == sizeof(hdr)) &&
+	    (memcmp(hdr, CHECKPOINT_MAGIC, 4) == 0) &&
+	    (fr_net_to_uint32(hdr + 4) == CHECKPOINT_VERSION) &&
+	    (fr_net_to_uint64(hdr + 8) == (uint64_t) buf.st_ino)) {
+		struct stat ckpt;
+
+		/*
+		 *	We were part way through this file when the
+		 *	server stopped.  Records marked in the bitmap
+		 *	will be skipped.
+		 */
+		if ((fstat(thread->checkpoint_fd, &ckpt) == 0) && (ckpt.st_size > CHECKPOINT_HDR_LEN)) {
+			thread->done_map_len = ckpt.st_size - CHECKPOINT_HDR_LEN;
+			MEM(thread->done_map = talloc_zero_array(thread, uint8_t, thread->done_map_len));
+
+			if (pread(thread->checkpoint_fd, thread->done_map, thread->done_map_len, CHECKPOINT_HDR_LEN) < 0) {
+				cf_log_err(inst->cs, "Failed reading %s: %s", thread->filename_checkpoint,
+					   fr_syserror(errno));
+				return -1;
+			}
+
+			DEBUG("Resuming %s from checkpoint %s", thread->filename_work, thread->filename_checkpoint);
+		}
+		return 0;
+	}
+
+	/*
+	 *	No checkpoint, or it's for a different file.
+	 */
+	memcpy(hdr, CHECKPOINT_MAGIC, 4);
+	fr_net_from_uint32(hdr + 4, CHECKPOINT_VERSION);
+	fr_net_from_uint64(hdr + 8, buf.st_ino);
+
+	if ((ftruncate(thread->checkpoint_fd, 0) < 0) ||
+	    (pwrite(thread->checkpoint_fd, hdr, sizeof(hdr), 0) != sizeof(hdr))) {
+		cf_log_err(inst->cs, "Failed writing %s: %s", thread->filename_checkpoint, fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Write the parts of the bitmap which have changed since the last write
+ *
+ */
+static void work_checkpoint_write(proto_detail_work_thread_t *thread)
+{
+	if (thread->dirty_start >= thread->dirty_end) return;
+
+	if (pwrite(thread->checkpoint_fd, thread->done_map + thread->dirty_start,
+		   thread->dirty_end - thread->dirty_start, CHECKPOINT_HDR_LEN + thread->dirty_start) < 0) {
+		ERROR("%s - Failed writing checkpoint %s: %s", thread->name, thread->filename_checkpoint,
+		      fr_syserror(errno));
+		return;
+	}
+
+	thread->dirty_start = thread->dirty_end = 0;
+}
+
+static void work_checkpoint_timer(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	proto_detail_work_thread_t *thread = talloc_get_type_abort(uctx, proto_detail_work_thread_t);
+
+	work_checkpoint_write(thread);
+}
+
+/** Mark a record as processed in the checkpoint bitmap
+ *
+ *  The bitmap is written on a timer, so that completing a record
+ *  doesn't cost a system call.
+ */
+static void work_checkpoint_mark(proto_detail_work_t const *inst, proto_detail_work_thread_t *thread, uint64_t record)
+{
+	size_t byte = record / 8;
+
+	if (byte >= thread->done_map_len) {
+		size_t len = thread->done_map_len ? thread->done_map_len : 1024;
+
+		while (len <= byte) len *= 2;
+
+		MEM(thread->done_map = talloc_realloc(thread, thread->done_map, uint8_t, len));
+		memset(thread->done_map + thread->done_map_len, 0, len - thread->done_map_len);
+		thread->done_map_len = len;
+	}
+
+	thread->done_map[byte] |= (1 << (record & 0x07));
+
+	if (thread->dirty_start >= thread->dirty_end) {
+		thread->dirty_start = byte;
+		thread->dirty_end = byte + 1;
+	} else {
+		if (byte < thread->dirty_start) thread->dirty_start = byte;
+		if (byte >= thread->dirty_end) thread->dirty_end = byte + 1;
+	}
+
+	if (thread->checkpoint_ev) return;
+
+	if (fr_event_timer_in(thread, thread->el, &thread->checkpoint_ev, inst->checkpoint_interval,
+			      work_checkpoint_timer, thread) < 0) {
+		work_checkpoint_write(thread);
+	}
+}
+
+static inline bool work_checkpoint_is_done(proto_detail_work_thread_t const *thread, uint64_t record)
+{
+	if ((record / 8) >= thread->done_map_len) return false;
+
+	return (thread->done_map[record / 8] & (1 << (record & 0x07))) != 0;
+}
+
+/** Update the backlog statistics, once we've read up to "offset"
+ *
+ */
+static void work_consumed(proto_detail_work_t const *inst, proto_detail_work_thread_t *thread, off_t offset)
+{
+	if (offset > thread->total_size) offset = thread->total_size;
+	if (offset <= thread->consumed) return;
+
+	atomic_fetch_sub_explicit(&inst->stats->backlog, offset - thread->consumed, memory_order_relaxed);
+	thread->consumed = offset;
+}
+
 /*
  *	All of the decoding is done by proto_detail.c
  */
@@ -140,6 +317,121 @@ static fr_event_update_t resume_read[] = {
 	{ 0 }
 };
 
+/** Skip binary records which have already been processed
+ *
+ */
+static void work_binary_skip_done(proto_detail_work_t const *inst, proto_detail_work_thread_t *thread)
+{
+	fr_detail_binary_hdr_t hdr;
+
+	while ((size_t) thread->read_offset < thread->map_len) {
+		if (fr_detail_binary_hdr_decode(&hdr, thread->map + thread->read_offset,
+						thread->map_len - thread->read_offset) < 0) break;
+
+		if (!(hdr.flags & FR_DETAIL_BINARY_FLAG_DONE) &&
+		    !work_checkpoint_is_done(thread, thread->num_records)) break;
+
+		atomic_fetch_add_explicit(&inst->stats->skipped, 1, memory_order_relaxed);
+		thread->num_records++;
+		thread->read_offset += hdr.length;
+	}
+
+	work_consumed(inst, thread, thread->read_offset);
+}
+
+/** Read the next record from a binary detail file
+ *
+ *  The file is mapped into memory, and each record says how long it
+ *  is.  So there's no read(), no searching for the end of the
+ *  record, and no leftover data to manage.  The record is copied
+ *  as-is to the message buffer, and decoded by proto_detail.
+ */
+static ssize_t work_read_binary(proto_detail_work_t const *inst, proto_detail_work_thread_t *thread,
+				void **packet_ctx, fr_time_t *recv_time_p, uint8_t *buffer, size_t buffer_len,
+				uint32_t *priority)
+{
+	fr_detail_binary_hdr_t	hdr;
+	fr_detail_entry_t	*track;
+
+redo:
+	work_binary_skip_done(inst, thread);
+
+	/*
+	 *	Everything in the file has already been processed.
+	 *	Nothing is outstanding, so mod_write() won't be
+	 *	called to close the file.  Tell the network side
+	 *	that we're done.
+	 */
+	if ((size_t) thread->read_offset >= thread->map_len) {
+		thread->eof = true;
+		thread->closing = true;
+		if (!thread->outstanding) return -1;
+		return 0;
+	}
+
+	if (fr_detail_binary_hdr_decode(&hdr, thread->map + thread->read_offset,
+					thread->map_len - thread->read_offset) < 0) {
+		ERROR("proto_detail (%s): Malformed record found at offset %zu of file %s: %s",
+		      thread->name, (size_t) thread->read_offset, thread->filename_work, fr_strerror());
+		return -1;
+	}
+
+	/*
+	 *	Too big?  Ignore it.
+	 */
+	if ((hdr.length > buffer_len) || (hdr.length > inst->parent->max_packet_size)) {
+		DEBUG("Ignoring 'too large' entry at offset %zu of %s",
+		      (size_t) thread->read_offset, thread->filename_work);
+		DEBUG("Entry size %u is greater than allowed maximum %u",
+		      hdr.length, inst->parent->max_packet_size);
+		thread->num_records++;
+		thread->read_offset += hdr.length;
+		goto redo;
+	}
+
+	memcpy(buffer, thread->map + thread->read_offset, hdr.length);
+
+	track = talloc_zero(thread, fr_detail_entry_t);
+	track->parent = thread;
+	track->timestamp = fr_time();
+	track->id = thread->count++;
+	track->done_offset = thread->read_offset + FR_DETAIL_BINARY_FLAGS_OFFSET;
+	track->record = thread->num_records++;
+	if (inst->retransmit) {
+		track->packet = talloc_memdup(track, buffer, hdr.length);
+		track->packet_len = hdr.length;
+	}
+
+	thread->header_offset = thread->read_offset;
+	thread->read_offset += hdr.length;
+
+	/*
+	 *	If this was the last record, mod_write() closes the
+	 *	file once all of the outstanding replies are in.
+	 */
+	work_binary_skip_done(inst, thread);
+	if ((size_t) thread->read_offset >= thread->map_len) {
+		thread->eof = true;
+		thread->closing = true;
+	}
+
+	thread->outstanding++;
+	atomic_fetch_add_explicit(&inst->stats->read, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&inst->stats->outstanding, 1, memory_order_relaxed);
+
+	if (!thread->paused && (thread->outstanding >= inst->max_outstanding)) {
+		(void) fr_event_filter_update(thread->el, thread->fd, FR_EVENT_FILTER_IO, pause_read);
+		thread->paused = true;
+	}
+
+	*packet_ctx = track;
+	*recv_time_p = track->timestamp;
+	*priority = inst->parent->priority;
+
+	MPRINT("Returning NUM %u - binary record of %u bytes", thread->outstanding, hdr.length);
+	return hdr.length;
+}
+
 static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time_p, uint8_t *buffer, size_t buffer_len, size_t *leftover, uint32_t *priority, UNUSED bool *is_dup)
 {
 	proto_detail_work_t const	*inst = talloc_get_type_abort_const(li->app_io_instance, proto_detail_work_t);
@@ -151,6 +443,7 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	uint8_t				*partial, *end, *next, *p, *record_end;
 	uint8_t				*stopped_search;
 	off_t				done_offset;
+	uint64_t			record;
 
 	fr_assert(*leftover < buffer_len);
 	fr_assert(thread->fd >= 0);
@@ -181,6 +474,7 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 		memcpy(buffer, track->packet, track->packet_len);
 
 		DEBUG("Retrying packet %d (retransmission %u)", track->id, track->retry.count);
+		atomic_fetch_add_explicit(&inst->stats->retransmitted, 1, memory_order_relaxed);
 		*packet_ctx = track;
 		*recv_time_p = track->timestamp;
 		*priority = inst->parent->priority;
@@ -193,7 +487,11 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	 *	without locking it first.  So too bad for them.
 	 */
 	if (thread->closing) {
-		if (inst->track_progress) thread->read_offset = lseek(thread->fd, 0, SEEK_END);
+		if (thread->binary) {
+			(void) lseek(thread->fd, 0, SEEK_END);
+		} else if (inst->track_progress) {
+			thread->read_offset = lseek(thread->fd, 0, SEEK_END);
+		}
 		return 0;
 	}
 
@@ -207,6 +505,10 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 		return 0;
 	}
 
+	if (thread->binary) {
+		return work_read_binary(inst, thread, packet_ctx, recv_time_p, buffer, buffer_len, priority);
+	}
+
 	/*
 	 *	If we've cached leftover data from the ring buffer,
 	 *	copy it back.
@@ -419,6 +721,12 @@ redo:
 		MPRINT("NO end of record, but at EOF, found %zd leftover is 0", packet_len);
 	}
 
+	/*
+	 *	Every record gets a number, even if we skip it, so
+	 *	that the numbers in the checkpoint don't change.
+	 */
+	record = thread->num_records++;
+
 	/*
 	 *	Too big?  Ignore it.
 	 *
@@ -432,6 +740,9 @@ redo:
 	skip_record:
 		MPRINT("Skipping record");
 		if (next) {
+			thread->header_offset += (next - buffer);
+			work_consumed(inst, thread, thread->header_offset);
+
 			memmove(buffer, next, (end - next));
 			data_size = (end - next);
 			*leftover = 0;
@@ -445,8 +756,17 @@ redo:
 			goto redo;
 		}
 
+		/*
+		 *	That was the last record in the file.  Close
+		 *	it once the outstanding records are done, or
+		 *	now if there aren't any.
+		 */
 		fr_assert(*leftover == 0);
-		goto done;
+		thread->header_offset += packet_len;
+		work_consumed(inst, thread, thread->header_offset);
+		thread->closing = true;
+		if (!thread->outstanding) return -1;
+		return 0;
 	}
 
 	/*
@@ -468,7 +788,7 @@ redo:
 
 		if (((record_end - p) >= 5) &&
 		    (memcmp(p, "\tDone", 5) == 0)) {
-			goto skip_record;
+			goto skip_done;
 		}
 
 		if (((record_end - p) > 10) &&
@@ -478,6 +798,15 @@ redo:
 		}
 	}
 
+	/*
+	 *	Processed before the server was restarted.
+	 */
+	if (work_checkpoint_is_done(thread, record)) {
+	skip_done:
+		atomic_fetch_add_explicit(&inst->stats->skipped, 1, memory_order_relaxed);
+		goto skip_record;
+	}
+
 	/*
 	 *	Allocate the tracking entry.
 	 */
@@ -487,6 +816,7 @@ redo:
 	track->id = thread->count++;
 
 	track->done_offset = done_offset;
+	track->record = record;
 	if (inst->retransmit) {
 		track->packet = talloc_memdup(track, buffer, packet_len);
 		track->packet_len = packet_len;
@@ -496,12 +826,12 @@ redo:
 	 *	We've read one more packet.
 	 */
 	thread->header_offset += packet_len;
+	work_consumed(inst, thread, thread->header_offset);
 
 	*packet_ctx = track;
 	*recv_time_p = track->timestamp;
 	*priority = inst->parent->priority;
 
-done:
 	/*
 	 *	If we're at EOF, mark us as "closing".
 	 */
@@ -512,6 +842,8 @@ done:
 	}
 
 	thread->outstanding++;
+	atomic_fetch_add_explicit(&inst->stats->read, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&inst->stats->outstanding, 1, memory_order_relaxed);
 
 	/*
 	 *	Pause reading until such time as we need more packets.
@@ -574,6 +906,7 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 	proto_detail_work_t const	*inst = talloc_get_type_abort_const(li->app_io_instance, proto_detail_work_t);
 	proto_detail_work_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_detail_work_thread_t);
 	fr_detail_entry_t		*track = packet_ctx;
+	bool				failed = false;
 
 	if (buffer_len < 1) return -1;
 
@@ -609,6 +942,7 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 				      track->retry.next, work_retransmit, track) < 0) {
 			ERROR("%s - Failed inserting retransmission timeout", thread->name);
 		fail:
+			failed = true;
 			if (inst->track_progress && (track->done_offset > 0)) goto mark_done;
 			goto free_track;
 		}
@@ -622,6 +956,19 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 
 	} else if (inst->track_progress && (track->done_offset > 0)) {
 	mark_done:
+		if (thread->binary) {
+			uint8_t flags = thread->map[track->done_offset] | FR_DETAIL_BINARY_FLAG_DONE;
+
+			/*
+			 *	Just set the flag in the record header.
+			 *	The write doesn't move the file offset.
+			 */
+			if (pwrite(thread->fd, &flags, sizeof(flags), track->done_offset) < 0) {
+				ERROR("%s - Failed marking entry as done: %s", thread->name, fr_syserror(errno));
+			}
+			goto free_track;
+		}
+
 		/*
 		 *	Seek to the entry, mark it as done, and then seek to
 		 *	the point in the file where we were reading from.
@@ -636,6 +983,19 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 free_track:
 	thread->outstanding--;
 
+	if (failed) {
+		atomic_fetch_add_explicit(&inst->stats->failed, 1, memory_order_relaxed);
+	} else {
+		atomic_fetch_add_explicit(&inst->stats->done, 1, memory_order_relaxed);
+	}
+	atomic_fetch_sub_explicit(&inst->stats->outstanding, 1, memory_order_relaxed);
+
+	/*
+	 *	Whether it succeeded, or we gave up on it, we don't
+	 *	want to see this record again.
+	 */
+	if (inst->checkpoint) work_checkpoint_mark(inst, thread, track->record);
+
 	/*
 	 *	If we need to read some more packet, let's do so.
 	 */
@@ -711,9 +1071,57 @@ static int mod_open(fr_listen_t *li)
 		thread->file_size = 1;
 	}
 
+	/*
+	 *	Binary files are mapped into memory, and the records
+	 *	are found by following their length fields.
+	 */
+	{
+		uint8_t		first;
+		struct stat	buf;
+
+		if ((pread(thread->fd, &first, sizeof(first), 0) == sizeof(first)) &&
+		    (first == FR_DETAIL_BINARY_MAGIC)) {
+			if (fstat(thread->fd, &buf) < 0) {
+				cf_log_err(inst->cs, "Failed examining %s: %s", thread->filename_work, fr_syserror(errno));
+				return -1;
+			}
+
+			thread->map = mmap(NULL, buf.st_size, PROT_READ, MAP_SHARED, thread->fd, 0);
+			if (thread->map == MAP_FAILED) {
+				thread->map = NULL;
+				cf_log_err(inst->cs, "Failed mapping %s: %s", thread->filename_work, fr_syserror(errno));
+				return -1;
+			}
+			thread->map_len = buf.st_size;
+			thread->binary = true;
+		}
+	}
+
 	fr_assert(thread->name == NULL);
 	fr_assert(thread->filename_work != NULL);
 	thread->name = talloc_typed_asprintf(thread, "detail_work reading file %s", thread->filename_work);
+	thread->inst = inst;
+
+	/*
+	 *	Everything in the file is backlog until we've read it.
+	 */
+	{
+		struct stat	buf;
+		int_fast64_t	start = 0;
+
+		if (fstat(thread->fd, &buf) < 0) {
+			cf_log_err(inst->cs, "Failed examining %s: %s", thread->filename_work, fr_syserror(errno));
+			return -1;
+		}
+
+		thread->total_size = buf.st_size;
+		atomic_fetch_add_explicit(&inst->stats->backlog, thread->total_size, memory_order_relaxed);
+		atomic_compare_exchange_strong_explicit(&inst->stats->start, &start, fr_time_unwrap(fr_time()),
+						memory_order_relaxed, memory_order_relaxed);
+	}
+
+	thread->checkpoint_fd = -1;
+	if (inst->checkpoint && (work_checkpoint_open(inst, thread) < 0)) return -1;
 
 	return 0;
 }
@@ -732,15 +1140,46 @@ static int mod_close_internal(proto_detail_work_thread_t *thread)
 		pthread_mutex_unlock(&thread->file_parent->worker_mutex);
 	}
 
-	DEBUG("Closing and deleting detail worker file %s", thread->name);
-
 #ifdef NOTE_REVOKE
 	fr_event_fd_delete(thread->el, thread->fd, FR_EVENT_FILTER_VNODE);
 #endif
 	fr_event_fd_delete(thread->el, thread->fd, FR_EVENT_FILTER_IO);
 
+	/*
+	 *	If we're stopping part way through the file, leave it
+	 *	and its checkpoint where they are.  The next time we
+	 *	start, we carry on from where we left off.
+	 */
+	if (thread->filename_checkpoint) {
+		fr_event_timer_delete(&thread->checkpoint_ev);
+
+		if (thread->checkpoint_fd >= 0) {
+			work_checkpoint_write(thread);
+			close(thread->checkpoint_fd);
+			thread->checkpoint_fd = -1;
+		}
+
+		if (!thread->closing || thread->outstanding) {
+			DEBUG("Closing detail worker file %s, progress saved in %s",
+			      thread->name, thread->filename_checkpoint);
+			goto close_file;
+		}
+
+		unlink(thread->filename_checkpoint);
+	}
+
+	DEBUG("Closing and deleting detail worker file %s", thread->name);
+
 	unlink(thread->filename_work);
 
+close_file:
+	if (thread->inst) work_consumed(thread->inst, thread, thread->total_size);
+
+	if (thread->map) {
+		(void) munmap(UNCONST(uint8_t *, thread->map), thread->map_len);
+		thread->map = NULL;
+	}
+
 	close(thread->fd);
 	thread->fd = -1;
 
@@ -814,10 +1253,71 @@ static char const *mod_name(fr_listen_t *li)
 	return thread->name;
 }
 
+static int cmd_stats_replay(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	proto_detail_work_t const	*inst = talloc_get_type_abort_const(ctx, proto_detail_work_t);
+	proto_detail_work_stats_t	*stats = inst->stats;
+	int_fast64_t			start;
+	uint64_t			done;
+	double				elapsed = 0;
+
+	start = atomic_load_explicit(&stats->start, memory_order_relaxed);
+	done = atomic_load_explicit(&stats->done, memory_order_relaxed);
+	if (start) elapsed = fr_time_delta_unwrap(fr_time_sub(fr_time(), fr_time_wrap(start))) / (double) NSEC;
+
+	fprintf(fp, "count.read	%" PRIu64 "\n", (uint64_t) atomic_load_explicit(&stats->read, memory_order_relaxed));
+	fprintf(fp, "count.retransmitted	%" PRIu64 "\n",
+		(uint64_t) atomic_load_explicit(&stats->retransmitted, memory_order_relaxed));
+	fprintf(fp, "count.done	%" PRIu64 "\n", done);
+	fprintf(fp, "count.failed	%" PRIu64 "\n",
+		(uint64_t) atomic_load_explicit(&stats->failed, memory_order_relaxed));
+	fprintf(fp, "count.skipped	%" PRIu64 "\n",
+		(uint64_t) atomic_load_explicit(&stats->skipped, memory_order_relaxed));
+	fprintf(fp, "outstanding	%" PRId64 "\n",
+		(int64_t) atomic_load_explicit(&stats->outstanding, memory_order_relaxed));
+	fprintf(fp, "backlog.bytes	%" PRId64 "\n",
+		(int64_t) atomic_load_explicit(&stats->backlog, memory_order_relaxed));
+	fprintf(fp, "elapsed	%.3f\n", elapsed);
+	fprintf(fp, "rate	%.1f\n", (elapsed > 0) ? done / elapsed : 0);
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_table[] = {
+	{
+		.parent = "stats",
+		.name = "detail",
+		.help = "Statistics for detail file readers.",
+		.read_only = true
+	},
+
+	{
+		.parent = "stats detail",
+		.add_name = true,
+		.name = "replay",
+		.func = cmd_stats_replay,
+		.help = "Show how far the detail file reader has got with its files.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
 static int mod_instantiate(void *instance, UNUSED CONF_SECTION *cs)
 {
 	proto_detail_work_t *inst = talloc_get_type_abort(instance, proto_detail_work_t);
 	RADCLIENT *client;
+	char const *name;
+
+	MEM(inst->stats = talloc_zero(inst, proto_detail_work_stats_t));
+
+	/*
+	 *	"stats detail <server> replay"
+	 */
+	name = cf_section_name2(inst->parent->server_cs);
+	if (name && (fr_command_register_hook(NULL, name, inst, cmd_table) < 0)) {
+		PWARN("Failed registering radmin commands for detail reader in %s", name);
+	}
 
 	client = inst->client = talloc_zero(inst, RADCLIENT);
 	if (!inst->client) return 0;
@@ -873,6 +1373,11 @@ static int mod_bootstrap(void *instance, CONF_SECTION *cs)
 
 	FR_INTEGER_BOUND_CHECK("limit.max_outstanding", inst->max_outstanding, >=, 1);
 
+	if (inst->checkpoint) {
+		FR_TIME_DELTA_BOUND_CHECK("checkpoint_interval", inst->checkpoint_interval, >=, fr_time_delta_from_msec(10));
+		FR_TIME_DELTA_BOUND_CHECK("checkpoint_interval", inst->checkpoint_interval, <=, fr_time_delta_from_sec(60));
+	}
+
 	return 0;
 }
 
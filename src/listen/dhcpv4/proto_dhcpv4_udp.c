@@ -39,6 +39,8 @@ extern fr_app_io_t proto_dhcpv4_udp;
 typedef struct {
 	char const			*name;			//!< socket name
 	int				sockfd;
+	fr_udp_mmsg_t			*recv_mmsg;		//!< for batched reads with recvmmsg().
+	fr_udp_mmsg_t			*send_mmsg;		//!< for batched writes with sendmmsg().
 
 	fr_io_address_t			*connection;		//!< for connected sockets.
 
@@ -58,6 +60,8 @@ typedef struct {
 	uint32_t			recv_buff;		//!< How big the kernel's receive buffer should be.
 
 	uint32_t			max_packet_size;	//!< for message ring buffer.
+	uint32_t			recv_batch;		//!< Maximum number of packets to read in one system call.
+	uint32_t			send_batch;		//!< Maximum number of packets to write in one system call.
 	uint32_t			max_attributes;		//!< Limit maximum decodable attributes.
 
 	uint16_t			port;			//!< Port to listen on.
@@ -103,6 +107,8 @@ static const CONF_PARSER udp_listen_config[] = {
 	{ FR_CONF_POINTER("networks", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) networks_config },
 
 	{ FR_CONF_OFFSET("max_packet_size", FR_TYPE_UINT32, proto_dhcpv4_udp_t, max_packet_size), .dflt = "4096" } ,
+	{ FR_CONF_OFFSET("recv_batch", FR_TYPE_UINT32, proto_dhcpv4_udp_t, recv_batch), .dflt = "1" } ,
+	{ FR_CONF_OFFSET("send_batch", FR_TYPE_UINT32, proto_dhcpv4_udp_t, send_batch), .dflt = "1" } ,
        	{ FR_CONF_OFFSET("max_attributes", FR_TYPE_UINT32, proto_dhcpv4_udp_t, max_attributes), .dflt = STRINGIFY(DHCPV4_MAX_ATTRIBUTES) } ,
 
 	CONF_PARSER_TERMINATOR
@@ -153,7 +159,13 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	 */
 	flags = UDP_FLAGS_CONNECTED * (thread->connection != NULL);
 
-	data_size = udp_recv(thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
+	if (thread->recv_mmsg) {
+		data_size = udp_recv_mmsg(thread->recv_mmsg, thread->sockfd, flags, &address->socket,
+					  buffer, buffer_len, recv_time_p);
+		li->read_pending = udp_mmsg_pending(thread->recv_mmsg);
+	} else {
+		data_size = udp_recv(thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
+	}
 	if (data_size < 0) {
 		RATE_LIMIT_GLOBAL(PERROR, "Read error (%zd)", data_size);
 		return data_size;
@@ -463,7 +475,12 @@ send_reply:
 	/*
 	 *	proto_dhcpv4 takes care of suppressing do-not-respond, etc.
 	 */
-	data_size = udp_send(&socket, flags, buffer, buffer_len);
+	if (thread->send_mmsg) {
+		if (udp_send_mmsg(thread->send_mmsg, &socket, flags, buffer, buffer_len) < 0) return -1;
+		data_size = buffer_len;
+	} else {
+		data_size = udp_send(&socket, flags, buffer, buffer_len);
+	}
 
 	/*
 	 *	This socket is dead.  That's an error...
@@ -473,6 +490,18 @@ send_reply:
 	return data_size;
 }
 
+/** Write any replies which were batched by mod_write()
+ *
+ */
+static int mod_flush(fr_listen_t *li)
+{
+	proto_dhcpv4_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_dhcpv4_udp_thread_t);
+
+	if (!thread->send_mmsg) return 0;
+
+	return (udp_mmsg_flush(thread->send_mmsg) < 0) ? -1 : 0;
+}
+
 
 static int mod_connection_set(fr_listen_t *li, fr_io_address_t *connection)
 {
@@ -546,6 +575,14 @@ static int mod_open(fr_listen_t *li)
 
 	thread->sockfd = sockfd;
 
+	if ((inst->recv_batch > 1) && !thread->recv_mmsg) {
+		MEM(thread->recv_mmsg = udp_mmsg_alloc(thread, inst->recv_batch, inst->max_packet_size));
+	}
+
+	if ((inst->send_batch > 1) && !thread->send_mmsg) {
+		MEM(thread->send_mmsg = udp_mmsg_alloc(thread, inst->send_batch, inst->max_packet_size));
+	}
+
 	fr_assert((cf_parent(inst->cs) != NULL) && (cf_parent(cf_parent(inst->cs)) != NULL));	/* listen { ... } */
 
 	thread->name = fr_app_io_socket_name(thread, &proto_dhcpv4_udp,
@@ -567,6 +604,14 @@ static int mod_fd_set(fr_listen_t *li, int fd)
 
 	thread->sockfd = fd;
 
+	if ((inst->recv_batch > 1) && !thread->recv_mmsg) {
+		MEM(thread->recv_mmsg = udp_mmsg_alloc(thread, inst->recv_batch, inst->max_packet_size));
+	}
+
+	if ((inst->send_batch > 1) && !thread->send_mmsg) {
+		MEM(thread->send_mmsg = udp_mmsg_alloc(thread, inst->send_batch, inst->max_packet_size));
+	}
+
 	thread->name = fr_app_io_socket_name(thread, &proto_dhcpv4_udp,
 					     &thread->connection->socket.inet.src_ipaddr,
 					     thread->connection->socket.inet.src_port,
@@ -701,6 +746,12 @@ static int mod_bootstrap(void *instance, CONF_SECTION *cs)
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, MIN_PACKET_SIZE);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65536);
 
+	FR_INTEGER_BOUND_CHECK("recv_batch", inst->recv_batch, >=, 1);
+	FR_INTEGER_BOUND_CHECK("recv_batch", inst->recv_batch, <=, 256);
+
+	FR_INTEGER_BOUND_CHECK("send_batch", inst->send_batch, >=, 1);
+	FR_INTEGER_BOUND_CHECK("send_batch", inst->send_batch, <=, 256);
+
 	if (!inst->port) {
 		struct servent *s;
 
@@ -814,6 +865,7 @@ fr_app_io_t proto_dhcpv4_udp = {
 	.open			= mod_open,
 	.read			= mod_read,
 	.write			= mod_write,
+	.flush			= mod_flush,
 	.fd_set			= mod_fd_set,
 	.track_create  		= mod_track_create,
 	.track_compare		= mod_track_compare,
@@ -185,6 +185,32 @@ static int transport_parse(TALLOC_CTX *ctx, void *out, UNUSED void *parent, CONF
 	return dl_module_instance(ctx, out, transport_cs, parent_inst, name, DL_MODULE_TYPE_SUBMODULE);
 }
 
+/** Verify a burst of packets
+ *
+ * The MD5 calculations for all of the packets are done in parallel.
+ */
+static void mod_verify(UNUSED void const *instance, fr_channel_data_t **cd, size_t num)
+{
+	fr_radius_verify_t	packets[num];
+	size_t			i;
+
+	for (i = 0; i < num; i++) {
+		fr_io_track_t const	*track = talloc_get_type_abort_const(cd[i]->packet_ctx, fr_io_track_t);
+		RADCLIENT const		*client = track->address->radclient;
+
+		packets[i] = (fr_radius_verify_t) {
+			.packet = cd[i]->m.data,
+			.secret = (uint8_t const *) client->secret,
+			.secret_len = talloc_array_length(client->secret) - 1,
+			.require_ma = client->message_authenticator
+		};
+	}
+
+	fr_radius_verify_multi(packets, num);
+
+	for (i = 0; i < num; i++) cd[i]->request.verified = (packets[i].rcode == 0);
+}
+
 /** Decode the packet
  *
  */
@@ -206,8 +232,13 @@ static int mod_decode(void const *instance, request_t *request, uint8_t *const d
 
 	client = address->radclient;
 
-	if (fr_radius_verify(data, NULL, (uint8_t const *) client->secret, talloc_array_length(client->secret) - 1,
-			     client->message_authenticator) < 0) {
+	/*
+	 *	The packet may already have been checked by
+	 *	mod_verify(), along with others in the same burst.
+	 */
+	if (!request->async->verified &&
+	    (fr_radius_verify(data, NULL, (uint8_t const *) client->secret, talloc_array_length(client->secret) - 1,
+			      client->message_authenticator) < 0)) {
 		RPEDEBUG("Failed verifying packet signature.");
 		return -1;
 	}
@@ -220,7 +251,15 @@ static int mod_decode(void const *instance, request_t *request, uint8_t *const d
 	request->reply->id = data[1];
 	memcpy(request->packet->vector, data + 4, sizeof(request->packet->vector));
 
-	request->packet->data = talloc_memdup(request->packet, data, data_len);
+	/*
+	 *	If the worker is holding on to the message for us,
+	 *	then decode the packet in place.
+	 */
+	if (request->async->msg) {
+		request->packet->data = data;
+	} else {
+		request->packet->data = talloc_memdup(request->packet, data, data_len);
+	}
 	request->packet->data_len = data_len;
 
 	/*
@@ -595,5 +634,6 @@ fr_app_t proto_radius = {
 	.open			= mod_open,
 	.decode			= mod_decode,
 	.encode			= mod_encode,
-	.priority		= mod_priority_set
+	.priority		= mod_priority_set,
+	.verify			= mod_verify
 };
@@ -40,6 +40,8 @@ typedef struct {
 	char const			*name;			//!< socket name
 
 	int				sockfd;
+	fr_udp_mmsg_t			*recv_mmsg;		//!< for batched reads with recvmmsg().
+	fr_udp_mmsg_t			*send_mmsg;		//!< for batched writes with sendmmsg().
 
 	fr_io_address_t			*connection;		//!< for connected sockets.
 
@@ -57,6 +59,8 @@ typedef struct {
 	uint32_t			recv_buff;		//!< How big the kernel's receive buffer should be.
 
 	uint32_t			max_packet_size;	//!< for message ring buffer.
+	uint32_t			recv_batch;		//!< Maximum number of packets to read in one system call.
+	uint32_t			send_batch;		//!< Maximum number of packets to write in one system call.
 
 	uint16_t			port;			//!< Port to listen on.
 
@@ -95,6 +99,8 @@ static const CONF_PARSER udp_listen_config[] = {
 	{ FR_CONF_POINTER("networks", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) networks_config },
 
 	{ FR_CONF_OFFSET("max_packet_size", FR_TYPE_UINT32, proto_vmps_udp_t, max_packet_size), .dflt = "1024" } ,
+	{ FR_CONF_OFFSET("recv_batch", FR_TYPE_UINT32, proto_vmps_udp_t, recv_batch), .dflt = "1" } ,
+	{ FR_CONF_OFFSET("send_batch", FR_TYPE_UINT32, proto_vmps_udp_t, send_batch), .dflt = "1" } ,
 
 	CONF_PARSER_TERMINATOR
 };
@@ -126,7 +132,13 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	 */
 	flags = UDP_FLAGS_CONNECTED * (thread->connection != NULL);
 
-	data_size = udp_recv(thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
+	if (thread->recv_mmsg) {
+		data_size = udp_recv_mmsg(thread->recv_mmsg, thread->sockfd, flags, &address->socket,
+					  buffer, buffer_len, recv_time_p);
+		li->read_pending = udp_mmsg_pending(thread->recv_mmsg);
+	} else {
+		data_size = udp_recv(thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
+	}
 	if (data_size < 0) {
 		PDEBUG2("proto_vmps_udp got read error %zd", data_size);
 		return data_size;
@@ -246,7 +258,12 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 	 *	Only write replies if they're VMPS packets.
 	 *	sometimes we want to NOT send a reply...
 	 */
-	data_size = udp_send(&socket, flags, buffer, buffer_len);
+	if (thread->send_mmsg) {
+		if (udp_send_mmsg(thread->send_mmsg, &socket, flags, buffer, buffer_len) < 0) return -1;
+		data_size = buffer_len;
+	} else {
+		data_size = udp_send(&socket, flags, buffer, buffer_len);
+	}
 
 	/*
 	 *	This socket is dead.  That's an error...
@@ -256,6 +273,18 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 	return data_size;
 }
 
+/** Write any replies which were batched by mod_write()
+ *
+ */
+static int mod_flush(fr_listen_t *li)
+{
+	proto_vmps_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_vmps_udp_thread_t);
+
+	if (!thread->send_mmsg) return 0;
+
+	return (udp_mmsg_flush(thread->send_mmsg) < 0) ? -1 : 0;
+}
+
 
 static int mod_connection_set(fr_listen_t *li, fr_io_address_t *connection)
 {
@@ -317,6 +346,14 @@ static int mod_open(fr_listen_t *li)
 
 	thread->sockfd = sockfd;
 
+	if ((inst->recv_batch > 1) && !thread->recv_mmsg) {
+		MEM(thread->recv_mmsg = udp_mmsg_alloc(thread, inst->recv_batch, inst->max_packet_size));
+	}
+
+	if ((inst->send_batch > 1) && !thread->send_mmsg) {
+		MEM(thread->send_mmsg = udp_mmsg_alloc(thread, inst->send_batch, inst->max_packet_size));
+	}
+
 	fr_assert((cf_parent(inst->cs) != NULL) && (cf_parent(cf_parent(inst->cs)) != NULL));	/* listen { ... } */
 
 	thread->name = fr_app_io_socket_name(thread, &proto_vmps_udp,
@@ -337,6 +374,14 @@ static int mod_fd_set(fr_listen_t *li, int fd)
 
 	thread->sockfd = fd;
 
+	if ((inst->recv_batch > 1) && !thread->recv_mmsg) {
+		MEM(thread->recv_mmsg = udp_mmsg_alloc(thread, inst->recv_batch, inst->max_packet_size));
+	}
+
+	if ((inst->send_batch > 1) && !thread->send_mmsg) {
+		MEM(thread->send_mmsg = udp_mmsg_alloc(thread, inst->send_batch, inst->max_packet_size));
+	}
+
 	thread->name = fr_app_io_socket_name(thread, &proto_vmps_udp,
 					     &thread->connection->socket.inet.src_ipaddr, thread->connection->socket.inet.src_port,
 					     &inst->ipaddr, inst->port,
@@ -412,6 +457,12 @@ static int mod_bootstrap(void *instance, CONF_SECTION *cs)
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, 32);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65536);
 
+	FR_INTEGER_BOUND_CHECK("recv_batch", inst->recv_batch, >=, 1);
+	FR_INTEGER_BOUND_CHECK("recv_batch", inst->recv_batch, <=, 256);
+
+	FR_INTEGER_BOUND_CHECK("send_batch", inst->send_batch, >=, 1);
+	FR_INTEGER_BOUND_CHECK("send_batch", inst->send_batch, <=, 256);
+
 	if (!inst->port) {
 		struct servent *s;
 
@@ -515,6 +566,7 @@ fr_app_io_t proto_vmps_udp = {
 	.open			= mod_open,
 	.read			= mod_read,
 	.write			= mod_write,
+	.flush			= mod_flush,
 	.fd_set			= mod_fd_set,
 	.track_create  		= mod_track_create,
 	.track_compare		= mod_track_compare,
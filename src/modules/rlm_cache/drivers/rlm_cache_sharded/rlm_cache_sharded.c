@@ -0,0 +1,561 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_cache_sharded.c
+ * @brief In memory cache, split into independently locked shards.
+ *
+ * Entries are assigned to a shard using a hash of their key.  Each shard
+ * has its own mutex, lookup table, expiry heap and LRU list, so workers
+ * only contend when they're operating on keys in the same shard.
+ *
+ * When a shard exceeds its share of max_entries or max_size, the least
+ * recently used entries in that shard are evicted.
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/heap.h>
+#include <freeradius-devel/util/debug.h>
+#include "../../rlm_cache.h"
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+/** A single partition of the cache
+ *
+ */
+typedef struct {
+	pthread_mutex_t		mutex;		//!< Protects everything in this shard.
+
+	fr_hash_table_t		*cache;		//!< For looking up cache keys.
+	fr_heap_t		*heap;		//!< For managing entry expiry.
+	fr_dlist_head_t		lru;		//!< Entries ordered by last use, most recent at the head.
+
+	size_t			size;		//!< Approximate memory used by entries in this shard.
+
+	uint64_t		hits;		//!< Lookups which found an entry.
+	uint64_t		misses;		//!< Lookups which didn't find an entry.
+	uint64_t		evictions;	//!< Entries removed to stay within max_entries or max_size.
+	uint64_t		expired;	//!< Entries removed because their TTL elapsed.
+} rlm_cache_sharded_shard_t;
+
+typedef struct {
+	uint32_t		num_shards;	//!< Number of shards.  Rounded up to a power of two.
+	size_t			max_size;	//!< Maximum memory to use for entries.  0 means no limit.
+
+	uint32_t		shard_max_entries;	//!< Entries allowed in each shard.
+	size_t			shard_max_size;		//!< Memory allowed in each shard.
+
+	rlm_cache_sharded_shard_t *shards;	//!< Array of shards.
+	atomic_uint_fast64_t	count;		//!< Total number of entries across all shards.
+} rlm_cache_sharded_t;
+
+typedef struct {
+	rlm_cache_entry_t	fields;		//!< Entry data.
+
+	uint32_t		hash;		//!< Hash of the key.  Selects the shard.
+	fr_heap_index_t		heap_id;	//!< Offset used for expiry heap.
+	fr_dlist_t		lru_entry;	//!< Entry in the shard's LRU list.
+	size_t			size;		//!< Memory charged to the shard for this entry.
+} rlm_cache_sharded_entry_t;
+
+/** Per-request handle, recording which shard we have locked
+ *
+ * rlm_cache only operates on a single key between acquire and release,
+ * so a handle holds at most one shard mutex at a time.
+ */
+typedef struct {
+	rlm_cache_sharded_t		*driver;	//!< Driver instance.
+	rlm_cache_sharded_shard_t	*locked;	//!< Shard we currently hold the mutex of.
+} rlm_cache_sharded_handle_t;
+
+static const CONF_PARSER driver_config[] = {
+	{ FR_CONF_OFFSET("shards", FR_TYPE_UINT32, rlm_cache_sharded_t, num_shards), .dflt = "16" },
+	{ FR_CONF_OFFSET("max_size", FR_TYPE_SIZE, rlm_cache_sharded_t, max_size), .dflt = "0" },
+	CONF_PARSER_TERMINATOR
+};
+
+static uint32_t cache_entry_hash(void const *data)
+{
+	rlm_cache_sharded_entry_t const *c = data;
+
+	return c->hash;
+}
+
+/** Compare two entries by key
+ *
+ * There may only be one entry with the same key.
+ */
+static int8_t cache_entry_cmp(void const *one, void const *two)
+{
+	rlm_cache_entry_t const *a = one, *b = two;
+
+	MEMCMP_RETURN(a, b, key, key_len);
+	return 0;
+}
+
+/** Compare two entries by expiry time
+ *
+ * There may be multiple entries with the same expiry time.
+ */
+static int8_t cache_heap_cmp(void const *one, void const *two)
+{
+	rlm_cache_entry_t const *a = one, *b = two;
+
+	return fr_unix_time_cmp(a->expires, b->expires);
+}
+
+/** Lock the shard a key hashes to, releasing any other shard the handle holds
+ *
+ */
+static inline CC_HINT(always_inline)
+rlm_cache_sharded_shard_t *cache_shard_lock(rlm_cache_sharded_handle_t *handle, uint32_t hash)
+{
+	rlm_cache_sharded_shard_t *shard = &handle->driver->shards[hash & (handle->driver->num_shards - 1)];
+
+	if (handle->locked == shard) return shard;
+
+	if (handle->locked) pthread_mutex_unlock(&handle->locked->mutex);
+	pthread_mutex_lock(&shard->mutex);
+	handle->locked = shard;
+
+	return shard;
+}
+
+/** Unlink an entry from all the shard's structures, and free it
+ *
+ * @note Called with the shard mutex held.
+ */
+static void cache_entry_remove(rlm_cache_sharded_t *driver, rlm_cache_sharded_shard_t *shard,
+			       rlm_cache_sharded_entry_t *c)
+{
+	fr_hash_table_delete(shard->cache, c);
+	fr_heap_extract(shard->heap, c);
+	fr_dlist_remove(&shard->lru, c);
+
+	shard->size -= c->size;
+	atomic_fetch_sub_explicit(&driver->count, 1, memory_order_relaxed);
+
+	talloc_free(c);
+}
+
+/** Cleanup a cache_sharded instance
+ *
+ */
+static int mod_detach(module_detach_ctx_t const *mctx)
+{
+	rlm_cache_sharded_t	*driver = talloc_get_type_abort(mctx->inst->data, rlm_cache_sharded_t);
+	uint32_t		i;
+
+	if (!driver->shards) return 0;
+
+	for (i = 0; i < driver->num_shards; i++) {
+		rlm_cache_sharded_shard_t	*shard = &driver->shards[i];
+		rlm_cache_sharded_entry_t	*c;
+
+		if (!shard->cache) continue;	/* Never initialised */
+
+		while ((c = fr_dlist_head(&shard->lru))) cache_entry_remove(driver, shard, c);
+
+		pthread_mutex_destroy(&shard->mutex);
+	}
+
+	return 0;
+}
+
+static int cmd_show_cache_stats(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	rlm_cache_sharded_t	*driver = talloc_get_type_abort(ctx, rlm_cache_sharded_t);
+	uint32_t		i;
+
+	fprintf(fp, "shard\tentries\tsize\thits\tmisses\tevictions\texpired\n");
+	for (i = 0; i < driver->num_shards; i++) {
+		rlm_cache_sharded_shard_t *shard = &driver->shards[i];
+
+		pthread_mutex_lock(&shard->mutex);
+		fprintf(fp, "%u\t%u\t%zu\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\n",
+			i, fr_hash_table_num_elements(shard->cache), shard->size,
+			shard->hits, shard->misses, shard->evictions, shard->expired);
+		pthread_mutex_unlock(&shard->mutex);
+	}
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_table[] = {
+	{
+		.parent = "show module",
+		.add_name = true,
+		.name = "shards",
+		.func = cmd_show_cache_stats,
+		.help = "Show per-shard entry counts and hit/miss/eviction counters for a sharded cache.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
+/** Create a new cache_sharded instance
+ *
+ * @param[in] mctx		Data required for instantiation.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_instantiate(module_inst_ctx_t const *mctx)
+{
+	rlm_cache_sharded_t		*driver = talloc_get_type_abort(mctx->inst->data, rlm_cache_sharded_t);
+	rlm_cache_config_t const	*config = mctx->inst->parent->data;	/* config is the first field of rlm_cache_t */
+	uint32_t			i, num_shards = 1;
+
+	FR_INTEGER_BOUND_CHECK("shards", driver->num_shards, >=, 1);
+	FR_INTEGER_BOUND_CHECK("shards", driver->num_shards, <=, 1024);
+
+	/*
+	 *	We mask the key hash to pick a shard
+	 */
+	while (num_shards < driver->num_shards) num_shards <<= 1;
+	driver->num_shards = num_shards;
+
+	/*
+	 *	rlm_cache refuses inserts once max_entries is reached,
+	 *	so divide it between the shards rounding down.  That
+	 *	way we start evicting before rlm_cache would fail.
+	 */
+	if (config->max_entries > 0) {
+		if (config->max_entries < driver->num_shards) {
+			cf_log_err(mctx->inst->conf, "max_entries (%u) must be greater than or equal to "
+				   "the number of shards (%u)", config->max_entries, driver->num_shards);
+			return -1;
+		}
+		driver->shard_max_entries = config->max_entries / driver->num_shards;
+	}
+	if (driver->max_size > 0) driver->shard_max_size = driver->max_size / driver->num_shards;
+
+	driver->shards = talloc_zero_array(driver, rlm_cache_sharded_shard_t, driver->num_shards);
+	if (!driver->shards) {
+		ERROR("Failed to allocate cache shards");
+		return -1;
+	}
+
+	for (i = 0; i < driver->num_shards; i++) {
+		rlm_cache_sharded_shard_t *shard = &driver->shards[i];
+
+		/*
+		 *	The heap of entries to expire.
+		 */
+		shard->heap = fr_heap_talloc_alloc(driver->shards, cache_heap_cmp, rlm_cache_sharded_entry_t, heap_id, 0);
+		if (!shard->heap) {
+			ERROR("Failed to create heap for the cache");
+			return -1;
+		}
+
+		fr_dlist_talloc_init(&shard->lru, rlm_cache_sharded_entry_t, lru_entry);
+
+		if (pthread_mutex_init(&shard->mutex, NULL) < 0) {
+			ERROR("Failed initializing mutex: %s", fr_syserror(errno));
+			return -1;
+		}
+
+		/*
+		 *	The cache.  Set last, as mod_detach uses it to
+		 *	determine whether the shard was initialised.
+		 */
+		shard->cache = fr_hash_table_alloc(driver->shards, cache_entry_hash, cache_entry_cmp, NULL);
+		if (!shard->cache) {
+			pthread_mutex_destroy(&shard->mutex);
+			ERROR("Failed to create cache");
+			return -1;
+		}
+	}
+
+	if (fr_command_register_hook(NULL, mctx->inst->parent->name, driver, cmd_table) < 0) {
+		PERROR("Failed registering radmin commands for cache %s", mctx->inst->parent->name);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Custom allocation function for the driver
+ *
+ * Allows allocation of cache entry structures with additional fields.
+ *
+ * @copydetails cache_entry_alloc_t
+ */
+static rlm_cache_entry_t *cache_entry_alloc(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+					    request_t *request)
+{
+	rlm_cache_sharded_entry_t *c;
+
+	c = talloc_zero(NULL, rlm_cache_sharded_entry_t);
+	if (!c) {
+		RERROR("Failed allocating cache entry");
+		return NULL;
+	}
+
+	return (rlm_cache_entry_t *)c;
+}
+
+/** Locate a cache entry
+ *
+ * Locks the shard the key belongs to.  The lock is held until the handle
+ * is released, so the entry remains valid until then.
+ *
+ * @copydetails cache_entry_find_t
+ */
+static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
+				       UNUSED rlm_cache_config_t const *config, void *instance,
+				       request_t *request, void *handle, uint8_t const *key, size_t key_len)
+{
+	rlm_cache_sharded_t		*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	rlm_cache_sharded_shard_t	*shard;
+	rlm_cache_sharded_entry_t	*c;
+	uint32_t			hash = fr_hash(key, key_len);
+	fr_unix_time_t			now = fr_time_to_unix_time(request->packet->timestamp);
+
+	shard = cache_shard_lock(handle, hash);
+
+	/*
+	 *	Clear out old entries
+	 */
+	while ((c = fr_heap_peek(shard->heap)) && fr_unix_time_lt(c->fields.expires, now)) {
+		cache_entry_remove(driver, shard, c);
+		shard->expired++;
+	}
+
+	/*
+	 *	Is there an entry for this key?
+	 */
+	c = fr_hash_table_find_by_key(shard->cache, hash, &(rlm_cache_entry_t){ .key = key, .key_len = key_len });
+	if (!c) {
+		shard->misses++;
+		*out = NULL;
+		return CACHE_MISS;
+	}
+
+	/*
+	 *	Most recently used goes to the head
+	 */
+	fr_dlist_remove(&shard->lru, c);
+	fr_dlist_insert_head(&shard->lru, c);
+	shard->hits++;
+
+	*out = (rlm_cache_entry_t *)c;
+
+	return CACHE_OK;
+}
+
+/** Free an entry and remove it from the data store
+ *
+ * @copydetails cache_entry_expire_t
+ */
+static cache_status_t cache_entry_expire(UNUSED rlm_cache_config_t const *config, void *instance,
+					 request_t *request, void *handle,
+					 uint8_t const *key, size_t key_len)
+{
+	rlm_cache_sharded_t		*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	rlm_cache_sharded_shard_t	*shard;
+	rlm_cache_sharded_entry_t	*c;
+	uint32_t			hash = fr_hash(key, key_len);
+
+	if (!request) return CACHE_ERROR;
+
+	shard = cache_shard_lock(handle, hash);
+
+	c = fr_hash_table_find_by_key(shard->cache, hash, &(rlm_cache_entry_t){ .key = key, .key_len = key_len });
+	if (!c) return CACHE_MISS;
+
+	cache_entry_remove(driver, shard, c);
+
+	return CACHE_OK;
+}
+
+/** Insert a new entry into the data store
+ *
+ * Evicts the least recently used entries in the shard if it has
+ * exceeded its share of max_entries or max_size.
+ *
+ * @copydetails cache_entry_insert_t
+ */
+static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, void *instance,
+					 request_t *request, void *handle,
+					 rlm_cache_entry_t const *entry)
+{
+	rlm_cache_sharded_t		*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	rlm_cache_sharded_shard_t	*shard;
+	rlm_cache_sharded_entry_t	*c = UNCONST(rlm_cache_sharded_entry_t *, entry), *old;
+
+	if (!request) return CACHE_ERROR;
+
+	c->hash = fr_hash(c->fields.key, c->fields.key_len);
+	c->size = talloc_total_size(c);
+
+	shard = cache_shard_lock(handle, c->hash);
+
+	/*
+	 *	Allow overwriting
+	 */
+	old = fr_hash_table_find_by_key(shard->cache, c->hash, c);
+	if (old) cache_entry_remove(driver, shard, old);
+
+	if (!fr_hash_table_insert(shard->cache, c)) {
+		RERROR("Failed adding entry");
+		return CACHE_ERROR;
+	}
+
+	if (fr_heap_insert(shard->heap, c) < 0) {
+		fr_hash_table_delete(shard->cache, c);
+		RERROR("Failed adding entry to expiry heap");
+		return CACHE_ERROR;
+	}
+
+	fr_dlist_insert_head(&shard->lru, c);
+	shard->size += c->size;
+	atomic_fetch_add_explicit(&driver->count, 1, memory_order_relaxed);
+
+	/*
+	 *	Evict from the tail until the shard is back within
+	 *	its limits.  Never evict the entry we just added.
+	 */
+	while ((driver->shard_max_entries && (fr_hash_table_num_elements(shard->cache) > driver->shard_max_entries)) ||
+	       (driver->shard_max_size && (shard->size > driver->shard_max_size))) {
+		rlm_cache_sharded_entry_t *lru = fr_dlist_tail(&shard->lru);
+
+		if (lru == c) break;
+
+		RDEBUG3("Evicting entry for \"%pV\"",
+			fr_box_strvalue_len((char const *)lru->fields.key, lru->fields.key_len));
+		cache_entry_remove(driver, shard, lru);
+		shard->evictions++;
+	}
+
+	return CACHE_OK;
+}
+
+/** Update the TTL of an entry
+ *
+ * @copydetails cache_entry_set_ttl_t
+ */
+static cache_status_t cache_entry_set_ttl(UNUSED rlm_cache_config_t const *config, void *instance,
+					  request_t *request, void *handle,
+					  rlm_cache_entry_t *entry)
+{
+	rlm_cache_sharded_t		*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	rlm_cache_sharded_entry_t	*c = (rlm_cache_sharded_entry_t *)entry;
+	rlm_cache_sharded_shard_t	*shard;
+
+#ifdef NDEBUG
+	if (!request) return CACHE_ERROR;
+#endif
+
+	shard = cache_shard_lock(handle, c->hash);
+
+	if (!fr_cond_assert(fr_heap_extract(shard->heap, c) == 0)) {
+		RERROR("Entry not in heap");
+		return CACHE_ERROR;
+	}
+
+	if (fr_heap_insert(shard->heap, c) < 0) {
+		fr_hash_table_delete(shard->cache, c);	/* make sure we don't leak entries... */
+		fr_dlist_remove(&shard->lru, c);
+		shard->size -= c->size;
+		atomic_fetch_sub_explicit(&driver->count, 1, memory_order_relaxed);
+		talloc_free(c);
+		RERROR("Failed updating entry TTL.  Entry was forcefully expired");
+		return CACHE_ERROR;
+	}
+	return CACHE_OK;
+}
+
+/** Return the number of entries in the cache
+ *
+ * Doesn't lock any shards, so may be slightly out of date.
+ *
+ * @copydetails cache_entry_count_t
+ */
+static uint64_t cache_entry_count(UNUSED rlm_cache_config_t const *config, void *instance,
+				  request_t *request, UNUSED void *handle)
+{
+	rlm_cache_sharded_t *driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+
+	if (!request) return CACHE_ERROR;
+
+	return atomic_load_explicit(&driver->count, memory_order_relaxed);
+}
+
+/** Allocate a handle for this request
+ *
+ * Shards are locked lazily, once we know which key we're operating on.
+ *
+ * @copydetails cache_acquire_t
+ */
+static int cache_acquire(void **handle, UNUSED rlm_cache_config_t const *config, void *instance,
+			 request_t *request)
+{
+	rlm_cache_sharded_handle_t *h;
+
+	MEM(h = talloc_zero(request, rlm_cache_sharded_handle_t));
+	h->driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+
+	*handle = h;
+
+	return 0;
+}
+
+/** Release the handle, unlocking any shard it holds
+ *
+ * @copydetails cache_release_t
+ */
+static void cache_release(UNUSED rlm_cache_config_t const *config, UNUSED void *instance, request_t *request,
+			  rlm_cache_handle_t *handle)
+{
+	rlm_cache_sharded_handle_t *h = talloc_get_type_abort(handle, rlm_cache_sharded_handle_t);
+
+	if (h->locked) {
+		pthread_mutex_unlock(&h->locked->mutex);
+		RDEBUG3("Shard %zu mutex released", (size_t)(h->locked - h->driver->shards));
+	}
+
+	talloc_free(h);
+}
+
+extern rlm_cache_driver_t rlm_cache_sharded;
+rlm_cache_driver_t rlm_cache_sharded = {
+	.name		= "rlm_cache_sharded",
+	.magic		= RLM_MODULE_INIT,
+	.config		= driver_config,
+	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
+	.inst_size	= sizeof(rlm_cache_sharded_t),
+	.inst_type	= "rlm_cache_sharded_t",
+	.alloc		= cache_entry_alloc,
+
+	.find		= cache_entry_find,
+	.insert		= cache_entry_insert,
+	.expire		= cache_entry_expire,
+	.set_ttl	= cache_entry_set_ttl,
+	.count		= cache_entry_count,
+
+	.acquire	= cache_acquire,
+	.release	= cache_release,
+};
@@ -25,9 +25,11 @@
 RCSID("$Id$")
 
 #include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/file_reload.h>
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/util/htrie.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/rcu.h>
 
 #include <freeradius-devel/server/map_proc.h>
 
@@ -59,14 +61,32 @@ typedef struct {
 	int		*field_offsets; /* field X from the file maps to array entry Y here */
 	fr_type_t	*field_types;
 	fr_rb_tree_t	*tree;
-	fr_htrie_t	*trie;
 
 	tmpl_t		*key;
 	fr_type_t	key_data_type;
 
 	fr_map_list_t	map;		//!< if there is an "update" section in the configuration.
+
+	fr_time_delta_t	reload_interval;	//!< How often to check the file for changes.
+
+	CONF_SECTION	*conf;		//!< For logging errors found when reloading.
+	fr_rcu_t	*data;		//!< rlm_csv_data_t, read by the workers.
+	file_reload_t	*reload;	//!< Re-reads the file when it changes.
 } rlm_csv_t;
 
+/** Everything read from the CSV file
+ *
+ * This is replaced as a whole when the file is reloaded.
+ */
+typedef struct {
+	fr_htrie_t	*trie;
+	int64_t		entries;	//!< Number of lines read from the file.
+} rlm_csv_data_t;
+
+typedef struct {
+	fr_rcu_reader_t	*reader;	//!< For this thread to read inst->data.
+} rlm_csv_thread_t;
+
 typedef struct rlm_csv_entry_s rlm_csv_entry_t;
 struct rlm_csv_entry_s {
 	fr_rb_node_t node;
@@ -86,13 +106,14 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("allow_multiple_keys", FR_TYPE_BOOL, rlm_csv_t, allow_multiple_keys) },
 	{ FR_CONF_OFFSET("index_field", FR_TYPE_STRING | FR_TYPE_REQUIRED | FR_TYPE_NOT_EMPTY, rlm_csv_t, index_field_name) },
 	{ FR_CONF_OFFSET("key", FR_TYPE_TMPL, rlm_csv_t, key) },
+	{ FR_CONF_OFFSET("reload_interval", FR_TYPE_TIME_DELTA, rlm_csv_t, reload_interval), .dflt = "0" },
 	CONF_PARSER_TERMINATOR
 };
 
 /*
  *	Allow for quotation marks.
  */
-static bool buf2entry(rlm_csv_t *inst, char *buf, char **out)
+static bool buf2entry(rlm_csv_t const *inst, char *buf, char **out)
 {
 	char *p, *q;
 
@@ -185,13 +206,13 @@ static int csv_to_key(uint8_t **out, size_t *outlen, void const *data)
 }
 
 
-static bool insert_entry(CONF_SECTION *conf, rlm_csv_t *inst, rlm_csv_entry_t *e, int lineno)
+static bool insert_entry(CONF_SECTION *conf, rlm_csv_t const *inst, rlm_csv_data_t *data, rlm_csv_entry_t *e, int lineno)
 {
 	rlm_csv_entry_t *old;
 
 	fr_assert(e != NULL);
 
-	old = fr_htrie_find(inst->trie, e);
+	old = fr_htrie_find(data->trie, e);
 	if (old) {
 		if (!inst->allow_multiple_keys && !inst->multiple_index_fields) {
 			cf_log_err(conf, "%s[%d]: Multiple entries are disallowed", inst->filename, lineno);
@@ -207,7 +228,7 @@ static bool insert_entry(CONF_SECTION *conf, rlm_csv_t *inst, rlm_csv_entry_t *e
 		return true;
 	}
 
-	if (!fr_htrie_insert(inst->trie, e)) {
+	if (!fr_htrie_insert(data->trie, e)) {
 		cf_log_err(conf, "Failed inserting entry for file %s line %d: %s",
 			   inst->filename, lineno, fr_strerror());
 fail:
@@ -219,13 +240,14 @@ fail:
 }
 
 
-static bool duplicate_entry(CONF_SECTION *conf, rlm_csv_t *inst, rlm_csv_entry_t *old, char *p, int lineno)
+static bool duplicate_entry(CONF_SECTION *conf, rlm_csv_t const *inst, rlm_csv_data_t *data,
+			    rlm_csv_entry_t *old, char *p, int lineno)
 {
 	int i;
 	fr_type_t type = inst->key_data_type;
 	rlm_csv_entry_t *e;
 
-	MEM(e = (rlm_csv_entry_t *)talloc_zero_array(inst, uint8_t,
+	MEM(e = (rlm_csv_entry_t *)talloc_zero_array(data, uint8_t,
 						     sizeof(*e) + (inst->used_fields * sizeof(e->data[0]))));
 	talloc_set_type(e, rlm_csv_entry_t);
 
@@ -243,19 +265,19 @@ static bool duplicate_entry(CONF_SECTION *conf, rlm_csv_t *inst, rlm_csv_entry_t
 		if (old->data[i]) e->data[i] = old->data[i]; /* no need to dup it, it's never freed... */
 	}
 
-	return insert_entry(conf, inst, e, lineno);
+	return insert_entry(conf, inst, data, e, lineno);
 }
 
 /*
  *	Convert a buffer to a CSV entry
  */
-static bool file2csv(CONF_SECTION *conf, rlm_csv_t *inst, int lineno, char *buffer)
+static bool file2csv(CONF_SECTION *conf, rlm_csv_t const *inst, rlm_csv_data_t *data, int lineno, char *buffer)
 {
 	rlm_csv_entry_t *e;
 	int i;
 	char *p, *q;
 
-	MEM(e = (rlm_csv_entry_t *)talloc_zero_array(inst, uint8_t,
+	MEM(e = (rlm_csv_entry_t *)talloc_zero_array(data, uint8_t,
 						     sizeof(*e) + (inst->used_fields * sizeof(e->data[0]))));
 	talloc_set_type(e, rlm_csv_entry_t);
 
@@ -301,7 +323,7 @@ static bool file2csv(CONF_SECTION *conf, rlm_csv_t *inst, int lineno, char *buff
 				while (l) {
 					*l = '\0';
 
-					if (!duplicate_entry(conf, inst, e, p, lineno)) goto fail;
+					if (!duplicate_entry(conf, inst, data, e, p, lineno)) goto fail;
 
 					if (!l) break;
 					p = l + 1;
@@ -354,7 +376,7 @@ static bool file2csv(CONF_SECTION *conf, rlm_csv_t *inst, int lineno, char *buff
 		goto fail;
 	}
 
-	return insert_entry(conf, inst, e, lineno);
+	return insert_entry(conf, inst, data, e, lineno);
 }
 
 
@@ -518,7 +540,6 @@ static int mod_bootstrap(module_inst_ctx_t const *mctx)
 	char const	*p;
 	char		*q;
 	char		*fields;
-	fr_htrie_type_t	htype;
 
 	if (inst->delimiter[1]) {
 		cf_log_err(conf, "'delimiter' must be one character long");
@@ -548,23 +569,12 @@ static int mod_bootstrap(module_inst_ctx_t const *mctx)
 	/*
 	 *	IP addresses go into tries.  Everything else into binary tries.
 	 */
-	htype = fr_htrie_hint(inst->key_data_type);
-	if (htype == FR_HTRIE_INVALID) {
+	if (fr_htrie_hint(inst->key_data_type) == FR_HTRIE_INVALID) {
 		cf_log_err(conf, "Invalid data type '%s' used for CSV file.",
 			   fr_table_str_by_value(fr_value_box_type_table, inst->key_data_type, "???"));
 		return -1;
 	}
 
-	inst->trie = fr_htrie_alloc(inst, htype,
-				    (fr_hash_t) csv_hash,
-				    (fr_cmp_t) csv_cmp,
-				    (fr_trie_key_t) csv_to_key,
-				    NULL);
-	if (!inst->trie) {
-		cf_log_err(conf, "Failed creating internal trie: %s", fr_strerror());
-		return -1;
-	}
-
 	if ((*inst->index_field_name == ',') || (*inst->index_field_name == *inst->delimiter)) {
 		cf_log_err(conf, "Field names cannot begin with the '%c' character", *inst->index_field_name);
 		return -1;
@@ -741,6 +751,98 @@ static int mod_bootstrap(module_inst_ctx_t const *mctx)
 }
 
 
+/** Read the CSV file into a new trie
+ *
+ * The result isn't parented by the instance, as it may be built in
+ * the reload thread, and freed by whichever thread publishes its
+ * replacement.
+ *
+ * @param[in] conf	for logging errors.
+ * @param[in] inst	of the module.
+ * @return
+ *	- The data read from the file.
+ *	- NULL on error.
+ */
+static rlm_csv_data_t *csv_data_load(CONF_SECTION *conf, rlm_csv_t const *inst)
+{
+	rlm_csv_data_t	*data;
+	int		lineno;
+	FILE		*fp;
+	char		buffer[8192];
+
+	MEM(data = talloc_zero(NULL, rlm_csv_data_t));
+
+	data->trie = fr_htrie_alloc(data, fr_htrie_hint(inst->key_data_type),
+				    (fr_hash_t) csv_hash,
+				    (fr_cmp_t) csv_cmp,
+				    (fr_trie_key_t) csv_to_key,
+				    NULL);
+	if (!data->trie) {
+		cf_log_err(conf, "Failed creating internal trie: %s", fr_strerror());
+	error:
+		talloc_free(data);
+		return NULL;
+	}
+
+	/*
+	 *	Re-open the file and read it all.
+	 */
+	fp = fopen(inst->filename, "r");
+	if (!fp) {
+		cf_log_err(conf, "Error opening filename %s: %s", inst->filename, fr_syserror(errno));
+		goto error;
+	}
+	lineno = 1;
+
+	/*
+	 *	If there is a header in the file, then read that first.
+	 *	This time we just ignore it.
+	 */
+	if (inst->header) {
+		char *p = fgets(buffer, sizeof(buffer), fp);
+		if (!p) {
+			cf_log_err(conf, "Error reading filename %s: Unexpected EOF", inst->filename);
+			fclose(fp);
+			goto error;
+		}
+		lineno++;
+	}
+
+	/*
+	 *	Read the rest of the file.
+	 */
+	while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+		if (!file2csv(conf, inst, data, lineno, buffer)) {
+			fclose(fp);
+			goto error;
+		}
+
+		lineno++;
+		data->entries++;
+	}
+	fclose(fp);
+
+	return data;
+}
+
+/*
+ *	Called from the reload thread when the file changes.
+ */
+static int64_t csv_reload(void *uctx)
+{
+	rlm_csv_t	*inst = talloc_get_type_abort(uctx, rlm_csv_t);
+	rlm_csv_data_t	*data;
+	int64_t		entries;
+
+	data = csv_data_load(inst->conf, inst);
+	if (!data) return -1;
+
+	entries = data->entries;
+	fr_rcu_publish(inst->data, data);
+
+	return entries;
+}
+
 /** Instantiate the module
  *
  * Creates a new instance of the module reading parameters from a configuration section.
@@ -755,13 +857,12 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	rlm_csv_t	*inst = talloc_get_type_abort(mctx->inst->data, rlm_csv_t);
 	CONF_SECTION	*conf = mctx->inst->conf;
 	CONF_SECTION	*cs;
-	int		lineno;
-	FILE		*fp;
+	rlm_csv_data_t	*data;
 	tmpl_rules_t	parse_rules = {
 		.allow_foreign = true	/* Because we don't know where we'll be called */
 	};
-	char buffer[8192];
 
+	inst->conf = conf;
 	fr_dlist_map_init(&inst->map);
 	/*
 	 *	"update" without "key" is invalid, as we can't run the
@@ -790,42 +891,51 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		cf_log_warn(conf, "Ignoring 'key', as no 'update' section has been defined.");
 	}
 
-	/*
-	 *	Re-open the file and read it all.
-	 */
-	fp = fopen(inst->filename, "r");
-	if (!fp) {
-		cf_log_err(conf, "Error opening filename %s: %s", inst->filename, fr_syserror(errno));
-		return -1;
-	}
-	lineno = 1;
+	data = csv_data_load(conf, inst);
+	if (!data) return -1;
 
-	/*
-	 *	If there is a header in the file, then read that first.
-	 *	This time we just ignore it.
-	 */
-	if (inst->header) {
-		char *p = fgets(buffer, sizeof(buffer), fp);
-		if (!p) {
-			cf_log_err(conf, "Error reading filename %s: Unexpected EOF", inst->filename);
-			fclose(fp);
+	MEM(inst->data = fr_rcu_alloc(inst, data));
+
+	if (fr_time_delta_ispos(inst->reload_interval)) {
+		char const **filenames;
+
+		FR_TIME_DELTA_BOUND_CHECK("reload_interval", inst->reload_interval, >=, fr_time_delta_from_sec(1));
+
+		MEM(filenames = talloc_array(inst, char const *, 1));
+		filenames[0] = inst->filename;
+
+		inst->reload = file_reload_alloc(inst, mctx->inst->name, filenames, inst->reload_interval,
+						 csv_reload, inst);
+		talloc_free(filenames);
+		if (!inst->reload) {
+			cf_log_perr(conf, "Failed starting reload thread");
 			return -1;
 		}
-		lineno++;
+		file_reload_entries_set(inst->reload, data->entries);
 	}
 
+	return 0;
+}
+
+static int mod_detach(module_detach_ctx_t const *mctx)
+{
+	rlm_csv_t *inst = talloc_get_type_abort(mctx->inst->data, rlm_csv_t);
+
 	/*
-	 *	Read the rest of the file.
+	 *	Stop the reload thread before the data it publishes
+	 *	to goes away.
 	 */
-	while (fgets(buffer, sizeof(buffer), fp) != NULL) {
-		if (!file2csv(conf, inst, lineno, buffer)) {
-			fclose(fp);
-			return -1;
-		}
+	TALLOC_FREE(inst->reload);
 
-		lineno++;
-	}
-	fclose(fp);
+	return 0;
+}
+
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_csv_t		*inst = talloc_get_type_abort(mctx->inst->data, rlm_csv_t);
+	rlm_csv_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_csv_thread_t);
+
+	MEM(t->reader = fr_rcu_reader_alloc(t, inst->data));
 
 	return 0;
 }
@@ -892,14 +1002,21 @@ static int csv_map_getvalue(TALLOC_CTX *ctx, fr_pair_list_t *out, request_t *req
  *	- #RLM_MODULE_UPDATED if one or more #fr_pair_t were added to the #request_t.
  *	- #RLM_MODULE_FAIL if an error occurred.
  */
-static rlm_rcode_t mod_map_apply(rlm_csv_t const *inst, request_t *request,
+static rlm_rcode_t mod_map_apply(rlm_csv_t const *inst, rlm_csv_thread_t *t, request_t *request,
 				fr_value_box_t const *key, fr_map_list_t const *maps)
 {
 	rlm_rcode_t		rcode = RLM_MODULE_UPDATED;
+	rlm_csv_data_t const	*data;
 	rlm_csv_entry_t		*e;
 	map_t const		*map = NULL;
 
-	e = fr_htrie_find(inst->trie, &(rlm_csv_entry_t) { .key = UNCONST(fr_value_box_t *, key) } );
+	/*
+	 *	The entries are only valid until we unlock.  They're
+	 *	copied into the request by map_to_request().
+	 */
+	data = fr_rcu_read_lock(t->reader);
+
+	e = fr_htrie_find(data->trie, &(rlm_csv_entry_t) { .key = UNCONST(fr_value_box_t *, key) } );
 	if (!e) {
 		rcode = RLM_MODULE_NOOP;
 		goto finish;
@@ -955,6 +1072,7 @@ redo:
 	}
 
 finish:
+	fr_rcu_read_unlock(t->reader);
 	return rcode;
 }
 
@@ -975,6 +1093,7 @@ static rlm_rcode_t mod_map_proc(void *mod_inst, UNUSED void *proc_inst, request_
 				fr_value_box_list_t *key, fr_map_list_t const *maps)
 {
 	rlm_csv_t		*inst = talloc_get_type_abort(mod_inst, rlm_csv_t);
+	rlm_csv_thread_t	*t = talloc_get_type_abort(module_thread_by_data(inst)->data, rlm_csv_thread_t);
 	fr_value_box_t		*key_head = fr_dlist_head(key);
 
 	if (!key_head) {
@@ -992,13 +1111,14 @@ static rlm_rcode_t mod_map_proc(void *mod_inst, UNUSED void *proc_inst, request_
 		}
 	}
 
-	return mod_map_apply(inst, request, key_head, maps);
+	return mod_map_apply(inst, t, request, key_head, maps);
 }
 
 
 static unlang_action_t CC_HINT(nonnull) mod_process(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_csv_t const *inst = talloc_get_type_abort_const(mctx->inst->data, rlm_csv_t);
+	rlm_csv_thread_t *t = talloc_get_type_abort(mctx->thread, rlm_csv_thread_t);
 	rlm_rcode_t rcode;
 	ssize_t slen;
 	fr_value_box_t *key;
@@ -1036,7 +1156,7 @@ static unlang_action_t CC_HINT(nonnull) mod_process(rlm_rcode_t *p_result, modul
 
 	RDEBUG2("Processing CVS map with key %pV", key);
 	RINDENT();
-	rcode = mod_map_apply(inst, request, key, &inst->map);
+	rcode = mod_map_apply(inst, t, request, key, &inst->map);
 	REXDENT();
 
 	talloc_free(key);
@@ -1052,6 +1172,10 @@ module_t rlm_csv = {
 	.config		= module_config,
 	.bootstrap	= mod_bootstrap,
 	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
+	.thread_inst_size	= sizeof(rlm_csv_thread_t),
+	.thread_inst_type	= "rlm_csv_thread_t",
+	.thread_instantiate	= mod_thread_instantiate,
 
 	.method_names = (module_method_names_t[]){
 		{ .name1 = CF_IDENT_ANY,	.name2 = CF_IDENT_ANY,	.method = mod_process },
@@ -26,14 +26,28 @@ RCSID("$Id$")
 #define LOG_PREFIX mctx->inst->name
 
 #include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/detail.h>
 #include <freeradius-devel/server/exfile.h>
 #include <freeradius-devel/server/module.h>
+#include <freeradius-devel/internal/internal.h>
+#include <freeradius-devel/io/schedule.h>
+#include <freeradius-devel/unlang/interpret.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/perm.h>
+#include <freeradius-devel/util/syserror.h>
 
 #include <ctype.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
 
 #ifdef HAVE_UNISTD_H
 #  include <unistd.h>
@@ -45,6 +59,66 @@ RCSID("$Id$")
 
 #define DIRLEN	8192		//!< Maximum path length.
 
+#define DETAIL_BINARY_MAX	65536	//!< Maximum size of a binary record.
+#define DETAIL_MAX_IOV		64	//!< Maximum number of records passed to a single writev().
+
+typedef enum {
+	DETAIL_FORMAT_TEXT = 0,		//!< One "Attribute = value" line per attribute.
+	DETAIL_FORMAT_BINARY		//!< Length prefixed records, see detail.h.
+} detail_format_t;
+
+static fr_table_num_sorted_t const detail_format_table[] = {
+	{ L("binary"),	DETAIL_FORMAT_BINARY	},
+	{ L("text"),	DETAIL_FORMAT_TEXT	}
+};
+static size_t detail_format_table_len = NUM_ELEMENTS(detail_format_table);
+
+typedef struct detail_record_s detail_record_t;
+typedef struct rlm_detail_thread_s rlm_detail_thread_t;
+
+/** A binary record waiting to be written by the commit thread
+ *
+ */
+struct detail_record_s {
+	detail_record_t		*next;		//!< Next record in the queue.
+	detail_record_t		*same;		//!< Next record in this batch for the same file.
+
+	char const		*filename;	//!< Expanded filename to append the record to.
+	uint8_t			*data;		//!< The encoded record.
+	size_t			data_len;	//!< Length of the encoded record.
+
+	rlm_detail_thread_t	*thread;	//!< Worker waiting for the record to be synced.
+						///< If NULL, the commit thread frees the record.
+	request_t		*request;	//!< To mark runnable once the record has been synced.
+	bool			cancelled;	//!< The request went away, only used by the worker.
+	bool			returned;	//!< The commit thread has written the record back to the
+						///< worker, so the worker owns it.  Only used by the worker.
+
+	bool			written;	//!< Handled by the commit thread, only used by that thread.
+	int			rcode;		//!< 0 if the record is on disk, -1 on error.
+};
+
+/** Writes, and syncs binary records in batches on behalf of all workers
+ *
+ * Workers encode the record, then queue it.  The commit thread takes
+ * everything queued since it last woke up, writes all the records
+ * for a given file with one writev(), and makes them durable with
+ * one fdatasync().
+ */
+typedef struct {
+	dl_module_inst_t const	*dl_inst;	//!< So the commit thread can log.
+
+	pthread_t		thread;		//!< The commit thread.
+	pthread_mutex_t		mutex;		//!< Protects everything below.
+	pthread_cond_t		work;		//!< Signalled when records are queued.
+
+	detail_record_t		*head;		//!< Records waiting to be written.
+	detail_record_t		**tail;		//!< Where to queue the next record.
+
+	bool			running;	//!< Commit thread was started.
+	bool			stop;		//!< Commit thread should exit once the queue is empty.
+} detail_writer_t;
+
 /** Instance configuration for rlm_detail
  *
  * Holds the configuration and preparsed data for a instance of rlm_detail.
@@ -61,13 +135,33 @@ typedef struct {
 
 	bool		escape;		//!< do filename escaping, yes / no
 
+	detail_format_t	format;		//!< Text or binary entries.
+	bool		sync;		//!< Wait for binary entries to reach the disk.
+
 	xlat_escape_legacy_t	escape_func; //!< escape function
 
 	exfile_t    	*ef;		//!< Log file handler
 
 	fr_hash_table_t *ht;		//!< Holds suppressed attributes.
+
+	detail_writer_t	*writer;	//!< Group commit writer for binary entries.
+	gid_t		gid;		//!< Resolved group, for binary entries.
+	bool		set_gid;	//!< Whether gid is valid.
 } rlm_detail_t;
 
+/** Per-worker state, for waiting on synced binary records
+ *
+ * The commit thread writes pointers to the records it has synced down
+ * the pipe of the worker which is waiting for them.  The worker reads
+ * the pipe from its event loop, and marks the requests runnable.
+ */
+struct rlm_detail_thread_s {
+	dl_module_inst_t const	*dl_inst;	//!< So the pipe callbacks can log.
+	fr_event_list_t		*el;		//!< The pipe is registered with.
+	int			pipe[2];	//!< Synced records are written to pipe[1].
+	atomic_uint_fast32_t	outstanding;	//!< Records which haven't been written back yet.
+};
+
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("filename", FR_TYPE_FILE_OUTPUT | FR_TYPE_REQUIRED | FR_TYPE_XLAT, rlm_detail_t, filename), .dflt = "%A/%{Packet-Src-IP-Address}/detail" },
 	{ FR_CONF_OFFSET("header", FR_TYPE_TMPL | FR_TYPE_XLAT | FR_TYPE_NON_BLOCKING, rlm_detail_t, header),
@@ -77,6 +171,11 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("locking", FR_TYPE_BOOL, rlm_detail_t, locking), .dflt = "no" },
 	{ FR_CONF_OFFSET("escape_filenames", FR_TYPE_BOOL, rlm_detail_t, escape), .dflt = "no" },
 	{ FR_CONF_OFFSET("log_packet_header", FR_TYPE_BOOL, rlm_detail_t, log_srcdst), .dflt = "no" },
+	{ FR_CONF_OFFSET("format", FR_TYPE_VOID, rlm_detail_t, format),
+	  .func = cf_table_parse_int,
+	  .uctx = &(cf_table_parse_ctx_t){ .table = detail_format_table, .len = &detail_format_table_len },
+	  .dflt = "text" },
+	{ FR_CONF_OFFSET("sync", FR_TYPE_BOOL, rlm_detail_t, sync), .dflt = "yes" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -126,6 +225,222 @@ static int8_t detail_cmp(void const *a, void const *b)
 	return CMP(a, b);
 }
 
+/** Write all of an iovec array, dealing with short writes
+ *
+ */
+static int detail_writev(int fd, struct iovec *iov, int iovcnt)
+{
+	while (iovcnt > 0) {
+		ssize_t slen;
+
+		slen = writev(fd, iov, iovcnt);
+		if (slen < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+
+		while ((iovcnt > 0) && ((size_t) slen >= iov->iov_len)) {
+			slen -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+
+		if (iovcnt > 0) {
+			iov->iov_base = ((uint8_t *) iov->iov_base) + slen;
+			iov->iov_len -= slen;
+		}
+	}
+
+	return 0;
+}
+
+/** Write, and sync every record in the batch destined for the same file as "first"
+ *
+ * @param[in] inst	Instance of rlm_detail.
+ * @param[in] first	Record which hasn't been written yet.  All later
+ *			records in the batch for the same file are
+ *			written with it.
+ */
+static void detail_writer_flush(rlm_detail_t const *inst, detail_record_t *first)
+{
+	module_inst_ctx_t const	*mctx = MODULE_INST_CTX(inst->writer->dl_inst);
+	struct iovec		iov[DETAIL_MAX_IOV];
+	detail_record_t		*rec, **last = &first->same;
+	int			fd, iovcnt = 0, rcode = 0;
+	off_t			start;
+
+	/*
+	 *	Chain together all the records for this file, in the
+	 *	order they were queued.
+	 */
+	first->written = true;
+	for (rec = first->next; rec; rec = rec->next) {
+		if (rec->written || (strcmp(rec->filename, first->filename) != 0)) continue;
+
+		rec->written = true;
+		*last = rec;
+		last = &rec->same;
+	}
+
+	fd = exfile_open(inst->ef, first->filename, inst->perm);
+	if (fd < 0) {
+		PERROR("Couldn't open file %s", first->filename);
+		rcode = -1;
+		goto finish;
+	}
+
+	if (inst->set_gid && (fchown(fd, -1, inst->gid) < 0)) {
+		DEBUG2("Unable to change system group of '%s'", first->filename);
+	}
+
+	start = lseek(fd, 0, SEEK_END);
+	if (start < 0) {
+		ERROR("Failed seeking to end of detail file %s: %s", first->filename, fr_syserror(errno));
+		rcode = -1;
+		goto close;
+	}
+
+	for (rec = first; rec; rec = rec->same) {
+		iov[iovcnt].iov_base = rec->data;
+		iov[iovcnt].iov_len = rec->data_len;
+		iovcnt++;
+
+		if ((iovcnt < DETAIL_MAX_IOV) && rec->same) continue;
+
+		if (detail_writev(fd, iov, iovcnt) < 0) {
+			ERROR("Failed writing to detail file %s: %s", first->filename, fr_syserror(errno));
+
+			/*
+			 *	Don't leave a partial record behind,
+			 *	the reader would lose its place.
+			 */
+			if (ftruncate(fd, start) < 0) {
+				ERROR("Failed truncating detail file %s: %s", first->filename, fr_syserror(errno));
+			}
+			rcode = -1;
+			goto close;
+		}
+		iovcnt = 0;
+	}
+
+	/*
+	 *	One sync for everything written to this file.
+	 */
+	if (fdatasync(fd) < 0) {
+		ERROR("Failed syncing detail file %s: %s", first->filename, fr_syserror(errno));
+		rcode = -1;
+	}
+
+close:
+	exfile_close(inst->ef, fd);
+
+finish:
+	for (rec = first; rec; rec = rec->same) rec->rcode = rcode;
+}
+
+/** Commit thread for binary records
+ *
+ */
+static void *detail_writer_thread(void *arg)
+{
+	rlm_detail_t const	*inst = arg;
+	detail_writer_t		*writer = inst->writer;
+	module_inst_ctx_t const	*mctx = MODULE_INST_CTX(writer->dl_inst);
+	detail_record_t		*batch, *rec, *next;
+
+	pthread_mutex_lock(&writer->mutex);
+	for (;;) {
+		while (!writer->head && !writer->stop) pthread_cond_wait(&writer->work, &writer->mutex);
+
+		/*
+		 *	Only exit once everything queued has been
+		 *	written.
+		 */
+		if (!writer->head) break;
+
+		/*
+		 *	Take everything which was queued whilst we
+		 *	were writing the previous batch.
+		 */
+		batch = writer->head;
+		writer->head = NULL;
+		writer->tail = &writer->head;
+		pthread_mutex_unlock(&writer->mutex);
+
+		for (rec = batch; rec; rec = rec->next) {
+			if (!rec->written) detail_writer_flush(inst, rec);
+		}
+
+		for (rec = batch; rec; rec = next) {
+			rlm_detail_thread_t	*t = rec->thread;
+			ssize_t			len;
+
+			next = rec->next;
+
+			if (!t) {
+				talloc_free(rec);
+				continue;
+			}
+
+			/*
+			 *	Once the pointer is written, the worker
+			 *	may free the record at any time.  Once
+			 *	outstanding is decremented, it may free
+			 *	its own state.
+			 */
+			do {
+				len = write(t->pipe[1], &rec, sizeof(rec));
+			} while ((len < 0) && (errno == EINTR));
+			if (len < 0) ERROR("Failed writing to completion pipe: %s", fr_syserror(errno));
+			atomic_fetch_sub(&t->outstanding, 1);
+		}
+
+		pthread_mutex_lock(&writer->mutex);
+	}
+	pthread_mutex_unlock(&writer->mutex);
+
+	return NULL;
+}
+
+/** Queue a record for the commit thread
+ *
+ * If rec->thread is set, the record is written back to that worker's
+ * pipe once it has been synced.  Otherwise the commit thread frees it.
+ *
+ * @param[in] writer	to queue the record with.
+ * @param[in] rec	to queue.
+ */
+static void detail_writer_submit(detail_writer_t *writer, detail_record_t *rec)
+{
+	if (rec->thread) atomic_fetch_add(&rec->thread->outstanding, 1);
+
+	pthread_mutex_lock(&writer->mutex);
+	*writer->tail = rec;
+	writer->tail = &rec->next;
+	pthread_cond_signal(&writer->work);
+	pthread_mutex_unlock(&writer->mutex);
+}
+
+/** Stop the commit thread, after it's written anything still queued
+ *
+ */
+static int _detail_writer_free(detail_writer_t *writer)
+{
+	if (writer->running) {
+		pthread_mutex_lock(&writer->mutex);
+		writer->stop = true;
+		pthread_cond_signal(&writer->work);
+		pthread_mutex_unlock(&writer->mutex);
+
+		pthread_join(writer->thread, NULL);
+	}
+
+	pthread_cond_destroy(&writer->work);
+	pthread_mutex_destroy(&writer->mutex);
+
+	return 0;
+}
+
 /*
  *	(Re-)read radiusd.conf into memory.
  */
@@ -150,6 +465,40 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		return -1;
 	}
 
+	/*
+	 *	Binary entries are written by a dedicated thread,
+	 *	which batches writes and syncs.
+	 */
+	if (inst->format == DETAIL_FORMAT_BINARY) {
+		detail_writer_t *writer;
+
+#ifdef HAVE_GRP_H
+		if (inst->group) {
+			char *endptr;
+
+			inst->gid = strtol(inst->group, &endptr, 10);
+			inst->set_gid = true;
+			if ((*endptr != '\0') && (fr_perm_gid_from_str(inst, &inst->gid, inst->group) < 0)) {
+				cf_log_warn(conf, "Unable to find system group '%s'", inst->group);
+				inst->set_gid = false;
+			}
+		}
+#endif
+
+		MEM(writer = inst->writer = talloc_zero(inst, detail_writer_t));
+		writer->dl_inst = mctx->inst;
+		writer->tail = &writer->head;
+		pthread_mutex_init(&writer->mutex, NULL);
+		pthread_cond_init(&writer->work, NULL);
+		talloc_set_destructor(writer, _detail_writer_free);
+
+		if (fr_schedule_pthread_create(&writer->thread, detail_writer_thread, inst) < 0) {
+			cf_log_perr(conf, "Failed creating commit thread");
+			return -1;
+		}
+		writer->running = true;
+	}
+
 	/*
 	 *	Suppress certain attributes.
 	 */
@@ -206,6 +555,135 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	return 0;
 }
 
+/** Read synced records from the pipe
+ *
+ * @param[in] t		Worker the records were submitted by.
+ * @param[in] discard	don't resume the requests, the worker is exiting.
+ */
+static void detail_thread_drain(rlm_detail_thread_t *t, bool discard)
+{
+	module_inst_ctx_t const	*mctx = MODULE_INST_CTX(t->dl_inst);
+	detail_record_t		*recs[64];
+	ssize_t			len;
+	size_t			i;
+
+	for (;;) {
+		len = read(t->pipe[0], recs, sizeof(recs));
+		if (len < 0) {
+			if (errno == EINTR) continue;
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+				ERROR("Failed reading from completion pipe: %s", fr_syserror(errno));
+			}
+			return;
+		}
+
+		/*
+		 *	Each record pointer is written atomically,
+		 *	so we never see part of one.
+		 */
+		for (i = 0; i < ((size_t)len / sizeof(recs[0])); i++) {
+			detail_record_t *rec = recs[i];
+
+			if (rec->cancelled || discard) {
+				talloc_free(rec);
+				continue;
+			}
+
+			/*
+			 *	The request may still be cancelled
+			 *	before it resumes, in which case the
+			 *	signal handler frees the record.
+			 */
+			rec->returned = true;
+			unlang_interpret_mark_runnable(rec->request);
+		}
+
+		if ((size_t)len < sizeof(recs)) return;
+	}
+}
+
+static void _detail_pipe_read(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	detail_thread_drain(talloc_get_type_abort(uctx, rlm_detail_thread_t), false);
+}
+
+static void _detail_pipe_error(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, int fd_errno, void *uctx)
+{
+	rlm_detail_thread_t	*t = talloc_get_type_abort(uctx, rlm_detail_thread_t);
+	module_inst_ctx_t const	*mctx = MODULE_INST_CTX(t->dl_inst);
+
+	ERROR("Completion pipe (%i) failed: %s", fd, fr_syserror(fd_errno));
+}
+
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_detail_t const	*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_detail_t);
+	rlm_detail_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_detail_thread_t);
+
+	t->dl_inst = mctx->inst;
+	t->el = mctx->el;
+	t->pipe[0] = t->pipe[1] = -1;
+	atomic_init(&t->outstanding, 0);
+
+	if (!inst->writer || !inst->sync) return 0;
+
+	if (pipe(t->pipe) < 0) {
+		ERROR("Failed creating completion pipe: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	if (fr_nonblock(t->pipe[0]) < 0) {
+		PERROR("Failed setting completion pipe to non-blocking");
+		return -1;
+	}
+
+	if (fr_event_fd_insert(t, t->el, t->pipe[0], _detail_pipe_read, NULL, _detail_pipe_error, t) < 0) {
+		PERROR("Failed listening on completion pipe");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_detail_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_detail_thread_t);
+	struct timespec		ts = { .tv_sec = 0, .tv_nsec = 1000000 };
+
+	if (t->pipe[0] < 0) return 0;
+
+	/*
+	 *	The commit thread may still be syncing records for
+	 *	this worker.  Wait for them, emptying the pipe as we
+	 *	go so that it doesn't block writing to it.
+	 */
+	for (;;) {
+		detail_thread_drain(t, true);
+		if (atomic_load(&t->outstanding) == 0) break;
+		nanosleep(&ts, NULL);
+	}
+	detail_thread_drain(t, true);
+
+	(void) fr_event_fd_delete(t->el, t->pipe[0], FR_EVENT_FILTER_IO);
+	close(t->pipe[0]);
+	if (t->pipe[1] >= 0) close(t->pipe[1]);
+
+	return 0;
+}
+
+static int mod_detach(module_detach_ctx_t const *mctx)
+{
+	rlm_detail_t *inst = talloc_get_type_abort(mctx->inst->data, rlm_detail_t);
+
+	/*
+	 *	Flush anything still queued before the exfile
+	 *	handles go away.
+	 */
+	TALLOC_FREE(inst->writer);
+
+	return 0;
+}
+
 /*
  *	Wrapper for VPs allocated on the stack.
  */
@@ -354,6 +832,208 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, request_t *request,
 	return 0;
 }
 
+/** Add the src/dst address and port of a packet to a list, for binary entries
+ *
+ */
+static void detail_binary_srcdst(TALLOC_CTX *ctx, fr_pair_list_t *out, fr_radius_packet_t *packet)
+{
+	fr_dict_attr_t const	*src_da, *dst_da;
+	fr_pair_t		*vp;
+
+	switch (packet->socket.inet.src_ipaddr.af) {
+	case AF_INET:
+		src_da = attr_packet_src_ipv4_address;
+		dst_da = attr_packet_dst_ipv4_address;
+		break;
+
+	case AF_INET6:
+		src_da = attr_packet_src_ipv6_address;
+		dst_da = attr_packet_dst_ipv6_address;
+		break;
+
+	default:
+		src_da = dst_da = NULL;
+		break;
+	}
+
+	if (src_da) {
+		MEM(vp = fr_pair_afrom_da(ctx, src_da));
+		vp->vp_ip = packet->socket.inet.src_ipaddr;
+		fr_pair_append(out, vp);
+
+		MEM(vp = fr_pair_afrom_da(ctx, dst_da));
+		vp->vp_ip = packet->socket.inet.dst_ipaddr;
+		fr_pair_append(out, vp);
+	}
+
+	MEM(vp = fr_pair_afrom_da(ctx, attr_packet_src_port));
+	vp->vp_uint16 = packet->socket.inet.src_port;
+	fr_pair_append(out, vp);
+
+	MEM(vp = fr_pair_afrom_da(ctx, attr_packet_dst_port));
+	vp->vp_uint16 = packet->socket.inet.dst_port;
+	fr_pair_append(out, vp);
+}
+
+/** Encode a list of attributes into a binary entry
+ *
+ * @param[out] dbuff	to write the attributes to.
+ * @param[in] inst	Instance of rlm_detail.
+ * @param[in] list	of attributes to encode.
+ * @param[in] compat	Write out entry in compatibility mode.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int detail_binary_encode(fr_dbuff_t *dbuff, rlm_detail_t const *inst, fr_pair_list_t *list, bool compat)
+{
+	fr_dcursor_t	cursor;
+	fr_pair_t	*vp;
+
+	for (vp = fr_pair_dcursor_init(&cursor, list);
+	     vp;
+	     vp = fr_dcursor_current(&cursor)) {
+		if ((inst->ht && fr_hash_table_find(inst->ht, vp->da)) ||
+		    (compat && (vp->da == attr_user_password))) {
+			fr_dcursor_next(&cursor);
+			continue;
+		}
+
+		if (fr_internal_encode_pair(dbuff, &cursor, NULL) < 0) return -1;
+	}
+
+	return 0;
+}
+
+/** The commit thread has synced a record
+ *
+ */
+static unlang_action_t detail_binary_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx,
+					    request_t *request)
+{
+	detail_record_t	*rec = talloc_get_type_abort(mctx->rctx, detail_record_t);
+	int		rcode = rec->rcode;
+
+	if (rcode < 0) REDEBUG("Failed writing entry to %s", rec->filename);
+	talloc_free(rec);
+
+	if (rcode < 0) RETURN_MODULE_FAIL;
+
+	RETURN_MODULE_OK;
+}
+
+/** The request went away before it was resumed
+ *
+ * If the commit thread still owns the record, it's freed when it's
+ * written back to us.  Otherwise it's ours, and is freed here.
+ */
+static void detail_binary_signal(module_ctx_t const *mctx, UNUSED request_t *request, fr_state_signal_t action)
+{
+	detail_record_t	*rec = talloc_get_type_abort(mctx->rctx, detail_record_t);
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	if (rec->returned) {
+		talloc_free(rec);
+		return;
+	}
+
+	rec->cancelled = true;
+}
+
+/** Write a binary detail entry
+ *
+ * The entry is encoded here, and then written by the commit thread.
+ * If sync is enabled, the request yields until the commit thread has
+ * synced the entry.
+ * The "header" configuration item isn't used, the time the packet
+ * was received is part of the fixed record header.
+ *
+ * @param[out] p_result	Result of writing the entry.
+ * @param[in] mctx	Module calling ctx.
+ * @param[in] request	The current request.
+ * @param[in] packet	associated with the request (request, reply...).
+ * @param[in] list	of attributes to write.
+ * @param[in] compat	Write out entry in compatibility mode.
+ * @param[in] filename	expanded filename to write the entry to.
+ */
+static unlang_action_t detail_binary_do(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request,
+					fr_radius_packet_t *packet, fr_pair_list_t *list,
+					bool compat, char const *filename)
+{
+	rlm_detail_t const	*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_detail_t);
+	rlm_detail_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_detail_thread_t);
+	detail_record_t		*rec;
+	fr_dbuff_t		dbuff;
+	fr_dbuff_uctx_talloc_t	tctx;
+	fr_detail_binary_hdr_t	hdr;
+
+	if (fr_pair_list_empty(list)) {
+		RWDEBUG("Skipping empty packet");
+		RETURN_MODULE_OK;
+	}
+
+	/*
+	 *	Not parented by the request.  The commit thread, or
+	 *	our completion pipe, may free it long after the
+	 *	request is gone.
+	 */
+	MEM(rec = talloc_zero(NULL, detail_record_t));
+	MEM(rec->filename = talloc_strdup(rec, filename));
+
+	MEM(fr_dbuff_init_talloc(rec, &dbuff, &tctx, 1024, DETAIL_BINARY_MAX));
+
+	/*
+	 *	Leave room for the header, it's written once we know
+	 *	the length of the record.
+	 */
+	fr_dbuff_advance(&dbuff, FR_DETAIL_BINARY_HDR_LEN);
+
+	if (inst->log_srcdst) {
+		fr_pair_list_t	srcdst;
+		int		ret;
+
+		fr_pair_list_init(&srcdst);
+		detail_binary_srcdst(rec, &srcdst, packet);
+		ret = detail_binary_encode(&dbuff, inst, &srcdst, false);
+		fr_pair_list_free(&srcdst);
+		if (ret < 0) goto error;
+	}
+
+	if (detail_binary_encode(&dbuff, inst, list, compat) < 0) {
+	error:
+		RPERROR("Failed encoding detail entry");
+		talloc_free(rec);
+		RETURN_MODULE_FAIL;
+	}
+
+	hdr = (fr_detail_binary_hdr_t) {
+		.length = fr_dbuff_used(&dbuff),
+		.code = packet->code,
+		.protocol = fr_dict_root(request->dict)->attr,
+		.timestamp = fr_time_to_unix_time(request->packet->timestamp)
+	};
+	rec->data = fr_dbuff_start(&dbuff);
+	rec->data_len = hdr.length;
+
+	if (fr_detail_binary_hdr_encode(&FR_DBUFF_TMP(rec->data, FR_DETAIL_BINARY_HDR_LEN), &hdr) < 0) goto error;
+
+	/*
+	 *	The pipe is only created when sync is enabled.  Other
+	 *	workers writing at the same time share the same sync.
+	 */
+	if (t->pipe[0] < 0) {
+		detail_writer_submit(inst->writer, rec);
+		RETURN_MODULE_OK;
+	}
+
+	rec->thread = t;
+	rec->request = request;
+	detail_writer_submit(inst->writer, rec);
+
+	return unlang_module_yield(request, detail_binary_resume, detail_binary_signal, rec);
+}
+
 /*
  *	Do detail, compatible with old accounting
  */
@@ -384,6 +1064,10 @@ static unlang_action_t CC_HINT(nonnull) detail_do(rlm_rcode_t *p_result, module_
 
 	RDEBUG2("%s expands to %s", inst->filename, buffer);
 
+	if (inst->format == DETAIL_FORMAT_BINARY) {
+		return detail_binary_do(p_result, mctx, request, packet, list, compat, buffer);
+	}
+
 	outfd = exfile_open(inst->ef, buffer, inst->perm);
 	if (outfd < 0) {
 		RPERROR("Couldn't open file %s", buffer);
@@ -466,11 +1150,16 @@ static unlang_action_t CC_HINT(nonnull) mod_post_auth(rlm_rcode_t *p_result, mod
 /* globally exported name */
 extern module_t rlm_detail;
 module_t rlm_detail = {
-	.magic		= RLM_MODULE_INIT,
-	.name		= "detail",
-	.inst_size	= sizeof(rlm_detail_t),
-	.config		= module_config,
-	.instantiate	= mod_instantiate,
+	.magic			= RLM_MODULE_INIT,
+	.name			= "detail",
+	.inst_size		= sizeof(rlm_detail_t),
+	.config			= module_config,
+	.instantiate		= mod_instantiate,
+	.detach			= mod_detach,
+	.thread_inst_size	= sizeof(rlm_detail_thread_t),
+	.thread_inst_type	= "rlm_detail_thread_t",
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
 	.methods = {
 		[MOD_AUTHORIZE]		= mod_authorize,
 		[MOD_PREACCT]		= mod_accounting,
@@ -25,43 +25,63 @@
 RCSID("$Id$")
 
 #include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/file_reload.h>
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/server/pairmove.h>
 #include <freeradius-devel/server/users_file.h>
 #include <freeradius-devel/util/htrie.h>
+#include <freeradius-devel/util/rcu.h>
 
 #include <ctype.h>
 #include <fcntl.h>
 
+/** Everything read from the users files
+ *
+ * This is replaced as a whole when the files are reloaded.
+ */
 typedef struct {
-	tmpl_t *key;
-	fr_type_t	key_data_type;
-
-	char const *filename;
 	fr_htrie_t *common;
 	PAIR_LIST_LIST *common_def;
 
 	/* autz */
-	char const *usersfile;
 	fr_htrie_t *users;
 	PAIR_LIST_LIST *users_def;
 
 	/* authenticate */
-	char const *auth_usersfile;
 	fr_htrie_t *auth_users;
 	PAIR_LIST_LIST *auth_users_def;
 
 	/* preacct */
-	char const *acct_usersfile;
 	fr_htrie_t *acct_users;
 	PAIR_LIST_LIST *acct_users_def;
 
 	/* post-authenticate */
-	char const *postauth_usersfile;
 	fr_htrie_t *postauth_users;
 	PAIR_LIST_LIST *postauth_users_def;
+
+	int64_t		entries;		//!< Total number of entries in all of the files.
+} rlm_files_data_t;
+
+typedef struct {
+	tmpl_t *key;
+	fr_type_t	key_data_type;
+
+	char const *filename;
+	char const *usersfile;
+	char const *auth_usersfile;
+	char const *acct_usersfile;
+	char const *postauth_usersfile;
+
+	fr_time_delta_t	reload_interval;	//!< How often to check the files for changes.
+
+	fr_rcu_t	*data;			//!< rlm_files_data_t, read by the workers.
+	file_reload_t	*reload;		//!< Re-reads the files when they change.
 } rlm_files_t;
 
+typedef struct {
+	fr_rcu_reader_t	*reader;		//!< For this thread to read inst->data.
+} rlm_files_thread_t;
+
 static fr_dict_t const *dict_freeradius;
 static fr_dict_t const *dict_radius;
 
@@ -91,6 +111,7 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("auth_usersfile", FR_TYPE_FILE_INPUT, rlm_files_t, auth_usersfile) },
 	{ FR_CONF_OFFSET("postauth_usersfile", FR_TYPE_FILE_INPUT, rlm_files_t, postauth_usersfile) },
 	{ FR_CONF_OFFSET("key", FR_TYPE_TMPL | FR_TYPE_NOT_EMPTY, rlm_files_t, key), .dflt = "%{%{Stripped-User-Name}:-%{User-Name}}", .quote = T_DOUBLE_QUOTED_STRING },
+	{ FR_CONF_OFFSET("reload_interval", FR_TYPE_TIME_DELTA, rlm_files_t, reload_interval), .dflt = "0" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -113,7 +134,8 @@ static int pairlist_to_key(uint8_t **out, size_t *outlen, void const *a)
 	return fr_value_box_to_key(out, outlen, ((PAIR_LIST_LIST const *)a)->box);
 }
 
-static int getusersfile(TALLOC_CTX *ctx, char const *filename, fr_htrie_t **ptree, PAIR_LIST_LIST **pdefault, fr_type_t data_type)
+static int getusersfile(TALLOC_CTX *ctx, char const *filename, fr_htrie_t **ptree, PAIR_LIST_LIST **pdefault,
+			fr_type_t data_type, int64_t *entries)
 {
 	int rcode;
 	PAIR_LIST_LIST users;
@@ -253,6 +275,7 @@ static int getusersfile(TALLOC_CTX *ctx, char const *filename, fr_htrie_t **ptre
 		 */
 		next = fr_dlist_next(&users.head, entry);
 		fr_dlist_remove(&users.head, entry);
+		(*entries)++;
 
 		/*
 		 *	@todo - loop over entry->reply, calling
@@ -347,12 +370,56 @@ static int getusersfile(TALLOC_CTX *ctx, char const *filename, fr_htrie_t **ptre
 
 
 
+/*
+ *	Read all of the "users" files into memory.
+ *
+ *	The result isn't parented by the instance, as it may be
+ *	built in the reload thread, and freed by whichever thread
+ *	publishes its replacement.
+ */
+static rlm_files_data_t *files_data_load(rlm_files_t const *inst)
+{
+	rlm_files_data_t *data;
+
+	MEM(data = talloc_zero(NULL, rlm_files_data_t));
+
+#undef READFILE
+#define READFILE(_x, _y, _d) do { if (getusersfile(data, inst->_x, &data->_y, &data->_d, inst->key_data_type, &data->entries) != 0) { ERROR("Failed reading %s", inst->_x); talloc_free(data); return NULL;} } while (0)
+
+	READFILE(filename, common, common_def);
+	READFILE(usersfile, users, users_def);
+	READFILE(acct_usersfile, acct_users, acct_users_def);
+	READFILE(auth_usersfile, auth_users, auth_users_def);
+	READFILE(postauth_usersfile, postauth_users, postauth_users_def);
+
+	return data;
+}
+
+/*
+ *	Called from the reload thread when any of the files change.
+ */
+static int64_t files_reload(void *uctx)
+{
+	rlm_files_t		*inst = talloc_get_type_abort(uctx, rlm_files_t);
+	rlm_files_data_t	*data;
+	int64_t			entries;
+
+	data = files_data_load(inst);
+	if (!data) return -1;
+
+	entries = data->entries;
+	fr_rcu_publish(inst->data, data);
+
+	return entries;
+}
+
 /*
  *	(Re-)read the "users" file into memory.
  */
 static int mod_instantiate(module_inst_ctx_t const *mctx)
 {
-	rlm_files_t *inst = talloc_get_type_abort(mctx->inst->data, rlm_files_t);
+	rlm_files_t		*inst = talloc_get_type_abort(mctx->inst->data, rlm_files_t);
+	rlm_files_data_t	*data;
 
 	inst->key_data_type = tmpl_expanded_type(inst->key);
 	if (fr_htrie_hint(inst->key_data_type) == FR_HTRIE_INVALID) {
@@ -361,14 +428,55 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		return -1;
 	}
 
-#undef READFILE
-#define READFILE(_x, _y, _d) do { if (getusersfile(inst, inst->_x, &inst->_y, &inst->_d, inst->key_data_type) != 0) { ERROR("Failed reading %s", inst->_x); return -1;} } while (0)
+	data = files_data_load(inst);
+	if (!data) return -1;
 
-	READFILE(filename, common, common_def);
-	READFILE(usersfile, users, users_def);
-	READFILE(acct_usersfile, acct_users, acct_users_def);
-	READFILE(auth_usersfile, auth_users, auth_users_def);
-	READFILE(postauth_usersfile, postauth_users, postauth_users_def);
+	MEM(inst->data = fr_rcu_alloc(inst, data));
+
+	if (fr_time_delta_ispos(inst->reload_interval)) {
+		char const **filenames;
+
+		FR_TIME_DELTA_BOUND_CHECK("reload_interval", inst->reload_interval, >=, fr_time_delta_from_sec(1));
+
+		MEM(filenames = talloc_array(inst, char const *, 5));
+		filenames[0] = inst->filename;
+		filenames[1] = inst->usersfile;
+		filenames[2] = inst->acct_usersfile;
+		filenames[3] = inst->auth_usersfile;
+		filenames[4] = inst->postauth_usersfile;
+
+		inst->reload = file_reload_alloc(inst, mctx->inst->name, filenames, inst->reload_interval,
+						 files_reload, inst);
+		talloc_free(filenames);
+		if (!inst->reload) {
+			cf_log_perr(mctx->inst->conf, "Failed starting reload thread");
+			return -1;
+		}
+		file_reload_entries_set(inst->reload, data->entries);
+	}
+
+	return 0;
+}
+
+static int mod_detach(module_detach_ctx_t const *mctx)
+{
+	rlm_files_t *inst = talloc_get_type_abort(mctx->inst->data, rlm_files_t);
+
+	/*
+	 *	Stop the reload thread before the data it publishes
+	 *	to goes away.
+	 */
+	TALLOC_FREE(inst->reload);
+
+	return 0;
+}
+
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_files_t		*inst = talloc_get_type_abort(mctx->inst->data, rlm_files_t);
+	rlm_files_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_files_thread_t);
+
+	MEM(t->reader = fr_rcu_reader_alloc(t, inst->data));
 
 	return 0;
 }
@@ -628,11 +736,18 @@ redo:
  */
 static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
-	rlm_files_t const *inst = talloc_get_type_abort_const(mctx->inst->data, rlm_files_t);
-
-	return file_common(p_result, inst, request, inst->filename,
-			   inst->users ? inst->users : inst->common,
-			   inst->users ? inst->users_def : inst->common_def);
+	rlm_files_t const	*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_files_t);
+	rlm_files_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_files_thread_t);
+	rlm_files_data_t const	*data;
+	unlang_action_t		ret;
+
+	data = fr_rcu_read_lock(t->reader);
+	ret = file_common(p_result, inst, request, inst->filename,
+			  data->users ? data->users : data->common,
+			  data->users ? data->users_def : data->common_def);
+	fr_rcu_read_unlock(t->reader);
+
+	return ret;
 }
 
 
@@ -643,29 +758,50 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
  */
 static unlang_action_t CC_HINT(nonnull) mod_preacct(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
-	rlm_files_t const *inst = talloc_get_type_abort_const(mctx->inst->data, rlm_files_t);
-
-	return file_common(p_result, inst, request, inst->acct_usersfile,
-			   inst->acct_users ? inst->acct_users : inst->common,
-			   inst->acct_users ? inst->acct_users_def : inst->common_def);
+	rlm_files_t const	*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_files_t);
+	rlm_files_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_files_thread_t);
+	rlm_files_data_t const	*data;
+	unlang_action_t		ret;
+
+	data = fr_rcu_read_lock(t->reader);
+	ret = file_common(p_result, inst, request, inst->acct_usersfile,
+			  data->acct_users ? data->acct_users : data->common,
+			  data->acct_users ? data->acct_users_def : data->common_def);
+	fr_rcu_read_unlock(t->reader);
+
+	return ret;
 }
 
 static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
-	rlm_files_t const *inst = talloc_get_type_abort_const(mctx->inst->data, rlm_files_t);
-
-	return file_common(p_result, inst, request, inst->auth_usersfile,
-			   inst->auth_users ? inst->auth_users : inst->common,
-			   inst->auth_users ? inst->auth_users_def : inst->common_def);
+	rlm_files_t const	*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_files_t);
+	rlm_files_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_files_thread_t);
+	rlm_files_data_t const	*data;
+	unlang_action_t		ret;
+
+	data = fr_rcu_read_lock(t->reader);
+	ret = file_common(p_result, inst, request, inst->auth_usersfile,
+			  data->auth_users ? data->auth_users : data->common,
+			  data->auth_users ? data->auth_users_def : data->common_def);
+	fr_rcu_read_unlock(t->reader);
+
+	return ret;
 }
 
 static unlang_action_t CC_HINT(nonnull) mod_post_auth(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
-	rlm_files_t const *inst = talloc_get_type_abort_const(mctx->inst->data, rlm_files_t);
-
-	return file_common(p_result, inst, request, inst->postauth_usersfile,
-			   inst->postauth_users ? inst->postauth_users : inst->common,
-			   inst->postauth_users ? inst->postauth_users_def : inst->common_def);
+	rlm_files_t const	*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_files_t);
+	rlm_files_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_files_thread_t);
+	rlm_files_data_t const	*data;
+	unlang_action_t		ret;
+
+	data = fr_rcu_read_lock(t->reader);
+	ret = file_common(p_result, inst, request, inst->postauth_usersfile,
+			  data->postauth_users ? data->postauth_users : data->common,
+			  data->postauth_users ? data->postauth_users_def : data->common_def);
+	fr_rcu_read_unlock(t->reader);
+
+	return ret;
 }
 
 
@@ -677,6 +813,10 @@ module_t rlm_files = {
 	.inst_size	= sizeof(rlm_files_t),
 	.config		= module_config,
 	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
+	.thread_inst_size	= sizeof(rlm_files_thread_t),
+	.thread_inst_type	= "rlm_files_thread_t",
+	.thread_instantiate	= mod_thread_instantiate,
 	.methods = {
 		[MOD_AUTHENTICATE]	= mod_authenticate,
 		[MOD_AUTHORIZE]		= mod_authorize,
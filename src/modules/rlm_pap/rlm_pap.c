@@ -31,6 +31,7 @@ USES_APPLE_DEPRECATED_API
 #include <freeradius-devel/server/password.h>
 #include <freeradius-devel/tls/base.h>
 #include <freeradius-devel/tls/log.h>
+#include <freeradius-devel/unlang/offload.h>
 
 #include <freeradius-devel/util/base64.h>
 #include <freeradius-devel/util/debug.h>
@@ -48,6 +49,7 @@ USES_APPLE_DEPRECATED_API
 #include <unistd.h>	/* Contains crypt function declarations */
 
 #ifdef HAVE_OPENSSL_EVP_H
+#  include <openssl/err.h>
 #  include <openssl/evp.h>
 #endif
 
@@ -74,6 +76,59 @@ typedef struct {
 
 typedef unlang_action_t (*pap_auth_func_t)(rlm_rcode_t *p_result, rlm_pap_t const *inst, request_t *request, fr_pair_t const *, fr_pair_t const *);
 
+/** Inputs and outputs for password hashes which are slow enough to offload
+ *
+ * Everything the hash needs is copied out of the request, as it may
+ * be calculated in an offload thread.
+ */
+typedef struct pap_offload_s pap_offload_t;
+
+/** Parse the "known good" password, and fill in the inputs for the hash
+ *
+ * Runs in the worker.
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 if the "known good" password is invalid.
+ */
+typedef int (*pap_offload_prepare_t)(pap_offload_t *off, request_t *request, fr_pair_t const *known_good);
+
+/** Check the result of the hash, and log any mismatch
+ *
+ * Runs in the worker.
+ */
+typedef rlm_rcode_t (*pap_offload_check_t)(pap_offload_t *off, request_t *request);
+
+struct pap_offload_s {
+	pap_offload_check_t	check;			//!< To call when the hash has been calculated.
+
+	char			*password;		//!< Copy of the User-Password.
+	size_t			password_len;
+
+#ifdef HAVE_CRYPT
+	char			*setting;		//!< Copy of the Crypt-Password.
+#endif
+
+#ifdef HAVE_OPENSSL_EVP_H
+	EVP_MD const		*evp_md;		//!< PBKDF2 digest.
+	size_t			digest_len;
+	uint32_t		iterations;
+	uint8_t			*salt;
+	size_t			salt_len;
+	uint8_t			hash[EVP_MAX_MD_SIZE];	//!< "known good" PBKDF2 hash.
+	uint8_t			digest[EVP_MAX_MD_SIZE];//!< Calculated PBKDF2 hash.
+#endif
+
+	bool			failed;			//!< The hash couldn't be calculated.
+	bool			match;			//!< The password matched.
+};
+
+typedef struct {
+	pap_offload_prepare_t	prepare;		//!< Called in the worker before hashing.
+	unlang_offload_func_t	hash;			//!< Called in an offload thread, or the worker.
+	pap_offload_check_t	check;			//!< Called in the worker after hashing.
+} pap_offload_func_t;
+
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("normalise", FR_TYPE_BOOL, rlm_pap_t, normify), .dflt = "yes" },
 	CONF_PARSER_TERMINATOR
@@ -180,43 +235,48 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_clear(rlm_rcode_t *p_result,
 }
 
 #ifdef HAVE_CRYPT
-static unlang_action_t CC_HINT(nonnull) pap_auth_crypt(rlm_rcode_t *p_result,
-						       UNUSED rlm_pap_t const *inst, request_t *request,
-						       fr_pair_t const *known_good, fr_pair_t const *password)
+static int pap_crypt_prepare(pap_offload_t *off, UNUSED request_t *request, fr_pair_t const *known_good)
+{
+	MEM(off->setting = talloc_bstrndup(off, known_good->vp_strvalue, known_good->vp_length));
+
+	return 0;
+}
+
+static void pap_crypt_hash(void *rctx)
 {
-	char	*crypt_out;
-	int	cmp = 0;
+	pap_offload_t	*off = rctx;
+	char		*crypt_out;
 
 #ifdef HAVE_CRYPT_R
 	struct crypt_data crypt_data = { .initialized = 0 };
 
-	crypt_out = crypt_r(password->vp_strvalue, known_good->vp_strvalue, &crypt_data);
-	if (crypt_out) cmp = strcmp(known_good->vp_strvalue, crypt_out);
+	crypt_out = crypt_r(off->password, off->setting, &crypt_data);
+	if (crypt_out) off->match = (strcmp(off->setting, crypt_out) == 0);
 #else
 	/*
 	 *	Ensure we're thread-safe, as crypt() isn't.
 	 */
 	pthread_mutex_lock(&fr_crypt_mutex);
-	crypt_out = crypt(password->vp_strvalue, known_good->vp_strvalue);
+	crypt_out = crypt(off->password, off->setting);
 
 	/*
 	 *	Got something, check it within the lock.  This is
 	 *	faster than copying it to a local buffer, and the
 	 *	time spent within the lock is critical.
 	 */
-	if (crypt_out) cmp = strcmp(known_good->vp_strvalue, crypt_out);
+	if (crypt_out) off->match = (strcmp(off->setting, crypt_out) == 0);
 	pthread_mutex_unlock(&fr_crypt_mutex);
 #endif
+}
 
-	/*
-	 *	Error.
-	 */
-	if (!crypt_out || (cmp != 0)) {
+static rlm_rcode_t pap_crypt_check(pap_offload_t *off, request_t *request)
+{
+	if (!off->match) {
 		REDEBUG("Crypt digest does not match \"known good\" digest");
-		RETURN_MODULE_REJECT;
+		return RLM_MODULE_REJECT;
 	}
 
-	RETURN_MODULE_OK;
+	return RLM_MODULE_OK;
 }
 #endif
 
@@ -432,7 +492,7 @@ PAP_AUTH_EVP_MD(pap_auth_evp_md_salted, pap_auth_ssha3_512, "SSHA3-512", EVP_sha
 
 /** Validates Crypt::PBKDF2 LDAP format strings
  *
- * @param[out] p_result		The result of comparing the pbkdf2 hash with the password.
+ * @param[out] off		Where to write the digest, iterations, salt and hash.
  * @param[in] request		The current request.
  * @param[in] str		Raw PBKDF2 string.
  * @param[in] len		Length of string.
@@ -442,19 +502,16 @@ PAP_AUTH_EVP_MD(pap_auth_evp_md_salted, pap_auth_ssha3_512, "SSHA3-512", EVP_sha
  * @param[in] iter_sep		Separation character between the iterations and the next component.
  * @param[in] salt_sep		Separation character between the salt and the next component.
  * @param[in] iter_is_base64	Whether the iterations is are encoded as base64.
- * @param[in] password		to validate.
  * @return
- *	- RLM_MODULE_REJECT
- *	- RLM_MODULE_OK
+ *	- 0 on success.
+ *	- -1 if the PBKDF2 string is invalid.
  */
-static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse(rlm_rcode_t *p_result,
-								     request_t *request, const uint8_t *str, size_t len,
-								     fr_table_num_sorted_t const hash_names[], size_t hash_names_len,
-								     char scheme_sep, char iter_sep, char salt_sep,
-								     bool iter_is_base64, fr_pair_t const *password)
+static inline CC_HINT(nonnull) int pap_pbkdf2_parse(pap_offload_t *off,
+						    request_t *request, const uint8_t *str, size_t len,
+						    fr_table_num_sorted_t const hash_names[], size_t hash_names_len,
+						    char scheme_sep, char iter_sep, char salt_sep,
+						    bool iter_is_base64)
 {
-	rlm_rcode_t		rcode = RLM_MODULE_INVALID;
-
 	uint8_t const		*p, *q, *end;
 	ssize_t			slen;
 
@@ -464,16 +521,11 @@ static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse(rlm_rcode_t
 
 	uint32_t		iterations = 1;
 
-	uint8_t			*salt = NULL;
-	size_t			salt_len;
-	uint8_t			hash[EVP_MAX_MD_SIZE];
-	uint8_t			digest[EVP_MAX_MD_SIZE];
-
 	RDEBUG2("Comparing with \"known-good\" PBKDF2-Password");
 
 	if (len <= 1) {
 		REDEBUG("PBKDF2-Password is too short");
-		goto finish;
+		return -1;
 	}
 
 	/*
@@ -485,7 +537,7 @@ static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse(rlm_rcode_t
 	q = memchr(p, scheme_sep, end - p);
 	if (!q) {
 		REDEBUG("PBKDF2-Password has no component separators");
-		goto finish;
+		return -1;
 	}
 
 	digest_type = fr_table_value_by_substr(hash_names, (char const *)p, q - p, -1);
@@ -539,19 +591,19 @@ static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse(rlm_rcode_t
 
 	default:
 		REDEBUG("Unknown PBKDF2 hash method \"%.*s\"", (int)(q - p), p);
-		goto finish;
+		return -1;
 	}
 
 	p = q + 1;
 
 	if (((end - p) < 1) || !(q = memchr(p, iter_sep, end - p))) {
 		REDEBUG("PBKDF2-Password missing iterations component");
-		goto finish;
+		return -1;
 	}
 
 	if ((q - p) == 0) {
 		REDEBUG("PBKDF2-Password iterations component too short");
-		goto finish;
+		return -1;
 	}
 
 	/*
@@ -568,7 +620,7 @@ static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse(rlm_rcode_t
 			REMARKER(iterations_buff, qq - iterations_buff,
 				 "PBKDF2-Password iterations field contains an invalid character");
 
-			goto finish;
+			return -1;
 		}
 		p = q + 1;
 	/*
@@ -580,7 +632,7 @@ static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse(rlm_rcode_t
 					&FR_SBUFF_IN((char const *)p, (char const *)q), false, false);
 		if (slen <= 0) {
 			RPEDEBUG("Failed decoding PBKDF2-Password iterations component (%.*s)", (int)(q - p), p);
-			goto finish;
+			return -1;
 		}
 		if (slen != sizeof(iterations)) {
 			REDEBUG("Decoded PBKDF2-Password iterations component is wrong size");
@@ -598,88 +650,64 @@ static inline CC_HINT(nonnull) unlang_action_t pap_auth_pbkdf2_parse(rlm_rcode_t
 
 	if (((end - p) < 1) || !(q = memchr(p, salt_sep, end - p))) {
 		REDEBUG("PBKDF2-Password missing salt component");
-		goto finish;
+		return -1;
 	}
 
 	if ((q - p) == 0) {
 		REDEBUG("PBKDF2-Password salt component too short");
-		goto finish;
+		return -1;
 	}
 
-	MEM(salt = talloc_array(request, uint8_t, FR_BASE64_DEC_LENGTH(q - p)));
-	slen = fr_base64_decode(&FR_DBUFF_TMP(salt, talloc_array_length(salt)),
+	MEM(off->salt = talloc_array(off, uint8_t, FR_BASE64_DEC_LENGTH(q - p)));
+	slen = fr_base64_decode(&FR_DBUFF_TMP(off->salt, talloc_array_length(off->salt)),
 				&FR_SBUFF_IN((char const *) p, (char const *)q), false, false);
 	if (slen <= 0) {
 		RPEDEBUG("Failed decoding PBKDF2-Password salt component");
-		goto finish;
+		return -1;
 	}
-	salt_len = (size_t)slen;
+	off->salt_len = (size_t)slen;
 
 	p = q + 1;
 
 	if ((q - p) == 0) {
 		REDEBUG("PBKDF2-Password hash component too short");
-		goto finish;
+		return -1;
 	}
 
-	slen = fr_base64_decode(&FR_DBUFF_TMP(hash, sizeof(hash)),
+	slen = fr_base64_decode(&FR_DBUFF_TMP(off->hash, sizeof(off->hash)),
 				&FR_SBUFF_IN((char const *)p, (char const *)end), false, false);
 	if (slen <= 0) {
 		RPEDEBUG("Failed decoding PBKDF2-Password hash component");
-		goto finish;
+		return -1;
 	}
 
 	if ((size_t)slen != digest_len) {
 		REDEBUG("PBKDF2-Password hash component length is incorrect for hash type, expected %zu, got %zd",
 			digest_len, slen);
 
-		RHEXDUMP2(hash, slen, "hash component");
+		RHEXDUMP2(off->hash, slen, "hash component");
 
-		goto finish;
+		return -1;
 	}
 
 	RDEBUG2("PBKDF2 %s: Iterations %u, salt length %zu, hash length %zd",
 		fr_table_str_by_value(pbkdf2_crypt_names, digest_type, "<UNKNOWN>"),
-		iterations, salt_len, slen);
+		iterations, off->salt_len, slen);
 
-	/*
-	 *	Hash and compare
-	 */
-	if (PKCS5_PBKDF2_HMAC((char const *)password->vp_octets, (int)password->vp_length,
-			      (unsigned char const *)salt, (int)salt_len,
-			      (int)iterations,
-			      evp_md,
-			      (int)digest_len, (unsigned char *)digest) == 0) {
-		fr_tls_log_error(request, "PBKDF2 digest failure");
-		goto finish;
-	}
+	off->evp_md = evp_md;
+	off->digest_len = digest_len;
+	off->iterations = iterations;
 
-	if (fr_digest_cmp(digest, hash, (size_t)digest_len) != 0) {
-		REDEBUG("PBKDF2 digest does not match \"known good\" digest");
-		REDEBUG3("Salt       : %pH", fr_box_octets(salt, salt_len));
-		REDEBUG3("Calculated : %pH", fr_box_octets(digest, digest_len));
-		REDEBUG3("Expected   : %pH", fr_box_octets(hash, slen));
-		rcode = RLM_MODULE_REJECT;
-	} else {
-		rcode = RLM_MODULE_OK;
-	}
-
-finish:
-	talloc_free(salt);
-
-	RETURN_MODULE_RCODE(rcode);
+	return 0;
 }
 
-static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(rlm_rcode_t *p_result,
-							       UNUSED rlm_pap_t const *inst,
-							       request_t *request,
-							       fr_pair_t const *known_good, fr_pair_t const *password)
+static int pap_pbkdf2_prepare(pap_offload_t *off, request_t *request, fr_pair_t const *known_good)
 {
 	uint8_t const *p = known_good->vp_octets, *q, *end = p + known_good->vp_length;
 
 	if (end - p < 2) {
 		REDEBUG("PBKDF2-Password too short");
-		RETURN_MODULE_INVALID;
+		return -1;
 	}
 
 	/*
@@ -696,9 +724,9 @@ static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(rlm_rcode_t *p_re
 			q = memchr(p, '}', end - p);
 			p = q + 1;
 		}
-		return pap_auth_pbkdf2_parse(p_result, request, p, end - p,
-					     pbkdf2_crypt_names, pbkdf2_crypt_names_len,
-					     ':', ':', ':', true, password);
+		return pap_pbkdf2_parse(off, request, p, end - p,
+					pbkdf2_crypt_names, pbkdf2_crypt_names_len,
+					':', ':', ':', true);
 	}
 
 	/*
@@ -708,9 +736,9 @@ static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(rlm_rcode_t *p_re
 	 */
 	if ((size_t)(end - p) >= sizeof("$PBKDF2$") && (memcmp(p, "$PBKDF2$", sizeof("$PBKDF2$") - 1) == 0)) {
 		p += sizeof("$PBKDF2$") - 1;
-		return pap_auth_pbkdf2_parse(p_result, request, p, end - p,
-					     pbkdf2_crypt_names, pbkdf2_crypt_names_len,
-					     ':', ':', '$', false, password);
+		return pap_pbkdf2_parse(off, request, p, end - p,
+					pbkdf2_crypt_names, pbkdf2_crypt_names_len,
+					':', ':', '$', false);
 	}
 
 	/*
@@ -722,14 +750,53 @@ static inline unlang_action_t CC_HINT(nonnull) pap_auth_pbkdf2(rlm_rcode_t *p_re
 	 */
 	if ((size_t)(end - p) >= sizeof("$pbkdf2-") && (memcmp(p, "$pbkdf2-", sizeof("$pbkdf2-") - 1) == 0)) {
 		p += sizeof("$pbkdf2-") - 1;
-		return pap_auth_pbkdf2_parse(p_result, request, p, end - p,
-					     pbkdf2_passlib_names, pbkdf2_passlib_names_len,
-					     '$', '$', '$', false, password);
+		return pap_pbkdf2_parse(off, request, p, end - p,
+					pbkdf2_passlib_names, pbkdf2_passlib_names_len,
+					'$', '$', '$', false);
 	}
 
 	REDEBUG("Can't determine format of PBKDF2-Password");
 
-	RETURN_MODULE_INVALID;
+	return -1;
+}
+
+static void pap_pbkdf2_hash(void *rctx)
+{
+	pap_offload_t *off = rctx;
+
+	if (PKCS5_PBKDF2_HMAC(off->password, (int)off->password_len,
+			      (unsigned char const *)off->salt, (int)off->salt_len,
+			      (int)off->iterations,
+			      off->evp_md,
+			      (int)off->digest_len, (unsigned char *)off->digest) == 0) {
+		/*
+		 *	The error queue belongs to whichever thread
+		 *	we're running in, which may not be the worker.
+		 */
+		ERR_clear_error();
+		off->failed = true;
+		return;
+	}
+
+	off->match = (fr_digest_cmp(off->digest, off->hash, off->digest_len) == 0);
+}
+
+static rlm_rcode_t pap_pbkdf2_check(pap_offload_t *off, request_t *request)
+{
+	if (off->failed) {
+		REDEBUG("PBKDF2 digest failure");
+		return RLM_MODULE_INVALID;
+	}
+
+	if (!off->match) {
+		REDEBUG("PBKDF2 digest does not match \"known good\" digest");
+		REDEBUG3("Salt       : %pH", fr_box_octets(off->salt, off->salt_len));
+		REDEBUG3("Calculated : %pH", fr_box_octets(off->digest, off->digest_len));
+		REDEBUG3("Expected   : %pH", fr_box_octets(off->hash, off->digest_len));
+		return RLM_MODULE_REJECT;
+	}
+
+	return RLM_MODULE_OK;
 }
 #endif
 
@@ -879,9 +946,6 @@ static const pap_auth_func_t auth_func_table[] = {
 	[FR_MD5]	= pap_auth_md5,
 	[FR_SMD5]	= pap_auth_smd5,
 
-#ifdef HAVE_CRYPT
-	[FR_CRYPT]	= pap_auth_crypt,
-#endif
 	[FR_NS_MTA_MD5] = pap_auth_ns_mta_md5,
 	[FR_NT]	= pap_auth_nt,
 	[FR_WITH_HEADER] = pap_auth_dummy,
@@ -889,7 +953,6 @@ static const pap_auth_func_t auth_func_table[] = {
 	[FR_SSHA1]	= pap_auth_ssha1,
 
 #ifdef HAVE_OPENSSL_EVP_H
-	[FR_PBKDF2]	= pap_auth_pbkdf2,
 	[FR_SHA2]	= pap_auth_dummy,
 	[FR_SHA2_224]	= pap_auth_sha2_224,
 	[FR_SHA2_256]	= pap_auth_sha2_256,
@@ -914,6 +977,76 @@ static const pap_auth_func_t auth_func_table[] = {
 #endif	/* HAVE_OPENSSL_EVP_H */
 };
 
+/** Table of password types which are slow enough to be offloaded
+ *
+ */
+static const pap_offload_func_t offload_func_table[] = {
+#ifdef HAVE_CRYPT
+	[FR_CRYPT]	= { .prepare = pap_crypt_prepare, .hash = pap_crypt_hash, .check = pap_crypt_check },
+#endif
+
+#ifdef HAVE_OPENSSL_EVP_H
+	[FR_PBKDF2]	= { .prepare = pap_pbkdf2_prepare, .hash = pap_pbkdf2_hash, .check = pap_pbkdf2_check },
+#endif
+};
+
+/** Log the result of comparing the passwords
+ *
+ */
+static unlang_action_t pap_auth_result(rlm_rcode_t *p_result, request_t *request, rlm_rcode_t rcode)
+{
+	switch (rcode) {
+	case RLM_MODULE_REJECT:
+		REDEBUG("Password incorrect");
+		break;
+
+	case RLM_MODULE_OK:
+		RDEBUG2("User authenticated successfully");
+		break;
+
+	default:
+		break;
+	}
+
+	RETURN_MODULE_RCODE(rcode);
+}
+
+static unlang_action_t mod_authenticate_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx,
+					       request_t *request)
+{
+	pap_offload_t	*off = talloc_get_type_abort(mctx->rctx, pap_offload_t);
+	rlm_rcode_t	rcode;
+
+	rcode = off->check(off, request);
+	talloc_free(off);
+
+	return pap_auth_result(p_result, request, rcode);
+}
+
+/** Hash the password in an offload thread, if there are any
+ *
+ * The "known good" password is parsed here, so it can be freed as
+ * soon as we return.
+ */
+static unlang_action_t pap_auth_offload(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request,
+					pap_offload_func_t const *func,
+					fr_pair_t const *known_good, fr_pair_t const *password)
+{
+	pap_offload_t	*off;
+
+	MEM(off = talloc_zero(request, pap_offload_t));
+	MEM(off->password = talloc_bstrndup(off, password->vp_strvalue, password->vp_length));
+	off->password_len = password->vp_length;
+	off->check = func->check;
+
+	if (func->prepare(off, request, known_good) < 0) {
+		talloc_free(off);
+		return pap_auth_result(p_result, request, RLM_MODULE_INVALID);
+	}
+
+	return unlang_module_yield_to_offload(p_result, mctx, request, func->hash, mod_authenticate_resume, off);
+}
+
 /*
  *	Authenticate the user via one of any well-known password.
  */
@@ -925,6 +1058,7 @@ static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result,
 	rlm_rcode_t		rcode = RLM_MODULE_INVALID;
 	pap_auth_func_t		auth_func;
 	bool			ephemeral;
+	unlang_action_t		ua;
 
 	password = fr_pair_find_by_da_idx(&request->request_pairs, attr_user, 0);
 	if (!password) {
@@ -962,34 +1096,35 @@ static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result,
 
 	fr_assert(known_good->da->attr < NUM_ELEMENTS(auth_func_table));
 
-	auth_func = auth_func_table[known_good->da->attr];
-	fr_assert(auth_func);
-
 	if (RDEBUG_ENABLED3) {
 		RDEBUG3("Comparing with \"known good\" %pP (%zu)", known_good, known_good->vp_length);
 	} else {
 		RDEBUG2("Comparing with \"known-good\" %s (%zu)", known_good->da->name, known_good->vp_length);
 	}
 
+	/*
+	 *	Slow hashes may be calculated by an offload thread,
+	 *	in which case mod_authenticate_resume() is called
+	 *	with the result.
+	 */
+	if ((known_good->da->attr < NUM_ELEMENTS(offload_func_table)) &&
+	    offload_func_table[known_good->da->attr].hash) {
+		ua = pap_auth_offload(p_result, mctx, request, &offload_func_table[known_good->da->attr],
+				      known_good, password);
+		if (ephemeral) TALLOC_FREE(known_good);
+		return ua;
+	}
+
+	auth_func = auth_func_table[known_good->da->attr];
+	fr_assert(auth_func);
+
 	/*
 	 *	Authenticate, and return.
 	 */
 	auth_func(&rcode, inst, request, known_good, password);
 	if (ephemeral) TALLOC_FREE(known_good);
-	switch (rcode) {
-	case RLM_MODULE_REJECT:
-		REDEBUG("Password incorrect");
-		break;
-
-	case RLM_MODULE_OK:
-		RDEBUG2("User authenticated successfully");
-		break;
 
-	default:
-		break;
-	}
-
-	RETURN_MODULE_RCODE(rcode);
+	return pap_auth_result(p_result, request, rcode);
 }
 
 static int mod_instantiate(module_inst_ctx_t const *mctx)
@@ -1005,6 +1140,16 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	return 0;
 }
 
+/** Whether we can check a password type, either directly or by offloading it
+ *
+ */
+static inline bool pap_auth_allowed(size_t attr)
+{
+	if (auth_func_table[attr]) return true;
+
+	return (attr < NUM_ELEMENTS(offload_func_table)) && offload_func_table[attr].hash;
+}
+
 static int mod_load(void)
 {
 	size_t	i, j = 0;
@@ -1027,7 +1172,7 @@ static int mod_load(void)
 	 *	Figure out how many password types we allow
 	 */
 	for (i = 0; i < NUM_ELEMENTS(auth_func_table); i++) {
-		if (auth_func_table[i] == NULL) continue;
+		if (!pap_auth_allowed(i)) continue;
 
 		allowed++;
 	}
@@ -1040,7 +1185,7 @@ static int mod_load(void)
 	for (i = 0; i < NUM_ELEMENTS(auth_func_table); i++) {
 		fr_dict_attr_t const *password_da;
 
-		if (auth_func_table[i] == NULL) continue;
+		if (!pap_auth_allowed(i)) continue;
 
 		password_da = fr_dict_attr_child_by_num(attr_root, i);
 		if (!fr_cond_assert(password_da)) {
@@ -57,6 +57,7 @@ typedef struct {
 
 	uint32_t		max_packet_size;	//!< Maximum packet size.
 	uint16_t		max_send_coalesce;	//!< Maximum number of packets to coalesce into one mmsg call.
+	uint16_t		num_sockets;		//!< Number of source ports each connection uses.
 
 	bool			recv_buff_is_set;	//!< Whether we were provided with a recv_buf
 	bool			send_buff_is_set;	//!< Whether we were provided with a send_buf
@@ -83,6 +84,8 @@ typedef struct udp_request_s udp_request_t;
 typedef struct {
 	struct iovec		out;			//!< Describes buffer to send.
 	fr_trunk_request_t	*treq;			//!< Used for signalling.
+	uint16_t		socket;			//!< Which socket the packet's ID belongs to.
+	bool			sent;			//!< Whether sendmmsg() sent it.
 } udp_coalesced_t;
 
 /** Track the handle, which is tightly correlated with the FD
@@ -92,10 +95,18 @@ typedef struct {
 	char const     		*name;			//!< From IP PORT to IP PORT.
 	char const		*module_name;		//!< the module that opened the connection
 
-	int			fd;			//!< File descriptor.
+	int			fd;			//!< File descriptor.  This is the first socket, and
+							///< is used for status checks, and write notifications.
+
+	int			*fds;			//!< All of the sockets, each with their own 256 IDs.
+							///< fds[0] is the same as fd.
+	uint16_t		num_sockets;		//!< How many sockets there are.
 
 	struct mmsghdr		*mmsgvec;		//!< Vector of inbound/outbound packets.
 	udp_coalesced_t		*coalesced;		//!< Outbound coalesced requests.
+	udp_coalesced_t		*sorted;		//!< Scratch space for grouping coalesced requests
+							///< by socket.  Only used with multiple sockets.
+	uint16_t		*socket_start;		//!< Where each socket's requests start in sorted.
 
 	size_t			send_buff_actual;	//!< What we believe the maximum SO_SNDBUF size to be.
 							///< We don't try and encode more packet data than this
@@ -177,6 +188,7 @@ static const CONF_PARSER module_config[] = {
 
 	{ FR_CONF_OFFSET("max_packet_size", FR_TYPE_UINT32, rlm_radius_udp_t, max_packet_size), .dflt = "4096" },
 	{ FR_CONF_OFFSET("max_send_coalesce", FR_TYPE_UINT16, rlm_radius_udp_t, max_send_coalesce), .dflt = "1024" },
+	{ FR_CONF_OFFSET("num_sockets", FR_TYPE_UINT16, rlm_radius_udp_t, num_sockets), .dflt = "1" },
 
 	{ FR_CONF_OFFSET("src_ipaddr", FR_TYPE_COMBO_IP_ADDR, rlm_radius_udp_t, src_ipaddr) },
 	{ FR_CONF_OFFSET("src_ipv4addr", FR_TYPE_IPV4_ADDR, rlm_radius_udp_t, src_ipaddr) },
@@ -690,10 +702,24 @@ static void conn_writable_status_check(fr_event_list_t *el, UNUSED int fd, UNUSE
  */
 static int _udp_handle_free(udp_handle_t *h)
 {
+	uint16_t i;
+
 	fr_assert(h->fd >= 0);
 
 	if (h->status_u) fr_event_timer_delete(&h->status_u->ev);
 
+	/*
+	 *	Close the extra sockets.  The first one is closed
+	 *	below.
+	 */
+	for (i = 1; i < h->num_sockets; i++) {
+		if (h->fds[i] < 0) continue;
+
+		(void) fr_event_fd_delete(h->thread->el, h->fds[i], FR_EVENT_FILTER_IO);
+		close(h->fds[i]);
+		h->fds[i] = -1;
+	}
+
 	fr_event_fd_delete(h->thread->el, h->fd, FR_EVENT_FILTER_IO);
 
 	if (shutdown(h->fd, SHUT_RDWR) < 0) {
@@ -751,7 +777,19 @@ static fr_connection_state_t conn_init(void **h_out, fr_connection_t *conn, void
 	MEM(h->buffer = talloc_array(h, uint8_t, h->max_packet_size));
 	h->buflen = h->max_packet_size;
 
-	if (!h->inst->replicate) MEM(h->tt = radius_track_alloc(h));
+	/*
+	 *	Each socket gives us another 256 IDs.
+	 */
+	h->num_sockets = h->inst->num_sockets;
+	MEM(h->fds = talloc_array(h, int, h->num_sockets));
+	for (i = 0; i < h->num_sockets; i++) h->fds[i] = -1;
+
+	if (h->num_sockets > 1) {
+		MEM(h->sorted = talloc_array(h, udp_coalesced_t, h->inst->max_send_coalesce));
+		MEM(h->socket_start = talloc_array(h, uint16_t, h->num_sockets + 1));
+	}
+
+	if (!h->inst->replicate) MEM(h->tt = radius_track_alloc(h, h->num_sockets));
 
 	/*
 	 *	Open the outgoing socket.
@@ -834,6 +872,50 @@ static fr_connection_state_t conn_init(void **h_out, fr_connection_t *conn, void
 #endif
 
 	h->fd = fd;
+	h->fds[0] = fd;
+
+	/*
+	 *	Open the extra sockets.  These use the same source
+	 *	IP, but different source ports.
+	 */
+	for (i = 1; i < h->num_sockets; i++) {
+		fr_ipaddr_t	src_ipaddr = h->src_ipaddr;
+		uint16_t	src_port = 0;
+
+		fd = fr_socket_client_udp(&src_ipaddr, &src_port, &h->inst->dst_ipaddr, h->inst->dst_port, true);
+		if (fd < 0) {
+			PERROR("%s - Failed opening socket %u of %u", h->module_name, i + 1, h->num_sockets);
+			goto fail;
+		}
+		h->fds[i] = fd;
+
+#ifdef SO_RCVBUF
+		if (h->inst->recv_buff_is_set) {
+			int opt = h->inst->recv_buff;
+
+			if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &opt, sizeof(int)) < 0) {
+				WARN("%s - Failed setting 'SO_RCVBUF': %s", h->module_name, fr_syserror(errno));
+			}
+		}
+#endif
+
+#ifdef SO_SNDBUF
+		if (h->inst->send_buff_is_set) {
+			int opt = h->inst->send_buff;
+
+			if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &opt, sizeof(int)) < 0) {
+				WARN("%s - Failed setting 'SO_SNDBUF', write performance may be sub-optimal: %s",
+				     h->module_name, fr_syserror(errno));
+			}
+		}
+#endif
+	}
+
+	if (h->num_sockets > 1) {
+		h->name = fr_asprintf(h, "proto udp local %pV port %u (+%u sockets) remote %pV port %u",
+				      fr_box_ipaddr(h->src_ipaddr), h->src_port, h->num_sockets - 1,
+				      fr_box_ipaddr(h->inst->dst_ipaddr), h->inst->dst_port);
+	}
 
 	/*
 	 *	If we're doing status checks, then we want at least
@@ -1043,6 +1125,7 @@ static void thread_conn_notify(fr_trunk_connection_t *tconn, fr_connection_t *co
 	udp_handle_t		*h = talloc_get_type_abort(conn->h, udp_handle_t);
 	fr_event_fd_cb_t	read_fn = NULL;
 	fr_event_fd_cb_t	write_fn = NULL;
+	uint16_t		i;
 
 	switch (notify_on) {
 		/*
@@ -1076,12 +1159,28 @@ static void thread_conn_notify(fr_trunk_connection_t *tconn, fr_connection_t *co
 			       write_fn,
 			       conn_error,
 			       tconn) < 0) {
+	fail:
 		PERROR("%s - Failed inserting FD event", h->module_name);
 
 		/*
 		 *	May free the connection!
 		 */
 		fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+		return;
+	}
+
+	/*
+	 *	The extra sockets are only watched for replies.  If
+	 *	one of them isn't writable, sendmmsg() will fail, and
+	 *	the requests will be re-queued.
+	 */
+	for (i = 1; i < h->num_sockets; i++) {
+		if (!read_fn) {
+			(void) fr_event_fd_delete(el, h->fds[i], FR_EVENT_FILTER_IO);
+			continue;
+		}
+
+		if (fr_event_fd_insert(h, el, h->fds[i], read_fn, NULL, conn_error, tconn) < 0) goto fail;
 	}
 }
 
@@ -1786,13 +1885,36 @@ static void status_check_retry(UNUSED fr_event_list_t *el, fr_time_t now, void *
         fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
 }
 
+/** Group the coalesced requests by socket
+ *
+ * This is a counting sort, so the requests for each socket stay in
+ * the order they were dequeued.  The mmsgvec entries point to the
+ * coalesced entries, so we only have to move the entries.
+ *
+ * @param[in] h		Handle with the coalesced requests.
+ * @param[in] queued	How many requests there are.
+ */
+static void udp_coalesced_sort(udp_handle_t *h, uint16_t queued)
+{
+	uint16_t	i;
+
+	memset(h->socket_start, 0, sizeof(h->socket_start[0]) * (h->num_sockets + 1));
+
+	for (i = 0; i < queued; i++) h->socket_start[h->coalesced[i].socket + 1]++;
+	for (i = 1; i <= h->num_sockets; i++) h->socket_start[i] += h->socket_start[i - 1];
+
+	for (i = 0; i < queued; i++) h->sorted[h->socket_start[h->coalesced[i].socket]++] = h->coalesced[i];
+
+	memcpy(h->coalesced, h->sorted, sizeof(h->coalesced[0]) * queued);
+}
+
 static void request_mux(fr_event_list_t *el,
 			fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
 {
 	udp_handle_t		*h = talloc_get_type_abort(conn->h, udp_handle_t);
 	rlm_radius_udp_t const	*inst = h->inst;
 	int			sent;
-	uint16_t		i, queued;
+	uint16_t		i, j, next, queued;
 	size_t			total_len = 0;
 
 	/*
@@ -1892,6 +2014,8 @@ static void request_mux(fr_event_list_t *el,
 		h->coalesced[queued].treq = treq;
 		h->coalesced[queued].out.iov_base = u->packet;
 		h->coalesced[queued].out.iov_len = u->packet_len;
+		h->coalesced[queued].socket = u->rr->socket;
+		h->coalesced[queued].sent = false;
 
 		/*
 		 *	Record how much data we have in total.
@@ -1920,66 +2044,96 @@ static void request_mux(fr_event_list_t *el,
 	(void)talloc_get_type_abort(h, udp_handle_t);
 
 	/*
-	 *	Send the coalesced datagrams
+	 *	Each packet has to be sent from the socket which owns
+	 *	its ID, so group the packets by socket.
 	 */
-	sent = sendmmsg(h->fd, h->mmsgvec, queued, 0);
-	if (sent < 0) {		/* Error means no messages were sent */
-		sent = 0;
+	if (h->num_sockets > 1) udp_coalesced_sort(h, queued);
 
-		/*
-		 *	Temporary conditions
-		 */
-		switch (errno) {
+	/*
+	 *	Send the coalesced datagrams, one sendmmsg call per socket.
+	 */
+	for (i = 0; i < queued; i = next) {
+		uint16_t	socket = h->coalesced[i].socket;
+
+		for (next = i + 1; (next < queued) && (h->coalesced[next].socket == socket); next++);
+
+		sent = sendmmsg(h->fds[socket], &h->mmsgvec[i], next - i, 0);
+		if (sent < 0) {		/* Error means no messages were sent */
+			sent = 0;
+
+			/*
+			 *	Temporary conditions
+			 */
+			switch (errno) {
 #if defined(EWOULDBLOCK) && (EWOULDBLOCK != EAGAIN)
-		case EWOULDBLOCK:	/* No outbound packet buffers, maybe? */
+			case EWOULDBLOCK:	/* No outbound packet buffers, maybe? */
 #endif
-		case EAGAIN:		/* No outbound packet buffers, maybe? */
-		case EINTR:		/* Interrupted by signal */
-		case ENOBUFS:		/* No outbound packet buffers, maybe? */
-		case ENOMEM:		/* malloc failure in kernel? */
-			WARN("%s - Failed sending data over connection %s: %s",
-			     h->module_name, h->name, fr_syserror(errno));
-			break;
+			case EAGAIN:		/* No outbound packet buffers, maybe? */
+			case EINTR:		/* Interrupted by signal */
+			case ENOBUFS:		/* No outbound packet buffers, maybe? */
+			case ENOMEM:		/* malloc failure in kernel? */
+				WARN("%s - Failed sending data over connection %s: %s",
+				     h->module_name, h->name, fr_syserror(errno));
+				break;
 
-		/*
-		 *	Fatal, request specific conditions
-		 *
-		 *	sendmmsg will only return an error condition if the
-		 *	first packet being sent errors.
-		 *
-		 *	When we get request specific errors, we need to fail
-		 *	the first request in the set, and move the rest of
-		 *	the packets back to the pending state.
-		 */
-		case EMSGSIZE:		/* Packet size exceeds max size allowed on socket */
-			ERROR("%s - Failed sending data over connection %s: %s",
-			      h->module_name, h->name, fr_syserror(errno));
-			fr_trunk_request_signal_fail(h->coalesced[0].treq);
-			sent = 1;
-			break;
+			/*
+			 *	Fatal, request specific conditions
+			 *
+			 *	sendmmsg will only return an error condition if the
+			 *	first packet being sent errors.
+			 *
+			 *	When we get request specific errors, we need to fail
+			 *	the first request in the set, and move the rest of
+			 *	the packets back to the pending state.
+			 */
+			case EMSGSIZE:		/* Packet size exceeds max size allowed on socket */
+				ERROR("%s - Failed sending data over connection %s: %s",
+				      h->module_name, h->name, fr_syserror(errno));
+				fr_trunk_request_signal_fail(h->coalesced[i].treq);
+				h->coalesced[i].treq = NULL;
+				break;
 
-		/*
-		 *	Will re-queue any 'sent' requests, so we don't
-		 *	have to do any cleanup.
-		 */
-		default:
-			ERROR("%s - Failed sending data over connection %s: %s",
-			      h->module_name, h->name, fr_syserror(errno));
-			fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
-			return;
+			/*
+			 *	Will re-queue any 'sent' requests, so we don't
+			 *	have to do any cleanup.
+			 */
+			default:
+				ERROR("%s - Failed sending data over connection %s: %s",
+				      h->module_name, h->name, fr_syserror(errno));
+				fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+				return;
+			}
 		}
+
+		for (j = i; j < (i + sent); j++) h->coalesced[j].sent = true;
 	}
 
 	/*
 	 *	For all messages that were actually sent by sendmmsg
 	 *	start the request timer.
 	 */
-	for (i = 0; i < sent; i++) {
+	for (i = 0; i < queued; i++) {
 		fr_trunk_request_t	*treq = h->coalesced[i].treq;
 		udp_request_t		*u;
 		request_t		*request;
 		char const		*action;
 
+		/*
+		 *	Failed, and already signalled.
+		 */
+		if (!treq) continue;
+
+		/*
+		 *	Requests that weren't sent get re-enqueued
+		 *
+		 *	The cancel logic runs as per-normal and cleans up
+		 *	the request ready for sending again...
+		 */
+		if (!h->coalesced[i].sent) {
+			fr_trunk_request_requeue(treq);
+			continue;
+		}
+
 		/*
 		 *	It's UDP so there should never be partial writes
 		 */
@@ -2038,14 +2192,6 @@ static void request_mux(fr_event_list_t *el,
 			RDEBUG("%s request.  Relying on NAS to perform more retransmissions", action);
 		}
 	}
-
-	/*
-	 *	Requests that weren't sent get re-enqueued
-	 *
-	 *	The cancel logic runs as per-normal and cleans up
-	 *	the request ready for sending again...
-	 */
-	for (i = sent; i < queued; i++) fr_trunk_request_requeue(h->coalesced[i].treq);
 }
 
 static void request_mux_replicate(UNUSED fr_event_list_t *el,
@@ -2367,11 +2513,15 @@ static void status_check_reply(fr_trunk_request_t *treq, fr_time_t now)
 
 static void request_demux(UNUSED fr_event_list_t *el, fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
 {
-	udp_handle_t		*h = talloc_get_type_abort(conn->h, udp_handle_t);;
+	udp_handle_t		*h = talloc_get_type_abort(conn->h, udp_handle_t);
+	uint16_t		socket = 0;
 
 	DEBUG3("%s - Reading data for connection %s", h->module_name, h->name);
 
-	while (true) {
+	/*
+	 *	Drain each socket in turn.
+	 */
+	while (socket < h->num_sockets) {
 		ssize_t			slen;
 
 		fr_trunk_request_t	*treq;
@@ -2391,11 +2541,17 @@ static void request_demux(UNUSED fr_event_list_t *el, fr_trunk_connection_t *tco
 		 *	saves a round through the event loop.  If we're not
 		 *	busy, a few extra system calls don't matter.
 		 */
-		slen = read(h->fd, h->buffer, h->buflen);
-		if (slen == 0) return;
+		slen = read(h->fds[socket], h->buffer, h->buflen);
+		if (slen == 0) {
+			socket++;
+			continue;
+		}
 
 		if (slen < 0) {
-			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+				socket++;
+				continue;
+			}
 
 			ERROR("%s - Failed reading response from socket: %s",
 			      h->module_name, fr_syserror(errno));
@@ -2413,7 +2569,7 @@ static void request_demux(UNUSED fr_event_list_t *el, fr_trunk_connection_t *tco
 		 *	Note that we don't care about packet codes.  All
 		 *	packet codes share the same ID space.
 		 */
-		rr = radius_track_entry_find(h->tt, h->buffer[1], NULL);
+		rr = radius_track_entry_find(h->tt, socket, h->buffer[1], NULL);
 		if (!rr) {
 			WARN("%s - Ignoring reply with ID %i that arrived too late",
 			     h->module_name, h->buffer[1]);
@@ -2877,6 +3033,23 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	 */
 	if (inst->max_send_coalesce == 0) inst->max_send_coalesce = 1;
 
+	/*
+	 *	Each socket has 256 IDs, so more sockets allow more
+	 *	packets per connection.  Replicated packets don't
+	 *	need IDs to be tracked.
+	 */
+	if (inst->replicate) inst->num_sockets = 1;
+	FR_INTEGER_BOUND_CHECK("num_sockets", inst->num_sockets, >=, 1);
+	FR_INTEGER_BOUND_CHECK("num_sockets", inst->num_sockets, <=, 256);
+
+	/*
+	 *	These limits are specific to RADIUS, and cannot be over-ridden
+	 */
+	FR_INTEGER_BOUND_CHECK("trunk.per_connection_max", parent->trunk_conf.max_req_per_conn,
+			       <=, 255 * (uint32_t) inst->num_sockets);
+	FR_INTEGER_BOUND_CHECK("trunk.per_connection_target", parent->trunk_conf.target_req_per_conn,
+			       <=, parent->trunk_conf.max_req_per_conn / 2);
+
 	/*
 	 *	Ensure that we have a destination address.
 	 */
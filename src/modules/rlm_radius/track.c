@@ -34,22 +34,35 @@ RCSID("$Id$")
 
 /** Create an radius_track_t
  *
- * @param ctx the talloc ctx
+ * Each socket has its own 256 IDs, so one table can track packets
+ * for a connection which sends from multiple source ports.  All of the
+ * IDs are in one free list, so allocation is still O(1).
+ *
+ * @param ctx		the talloc ctx
+ * @param num_sockets	how many sockets the IDs are for.
  * @return
  *	- NULL on error
  *	- radius_track_t on success
  */
-radius_track_t *radius_track_alloc(TALLOC_CTX *ctx)
+radius_track_t *radius_track_alloc(TALLOC_CTX *ctx, unsigned int num_sockets)
 {
-	int i;
+	unsigned int i, num_ids;
 	radius_track_t *tt;
 
+	fr_assert((num_sockets > 0) && (num_sockets <= (UINT16_MAX + 1)));
+
 	MEM(tt = talloc_zero(ctx, radius_track_t));
 
+	num_ids = num_sockets * (UINT8_MAX + 1);
+	tt->num_sockets = num_sockets;
+	MEM(tt->id = talloc_zero_array(tt, radius_track_entry_t, num_ids));
+	MEM(tt->subtree = talloc_zero_array(tt, fr_rb_tree_t *, num_ids));
+
 	fr_dlist_init(&tt->free_list, radius_track_entry_t, entry);
 
-	for (i = 0; i < 256; i++) {
-		tt->id[i].id = i;
+	for (i = 0; i < num_ids; i++) {
+		tt->id[i].id = i & 0xff;
+		tt->id[i].socket = i >> 8;
 #ifndef NDEBUG
 		tt->id[i].file = __FILE__;
 		tt->id[i].line = __LINE__;
@@ -57,7 +70,7 @@ radius_track_t *radius_track_alloc(TALLOC_CTX *ctx)
 		fr_dlist_insert_tail(&tt->free_list, &tt->id[i]);
 	}
 
-	tt->next_id = fr_rand() & 0xff;
+	tt->next_id = fr_rand() % num_ids;
 
 	return tt;
 }
@@ -132,7 +145,7 @@ retry:
 		 *	don't use it".  Ensure that we only return IDs
 		 *	which are in the static array.
 		 */
-		if (!tt->use_authenticator && (te != &tt->id[te->id])) {
+		if (!tt->use_authenticator && (te != &tt->id[RADIUS_TRACK_INDEX(te->socket, te->id)])) {
 			talloc_free(te);
 			goto retry;
 		}
@@ -154,7 +167,7 @@ retry:
 	 *	point.
 	 */
 	tt->next_id++;
-	tt->next_id &= 0xff;
+	if (tt->next_id >= (tt->num_sockets * (UINT8_MAX + 1))) tt->next_id = 0;
 
 	/*
 	 *	If needed, allocate a subtree.
@@ -168,7 +181,8 @@ retry:
 	 *	Allocate a new one, and insert it into the appropriate subtree.
 	 */
 	te = talloc_zero(tt, radius_track_entry_t);
-	te->id = tt->next_id;
+	te->id = tt->next_id & 0xff;
+	te->socket = tt->next_id >> 8;
 
 done:
 	te->tt = tt;
@@ -238,12 +252,14 @@ int radius_track_entry_release(
 	/*
 	 *	We're freeing a static ID, just go do that...
 	 */
-	if (te == &tt->id[te->id]) {
+	if (te == &tt->id[RADIUS_TRACK_INDEX(te->socket, te->id)]) {
 		/*
 		 *	This entry MAY be in a subtree.  If so, delete
 		 *	it.
 		 */
-		if (tt->subtree[te->id]) (void) fr_rb_delete(tt->subtree[te->id], te);
+		if (tt->subtree[RADIUS_TRACK_INDEX(te->socket, te->id)]) {
+			(void) fr_rb_delete(tt->subtree[RADIUS_TRACK_INDEX(te->socket, te->id)], te);
+		}
 
 		goto done;
 	}
@@ -256,8 +272,8 @@ int radius_track_entry_release(
 	/*
 	 *	Delete it from the tracking subtree.
 	 */
-	fr_assert(tt->subtree[te->id] != NULL);
-	(void) fr_rb_delete(tt->subtree[te->id], te);
+	fr_assert(tt->subtree[RADIUS_TRACK_INDEX(te->socket, te->id)] != NULL);
+	(void) fr_rb_delete(tt->subtree[RADIUS_TRACK_INDEX(te->socket, te->id)], te);
 
 	/*
 	 *	Try to free memory if the system gets idle.  If the
@@ -293,13 +309,16 @@ done:
 int radius_track_entry_update(radius_track_entry_t *te, uint8_t const *vector)
 {
 	radius_track_t *tt = te->tt;
+	unsigned int	index;
 
 	fr_assert(tt);
 
+	index = RADIUS_TRACK_INDEX(te->socket, te->id);
+
 	/*
 	 *	The authentication vector may have changed.
 	 */
-	if (tt->subtree[te->id]) (void) fr_rb_delete(tt->subtree[te->id], te);
+	if (tt->subtree[index]) (void) fr_rb_delete(tt->subtree[index], te);
 
 	memcpy(te->vector, vector, sizeof(te->vector));
 
@@ -310,7 +329,7 @@ int radius_track_entry_update(radius_track_entry_t *te, uint8_t const *vector)
 	 *	@todo - gracefully handle fallback if the server screws up.
 	 */
 	if (!tt->use_authenticator) {
-		fr_assert(te == &tt->id[te->id]);
+		fr_assert(te == &tt->id[index]);
 		return 0;
 	}
 
@@ -321,7 +340,7 @@ int radius_track_entry_update(radius_track_entry_t *te, uint8_t const *vector)
 	 *	array.  That way if the server responds with
 	 *	Original-Request-Authenticator, we can easily find it.
 	 */
-	if (!fr_rb_insert(tt->subtree[te->id], te)) return -1;
+	if (!fr_rb_insert(tt->subtree[index], te)) return -1;
 
 	return 0;
 }
@@ -329,23 +348,30 @@ int radius_track_entry_update(radius_track_entry_t *te, uint8_t const *vector)
 /** Find a tracking entry from a request authenticator
  *
  * @param tt		The radius_track_t tracking table
+ * @param socket	The reply was received on.
  * @param packet_id    	The ID from the RADIUS header
  * @param vector	The Request Authenticator (may be NULL)
  * @return
  *	- NULL on "not found"
  *	- radius_track_entry_t on success
  */
-radius_track_entry_t *radius_track_entry_find(radius_track_t *tt, uint8_t packet_id, uint8_t const *vector)
+radius_track_entry_t *radius_track_entry_find(radius_track_t *tt, uint16_t socket, uint8_t packet_id,
+					      uint8_t const *vector)
 {
 	radius_track_entry_t my_te, *te;
+	unsigned int	index;
 
 	(void) talloc_get_type_abort(tt, radius_track_t);
 
+	if (!fr_cond_assert(socket < tt->num_sockets)) return NULL;
+
+	index = RADIUS_TRACK_INDEX(socket, packet_id);
+
 	/*
 	 *	Just use the static array.
 	 */
 	if (!tt->use_authenticator || !vector) {
-		te = &tt->id[packet_id];
+		te = &tt->id[index];
 
 		/*
 		 *	Not in use, die.
@@ -364,7 +390,7 @@ radius_track_entry_t *radius_track_entry_find(radius_track_t *tt, uint8_t packet
 	 */
 	memcpy(&my_te.vector, vector, sizeof(my_te.vector));
 
-	te = fr_rb_find(tt->subtree[packet_id], &my_te);
+	te = tt->subtree[index] ? fr_rb_find(tt->subtree[index], &my_te) : NULL;
 
 	/*
 	 *	Not found, the packet MAY have been allocated in the
@@ -372,7 +398,7 @@ radius_track_entry_t *radius_track_entry_find(radius_track_t *tt, uint8_t packet
 	 *	Original-Request-Identifier.
 	 */
 	if (!te) {
-		te = &tt->id[packet_id];
+		te = &tt->id[index];
 
 		/*
 		 *	Not in use, die.
@@ -427,20 +453,20 @@ void radius_track_state_log(fr_log_t const *log, fr_log_type_t log_type, char co
 {
 	size_t i;
 
-	for (i = 0; i < NUM_ELEMENTS(tt->id); i++) {
+	for (i = 0; i < (tt->num_sockets * (UINT8_MAX + 1)); i++) {
 		radius_track_entry_t	*entry;
 
 		entry = &tt->id[i];
 
 		if (entry->request) {
 			fr_log(log, log_type, file, line,
-			       "[%zu] %"PRIu64 " - Allocated at %s:%u to request %p (%s), uctx %p",
-			       i, entry->operation,
+			       "[%u.%u] %"PRIu64 " - Allocated at %s:%u to request %p (%s), uctx %p",
+			       entry->socket, entry->id, entry->operation,
 			       entry->file, entry->line, entry->request, entry->request->name, entry->uctx);
 		} else {
 			fr_log(log, log_type, file, line,
-			       "[%zu] %"PRIu64 " - Freed at %s:%u",
-			       i, entry->operation, entry->file, entry->line);
+			       "[%u.%u] %"PRIu64 " - Freed at %s:%u",
+			       entry->socket, entry->id, entry->operation, entry->file, entry->line);
 		}
 
 		if (extra) extra(log, log_type, file, line, entry);
@@ -48,6 +48,7 @@ struct radius_track_entry_s {
 
 	uint8_t		code;			//!< packet code (sigh)
 	uint8_t		id;			//!< our ID
+	uint16_t	socket;			//!< which socket the ID belongs to.
 
 	union {
 		fr_dlist_t	entry;					//!< For free list.
@@ -61,24 +62,33 @@ struct radius_track_entry_s {
 #endif
 };
 
+/** Index of an ID in the tracking table
+ *
+ * Each socket has its own 256 IDs.
+ */
+#define RADIUS_TRACK_INDEX(_socket, _id) ((((unsigned int) (_socket)) << 8) | (_id))
+
 struct radius_track_s {
 	unsigned int	num_requests;  		//!< number of requests in the allocation
 
 	fr_dlist_head_t	free_list;     		//!< so we allocate by least recently used
 
 	bool		use_authenticator;	//!< whether to use the request authenticator as an ID
-	int		next_id;		//!< next ID to allocate
+	unsigned int	next_id;		//!< next ID to allocate
+
+	unsigned int	num_sockets;		//!< how many sets of 256 IDs we have.
 
-	radius_track_entry_t	id[UINT8_MAX + 1];	//!< which ID was used
+	radius_track_entry_t	*id;		//!< which ID was used, indexed by RADIUS_TRACK_INDEX().
 
-	fr_rb_tree_t	*subtree[UINT8_MAX + 1];	//!< for Original-Request-Authenticator
+	fr_rb_tree_t	**subtree;		//!< for Original-Request-Authenticator, indexed
+						///< by RADIUS_TRACK_INDEX().
 
 #ifndef NDEBUG
 	uint64_t	operation;		//!< Incremented each alloc and de-alloc
 #endif
 };
 
-radius_track_t		*radius_track_alloc(TALLOC_CTX *ctx);
+radius_track_t		*radius_track_alloc(TALLOC_CTX *ctx, unsigned int num_sockets);
 
 /*
  *	Debug functions which track allocations and frees
@@ -117,7 +127,7 @@ int			radius_track_entry_release(radius_track_entry_t **te) CC_HINT(nonnull);
 int			radius_track_entry_update(radius_track_entry_t *te,
 						  uint8_t const *vector) CC_HINT(nonnull);
 
-radius_track_entry_t	*radius_track_entry_find(radius_track_t *tt, uint8_t packet_id,
+radius_track_entry_t	*radius_track_entry_find(radius_track_t *tt, uint16_t socket, uint8_t packet_id,
 						 uint8_t const *vector) CC_HINT(nonnull(1));
 
 void			radius_track_use_authenticator(radius_track_t *te, bool flag) CC_HINT(nonnull);
@@ -84,10 +84,34 @@ static fr_table_num_sorted_t const server_warnings_table[] = {
 };
 static size_t server_warnings_table_len = NUM_ELEMENTS(server_warnings_table);
 
+/*
+ *	MariaDB's client library provides a non-blocking API,
+ *	which lets queries run on trunk connections.
+ */
+#ifdef MYSQL_WAIT_READ
+#  define HAVE_MYSQL_NONBLOCK	1
+#endif
+
+#ifdef HAVE_MYSQL_NONBLOCK
+/** Which non-blocking operation is in progress on a connection
+ *
+ */
+typedef enum {
+	MYSQL_ASYNC_NONE = 0,
+	MYSQL_ASYNC_CONNECT,			//!< mysql_real_connect_start().
+	MYSQL_ASYNC_QUERY,			//!< mysql_real_query_start().
+	MYSQL_ASYNC_STORE			//!< mysql_store_result_start().
+} rlm_sql_mysql_async_t;
+#endif
+
 typedef struct {
 	MYSQL		db;
 	MYSQL		*sock;
 	MYSQL_RES	*result;
+#ifdef HAVE_MYSQL_NONBLOCK
+	rlm_sql_mysql_async_t	async;		//!< Operation in progress.
+	int		async_status;		//!< What the operation is waiting for.
+#endif
 } rlm_sql_mysql_conn_t;
 
 typedef struct {
@@ -217,18 +241,16 @@ static int mod_load(void)
 	return 0;
 }
 
-static sql_rcode_t sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_config_t const *config, fr_time_delta_t timeout)
+/** Initialise a connection handle and set the options common to blocking and non-blocking connections
+ *
+ * @return the client flags to pass to mysql_real_connect().
+ */
+static unsigned long sql_socket_options(rlm_sql_mysql_conn_t *conn, rlm_sql_mysql_t const *inst,
+					rlm_sql_config_t const *config, fr_time_delta_t timeout)
 {
-	rlm_sql_mysql_conn_t *conn;
-	rlm_sql_mysql_t *inst = config->driver;
 	unsigned int connect_timeout = (unsigned int)fr_time_delta_to_sec(timeout);
 	unsigned long sql_flags;
 
-	MEM(conn = handle->conn = talloc_zero(handle, rlm_sql_mysql_conn_t));
-	talloc_set_destructor(conn, _sql_socket_destructor);
-
-	DEBUG("Starting connect to MySQL server");
-
 	mysql_init(&(conn->db));
 
 	/*
@@ -323,6 +345,23 @@ static sql_rcode_t sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_config_t co
 #ifdef CLIENT_MULTI_STATEMENTS
 	sql_flags |= CLIENT_MULTI_STATEMENTS;
 #endif
+
+	return sql_flags;
+}
+
+static sql_rcode_t sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_config_t const *config, fr_time_delta_t timeout)
+{
+	rlm_sql_mysql_conn_t *conn;
+	rlm_sql_mysql_t *inst = config->driver;
+	unsigned long sql_flags;
+
+	MEM(conn = handle->conn = talloc_zero(handle, rlm_sql_mysql_conn_t));
+	talloc_set_destructor(conn, _sql_socket_destructor);
+
+	DEBUG("Starting connect to MySQL server");
+
+	sql_flags = sql_socket_options(conn, inst, config, timeout);
+
 	conn->sock = mysql_real_connect(&(conn->db),
 					config->sql_server,
 					config->sql_login,
@@ -441,6 +480,181 @@ static sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t c
 	return RLM_SQL_OK;
 }
 
+#ifdef HAVE_MYSQL_NONBLOCK
+/** Map what a non-blocking call is waiting for to what rlm_sql expects
+ *
+ * Timeouts are enforced by rlm_sql, so MYSQL_WAIT_TIMEOUT is ignored.
+ */
+static inline sql_io_t sql_async_wait(rlm_sql_mysql_conn_t *conn, int status)
+{
+	conn->async_status = status;
+
+	return (status & MYSQL_WAIT_WRITE) ? SQL_IO_WANT_WRITE : SQL_IO_WANT_READ;
+}
+
+/** Advance a non-blocking connection attempt
+ *
+ */
+static sql_io_t sql_socket_connected(rlm_sql_mysql_conn_t *conn, rlm_sql_config_t const *config, MYSQL *sock, int status)
+{
+	if (status) return sql_async_wait(conn, status);
+
+	conn->async = MYSQL_ASYNC_NONE;
+	if (!sock) {
+		ERROR("Couldn't connect to MySQL server %s@%s:%s", config->sql_login,
+		      config->sql_server, config->sql_db);
+		ERROR("MySQL error: %s", mysql_error(&conn->db));
+		return SQL_IO_FAIL;
+	}
+	conn->sock = sock;
+
+	DEBUG2("Connected to database '%s' on %s, server version %s, protocol version %i",
+	       config->sql_db, mysql_get_host_info(conn->sock),
+	       mysql_get_server_info(conn->sock), mysql_get_proto_info(conn->sock));
+
+	return SQL_IO_DONE;
+}
+
+static sql_io_t sql_socket_init_async(rlm_sql_handle_t *handle, rlm_sql_config_t const *config)
+{
+	rlm_sql_mysql_conn_t	*conn;
+	rlm_sql_mysql_t		*inst = config->driver;
+	unsigned long		sql_flags;
+	MYSQL			*sock = NULL;
+	int			status;
+
+	MEM(conn = handle->conn = talloc_zero(handle, rlm_sql_mysql_conn_t));
+	talloc_set_destructor(conn, _sql_socket_destructor);
+
+	DEBUG("Starting non-blocking connect to MySQL server");
+
+	/*
+	 *	The connection API enforces the connection timeout
+	 */
+	sql_flags = sql_socket_options(conn, inst, config, fr_time_delta_wrap(0));
+	mysql_options(&(conn->db), MYSQL_OPT_NONBLOCK, 0);
+
+	conn->async = MYSQL_ASYNC_CONNECT;
+	status = mysql_real_connect_start(&sock, &(conn->db),
+					  config->sql_server,
+					  config->sql_login,
+					  config->sql_password,
+					  config->sql_db,
+					  config->sql_port,
+					  NULL,
+					  sql_flags);
+
+	return sql_socket_connected(conn, config, sock, status);
+}
+
+static sql_io_t sql_socket_init_resume(rlm_sql_handle_t *handle, rlm_sql_config_t const *config)
+{
+	rlm_sql_mysql_conn_t	*conn = handle->conn;
+	MYSQL			*sock = NULL;
+	int			status;
+
+	status = mysql_real_connect_cont(&sock, &(conn->db), conn->async_status);
+
+	return sql_socket_connected(conn, config, sock, status);
+}
+
+/** Advance a non-blocking query
+ *
+ * Any result set is stored before the query is considered done, so
+ * that the result functions and sql_finish_query() don't block.
+ * Additional result sets from multi-statement queries are still
+ * drained by sql_finish_query().
+ */
+static sql_io_t sql_query_next(sql_rcode_t *rcode, rlm_sql_mysql_conn_t *conn, int status)
+{
+	char const *info;
+
+	if (status) return sql_async_wait(conn, status);
+
+	switch (conn->async) {
+	case MYSQL_ASYNC_QUERY:
+		*rcode = sql_check_error(conn->sock, 0);
+		if (*rcode != RLM_SQL_OK) break;
+
+		/* Only returns non-null string for INSERTS */
+		info = mysql_info(conn->sock);
+		if (info) DEBUG2("%s", info);
+
+		if (mysql_field_count(conn->sock) == 0) break;
+
+		conn->async = MYSQL_ASYNC_STORE;
+		status = mysql_store_result_start(&conn->result, conn->sock);
+		return sql_query_next(rcode, conn, status);
+
+	case MYSQL_ASYNC_STORE:
+		if (!conn->result) *rcode = sql_check_error(conn->sock, 0);
+		break;
+
+	default:
+		fr_assert(0);
+		*rcode = RLM_SQL_ERROR;
+		break;
+	}
+
+	conn->async = MYSQL_ASYNC_NONE;
+
+	return SQL_IO_DONE;
+}
+
+static sql_io_t sql_query_async(sql_rcode_t *rcode, rlm_sql_handle_t *handle,
+				UNUSED rlm_sql_config_t const *config, char const *query)
+{
+	rlm_sql_mysql_conn_t	*conn = handle->conn;
+	int			err;
+	int			status;
+
+	if (!conn->sock) {
+		ERROR("Socket not connected");
+		*rcode = RLM_SQL_RECONNECT;
+		return SQL_IO_DONE;
+	}
+
+	conn->async = MYSQL_ASYNC_QUERY;
+	status = mysql_real_query_start(&err, conn->sock, query, strlen(query));
+
+	return sql_query_next(rcode, conn, status);
+}
+
+static sql_io_t sql_query_resume(sql_rcode_t *rcode, rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t const *config)
+{
+	rlm_sql_mysql_conn_t	*conn = handle->conn;
+	int			err;
+	int			status;
+
+	switch (conn->async) {
+	case MYSQL_ASYNC_QUERY:
+		status = mysql_real_query_cont(&err, conn->sock, conn->async_status);
+		break;
+
+	case MYSQL_ASYNC_STORE:
+		status = mysql_store_result_cont(&conn->result, conn->sock, conn->async_status);
+		break;
+
+	/*
+	 *	Nothing in progress, e.g. an immediate
+	 *	failure already reported by sql_query_async().
+	 */
+	default:
+		*rcode = RLM_SQL_OK;
+		return SQL_IO_DONE;
+	}
+
+	return sql_query_next(rcode, conn, status);
+}
+
+static int sql_fd(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t const *config)
+{
+	rlm_sql_mysql_conn_t *conn = handle->conn;
+
+	return mysql_get_socket(conn->sock ? conn->sock : &(conn->db));
+}
+#endif
+
 static sql_rcode_t sql_store_result(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t const *config)
 {
 	rlm_sql_mysql_conn_t *conn = handle->conn;
@@ -864,5 +1078,12 @@ rlm_sql_driver_t rlm_sql_mysql = {
 	.sql_error			= sql_error,
 	.sql_finish_query		= sql_finish_query,
 	.sql_finish_select_query	= sql_finish_query,
-	.sql_escape_func		= sql_escape_func
+	.sql_escape_func		= sql_escape_func,
+#ifdef HAVE_MYSQL_NONBLOCK
+	.sql_socket_init_async		= sql_socket_init_async,
+	.sql_socket_init_resume		= sql_socket_init_resume,
+	.sql_query_async		= sql_query_async,
+	.sql_query_resume		= sql_query_resume,
+	.sql_fd				= sql_fd
+#endif
 };
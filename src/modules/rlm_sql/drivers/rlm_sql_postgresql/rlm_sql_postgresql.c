@@ -261,6 +261,101 @@ static int CC_HINT(nonnull) sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_co
 	return 0;
 }
 
+/** Classify the result of a query once all of its results have been collected
+ *
+ */
+static sql_rcode_t sql_query_status(rlm_sql_postgresql_t *inst, rlm_sql_postgres_conn_t *conn)
+{
+	int			numfields = 0;
+	ExecStatusType		status;
+
+	/*
+	 *  As this error COULD be a connection error OR an out-of-memory
+	 *  condition return value WILL be wrong SOME of the time
+	 *  regardless! Pick your poison...
+	 */
+	if (!conn->result) {
+		ERROR("Failed getting query result: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	status = PQresultStatus(conn->result);
+	switch (status){
+	/*
+	 *  Successful completion of a command returning no data.
+	 */
+	case PGRES_COMMAND_OK:
+		/*
+		 *  Affected_rows function only returns the number of affected rows of a command
+		 *  returning no data...
+		 */
+		conn->affected_rows = affected_rows(conn->result);
+		DEBUG2("query affected rows = %i", conn->affected_rows);
+		break;
+	/*
+	 *  Successful completion of a command returning data (such as a SELECT or SHOW).
+	 */
+#ifdef HAVE_PGRES_SINGLE_TUPLE
+	case PGRES_SINGLE_TUPLE:
+#endif
+	case PGRES_TUPLES_OK:
+		conn->cur_row = 0;
+		conn->affected_rows = PQntuples(conn->result);
+		numfields = PQnfields(conn->result); /*Check row storing functions..*/
+		DEBUG2("query returned rows = %i, fields = %i", conn->affected_rows, numfields);
+		break;
+
+#ifdef HAVE_PGRES_COPY_BOTH
+	case PGRES_COPY_BOTH:
+#endif
+	case PGRES_COPY_OUT:
+	case PGRES_COPY_IN:
+		DEBUG2("Data transfer started");
+		break;
+
+	/*
+	 *  Weird.. this shouldn't happen.
+	 */
+	case PGRES_EMPTY_QUERY:
+	case PGRES_BAD_RESPONSE:	/* The server's response was not understood */
+	case PGRES_NONFATAL_ERROR:
+	case PGRES_FATAL_ERROR:
+#ifdef HAVE_PGRES_PIPELINE_SYNC
+	case PGRES_PIPELINE_SYNC:
+	case PGRES_PIPELINE_ABORTED:
+#endif
+		break;
+	}
+
+	return sql_classify_error(inst, status, conn->result);
+}
+
+/** Collect the result of a query once libpq is no longer busy
+ *
+ * PQgetResult blocks if the results of any appended queries haven't
+ * arrived yet, so this is only for the synchronous API.
+ */
+static sql_rcode_t sql_query_result(rlm_sql_postgresql_t *inst, rlm_sql_postgres_conn_t *conn)
+{
+	PGresult		*tmp_result;
+
+	/*
+	 *  Returns a PGresult pointer or possibly a null pointer.
+	 *  A non-null pointer will generally be returned except in
+	 *  out-of-memory conditions or serious errors such as inability
+	 *  to send the command to the server. If a null pointer is
+	 *  returned, it should be treated like a PGRES_FATAL_ERROR
+	 *  result.
+	 */
+	conn->result = PQgetResult(conn->db);
+
+	/* Discard results for appended queries */
+	while ((tmp_result = PQgetResult(conn->db)) != NULL)
+		PQclear(tmp_result);
+
+	return sql_query_status(inst, conn);
+}
+
 static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, rlm_sql_config_t const *config,
 					      char const *query)
 {
@@ -269,9 +364,6 @@ static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, rlm_sql_
 	fr_time_delta_t		timeout = config->query_timeout;
 	fr_time_t		start;
 	int			sockfd;
-	PGresult		*tmp_result;
-	int			numfields = 0;
-	ExecStatusType		status;
 
 	if (!conn->db) {
 		ERROR("Socket not connected");
@@ -325,84 +417,143 @@ static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, rlm_sql_
 		}
 	}
 
-	/*
-	 *  Returns a PGresult pointer or possibly a null pointer.
-	 *  A non-null pointer will generally be returned except in
-	 *  out-of-memory conditions or serious errors such as inability
-	 *  to send the command to the server. If a null pointer is
-	 *  returned, it should be treated like a PGRES_FATAL_ERROR
-	 *  result.
-	 */
-	conn->result = PQgetResult(conn->db);
+	return sql_query_result(inst, conn);
+}
 
-	/* Discard results for appended queries */
-	while ((tmp_result = PQgetResult(conn->db)) != NULL)
-		PQclear(tmp_result);
+static sql_rcode_t sql_select_query(rlm_sql_handle_t * handle, rlm_sql_config_t const *config, char const *query)
+{
+	return sql_query(handle, config, query);
+}
 
-	/*
-	 *  As this error COULD be a connection error OR an out-of-memory
-	 *  condition return value WILL be wrong SOME of the time
-	 *  regardless! Pick your poison...
-	 */
-	if (!conn->result) {
-		ERROR("Failed getting query result: %s", PQerrorMessage(conn->db));
-		return RLM_SQL_RECONNECT;
+/** Map the result of PQconnectPoll to what rlm_sql expects
+ *
+ */
+static sql_io_t sql_connect_poll(rlm_sql_postgres_conn_t *conn)
+{
+	switch (PQconnectPoll(conn->db)) {
+	case PGRES_POLLING_READING:
+		return SQL_IO_WANT_READ;
+
+	case PGRES_POLLING_WRITING:
+		return SQL_IO_WANT_WRITE;
+
+	case PGRES_POLLING_OK:
+		if (PQsetnonblocking(conn->db, 1) < 0) {
+			ERROR("Failed setting connection to non-blocking: %s", PQerrorMessage(conn->db));
+			return SQL_IO_FAIL;
+		}
+
+		DEBUG2("Connected to database '%s' on '%s' server version %i, protocol version %i, backend PID %i ",
+		       PQdb(conn->db), PQhost(conn->db), PQserverVersion(conn->db), PQprotocolVersion(conn->db),
+		       PQbackendPID(conn->db));
+		return SQL_IO_DONE;
+
+	default:
+		ERROR("Connection failed: %s", PQerrorMessage(conn->db));
+		return SQL_IO_FAIL;
+	}
+}
+
+static sql_io_t CC_HINT(nonnull) sql_socket_init_async(rlm_sql_handle_t *handle, rlm_sql_config_t const *config)
+{
+	rlm_sql_postgresql_t	*inst = config->driver;
+	rlm_sql_postgres_conn_t	*conn;
+
+	MEM(conn = handle->conn = talloc_zero(handle, rlm_sql_postgres_conn_t));
+	talloc_set_destructor(conn, _sql_socket_destructor);
+
+	DEBUG2("Connecting using parameters: %s", inst->db_string);
+	conn->db = PQconnectStart(inst->db_string);
+	if (!conn->db) {
+		ERROR("Connection failed: Out of memory");
+		return SQL_IO_FAIL;
+	}
+	if (PQstatus(conn->db) == CONNECTION_BAD) {
+		ERROR("Connection failed: %s", PQerrorMessage(conn->db));
+		return SQL_IO_FAIL;
 	}
 
-	status = PQresultStatus(conn->result);
-	switch (status){
-	/*
-	 *  Successful completion of a command returning no data.
-	 */
-	case PGRES_COMMAND_OK:
-		/*
-		 *  Affected_rows function only returns the number of affected rows of a command
-		 *  returning no data...
-		 */
-		conn->affected_rows = affected_rows(conn->result);
-		DEBUG2("query affected rows = %i", conn->affected_rows);
-		break;
 	/*
-	 *  Successful completion of a command returning data (such as a SELECT or SHOW).
+	 *	libpq says to act as if PQconnectPoll
+	 *	had last returned PGRES_POLLING_WRITING.
 	 */
-#ifdef HAVE_PGRES_SINGLE_TUPLE
-	case PGRES_SINGLE_TUPLE:
-#endif
-	case PGRES_TUPLES_OK:
-		conn->cur_row = 0;
-		conn->affected_rows = PQntuples(conn->result);
-		numfields = PQnfields(conn->result); /*Check row storing functions..*/
-		DEBUG2("query returned rows = %i, fields = %i", conn->affected_rows, numfields);
-		break;
+	return SQL_IO_WANT_WRITE;
+}
 
-#ifdef HAVE_PGRES_COPY_BOTH
-	case PGRES_COPY_BOTH:
-#endif
-	case PGRES_COPY_OUT:
-	case PGRES_COPY_IN:
-		DEBUG2("Data transfer started");
+static sql_io_t CC_HINT(nonnull) sql_socket_init_resume(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t const *config)
+{
+	return sql_connect_poll(handle->conn);
+}
+
+static sql_io_t CC_HINT(nonnull) sql_query_resume(sql_rcode_t *rcode, rlm_sql_handle_t *handle,
+						  rlm_sql_config_t const *config)
+{
+	rlm_sql_postgres_conn_t	*conn = handle->conn;
+	rlm_sql_postgresql_t	*inst = config->driver;
+
+	switch (PQflush(conn->db)) {
+	case 0:
 		break;
 
+	case 1:
+		return SQL_IO_WANT_WRITE;
+
+	default:
+		ERROR("Failed sending query: %s", PQerrorMessage(conn->db));
+		*rcode = RLM_SQL_RECONNECT;
+		return SQL_IO_DONE;
+	}
+
+	if (!PQconsumeInput(conn->db)) {
+		ERROR("Failed reading input: %s", PQerrorMessage(conn->db));
+		*rcode = RLM_SQL_RECONNECT;
+		return SQL_IO_DONE;
+	}
+
 	/*
-	 *  Weird.. this shouldn't happen.
+	 *  Keep the first result, and discard the results of any
+	 *  appended queries.  PQgetResult is only called when libpq
+	 *  has a complete result buffered, so it never blocks.  The
+	 *  query is done when it returns NULL.
 	 */
-	case PGRES_EMPTY_QUERY:
-	case PGRES_BAD_RESPONSE:	/* The server's response was not understood */
-	case PGRES_NONFATAL_ERROR:
-	case PGRES_FATAL_ERROR:
-#ifdef HAVE_PGRES_PIPELINE_SYNC
-	case PGRES_PIPELINE_SYNC:
-	case PGRES_PIPELINE_ABORTED:
-#endif
-		break;
+	while (!PQisBusy(conn->db)) {
+		PGresult *result;
+
+		result = PQgetResult(conn->db);
+		if (!result) {
+			*rcode = sql_query_status(inst, conn);
+			return SQL_IO_DONE;
+		}
+
+		if (conn->result) {
+			PQclear(result);
+			continue;
+		}
+		conn->result = result;
 	}
 
-	return sql_classify_error(inst, status, conn->result);;
+	return SQL_IO_WANT_READ;
 }
 
-static sql_rcode_t sql_select_query(rlm_sql_handle_t * handle, rlm_sql_config_t const *config, char const *query)
+static sql_io_t CC_HINT(nonnull) sql_query_async(sql_rcode_t *rcode, rlm_sql_handle_t *handle,
+						 rlm_sql_config_t const *config, char const *query)
 {
-	return sql_query(handle, config, query);
+	rlm_sql_postgres_conn_t	*conn = handle->conn;
+
+	if (!PQsendQuery(conn->db, query)) {
+		ERROR("Failed to send query: %s", PQerrorMessage(conn->db));
+		*rcode = RLM_SQL_RECONNECT;
+		return SQL_IO_DONE;
+	}
+
+	return sql_query_resume(rcode, handle, config);
+}
+
+static int sql_fd(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t const *config)
+{
+	rlm_sql_postgres_conn_t *conn = handle->conn;
+
+	return PQsocket(conn->db);
 }
 
 static sql_rcode_t sql_fields(char const **out[], rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t const *config)
@@ -684,5 +835,10 @@ rlm_sql_driver_t rlm_sql_postgresql = {
 	.sql_finish_query		= sql_free_result,
 	.sql_finish_select_query	= sql_free_result,
 	.sql_affected_rows		= sql_affected_rows,
-	.sql_escape_func		= sql_escape_func
+	.sql_escape_func		= sql_escape_func,
+	.sql_socket_init_async		= sql_socket_init_async,
+	.sql_socket_init_resume		= sql_socket_init_resume,
+	.sql_query_async		= sql_query_async,
+	.sql_query_resume		= sql_query_resume,
+	.sql_fd				= sql_fd
 };
@@ -112,6 +112,12 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_POINTER("accounting", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) acct_config },
 
 	{ FR_CONF_POINTER("post-auth", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) postauth_config },
+
+	/*
+	 *	Only used if the driver supports non-blocking queries.
+	 */
+	{ FR_CONF_OFFSET_IS_SET("trunk", FR_TYPE_SUBSECTION, rlm_sql_config_t, trunk_conf), .subcs = (void const *) fr_trunk_config },
+	{ FR_CONF_OFFSET("trunk_threads", FR_TYPE_UINT32, rlm_sql_config_t, trunk_threads), .dflt = "0" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -1206,6 +1212,37 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		return -1;
 	}
 
+	/*
+	 *	Queries are run one at a time on each
+	 *	connection, so the trunk's per-connection
+	 *	limits are fixed.
+	 */
+	if (inst->config.trunk_conf_is_set) {
+		if (!inst->driver->sql_query_async) {
+			WARN("Driver %s does not support non-blocking queries, ignoring \"trunk\" section",
+			     inst->config.sql_driver_name);
+			inst->config.trunk_conf_is_set = false;
+		} else {
+			inst->config.trunk_conf.max_req_per_conn = 1;
+			inst->config.trunk_conf.target_req_per_conn = 1;
+			inst->config.trunk_conf.always_writable = !inst->driver->sql_fd;
+		}
+	}
+
+	/*
+	 *	Run the trunks in dedicated I/O threads,
+	 *	shared by all the workers.
+	 */
+	if (inst->config.trunk_conf_is_set && inst->config.trunk_threads) {
+		FR_INTEGER_BOUND_CHECK("trunk_threads", inst->config.trunk_threads, <=, 64);
+
+		inst->shared_trunk = sql_trunk_shared_alloc(inst);
+		if (!inst->shared_trunk) {
+			cf_log_perr(conf, "Failed starting trunk I/O threads");
+			return -1;
+		}
+	}
+
 	/*
 	 *	Initialise the connection pool for this instance
 	 */
@@ -1217,6 +1254,51 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	return 0;
 }
 
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_sql_t const		*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_sql_t);
+	rlm_sql_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_sql_thread_t);
+
+	t->inst = inst;
+	t->el = mctx->el;
+
+	if (!inst->config.trunk_conf_is_set) return 0;
+
+	t->escape = sql_trunk_escape_alloc(t);
+	if (!t->escape) {
+		ERROR("Failed creating escape connection");
+		return -1;
+	}
+
+	if (inst->shared_trunk) {
+		t->shared = fr_trunk_shared_thread_alloc(t, inst->shared_trunk, t->el);
+		if (!t->shared) {
+			PERROR("Failed creating shared trunk handle");
+			return -1;
+		}
+		return 0;
+	}
+
+	t->trunk = sql_trunk_alloc(t);
+	if (!t->trunk) {
+		ERROR("Failed creating trunk");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_sql_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_sql_thread_t);
+
+	TALLOC_FREE(t->shared);
+	TALLOC_FREE(t->trunk);
+	TALLOC_FREE(t->escape);
+
+	return 0;
+}
+
 static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_rcode_t		rcode = RLM_MODULE_NOOP;
@@ -1462,6 +1544,180 @@ release:
 	RETURN_MODULE_RCODE(rcode);
 }
 
+/** State for running a redundant set of queries on a trunk
+ *
+ */
+typedef struct {
+	rlm_sql_t const			*inst;		//!< Module instance.
+	rlm_sql_thread_t		*t;		//!< Thread the queries are enqueued on.
+	sql_acct_section_t const	*section;	//!< Section the queries came from.
+	CONF_PAIR			*pair;		//!< Query we're currently running.
+	char const			*attr;		//!< Name shared by the queries in the set.
+	sql_trunk_query_t		*query;		//!< Query we're waiting on.
+	sql_escape_wait_t		escape_wait;	//!< Used to wait for the escape connection.
+} sql_redundant_ctx_t;
+
+static unlang_action_t acct_redundant_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request);
+static unlang_action_t acct_redundant_escape_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx,
+						    request_t *request);
+static void acct_redundant_signal(module_ctx_t const *mctx, request_t *request, fr_state_signal_t action);
+
+/** Process the result of one of the queries in a redundant set
+ *
+ * @return
+ *	- true if the next query in the set should be tried.
+ *	- false if we're done, in which case *p_result is set.
+ */
+static bool acct_redundant_result(rlm_rcode_t *p_result, sql_redundant_ctx_t *redundant, request_t *request)
+{
+	sql_trunk_query_t	*query = redundant->query;
+
+	switch (query->rcode) {
+	case RLM_SQL_OK:
+		RDEBUG2("%i record(s) updated", query->affected_rows);
+		if (query->affected_rows > 0) {
+			*p_result = RLM_MODULE_OK;
+			return false;
+		}
+		break;
+
+	case RLM_SQL_QUERY_INVALID:
+		*p_result = RLM_MODULE_INVALID;
+		return false;
+
+	case RLM_SQL_ALT_QUERY:
+		break;
+
+	default:
+		*p_result = RLM_MODULE_FAIL;
+		return false;
+	}
+
+	redundant->pair = cf_pair_find_next(redundant->section->cs, redundant->pair, redundant->attr);
+	if (!redundant->pair) {
+		RDEBUG2("No additional queries configured");
+		*p_result = RLM_MODULE_NOOP;
+		return false;
+	}
+
+	RDEBUG2("Trying next query...");
+
+	return true;
+}
+
+/** Expand and enqueue queries from a redundant set until one yields, or we're done
+ *
+ */
+static unlang_action_t acct_redundant_next(rlm_rcode_t *p_result, sql_redundant_ctx_t *redundant, request_t *request)
+{
+	rlm_sql_t const		*inst = redundant->inst;
+	rlm_sql_handle_t	*handle;
+	rlm_rcode_t		rcode = RLM_MODULE_FAIL;
+	char const		*value;
+	char			*expanded = NULL;
+	ssize_t			slen;
+
+	do {
+		TALLOC_FREE(redundant->query);
+
+		value = cf_pair_value(redundant->pair);
+		if (!value) {
+			RDEBUG2("Ignoring null query");
+			rcode = RLM_MODULE_NOOP;
+			goto finish;
+		}
+
+		/*
+		 *	Some drivers need a connected handle to escape
+		 *	values.  Getting one from the pool may block
+		 *	while it connects, so we use the thread's own,
+		 *	which is connected by the event loop.
+		 */
+		switch (sql_trunk_escape_handle(&handle, redundant->t, &redundant->escape_wait, request)) {
+		case 0:
+			break;
+
+		case 1:
+			return unlang_module_yield(request, acct_redundant_escape_resume, acct_redundant_signal, redundant);
+
+		default:
+			REDEBUG("No connection available for escaping values");
+			rcode = RLM_MODULE_FAIL;
+			goto finish;
+		}
+		slen = xlat_aeval(request, &expanded, request, value, inst->sql_escape_func, handle);
+		if (slen < 0) {
+			rcode = RLM_MODULE_FAIL;
+			goto finish;
+		}
+
+		if (!*expanded) {
+			RDEBUG2("Ignoring null query");
+			talloc_free(expanded);
+			rcode = RLM_MODULE_NOOP;
+			goto finish;
+		}
+
+		rlm_sql_query_log(inst, request, redundant->section, expanded);
+
+		redundant->query = sql_trunk_query_enqueue(redundant, redundant->t, request, expanded);
+		talloc_free(expanded);
+		if (!redundant->query) {
+			rcode = RLM_MODULE_FAIL;
+			goto finish;
+		}
+
+		if (!redundant->query->returned) {
+			return unlang_module_yield(request, acct_redundant_resume, acct_redundant_signal, redundant);
+		}
+	} while (acct_redundant_result(&rcode, redundant, request));
+
+finish:
+	sql_unset_user(inst, request);
+	talloc_free(redundant);
+
+	RETURN_MODULE_RCODE(rcode);
+}
+
+static unlang_action_t acct_redundant_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	sql_redundant_ctx_t	*redundant = talloc_get_type_abort(mctx->rctx, sql_redundant_ctx_t);
+	rlm_sql_t const		*inst = redundant->inst;
+	rlm_rcode_t		rcode;
+
+	if (acct_redundant_result(&rcode, redundant, request)) return acct_redundant_next(p_result, redundant, request);
+
+	sql_unset_user(inst, request);
+	talloc_free(redundant);
+
+	RETURN_MODULE_RCODE(rcode);
+}
+
+/** The escape connection has connected, or failed
+ *
+ */
+static unlang_action_t acct_redundant_escape_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx,
+						    request_t *request)
+{
+	sql_redundant_ctx_t	*redundant = talloc_get_type_abort(mctx->rctx, sql_redundant_ctx_t);
+
+	return acct_redundant_next(p_result, redundant, request);
+}
+
+static void acct_redundant_signal(module_ctx_t const *mctx, request_t *request, fr_state_signal_t action)
+{
+	sql_redundant_ctx_t	*redundant = talloc_get_type_abort(mctx->rctx, sql_redundant_ctx_t);
+	rlm_sql_t const		*inst = redundant->inst;
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	sql_trunk_escape_wait_cancel(redundant->t, &redundant->escape_wait);
+	if (redundant->query) sql_trunk_query_cancel(redundant->query);
+
+	sql_unset_user(inst, request);
+	talloc_free(redundant);
+}
+
 /*
  *	Generic function for failing between a bunch of queries.
  *
@@ -1471,8 +1727,12 @@ release:
  *	If the reference matches multiple config items, and a query fails or
  *	doesn't update any rows, the next matching config item is used.
  *
+ *	If the thread has a trunk, the queries are run on it and the request
+ *	yields until each one completes.
+ *
  */
-static unlang_action_t acct_redundant(rlm_rcode_t *p_result, rlm_sql_t const *inst, request_t *request, sql_acct_section_t const *section)
+static unlang_action_t acct_redundant(rlm_rcode_t *p_result, rlm_sql_t const *inst, rlm_sql_thread_t *t,
+				      request_t *request, sql_acct_section_t const *section)
 {
 	rlm_rcode_t		rcode = RLM_MODULE_OK;
 
@@ -1522,6 +1782,23 @@ static unlang_action_t acct_redundant(rlm_rcode_t *p_result, rlm_sql_t const *in
 
 	RDEBUG2("Using query template '%s'", attr);
 
+	if (t->trunk || t->shared) {
+		sql_redundant_ctx_t *redundant;
+
+		MEM(redundant = talloc(request, sql_redundant_ctx_t));
+		*redundant = (sql_redundant_ctx_t) {
+			.inst = inst,
+			.t = t,
+			.section = section,
+			.pair = pair,
+			.attr = attr
+		};
+
+		sql_set_user(inst, request, NULL);
+
+		return acct_redundant_next(p_result, redundant, request);
+	}
+
 	handle = fr_pool_connection_get(inst->pool, request);
 	if (!handle) {
 		rcode = RLM_MODULE_FAIL;
@@ -1635,10 +1912,11 @@ finish:
  */
 static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
-	rlm_sql_t const *inst = talloc_get_type_abort_const(mctx->inst->data, rlm_sql_t);
+	rlm_sql_t const		*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_sql_t);
+	rlm_sql_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_sql_thread_t);
 
 	if (inst->config.accounting.reference_cp) {
-		return acct_redundant(p_result, inst, request, &inst->config.accounting);
+		return acct_redundant(p_result, inst, t, request, &inst->config.accounting);
 	}
 
 	RETURN_MODULE_NOOP;
@@ -1649,10 +1927,11 @@ static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, mo
  */
 static unlang_action_t CC_HINT(nonnull) mod_post_auth(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
-	rlm_sql_t const *inst = talloc_get_type_abort_const(mctx->inst->data, rlm_sql_t);
+	rlm_sql_t const		*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_sql_t);
+	rlm_sql_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_sql_thread_t);
 
 	if (inst->config.postauth.reference_cp) {
-		return acct_redundant(p_result, inst, request, &inst->config.postauth);
+		return acct_redundant(p_result, inst, t, request, &inst->config.postauth);
 	}
 
 	RETURN_MODULE_NOOP;
@@ -1673,6 +1952,10 @@ module_t rlm_sql = {
 	.bootstrap	= mod_bootstrap,
 	.instantiate	= mod_instantiate,
 	.detach		= mod_detach,
+	.thread_inst_size	= sizeof(rlm_sql_thread_t),
+	.thread_inst_type	= "rlm_sql_thread_t",
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
 	.methods = {
 		[MOD_AUTHORIZE]		= mod_authorize,
 		[MOD_ACCOUNTING]	= mod_accounting,
@@ -29,6 +29,8 @@ RCSIDH(rlm_sql_h, "$Id$")
 
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/pool.h>
+#include <freeradius-devel/server/trunk.h>
+#include <freeradius-devel/server/trunk_shared.h>
 #include <freeradius-devel/server/modpriv.h>
 #include <freeradius-devel/server/exfile.h>
 
@@ -48,6 +50,16 @@ typedef enum {
 	RLM_SQL_NO_MORE_ROWS,		//!< No more rows available
 } sql_rcode_t;
 
+/** Result of a non-blocking driver operation
+ *
+ */
+typedef enum {
+	SQL_IO_FAIL = -1,		//!< Operation failed, the connection is unusable.
+	SQL_IO_DONE = 0,		//!< Operation complete.
+	SQL_IO_WANT_READ,		//!< Call again when the connection's fd is readable.
+	SQL_IO_WANT_WRITE		//!< Call again when the connection's fd is writable.
+} sql_io_t;
+
 typedef enum {
 	FALL_THROUGH_NO = 0,
 	FALL_THROUGH_YES,
@@ -125,6 +137,11 @@ typedef struct {
 	char const		*connect_query;			//!< Query executed after establishing
 								//!< new connection.
 
+	fr_trunk_conf_t		trunk_conf;			//!< Configuration for per-thread trunks.
+	bool			trunk_conf_is_set;		//!< Whether a "trunk" section was configured.
+	uint32_t		trunk_threads;			//!< If non-zero, the trunks are owned by this
+								///< many I/O threads, shared by all workers.
+
 	void			*driver;			//!< Where drivers should write a
 								//!< pointer to their configurations.
 
@@ -211,11 +228,38 @@ typedef struct {
 	sql_rcode_t (*sql_finish_select_query)(rlm_sql_handle_t *handle, rlm_sql_config_t const *config);
 
 	xlat_escape_legacy_t	sql_escape_func;
+
+	/** @name Non-blocking interface
+	 *
+	 * Optional.  Drivers which provide these can have their queries run on
+	 * per-thread trunks of connections, so that a worker never blocks waiting
+	 * on the database.
+	 *
+	 * Each function returns #SQL_IO_WANT_READ or #SQL_IO_WANT_WRITE if it needs
+	 * to be called again (via the _resume variant) once the fd returned by
+	 * sql_fd is ready.  sql_fd may be NULL if the driver always completes
+	 * operations immediately.
+	 *
+	 * Once a query is done its results are available through the normal
+	 * result functions, and sql_finish_query must not block.
+	 * @{
+	 */
+	sql_io_t (*sql_socket_init_async)(rlm_sql_handle_t *handle, rlm_sql_config_t const *config);
+	sql_io_t (*sql_socket_init_resume)(rlm_sql_handle_t *handle, rlm_sql_config_t const *config);
+
+	sql_io_t (*sql_query_async)(sql_rcode_t *rcode, rlm_sql_handle_t *handle, rlm_sql_config_t const *config,
+				    char const *query);
+	sql_io_t (*sql_query_resume)(sql_rcode_t *rcode, rlm_sql_handle_t *handle, rlm_sql_config_t const *config);
+
+	int (*sql_fd)(rlm_sql_handle_t *handle, rlm_sql_config_t const *config);
+	/** @} */
 } rlm_sql_driver_t;
 
 struct sql_inst {
 	rlm_sql_config_t	config; /* HACK */
 	fr_pool_t		*pool;
+	fr_trunk_shared_t	*shared_trunk;		//!< I/O threads which own the trunk connections,
+							///< if trunk_threads is set.
 
 	fr_dict_attr_t const	*sql_user;		//!< Cached pointer to SQL-User-Name
 							//!< dictionary attribute.
@@ -234,6 +278,41 @@ struct sql_inst {
 	fr_dict_attr_t const	*group_da;		//!< Group dictionary attribute.
 };
 
+/** Per-thread instance data
+ *
+ */
+typedef struct {
+	rlm_sql_t const		*inst;			//!< Module instance.
+	fr_event_list_t		*el;			//!< This thread's event list.
+	fr_trunk_t		*trunk;			//!< Trunk of connections for async queries.
+							///< NULL if the driver doesn't support them.
+	fr_trunk_shared_thread_t *shared;		//!< Used instead of trunk, if trunk_threads is set.
+	fr_connection_t		*escape;		//!< Connection whose handle is used to escape values
+							///< in queries run on the trunk.
+	fr_dlist_head_t		escape_wait;		//!< Requests waiting for the escape connection.
+} rlm_sql_thread_t;
+
+/** A request waiting for the thread's escape connection to connect
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;			//!< Entry in the thread's list of waiting requests.
+	request_t		*request;		//!< To mark runnable once the connection is up, or failed.
+} sql_escape_wait_t;
+
+/** The result of a query run on a trunk connection
+ *
+ */
+typedef struct {
+	request_t		*request;		//!< Request the query is being run for.
+	fr_trunk_request_t	*treq;			//!< Trunk request, NULL once the query has returned.
+	fr_trunk_shared_request_t *sreq;		//!< Shared trunk request, NULL once the query has returned.
+
+	sql_rcode_t		rcode;			//!< Result of the query.
+	int			affected_rows;		//!< Number of rows the query changed.
+	bool			returned;		//!< Whether the query has completed or failed.
+} sql_trunk_query_t;
+
 typedef struct rlm_sql_grouplist_s rlm_sql_grouplist_t;
 struct rlm_sql_grouplist_s {
 	char			*name;
@@ -249,6 +328,19 @@ int		rlm_sql_fetch_row(rlm_sql_row_t *out, rlm_sql_t const *inst, request_t *req
 void		rlm_sql_print_error(rlm_sql_t const *inst, request_t *request, rlm_sql_handle_t *handle, bool force_debug);
 int		sql_set_user(rlm_sql_t const *inst, request_t *request, char const *username);
 
+/*
+ *	sql_trunk.c
+ */
+fr_trunk_t	*sql_trunk_alloc(rlm_sql_thread_t *thread);
+fr_trunk_shared_t *sql_trunk_shared_alloc(rlm_sql_t *inst);
+sql_trunk_query_t *sql_trunk_query_enqueue(TALLOC_CTX *ctx, rlm_sql_thread_t *thread,
+					   request_t *request, char const *query_str);
+void		sql_trunk_query_cancel(sql_trunk_query_t *query);
+fr_connection_t	*sql_trunk_escape_alloc(rlm_sql_thread_t *thread);
+int		sql_trunk_escape_handle(rlm_sql_handle_t **out, rlm_sql_thread_t *thread,
+					sql_escape_wait_t *wait, request_t *request);
+void		sql_trunk_escape_wait_cancel(rlm_sql_thread_t *thread, sql_escape_wait_t *wait);
+
 /*
  *	sql_state.c
  */
@@ -0,0 +1,822 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file sql_trunk.c
+ * @brief Run queries on per-thread trunks of non-blocking connections
+ *
+ * Drivers which implement the non-blocking interface in #rlm_sql_driver_t
+ * have their connections managed by a #fr_trunk_t.  Queries are enqueued on
+ * the trunk and the request yields until the driver reports the query is
+ * complete, so a worker can have as many queries outstanding as it has
+ * trunk connections, plus whatever is in the trunk's backlog.
+ *
+ * SQL servers process queries on a connection one at a time, so each
+ * trunk connection only ever has a single query in progress.
+ *
+ * If trunk_threads is set, the trunks are instead owned by a small number
+ * of I/O threads shared by all the workers (see trunk_shared.c).  The I/O
+ * callbacks here may then run outside of the worker, so they only use the
+ * #sql_trunk_request_t, and never the request or the #sql_trunk_query_t.
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#define LOG_PREFIX inst->name
+
+#include <freeradius-devel/unlang/base.h>
+
+#include "rlm_sql.h"
+
+/** A single trunk connection
+ *
+ */
+typedef struct {
+	rlm_sql_t const		*inst;			//!< Module instance.
+	rlm_sql_handle_t	*handle;		//!< Driver handle.
+	fr_connection_t		*conn;			//!< Connection this handle belongs to.
+	int			fd;			//!< The fd we last inserted events for, or -1.
+	bool			open_query;		//!< We're running the open_query.
+	fr_trunk_request_t	*treq;			//!< Request whose query is currently running.
+} sql_trunk_conn_t;
+
+/** Data the muxer needs to send the query, and the result
+ *
+ */
+typedef struct {
+	rlm_sql_t const		*inst;			//!< Module instance.
+	char const		*query_str;		//!< Query to run.
+	fr_event_timer_t const	*ev;			//!< query_timeout timer.
+
+	sql_rcode_t		rcode;			//!< Result of the query.
+	int			affected_rows;		//!< Number of rows the query changed.
+} sql_trunk_request_t;
+
+static void sql_trunk_conn_connecting_io(sql_trunk_conn_t *c, sql_io_t io, sql_rcode_t rcode);
+
+/** Insert I/O events for a connection handle
+ *
+ * The driver's fd may change between calls (e.g. when libpq moves on to the
+ * next host), so we ask for it every time.
+ */
+static int sql_trunk_conn_watch(sql_trunk_conn_t *c, fr_event_list_t *el,
+				fr_event_fd_cb_t read_fn, fr_event_fd_cb_t write_fn, fr_event_error_cb_t error_fn,
+				void *uctx)
+{
+	rlm_sql_t const	*inst = c->inst;
+	int		fd = -1;
+
+	if (inst->driver->sql_fd) fd = inst->driver->sql_fd(c->handle, &inst->config);
+	if (fd < 0) {
+		ERROR("Driver did not provide a file descriptor to wait on");
+		return -1;
+	}
+
+	if ((c->fd >= 0) && (c->fd != fd)) fr_event_fd_delete(el, c->fd, FR_EVENT_FILTER_IO);
+	c->fd = fd;
+
+	if (fr_event_fd_insert(c, el, fd, read_fn, write_fn, error_fn, uctx) < 0) {
+		PERROR("Failed inserting FD event");
+		return -1;
+	}
+
+	return 0;
+}
+
+/** The connection's fd is ready while connecting
+ *
+ */
+static void _sql_trunk_conn_connecting_ready(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	sql_trunk_conn_t	*c = talloc_get_type_abort(uctx, sql_trunk_conn_t);
+	rlm_sql_t const		*inst = c->inst;
+	sql_rcode_t		rcode = RLM_SQL_OK;
+	sql_io_t		io;
+
+	if (c->open_query) {
+		io = inst->driver->sql_query_resume(&rcode, c->handle, &inst->config);
+	} else {
+		io = inst->driver->sql_socket_init_resume(c->handle, &inst->config);
+	}
+
+	sql_trunk_conn_connecting_io(c, io, rcode);
+}
+
+static void _sql_trunk_conn_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, int fd_errno, void *uctx)
+{
+	sql_trunk_conn_t	*c = talloc_get_type_abort(uctx, sql_trunk_conn_t);
+	rlm_sql_t const		*inst = c->inst;
+
+	ERROR("Connection failed: %s", fr_syserror(fd_errno));
+
+	fr_connection_signal_reconnect(c->conn, FR_CONNECTION_FAILED);
+}
+
+/** Advance a connection towards the connected state
+ *
+ * Once the driver has established the connection, we run the open_query
+ * (if there is one) before telling the trunk it can use the connection.
+ */
+static void sql_trunk_conn_connecting_io(sql_trunk_conn_t *c, sql_io_t io, sql_rcode_t rcode)
+{
+	rlm_sql_t const		*inst = c->inst;
+	fr_event_list_t		*el = c->conn->el;
+
+again:
+	switch (io) {
+	case SQL_IO_FAIL:
+	fail:
+		if (c->fd >= 0) {
+			fr_event_fd_delete(el, c->fd, FR_EVENT_FILTER_IO);
+			c->fd = -1;
+		}
+		fr_connection_signal_reconnect(c->conn, FR_CONNECTION_FAILED);
+		return;
+
+	case SQL_IO_WANT_READ:
+		if (sql_trunk_conn_watch(c, el, _sql_trunk_conn_connecting_ready, NULL,
+					 _sql_trunk_conn_error, c) < 0) goto fail;
+		return;
+
+	case SQL_IO_WANT_WRITE:
+		if (sql_trunk_conn_watch(c, el, NULL, _sql_trunk_conn_connecting_ready,
+					 _sql_trunk_conn_error, c) < 0) goto fail;
+		return;
+
+	case SQL_IO_DONE:
+		break;
+	}
+
+	if (c->open_query) {
+		if (rcode != RLM_SQL_OK) {
+			ERROR("open_query failed");
+			rlm_sql_print_error(inst, NULL, c->handle, false);
+			inst->driver->sql_finish_query(c->handle, &inst->config);
+			goto fail;
+		}
+		inst->driver->sql_finish_query(c->handle, &inst->config);
+		c->open_query = false;
+
+	} else if (inst->config.connect_query) {
+		DEBUG2("Executing open_query: %s", inst->config.connect_query);
+
+		c->open_query = true;
+		io = inst->driver->sql_query_async(&rcode, c->handle, &inst->config, inst->config.connect_query);
+		goto again;
+	}
+
+	/*
+	 *	From here on the trunk decides which events
+	 *	we're interested in.
+	 */
+	if (c->fd >= 0) fr_event_fd_delete(el, c->fd, FR_EVENT_FILTER_IO);
+	if (inst->driver->sql_fd) c->fd = inst->driver->sql_fd(c->handle, &inst->config);
+
+	fr_connection_signal_connected(c->conn);
+}
+
+/** Close a trunk connection
+ *
+ */
+static void _sql_trunk_conn_close(fr_event_list_t *el, void *h, UNUSED void *uctx)
+{
+	sql_trunk_conn_t *c = talloc_get_type_abort(h, sql_trunk_conn_t);
+
+	if (c->fd >= 0) {
+		fr_event_fd_delete(el, c->fd, FR_EVENT_FILTER_IO);
+		c->fd = -1;
+	}
+
+	talloc_free(c);
+}
+
+/** Start connecting a trunk connection
+ *
+ */
+static fr_connection_state_t _sql_trunk_conn_init(void **h, fr_connection_t *conn, void *uctx)
+{
+	rlm_sql_t const		*inst = talloc_get_type_abort_const(uctx, rlm_sql_t);
+	sql_trunk_conn_t	*c;
+	sql_io_t		io;
+
+	MEM(c = talloc_zero(conn, sql_trunk_conn_t));
+	c->inst = inst;
+	c->conn = conn;
+	c->fd = -1;
+
+	/*
+	 *	Same layout as the handles the connection
+	 *	pool creates, so the drivers don't care
+	 *	where their handles came from.
+	 */
+	MEM(c->handle = talloc_zero(c, rlm_sql_handle_t));
+	MEM(c->handle->log_ctx = talloc_pool(c->handle, 2048));
+	c->handle->inst = inst;
+
+	io = inst->driver->sql_socket_init_async(c->handle, &inst->config);
+	if (io == SQL_IO_FAIL) {
+		talloc_free(c);
+		return FR_CONNECTION_STATE_FAILED;
+	}
+
+	*h = c;
+
+	/*
+	 *	Signals raised here are deferred until
+	 *	the connection is in the connecting state.
+	 */
+	sql_trunk_conn_connecting_io(c, io, RLM_SQL_OK);
+
+	return FR_CONNECTION_STATE_CONNECTING;
+}
+
+static fr_connection_t *sql_trunk_connection_alloc(fr_trunk_connection_t *tconn, fr_event_list_t *el,
+						   fr_connection_conf_t const *conn_conf,
+						   char const *log_prefix, void *uctx)
+{
+	return fr_connection_alloc(tconn, el,
+				   &(fr_connection_funcs_t){
+					.init = _sql_trunk_conn_init,
+					.close = _sql_trunk_conn_close
+				   },
+				   conn_conf, log_prefix, uctx);
+}
+
+static void _sql_trunk_conn_readable(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+
+	fr_trunk_connection_signal_readable(tconn);
+}
+
+static void _sql_trunk_conn_writable(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+
+	fr_trunk_connection_signal_writable(tconn);
+}
+
+static void _sql_trunk_tconn_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, int fd_errno, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+	sql_trunk_conn_t	*c = talloc_get_type_abort(tconn->conn->h, sql_trunk_conn_t);
+	rlm_sql_t const		*inst = c->inst;
+
+	ERROR("Connection failed: %s", fr_syserror(fd_errno));
+
+	fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+}
+
+static void sql_trunk_connection_notify(fr_trunk_connection_t *tconn, fr_connection_t *conn,
+					fr_event_list_t *el,
+					fr_trunk_connection_event_t notify_on, UNUSED void *uctx)
+{
+	sql_trunk_conn_t	*c = talloc_get_type_abort(conn->h, sql_trunk_conn_t);
+	rlm_sql_t const		*inst = c->inst;
+	fr_event_fd_cb_t	read_fn = NULL;
+	fr_event_fd_cb_t	write_fn = NULL;
+
+	/*
+	 *	Driver completes everything immediately,
+	 *	and the trunk is always writable.
+	 */
+	if (c->fd < 0) return;
+
+	switch (notify_on) {
+	case FR_TRUNK_CONN_EVENT_NONE:
+		fr_event_fd_delete(el, c->fd, FR_EVENT_FILTER_IO);
+		return;
+
+	case FR_TRUNK_CONN_EVENT_READ:
+		read_fn = _sql_trunk_conn_readable;
+		break;
+
+	case FR_TRUNK_CONN_EVENT_WRITE:
+		write_fn = _sql_trunk_conn_writable;
+		break;
+
+	case FR_TRUNK_CONN_EVENT_BOTH:
+		read_fn = _sql_trunk_conn_readable;
+		write_fn = _sql_trunk_conn_writable;
+		break;
+	}
+
+	if (fr_event_fd_insert(c, el, c->fd, read_fn, write_fn, _sql_trunk_tconn_error, tconn) < 0) {
+		PERROR("Failed inserting FD event");
+		fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+	}
+}
+
+/** The query took longer than query_timeout
+ *
+ * There's no portable way of interrupting a query without blocking, so
+ * the query is failed and the connection is closed.
+ */
+static void _sql_trunk_request_timeout(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	fr_trunk_request_t	*treq = talloc_get_type_abort(uctx, fr_trunk_request_t);
+	sql_trunk_request_t	*sreq = talloc_get_type_abort(treq->preq, sql_trunk_request_t);
+	fr_trunk_connection_t	*tconn = treq->tconn;
+	rlm_sql_t const		*inst = sreq->inst;
+
+	switch (treq->state) {
+	case FR_TRUNK_REQUEST_STATE_PARTIAL:
+	case FR_TRUNK_REQUEST_STATE_SENT:
+	{
+		request_t *request = treq->request;
+
+		ROPTIONAL(RERROR, ERROR, "Query timed out after %pVs",
+			  fr_box_time_delta(inst->config.query_timeout));
+		fr_trunk_request_signal_fail(treq);
+	}
+		break;
+
+	default:
+		break;
+	}
+
+	if (tconn) fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+}
+
+/** Process the result of a query which has returned
+ *
+ */
+static void sql_trunk_request_done(sql_trunk_conn_t *c, fr_trunk_request_t *treq, sql_rcode_t rcode)
+{
+	rlm_sql_t const		*inst = c->inst;
+	sql_trunk_request_t	*sreq = talloc_get_type_abort(treq->preq, sql_trunk_request_t);
+	request_t		*request = treq->request;
+
+	ROPTIONAL(RDEBUG2, DEBUG2, "SQL query returned: %s",
+		  fr_table_str_by_value(sql_rcode_description_table, rcode, "<INVALID>"));
+
+	switch (rcode) {
+	case RLM_SQL_OK:
+		sreq->affected_rows = (inst->driver->sql_affected_rows)(c->handle, &inst->config);
+		break;
+
+	/*
+	 *	The connection is bad.  The trunk moves the
+	 *	query to another connection.
+	 */
+	case RLM_SQL_RECONNECT:
+		fr_trunk_connection_signal_reconnect(treq->tconn, FR_CONNECTION_FAILED);
+		return;
+
+	case RLM_SQL_QUERY_INVALID:
+		rlm_sql_print_error(inst, request, c->handle, false);
+		break;
+
+	/*
+	 *	Same rewriting as rlm_sql_query()
+	 */
+	case RLM_SQL_ERROR:
+		if (inst->driver->flags & RLM_SQL_RCODE_FLAGS_ALT_QUERY) {
+			rlm_sql_print_error(inst, request, c->handle, false);
+			break;
+		}
+		rcode = RLM_SQL_ALT_QUERY;
+		FALL_THROUGH;
+
+	case RLM_SQL_ALT_QUERY:
+		rlm_sql_print_error(inst, request, c->handle, true);
+		break;
+
+	default:
+		break;
+	}
+
+	(inst->driver->sql_finish_query)(c->handle, &inst->config);
+
+	sreq->rcode = rcode;
+
+	if (treq->state == FR_TRUNK_REQUEST_STATE_PARTIAL) fr_trunk_request_signal_sent(treq);
+	fr_trunk_request_signal_complete(treq);
+}
+
+/** Move a request along based on what the driver told us
+ *
+ */
+static void sql_trunk_request_io(sql_trunk_conn_t *c, fr_trunk_request_t *treq, sql_io_t io, sql_rcode_t rcode)
+{
+	switch (io) {
+	case SQL_IO_WANT_WRITE:
+		if (treq->state == FR_TRUNK_REQUEST_STATE_PENDING) fr_trunk_request_signal_partial(treq);
+		return;
+
+	case SQL_IO_WANT_READ:
+		if (treq->state != FR_TRUNK_REQUEST_STATE_SENT) fr_trunk_request_signal_sent(treq);
+		return;
+
+	case SQL_IO_FAIL:
+		rlm_sql_print_error(c->inst, treq->request, c->handle, false);
+		fr_trunk_connection_signal_reconnect(treq->tconn, FR_CONNECTION_FAILED);
+		return;
+
+	case SQL_IO_DONE:
+		sql_trunk_request_done(c, treq, rcode);
+		return;
+	}
+}
+
+/** Move a cancelled request along
+ *
+ * The query is still running on the server, and the connection can't
+ * be used for anything else until it finishes.
+ */
+static void sql_trunk_request_cancel_io(sql_trunk_conn_t *c, fr_trunk_request_t *treq, sql_io_t io)
+{
+	rlm_sql_t const *inst = c->inst;
+
+	switch (io) {
+	case SQL_IO_WANT_WRITE:
+		if (treq->state == FR_TRUNK_REQUEST_STATE_CANCEL) fr_trunk_request_signal_cancel_partial(treq);
+		return;
+
+	case SQL_IO_WANT_READ:
+		if (treq->state != FR_TRUNK_REQUEST_STATE_CANCEL_SENT) fr_trunk_request_signal_cancel_sent(treq);
+		return;
+
+	case SQL_IO_FAIL:
+		fr_trunk_connection_signal_reconnect(treq->tconn, FR_CONNECTION_FAILED);
+		return;
+
+	case SQL_IO_DONE:
+		(inst->driver->sql_finish_query)(c->handle, &inst->config);
+
+		if (treq->state != FR_TRUNK_REQUEST_STATE_CANCEL_SENT) fr_trunk_request_signal_cancel_sent(treq);
+		fr_trunk_request_signal_cancel_complete(treq);
+		return;
+	}
+}
+
+static void sql_trunk_request_mux(fr_event_list_t *el, fr_trunk_connection_t *tconn,
+				  fr_connection_t *conn, UNUSED void *uctx)
+{
+	sql_trunk_conn_t	*c = talloc_get_type_abort(conn->h, sql_trunk_conn_t);
+	rlm_sql_t const		*inst = c->inst;
+	fr_trunk_request_t	*treq;
+
+	while (fr_trunk_connection_pop_request(&treq, tconn) == 0) {
+		sql_trunk_request_t	*sreq;
+		request_t		*request;
+		sql_rcode_t		rcode = RLM_SQL_OK;
+		sql_io_t		io;
+
+		if (!treq) break;
+
+		sreq = talloc_get_type_abort(treq->preq, sql_trunk_request_t);
+		request = treq->request;
+
+		/*
+		 *	Finish writing a query
+		 */
+		if (treq->state == FR_TRUNK_REQUEST_STATE_PARTIAL) {
+			io = inst->driver->sql_query_resume(&rcode, c->handle, &inst->config);
+		} else {
+			ROPTIONAL(RDEBUG2, DEBUG2, "Executing query: %s", sreq->query_str);
+
+			c->treq = treq;
+			if (fr_time_delta_ispos(inst->config.query_timeout) &&
+			    (fr_event_timer_in(sreq, el, &sreq->ev, inst->config.query_timeout,
+					       _sql_trunk_request_timeout, treq) < 0)) {
+				ROPTIONAL(RPERROR, PERROR, "Failed inserting query timeout");
+			}
+			io = inst->driver->sql_query_async(&rcode, c->handle, &inst->config, sreq->query_str);
+		}
+
+		sql_trunk_request_io(c, treq, io, rcode);
+	}
+}
+
+static void sql_trunk_request_demux(UNUSED fr_event_list_t *el, UNUSED fr_trunk_connection_t *tconn,
+				    fr_connection_t *conn, UNUSED void *uctx)
+{
+	sql_trunk_conn_t	*c = talloc_get_type_abort(conn->h, sql_trunk_conn_t);
+	rlm_sql_t const		*inst = c->inst;
+	fr_trunk_request_t	*treq = c->treq;
+	sql_rcode_t		rcode = RLM_SQL_OK;
+	sql_io_t		io;
+
+	if (!treq) return;
+
+	io = inst->driver->sql_query_resume(&rcode, c->handle, &inst->config);
+
+	switch (treq->state) {
+	case FR_TRUNK_REQUEST_STATE_PARTIAL:
+	case FR_TRUNK_REQUEST_STATE_SENT:
+		sql_trunk_request_io(c, treq, io, rcode);
+		break;
+
+	case FR_TRUNK_REQUEST_STATE_CANCEL:
+	case FR_TRUNK_REQUEST_STATE_CANCEL_PARTIAL:
+	case FR_TRUNK_REQUEST_STATE_CANCEL_SENT:
+		sql_trunk_request_cancel_io(c, treq, io);
+		break;
+
+	default:
+		break;
+	}
+}
+
+static void sql_trunk_request_cancel_mux(UNUSED fr_event_list_t *el, fr_trunk_connection_t *tconn,
+					 fr_connection_t *conn, UNUSED void *uctx)
+{
+	sql_trunk_conn_t	*c = talloc_get_type_abort(conn->h, sql_trunk_conn_t);
+	rlm_sql_t const		*inst = c->inst;
+	fr_trunk_request_t	*treq;
+
+	while (fr_trunk_connection_pop_cancellation(&treq, tconn) == 0) {
+		sql_rcode_t	rcode;
+
+		if (!treq) break;
+
+		sql_trunk_request_cancel_io(c, treq,
+					    inst->driver->sql_query_resume(&rcode, c->handle, &inst->config));
+	}
+}
+
+/** The request is no longer running on the connection
+ *
+ */
+static void sql_trunk_request_conn_release(fr_connection_t *conn, void *preq_to_reset, UNUSED void *uctx)
+{
+	sql_trunk_request_t	*sreq = talloc_get_type_abort(preq_to_reset, sql_trunk_request_t);
+	sql_trunk_conn_t	*c = conn->h;
+
+	if (sreq->ev) fr_event_timer_delete(&sreq->ev);
+
+	if (c && c->treq && (c->treq->preq == preq_to_reset)) c->treq = NULL;
+}
+
+static void sql_trunk_request_complete(request_t *request, void *preq, void *rctx, UNUSED void *uctx)
+{
+	sql_trunk_request_t	*sreq = talloc_get_type_abort(preq, sql_trunk_request_t);
+	sql_trunk_query_t	*query = talloc_get_type_abort(rctx, sql_trunk_query_t);
+
+	query->treq = NULL;
+	query->sreq = NULL;
+	query->rcode = sreq->rcode;
+	query->affected_rows = sreq->affected_rows;
+	query->returned = true;
+
+	unlang_interpret_mark_runnable(request);
+}
+
+static void sql_trunk_request_fail(request_t *request, UNUSED void *preq, void *rctx,
+				   UNUSED fr_trunk_request_state_t state, UNUSED void *uctx)
+{
+	sql_trunk_query_t	*query = talloc_get_type_abort(rctx, sql_trunk_query_t);
+
+	query->treq = NULL;
+	query->sreq = NULL;
+	query->rcode = RLM_SQL_ERROR;
+	query->returned = true;
+
+	unlang_interpret_mark_runnable(request);
+}
+
+static void sql_trunk_request_free(UNUSED request_t *request, void *preq_to_free, UNUSED void *uctx)
+{
+	talloc_free(preq_to_free);
+}
+
+static fr_trunk_io_funcs_t const sql_trunk_funcs = {
+	.connection_alloc = sql_trunk_connection_alloc,
+	.connection_notify = sql_trunk_connection_notify,
+	.request_mux = sql_trunk_request_mux,
+	.request_demux = sql_trunk_request_demux,
+	.request_cancel_mux = sql_trunk_request_cancel_mux,
+	.request_conn_release = sql_trunk_request_conn_release,
+	.request_complete = sql_trunk_request_complete,
+	.request_fail = sql_trunk_request_fail,
+	.request_free = sql_trunk_request_free
+};
+
+/** Allocate a trunk for a thread
+ *
+ * @param[in] t		Thread instance data.  The trunk is parented by it.
+ * @return
+ *	- A new trunk.
+ *	- NULL on failure.
+ */
+fr_trunk_t *sql_trunk_alloc(rlm_sql_thread_t *t)
+{
+	rlm_sql_t const *inst = t->inst;
+
+	return fr_trunk_alloc(t, t->el, &sql_trunk_funcs, &inst->config.trunk_conf, inst->name, inst, false);
+}
+
+/** Start the I/O threads which own the trunks, when they're shared by all workers
+ *
+ * @param[in] inst	Module instance.  The shared trunk is parented by it.
+ * @return
+ *	- A new shared trunk.
+ *	- NULL on failure.
+ */
+fr_trunk_shared_t *sql_trunk_shared_alloc(rlm_sql_t *inst)
+{
+	/*
+	 *	Each worker can have this many queries queued or
+	 *	running.  Any more fail immediately, as they would
+	 *	if a per-thread trunk's backlog was full.
+	 */
+	return fr_trunk_shared_alloc(inst, inst->name, inst->config.trunk_threads, 4096,
+				     &sql_trunk_funcs, &inst->config.trunk_conf, inst);
+}
+
+/** Enqueue a query on this thread's trunk
+ *
+ * The request should yield if the query hasn't returned by the time this
+ * function does.  It'll be marked runnable when the query completes or fails.
+ *
+ * @param[in] ctx		to allocate the query in.  Usually the module's rctx.
+ * @param[in] t			Thread instance data.
+ * @param[in] request		to run the query for.
+ * @param[in] query_str		Query to run.  Will be copied.
+ * @return
+ *	- A new query.
+ *	- NULL if the query couldn't be enqueued.
+ */
+sql_trunk_query_t *sql_trunk_query_enqueue(TALLOC_CTX *ctx, rlm_sql_thread_t *t,
+					   request_t *request, char const *query_str)
+{
+	sql_trunk_query_t	*query;
+	sql_trunk_request_t	*sreq;
+	fr_trunk_request_t	*treq;
+
+	if (t->shared) {
+		MEM(sreq = talloc_zero(NULL, sql_trunk_request_t));
+		sreq->inst = t->inst;
+		MEM(sreq->query_str = talloc_typed_strdup(sreq, query_str));
+
+		MEM(query = talloc_zero(ctx, sql_trunk_query_t));
+		query->request = request;
+		query->rcode = RLM_SQL_ERROR;
+
+		if (fr_trunk_shared_request_enqueue(&query->sreq, t->shared, request, sreq, query) < 0) {
+			REDEBUG("Failed enqueueing query, too many queries outstanding");
+			talloc_free(sreq);
+			talloc_free(query);
+			return NULL;
+		}
+
+		return query;
+	}
+
+	treq = fr_trunk_request_alloc(t->trunk, request);
+	if (!treq) {
+		REDEBUG("Failed allocating trunk request");
+		return NULL;
+	}
+
+	MEM(sreq = talloc_zero(treq, sql_trunk_request_t));
+	sreq->inst = t->inst;
+	MEM(sreq->query_str = talloc_typed_strdup(sreq, query_str));
+
+	MEM(query = talloc_zero(ctx, sql_trunk_query_t));
+	query->request = request;
+	query->rcode = RLM_SQL_ERROR;
+
+	/*
+	 *	Set before enqueueing, as the query may
+	 *	complete immediately.
+	 */
+	query->treq = treq;
+
+	if (fr_trunk_request_enqueue(&treq, t->trunk, request, sreq, query) < 0) {
+		REDEBUG("Failed enqueueing query");
+		fr_trunk_request_free(&treq);
+		talloc_free(query);
+		return NULL;
+	}
+
+	return query;
+}
+
+/** Stop waiting for a query
+ *
+ * The query continues to run on the server, but the result is discarded.
+ */
+void sql_trunk_query_cancel(sql_trunk_query_t *query)
+{
+	if (query->sreq) {
+		fr_trunk_shared_request_signal_cancel(query->sreq);
+		query->sreq = NULL;
+		return;
+	}
+
+	if (!query->treq) return;
+
+	fr_trunk_request_signal_cancel(query->treq);
+	query->treq = NULL;
+}
+
+/** Wake up the requests waiting for the escape connection
+ *
+ * They check for themselves whether it connected or failed.
+ */
+static void _sql_trunk_escape_watch(UNUSED fr_connection_t *conn, UNUSED fr_connection_state_t prev,
+				    UNUSED fr_connection_state_t state, void *uctx)
+{
+	rlm_sql_thread_t	*t = talloc_get_type_abort(uctx, rlm_sql_thread_t);
+	sql_escape_wait_t	*wait;
+
+	while ((wait = fr_dlist_pop_head(&t->escape_wait))) unlang_interpret_mark_runnable(wait->request);
+}
+
+/** Allocate a connection used only for escaping values
+ *
+ * The drivers' escape functions need a connected handle.  This one is
+ * connected (and reconnected) by the worker's event loop, so expanding a
+ * query for the trunk never has to wait for the connection pool.
+ *
+ * @param[in] t		Thread instance data.  The connection is parented by it.
+ * @return
+ *	- A new connection.
+ *	- NULL on failure.
+ */
+fr_connection_t *sql_trunk_escape_alloc(rlm_sql_thread_t *t)
+{
+	rlm_sql_t const	*inst = t->inst;
+	fr_connection_t	*conn;
+
+	fr_dlist_init(&t->escape_wait, sql_escape_wait_t, entry);
+
+	conn = fr_connection_alloc(t, t->el,
+				   &(fr_connection_funcs_t){
+					.init = _sql_trunk_conn_init,
+					.close = _sql_trunk_conn_close
+				   },
+				   inst->config.trunk_conf.conn_conf, inst->name, inst);
+	if (!conn) return NULL;
+
+	fr_connection_add_watch_post(conn, FR_CONNECTION_STATE_CONNECTED, _sql_trunk_escape_watch, false, t);
+	fr_connection_add_watch_post(conn, FR_CONNECTION_STATE_FAILED, _sql_trunk_escape_watch, false, t);
+
+	fr_connection_signal_init(conn);
+
+	return conn;
+}
+
+/** Get the handle of the thread's escape connection
+ *
+ * If the connection is still being established the request is added to
+ * a list, and marked runnable once the connection is up, or has failed.
+ * The caller should yield, and call this function again when resumed.
+ *
+ * @param[out] out	Where to write the connected handle.
+ * @param[in] t		Thread instance data.
+ * @param[in] wait	Used to wait for the connection.  Usually part of the module's rctx.
+ * @param[in] request	to mark runnable.
+ * @return
+ *	- 0 if out has been set.
+ *	- 1 if the request should yield.
+ *	- -1 if the escape connection isn't available.
+ */
+int sql_trunk_escape_handle(rlm_sql_handle_t **out, rlm_sql_thread_t *t,
+			    sql_escape_wait_t *wait, request_t *request)
+{
+	sql_trunk_conn_t *c;
+
+	if (!t->escape) return -1;
+
+	switch (t->escape->state) {
+	case FR_CONNECTION_STATE_CONNECTED:
+		c = talloc_get_type_abort(t->escape->h, sql_trunk_conn_t);
+		*out = c->handle;
+		return 0;
+
+	case FR_CONNECTION_STATE_INIT:
+	case FR_CONNECTION_STATE_CONNECTING:
+		wait->request = request;
+		fr_dlist_insert_tail(&t->escape_wait, wait);
+		return 1;
+
+	default:
+		return -1;
+	}
+}
+
+/** Stop waiting for the escape connection
+ *
+ */
+void sql_trunk_escape_wait_cancel(rlm_sql_thread_t *t, sql_escape_wait_t *wait)
+{
+	if (fr_dlist_entry_in_list(&wait->entry)) fr_dlist_remove(&t->escape_wait, wait);
+}
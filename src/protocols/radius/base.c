@@ -326,6 +326,107 @@ invalid:
 	return packet_len;
 }
 
+/** Set the authenticator field of a packet, ready for calculating the Message-Authenticator
+ *
+ * @param[in,out] packet	to sign.
+ * @param[in] original		request (only if this is a response).
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+static int radius_ma_vector(uint8_t *packet, uint8_t const *original)
+{
+	switch (packet[0]) {
+	case FR_RADIUS_CODE_ACCOUNTING_RESPONSE:
+	case FR_RADIUS_CODE_DISCONNECT_ACK:
+	case FR_RADIUS_CODE_DISCONNECT_NAK:
+	case FR_RADIUS_CODE_COA_ACK:
+	case FR_RADIUS_CODE_COA_NAK:
+		if (!original) goto need_original;
+		if (original[0] == FR_RADIUS_CODE_STATUS_SERVER) goto do_ack;
+		FALL_THROUGH;
+
+	case FR_RADIUS_CODE_ACCOUNTING_REQUEST:
+	case FR_RADIUS_CODE_DISCONNECT_REQUEST:
+	case FR_RADIUS_CODE_COA_REQUEST:
+		memset(packet + 4, 0, RADIUS_AUTH_VECTOR_LENGTH);
+		break;
+
+	case FR_RADIUS_CODE_ACCESS_ACCEPT:
+	case FR_RADIUS_CODE_ACCESS_REJECT:
+	case FR_RADIUS_CODE_ACCESS_CHALLENGE:
+	do_ack:
+		if (!original) {
+		need_original:
+			fr_strerror_const("Cannot sign response packet without a request packet");
+			return -1;
+		}
+		memcpy(packet + 4, original + 4, RADIUS_AUTH_VECTOR_LENGTH);
+		break;
+
+	case FR_RADIUS_CODE_ACCESS_REQUEST:
+	case FR_RADIUS_CODE_STATUS_SERVER:
+		/* packet + 4 MUST be the Request Authenticator filled with random data */
+		break;
+
+	default:
+		fr_strerror_printf("Cannot sign unknown packet code %u", packet[0]);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Set the authenticator field of a packet, ready for calculating the Request / Response Authenticator
+ *
+ * @param[in,out] packet	to sign.
+ * @param[in] original		request (only if this is a response).
+ * @return
+ *	- <0 on error
+ *	- 0 if the packet doesn't need an authenticator calculating.
+ *	- 1 if the authenticator should be set to MD5(packet + secret).
+ */
+static int radius_authenticator_vector(uint8_t *packet, uint8_t const *original)
+{
+	switch (packet[0]) {
+	case FR_RADIUS_CODE_ACCOUNTING_REQUEST:
+	case FR_RADIUS_CODE_DISCONNECT_REQUEST:
+	case FR_RADIUS_CODE_COA_REQUEST:
+		memset(packet + 4, 0, RADIUS_AUTH_VECTOR_LENGTH);
+		break;
+
+	case FR_RADIUS_CODE_ACCESS_ACCEPT:
+	case FR_RADIUS_CODE_ACCESS_REJECT:
+	case FR_RADIUS_CODE_ACCESS_CHALLENGE:
+	case FR_RADIUS_CODE_ACCOUNTING_RESPONSE:
+	case FR_RADIUS_CODE_DISCONNECT_ACK:
+	case FR_RADIUS_CODE_DISCONNECT_NAK:
+	case FR_RADIUS_CODE_COA_ACK:
+	case FR_RADIUS_CODE_COA_NAK:
+	case FR_RADIUS_CODE_PROTOCOL_ERROR:
+		if (!original) {
+			fr_strerror_const("Cannot sign response packet without a request packet");
+			return -1;
+		}
+		memcpy(packet + 4, original + 4, RADIUS_AUTH_VECTOR_LENGTH);
+		break;
+
+		/*
+		 *	The Request Authenticator is random numbers.
+		 *	We don't need to sign anything else.
+		 */
+	case FR_RADIUS_CODE_ACCESS_REQUEST:
+	case FR_RADIUS_CODE_STATUS_SERVER:
+		return 0;
+
+	default:
+		fr_strerror_printf("Cannot sign unknown packet code %u", packet[0]);
+		return -1;
+	}
+
+	return 1;
+}
+
 /** Sign a previously encoded packet
  *
  * Calculates the request/response authenticator for packets which need it, and fills
@@ -342,6 +443,7 @@ invalid:
 int fr_radius_sign(uint8_t *packet, uint8_t const *original,
 		   uint8_t const *secret, size_t secret_len)
 {
+	int		ret;
 	uint8_t		*msg, *end;
 	size_t		packet_len = (packet[2] << 8) | packet[3];
 
@@ -387,38 +489,7 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *original,
 			return -1;
 		}
 
-		switch (packet[0]) {
-		case FR_RADIUS_CODE_ACCOUNTING_RESPONSE:
-		case FR_RADIUS_CODE_DISCONNECT_ACK:
-		case FR_RADIUS_CODE_DISCONNECT_NAK:
-		case FR_RADIUS_CODE_COA_ACK:
-		case FR_RADIUS_CODE_COA_NAK:
-			if (!original) goto need_original;
-			if (original[0] == FR_RADIUS_CODE_STATUS_SERVER) goto do_ack;
-			FALL_THROUGH;
-
-		case FR_RADIUS_CODE_ACCOUNTING_REQUEST:
-		case FR_RADIUS_CODE_DISCONNECT_REQUEST:
-		case FR_RADIUS_CODE_COA_REQUEST:
-			memset(packet + 4, 0, RADIUS_AUTH_VECTOR_LENGTH);
-			break;
-
-		case FR_RADIUS_CODE_ACCESS_ACCEPT:
-		case FR_RADIUS_CODE_ACCESS_REJECT:
-		case FR_RADIUS_CODE_ACCESS_CHALLENGE:
-		do_ack:
-			if (!original) goto need_original;
-			memcpy(packet + 4, original + 4, RADIUS_AUTH_VECTOR_LENGTH);
-			break;
-
-		case FR_RADIUS_CODE_ACCESS_REQUEST:
-		case FR_RADIUS_CODE_STATUS_SERVER:
-			/* packet + 4 MUST be the Request Authenticator filled with random data */
-			break;
-
-		default:
-			goto bad_packet;
-		}
+		if (radius_ma_vector(packet, original) < 0) return -1;
 
 		/*
 		 *	Force Message-Authenticator to be zero,
@@ -433,44 +504,8 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *original,
 	/*
 	 *	Initialize the request authenticator.
 	 */
-	switch (packet[0]) {
-	case FR_RADIUS_CODE_ACCOUNTING_REQUEST:
-	case FR_RADIUS_CODE_DISCONNECT_REQUEST:
-	case FR_RADIUS_CODE_COA_REQUEST:
-		memset(packet + 4, 0, RADIUS_AUTH_VECTOR_LENGTH);
-		break;
-
-	case FR_RADIUS_CODE_ACCESS_ACCEPT:
-	case FR_RADIUS_CODE_ACCESS_REJECT:
-	case FR_RADIUS_CODE_ACCESS_CHALLENGE:
-	case FR_RADIUS_CODE_ACCOUNTING_RESPONSE:
-	case FR_RADIUS_CODE_DISCONNECT_ACK:
-	case FR_RADIUS_CODE_DISCONNECT_NAK:
-	case FR_RADIUS_CODE_COA_ACK:
-	case FR_RADIUS_CODE_COA_NAK:
-	case FR_RADIUS_CODE_PROTOCOL_ERROR:
-		if (!original) {
-		need_original:
-			fr_strerror_const("Cannot sign response packet without a request packet");
-			return -1;
-		}
-		memcpy(packet + 4, original + 4, RADIUS_AUTH_VECTOR_LENGTH);
-		break;
-
-		/*
-		 *	The Request Authenticator is random numbers.
-		 *	We don't need to sign anything else, so
-		 *	return.
-		 */
-	case FR_RADIUS_CODE_ACCESS_REQUEST:
-	case FR_RADIUS_CODE_STATUS_SERVER:
-		return 0;
-
-	default:
-	bad_packet:
-		fr_strerror_printf("Cannot sign unknown packet code %u", packet[0]);
-		return -1;
-	}
+	ret = radius_authenticator_vector(packet, original);
+	if (ret <= 0) return ret;
 
 	/*
 	 *	Request / Response Authenticator = MD5(packet + secret)
@@ -754,37 +789,32 @@ finish:
 }
 
 
-/** Verify a request / response packet
- *
- *  This function does its work by calling fr_radius_sign(), and then
- *  comparing the signature in the packet with the one we calculated.
- *  If they differ, there's a problem.
+/** Find and save the authenticators of a packet which is about to be verified
  *
- * @param packet the raw RADIUS packet (request or response)
- * @param original the raw original request (if this is a response)
- * @param secret the shared secret
- * @param secret_len the length of the secret
- * @param[in] require_ma	whether we require Message-Authenticator.
+ * @param[in] packet			to verify.
+ * @param[in] require_ma		whether we require Message-Authenticator.
+ * @param[out] msg_p			the Message-Authenticator attribute, or NULL if there isn't one.
+ * @param[out] request_authenticator	copy of the authenticator field.
+ * @param[out] message_authenticator	copy of the Message-Authenticator value.
  * @return
  *	- <0 on error
  *	- 0 on success
  */
-int fr_radius_verify(uint8_t *packet, uint8_t const *original,
-		     uint8_t const *secret, size_t secret_len, bool require_ma)
+static int radius_verify_prepare(uint8_t *packet, bool require_ma, uint8_t **msg_p,
+				 uint8_t request_authenticator[static RADIUS_AUTH_VECTOR_LENGTH],
+				 uint8_t message_authenticator[static RADIUS_AUTH_VECTOR_LENGTH])
 {
-	bool found_ma;
-	int rcode;
 	uint8_t *msg, *end;
 	size_t packet_len = (packet[2] << 8) | packet[3];
-	uint8_t request_authenticator[RADIUS_AUTH_VECTOR_LENGTH];
-	uint8_t message_authenticator[RADIUS_AUTH_VECTOR_LENGTH];
+
+	*msg_p = NULL;
 
 	if (packet_len < RADIUS_HEADER_LENGTH) {
 		fr_strerror_printf("invalid packet length %zd", packet_len);
 		return -1;
 	}
 
-	memcpy(request_authenticator, packet + 4, sizeof(request_authenticator));
+	memcpy(request_authenticator, packet + 4, RADIUS_AUTH_VECTOR_LENGTH);
 
 	/*
 	 *	Find Message-Authenticator.  Its value has to be
@@ -793,7 +823,6 @@ int fr_radius_verify(uint8_t *packet, uint8_t const *original,
 	 */
 	msg = packet + RADIUS_HEADER_LENGTH;
 	end = packet + packet_len;
-	found_ma = false;
 
 	while (msg < end) {
 		if ((end - msg) < 2) goto invalid_attribute;
@@ -818,29 +847,32 @@ int fr_radius_verify(uint8_t *packet, uint8_t const *original,
 		/*
 		 *	Found it, save a copy.
 		 */
-		memcpy(message_authenticator, msg + 2, sizeof(message_authenticator));
-		found_ma = true;
+		memcpy(message_authenticator, msg + 2, RADIUS_AUTH_VECTOR_LENGTH);
+		*msg_p = msg;
 		break;
 	}
 
 	if ((packet[0] == FR_RADIUS_CODE_ACCESS_REQUEST) &&
-	    require_ma && !found_ma) {
+	    require_ma && !*msg_p) {
 		fr_strerror_const("Access-Request is missing the required Message-Authenticator attribute");
 		return -1;
 	}
 
-	/*
-	 *	Implement verification as a signature, followed by
-	 *	checking our signature against the sent one.  This is
-	 *	slightly more CPU work than having verify-specific
-	 *	functions, but it ends up being cleaner in the code.
-	 */
-	rcode = fr_radius_sign(packet, original, secret, secret_len);
-	if (rcode < 0) {
-		fr_strerror_const_push("Failed calculating correct authenticator");
-		return -1;
-	}
+	return 0;
+}
 
+/** Compare the authenticators we calculated with the ones the packet was sent with
+ *
+ * If they differ, the packet is restored to how it was received.
+ *
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+static int radius_verify_check(uint8_t *packet, uint8_t const *original, uint8_t *msg,
+			       uint8_t const request_authenticator[static RADIUS_AUTH_VECTOR_LENGTH],
+			       uint8_t const message_authenticator[static RADIUS_AUTH_VECTOR_LENGTH])
+{
 	/*
 	 *	Check the Message-Authenticator first.
 	 *
@@ -848,10 +880,9 @@ int fr_radius_verify(uint8_t *packet, uint8_t const *original,
 	 *	Message-Authenticator and Request Authenticator
 	 *	fields.
 	 */
-	if ((msg < end) &&
-	    (fr_digest_cmp(message_authenticator, msg + 2, sizeof(message_authenticator)) != 0)) {
-		memcpy(msg + 2, message_authenticator, sizeof(message_authenticator));
-		memcpy(packet + 4, request_authenticator, sizeof(request_authenticator));
+	if (msg && (fr_digest_cmp(message_authenticator, msg + 2, RADIUS_AUTH_VECTOR_LENGTH) != 0)) {
+		memcpy(msg + 2, message_authenticator, RADIUS_AUTH_VECTOR_LENGTH);
+		memcpy(packet + 4, request_authenticator, RADIUS_AUTH_VECTOR_LENGTH);
 
 		fr_strerror_const("invalid Message-Authenticator (shared secret is incorrect)");
 		return -1;
@@ -868,8 +899,8 @@ int fr_radius_verify(uint8_t *packet, uint8_t const *original,
 	/*
 	 *	Check the Request Authenticator.
 	 */
-	if (fr_digest_cmp(request_authenticator, packet + 4, sizeof(request_authenticator)) != 0) {
-		memcpy(packet + 4, request_authenticator, sizeof(request_authenticator));
+	if (fr_digest_cmp(request_authenticator, packet + 4, RADIUS_AUTH_VECTOR_LENGTH) != 0) {
+		memcpy(packet + 4, request_authenticator, RADIUS_AUTH_VECTOR_LENGTH);
 		if (original) {
 			fr_strerror_const("invalid Response Authenticator (shared secret is incorrect)");
 		} else {
@@ -881,6 +912,202 @@ int fr_radius_verify(uint8_t *packet, uint8_t const *original,
 	return 0;
 }
 
+/** Verify a request / response packet
+ *
+ *  This function does its work by calling fr_radius_sign(), and then
+ *  comparing the signature in the packet with the one we calculated.
+ *  If they differ, there's a problem.
+ *
+ * @param packet the raw RADIUS packet (request or response)
+ * @param original the raw original request (if this is a response)
+ * @param secret the shared secret
+ * @param secret_len the length of the secret
+ * @param[in] require_ma	whether we require Message-Authenticator.
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+int fr_radius_verify(uint8_t *packet, uint8_t const *original,
+		     uint8_t const *secret, size_t secret_len, bool require_ma)
+{
+	uint8_t *msg;
+	uint8_t request_authenticator[RADIUS_AUTH_VECTOR_LENGTH];
+	uint8_t message_authenticator[RADIUS_AUTH_VECTOR_LENGTH];
+
+	if (radius_verify_prepare(packet, require_ma, &msg, request_authenticator, message_authenticator) < 0) {
+		return -1;
+	}
+
+	/*
+	 *	Implement verification as a signature, followed by
+	 *	checking our signature against the sent one.  This is
+	 *	slightly more CPU work than having verify-specific
+	 *	functions, but it ends up being cleaner in the code.
+	 */
+	if (fr_radius_sign(packet, original, secret, secret_len) < 0) {
+		fr_strerror_const_push("Failed calculating correct authenticator");
+		return -1;
+	}
+
+	return radius_verify_check(packet, original, msg, request_authenticator, message_authenticator);
+}
+
+/** Verify up to FR_MD5_MULTI_MAX_LANES packets
+ *
+ */
+static void radius_verify_multi(fr_radius_verify_t *packets, size_t num)
+{
+	struct {
+		uint8_t		*msg;
+		uint8_t		request_authenticator[RADIUS_AUTH_VECTOR_LENGTH];
+		uint8_t		message_authenticator[RADIUS_AUTH_VECTOR_LENGTH];
+		uint8_t		k_ipad[64];		//!< HMAC inner padding, the key XORd with ipad.
+		uint8_t		k_opad[64];		//!< HMAC outer padding, the key XORd with opad.
+		uint8_t		inner[MD5_DIGEST_LENGTH];
+	}			state[FR_MD5_MULTI_MAX_LANES];
+	fr_md5_multi_t		md5[FR_MD5_MULTI_MAX_LANES];
+	size_t			idx[FR_MD5_MULTI_MAX_LANES];	//!< Which packet each HMAC belongs to.
+	size_t			i, j, hmac = 0, auth = 0;
+
+	fr_assert(num <= FR_MD5_MULTI_MAX_LANES);
+
+	/*
+	 *	Save the authenticators, and set up the HMAC for
+	 *	packets with a Message-Authenticator.
+	 */
+	for (i = 0; i < num; i++) {
+		fr_radius_verify_t	*v = &packets[i];
+		uint8_t const		*key = v->secret;
+		size_t			key_len = v->secret_len;
+		uint8_t			tk[MD5_DIGEST_LENGTH];
+
+		v->rcode = -1;
+
+		if (v->secret_len > UINT16_MAX) continue;
+
+		if (radius_verify_prepare(v->packet, v->require_ma, &state[i].msg,
+					  state[i].request_authenticator, state[i].message_authenticator) < 0) continue;
+
+		v->rcode = 0;
+		if (!state[i].msg) continue;
+
+		if (radius_ma_vector(v->packet, v->original) < 0) {
+			v->rcode = -1;
+			continue;
+		}
+
+		/* if key is longer than 64 bytes reset it to key=MD5(key) */
+		if (key_len > 64) {
+			fr_md5_calc(tk, key, key_len);
+			key = tk;
+			key_len = sizeof(tk);
+		}
+
+		memset(state[i].k_ipad, 0, sizeof(state[i].k_ipad));
+		memcpy(state[i].k_ipad, key, key_len);
+		memcpy(state[i].k_opad, state[i].k_ipad, sizeof(state[i].k_opad));
+		for (j = 0; j < sizeof(state[i].k_ipad); j++) {
+			state[i].k_ipad[j] ^= 0x36;
+			state[i].k_opad[j] ^= 0x5c;
+		}
+
+		memset(state[i].msg + 2, 0, RADIUS_AUTH_VECTOR_LENGTH);
+
+		idx[hmac] = i;
+		md5[hmac++] = (fr_md5_multi_t) {
+			.in = state[i].k_ipad,
+			.inlen = sizeof(state[i].k_ipad),
+			.in2 = v->packet,
+			.in2len = (v->packet[2] << 8) | v->packet[3],
+			.out = state[i].inner
+		};
+	}
+
+	/*
+	 *	HMAC-MD5 = MD5(K XOR opad, MD5(K XOR ipad, packet))
+	 */
+	if (hmac > 0) {
+		fr_md5_calc_multi(md5, hmac);
+
+		for (j = 0; j < hmac; j++) {
+			i = idx[j];
+
+			md5[j] = (fr_md5_multi_t) {
+				.in = state[i].k_opad,
+				.inlen = sizeof(state[i].k_opad),
+				.in2 = state[i].inner,
+				.in2len = sizeof(state[i].inner),
+				.out = state[i].msg + 2
+			};
+		}
+
+		fr_md5_calc_multi(md5, hmac);
+	}
+
+	/*
+	 *	Request / Response Authenticator = MD5(packet + secret)
+	 */
+	for (i = 0; i < num; i++) {
+		fr_radius_verify_t	*v = &packets[i];
+		int			ret;
+
+		if (v->rcode < 0) continue;
+
+		ret = radius_authenticator_vector(v->packet, v->original);
+		if (ret < 0) {
+			if (state[i].msg) memcpy(state[i].msg + 2, state[i].message_authenticator, RADIUS_AUTH_VECTOR_LENGTH);
+			memcpy(v->packet + 4, state[i].request_authenticator, RADIUS_AUTH_VECTOR_LENGTH);
+			v->rcode = -1;
+			continue;
+		}
+		if (ret == 0) continue;
+
+		md5[auth++] = (fr_md5_multi_t) {
+			.in = v->packet,
+			.inlen = (v->packet[2] << 8) | v->packet[3],
+			.in2 = v->secret,
+			.in2len = v->secret_len,
+			.out = v->packet + 4
+		};
+	}
+
+	if (auth > 0) fr_md5_calc_multi(md5, auth);
+
+	for (i = 0; i < num; i++) {
+		fr_radius_verify_t *v = &packets[i];
+
+		if (v->rcode < 0) continue;
+
+		v->rcode = radius_verify_check(v->packet, v->original, state[i].msg,
+					       state[i].request_authenticator, state[i].message_authenticator);
+	}
+}
+
+/** Verify a burst of request / response packets
+ *
+ *  Gives the same results as calling fr_radius_verify() on each packet,
+ *  but the MD5 calculations for the packets are done in parallel with
+ *  fr_md5_calc_multi().
+ *
+ *  The reason a packet failed isn't kept.  Callers which need it should
+ *  call fr_radius_verify() on the packet again.
+ *
+ * @param[in,out] packets	to verify.  The result for each packet is written
+ *				to its rcode field.
+ * @param[in] num		number of packets.
+ */
+void fr_radius_verify_multi(fr_radius_verify_t *packets, size_t num)
+{
+	while (num > 0) {
+		size_t todo = (num < FR_MD5_MULTI_MAX_LANES) ? num : FR_MD5_MULTI_MAX_LANES;
+
+		radius_verify_multi(packets, todo);
+
+		packets += todo;
+		num -= todo;
+	}
+}
+
 void *fr_radius_next_encodable(fr_dlist_head_t *list, void *to_eval, void *uctx);
 
 void *fr_radius_next_encodable(fr_dlist_head_t *list, void *to_eval, void *uctx)
@@ -1088,10 +1315,13 @@ int fr_radius_init(void)
 
 	if (fr_dict_autoload(libfreeradius_radius_dict) < 0) return -1;
 	if (fr_dict_attr_autoload(libfreeradius_radius_dict_attr) < 0) {
+	fail:
 		fr_dict_autofree(libfreeradius_radius_dict);
 		return -1;
 	}
 
+	if (fr_radius_decode_fast_init() < 0) goto fail;
+
 	instance_count++;
 
 	return 0;
@@ -1101,6 +1331,7 @@ void fr_radius_free(void)
 {
 	if (--instance_count > 0) return;
 
+	fr_radius_decode_fast_free();
 	fr_dict_autofree(libfreeradius_radius_dict);
 }
 
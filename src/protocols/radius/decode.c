@@ -1719,6 +1719,237 @@ done:
 	return attr_len;
 }
 
+/** Vendors whose attributes get a direct lookup table
+ *
+ *  These are the vendors we most often see in Access-Requests and
+ *  Accounting-Requests.  VSAs from other vendors are decoded by
+ *  decode_vsa().
+ */
+static uint32_t const decode_fast_pens[] = {
+	9,			/* Cisco */
+	311,			/* Microsoft */
+	2636,			/* Juniper */
+	4874,			/* ERX */
+	14122,			/* WISPr */
+	14823,			/* Aruba */
+	14988,			/* Mikrotik */
+};
+
+typedef struct {
+	uint32_t		pen;
+	fr_dict_attr_t const	*attrs[UINT8_MAX + 1];	//!< Indexed by vendor attribute number.
+} decode_fast_vendor_t;
+
+/** Lookup tables for attributes which can be decoded without the generic code
+ *
+ *  An entry is only set if the attribute is a leaf which has no tags,
+ *  encryption, or other RADIUS-specific handling.  Anything else is
+ *  NULL, and goes through fr_radius_decode_pair_value() as before.
+ */
+typedef struct {
+	fr_dict_attr_t const	*attrs[UINT8_MAX + 1];	//!< Indexed by top-level attribute number.
+	decode_fast_vendor_t	vendors[NUM_ELEMENTS(decode_fast_pens)];
+	size_t			num_vendors;
+} decode_fast_t;
+
+static decode_fast_t *decode_fast;
+
+static bool decode_fast_attr_ok(fr_dict_attr_t const *parent, fr_dict_attr_t const *da)
+{
+	if (!da || (da->parent != parent)) return false;
+
+	if (!fr_type_is_leaf(da->type)) return false;
+
+	/*
+	 *	Tags, encryption, concat, abinary, etc.
+	 */
+	if (da->flags.subtype || da->flags.extra || da->flags.array) return false;
+
+	/*
+	 *	These have a RADIUS-specific format.
+	 */
+	return (da->type != FR_TYPE_IPV4_PREFIX) && (da->type != FR_TYPE_IPV6_PREFIX);
+}
+
+/** Build the lookup tables for the fast path decoder
+ *
+ *  Called once the RADIUS dictionary has been loaded.  Attributes
+ *  which are added to the dictionary later are still decoded, just
+ *  by the generic code.
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_radius_decode_fast_init(void)
+{
+	fr_dict_attr_t const	*root = fr_dict_root(dict_radius);
+	decode_fast_t		*fast;
+	unsigned int		i, j;
+
+	if (decode_fast) return 0;
+
+	fast = talloc_zero(NULL, decode_fast_t);
+	if (!fast) {
+		fr_strerror_const("Out of memory");
+		return -1;
+	}
+
+	for (i = 1; i <= UINT8_MAX; i++) {
+		fr_dict_attr_t const *da;
+
+		if (i == FR_NAS_FILTER_RULE) continue;
+
+		da = fr_dict_attr_child_by_num(root, i);
+		if (decode_fast_attr_ok(root, da)) fast->attrs[i] = da;
+	}
+
+	for (i = 0; i < NUM_ELEMENTS(decode_fast_pens); i++) {
+		fr_dict_vendor_t const	*dv;
+		fr_dict_attr_t const	*vendor_da;
+		decode_fast_vendor_t	*vendor;
+
+		vendor_da = fr_dict_attr_child_by_num(attr_vendor_specific, decode_fast_pens[i]);
+		if (!vendor_da) continue;
+
+		/*
+		 *	Only the standard VSA format.
+		 */
+		dv = fr_dict_vendor_by_num(dict_radius, decode_fast_pens[i]);
+		if (!dv || (dv->type != 1) || (dv->length != 1) || dv->continuation) continue;
+
+		vendor = &fast->vendors[fast->num_vendors++];
+		vendor->pen = decode_fast_pens[i];
+
+		for (j = 1; j <= UINT8_MAX; j++) {
+			fr_dict_attr_t const *da;
+
+			da = fr_dict_attr_child_by_num(vendor_da, j);
+			if (decode_fast_attr_ok(vendor_da, da)) vendor->attrs[j] = da;
+		}
+	}
+
+	decode_fast = fast;
+
+	return 0;
+}
+
+void fr_radius_decode_fast_free(void)
+{
+	TALLOC_FREE(decode_fast);
+}
+
+/** Decode a value which decode_fast_attr_ok() said is simple
+ *
+ * @return
+ *	- >0 the length of data consumed.
+ *	- 0 if the generic decoder should be used instead, e.g. to create
+ *	  a raw attribute.
+ *	- <0 on error.
+ */
+static inline CC_HINT(always_inline) ssize_t decode_fast_value(TALLOC_CTX *ctx, fr_pair_list_t *out,
+							      fr_dict_attr_t const *da,
+							      uint8_t const *data, size_t data_len)
+{
+	fr_pair_t *vp;
+
+	if ((data_len < fr_radius_attr_sizes[da->type][0]) || (data_len > fr_radius_attr_sizes[da->type][1])) return 0;
+
+	if ((da->type == FR_TYPE_OCTETS) && da->flags.length && (data_len != da->flags.length)) return 0;
+
+	vp = fr_pair_afrom_da(ctx, da);
+	if (!vp) return -1;
+
+	if (fr_value_box_from_network(vp, &vp->data, da->type, da,
+				      &FR_DBUFF_TMP(data, data_len), data_len, true) < 0) {
+		talloc_free(vp);
+		return 0;
+	}
+
+	vp->vp_tainted = true;
+	fr_pair_append(out, vp);
+
+	return data_len;
+}
+
+/** Decode a Vendor-Specific attribute using the vendor lookup tables
+ *
+ *  All of the VSAs must be simple, otherwise the whole attribute is
+ *  left to decode_vsa().
+ */
+static ssize_t decode_fast_vsa(TALLOC_CTX *ctx, fr_pair_list_t *out, uint8_t const *data)
+{
+	uint32_t			pen;
+	size_t				i;
+	uint8_t const			*p, *end;
+	decode_fast_vendor_t const	*vendor = NULL;
+	fr_pair_list_t			tmp;
+
+	if ((data[1] < (2 + 4 + 2)) || (data[2] != 0)) return 0;
+
+	memcpy(&pen, data + 2, sizeof(pen));
+	pen = ntohl(pen);
+
+	for (i = 0; i < decode_fast->num_vendors; i++) {
+		if (decode_fast->vendors[i].pen == pen) {
+			vendor = &decode_fast->vendors[i];
+			break;
+		}
+	}
+	if (!vendor) return 0;
+
+	p = data + 2 + 4;
+	end = data + data[1];
+
+	if (fr_radius_decode_tlv_ok(p, end - p, 1, 1) < 0) return 0;
+
+	fr_pair_list_init(&tmp);
+	while (p < end) {
+		/*
+		 *	Zero-length VSAs are silently ignored.
+		 */
+		if (p[1] > 2) {
+			fr_dict_attr_t const	*da = vendor->attrs[p[0]];
+			ssize_t			ret = 0;
+
+			if (da) ret = decode_fast_value(ctx, &tmp, da, p + 2, p[1] - 2);
+			if (ret <= 0) {
+				fr_pair_list_free(&tmp);
+				return ret;
+			}
+		}
+
+		p += p[1];
+	}
+	fr_pair_list_append(out, &tmp);
+
+	return data[1];
+}
+
+/** Decode the common attributes without going through the generic code
+ *
+ * @return
+ *	- >0 the length of data consumed.
+ *	- 0 if the generic decoder should be used instead.
+ *	- <0 on error.
+ */
+static inline CC_HINT(always_inline) ssize_t decode_fast_pair(TALLOC_CTX *ctx, fr_pair_list_t *out,
+							     uint8_t const *data)
+{
+	fr_dict_attr_t const	*da;
+	ssize_t			ret;
+
+	if (data[0] == FR_VENDOR_SPECIFIC) return decode_fast_vsa(ctx, out, data);
+
+	da = decode_fast->attrs[data[0]];
+	if (!da) return 0;
+
+	ret = decode_fast_value(ctx, out, da, data + 2, data[1] - 2);
+	if (ret <= 0) return ret;
+
+	return 2 + ret;
+}
+
 /** Create a "normal" fr_pair_t from the given data
  *
  */
@@ -1743,6 +1974,15 @@ ssize_t fr_radius_decode_pair(TALLOC_CTX *ctx, fr_pair_list_t *out,
 		packet_ctx->tag_root_ctx = ctx;
 	}
 
+	/*
+	 *	Most attributes are simple, and can skip all of the
+	 *	checks below.
+	 */
+	if (decode_fast && (data[1] > 2)) {
+		ret = decode_fast_pair(ctx, out, data);
+		if (ret != 0) return ret;
+	}
+
 	da = fr_dict_attr_child_by_num(fr_dict_root(dict_radius), data[0]);
 	if (!da) {
 		FR_PROTO_TRACE("Unknown attribute %u", data[0]);
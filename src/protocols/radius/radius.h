@@ -114,6 +114,22 @@ int		fr_radius_sign(uint8_t *packet, uint8_t const *original,
 			       uint8_t const *secret, size_t secret_len) CC_HINT(nonnull (1,3));
 int		fr_radius_verify(uint8_t *packet, uint8_t const *original,
 				 uint8_t const *secret, size_t secret_len, bool require_ma) CC_HINT(nonnull (1,3));
+
+/** A packet to be checked by fr_radius_verify_multi()
+ *
+ */
+typedef struct {
+	uint8_t			*packet;	//!< The raw RADIUS packet (request or response).
+	uint8_t const		*original;	//!< The raw original request (if this is a response).
+	uint8_t const		*secret;	//!< The shared secret.
+	size_t			secret_len;	//!< The length of the secret.
+	bool			require_ma;	//!< Whether we require Message-Authenticator.
+
+	int			rcode;		//!< 0 if the packet verified, < 0 otherwise.
+} fr_radius_verify_t;
+
+void		fr_radius_verify_multi(fr_radius_verify_t *packets, size_t num) CC_HINT(nonnull);
+
 bool		fr_radius_ok(uint8_t const *packet, size_t *packet_len_p,
 			     uint32_t max_attributes, bool require_ma, decode_fail_t *reason) CC_HINT(nonnull (1,2));
 
@@ -221,3 +237,7 @@ ssize_t		fr_radius_decode_tlv(TALLOC_CTX *ctx, fr_pair_list_t *list,
 
 ssize_t		fr_radius_decode_pair(TALLOC_CTX *ctx, fr_pair_list_t *list,
 				      uint8_t const *data, size_t data_len, fr_radius_ctx_t *packet_ctx) CC_HINT(nonnull);
+
+int		fr_radius_decode_fast_init(void);
+
+void		fr_radius_decode_fast_free(void);
@@ -0,0 +1,274 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for the RADIUS attribute decoder
+ *
+ * decode.c is included directly, so that the fast path can be turned
+ * off, and its output compared with the generic decoder.
+ *
+ * @file src/protocols/radius/radius_decode_tests.c
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/conf.h>
+#include <freeradius-devel/util/time.h>
+
+#include "decode.c"
+
+static TALLOC_CTX	*autofree;
+static fr_dict_t	*dict_internal;
+
+/*
+ *	Attributes which take the fast path, attributes which don't,
+ *	and malformed attributes which are decoded as raw.
+ */
+static struct {
+	char const	*name;
+	uint8_t		data[32];
+	size_t		len;
+} decode_vectors[] = {
+	{ "User-Name",			{ 0x01, 0x05, 'b', 'o', 'b' }, 5 },
+	{ "NAS-IP-Address",		{ 0x04, 0x06, 0xc0, 0x00, 0x02, 0x01 }, 6 },
+	{ "NAS-Port",			{ 0x05, 0x06, 0x00, 0x00, 0x00, 0x11 }, 6 },
+	{ "NAS-Port short",		{ 0x05, 0x05, 0x00, 0x00, 0x11 }, 5 },
+	{ "Framed-IP-Address long",	{ 0x08, 0x07, 0x0a, 0x00, 0x00, 0x01, 0x02 }, 7 },
+	{ "Acct-Session-Id",		{ 0x2c, 0x05, 'a', 'b', 'c' }, 5 },
+	{ "Event-Timestamp",		{ 0x37, 0x06, 0x5f, 0x00, 0x00, 0x00 }, 6 },
+	{ "NAS-Port-Type",		{ 0x3d, 0x06, 0x00, 0x00, 0x00, 0x0f }, 6 },
+	{ "Tunnel-Type tagged",		{ 0x40, 0x06, 0x01, 0x00, 0x00, 0x0d }, 6 },
+	{ "Chargeable-User-Identity",	{ 0x59, 0x02 }, 2 },
+	{ "Cisco-AVPair",		{ 0x1a, 0x0f, 0x00, 0x00, 0x00, 0x09,
+					  0x01, 0x09, 'a', '=', 'b', '-', 'c', '=', 'd' }, 15 },
+	{ "Cisco two VSAs",		{ 0x1a, 0x0e, 0x00, 0x00, 0x00, 0x09,
+					  0x01, 0x05, 'a', '=', 'b', 0x02, 0x03, 'x' }, 14 },
+	{ "Cisco unknown VSA",		{ 0x1a, 0x0c, 0x00, 0x00, 0x00, 0x09,
+					  0x01, 0x03, 'a', 0xf0, 0x03, 'b' }, 12 },
+	{ "Cisco empty VSA",		{ 0x1a, 0x0b, 0x00, 0x00, 0x00, 0x09,
+					  0x01, 0x03, 'a', 0x02, 0x02 }, 11 },
+	{ "Cisco malformed VSA",	{ 0x1a, 0x0a, 0x00, 0x00, 0x00, 0x09,
+					  0x01, 0x09, 'a', 'b' }, 10 },
+	{ "WISPr-Location-Name",	{ 0x1a, 0x0b, 0x00, 0x00, 0x37, 0x2a,
+					  0x02, 0x05, 'f', 'o', 'o' }, 11 },
+	{ "MS-CHAP-Challenge",		{ 0x1a, 0x0c, 0x00, 0x00, 0x01, 0x37,
+					  0x0b, 0x06, 0x01, 0x02, 0x03, 0x04 }, 12 },
+	{ "Unknown vendor",		{ 0x1a, 0x09, 0x00, 0x00, 0x04, 0xd2,
+					  0x01, 0x03, 'z' }, 9 },
+};
+
+/*
+ *	A typical Access-Request, without the encrypted attributes.
+ */
+static uint8_t const bench_attrs[] = {
+	0x01, 0x0d, 'b', 'o', 'b', '@', 'e', 'x', 'a', 'm', 'p', 'l', 'e',		/* User-Name */
+	0x04, 0x06, 0xc0, 0x00, 0x02, 0x01,						/* NAS-IP-Address */
+	0x05, 0x06, 0x00, 0x00, 0x00, 0x11,						/* NAS-Port */
+	0x06, 0x06, 0x00, 0x00, 0x00, 0x02,						/* Service-Type */
+	0x07, 0x06, 0x00, 0x00, 0x00, 0x01,						/* Framed-Protocol */
+	0x1e, 0x13, '0', '0', '-', '1', '1', '-', '2', '2', '-', '3', '3',
+		    '-', '4', '4', '-', '5', '5',					/* Called-Station-Id */
+	0x1f, 0x13, '6', '6', '-', '7', '7', '-', '8', '8', '-', '9', '9',
+		    '-', 'a', 'a', '-', 'b', 'b',					/* Calling-Station-Id */
+	0x20, 0x06, 'n', 'a', 's', '1',							/* NAS-Identifier */
+	0x2c, 0x0a, '0', '0', '0', '0', '1', '2', '3', '4',				/* Acct-Session-Id */
+	0x3d, 0x06, 0x00, 0x00, 0x00, 0x0f,						/* NAS-Port-Type */
+	0x57, 0x07, 'e', 't', 'h', '0', '1',						/* NAS-Port-Id */
+	0x1a, 0x19, 0x00, 0x00, 0x00, 0x09,
+		    0x01, 0x13, 's', 'h', 'e', 'l', 'l', ':', 'p', 'r', 'i', 'v',
+				'-', 'l', 'v', 'l', '=', '1', '5',			/* Cisco-AVPair */
+};
+
+#define BENCH_NUM	(100000)
+
+static void test_init(void) __attribute__((constructor));
+static void test_init(void)
+{
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("radius_decode_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	if (!fr_dict_global_ctx_init(autofree, "share/dictionary")) goto error;
+	if (fr_dict_internal_afrom_file(&dict_internal, FR_DICTIONARY_INTERNAL_DIR, __FILE__) < 0) goto error;
+	if (fr_radius_init() < 0) goto error;
+}
+
+static fr_radius_ctx_t *test_packet_ctx_alloc(TALLOC_CTX *ctx)
+{
+	fr_radius_ctx_t	*packet_ctx;
+
+	packet_ctx = talloc_zero(ctx, fr_radius_ctx_t);
+	packet_ctx->secret = "testing123";
+	packet_ctx->tmp_ctx = talloc_zero(packet_ctx, uint8_t);
+
+	return packet_ctx;
+}
+
+static ssize_t test_decode(TALLOC_CTX *ctx, fr_pair_list_t *out, uint8_t const *data, size_t data_len,
+			   fr_radius_ctx_t *packet_ctx)
+{
+	uint8_t const	*p = data, *end = data + data_len;
+	ssize_t		slen;
+
+	packet_ctx->tag_root = NULL;
+	packet_ctx->tag_root_ctx = NULL;
+
+	while (p < end) {
+		slen = fr_radius_decode_pair(ctx, out, p, end - p, packet_ctx);
+		if (slen <= 0) break;
+
+		p += slen;
+	}
+	TALLOC_FREE(packet_ctx->tags);
+
+	return p - data;
+}
+
+/** Print a list, so that lists with unknown attributes can be compared
+ *
+ */
+static void test_print(char *buffer, size_t len, fr_pair_list_t const *list)
+{
+	fr_sbuff_t	out = FR_SBUFF_OUT(buffer, len);
+	fr_pair_t	*vp;
+
+	for (vp = fr_pair_list_head(list); vp; vp = fr_pair_list_next(list, vp)) {
+		(void) fr_pair_print(&out, NULL, vp);
+		(void) fr_sbuff_in_strcpy_literal(&out, ", ");
+	}
+	fr_sbuff_terminate(&out);
+}
+
+static void test_decode_fast_tables(void)
+{
+	TEST_CASE("Tables are built");
+	TEST_ASSERT(decode_fast != NULL);
+
+	TEST_CHECK(decode_fast->attrs[FR_USER_NAME] != NULL);
+	TEST_CHECK(decode_fast->attrs[FR_NAS_PORT] != NULL);
+
+	TEST_CASE("Attributes which need the generic decoder are excluded");
+	TEST_CHECK(decode_fast->attrs[FR_USER_PASSWORD] == NULL);
+	TEST_CHECK(decode_fast->attrs[FR_TUNNEL_TYPE] == NULL);
+	TEST_CHECK(decode_fast->attrs[FR_VENDOR_SPECIFIC] == NULL);
+	TEST_CHECK(decode_fast->attrs[FR_NAS_FILTER_RULE] == NULL);
+	TEST_CHECK(decode_fast->attrs[FR_EAP_MESSAGE] == NULL);
+
+	TEST_CHECK(decode_fast->num_vendors > 0);
+}
+
+/** Check that the fast path and the generic decoder produce the same pairs
+ *
+ */
+static void test_decode_fast_equivalent(void)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("test");
+	fr_radius_ctx_t		*packet_ctx = test_packet_ctx_alloc(ctx);
+	decode_fast_t		*fast = decode_fast;
+	size_t			i;
+
+	for (i = 0; i < NUM_ELEMENTS(decode_vectors); i++) {
+		fr_pair_list_t	a, b;
+		ssize_t		slen_a, slen_b;
+		char		buffer_a[1024], buffer_b[1024];
+
+		fr_pair_list_init(&a);
+		fr_pair_list_init(&b);
+
+		TEST_CASE(decode_vectors[i].name);
+
+		slen_a = test_decode(ctx, &a, decode_vectors[i].data, decode_vectors[i].len, packet_ctx);
+
+		decode_fast = NULL;
+		slen_b = test_decode(ctx, &b, decode_vectors[i].data, decode_vectors[i].len, packet_ctx);
+		decode_fast = fast;
+
+		TEST_CHECK_SLEN(slen_a, (ssize_t)decode_vectors[i].len);
+		TEST_CHECK_SLEN(slen_b, (ssize_t)decode_vectors[i].len);
+		TEST_CHECK(fr_pair_list_len(&a) == fr_pair_list_len(&b));
+
+		test_print(buffer_a, sizeof(buffer_a), &a);
+		test_print(buffer_b, sizeof(buffer_b), &b);
+		TEST_CHECK(strcmp(buffer_a, buffer_b) == 0);
+		TEST_MSG("fast    %s", buffer_a);
+		TEST_MSG("generic %s", buffer_b);
+
+		fr_pair_list_free(&a);
+		fr_pair_list_free(&b);
+	}
+
+	talloc_free(ctx);
+}
+
+static void decode_bench_print(char const *name, fr_time_t start, fr_time_t end)
+{
+	fr_time_delta_t	used = fr_time_sub(end, start);
+
+	TEST_MSG_ALWAYS("%-10s %6" PRIu64 " ns/packet  %10.0lf packets/s", name,
+			fr_time_delta_unwrap(used) / BENCH_NUM,
+			BENCH_NUM / (fr_time_delta_unwrap(used) / (double)NSEC));
+}
+
+static void decode_bench(void)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("bench");
+	fr_radius_ctx_t		*packet_ctx = test_packet_ctx_alloc(ctx);
+	decode_fast_t		*fast = decode_fast;
+	fr_pair_list_t		list;
+	fr_time_t		start, end;
+	size_t			i;
+
+	fr_pair_list_init(&list);
+
+	TEST_MSG_ALWAYS("\n%u x %zu byte Access-Requests\n", BENCH_NUM, sizeof(bench_attrs));
+
+	decode_fast = NULL;
+	start = fr_time();
+	for (i = 0; i < BENCH_NUM; i++) {
+		test_decode(ctx, &list, bench_attrs, sizeof(bench_attrs), packet_ctx);
+		fr_pair_list_free(&list);
+	}
+	end = fr_time();
+	decode_bench_print("generic", start, end);
+	decode_fast = fast;
+
+	start = fr_time();
+	for (i = 0; i < BENCH_NUM; i++) {
+		test_decode(ctx, &list, bench_attrs, sizeof(bench_attrs), packet_ctx);
+		fr_pair_list_free(&list);
+	}
+	end = fr_time();
+	decode_bench_print("fast", start, end);
+
+	talloc_free(ctx);
+}
+
+TEST_LIST = {
+	/*
+	 *	Basic tests
+	 */
+	{ "decode_fast_tables",		test_decode_fast_tables },
+	{ "decode_fast_equivalent",	test_decode_fast_equivalent },
+
+	/*
+	 *	Benchmarks
+	 */
+	{ "decode_bench",		decode_bench },
+	{ NULL }
+};
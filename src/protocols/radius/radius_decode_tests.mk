@@ -0,0 +1,9 @@
+TARGET		:= radius_decode_tests
+
+SOURCES		:= radius_decode_tests.c
+
+SRC_CFLAGS	:= -D_LIBRADIUS -DNO_ASSERT -I$(top_builddir)/src
+
+TGT_LDLIBS	:= $(LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS)
+TGT_PREREQS	:= libfreeradius-util.a libfreeradius-radius.a